@@ -0,0 +1,108 @@
+/*
+ * Device module for EnumerationTest, built once for each module of the test.
+ * It has two device implementations with one device each, named
+ * DEVICE_PREFIX "1" and DEVICE_PREFIX "2". The first implementation waits
+ * FIRST_DELAY_MS before enumerating, so that the devices finish enumerating
+ * out of order.
+ */
+
+#include "OpenScanDeviceLib.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+static void SleepMilliseconds(long ms) {
+#ifdef _WIN32
+    Sleep((DWORD)ms);
+#else
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+#endif
+}
+
+static OScDev_DeviceImpl g_FirstImpl;
+static OScDev_DeviceImpl g_SecondImpl;
+
+static OScDev_Error FirstGetModelName(const char **name) {
+    *name = DEVICE_PREFIX "Model1";
+    return OScDev_OK;
+}
+
+static OScDev_Error SecondGetModelName(const char **name) {
+    *name = DEVICE_PREFIX "Model2";
+    return OScDev_OK;
+}
+
+static OScDev_Error EnumerateOne(OScDev_DeviceImpl *impl,
+                                 OScDev_PtrArray **devices) {
+    *devices = OScDev_PtrArray_Create();
+
+    OScDev_Error errCode;
+    OScDev_Device *device = NULL;
+    errCode = OScDev_Device_Create(&device, impl, NULL);
+    if (errCode) {
+        OScDev_PtrArray_Destroy(*devices);
+        *devices = NULL;
+        return errCode;
+    }
+    OScDev_PtrArray_Append(*devices, device);
+    return OScDev_OK;
+}
+
+static OScDev_Error FirstEnumerateInstances(OScDev_PtrArray **devices) {
+    SleepMilliseconds(FIRST_DELAY_MS);
+    return EnumerateOne(&g_FirstImpl, devices);
+}
+
+static OScDev_Error SecondEnumerateInstances(OScDev_PtrArray **devices) {
+    return EnumerateOne(&g_SecondImpl, devices);
+}
+
+static OScDev_Error ReleaseInstance(OScDev_Device *device) {
+    (void)device;
+    return OScDev_OK;
+}
+
+static OScDev_Error FirstGetName(OScDev_Device *device, char *name) {
+    (void)device;
+    strncpy(name, DEVICE_PREFIX "1", OScDev_MAX_STR_LEN);
+    return OScDev_OK;
+}
+
+static OScDev_Error SecondGetName(OScDev_Device *device, char *name) {
+    (void)device;
+    strncpy(name, DEVICE_PREFIX "2", OScDev_MAX_STR_LEN);
+    return OScDev_OK;
+}
+
+static OScDev_DeviceImpl g_FirstImpl = {
+    .GetModelName = FirstGetModelName,
+    .EnumerateInstances = FirstEnumerateInstances,
+    .ReleaseInstance = ReleaseInstance,
+    .GetName = FirstGetName,
+    // Other required methods omitted.
+};
+
+static OScDev_DeviceImpl g_SecondImpl = {
+    .GetModelName = SecondGetModelName,
+    .EnumerateInstances = SecondEnumerateInstances,
+    .ReleaseInstance = ReleaseInstance,
+    .GetName = SecondGetName,
+    // Other required methods omitted.
+};
+
+static OScDev_Error GetDeviceImpls(OScDev_PtrArray **deviceImpls) {
+    *deviceImpls = OScDev_PtrArray_CreateFromNullTerminated(
+        (void *[]){&g_FirstImpl, &g_SecondImpl, NULL});
+    return OScDev_OK;
+}
+
+OScDev_MODULE_IMPL = {
+    .displayName = "Enumeration Test Module for OpenScan",
+    .GetDeviceImpls = GetDeviceImpls,
+};
@@ -0,0 +1,84 @@
+/*
+ * Enumerates the EnumerationTest modules, which are enumerated concurrently
+ * and finish out of order, and checks that their devices are listed in
+ * module and implementation order. The module that takes longer than the
+ * time limit must be skipped, and its devices must not appear when it
+ * finishes later.
+ */
+
+#include "OpenScanLib.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+// Must be between the delays of the quick modules and the slow module (see
+// meson.build)
+#define TIMEOUT_SECONDS 1.5
+#define SLOW_MODULE_DELAY_MS 3000
+
+static void SleepMilliseconds(long ms) {
+#ifdef _WIN32
+    Sleep((DWORD)ms);
+#else
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+#endif
+}
+
+static int CheckDevices(void) {
+    static const char *const expected[] = {"A1", "A2", "B1", "B2"};
+    const size_t nExpected = sizeof(expected) / sizeof(expected[0]);
+
+    OSc_Device **devices;
+    size_t count;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OSc_GetAllDevices(&devices, &count))) {
+        fprintf(stderr, "Could not get all devices\n");
+        return __LINE__;
+    }
+
+    printf("Count of devices = %zu\n", count);
+    for (size_t i = 0; i < count; ++i) {
+        const char *name;
+        OSc_Device_GetName(devices[i], &name);
+        printf("Device %zu: %s\n", i, name);
+        if (i >= nExpected || strcmp(name, expected[i]) != 0)
+            return __LINE__;
+    }
+    if (count != nExpected)
+        return __LINE__;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (!OSc_CheckVersion()) {
+        fprintf(stderr, "OpenScanLib ABI version mismatch\n");
+        return __LINE__;
+    }
+
+    if (argc != 2) {
+        fprintf(stderr,
+                "Expected 1 argument (directory containing the modules)\n");
+        return __LINE__;
+    }
+
+    const char *paths[2];
+    paths[0] = argv[1];
+    paths[1] = NULL;
+    OSc_SetDeviceModuleSearchPaths(paths);
+    OSc_SetDeviceEnumerationTimeout(TIMEOUT_SECONDS);
+
+    int ret = CheckDevices();
+    if (ret)
+        return ret;
+
+    // Let the slow module finish, then check that the list is unchanged
+    SleepMilliseconds(SLOW_MODULE_DELAY_MS);
+    return CheckDevices();
+}
@@ -2,24 +2,55 @@
 
 #include <ss8str.h>
 
+#include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 #ifdef _WIN32
 #include <Windows.h>
+#else
+#include <dlfcn.h>
 #endif
 
+// Whether the module file at 'path' is loaded in this process
+static bool IsModuleLoaded(const char *path) {
+#ifdef _WIN32
+    return GetModuleHandleA(path) != NULL;
+#else
+    void *handle = dlopen(path, RTLD_LAZY | RTLD_NOLOAD);
+    if (handle)
+        dlclose(handle);
+    return handle != NULL;
+#endif
+}
+
 int main(int argc, char *argv[]) {
     if (!OSc_CheckVersion()) {
         fprintf(stderr, "OpenScanLib ABI version mismatch\n");
         return __LINE__;
     }
 
-    if (argc != 2) {
-        fprintf(stderr,
-                "Expected 1 argument (module whose directory to test)\n");
+    if (argc < 2 || argc > 4 || (argc > 2 && strcmp(argv[2], "lazy"))) {
+        fprintf(stderr, "Expected 1 to 3 arguments (module whose directory "
+                        "to test, \"lazy\", device manifest to create)\n");
         return __LINE__;
     }
 
+    // With lazy loading, the module is unloaded after enumeration and its
+    // devices are listed as deferred devices, which are bound to the
+    // module's devices (loading it again) when opened
+    bool lazy = argc > 2;
+    const char *manifest = argc > 3 ? argv[3] : NULL;
+    if (lazy) {
+        printf("Loading device modules lazily\n");
+        OSc_SetDeviceModuleLazyLoading(true);
+    }
+    if (manifest) {
+        printf("Using \"%s\" as device manifest\n", manifest);
+        remove(manifest);
+        OSc_SetDeviceManifestCache(manifest);
+    }
+
     printf("Using directory containing \"%s\" as search path\n", argv[1]);
     ss8str dir;
     ss8_init_copy_cstr(&dir, argv[1]);
@@ -64,5 +95,46 @@ int main(int argc, char *argv[]) {
         printf("Device %zu: %s\n", i, name);
     }
 
+    if (manifest) {
+        FILE *fp = fopen(manifest, "r");
+        if (!fp) {
+            fprintf(stderr, "Device manifest was not written\n");
+            return __LINE__;
+        }
+        fclose(fp);
+    }
+
+    if (lazy) {
+        if (IsModuleLoaded(argv[1])) {
+            fprintf(stderr, "Module still loaded after enumeration\n");
+            return __LINE__;
+        }
+
+        OSc_LSM *lsm;
+        OSc_LSM_Create(&lsm);
+        if (OSc_CHECK_ERROR(err, OSc_Device_Open(devices[0], lsm))) {
+            fprintf(stderr, "Could not open deferred device\n");
+            return __LINE__;
+        }
+        const char *name;
+        OSc_Device_GetDisplayName(devices[0], &name);
+        printf("Opened deferred device: %s\n", name);
+        OSc_LSM_Destroy(lsm);
+
+        // The bound device keeps the module loaded
+        if (!IsModuleLoaded(argv[1])) {
+            fprintf(stderr, "Module not loaded for the opened device\n");
+            return __LINE__;
+        }
+    }
+
+    if (manifest) {
+        if (OSc_CHECK_ERROR(err, OSc_RefreshDeviceManifest())) {
+            fprintf(stderr, "Could not refresh device manifest\n");
+            return __LINE__;
+        }
+        remove(manifest);
+    }
+
     return 0;
 }
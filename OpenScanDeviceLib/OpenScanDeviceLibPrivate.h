@@ -22,6 +22,9 @@ extern "C" {
 #else
 #ifdef _MSC_VER
 #define OScDevInternal_ENTRY_POINT_EXPORT __declspec(dllexport)
+#elif defined(__GNUC__)
+#define OScDevInternal_ENTRY_POINT_EXPORT                                     \
+    __attribute__((visibility("default")))
 #else
 #error Not implemented for this platform.
 #endif
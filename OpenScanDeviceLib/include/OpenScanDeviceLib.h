@@ -80,6 +80,8 @@ extern "C" {
  *   `OScDevInternal_Interface`
  * - A previously required device implementation field becomes optional
  * - An optional field is added at the end of a device implementation struct
+ *   (OpenScanLib must then check the module's minor version before reading
+ *   it, since older modules' structs end before it)
  * - A new `enum` constant is added (at the end) to an `enum` type that is
  *   not interpreted by modules
  *
@@ -90,7 +92,7 @@ extern "C" {
  * set of changes is to be made over multiple commits, the version number
  * can be set to `(-1, 0)` in intermediate commits to indicate "experimental".
  */
-#define OScDevInternal_ABI_VERSION OScDevInternal_MAKE_VERSION(13, 0)
+#define OScDevInternal_ABI_VERSION OScDevInternal_MAKE_VERSION(13, 4)
 
 /** \addtogroup dpi
  * @{
@@ -217,6 +219,54 @@ enum {
     OScDev_ClockSource_External,
 };
 
+/// Kind of a time-tag record.
+/**
+ * \see OScDev_TimeTag_Make()
+ */
+typedef int32_t OScDev_TimeTagKind;
+enum {
+    /// A detected photon
+    OScDev_TimeTagKind_Photon,
+    /// Start of a scan line (the channel and microtime are ignored)
+    OScDev_TimeTagKind_LineStart,
+    /// End of a frame (the channel and microtime are ignored)
+    OScDev_TimeTagKind_FrameEnd,
+};
+
+/// Format of the samples of a detector channel.
+/**
+ * All multi-byte formats are in native byte order.
+ *
+ * \see OScDev_DeviceImpl::GetSampleFormat
+ */
+typedef int32_t OScDev_SampleFormat;
+enum {
+    /// Unsigned 8-bit integer
+    OScDev_SampleFormat_UInt8,
+    /// Unsigned 12-bit integer in the low bits of a 16-bit word
+    OScDev_SampleFormat_UInt12,
+    /// Unsigned 12-bit integers packed 2 per 3 bytes
+    /**
+     * Sample `2k` occupies byte `3k` and the low 4 bits of byte `3k + 1`;
+     * sample `2k + 1` occupies the high 4 bits of byte `3k + 1` and byte
+     * `3k + 2` (low-order bits first). A frame of `n` samples occupies
+     * `(3n + 1) / 2` bytes.
+     */
+    OScDev_SampleFormat_UInt12Packed,
+    /// Unsigned 16-bit integer
+    OScDev_SampleFormat_UInt16,
+    /// Unsigned 32-bit integer
+    OScDev_SampleFormat_UInt32,
+    /// Signed 8-bit integer
+    OScDev_SampleFormat_Int8,
+    /// Signed 16-bit integer
+    OScDev_SampleFormat_Int16,
+    /// Signed 32-bit integer
+    OScDev_SampleFormat_Int32,
+    /// IEEE 754 single-precision floating point
+    OScDev_SampleFormat_Float32,
+};
+
 typedef int32_t OScDev_ValueType;
 enum {
     OScDev_ValueType_String,
@@ -448,6 +498,25 @@ struct OScDevInternal_Interface {
     bool (*Acquisition_CallFrameCallback)(OScDev_ModuleImpl *modImpl,
                                           OScDev_Acquisition *acq,
                                           uint32_t channel, void *pixels);
+
+    uint32_t (*Acquisition_GetSamplesPerPixel)(OScDev_ModuleImpl *modImpl,
+                                               OScDev_Acquisition *acq);
+
+    bool (*Acquisition_CallTimeTagCallback)(OScDev_ModuleImpl *modImpl,
+                                            OScDev_Acquisition *acq,
+                                            const uint64_t *timeTags,
+                                            size_t count);
+
+    OScDev_Error (*DeinterleaveChannels)(OScDev_ModuleImpl *modImpl,
+                                         const void *src, void *const *dst,
+                                         uint32_t nChannels,
+                                         uint32_t bytesPerSample,
+                                         size_t samplesPerChannel);
+    OScDev_Error (*InterleaveChannels)(OScDev_ModuleImpl *modImpl,
+                                       const void *const *src, void *dst,
+                                       uint32_t nChannels,
+                                       uint32_t bytesPerSample,
+                                       size_t samplesPerChannel);
 };
 
 /// The module implementation function table.
@@ -512,8 +581,9 @@ struct OScDev_ModuleImpl {
      * `deviceImpls` must be an array of `struct` ::OScDev_DeviceImpl objects.
      * OpenScanLib takes ownership of the array (unless the array is statically
      * defined). The device implementation objects must remain valid while this
-     * module remains loaded (i.e. indefinitely since we do not support
-     * unloading).
+     * module remains loaded. The module may be unloaded (after `Close`) and
+     * loaded again while none of its devices is in use, if the application
+     * loads modules lazily.
      */
     OScDev_Error (*GetDeviceImpls)(OScDev_PtrArray **deviceImpls);
 };
@@ -544,6 +614,14 @@ struct OScDev_DeviceImpl {
      * It is OpenScanLib's responsibility to ensure that no more than 1
      * instance of the same device (as identified by `GetName`) is ever opened
      * at the same time.
+     *
+     * This function is called on a thread of OpenScanLib's, concurrently
+     * with the `EnumerateInstances` of the other device implementations of
+     * this module (and of other modules). Device implementations that share
+     * state, such as an SDK that is not thread-safe, must synchronize their
+     * enumeration. If the application's time limit for enumeration expires,
+     * OpenScanLib stops waiting for the module, but this function still runs
+     * to completion, and the devices it returns are then released.
      */
     OScDev_Error (*EnumerateInstances)(OScDev_PtrArray **devices);
 
@@ -725,7 +803,8 @@ struct OScDev_DeviceImpl {
 
     /// Return the bytes per sample given current settings
     /**
-     * Values other than 2 (16-bit) are not currently supported.
+     * Devices that do not implement GetSampleFormat() deliver unsigned
+     * integer samples of this size, which must be 1, 2, or 4.
      *
      * **Required** if this device has a detector.
      */
@@ -877,6 +956,21 @@ struct OScDev_DeviceImpl {
      * changes using a callback interface.
      */
     OScDev_Error (*Wait)(OScDev_Device *device);
+
+    /// Return the sample format of a channel given current settings.
+    /**
+     * Channels of one device may differ in format. OpenScanLib converts the
+     * frames of all detectors to a common format (negotiated by the
+     * acquisition template) before further processing, so the device should
+     * report the format in which the hardware natively produces data. The
+     * frames passed to OScDev_Acquisition_CallFrameCallback() must be in
+     * this format.
+     *
+     * **Optional**; the default implementation reports an unsigned integer
+     * format with the size returned by GetBytesPerSample().
+     */
+    OScDev_Error (*GetSampleFormat)(OScDev_Device *device, uint32_t channel,
+                                    OScDev_SampleFormat *format);
 };
 
 struct OScDev_SettingImpl {
@@ -1332,6 +1426,20 @@ OScDev_API void OScDev_Acquisition_GetROI(OScDev_Acquisition *acq,
         &OScDevInternal_TheModuleImpl, acq, xOffset, yOffset, width, height);
 }
 
+/// Determine the number of raw samples per pixel for the given acquisition.
+/**
+ * This is 1 unless the application has enabled photon counting, in which
+ * case the detector must send this many consecutive raw samples for each
+ * pixel, so that each call to `OScDev_Acquisition_CallFrameCallback()`
+ * passes width x height x samples-per-pixel samples. Detectors that cannot
+ * oversample should fail to arm when this is not 1.
+ */
+OScDev_API uint32_t
+OScDev_Acquisition_GetSamplesPerPixel(OScDev_Acquisition *acq) {
+    return OScDevInternal_FunctionTable->Acquisition_GetSamplesPerPixel(
+        &OScDevInternal_TheModuleImpl, acq);
+}
+
 /// Send acquired data for one channel of a frame.
 /**
  * This function must be called during an acquisition by the device that owns
@@ -1345,7 +1453,8 @@ OScDev_API void OScDev_Acquisition_GetROI(OScDev_Acquisition *acq,
  *
  * \param[in] acq the acquisition that was given when arming this device
  * \param[in] channel the channel index
- * \param[in] pixels the raw pixel data for the channel
+ * \param[in] pixels the raw pixel data for the channel, in the format reported
+ * by the device's `GetSampleFormat()`
  * \return `true` normally, or `false` if the application requests
  * cancellation of the acquisition, in which case the module should stop the
  * acquisition as soon as practical
@@ -1357,6 +1466,93 @@ OScDev_API bool OScDev_Acquisition_CallFrameCallback(OScDev_Acquisition *acq,
         &OScDevInternal_TheModuleImpl, acq, channel, pixels);
 }
 
+/// Pack a time-tag record.
+/**
+ * Time-tag records are 64-bit values with the following layout:
+ * - bits 0-39: macrotime (typically laser sync periods), modulo 2^40
+ * - bits 40-55: microtime (TCSPC time bin within the sync period)
+ * - bits 56-61: device-local channel index
+ * - bits 62-63: kind (`OScDev_TimeTagKind`)
+ *
+ * \see OScDev_Acquisition_CallTimeTagCallback()
+ */
+OScDev_API uint64_t OScDev_TimeTag_Make(OScDev_TimeTagKind kind,
+                                        uint32_t channel, uint32_t microtime,
+                                        uint64_t macrotime) {
+    return ((uint64_t)(kind & 0x3) << 62) |
+           ((uint64_t)(channel & 0x3f) << 56) |
+           ((uint64_t)(microtime & 0xffff) << 40) |
+           (macrotime & 0xffffffffffULL);
+}
+
+/// Send a batch of time-tagged photon records.
+/**
+ * Detectors that time-tag individual photons (such as TCSPC devices) call
+ * this function, instead of `OScDev_Acquisition_CallFrameCallback()`, to
+ * deliver their data as a stream of records created with
+ * `OScDev_TimeTag_Make()`, in order of macrotime. Line start and frame end
+ * markers in the stream determine the pixel position of each photon; pixel
+ * boundaries within a line are derived from the pixel rate of the
+ * acquisition. OpenScanLib forwards the records to the application and, if
+ * the application has enabled it, builds per-pixel lifetime histograms
+ * which it delivers as frames.
+ *
+ * The same threading rules as for `OScDev_Acquisition_CallFrameCallback()`
+ * apply, except that calls for a given acquisition must not be made
+ * concurrently from multiple threads of a device.
+ *
+ * \param[in] acq the acquisition that was given when arming this device
+ * \param[in] timeTags the records
+ * \param[in] count the number of records
+ * \return `true` normally, or `false` if the application requests
+ * cancellation of the acquisition
+ */
+OScDev_API bool
+OScDev_Acquisition_CallTimeTagCallback(OScDev_Acquisition *acq,
+                                       const uint64_t *timeTags,
+                                       size_t count) {
+    return OScDevInternal_FunctionTable->Acquisition_CallTimeTagCallback(
+        &OScDevInternal_TheModuleImpl, acq, timeTags, count);
+}
+
+/// Split channel-interleaved samples into one buffer per channel.
+/**
+ * Converts `samplesPerChannel` frames of `nChannels` interleaved samples (as
+ * returned by many DAQ devices) into the planar layout expected by
+ * `OScDev_Acquisition_CallFrameCallback()`. Kernels optimized for the
+ * processor in use are provided for 2, 3, 4, and 8 channels.
+ *
+ * \param[in] src the interleaved samples
+ * \param[in] dst array of `nChannels` buffers, each receiving
+ * `samplesPerChannel` samples
+ * \param[in] nChannels the number of channels
+ * \param[in] bytesPerSample 1, 2, or 4
+ * \param[in] samplesPerChannel the number of samples in each channel
+ */
+OScDev_API OScDev_Error OScDev_DeinterleaveChannels(const void *src,
+                                                    void *const *dst,
+                                                    uint32_t nChannels,
+                                                    uint32_t bytesPerSample,
+                                                    size_t samplesPerChannel) {
+    return OScDevInternal_FunctionTable->DeinterleaveChannels(
+        &OScDevInternal_TheModuleImpl, src, dst, nChannels, bytesPerSample,
+        samplesPerChannel);
+}
+
+/// Combine per-channel sample buffers into channel-interleaved samples.
+/**
+ * This is the reverse of `OScDev_DeinterleaveChannels()`.
+ */
+OScDev_API OScDev_Error OScDev_InterleaveChannels(const void *const *src,
+                                                  void *dst,
+                                                  uint32_t nChannels,
+                                                  uint32_t bytesPerSample,
+                                                  size_t samplesPerChannel) {
+    return OScDevInternal_FunctionTable->InterleaveChannels(
+        &OScDevInternal_TheModuleImpl, src, dst, nChannels, bytesPerSample,
+        samplesPerChannel);
+}
+
 #undef OScDev_API
 
 #endif // OScDevInternal_BUILDING_OPENSCANLIB
@@ -91,7 +91,7 @@ extern "C" {
  *
  * The above list is not comprehensive.
  */
-#define OScInternal_ABI_VERSION OScInternal_MAKE_VERSION(5, 0)
+#define OScInternal_ABI_VERSION OScInternal_MAKE_VERSION(5, 23)
 
 /**
  * \addtogroup api
@@ -186,6 +186,83 @@ enum {
     OSc_ValueConstraint_Continuous,
 };
 
+/**
+ * \brief Format of image samples.
+ *
+ * Multi-byte formats are in native byte order. The packed format is only
+ * produced by detector devices; the samples passed to the frame callback are
+ * always in one of the other formats.
+ *
+ * See enum constants starting with `OSc_SampleFormat_`.
+ */
+typedef int32_t OSc_SampleFormat;
+
+/** \brief Constants for #OSc_SampleFormat */
+enum {
+    OSc_SampleFormat_UInt8,
+    /** \brief Unsigned 12-bit integer in the low bits of a 16-bit word */
+    OSc_SampleFormat_UInt12,
+    /** \brief Unsigned 12-bit integers packed 2 per 3 bytes */
+    OSc_SampleFormat_UInt12Packed,
+    OSc_SampleFormat_UInt16,
+    OSc_SampleFormat_UInt32,
+    OSc_SampleFormat_Int8,
+    OSc_SampleFormat_Int16,
+    OSc_SampleFormat_Int32,
+    OSc_SampleFormat_Float32,
+
+    /**
+     * \brief Let OpenScanLib choose the format (only for
+     * OSc_AcqTemplate_SetSampleFormat())
+     */
+    OSc_SampleFormat_Auto = -1,
+};
+
+/**
+ * \brief Instruction set level of the SIMD kernels used for processing.
+ *
+ * Each level includes the ones before it. OpenScanLib selects, at run time,
+ * the highest level supported by the processor and operating system. The
+ * environment variable `OSC_SIMD_LEVEL` (set to `scalar`, `sse4.2`, `avx2`,
+ * or `avx512`) can lower the level, for example to test the portable code
+ * paths.
+ *
+ * See enum constants starting with `OSc_SIMDLevel_`.
+ *
+ * \sa OSc_GetSIMDLevel()
+ */
+typedef int32_t OSc_SIMDLevel;
+
+/** \brief Constants for #OSc_SIMDLevel */
+enum {
+    /** \brief Portable C code only */
+    OSc_SIMDLevel_Scalar,
+    /** \brief SSE2 through SSE4.2, including SSSE3 */
+    OSc_SIMDLevel_SSE42,
+    OSc_SIMDLevel_AVX2,
+    /** \brief AVX-512 Foundation and Byte/Word instructions */
+    OSc_SIMDLevel_AVX512,
+};
+
+/**
+ * \brief Compression of frames recorded by the storage pipeline stages.
+ *
+ * See enum constants starting with `OSc_StorageCompression_`.
+ *
+ * \sa OSc_Acquisition_SetStorageCompression()
+ */
+typedef int32_t OSc_StorageCompression;
+
+/** \brief Constants for #OSc_StorageCompression */
+enum {
+    OSc_StorageCompression_None,
+    /**
+     * \brief OpenScanLib's lossless codec for detector data (see
+     * OSc_DecodeLosslessFrame())
+     */
+    OSc_StorageCompression_Lossless,
+};
+
 /**
  * \brief An LSM object, which integrates clock, scanner, and detector
  * functionality.
@@ -269,6 +346,273 @@ typedef void (*OSc_SettingInvalidateFunc)(OSc_Setting *setting, void *data);
 typedef bool (*OSc_FrameCallback)(OSc_Acquisition *acq, uint32_t channel,
                                   void *pixels, void *data);
 
+/**
+ * \brief Time-tag record kind.
+ *
+ * See enum constants starting with `OSc_TimeTagKind_`.
+ */
+typedef int32_t OSc_TimeTagKind;
+
+/** \brief Constants for #OSc_TimeTagKind. */
+enum {
+    OSc_TimeTagKind_Photon,
+    OSc_TimeTagKind_LineStart,
+    OSc_TimeTagKind_FrameEnd,
+};
+
+/**
+ * \brief Pointer to function receiving time-tagged photon records.
+ *
+ * Detectors that time-tag individual photons deliver their data as a stream
+ * of 64-bit records, which can be decoded with OSc_TimeTag_GetKind(),
+ * OSc_TimeTag_GetChannel(), OSc_TimeTag_GetMicrotime(), and
+ * OSc_TimeTag_GetMacrotime(). Records are in order of macrotime for each
+ * detector device.
+ *
+ * The same rules as for #OSc_FrameCallback apply.
+ *
+ * \sa OSc_Acquisition_SetTimeTagCallback()
+ * \param acq the acquisition
+ * \param firstChannel the channel number of the detector device's first
+ * channel; channel indices in the records are relative to this
+ * \param timeTags the records, which the callback must copy if needed
+ * \param count the number of records
+ * \param data the acquisition client data set by OSc_Acquisition_SetData()
+ * \return `true` normally, or `false` to cancel the acquisition
+ */
+typedef bool (*OSc_TimeTagCallback)(OSc_Acquisition *acq,
+                                    uint32_t firstChannel,
+                                    const uint64_t *timeTags, size_t count,
+                                    void *data);
+
+/**
+ * \brief Pointer to function receiving downsampled preview images.
+ *
+ * The pixels are in the same format as those passed to the frame callback
+ * (see OSc_Acquisition_GetSampleFormat()). The same rules as for
+ * #OSc_FrameCallback apply.
+ *
+ * \sa OSc_Acquisition_SetPreviewPyramid()
+ * \param acq the acquisition
+ * \param channel the channel number (zero-based)
+ * \param level the pyramid level; the image is downsampled by `2^level`
+ * \param width the width of the image
+ * \param height the height of the image
+ * \param pixels image data, which the callback must copy if needed
+ * \param data the acquisition client data set by OSc_Acquisition_SetData()
+ * \return `true` normally, or `false` to cancel the acquisition
+ */
+typedef bool (*OSc_PreviewCallback)(OSc_Acquisition *acq, uint32_t channel,
+                                    uint32_t level, uint32_t width,
+                                    uint32_t height, void *pixels,
+                                    void *data);
+
+/** \brief Get the kind (#OSc_TimeTagKind) of a time-tag record. */
+OSc_InlineAPI OSc_TimeTagKind OSc_TimeTag_GetKind(uint64_t timeTag) {
+    return (OSc_TimeTagKind)(timeTag >> 62);
+}
+
+/** \brief Get the (detector-device-relative) channel of a time-tag record. */
+OSc_InlineAPI uint32_t OSc_TimeTag_GetChannel(uint64_t timeTag) {
+    return (uint32_t)(timeTag >> 56) & 0x3f;
+}
+
+/** \brief Get the microtime (TCSPC bin) of a time-tag record. */
+OSc_InlineAPI uint32_t OSc_TimeTag_GetMicrotime(uint64_t timeTag) {
+    return (uint32_t)(timeTag >> 40) & 0xffff;
+}
+
+/** \brief Get the macrotime (modulo 2^40) of a time-tag record. */
+OSc_InlineAPI uint64_t OSc_TimeTag_GetMacrotime(uint64_t timeTag) {
+    return timeTag & 0xffffffffffULL;
+}
+
+/**
+ * \brief Pointer to function describing the field distortion of the scanner.
+ *
+ * Coordinates are normalized so that the full field of view at zoom factor
+ * 1.0 spans -1.0 to 1.0 in both X and Y, with the origin at the center of
+ * the field; they do not depend on the zoom factor or ROI of an acquisition.
+ *
+ * The function receives the ideal (undistorted) position of a point and must
+ * return the position at which that point appears in the raw, distorted
+ * raster. It is called once per output pixel, on the thread calling
+ * OSc_Acquisition_Arm(), when the correction map is computed.
+ *
+ * \sa OSc_Acquisition_SetFieldDistortion()
+ */
+typedef void (*OSc_FieldDistortionFunc)(double x, double y,
+                                        double *distortedX,
+                                        double *distortedY, void *data);
+
+/**
+ * \brief A reference-counted image passed between pipeline stages.
+ *
+ * A frame buffer holds one channel of one frame, in a non-packed
+ * #OSc_SampleFormat. It is freed when its last reference is released with
+ * OSc_FrameBuffer_Release(). Frame buffers passed to stages must not be
+ * modified, because the same buffer may be read concurrently by other
+ * stages.
+ */
+typedef struct OScInternal_FrameBuffer OSc_FrameBuffer;
+
+/**
+ * \brief A DLPack tensor (see `dlpack/dlpack.h`, shipped with OpenScanLib).
+ *
+ * \sa OSc_FrameBuffer_ExportDLPack()
+ */
+struct DLManagedTensor;
+
+/**
+ * \brief A processing stage in the pipeline of an acquisition.
+ *
+ * Stages are created with OSc_Acquisition_AddPipelineStage() (or one of the
+ * functions adding a built-in stage) and connected into a directed acyclic
+ * graph with OSc_PipelineStage_Connect(). Stages are owned by the
+ * acquisition and destroyed with it.
+ */
+typedef struct OScInternal_PipelineStage OSc_PipelineStage;
+
+/**
+ * \brief A reader of a raw recording file.
+ *
+ * Readers are created with OSc_RecordingReader_Open() and destroyed with
+ * OSc_RecordingReader_Close(). A reader is not modified after it is opened,
+ * so it may be used from any number of threads.
+ */
+typedef struct OScInternal_RecordingReader OSc_RecordingReader;
+
+/**
+ * \brief A subscriber to a frame ring published by another process.
+ *
+ * Subscribers are created with OSc_FrameRingSubscriber_Open() and destroyed
+ * with OSc_FrameRingSubscriber_Close().
+ */
+typedef struct OScInternal_FrameRingSubscriber OSc_FrameRingSubscriber;
+
+/**
+ * \brief Pointer to function implementing a pipeline stage.
+ *
+ * The function is called on a worker thread owned by OpenScanLib, once for
+ * each frame buffer reaching the stage. Calls for a given stage are never
+ * concurrent and occur in the order in which the frames reached the stage;
+ * calls for different stages may be concurrent.
+ *
+ * The frame buffer is only valid during the call unless the function
+ * retains it with OSc_FrameBuffer_Retain(). To pass frames on to the
+ * downstream stages, call OSc_PipelineStage_Emit() (with \p frame or with a
+ * new frame buffer).
+ *
+ * The same restrictions as for #OSc_FrameCallback apply to calling back into
+ * OpenScanLib.
+ *
+ * \param stage the stage
+ * \param frame the frame buffer to process
+ * \param data the client data passed to OSc_Acquisition_AddPipelineStage()
+ * \return `true` normally, or `false` to cancel the acquisition
+ */
+typedef bool (*OSc_PipelineStageFunc)(OSc_PipelineStage *stage,
+                                      OSc_FrameBuffer *frame, void *data);
+
+/**
+ * \brief Attach to a frame ring.
+ *
+ * The ring, created by a frame ring stage (see
+ * OSc_Acquisition_AddFrameRingStage()), usually in another process, is
+ * mapped read-only. Frames are numbered from 0 in the order published,
+ * counting each channel separately.
+ *
+ * \param subscriber receives the new subscriber
+ * \param name the name given to the stage
+ * \return an error if the ring does not exist (for example, because the
+ * acquisition has not been armed yet)
+ */
+OSc_API OSc_RichError *
+OSc_FrameRingSubscriber_Open(OSc_FrameRingSubscriber **subscriber,
+                             const char *name);
+
+/**
+ * \brief Detach from a frame ring.
+ *
+ * Pointers obtained with OSc_FrameRingSubscriber_GetFrame() become invalid.
+ */
+OSc_API void
+OSc_FrameRingSubscriber_Close(OSc_FrameRingSubscriber *subscriber);
+
+/**
+ * \brief Get the number of frames published so far.
+ *
+ * The latest frame is this minus 1; frames older than
+ * OSc_FrameRingSubscriber_GetNumberOfSlots() before it have been
+ * overwritten.
+ */
+OSc_API uint64_t OSc_FrameRingSubscriber_GetNumberOfFramesPublished(
+    OSc_FrameRingSubscriber *subscriber);
+
+OSc_API uint32_t
+OSc_FrameRingSubscriber_GetNumberOfSlots(OSc_FrameRingSubscriber *subscriber);
+
+/**
+ * \brief Check whether the publisher has finished.
+ *
+ * No more frames will be published to a closed ring; the frames still in it
+ * can be read. To receive the frames of the next acquisition, open the ring
+ * again.
+ */
+OSc_API bool
+OSc_FrameRingSubscriber_IsClosed(OSc_FrameRingSubscriber *subscriber);
+
+/**
+ * \brief Wait until a frame has been published.
+ *
+ * Returns when frame \p frameNumber has been published, the ring is closed,
+ * or the timeout expires, whichever comes first.
+ *
+ * \param subscriber the subscriber
+ * \param frameNumber the frame to wait for
+ * \param timeoutMilliseconds the maximum time to wait
+ * \param published receives whether the frame has been published
+ */
+OSc_API OSc_RichError *OSc_FrameRingSubscriber_Wait(
+    OSc_FrameRingSubscriber *subscriber, uint64_t frameNumber,
+    uint32_t timeoutMilliseconds, bool *published);
+
+/**
+ * \brief Get a frame in the ring without copying it.
+ *
+ * \p pixels receives a pointer into the shared memory. Because the
+ * publisher does not wait for subscribers, the slot may be overwritten by a
+ * later frame at any time: after using the pixels (for example, after
+ * copying them to a display buffer), call
+ * OSc_FrameRingSubscriber_IsFrameValid() and discard the result if it
+ * returns `false`.
+ *
+ * \param subscriber the subscriber
+ * \param frameNumber the frame
+ * \param channel receives the channel of the frame
+ * \param width receives the width of the frame
+ * \param height receives the height of the frame
+ * \param format receives the sample format of the frame
+ * \param pixels receives the address of the samples
+ * \param size receives the size of the samples in bytes
+ * \return an error if the frame has not been published yet or has been
+ * overwritten
+ */
+OSc_API OSc_RichError *OSc_FrameRingSubscriber_GetFrame(
+    OSc_FrameRingSubscriber *subscriber, uint64_t frameNumber,
+    uint32_t *channel, uint32_t *width, uint32_t *height,
+    OSc_SampleFormat *format, const void **pixels, size_t *size);
+
+/**
+ * \brief Check that a frame has not been overwritten.
+ *
+ * \return `true` if the frame obtained with
+ * OSc_FrameRingSubscriber_GetFrame() was intact throughout its use
+ */
+OSc_API bool
+OSc_FrameRingSubscriber_IsFrameValid(OSc_FrameRingSubscriber *subscriber,
+                                     uint64_t frameNumber);
+
 /** @} */ // addtogroup api
 
 /**
@@ -295,12 +639,88 @@ OSc_InlineAPI bool OSc_CheckVersion(void) {
     return OScInternal_CheckVersion(OScInternal_ABI_VERSION);
 }
 
+/**
+ * \brief Get the instruction set level selected for processing kernels.
+ *
+ * The level is determined once, when OSc_CheckVersion() or OSc_LSM_Create()
+ * is first called (or by this function, if neither has been called).
+ */
+OSc_API OSc_SIMDLevel OSc_GetSIMDLevel(void);
+
+/**
+ * \brief Get the number of groups of processing kernels.
+ *
+ * Each group (such as sample format conversion or photon counting) has its
+ * SIMD variant selected as a whole.
+ *
+ * \sa OSc_GetKernelName(), OSc_GetKernelLevel()
+ */
+OSc_API size_t OSc_GetNumberOfKernels(void);
+
+/**
+ * \brief Get the name of a group of processing kernels.
+ *
+ * \return the name, or `NULL` if \p index is out of range
+ */
+OSc_API const char *OSc_GetKernelName(size_t index);
+
+/**
+ * \brief Get the instruction set level of the variant in use for a group of
+ * processing kernels.
+ *
+ * This is the highest level, not exceeding OSc_GetSIMDLevel(), for which the
+ * group has a variant. It is #OSc_SIMDLevel_Scalar if \p index is out of
+ * range.
+ */
+OSc_API OSc_SIMDLevel OSc_GetKernelLevel(size_t index);
+
+/**
+ * \brief Get the size of a frame compressed with the lossless codec.
+ *
+ * Frames compressed with #OSc_StorageCompression_Lossless start with a
+ * header giving their size; this function reads it, so that a buffer can be
+ * allocated for OSc_DecodeLosslessFrame().
+ *
+ * \param data the compressed frame
+ * \param size the size of \p data in bytes
+ * \param width receives the width of the frame
+ * \param height receives the height of the frame
+ * \param bytesPerSample receives the size of each sample (1, 2, or 4)
+ */
+OSc_API OSc_RichError *OSc_GetLosslessFrameInfo(const void *data, size_t size,
+                                                uint32_t *width,
+                                                uint32_t *height,
+                                                uint32_t *bytesPerSample);
+
+/**
+ * \brief Decompress a frame compressed with the lossless codec.
+ *
+ * The codec predicts each sample from its left neighbor (the first sample of
+ * each row from the sample above) and stores the residuals of each block of
+ * 128 samples as only as many bit planes as they need, so that it encodes
+ * and decodes at several gigabytes per second. Samples are decoded in the
+ * byte order of the calling machine.
+ *
+ * \param data the compressed frame
+ * \param size the size of \p data in bytes
+ * \param samples receives the decoded samples
+ * \param capacity the size of \p samples in bytes, which must be at least
+ * the size of the frame
+ */
+OSc_API OSc_RichError *OSc_DecodeLosslessFrame(const void *data, size_t size,
+                                               void *samples,
+                                               size_t capacity);
+
 /**
  * \brief Set the logger for OpenScan.
  *
  * The given function will be used for all logging by OpenScanLib and device
  * modules, unless a device-specific logger is used.
  *
+ * The function may be called on threads other than the application's,
+ * notably during device enumeration (see
+ * OSc_SetDeviceEnumerationTimeout()).
+ *
  * \param func the logger function, or null, in which case the logger is
  * removed \param data client data passed to the logger function \sa
  * OSc_Device_SetLogFunc()
@@ -385,6 +805,109 @@ OSc_API void OSc_Error_Destroy(OSc_RichError *error);
  */
 OSc_API void OSc_SetDeviceModuleSearchPaths(const char **paths);
 
+/**
+ * \brief Load device modules in a separate host process.
+ *
+ * When a host is set, each device module is loaded in its own instance of the
+ * OpenScanDeviceHost executable instead of in the application, so that a
+ * device module that crashes does not take the application with it. Devices
+ * are used as usual; frames are passed through a buffer pool in shared
+ * memory.
+ *
+ * Like OSc_SetDeviceModuleSearchPaths(), this function must be called before
+ * device modules are loaded.
+ *
+ * \param hostPath path to the OpenScanDeviceHost executable, or NULL to load
+ * modules in the application (the default)
+ * \param poolBytes size of the buffer pool for each host, or 0 for the
+ * default (64 MiB); the pool must hold at least two frames of one channel
+ */
+OSc_API void OSc_SetDeviceModuleHost(const char *hostPath, size_t poolBytes);
+
+/**
+ * \brief Set the time limit for device enumeration in each device module.
+ *
+ * Device modules (and the device implementations within each module) are
+ * enumerated concurrently. A module that has not finished enumerating when
+ * the time limit expires is skipped, with a warning logged, and none of its
+ * devices are listed.
+ *
+ * Because enumeration runs on other threads, warnings from it (and messages
+ * logged by device modules while enumerating) may reach the logger (see
+ * OSc_LogFunc_Set()) on those threads. Modules skipped for the time limit
+ * continue on their own, so their messages may be logged even after
+ * OSc_GetAllDevices() has returned. The logger must therefore be
+ * thread-safe, and must stay valid while modules may still be enumerating.
+ *
+ * Like OSc_SetDeviceModuleSearchPaths(), this function must be called before
+ * either OSc_GetAllDevices() or OSc_GetNumberOfAvailableDevices() is called.
+ *
+ * \param seconds the time limit, or 0 for no limit (the default)
+ */
+OSc_API void OSc_SetDeviceEnumerationTimeout(double seconds);
+
+/**
+ * \brief Enable the device manifest cache.
+ *
+ * The manifest cache records, in the file at \p path, the devices found in
+ * each device module, so that the device list can be presented at startup
+ * without loading the device modules. A module is loaded and enumerated
+ * only if its file has changed (or is new) since it was recorded, or when
+ * one of its devices is first opened (or its settings are requested).
+ *
+ * Devices listed from the cache are not probed, so a device that is no
+ * longer present is still listed until the module is enumerated; opening it
+ * then fails. Enumerating a module updates its record, so that changes are
+ * reflected in the device list from the next start. Modules that find no
+ * devices are not recorded, and are enumerated at every start. Call
+ * OSc_RefreshDeviceManifest() to enumerate the other modules, for example in
+ * the background after presenting the device list.
+ *
+ * Like OSc_SetDeviceModuleSearchPaths(), this function must be called before
+ * either OSc_GetAllDevices() or OSc_GetNumberOfAvailableDevices() is called.
+ *
+ * \param path path of the cache file (which need not exist), or NULL to
+ * disable the cache (the default)
+ */
+OSc_API void OSc_SetDeviceManifestCache(const char *path);
+
+/**
+ * \brief Enumerate the device modules listed from the manifest cache.
+ *
+ * Each device module whose devices were listed from the manifest cache (see
+ * OSc_SetDeviceManifestCache()), and none of whose devices has been opened
+ * since, is loaded and enumerated, and its record is updated, so that
+ * devices that were added or removed are reflected in the device list from
+ * the next start. The current device list does not change.
+ *
+ * This can take as long as enumerating without the cache. It may be called
+ * from another thread while devices are in use, but only after
+ * OSc_GetAllDevices() or OSc_GetNumberOfAvailableDevices() has returned.
+ * Opening a device of the module being enumerated waits until it is done.
+ */
+OSc_API OSc_RichError *OSc_RefreshDeviceManifest(void);
+
+/**
+ * \brief Load device modules only while they are needed.
+ *
+ * By default, all device modules are loaded when the device list is first
+ * requested, and stay loaded. In lazy mode, modules are found by file name
+ * only; each module is loaded to enumerate its devices, then unloaded
+ * (together with its dependencies), and loaded again when one of its
+ * devices is opened (or its settings are requested). This saves memory when
+ * only a few of the installed modules are used.
+ *
+ * Combined with the device manifest cache (OSc_SetDeviceManifestCache()),
+ * modules whose devices are recorded in the manifest are not loaded at all
+ * until one of their devices is opened.
+ *
+ * Like OSc_SetDeviceModuleSearchPaths(), this function must be called before
+ * either OSc_GetAllDevices() or OSc_GetNumberOfAvailableDevices() is called.
+ *
+ * \param lazy whether to load device modules lazily (default: false)
+ */
+OSc_API void OSc_SetDeviceModuleLazyLoading(bool lazy);
+
 OSc_API OSc_RichError *OSc_LSM_Create(OSc_LSM **lsm);
 
 /**
@@ -637,6 +1160,57 @@ OSc_API OSc_RichError *
 OSc_AcqTemplate_GetBytesPerSample(OSc_AcqTemplate *tmpl,
                                   uint32_t *bytesPerSample);
 
+/**
+ * \brief Get the native sample format of a detector channel.
+ *
+ * Like OSc_AcqTemplate_GetNumberOfChannels(), this currently reads the state
+ * of the detector device.
+ *
+ * \param tmpl the acquisition template
+ * \param channel the channel index, counting the channels of the enabled
+ * detector devices in order
+ * \param[out] format the format in which the detector produces samples
+ */
+OSc_API OSc_RichError *
+OSc_AcqTemplate_GetChannelSampleFormat(OSc_AcqTemplate *tmpl,
+                                       uint32_t channel,
+                                       OSc_SampleFormat *format);
+
+/**
+ * \brief Set the sample format to which detector data is converted.
+ *
+ * All channels are converted to this common format before any processing
+ * (photon counting, phasor analysis, remapping), so that detectors with
+ * different formats can be combined in one acquisition. Conversion between
+ * integer formats saturates; conversion from floating point rounds to the
+ * nearest integer.
+ *
+ * The default, #OSc_SampleFormat_Auto, chooses the narrowest format that
+ * can represent the samples of every enabled channel: any floating-point
+ * channel results in #OSc_SampleFormat_Float32, and mixing signed and
+ * unsigned channels results in a signed format wide enough for both
+ * (saturating at #OSc_SampleFormat_Int32). Packed 12-bit samples are
+ * unpacked to #OSc_SampleFormat_UInt12.
+ *
+ * \param tmpl the acquisition template
+ * \param format the common format; must not be
+ * #OSc_SampleFormat_UInt12Packed
+ */
+OSc_API OSc_RichError *
+OSc_AcqTemplate_SetSampleFormat(OSc_AcqTemplate *tmpl,
+                                OSc_SampleFormat format);
+
+/**
+ * \brief Get the common sample format of the acquired data.
+ *
+ * This is the format set with OSc_AcqTemplate_SetSampleFormat() or, if
+ * #OSc_SampleFormat_Auto, the format chosen for the enabled detectors.
+ * OSc_AcqTemplate_GetBytesPerSample() returns its size.
+ */
+OSc_API OSc_RichError *
+OSc_AcqTemplate_GetSampleFormat(OSc_AcqTemplate *tmpl,
+                                OSc_SampleFormat *format);
+
 /**
  * \brief Create a new acquisition from the current settings of a template.
  *
@@ -697,6 +1271,699 @@ OSc_Acquisition_GetNumberOfChannels(OSc_Acquisition *acq,
 OSc_API OSc_RichError *
 OSc_Acquisition_GetBytesPerSample(OSc_Acquisition *acq,
                                   uint32_t *bytesPerSample);
+
+/**
+ * \brief Get the sample format of the frames passed to the frame callback.
+ *
+ * This is the common format of the acquisition template, unless changed by
+ * processing: photon counting produces unsigned counts, lifetime histograms
+ * produce #OSc_SampleFormat_UInt16, and phasor analysis produces
+ * #OSc_SampleFormat_Float32. OSc_Acquisition_GetBytesPerSample() returns
+ * its size.
+ */
+OSc_API OSc_RichError *
+OSc_Acquisition_GetSampleFormat(OSc_Acquisition *acq,
+                                OSc_SampleFormat *format);
+
+/**
+ * \brief Set the scan rotation to correct for in the acquired images.
+ *
+ * When the scan rotation is nonzero, every channel of every frame is
+ * resampled (with bilinear interpolation) before being passed to the frame
+ * callback, so that the image appears unrotated. The angle is the
+ * counterclockwise rotation of the raster relative to the sample, about the
+ * center of the field of view. Parts of the output image that fall outside
+ * of the acquired raster are set to zero.
+ *
+ * This must be called before OSc_Acquisition_Arm(). The default is zero
+ * (no correction).
+ *
+ * \param acq the acquisition
+ * \param degrees the rotation angle in degrees
+ */
+OSc_API OSc_RichError *OSc_Acquisition_SetScanRotation(OSc_Acquisition *acq,
+                                                       double degrees);
+
+OSc_API double OSc_Acquisition_GetScanRotation(OSc_Acquisition *acq);
+
+/**
+ * \brief Set a field distortion model to correct for in the acquired images.
+ *
+ * Like scan rotation (with which it can be combined), distortion correction
+ * resamples every channel of every frame before it is passed to the frame
+ * callback. The correction map is computed when the acquisition is armed and
+ * is reused for later acquisitions with the same geometry and distortion
+ * function and data.
+ *
+ * This must be called before OSc_Acquisition_Arm().
+ *
+ * \param acq the acquisition
+ * \param func the distortion model, or `NULL` to disable correction
+ * \param data client data passed to \p func
+ */
+OSc_API OSc_RichError *
+OSc_Acquisition_SetFieldDistortion(OSc_Acquisition *acq,
+                                   OSc_FieldDistortionFunc func, void *data);
+
+/**
+ * \brief Enable photon counting of an oversampled analog detector signal.
+ *
+ * When enabled, detector devices send \p samplesPerPixel raw samples per
+ * pixel (see OScDev_Acquisition_GetSamplesPerPixel()), which OpenScanLib
+ * converts into photon counts before any other processing: a discriminator
+ * with hysteresis (see OSc_Acquisition_SetPhotonThreshold()) is applied to
+ * the samples, and the number of times it goes high within each pixel is
+ * the pixel value. The discriminator is reset at the start of every line.
+ *
+ * The frame callback then receives counts of \p bytesPerCount bytes each,
+ * saturated to the maximum value, and OSc_Acquisition_GetBytesPerSample()
+ * returns \p bytesPerCount.
+ *
+ * This must be called before OSc_Acquisition_Arm().
+ *
+ * \param acq the acquisition
+ * \param samplesPerPixel the number of raw samples per pixel, or 0 to
+ * disable photon counting (the default)
+ * \param bytesPerCount 1 or 2
+ */
+OSc_API OSc_RichError *
+OSc_Acquisition_SetPhotonCounting(OSc_Acquisition *acq,
+                                  uint32_t samplesPerPixel,
+                                  uint32_t bytesPerCount);
+
+/**
+ * \brief Get the number of raw samples per pixel sent by detectors.
+ *
+ * \return the value set with OSc_Acquisition_SetPhotonCounting(), or 1 if
+ * photon counting is disabled
+ */
+OSc_API uint32_t OSc_Acquisition_GetSamplesPerPixel(OSc_Acquisition *acq);
+
+/**
+ * \brief Set the photon discriminator thresholds for a channel.
+ *
+ * The discriminator goes high at a raw sample greater than or equal to
+ * \p upper and goes low at a raw sample less than \p lower. The thresholds
+ * are in units of the raw samples in the common sample format (see
+ * OSc_AcqTemplate_SetSampleFormat()), which must be an unsigned integer
+ * format, and must be representable in it; this is checked by
+ * OSc_Acquisition_Arm(). The default for both is half of the raw sample
+ * range.
+ *
+ * \param acq the acquisition
+ * \param channel the channel index
+ * \param lower the lower threshold
+ * \param upper the upper threshold, which must not be less than \p lower
+ */
+OSc_API OSc_RichError *
+OSc_Acquisition_SetPhotonThreshold(OSc_Acquisition *acq, uint32_t channel,
+                                   uint32_t lower, uint32_t upper);
+
+/** \brief Channel indices of the images produced by phasor analysis. */
+enum {
+    OSc_PhasorChannel_G,
+    OSc_PhasorChannel_S,
+    OSc_PhasorChannel_Intensity,
+};
+
+/**
+ * \brief Enable phasor analysis of fluorescence lifetime histograms.
+ *
+ * When enabled, the channels of the acquisition (after photon counting, if
+ * also enabled) are interpreted as consecutive time bins spanning one laser
+ * period, so that each pixel carries a lifetime histogram. Instead of the
+ * histogram channels, the frame callback receives, for each frame, three
+ * images of 32-bit `float` samples: the phasor coordinates G and S at the
+ * given harmonic, and the total intensity (see the `OSc_PhasorChannel_`
+ * constants). OSc_Acquisition_GetNumberOfChannels() then returns 3 and
+ * OSc_Acquisition_GetBytesPerSample() returns 4.
+ *
+ * Pixels with zero intensity have G and S set to zero.
+ *
+ * This must be called before OSc_Acquisition_Arm().
+ *
+ * \param acq the acquisition
+ * \param harmonic the harmonic (1 for the laser repetition frequency), or 0
+ * to disable phasor analysis (the default)
+ */
+OSc_API OSc_RichError *OSc_Acquisition_SetPhasorAnalysis(OSc_Acquisition *acq,
+                                                         uint32_t harmonic);
+
+/**
+ * \brief Set the phasor calibration.
+ *
+ * The computed phasors are rotated counterclockwise by \p phaseShift and
+ * scaled by \p modulationScale to correct for the instrument response. The
+ * default is no correction (0 and 1).
+ *
+ * This function may be called at any time, including while the acquisition
+ * is running and from the frame and preview callbacks; it takes effect from
+ * the next completed frame.
+ *
+ * \param acq the acquisition
+ * \param phaseShift the phase correction in radians
+ * \param modulationScale the modulation correction factor (positive)
+ */
+OSc_API OSc_RichError *
+OSc_Acquisition_SetPhasorCalibration(OSc_Acquisition *acq, double phaseShift,
+                                     double modulationScale);
+
+/**
+ * \brief Calibrate phasor analysis against a reference of known lifetime.
+ *
+ * Given the uncalibrated phasor measured for a sample with a known
+ * single-exponential lifetime, set the calibration (as with
+ * OSc_Acquisition_SetPhasorCalibration()) such that this phasor maps to its
+ * theoretical position. Phasor analysis must have been enabled with
+ * OSc_Acquisition_SetPhasorAnalysis().
+ *
+ * \param acq the acquisition
+ * \param referenceG the uncalibrated G of the reference
+ * \param referenceS the uncalibrated S of the reference
+ * \param referenceLifetime the lifetime of the reference in seconds
+ * \param laserFrequencyHz the laser repetition frequency
+ */
+OSc_API OSc_RichError *OSc_Acquisition_CalibratePhasor(
+    OSc_Acquisition *acq, double referenceG, double referenceS,
+    double referenceLifetime, double laserFrequencyHz);
+
+/**
+ * \brief Set the function receiving time-tagged photon records.
+ *
+ * Only detectors that time-tag photons call this function. The records are
+ * delivered unmodified, whether or not lifetime histograms are also built
+ * (see OSc_Acquisition_SetLifetimeHistogram()).
+ */
+OSc_API OSc_RichError *
+OSc_Acquisition_SetTimeTagCallback(OSc_Acquisition *acq,
+                                   OSc_TimeTagCallback callback);
+
+/**
+ * \brief Enable building of lifetime histograms from time-tagged photons.
+ *
+ * When enabled, photons received from time-tagging detectors are binned
+ * into pixels by their macrotime relative to the line start markers, and
+ * into time bins by their microtime, to build a per-pixel lifetime histogram
+ * for each channel. At each frame end marker (or when a line start marker
+ * follows the last line of a frame), the histograms are delivered as frames
+ * of 16-bit (saturating) counts, one per channel and time bin: channel
+ * number `c * microtimeBins + b` holds time bin `b` of detector channel `c`.
+ * OSc_Acquisition_GetNumberOfChannels() and
+ * OSc_Acquisition_GetBytesPerSample() reflect this. The histograms can in
+ * turn be reduced by phasor analysis (OSc_Acquisition_SetPhasorAnalysis()).
+ *
+ * Photons outside of the scanned lines, or with a time bin beyond
+ * \p microtimeBins, are not counted.
+ *
+ * This must be called before OSc_Acquisition_Arm().
+ *
+ * \param acq the acquisition
+ * \param microtimeBins the number of time bins, or 0 to disable histogram
+ * building (the default)
+ * \param microtimeShift the number of low-order bits of the microtime to
+ * discard (to combine adjacent TCSPC bins)
+ * \param macrotimeClockHz the frequency of the macrotime clock of the
+ * detector, used with the pixel rate to assign photons to pixels
+ */
+OSc_API OSc_RichError *OSc_Acquisition_SetLifetimeHistogram(
+    OSc_Acquisition *acq, uint32_t microtimeBins, uint32_t microtimeShift,
+    double macrotimeClockHz);
+
+/**
+ * \brief Build a multi-resolution preview pyramid of every frame.
+ *
+ * After each channel of each frame is passed to the frame callback, it is
+ * downsampled by 2, 4, 8, ... (levels 1, 2, 3, ...) with a 2 x 2 box filter
+ * applied repeatedly, and each level is passed to \p callback, in order of
+ * increasing level. Each dimension of a level is half that of the previous
+ * level, rounded up. Viewers can display a level matching the zoom factor
+ * without handling full-resolution data.
+ *
+ * The number of levels is limited to the first level with a size of 1 x 1.
+ *
+ * This must be called before OSc_Acquisition_Arm().
+ *
+ * \param acq the acquisition
+ * \param numberOfLevels the number of levels to build, or 0 to disable the
+ * pyramid (the default)
+ * \param callback the function receiving the levels
+ */
+OSc_API OSc_RichError *
+OSc_Acquisition_SetPreviewPyramid(OSc_Acquisition *acq,
+                                  uint32_t numberOfLevels,
+                                  OSc_PreviewCallback callback);
+
+/**
+ * \brief Add a processing stage to the pipeline of an acquisition.
+ *
+ * After each channel of each frame is passed to the frame callback (and
+ * preview callback, if any), it is copied into a frame buffer and queued to
+ * every pipeline stage that has no upstream stage. Packed samples
+ * (#OSc_SampleFormat_UInt12Packed) are unpacked to #OSc_SampleFormat_UInt12
+ * in the process. Stages run on a pool of worker threads shared by all
+ * acquisitions, so that the device threads are not held up by processing.
+ *
+ * Each stage has its own queue of frames waiting to be processed. When the
+ * queue already holds \p queueDepth frames, arriving frames are dropped
+ * (and counted; see OSc_PipelineStage_GetStatistics()).
+ *
+ * OSc_Acquisition_Wait() returns only after all queued frames have been
+ * processed. If a stage cancels the acquisition, the frames still queued are
+ * discarded.
+ *
+ * This must be called before OSc_Acquisition_Arm().
+ *
+ * \param acq the acquisition
+ * \param func the function processing each frame
+ * \param data client data passed to \p func
+ * \param queueDepth the maximum number of queued frames, or 0 for no limit
+ * \param stage the new stage
+ */
+OSc_API OSc_RichError *OSc_Acquisition_AddPipelineStage(
+    OSc_Acquisition *acq, OSc_PipelineStageFunc func, void *data,
+    uint32_t queueDepth, OSc_PipelineStage **stage);
+
+/**
+ * \brief Add a built-in pipeline stage that downsamples frames.
+ *
+ * The stage emits each frame downsampled by `2^level` with a 2 x 2 box
+ * filter applied repeatedly (the same as level \p level of the preview
+ * pyramid; see OSc_Acquisition_SetPreviewPyramid()), or to 1 x 1 if the
+ * frame is too small.
+ *
+ * \sa OSc_Acquisition_AddPipelineStage()
+ * \param acq the acquisition
+ * \param level the pyramid level (at least 1)
+ * \param queueDepth the maximum number of queued frames, or 0 for no limit
+ * \param stage the new stage
+ */
+OSc_API OSc_RichError *
+OSc_Acquisition_AddDownsampleStage(OSc_Acquisition *acq, uint32_t level,
+                                   uint32_t queueDepth,
+                                   OSc_PipelineStage **stage);
+
+/**
+ * \brief Set the compression of frames recorded by storage stages.
+ *
+ * Applies to the raw file and Zarr writer stages of the acquisition (see
+ * OSc_Acquisition_AddRawWriterStage() and
+ * OSc_Acquisition_AddZarrWriterStage()). OME-TIFF files are always written
+ * uncompressed, so that they remain readable by other software.
+ *
+ * Lossless compression (#OSc_StorageCompression_Lossless) is fast enough to
+ * keep up with acquisition, and usually reduces the data written severalfold
+ * when the detector's noise occupies few of the bits of each sample.
+ *
+ * This must be called before OSc_Acquisition_Arm().
+ *
+ * \param acq the acquisition
+ * \param compression the compression (#OSc_StorageCompression_None by
+ * default)
+ */
+OSc_API OSc_RichError *
+OSc_Acquisition_SetStorageCompression(OSc_Acquisition *acq,
+                                      OSc_StorageCompression compression);
+
+OSc_API OSc_StorageCompression
+OSc_Acquisition_GetStorageCompression(OSc_Acquisition *acq);
+
+/**
+ * \brief Default number of frames between commits of a recording's index
+ *
+ * \sa OSc_Acquisition_SetRecordingCommitInterval()
+ */
+#define OSc_DEFAULT_COMMIT_FRAMES 100
+
+/**
+ * \brief Default time between commits of a recording's index
+ *
+ * \sa OSc_Acquisition_SetRecordingCommitInterval()
+ */
+#define OSc_DEFAULT_COMMIT_MILLISECONDS 500
+
+/**
+ * \brief Set how often the index of a raw recording is made crash-safe.
+ *
+ * While recording, the raw writer stage (see
+ * OSc_Acquisition_AddRawWriterStage()) keeps a journal of its index next to
+ * the file (the file name followed by `.journal`). Index entries are
+ * committed to the journal in groups: when \p frames frames have been
+ * written, or a frame is written \p milliseconds after the previous commit,
+ * the data written so far and the new entries are forced to the storage
+ * device, with one synchronization of each file for the whole group. If the
+ * process or the computer crashes, OSc_RecordingReader_Open() reads the
+ * recording up to the last committed frame without scanning the data. The
+ * journal is deleted when the recording is completed normally.
+ *
+ * Committing more often loses fewer frames in a crash, at the cost of more
+ * frequent synchronous writes.
+ *
+ * This must be called before OSc_Acquisition_Arm().
+ *
+ * \param acq the acquisition
+ * \param frames the number of frames between commits (default
+ * #OSc_DEFAULT_COMMIT_FRAMES), or 0 to commit only by time
+ * \param milliseconds the maximum time between commits (default
+ * #OSc_DEFAULT_COMMIT_MILLISECONDS), or 0 to commit only by frame count;
+ * if both are 0, no journal is kept and an incomplete recording cannot be
+ * read
+ */
+OSc_API OSc_RichError *OSc_Acquisition_SetRecordingCommitInterval(
+    OSc_Acquisition *acq, uint32_t frames, uint32_t milliseconds);
+
+OSc_API void OSc_Acquisition_GetRecordingCommitInterval(
+    OSc_Acquisition *acq, uint32_t *frames, uint32_t *milliseconds);
+
+/**
+ * \brief Add a built-in pipeline stage that records frames to a raw file.
+ *
+ * The file is created (replacing any existing file) when the acquisition is
+ * armed and completed by OSc_Acquisition_Wait() or when the acquisition is
+ * destroyed. Every frame received is written, as one record per channel
+ * aligned to 4096 bytes, followed by an index of the records when the file is
+ * completed. Records are compressed if set with
+ * OSc_Acquisition_SetStorageCompression(). The file is preallocated when the
+ * number of frames is known, and written asynchronously with direct I/O
+ * where supported, so that recording does not fill the operating system's
+ * file cache.
+ *
+ * If a write fails, the acquisition is cancelled and the error is returned
+ * by OSc_Acquisition_Wait(). The stage emits no frames.
+ *
+ * \sa OSc_Acquisition_AddPipelineStage()
+ * \param acq the acquisition
+ * \param path the file to write
+ * \param queueDepth the maximum number of queued frames, or 0 for no limit
+ * \param stage the new stage
+ */
+OSc_API OSc_RichError *
+OSc_Acquisition_AddRawWriterStage(OSc_Acquisition *acq, const char *path,
+                                  uint32_t queueDepth,
+                                  OSc_PipelineStage **stage);
+
+/**
+ * \brief Add a built-in pipeline stage that records frames to an OME-TIFF
+ * file.
+ *
+ * The file is a BigTIFF with one uncompressed page per channel per frame,
+ * written as frames arrive in the same way as with
+ * OSc_Acquisition_AddRawWriterStage(). The OME-XML metadata, describing the
+ * frames actually recorded and the scan parameters (pixel rate, resolution,
+ * zoom factor, ROI and channels), is written when the file is completed, so
+ * the number of frames need not be known in advance.
+ *
+ * All frames must have the same size and sample format. If a write fails,
+ * the acquisition is cancelled and the error is returned by
+ * OSc_Acquisition_Wait(). The stage emits no frames.
+ *
+ * \sa OSc_Acquisition_AddPipelineStage()
+ * \param acq the acquisition
+ * \param path the file to write (usually ending in `.ome.tif`)
+ * \param queueDepth the maximum number of queued frames, or 0 for no limit
+ * \param stage the new stage
+ */
+OSc_API OSc_RichError *
+OSc_Acquisition_AddOMETiffWriterStage(OSc_Acquisition *acq, const char *path,
+                                      uint32_t queueDepth,
+                                      OSc_PipelineStage **stage);
+
+/**
+ * \brief Add a built-in pipeline stage that records frames to a chunked
+ * Zarr array.
+ *
+ * A Zarr (version 3) array with dimensions (t, c, y, x) is created in the
+ * directory \p path when the acquisition is armed. Frames are stored in
+ * chunks spanning several frames of a tile of one channel, and the chunks
+ * are packed into shard files each holding a block of frames, so that the
+ * array can be read in parallel without creating very many files. Chunks are
+ * encoded, and shards written, on OpenScanLib's worker threads while later
+ * frames arrive. The array metadata, including the acquisition parameters as
+ * attributes, is written by OSc_Acquisition_Wait() or when the acquisition
+ * is destroyed.
+ *
+ * With lossless compression (see OSc_Acquisition_SetStorageCompression()),
+ * the chunks are encoded with the codec named `openscan_lossless`, which
+ * readers must provide (see OSc_DecodeLosslessFrame()); each chunk is
+ * encoded as a frame of the chunk's width whose rows are the rows of its
+ * frames in turn.
+ *
+ * All frames must have the same size and sample format. If encoding or
+ * writing fails, the acquisition is cancelled and the error is returned by
+ * OSc_Acquisition_Wait(). The stage emits no frames.
+ *
+ * \sa OSc_Acquisition_AddPipelineStage()
+ * \param acq the acquisition
+ * \param path the directory to create (usually ending in `.zarr`)
+ * \param queueDepth the maximum number of queued frames, or 0 for no limit
+ * \param stage the new stage
+ */
+OSc_API OSc_RichError *
+OSc_Acquisition_AddZarrWriterStage(OSc_Acquisition *acq, const char *path,
+                                   uint32_t queueDepth,
+                                   OSc_PipelineStage **stage);
+
+/**
+ * \brief Check whether the storage stages can keep up with an acquisition.
+ *
+ * The data rate that the storage stages (see
+ * OSc_Acquisition_AddRawWriterStage(), OSc_Acquisition_AddOMETiffWriterStage()
+ * and OSc_Acquisition_AddZarrWriterStage()) must sustain is computed from
+ * the pixel rate, ROI, number of channels and sample format of the
+ * acquisition, as if frames followed each other without flyback. It is
+ * compared with the rate at which each target directory can be written,
+ * measured by briefly writing (and then deleting) a scratch file there, and
+ * the rate of lossless encoding if set (see
+ * OSc_Acquisition_SetStorageCompression()), assuming no reduction in size.
+ * Measurements are made once per directory and kept for the life of the
+ * process, so the first call may take up to about a second.
+ *
+ * If \p availableBytesPerSecond is less than \p requiredBytesPerSecond, the
+ * recording will fall behind the acquisition and the storage stages' queues
+ * will grow until frames are dropped or memory runs out; a warning is also
+ * logged. Their ratio is the expected headroom.
+ *
+ * This should be called after the storage stages have been added and the
+ * acquisition parameters set, and before OSc_Acquisition_Arm().
+ *
+ * \param acq the acquisition
+ * \param requiredBytesPerSecond the data rate to be stored (0 if there are
+ * no storage stages)
+ * \param availableBytesPerSecond the estimated data rate that can be stored
+ * (`HUGE_VAL` if there are no storage stages)
+ */
+OSc_API OSc_RichError *
+OSc_Acquisition_CheckStorageThroughput(OSc_Acquisition *acq,
+                                       double *requiredBytesPerSecond,
+                                       double *availableBytesPerSecond);
+
+/**
+ * \brief Add a built-in pipeline stage that publishes frames to other
+ * processes through shared memory.
+ *
+ * A ring of \p numberOfSlots frames is created in shared memory named
+ * \p name (POSIX `shm_open()`; a named file mapping on Windows) when the
+ * acquisition is armed. Each frame received (one channel) is copied into the
+ * next slot, overwriting the oldest. Other processes read the frames in
+ * place with OSc_FrameRingSubscriber_Open() and related functions. The stage
+ * never waits for subscribers, so any number of them can attach without
+ * slowing the acquisition; a subscriber that falls behind by more than
+ * \p numberOfSlots frames misses frames.
+ *
+ * Slots hold frames of the acquisition's output size; larger frames (from
+ * other stages) are not published. When the acquisition finishes, the ring
+ * is marked closed and its name removed.
+ *
+ * \sa OSc_Acquisition_AddPipelineStage()
+ * \param acq the acquisition
+ * \param name the name of the shared memory (for example, `/openscan-live`)
+ * \param numberOfSlots the number of frames in the ring (at least 2), or 0
+ * for the default (8)
+ * \param queueDepth the maximum number of queued frames, or 0 for no limit
+ * \param stage the new stage
+ */
+OSc_API OSc_RichError *OSc_Acquisition_AddFrameRingStage(
+    OSc_Acquisition *acq, const char *name, uint32_t numberOfSlots,
+    uint32_t queueDepth, OSc_PipelineStage **stage);
+
+/**
+ * \brief Add a built-in pipeline stage that streams frames to clients over a
+ * socket.
+ *
+ * When the acquisition is armed, the stage listens on \p address, either
+ * `unix:PATH` (a Unix-domain socket; an existing socket file at PATH is
+ * replaced) or `tcp:HOST:PORT` (for example, `tcp:0.0.0.0:5025`). Any number
+ * of clients can connect, during the acquisition, and receive every frame
+ * received by the stage from then on. When the acquisition finishes, the
+ * clients are disconnected.
+ *
+ * Each frame is sent to all clients from the same buffer, without a copy
+ * per client (on Linux, large frames are sent to TCP clients with
+ * `MSG_ZEROCOPY`). Each client has a queue of \p clientQueueDepth frames;
+ * if a client cannot keep up, its oldest queued frames are dropped, so that
+ * it always receives the latest frames. The stage never waits for clients.
+ *
+ * Protocol (all integers little-endian): on connecting, the client receives
+ * a 64-byte stream header: the magic `OScStrm\n`; uint32 version (1);
+ * uint32 size of the frame headers (40); double pixel rate (Hz); double zoom
+ * factor; uint32 resolution, x offset, y offset, width, height, and number
+ * of channels; int32 #OSc_SampleFormat; and int32 #OSc_StorageCompression.
+ * Each frame is then sent as a frame header: the magic `OScF`; uint32
+ * channel; uint64 sequence number (counting all frames received by the
+ * stage, so that gaps show dropped frames); uint32 width and height; int32
+ * sample format and compression; and uint64 payload size, followed by the
+ * payload: the samples, or a frame compressed with the lossless codec (see
+ * OSc_DecodeLosslessFrame()). Data sent by clients is ignored.
+ *
+ * Not available on Windows.
+ *
+ * \sa OSc_Acquisition_AddPipelineStage()
+ * \param acq the acquisition
+ * \param address the address to listen on
+ * \param compression #OSc_StorageCompression_None or
+ * #OSc_StorageCompression_Lossless (which costs one encoding per frame,
+ * shared by all clients)
+ * \param clientQueueDepth the maximum number of frames queued per client, or
+ * 0 for the default (4)
+ * \param queueDepth the maximum number of frames queued to the stage, or 0
+ * for no limit
+ * \param stage the new stage
+ */
+OSc_API OSc_RichError *OSc_Acquisition_AddStreamServerStage(
+    OSc_Acquisition *acq, const char *address,
+    OSc_StorageCompression compression, uint32_t clientQueueDepth,
+    uint32_t queueDepth, OSc_PipelineStage **stage);
+
+/**
+ * \brief Connect two pipeline stages.
+ *
+ * Frames emitted by \p upstream are queued to \p downstream. A stage may
+ * have any number of upstream and downstream stages, but the connections
+ * must not form a cycle. Stages with an upstream stage no longer receive the
+ * acquired frames directly.
+ *
+ * This must be called before OSc_Acquisition_Arm().
+ */
+OSc_API OSc_RichError *
+OSc_PipelineStage_Connect(OSc_PipelineStage *upstream,
+                          OSc_PipelineStage *downstream);
+
+/**
+ * \brief Pass a frame buffer to the downstream stages.
+ *
+ * This must only be called from the stage's #OSc_PipelineStageFunc. Each
+ * downstream stage takes its own reference; the caller keeps its reference.
+ */
+OSc_API OSc_RichError *OSc_PipelineStage_Emit(OSc_PipelineStage *stage,
+                                              OSc_FrameBuffer *frame);
+
+/** \brief Get the acquisition to which a pipeline stage belongs. */
+OSc_API OSc_Acquisition *
+OSc_PipelineStage_GetAcquisition(OSc_PipelineStage *stage);
+
+/**
+ * \brief Get the performance counters of a pipeline stage.
+ *
+ * The counters are reset by OSc_Acquisition_Arm(). Latency is measured from
+ * when a frame is queued to the stage until the stage function returns, and
+ * therefore includes time spent waiting in the queue. Any of the output
+ * parameters may be `NULL`.
+ *
+ * \param stage the stage
+ * \param framesProcessed the number of frames processed
+ * \param framesDropped the number of frames dropped because the queue was
+ * full
+ * \param maxQueuedFrames the largest number of frames that were queued
+ * \param meanLatency the mean latency, in seconds
+ * \param maxLatency the maximum latency, in seconds
+ * \param meanProcessingTime the mean time spent in the stage function, in
+ * seconds
+ */
+OSc_API OSc_RichError *OSc_PipelineStage_GetStatistics(
+    OSc_PipelineStage *stage, uint64_t *framesProcessed,
+    uint64_t *framesDropped, uint32_t *maxQueuedFrames, double *meanLatency,
+    double *maxLatency, double *meanProcessingTime);
+
+/**
+ * \brief Create a frame buffer, with a reference count of 1.
+ *
+ * The pixels are uninitialized.
+ *
+ * \param frame the new frame buffer
+ * \param channel the channel number
+ * \param width the width of the image
+ * \param height the height of the image
+ * \param format the sample format, which must not be packed
+ */
+OSc_API OSc_RichError *OSc_FrameBuffer_Create(OSc_FrameBuffer **frame,
+                                              uint32_t channel,
+                                              uint32_t width, uint32_t height,
+                                              OSc_SampleFormat format);
+
+/** \brief Add a reference to a frame buffer. */
+OSc_API void OSc_FrameBuffer_Retain(OSc_FrameBuffer *frame);
+
+/** \brief Remove a reference, freeing the frame buffer if it was the last. */
+OSc_API void OSc_FrameBuffer_Release(OSc_FrameBuffer *frame);
+
+/** \brief Get the pixel data of a frame buffer. */
+OSc_API void *OSc_FrameBuffer_GetPixels(OSc_FrameBuffer *frame);
+
+/** \brief Get the channel number of a frame buffer. */
+OSc_API uint32_t OSc_FrameBuffer_GetChannel(OSc_FrameBuffer *frame);
+
+/** \brief Get the image size of a frame buffer. */
+OSc_API void OSc_FrameBuffer_GetSize(OSc_FrameBuffer *frame, uint32_t *width,
+                                     uint32_t *height);
+
+/** \brief Get the sample format of a frame buffer. */
+OSc_API OSc_SampleFormat
+OSc_FrameBuffer_GetSampleFormat(OSc_FrameBuffer *frame);
+
+/**
+ * \brief Export a frame buffer as a DLPack tensor, without copying.
+ *
+ * The tensor (on the CPU device) has shape (height, width), with row-major
+ * strides, and the data type of the frame's sample format
+ * (#OSc_SampleFormat_UInt12 is exported as 16-bit unsigned integers). It
+ * holds a reference to the frame buffer, which is released when the
+ * consumer calls the tensor's `deleter`; thus frameworks such as NumPy and
+ * PyTorch can use the pixels in place (for example, with `from_dlpack()`
+ * on a capsule holding the tensor) for as long as they need.
+ *
+ * The samples must not be modified through the tensor, because the frame
+ * buffer may be shared with other pipeline stages.
+ *
+ * Frame buffers are available to pipeline stages (see
+ * #OSc_PipelineStageFunc); the pixels passed to the #OSc_FrameCallback
+ * cannot be exported, because they are only valid during the call.
+ *
+ * \param frame the frame buffer
+ * \param tensor receives the tensor, which must be freed by calling its
+ * `deleter`
+ */
+OSc_API OSc_RichError *
+OSc_FrameBuffer_ExportDLPack(OSc_FrameBuffer *frame,
+                             struct DLManagedTensor **tensor);
+
+/**
+ * \brief Export the channels of a frame as one DLPack tensor.
+ *
+ * The tensor has shape (\p count, height, width), with row-major strides;
+ * the frame buffers must all have the same size and sample format. Because
+ * frame buffers hold one channel each, their samples are copied, once, into
+ * a new frame buffer owned by the tensor (except when \p count is 1). The
+ * tensor is otherwise as described for OSc_FrameBuffer_ExportDLPack(); the
+ * frame buffers passed remain owned by the caller.
+ *
+ * \param frames the frame buffers, in channel order
+ * \param count the number of frame buffers
+ * \param tensor receives the tensor, which must be freed by calling its
+ * `deleter`
+ */
+OSc_API OSc_RichError *
+OSc_FrameBuffer_ExportDLPackSet(OSc_FrameBuffer **frames, uint32_t count,
+                                struct DLManagedTensor **tensor);
+
 /**
  * \brief Arm an acquisition, preparing all participating devices.
  *
@@ -752,8 +2019,10 @@ OSc_API OSc_RichError *OSc_Acquisition_Stop(OSc_Acquisition *acq);
  * This blocks until the acquisition has finished on all participating
  * devices, whether by a call to OSc_Acquisition_Stop() or by completing the
  * requested number of frames; it returns immediately if the acquisition is
- * not armed or running. Once this function returns, no further frame
- * callbacks occur and the acquisition may be destroyed.
+ * not armed or running. It then waits for the frames queued to pipeline
+ * stages to be processed. Once this function returns, no further frame
+ * callbacks or pipeline stage calls occur and the acquisition may be
+ * destroyed.
  *
  * This function does not itself request a stop, so waiting for an
  * acquisition that does not finish on its own will not return until
@@ -764,6 +2033,136 @@ OSc_API OSc_RichError *OSc_Acquisition_Stop(OSc_Acquisition *acq);
  */
 OSc_API OSc_RichError *OSc_Acquisition_Wait(OSc_Acquisition *acq);
 
+/**
+ * \brief Open a raw recording file for reading.
+ *
+ * The file must have been written by a raw writer stage (see
+ * OSc_Acquisition_AddRawWriterStage()). It is mapped into memory read-only,
+ * and its index is read so that any frame can be located in constant time.
+ * Frames are read from the mapping only when accessed.
+ *
+ * If the recording was not completed (because of a crash), its index is
+ * recovered from the journal kept while recording, and the frames up to the
+ * last commit (see OSc_Acquisition_SetRecordingCommitInterval()) are
+ * available. The file and journal are not modified.
+ *
+ * The file must not be modified while the reader is open.
+ *
+ * \param reader receives the new reader
+ * \param path the file to read
+ */
+OSc_API OSc_RichError *OSc_RecordingReader_Open(OSc_RecordingReader **reader,
+                                                const char *path);
+
+/**
+ * \brief Close a recording reader.
+ *
+ * Pointers obtained with OSc_RecordingReader_GetFrame() become invalid.
+ */
+OSc_API void OSc_RecordingReader_Close(OSc_RecordingReader *reader);
+
+/**
+ * \brief Get the number of frames of a recording.
+ *
+ * This is one more than the highest frame number recorded for any channel.
+ */
+OSc_API uint32_t
+OSc_RecordingReader_GetNumberOfFrames(OSc_RecordingReader *reader);
+
+OSc_API uint32_t
+OSc_RecordingReader_GetNumberOfChannels(OSc_RecordingReader *reader);
+
+/**
+ * \brief Get the compression of the records of a recording.
+ *
+ * If it is #OSc_StorageCompression_Lossless, OSc_RecordingReader_GetFrame()
+ * returns compressed frames.
+ */
+OSc_API OSc_StorageCompression
+OSc_RecordingReader_GetCompression(OSc_RecordingReader *reader);
+
+OSc_API double OSc_RecordingReader_GetPixelRate(OSc_RecordingReader *reader);
+
+OSc_API uint32_t
+OSc_RecordingReader_GetResolution(OSc_RecordingReader *reader);
+
+OSc_API double OSc_RecordingReader_GetZoomFactor(OSc_RecordingReader *reader);
+
+OSc_API void OSc_RecordingReader_GetROI(OSc_RecordingReader *reader,
+                                        uint32_t *xOffset, uint32_t *yOffset,
+                                        uint32_t *width, uint32_t *height);
+
+/**
+ * \brief Get the size and sample format of a recorded frame.
+ *
+ * \return an error if the frame was not recorded for \p channel
+ */
+OSc_API OSc_RichError *
+OSc_RecordingReader_GetFrameInfo(OSc_RecordingReader *reader, uint32_t frame,
+                                 uint32_t channel, uint32_t *width,
+                                 uint32_t *height, OSc_SampleFormat *format);
+
+/**
+ * \brief Get a recorded frame without copying it.
+ *
+ * \p data receives a pointer into the mapped file, valid until the reader
+ * is closed. It points to the samples, or, if the recording is compressed,
+ * to the compressed frame (see OSc_DecodeLosslessFrame()). Accessing the
+ * data may block while it is read from the file.
+ *
+ * \param reader the reader
+ * \param frame the frame number
+ * \param channel the channel
+ * \param data receives the address of the frame
+ * \param size receives the size of the frame in bytes (may be `NULL`)
+ */
+OSc_API OSc_RichError *
+OSc_RecordingReader_GetFrame(OSc_RecordingReader *reader, uint32_t frame,
+                             uint32_t channel, const void **data,
+                             size_t *size);
+
+/**
+ * \brief Copy the samples of a recorded frame, decompressing if necessary.
+ *
+ * \param reader the reader
+ * \param frame the frame number
+ * \param channel the channel
+ * \param samples receives the samples
+ * \param capacity the size of \p samples in bytes, which must be at least
+ * the size of the frame
+ */
+OSc_API OSc_RichError *
+OSc_RecordingReader_ReadFrame(OSc_RecordingReader *reader, uint32_t frame,
+                              uint32_t channel, void *samples,
+                              size_t capacity);
+
+/**
+ * \brief Tell the operating system how the frames will be accessed.
+ *
+ * For playback (\p sequential `true`), the file is read ahead aggressively
+ * and pages behind the reading position may be dropped early; for random
+ * access, read-ahead is disabled so that each access reads only what is
+ * needed. This is a hint and has no effect on some systems.
+ */
+OSc_API OSc_RichError *
+OSc_RecordingReader_SetSequentialAccess(OSc_RecordingReader *reader,
+                                        bool sequential);
+
+/**
+ * \brief Start reading a range of frames into memory in the background.
+ *
+ * This returns immediately; later access to the frames does not wait for
+ * the file if reading has completed. Frames beyond the end of the
+ * recording are ignored.
+ *
+ * \param reader the reader
+ * \param firstFrame the first frame to read
+ * \param numberOfFrames the number of frames (all channels) to read
+ */
+OSc_API OSc_RichError *
+OSc_RecordingReader_Prefetch(OSc_RecordingReader *reader, uint32_t firstFrame,
+                             uint32_t numberOfFrames);
+
 /** @} */ // addtogroup api
 
 #ifdef __cplusplus
@@ -1,5 +1,6 @@
 #include "InternalErrors.h"
 #include "OpenScanLibPrivate.h"
+#include "SampleFormat.h"
 
 #include <math.h>
 
@@ -22,6 +23,8 @@ struct OScInternal_AcqTemplate {
     uint32_t yOffset;
     uint32_t width;
     uint32_t height;
+
+    OSc_SampleFormat sampleFormat; // Or OSc_SampleFormat_Auto
 };
 
 static OScInternal_NumRange *GetPixelRates(OSc_AcqTemplate *tmpl) {
@@ -346,6 +349,7 @@ OSc_RichError *OSc_AcqTemplate_Create(OSc_AcqTemplate **tmpl, OSc_LSM *lsm) {
     (*tmpl)->lsm = lsm;
     (*tmpl)->numberOfFrames = UINT32_MAX; // Infinite
     (*tmpl)->detectorMask = 1;            // Enable first detector by default
+    (*tmpl)->sampleFormat = OSc_SampleFormat_Auto;
 
     OSc_RichError *err;
     OSc_Setting *setting;
@@ -586,27 +590,78 @@ OSc_RichError *OSc_AcqTemplate_GetBytesPerSample(OSc_AcqTemplate *tmpl,
     if (!tmpl || !bytesPerSample)
         return OScInternal_Error_IllegalArgument();
 
-    // This implementation is temporary; device-specific settings that affect
-    // the sample format should belong to the AcqTemplate and we need a
-    // mechanism to allow the device implementation to compute the sample
-    // format with the AcqTemplate settings as sole input.
-    *bytesPerSample = 0;
+    OSc_SampleFormat format;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OSc_AcqTemplate_GetSampleFormat(tmpl, &format)))
+        return err;
+    *bytesPerSample = OScInternal_SampleFormat_GetBytesPerSample(format);
+    return OSc_OK;
+}
+
+OSc_RichError *
+OSc_AcqTemplate_GetChannelSampleFormat(OSc_AcqTemplate *tmpl,
+                                       uint32_t channel,
+                                       OSc_SampleFormat *format) {
+    if (!tmpl || !format)
+        return OScInternal_Error_IllegalArgument();
+
+    // Like the number of channels, this reads the current device state
     for (size_t i = 0; i < OSc_LSM_GetNumberOfDetectorDevices(tmpl->lsm);
          ++i) {
         if (!OSc_AcqTemplate_IsDetectorDeviceEnabled(tmpl, i))
             continue;
         OSc_Device *detectorDevice = OSc_LSM_GetDetectorDevice(tmpl->lsm, i);
-        uint32_t bps = 0;
+        uint32_t nch = 0;
         OSc_RichError *err =
-            OScInternal_Device_GetBytesPerSample(detectorDevice, &bps);
+            OScInternal_Device_GetNumberOfChannels(detectorDevice, &nch);
         if (err != OSc_OK)
             return err;
-        if (*bytesPerSample == 0 || *bytesPerSample == bps)
-            *bytesPerSample = bps;
-        else
-            return OScInternal_Error_NonUniformBytesPerSample();
+        if (channel < nch)
+            return OScInternal_Device_GetSampleFormat(detectorDevice,
+                                                      channel, format);
+        channel -= nch;
     }
-    if (*bytesPerSample == 0)
+    return OScInternal_Error_OutOfRange();
+}
+
+OSc_RichError *OSc_AcqTemplate_SetSampleFormat(OSc_AcqTemplate *tmpl,
+                                               OSc_SampleFormat format) {
+    if (!tmpl)
+        return OScInternal_Error_IllegalArgument();
+    if (format != OSc_SampleFormat_Auto &&
+        (!OScInternal_SampleFormat_IsValid(format) ||
+         format == OSc_SampleFormat_UInt12Packed))
+        return OScInternal_Error_IllegalArgument();
+    tmpl->sampleFormat = format;
+    return OSc_OK;
+}
+
+OSc_RichError *OSc_AcqTemplate_GetSampleFormat(OSc_AcqTemplate *tmpl,
+                                               OSc_SampleFormat *format) {
+    if (!tmpl || !format)
+        return OScInternal_Error_IllegalArgument();
+
+    uint32_t nChannels;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(
+            err, OSc_AcqTemplate_GetNumberOfChannels(tmpl, &nChannels)))
+        return err;
+    if (nChannels == 0)
         return OScInternal_Error_NoDetectorDeviceEnabled();
+
+    if (tmpl->sampleFormat != OSc_SampleFormat_Auto) {
+        *format = tmpl->sampleFormat;
+        return OSc_OK;
+    }
+
+    // Promoting a format with itself only unpacks the packed format
+    for (uint32_t ch = 0; ch < nChannels; ++ch) {
+        OSc_SampleFormat channelFormat;
+        if (OSc_CHECK_ERROR(err, OSc_AcqTemplate_GetChannelSampleFormat(
+                                     tmpl, ch, &channelFormat)))
+            return err;
+        *format = OScInternal_SampleFormat_Promote(
+            ch == 0 ? channelFormat : *format, channelFormat);
+    }
     return OSc_OK;
 }
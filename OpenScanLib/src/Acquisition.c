@@ -1,21 +1,52 @@
+#include "FrameRing.h"
 #include "InternalErrors.h"
+#include "OMETiffWriter.h"
 #include "OpenScanLibPrivate.h"
+#include "Phasor.h"
+#include "Pipeline.h"
+#include "PhotonCounting.h"
+#include "Pyramid.h"
+#include "RawWriter.h"
+#include "Remap.h"
+#include "SampleFormat.h"
+#include "StorageThroughput.h"
+#include "StreamServer.h"
+#include "Threads.h"
+#include "TimeTag.h"
+#include "ZarrWriter.h"
 
 #include <assert.h>
 #include <math.h>
 #include <stdlib.h>
 
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
 struct OScInternal_AcquisitionForDevice {
     OSc_Device *device;
     OSc_Acquisition *acq;
     size_t detectorIndex; // SIZE_MAX if not detector
 };
 
+struct PhotonThreshold {
+    uint32_t lower;
+    uint32_t upper;
+};
+
+// Lifetime histogram builder for the time tags of one detector device
+struct DeviceHistogram {
+    OSc_Acquisition *acq;
+    uint32_t firstChannel; // Of the histogram frames (channel x bin)
+    OScInternal_LifetimeHistogram *histogram;
+};
+
 struct OScInternal_Acquisition {
     OSc_Device *clockDevice;
     OSc_Device *scannerDevice;
     OScInternal_PtrArray *detectorDevices;
     OSc_FrameCallback frameCallback;
+    OSc_TimeTagCallback timeTagCallback;
     void *data;
 
     uint32_t numberOfFrames;
@@ -32,7 +63,75 @@ struct OScInternal_Acquisition {
     OScInternal_NumArray *channelOffsets;
 
     uint32_t numberOfChannels;
-    uint32_t bytesPerSample;
+
+    // Frames of channels whose native format (indexed by global channel)
+    // differs from the common sample format are converted on arrival into
+    // conversionBuffer (allocated while armed), which holds one frame per
+    // channel.
+    OSc_SampleFormat sampleFormat;
+    uint32_t bytesPerSample; // Of sampleFormat
+    OSc_SampleFormat *channelFormats;
+    void *conversionBuffer;
+
+    // Photon counting. When samplesPerPixel is nonzero, detectors send that
+    // many raw samples per pixel, which are discriminated into counts of
+    // bytesPerCount each. Thresholds are indexed by global channel. Counts
+    // are written to photonBuffer (allocated while armed), which holds one
+    // frame per channel.
+    uint32_t samplesPerPixel;
+    uint32_t bytesPerCount;
+    struct PhotonThreshold *photonThresholds;
+    void *photonBuffer;
+
+    // Lifetime histograms built from time tags. When microtimeBins is
+    // nonzero, each channel is expanded into that many time bin channels.
+    // Histogram builders (allocated while armed) are indexed by detector
+    // device.
+    uint32_t microtimeBins;
+    uint32_t microtimeShift;
+    double macrotimeClockHz;
+    struct DeviceHistogram *deviceHistograms;
+
+    // Phasor analysis. When phasorHarmonic is nonzero, the channels (after
+    // photon counting or histogram building, if enabled) are the time bins
+    // of per-pixel lifetime histograms, and the frame callback instead
+    // receives the three float images G, S, and intensity, computed into
+    // phasorOutput when the last time bin of a frame arrives.
+    uint32_t phasorHarmonic;
+    OScInternal_Mutex phasorMutex; // Guards the calibration
+    double phasorPhaseShift;
+    double phasorModulationScale;
+    // Guards the fields below; held while the output images are delivered,
+    // so that they cannot be overwritten by the next frame while in use
+    OScInternal_Mutex phasorOutputMutex;
+    OScInternal_Phasor *phasor;
+    float *phasorOutput;
+
+    // Geometric correction (scan rotation, field distortion). When a map is
+    // set (while armed), frames are resampled into remapBuffer, which holds
+    // one frame per channel.
+    double scanRotationDegrees;
+    OSc_FieldDistortionFunc distortionFunc;
+    void *distortionData;
+    OScInternal_RemapMap *remapMap;
+    void *remapBuffer;
+
+    // Preview pyramid. When previewLevels is nonzero, output frames are
+    // downsampled into the pyramid of their channel (allocated while armed,
+    // indexed by output channel), whose levels are passed to
+    // previewCallback. The number of pyramids is kept because the number of
+    // output channels can change before they are released.
+    uint32_t previewLevels;
+    OSc_PreviewCallback previewCallback;
+    OScInternal_Pyramid **pyramids;
+    uint32_t numberOfPyramids;
+
+    // Processing pipeline, created when the first stage is added. Output
+    // frames are pushed to it after the callbacks.
+    OScInternal_Pipeline *pipeline;
+    OSc_StorageCompression storageCompression; // Of storage stages
+    uint32_t commitFrames; // Index commit interval of storage stages
+    uint32_t commitMilliseconds;
 
     // We can pass opaque pointers to these structs to devices, so that we can
     // handle acquisition-related calls in a device-specific manner.
@@ -70,11 +169,31 @@ OSc_RichError *OSc_Acquisition_Create(OSc_Acquisition **acq,
     if (nChans == 0)
         return OScInternal_Error_NoDetectorChannelEnabled();
 
-    uint32_t bytesPerSamp;
-    err = OSc_AcqTemplate_GetBytesPerSample(tmpl, &bytesPerSamp);
+    OSc_SampleFormat sampleFormat;
+    err = OSc_AcqTemplate_GetSampleFormat(tmpl, &sampleFormat);
     if (err != OSc_OK)
         return err;
 
+    OSc_SampleFormat *channelFormats =
+        malloc(nChans * sizeof(OSc_SampleFormat));
+    if (!channelFormats)
+        return OScInternal_Error_OutOfMemory();
+    for (uint32_t ch = 0; ch < nChans; ++ch) {
+        err = OSc_AcqTemplate_GetChannelSampleFormat(tmpl, ch,
+                                                     &channelFormats[ch]);
+        if (err != OSc_OK) {
+            free(channelFormats);
+            return err;
+        }
+    }
+
+    struct PhotonThreshold *photonThresholds =
+        malloc(nChans * sizeof(struct PhotonThreshold));
+    if (!photonThresholds) {
+        free(channelFormats);
+        return OScInternal_Error_OutOfMemory();
+    }
+
     *acq = calloc(1, sizeof(OSc_Acquisition));
 
     (*acq)->clockDevice = OSc_LSM_GetClockDevice(lsm);
@@ -100,6 +219,8 @@ OSc_RichError *OSc_Acquisition_Create(OSc_Acquisition **acq,
     }
 
     (*acq)->numberOfFrames = OSc_AcqTemplate_GetNumberOfFrames(tmpl);
+    (*acq)->commitFrames = OSc_DEFAULT_COMMIT_FRAMES;
+    (*acq)->commitMilliseconds = OSc_DEFAULT_COMMIT_MILLISECONDS;
     OSc_Setting *setting;
     OSc_AcqTemplate_GetPixelRateSetting(tmpl, &setting);
     OSc_Setting_GetFloat64Value(setting, &(*acq)->pixelRateHz);
@@ -111,7 +232,23 @@ OSc_RichError *OSc_Acquisition_Create(OSc_Acquisition **acq,
                            &(*acq)->width, &(*acq)->height);
 
     (*acq)->numberOfChannels = nChans;
-    (*acq)->bytesPerSample = bytesPerSamp;
+    (*acq)->sampleFormat = sampleFormat;
+    (*acq)->bytesPerSample =
+        OScInternal_SampleFormat_GetBytesPerSample(sampleFormat);
+    (*acq)->channelFormats = channelFormats;
+
+    // Default to a threshold at half of the raw sample range
+    (*acq)->photonThresholds = photonThresholds;
+    uint32_t midRange =
+        (OScInternal_SampleFormat_GetMaxValue(sampleFormat) >> 1) + 1;
+    for (uint32_t ch = 0; ch < nChans; ++ch) {
+        (*acq)->photonThresholds[ch].lower = midRange;
+        (*acq)->photonThresholds[ch].upper = midRange;
+    }
+
+    OScInternal_Mutex_Init(&(*acq)->phasorMutex);
+    OScInternal_Mutex_Init(&(*acq)->phasorOutputMutex);
+    (*acq)->phasorModulationScale = 1.0;
 
     (*acq)->acqForClockDevice.device = (*acq)->clockDevice;
     (*acq)->acqForClockDevice.acq = *acq;
@@ -133,7 +270,297 @@ OSc_RichError *OSc_Acquisition_Create(OSc_Acquisition **acq,
     return OSc_OK;
 }
 
+static void ReleaseRemap(OSc_Acquisition *acq) {
+    OScInternal_RemapMap_Release(acq->remapMap);
+    acq->remapMap = NULL;
+    free(acq->remapBuffer);
+    acq->remapBuffer = NULL;
+}
+
+// Sample format after photon counting or histogram building, if enabled
+static OSc_SampleFormat GetCountSampleFormat(OSc_Acquisition *acq) {
+    if (acq->microtimeBins)
+        return OSc_SampleFormat_UInt16;
+    if (acq->samplesPerPixel)
+        return acq->bytesPerCount == 1 ? OSc_SampleFormat_UInt8
+                                       : OSc_SampleFormat_UInt16;
+    return acq->sampleFormat;
+}
+
+static uint32_t GetCountBytesPerSample(OSc_Acquisition *acq) {
+    return OScInternal_SampleFormat_GetBytesPerSample(
+        GetCountSampleFormat(acq));
+}
+
+// Number of channels after histogram building, if enabled
+static uint32_t GetCountNumberOfChannels(OSc_Acquisition *acq) {
+    if (acq->microtimeBins)
+        return acq->numberOfChannels * acq->microtimeBins;
+    return acq->numberOfChannels;
+}
+
+// Sample format of the frames passed to the frame callback
+static OSc_SampleFormat GetOutputSampleFormat(OSc_Acquisition *acq) {
+    return acq->phasorHarmonic ? OSc_SampleFormat_Float32
+                               : GetCountSampleFormat(acq);
+}
+
+static uint32_t GetOutputBytesPerSample(OSc_Acquisition *acq) {
+    return OScInternal_SampleFormat_GetBytesPerSample(
+        GetOutputSampleFormat(acq));
+}
+
+// Number of channels passed to the frame callback
+static uint32_t GetOutputNumberOfChannels(OSc_Acquisition *acq) {
+    return acq->phasorHarmonic ? 3 : GetCountNumberOfChannels(acq);
+}
+
+static size_t GetNumberOfPixels(OSc_Acquisition *acq) {
+    return (size_t)acq->width * acq->height;
+}
+
+// Bytes per output frame
+static size_t GetFrameBytes(OSc_Acquisition *acq) {
+    return GetNumberOfPixels(acq) * GetOutputBytesPerSample(acq);
+}
+
+static size_t GetCountFrameBytes(OSc_Acquisition *acq) {
+    return GetNumberOfPixels(acq) * acq->bytesPerCount;
+}
+
+// Samples per frame sent by the detectors for one channel
+static size_t GetNumberOfRawSamples(OSc_Acquisition *acq) {
+    return GetNumberOfPixels(acq) * OSc_Acquisition_GetSamplesPerPixel(acq);
+}
+
+// UInt12 samples need no conversion to UInt16
+static bool NeedsConversion(OSc_Acquisition *acq, uint32_t channel) {
+    OSc_SampleFormat native = acq->channelFormats[channel];
+    return native != acq->sampleFormat &&
+           !(native == OSc_SampleFormat_UInt12 &&
+             acq->sampleFormat == OSc_SampleFormat_UInt16);
+}
+
+static OSc_RichError *PrepareConversion(OSc_Acquisition *acq) {
+    free(acq->conversionBuffer);
+    acq->conversionBuffer = NULL;
+    bool needed = false;
+    for (uint32_t ch = 0; ch < acq->numberOfChannels; ++ch)
+        needed |= NeedsConversion(acq, ch);
+    if (!needed)
+        return OSc_OK;
+
+    acq->conversionBuffer =
+        malloc(GetNumberOfRawSamples(acq) * acq->bytesPerSample *
+               acq->numberOfChannels);
+    if (!acq->conversionBuffer)
+        return OScInternal_Error_OutOfMemory();
+    return OSc_OK;
+}
+
+static OSc_RichError *PreparePhotonCounting(OSc_Acquisition *acq) {
+    free(acq->photonBuffer);
+    acq->photonBuffer = NULL;
+    if (!acq->samplesPerPixel)
+        return OSc_OK;
+
+    // Thresholds must be representable in the raw sample type
+    if (!OScInternal_SampleFormat_IsUnsignedInteger(acq->sampleFormat))
+        return OScInternal_Error_UnsupportedOperation();
+    uint32_t maxSample =
+        OScInternal_SampleFormat_GetMaxValue(acq->sampleFormat);
+    for (uint32_t ch = 0; ch < acq->numberOfChannels; ++ch) {
+        if (acq->photonThresholds[ch].upper > maxSample)
+            return OScInternal_Error_IllegalArgument();
+    }
+
+    acq->photonBuffer =
+        malloc(GetCountFrameBytes(acq) * acq->numberOfChannels);
+    if (!acq->photonBuffer)
+        return OScInternal_Error_OutOfMemory();
+    return OSc_OK;
+}
+
+static bool ProcessCountFrame(OSc_Acquisition *acq, uint32_t channel,
+                              void *pixels);
+
+static bool HistogramFrame(void *data, uint32_t channel,
+                           const uint16_t *counts) {
+    struct DeviceHistogram *dh = data;
+    return ProcessCountFrame(dh->acq, dh->firstChannel + channel,
+                             (void *)counts);
+}
+
+static void ReleaseHistograms(OSc_Acquisition *acq) {
+    if (!acq->deviceHistograms)
+        return;
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(acq->detectorDevices);
+         ++i)
+        OScInternal_LifetimeHistogram_Destroy(
+            acq->deviceHistograms[i].histogram);
+    free(acq->deviceHistograms);
+    acq->deviceHistograms = NULL;
+}
+
+static OSc_RichError *PrepareHistograms(OSc_Acquisition *acq) {
+    ReleaseHistograms(acq);
+    if (!acq->microtimeBins)
+        return OSc_OK;
+    if (acq->samplesPerPixel)
+        return OScInternal_Error_UnsupportedOperation();
+
+    size_t nDevices = OScInternal_PtrArray_Size(acq->detectorDevices);
+    acq->deviceHistograms = calloc(nDevices, sizeof(struct DeviceHistogram));
+    if (!acq->deviceHistograms)
+        return OScInternal_Error_OutOfMemory();
+
+    for (size_t i = 0; i < nDevices; ++i) {
+        uint32_t offset =
+            (uint32_t)OScInternal_NumArray_At(acq->channelOffsets, i);
+        uint32_t end =
+            i + 1 < nDevices
+                ? (uint32_t)OScInternal_NumArray_At(acq->channelOffsets, i + 1)
+                : acq->numberOfChannels;
+        struct DeviceHistogram *dh = &acq->deviceHistograms[i];
+        dh->acq = acq;
+        dh->firstChannel = offset * acq->microtimeBins;
+        if (end == offset)
+            continue;
+
+        struct OScInternal_LifetimeHistogramParams params = {
+            .width = acq->width,
+            .height = acq->height,
+            .numberOfChannels = end - offset,
+            .microtimeBins = acq->microtimeBins,
+            .microtimeShift = acq->microtimeShift,
+            .ticksPerPixel = acq->macrotimeClockHz / acq->pixelRateHz,
+        };
+        OSc_RichError *err;
+        if (OSc_CHECK_ERROR(err, OScInternal_LifetimeHistogram_Create(
+                                     &dh->histogram, &params, HistogramFrame,
+                                     dh))) {
+            ReleaseHistograms(acq);
+            return err;
+        }
+    }
+    return OSc_OK;
+}
+
+static void ReleasePhasor(OSc_Acquisition *acq) {
+    OScInternal_Phasor_Destroy(acq->phasor);
+    acq->phasor = NULL;
+    free(acq->phasorOutput);
+    acq->phasorOutput = NULL;
+}
+
+static OSc_RichError *PreparePhasor(OSc_Acquisition *acq) {
+    ReleasePhasor(acq);
+    if (!acq->phasorHarmonic)
+        return OSc_OK;
+
+    // Time bins are accumulated as unsigned integers
+    if (!OScInternal_SampleFormat_IsUnsignedInteger(GetCountSampleFormat(acq)))
+        return OScInternal_Error_UnsupportedOperation();
+
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OScInternal_Phasor_Create(
+                                 &acq->phasor, GetNumberOfPixels(acq),
+                                 GetCountNumberOfChannels(acq),
+                                 acq->phasorHarmonic)))
+        return err;
+    acq->phasorOutput = malloc(GetFrameBytes(acq) * 3);
+    if (!acq->phasorOutput) {
+        ReleasePhasor(acq);
+        return OScInternal_Error_OutOfMemory();
+    }
+    return OSc_OK;
+}
+
+static OSc_RichError *PrepareRemap(OSc_Acquisition *acq) {
+    ReleaseRemap(acq);
+
+    struct OScInternal_RemapGeometry geometry = {
+        .resolution = acq->resolution,
+        .zoomFactor = acq->zoomFactor,
+        .xOffset = acq->xOffset,
+        .yOffset = acq->yOffset,
+        .width = acq->width,
+        .height = acq->height,
+        .rotationDegrees = acq->scanRotationDegrees,
+        .distortionFunc = acq->distortionFunc,
+        .distortionData = acq->distortionData,
+    };
+    if (OScInternal_RemapGeometry_IsIdentity(&geometry))
+        return OSc_OK;
+
+    // Integer samples are interpolated as unsigned
+    OSc_SampleFormat format = GetOutputSampleFormat(acq);
+    if (format != OSc_SampleFormat_Float32 &&
+        !OScInternal_SampleFormat_IsUnsignedInteger(format))
+        return OScInternal_Error_UnsupportedOperation();
+
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OScInternal_RemapMap_Get(&geometry,
+                                                      &acq->remapMap)))
+        return err;
+    acq->remapBuffer =
+        malloc(GetFrameBytes(acq) * GetOutputNumberOfChannels(acq));
+    if (!acq->remapBuffer) {
+        ReleaseRemap(acq);
+        return OScInternal_Error_OutOfMemory();
+    }
+    return OSc_OK;
+}
+
+static void ReleasePyramids(OSc_Acquisition *acq) {
+    if (!acq->pyramids)
+        return;
+    for (uint32_t ch = 0; ch < acq->numberOfPyramids; ++ch)
+        OScInternal_Pyramid_Destroy(acq->pyramids[ch]);
+    free(acq->pyramids);
+    acq->pyramids = NULL;
+    acq->numberOfPyramids = 0;
+}
+
+static OSc_RichError *PreparePyramids(OSc_Acquisition *acq) {
+    ReleasePyramids(acq);
+    uint32_t maxLevels =
+        OScInternal_Pyramid_GetMaxLevels(acq->width, acq->height);
+    uint32_t levels =
+        acq->previewLevels < maxLevels ? acq->previewLevels : maxLevels;
+    if (levels == 0)
+        return OSc_OK;
+
+    uint32_t nChannels = GetOutputNumberOfChannels(acq);
+    acq->pyramids = calloc(nChannels, sizeof(OScInternal_Pyramid *));
+    if (!acq->pyramids)
+        return OScInternal_Error_OutOfMemory();
+    acq->numberOfPyramids = nChannels;
+    for (uint32_t ch = 0; ch < nChannels; ++ch) {
+        OSc_RichError *err;
+        if (OSc_CHECK_ERROR(err, OScInternal_Pyramid_Create(
+                                     &acq->pyramids[ch], acq->width,
+                                     acq->height, levels,
+                                     GetOutputSampleFormat(acq)))) {
+            ReleasePyramids(acq);
+            return err;
+        }
+    }
+    return OSc_OK;
+}
+
 OSc_RichError *OSc_Acquisition_Destroy(OSc_Acquisition *acq) {
+    OScInternal_Pipeline_Destroy(acq->pipeline);
+    ReleasePyramids(acq);
+    ReleaseRemap(acq);
+    free(acq->conversionBuffer);
+    free(acq->channelFormats);
+    free(acq->photonBuffer);
+    free(acq->photonThresholds);
+    ReleaseHistograms(acq);
+    ReleasePhasor(acq);
+    OScInternal_Mutex_Destroy(&acq->phasorOutputMutex);
+    OScInternal_Mutex_Destroy(&acq->phasorMutex);
     for (size_t i = 0;
          i < OScInternal_PtrArray_Size(acq->acqsForDetectorDevices); ++i)
         free(OScInternal_PtrArray_At(acq->acqsForDetectorDevices, i));
@@ -156,6 +583,13 @@ OSc_RichError *OSc_Acquisition_SetFrameCallback(OSc_Acquisition *acq,
     return OSc_OK;
 }
 
+OSc_RichError *
+OSc_Acquisition_SetTimeTagCallback(OSc_Acquisition *acq,
+                                   OSc_TimeTagCallback callback) {
+    acq->timeTagCallback = callback;
+    return OSc_OK;
+}
+
 OSc_RichError *OSc_Acquisition_GetData(OSc_Acquisition *acq, void **data) {
     *data = acq->data;
     return OSc_OK;
@@ -213,7 +647,7 @@ OSc_Acquisition_GetNumberOfChannels(OSc_Acquisition *acq,
                                     uint32_t *numberOfChannels) {
     if (!acq || !numberOfChannels)
         return OScInternal_Error_IllegalArgument();
-    *numberOfChannels = acq->numberOfChannels;
+    *numberOfChannels = GetOutputNumberOfChannels(acq);
     return OSc_OK;
 }
 
@@ -221,13 +655,296 @@ OSc_RichError *OSc_Acquisition_GetBytesPerSample(OSc_Acquisition *acq,
                                                  uint32_t *bytesPerSample) {
     if (!acq || !bytesPerSample)
         return OScInternal_Error_IllegalArgument();
-    *bytesPerSample = acq->bytesPerSample;
+    *bytesPerSample = GetOutputBytesPerSample(acq);
     return OSc_OK;
 }
 
-OSc_RichError *OSc_Acquisition_Arm(OSc_Acquisition *acq) {
-    // Arm each device participating in the acquisition exactly once each
+OSc_RichError *OSc_Acquisition_GetSampleFormat(OSc_Acquisition *acq,
+                                               OSc_SampleFormat *format) {
+    if (!acq || !format)
+        return OScInternal_Error_IllegalArgument();
+    *format = GetOutputSampleFormat(acq);
+    return OSc_OK;
+}
+
+OSc_RichError *OSc_Acquisition_SetPhotonCounting(OSc_Acquisition *acq,
+                                                 uint32_t samplesPerPixel,
+                                                 uint32_t bytesPerCount) {
+    if (!acq)
+        return OScInternal_Error_IllegalArgument();
+    if (samplesPerPixel > 0 && bytesPerCount != 1 && bytesPerCount != 2)
+        return OScInternal_Error_IllegalArgument();
+    acq->samplesPerPixel = samplesPerPixel;
+    acq->bytesPerCount = samplesPerPixel > 0 ? bytesPerCount : 0;
+    return OSc_OK;
+}
+
+uint32_t OSc_Acquisition_GetSamplesPerPixel(OSc_Acquisition *acq) {
+    if (!acq)
+        return 0;
+    return acq->samplesPerPixel ? acq->samplesPerPixel : 1;
+}
+
+OSc_RichError *OSc_Acquisition_SetPhotonThreshold(OSc_Acquisition *acq,
+                                                  uint32_t channel,
+                                                  uint32_t lower,
+                                                  uint32_t upper) {
+    if (!acq || lower > upper)
+        return OScInternal_Error_IllegalArgument();
+    if (channel >= acq->numberOfChannels)
+        return OScInternal_Error_OutOfRange();
+    acq->photonThresholds[channel].lower = lower;
+    acq->photonThresholds[channel].upper = upper;
+    return OSc_OK;
+}
+
+OSc_RichError *OSc_Acquisition_SetScanRotation(OSc_Acquisition *acq,
+                                               double degrees) {
+    if (!acq || !isfinite(degrees))
+        return OScInternal_Error_IllegalArgument();
+    acq->scanRotationDegrees = degrees;
+    return OSc_OK;
+}
+
+double OSc_Acquisition_GetScanRotation(OSc_Acquisition *acq) {
+    if (!acq)
+        return NAN;
+    return acq->scanRotationDegrees;
+}
+
+OSc_RichError *
+OSc_Acquisition_SetFieldDistortion(OSc_Acquisition *acq,
+                                   OSc_FieldDistortionFunc func, void *data) {
+    if (!acq)
+        return OScInternal_Error_IllegalArgument();
+    acq->distortionFunc = func;
+    acq->distortionData = func ? data : NULL;
+    return OSc_OK;
+}
+
+OSc_RichError *OSc_Acquisition_SetPhasorAnalysis(OSc_Acquisition *acq,
+                                                 uint32_t harmonic) {
+    if (!acq)
+        return OScInternal_Error_IllegalArgument();
+    acq->phasorHarmonic = harmonic;
+    return OSc_OK;
+}
+
+OSc_RichError *OSc_Acquisition_SetPhasorCalibration(OSc_Acquisition *acq,
+                                                    double phaseShift,
+                                                    double modulationScale) {
+    if (!acq || !isfinite(phaseShift) || !isfinite(modulationScale) ||
+        modulationScale <= 0.0)
+        return OScInternal_Error_IllegalArgument();
+    OScInternal_Mutex_Lock(&acq->phasorMutex);
+    acq->phasorPhaseShift = phaseShift;
+    acq->phasorModulationScale = modulationScale;
+    OScInternal_Mutex_Unlock(&acq->phasorMutex);
+    return OSc_OK;
+}
+
+OSc_RichError *OSc_Acquisition_CalibratePhasor(OSc_Acquisition *acq,
+                                               double referenceG,
+                                               double referenceS,
+                                               double referenceLifetime,
+                                               double laserFrequencyHz) {
+    if (!acq || acq->phasorHarmonic == 0)
+        return OScInternal_Error_IllegalArgument();
+    double measuredModulation = hypot(referenceG, referenceS);
+    if (!(measuredModulation > 0.0) || !(referenceLifetime >= 0.0) ||
+        !(laserFrequencyHz > 0.0))
+        return OScInternal_Error_IllegalArgument();
+
+    // A single-exponential decay with lifetime tau has phase atan(omega tau)
+    // and modulation 1 / sqrt(1 + (omega tau)^2).
+    double omegaTau = 2.0 * M_PI * acq->phasorHarmonic * laserFrequencyHz *
+                      referenceLifetime;
+    double expectedPhase = atan(omegaTau);
+    double expectedModulation = 1.0 / sqrt(1.0 + omegaTau * omegaTau);
+    return OSc_Acquisition_SetPhasorCalibration(
+        acq, expectedPhase - atan2(referenceS, referenceG),
+        expectedModulation / measuredModulation);
+}
+
+OSc_RichError *OSc_Acquisition_SetLifetimeHistogram(
+    OSc_Acquisition *acq, uint32_t microtimeBins, uint32_t microtimeShift,
+    double macrotimeClockHz) {
+    if (!acq)
+        return OScInternal_Error_IllegalArgument();
+    if (microtimeBins > 0 &&
+        (microtimeShift >= 16 || !(macrotimeClockHz > 0.0)))
+        return OScInternal_Error_IllegalArgument();
+    acq->microtimeBins = microtimeBins;
+    acq->microtimeShift = microtimeShift;
+    acq->macrotimeClockHz = macrotimeClockHz;
+    return OSc_OK;
+}
+
+OSc_RichError *
+OSc_Acquisition_SetPreviewPyramid(OSc_Acquisition *acq,
+                                  uint32_t numberOfLevels,
+                                  OSc_PreviewCallback callback) {
+    if (!acq || (numberOfLevels > 0 && !callback))
+        return OScInternal_Error_IllegalArgument();
+    acq->previewLevels = numberOfLevels;
+    acq->previewCallback = numberOfLevels > 0 ? callback : NULL;
+    return OSc_OK;
+}
+
+static OSc_RichError *GetPipeline(OSc_Acquisition *acq,
+                                  OScInternal_Pipeline **pipeline) {
+    if (!acq->pipeline) {
+        OSc_RichError *err;
+        if (OSc_CHECK_ERROR(err, OScInternal_Pipeline_Create(&acq->pipeline,
+                                                             acq)))
+            return err;
+    }
+    *pipeline = acq->pipeline;
+    return OSc_OK;
+}
+
+OSc_RichError *OSc_Acquisition_AddPipelineStage(
+    OSc_Acquisition *acq, OSc_PipelineStageFunc func, void *data,
+    uint32_t queueDepth, OSc_PipelineStage **stage) {
+    if (!acq || !func || !stage)
+        return OScInternal_Error_IllegalArgument();
+    OScInternal_Pipeline *pipeline;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, GetPipeline(acq, &pipeline)))
+        return err;
+    return OScInternal_Pipeline_AddStage(pipeline, func, data, NULL,
+                                         queueDepth, stage);
+}
+
+OSc_RichError *
+OSc_Acquisition_AddDownsampleStage(OSc_Acquisition *acq, uint32_t level,
+                                   uint32_t queueDepth,
+                                   OSc_PipelineStage **stage) {
+    if (!acq || !stage)
+        return OScInternal_Error_IllegalArgument();
+    OScInternal_Pipeline *pipeline;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, GetPipeline(acq, &pipeline)))
+        return err;
+    return OScInternal_Pipeline_AddDownsampleStage(pipeline, level,
+                                                   queueDepth, stage);
+}
+
+OSc_RichError *
+OSc_Acquisition_SetStorageCompression(OSc_Acquisition *acq,
+                                      OSc_StorageCompression compression) {
+    if (!acq || (compression != OSc_StorageCompression_None &&
+                 compression != OSc_StorageCompression_Lossless))
+        return OScInternal_Error_IllegalArgument();
+    acq->storageCompression = compression;
+    return OSc_OK;
+}
+
+OSc_StorageCompression
+OSc_Acquisition_GetStorageCompression(OSc_Acquisition *acq) {
+    if (!acq)
+        return OSc_StorageCompression_None;
+    return acq->storageCompression;
+}
+
+OSc_RichError *OSc_Acquisition_SetRecordingCommitInterval(
+    OSc_Acquisition *acq, uint32_t frames, uint32_t milliseconds) {
+    if (!acq)
+        return OScInternal_Error_IllegalArgument();
+    acq->commitFrames = frames;
+    acq->commitMilliseconds = milliseconds;
+    return OSc_OK;
+}
+
+void OSc_Acquisition_GetRecordingCommitInterval(OSc_Acquisition *acq,
+                                                uint32_t *frames,
+                                                uint32_t *milliseconds) {
+    if (frames)
+        *frames = acq ? acq->commitFrames : 0;
+    if (milliseconds)
+        *milliseconds = acq ? acq->commitMilliseconds : 0;
+}
+
+OSc_RichError *
+OSc_Acquisition_AddRawWriterStage(OSc_Acquisition *acq, const char *path,
+                                  uint32_t queueDepth,
+                                  OSc_PipelineStage **stage) {
+    if (!acq || !path || !stage)
+        return OScInternal_Error_IllegalArgument();
+    OScInternal_Pipeline *pipeline;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, GetPipeline(acq, &pipeline)))
+        return err;
+    return OScInternal_RawWriter_AddStage(pipeline, path, queueDepth, stage);
+}
+
+OSc_RichError *
+OSc_Acquisition_AddOMETiffWriterStage(OSc_Acquisition *acq, const char *path,
+                                      uint32_t queueDepth,
+                                      OSc_PipelineStage **stage) {
+    if (!acq || !path || !stage)
+        return OScInternal_Error_IllegalArgument();
+    OScInternal_Pipeline *pipeline;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, GetPipeline(acq, &pipeline)))
+        return err;
+    return OScInternal_OMETiffWriter_AddStage(pipeline, path, queueDepth,
+                                              stage);
+}
+
+OSc_RichError *
+OSc_Acquisition_AddZarrWriterStage(OSc_Acquisition *acq, const char *path,
+                                   uint32_t queueDepth,
+                                   OSc_PipelineStage **stage) {
+    if (!acq || !path || !stage)
+        return OScInternal_Error_IllegalArgument();
+    OScInternal_Pipeline *pipeline;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, GetPipeline(acq, &pipeline)))
+        return err;
+    return OScInternal_ZarrWriter_AddStage(pipeline, path, queueDepth, stage);
+}
+
+OSc_RichError *OSc_Acquisition_AddFrameRingStage(
+    OSc_Acquisition *acq, const char *name, uint32_t numberOfSlots,
+    uint32_t queueDepth, OSc_PipelineStage **stage) {
+    if (!acq || !name || !stage)
+        return OScInternal_Error_IllegalArgument();
+    OScInternal_Pipeline *pipeline;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, GetPipeline(acq, &pipeline)))
+        return err;
+    return OScInternal_FrameRing_AddStage(pipeline, name, numberOfSlots,
+                                          queueDepth, stage);
+}
+
+OSc_RichError *OSc_Acquisition_AddStreamServerStage(
+    OSc_Acquisition *acq, const char *address,
+    OSc_StorageCompression compression, uint32_t clientQueueDepth,
+    uint32_t queueDepth, OSc_PipelineStage **stage) {
+    if (!acq || !address || !stage)
+        return OScInternal_Error_IllegalArgument();
+    OScInternal_Pipeline *pipeline;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, GetPipeline(acq, &pipeline)))
+        return err;
+    return OScInternal_StreamServer_AddStage(
+        pipeline, address, compression, clientQueueDepth, queueDepth, stage);
+}
+
+OSc_RichError *
+OSc_Acquisition_CheckStorageThroughput(OSc_Acquisition *acq,
+                                       double *requiredBytesPerSecond,
+                                       double *availableBytesPerSecond) {
+    if (!acq || !requiredBytesPerSecond || !availableBytesPerSecond)
+        return OScInternal_Error_IllegalArgument();
+    return OScInternal_StorageThroughput_Check(acq->pipeline, acq,
+                                               requiredBytesPerSecond,
+                                               availableBytesPerSecond);
+}
 
+// Arm each device participating in the acquisition exactly once each
+static OSc_RichError *ArmDevices(OSc_Acquisition *acq) {
     OSc_RichError *err;
 
     // Clock
@@ -267,6 +984,42 @@ OSc_RichError *OSc_Acquisition_Arm(OSc_Acquisition *acq) {
     return OSc_OK;
 }
 
+OSc_RichError *OSc_Acquisition_Arm(OSc_Acquisition *acq) {
+    OSc_RichError *err;
+
+    // Set up processing before any device can start sending frames
+    if (OSc_CHECK_ERROR(err, PrepareConversion(acq)))
+        return err;
+    if (OSc_CHECK_ERROR(err, PreparePhotonCounting(acq)))
+        return err;
+    if (OSc_CHECK_ERROR(err, PrepareHistograms(acq)))
+        return err;
+    if (OSc_CHECK_ERROR(err, PreparePhasor(acq)))
+        return err;
+    if (OSc_CHECK_ERROR(err, PrepareRemap(acq)))
+        return err;
+    if (OSc_CHECK_ERROR(err, PreparePyramids(acq)))
+        return err;
+    if (acq->pipeline) {
+        OScInternal_Pipeline_Reset(acq->pipeline);
+        // Open storage sinks
+        if (OSc_CHECK_ERROR(err, OScInternal_Pipeline_Start(acq->pipeline)))
+            return err;
+    }
+
+    if (OSc_CHECK_ERROR(err, ArmDevices(acq))) {
+        // Close the storage sinks again; the arm error is the one to report
+        if (acq->pipeline) {
+            OSc_RichError *finishErr =
+                OScInternal_Pipeline_Finish(acq->pipeline);
+            if (finishErr)
+                OScInternal_Error_Destroy(finishErr);
+        }
+        return err;
+    }
+    return OSc_OK;
+}
+
 OSc_RichError *OSc_Acquisition_Start(OSc_Acquisition *acq) {
     // TODO Error if not armed
     return OScInternal_Device_Start(acq->clockDevice);
@@ -293,6 +1046,9 @@ OSc_RichError *OSc_Acquisition_Wait(OSc_Acquisition *acq) {
         OScInternal_Device_Wait(
             OScInternal_PtrArray_At(acq->detectorDevices, i));
     }
+    // Complete storage sinks, reporting any write error
+    if (acq->pipeline)
+        return OScInternal_Pipeline_Finish(acq->pipeline);
     return OSc_OK;
 }
 
@@ -336,14 +1092,140 @@ OScDev_Acquisition *OScInternal_Acquisition_GetForDevice(OSc_Acquisition *acq,
     return NULL;
 }
 
+// Apply the final (per-output-channel) processing and call the callback
+static bool DeliverFrame(OSc_Acquisition *acq, uint32_t channel,
+                         void *pixels) {
+    if (acq->remapMap) {
+        void *remapped =
+            (char *)acq->remapBuffer + GetFrameBytes(acq) * channel;
+        if (GetOutputSampleFormat(acq) == OSc_SampleFormat_Float32)
+            OScInternal_RemapMap_ApplyFloat(acq->remapMap, pixels, remapped);
+        else
+            OScInternal_RemapMap_Apply(acq->remapMap, pixels, remapped,
+                                       GetOutputBytesPerSample(acq));
+        pixels = remapped;
+    }
+
+    if (acq->frameCallback &&
+        !acq->frameCallback(acq, channel, pixels, acq->data))
+        return false;
+
+    if (acq->pyramids) {
+        OScInternal_Pyramid *pyramid = acq->pyramids[channel];
+        OScInternal_Pyramid_Build(pyramid, pixels);
+        uint32_t levels = OScInternal_Pyramid_GetNumberOfLevels(pyramid);
+        for (uint32_t level = 1; level <= levels; ++level) {
+            uint32_t width, height;
+            OScInternal_Pyramid_GetLevelSize(acq->width, acq->height, level,
+                                             &width, &height);
+            if (!acq->previewCallback(
+                    acq, channel, level, width, height,
+                    (void *)OScInternal_Pyramid_GetLevel(pyramid, level),
+                    acq->data))
+                return false;
+        }
+    }
+
+    if (acq->pipeline)
+        return OScInternal_Pipeline_Push(acq->pipeline, channel, acq->width,
+                                         acq->height,
+                                         GetOutputSampleFormat(acq), pixels);
+    return true;
+}
+
+static bool AddPhasorBin(OSc_Acquisition *acq, uint32_t bin, void *pixels) {
+    bool shouldContinue = true;
+
+    OScInternal_Mutex_Lock(&acq->phasorOutputMutex);
+    if (OScInternal_Phasor_AddBin(acq->phasor, bin, pixels,
+                                  GetCountBytesPerSample(acq))) {
+        // The callbacks may set the calibration (for the next frame)
+        OScInternal_Mutex_Lock(&acq->phasorMutex);
+        double phaseShift = acq->phasorPhaseShift;
+        double modulationScale = acq->phasorModulationScale;
+        OScInternal_Mutex_Unlock(&acq->phasorMutex);
+
+        size_t nPixels = GetNumberOfPixels(acq);
+        float *output = acq->phasorOutput;
+        OScInternal_Phasor_Compute(
+            acq->phasor, phaseShift, modulationScale,
+            output + nPixels * OSc_PhasorChannel_G,
+            output + nPixels * OSc_PhasorChannel_S,
+            output + nPixels * OSc_PhasorChannel_Intensity);
+        for (uint32_t ch = 0; ch < 3 && shouldContinue; ++ch)
+            shouldContinue = DeliverFrame(acq, ch, output + nPixels * ch);
+    }
+    OScInternal_Mutex_Unlock(&acq->phasorOutputMutex);
+
+    return shouldContinue;
+}
+
+// Continue processing of a frame of counts (or raw samples, if neither photon
+// counting nor histogram building is enabled), indexed by count channel
+static bool ProcessCountFrame(OSc_Acquisition *acq, uint32_t channel,
+                              void *pixels) {
+    if (acq->phasor)
+        return AddPhasorBin(acq, channel, pixels);
+    return DeliverFrame(acq, channel, pixels);
+}
+
 bool OScInternal_Acquisition_CallFrameCallback(OSc_Acquisition *acq,
                                                size_t detectorIndex,
                                                uint32_t channel,
                                                void *pixels) {
-    if (acq->frameCallback == NULL)
+    if (acq->frameCallback == NULL && acq->pyramids == NULL &&
+        acq->pipeline == NULL)
         return true;
 
     uint32_t chanOffset =
         (uint32_t)OScInternal_NumArray_At(acq->channelOffsets, detectorIndex);
-    return acq->frameCallback(acq, chanOffset + channel, pixels, acq->data);
+    uint32_t globalChannel = chanOffset + channel;
+
+    if (NeedsConversion(acq, globalChannel)) {
+        size_t nSamples = GetNumberOfRawSamples(acq);
+        void *converted = (char *)acq->conversionBuffer +
+                          nSamples * acq->bytesPerSample * globalChannel;
+        OScInternal_ConvertSamples(pixels, acq->channelFormats[globalChannel],
+                                   converted, acq->sampleFormat, nSamples);
+        pixels = converted;
+    }
+
+    if (acq->photonBuffer) {
+        struct OScInternal_PhotonCountParams params = {
+            .width = acq->width,
+            .height = acq->height,
+            .samplesPerPixel = acq->samplesPerPixel,
+            .bytesPerSample = acq->bytesPerSample,
+            .bytesPerCount = acq->bytesPerCount,
+            .lowerThreshold = acq->photonThresholds[globalChannel].lower,
+            .upperThreshold = acq->photonThresholds[globalChannel].upper,
+        };
+        void *counts = (char *)acq->photonBuffer +
+                       GetCountFrameBytes(acq) * globalChannel;
+        OScInternal_PhotonCount(&params, pixels, counts);
+        pixels = counts;
+    }
+
+    return ProcessCountFrame(acq, globalChannel, pixels);
+}
+
+bool OScInternal_Acquisition_CallTimeTagCallback(OSc_Acquisition *acq,
+                                                 size_t detectorIndex,
+                                                 const uint64_t *timeTags,
+                                                 size_t count) {
+    uint32_t chanOffset =
+        (uint32_t)OScInternal_NumArray_At(acq->channelOffsets, detectorIndex);
+
+    if (acq->timeTagCallback &&
+        !acq->timeTagCallback(acq, chanOffset, timeTags, count, acq->data))
+        return false;
+
+    if (acq->deviceHistograms) {
+        OScInternal_LifetimeHistogram *histogram =
+            acq->deviceHistograms[detectorIndex].histogram;
+        if (histogram &&
+            !OScInternal_LifetimeHistogram_Add(histogram, timeTags, count))
+            return false;
+    }
+    return true;
 }
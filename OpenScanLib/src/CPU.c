@@ -0,0 +1,81 @@
+#include "CPU.h"
+
+#ifdef OScInternal_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef OScInternal_X86
+
+static void CPUID(unsigned leaf, unsigned subleaf, unsigned regs[4]) {
+#ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, (int)leaf, (int)subleaf);
+    for (int i = 0; i < 4; ++i)
+        regs[i] = (unsigned)r[i];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Extended processor state enabled by the OS (XCR0)
+static uint64_t GetEnabledXState(void) {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned lo, hi;
+    __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+static unsigned DetectFeatures(void) {
+    unsigned features = 0;
+    unsigned regs[4]; // EAX, EBX, ECX, EDX
+    CPUID(0, 0, regs);
+    unsigned maxLeaf = regs[0];
+    if (maxLeaf < 1)
+        return 0;
+
+    CPUID(1, 0, regs);
+    if (regs[2] & (1u << 9))
+        features |= OScInternal_CPUFeature_SSSE3;
+    if (regs[2] & (1u << 20))
+        features |= OScInternal_CPUFeature_SSE42;
+
+    // AVX state must be enabled by the OS (OSXSAVE, then XMM and YMM in
+    // XCR0) before any AVX instruction can be used
+    bool osXSAVE = (regs[2] & (1u << 27)) != 0;
+    uint64_t xState = osXSAVE ? GetEnabledXState() : 0;
+    bool osAVX = osXSAVE && (regs[2] & (1u << 28)) && (xState & 0x6) == 0x6;
+    // AVX-512 additionally needs the opmask and ZMM state
+    bool osAVX512 = osAVX && (xState & 0xe0) == 0xe0;
+    if (osAVX && maxLeaf >= 7) {
+        CPUID(7, 0, regs);
+        if (regs[1] & (1u << 5))
+            features |= OScInternal_CPUFeature_AVX2;
+        if (osAVX512 && (regs[1] & (1u << 16)) && (regs[1] & (1u << 30)))
+            features |= OScInternal_CPUFeature_AVX512;
+    }
+    return features;
+}
+
+#else
+
+static unsigned DetectFeatures(void) { return 0; }
+
+#endif
+
+unsigned OScInternal_CPU_GetFeatures(void) {
+    // Detection is idempotent, so a race on first use is harmless
+    static volatile int detected;
+    static volatile unsigned features;
+    if (!detected) {
+        features = DetectFeatures();
+        detected = 1;
+    }
+    return features;
+}
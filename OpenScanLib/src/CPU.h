@@ -0,0 +1,35 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * Run-time detection of instruction set extensions, so that SIMD kernels
+ * beyond the compile-time baseline can be selected on capable processors.
+ */
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) ||           \
+    defined(__i386__)
+#define OScInternal_X86 1
+#endif
+
+// Mark a function as compiled for an extension that is not enabled for the
+// whole build. MSVC allows intrinsics for any extension without this.
+#if defined(__GNUC__) && defined(OScInternal_X86)
+#define OScInternal_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define OScInternal_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define OScInternal_TARGET_SSSE3
+#define OScInternal_TARGET_AVX2
+#endif
+
+enum {
+    OScInternal_CPUFeature_SSSE3 = 1 << 0,
+    OScInternal_CPUFeature_AVX2 = 1 << 1,
+    OScInternal_CPUFeature_SSE42 = 1 << 2,
+    // AVX-512 Foundation and Byte/Word instructions, which kernels need
+    // together
+    OScInternal_CPUFeature_AVX512 = 1 << 3,
+};
+
+// Bitwise OR of the extensions supported by both the processor and the OS
+unsigned OScInternal_CPU_GetFeatures(void);
@@ -0,0 +1,622 @@
+#include "Codec.h"
+#include "CPU.h"
+#include "InternalErrors.h"
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#ifdef OScInternal_X86
+#include <immintrin.h>
+#endif
+
+#define FORMAT_VERSION 1
+#define BLOCK_SAMPLES 128
+#define PLANE_BYTES (BLOCK_SAMPLES / 8)
+
+#define ZIGZAG(type, bits, d)                                                 \
+    ((type)((type)((d) << 1) ^ (type)(0 - ((d) >> ((bits) - 1)))))
+#define UNZIGZAG(type, z) ((type)(((z) >> 1) ^ (type)(0 - ((z) & 1))))
+
+/*
+ * Kernels with SIMD variants, all working on one block:
+ *
+ * Residuals16 stores the zigzag-encoded differences of samples 0 to 127
+ * from samples -1 to 126, and returns their bitwise OR.
+ *
+ * Split16 separates 16-bit values into their low and high bytes.
+ *
+ * ExtractPlanes writes the lowest 'numberOfPlanes' bit planes of 128 bytes;
+ * bit i of byte g of plane k is bit k of byte 8g + i. DepositPlanes is its
+ * inverse, leaving the bits above the planes zero.
+ *
+ * Merge16 combines low and high bytes into 16-bit values.
+ *
+ * PrefixSum16 stores the running sums of 'carry' and the un-zigzagged
+ * residuals.
+ */
+typedef uint32_t (*Residuals16Func)(const uint16_t *samples,
+                                    uint16_t *residuals);
+typedef void (*Split16Func)(const uint16_t *values, uint8_t *low,
+                            uint8_t *high);
+typedef void (*ExtractPlanesFunc)(const uint8_t *bytes,
+                                  unsigned numberOfPlanes, uint8_t *planes);
+typedef void (*DepositPlanesFunc)(const uint8_t *planes,
+                                  unsigned numberOfPlanes, uint8_t *bytes);
+typedef void (*Merge16Func)(const uint8_t *low, const uint8_t *high,
+                            uint16_t *values);
+typedef void (*PrefixSum16Func)(const uint16_t *residuals, uint16_t carry,
+                                uint16_t *values);
+
+#define DEFINE_SCALAR_RESIDUALS(name, type, bits)                             \
+    static uint32_t name(const type *samples, type *residuals) {              \
+        uint32_t any = 0;                                                     \
+        for (int i = 0; i < BLOCK_SAMPLES; ++i) {                             \
+            type d = (type)(samples[i] - samples[i - 1]);                     \
+            residuals[i] = ZIGZAG(type, bits, d);                             \
+            any |= residuals[i];                                              \
+        }                                                                     \
+        return any;                                                           \
+    }
+
+DEFINE_SCALAR_RESIDUALS(Residuals8, uint8_t, 8)
+DEFINE_SCALAR_RESIDUALS(Residuals16, uint16_t, 16)
+DEFINE_SCALAR_RESIDUALS(Residuals32, uint32_t, 32)
+
+#define DEFINE_SCALAR_PREFIX_SUM(name, type)                                  \
+    static void name(const type *residuals, type carry, type *values) {       \
+        for (int i = 0; i < BLOCK_SAMPLES; ++i) {                             \
+            carry = (type)(carry + UNZIGZAG(type, residuals[i]));             \
+            values[i] = carry;                                                \
+        }                                                                     \
+    }
+
+DEFINE_SCALAR_PREFIX_SUM(PrefixSum8, uint8_t)
+DEFINE_SCALAR_PREFIX_SUM(PrefixSum16, uint16_t)
+DEFINE_SCALAR_PREFIX_SUM(PrefixSum32, uint32_t)
+
+static void Split16(const uint16_t *values, uint8_t *low, uint8_t *high) {
+    for (int i = 0; i < BLOCK_SAMPLES; ++i) {
+        low[i] = (uint8_t)values[i];
+        high[i] = (uint8_t)(values[i] >> 8);
+    }
+}
+
+static void Merge16(const uint8_t *low, const uint8_t *high,
+                    uint16_t *values) {
+    for (int i = 0; i < BLOCK_SAMPLES; ++i)
+        values[i] = (uint16_t)(low[i] | high[i] << 8);
+}
+
+static inline uint64_t LoadLE64(const uint8_t *p) {
+    uint64_t x = 0;
+    for (int i = 7; i >= 0; --i)
+        x = (x << 8) | p[i];
+    return x;
+}
+
+static inline void StoreLE64(uint8_t *p, uint64_t x) {
+    for (int i = 0; i < 8; ++i, x >>= 8)
+        p[i] = (uint8_t)x;
+}
+
+static void ExtractPlanes(const uint8_t *bytes, unsigned numberOfPlanes,
+                          uint8_t *planes) {
+    for (int g = 0; g < PLANE_BYTES; ++g) {
+        uint64_t x = LoadLE64(bytes + 8 * g);
+        // Gather bit k of each of the 8 bytes into the top byte
+        for (unsigned k = 0; k < numberOfPlanes; ++k)
+            planes[k * PLANE_BYTES + g] =
+                (uint8_t)((((x >> k) & 0x0101010101010101u) *
+                           0x0102040810204080u) >>
+                          56);
+    }
+}
+
+// The inverse of ExtractPlanes for one plane byte: bit i to bit 0 of byte i
+static inline uint64_t SpreadBits(uint8_t bits) {
+    uint64_t x = bits;
+    x = (x | x << 28) & 0x0000000f0000000fu;
+    x = (x | x << 14) & 0x0003000300030003u;
+    return (x | x << 7) & 0x0101010101010101u;
+}
+
+static void DepositPlanes(const uint8_t *planes, unsigned numberOfPlanes,
+                          uint8_t *bytes) {
+    for (int g = 0; g < PLANE_BYTES; ++g) {
+        uint64_t x = 0;
+        for (unsigned k = 0; k < numberOfPlanes; ++k)
+            x |= SpreadBits(planes[k * PLANE_BYTES + g]) << k;
+        StoreLE64(bytes + 8 * g, x);
+    }
+}
+
+#ifdef HAVE_SSE2
+
+static uint32_t Residuals16_SSE2(const uint16_t *samples,
+                                 uint16_t *residuals) {
+    __m128i any = _mm_setzero_si128();
+    for (int i = 0; i < BLOCK_SAMPLES; i += 8) {
+        __m128i cur = _mm_loadu_si128((const __m128i *)(samples + i));
+        __m128i prev = _mm_loadu_si128((const __m128i *)(samples + i - 1));
+        __m128i d = _mm_sub_epi16(cur, prev);
+        __m128i z = _mm_xor_si128(_mm_slli_epi16(d, 1), _mm_srai_epi16(d, 15));
+        _mm_storeu_si128((__m128i *)(residuals + i), z);
+        any = _mm_or_si128(any, z);
+    }
+    any = _mm_or_si128(any, _mm_srli_si128(any, 8));
+    any = _mm_or_si128(any, _mm_srli_si128(any, 4));
+    any = _mm_or_si128(any, _mm_srli_si128(any, 2));
+    return (uint32_t)_mm_cvtsi128_si32(any) & 0xffff;
+}
+
+static void Split16_SSE2(const uint16_t *values, uint8_t *low,
+                         uint8_t *high) {
+    const __m128i lowMask = _mm_set1_epi16(0xff);
+    for (int i = 0; i < BLOCK_SAMPLES; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(values + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(values + i + 8));
+        _mm_storeu_si128((__m128i *)(low + i),
+                         _mm_packus_epi16(_mm_and_si128(a, lowMask),
+                                          _mm_and_si128(b, lowMask)));
+        _mm_storeu_si128((__m128i *)(high + i),
+                         _mm_packus_epi16(_mm_srli_epi16(a, 8),
+                                          _mm_srli_epi16(b, 8)));
+    }
+}
+
+// Shifting each 16-bit lane left by 7 - k moves bit k of both its bytes to
+// their top bits, which movemask collects
+static void ExtractPlanes_SSE2(const uint8_t *bytes, unsigned numberOfPlanes,
+                               uint8_t *planes) {
+    __m128i v[8];
+    for (int i = 0; i < 8; ++i)
+        v[i] = _mm_loadu_si128((const __m128i *)(bytes + 16 * i));
+    for (unsigned k = 0; k < numberOfPlanes; ++k) {
+        __m128i shift = _mm_cvtsi32_si128(7 - (int)k);
+        for (int i = 0; i < 8; ++i) {
+            uint16_t mask = (uint16_t)_mm_movemask_epi8(
+                _mm_sll_epi16(v[i], shift));
+            memcpy(planes + k * PLANE_BYTES + 2 * i, &mask, 2);
+        }
+    }
+}
+
+// Each plane byte is broadcast to the 8 bytes it describes by unpacking,
+// and each of those bytes tests its own bit
+static void DepositPlanes_SSE2(const uint8_t *planes, unsigned numberOfPlanes,
+                               uint8_t *bytes) {
+    const __m128i bitMask = _mm_set1_epi64x(0x8040201008040201);
+    __m128i acc[8];
+    for (int i = 0; i < 8; ++i)
+        acc[i] = _mm_setzero_si128();
+    for (unsigned k = 0; k < numberOfPlanes; ++k) {
+        __m128i p = _mm_loadu_si128((const __m128i *)(planes + 16 * k));
+        __m128i bit = _mm_set1_epi8((char)(1 << k));
+        __m128i p2[2] = {_mm_unpacklo_epi8(p, p), _mm_unpackhi_epi8(p, p)};
+        for (int m = 0; m < 4; ++m) {
+            // Bytes 4m to 4m + 3 of the plane, each repeated 4 times
+            __m128i p4 = m % 2 ? _mm_unpackhi_epi16(p2[m / 2], p2[m / 2])
+                               : _mm_unpacklo_epi16(p2[m / 2], p2[m / 2]);
+            __m128i p8[2] = {_mm_unpacklo_epi32(p4, p4),
+                             _mm_unpackhi_epi32(p4, p4)};
+            for (int h = 0; h < 2; ++h) {
+                __m128i set = _mm_cmpeq_epi8(_mm_and_si128(p8[h], bitMask),
+                                             bitMask);
+                acc[2 * m + h] =
+                    _mm_or_si128(acc[2 * m + h], _mm_and_si128(set, bit));
+            }
+        }
+    }
+    for (int i = 0; i < 8; ++i)
+        _mm_storeu_si128((__m128i *)(bytes + 16 * i), acc[i]);
+}
+
+static void Merge16_SSE2(const uint8_t *low, const uint8_t *high,
+                         uint16_t *values) {
+    for (int i = 0; i < BLOCK_SAMPLES; i += 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(low + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(high + i));
+        _mm_storeu_si128((__m128i *)(values + i), _mm_unpacklo_epi8(lo, hi));
+        _mm_storeu_si128((__m128i *)(values + i + 8),
+                         _mm_unpackhi_epi8(lo, hi));
+    }
+}
+
+// Running sums within each vector by shifted adds, then the carry (the last
+// sum so far) broadcast and added
+static void PrefixSum16_SSE2(const uint16_t *residuals, uint16_t carry,
+                             uint16_t *values) {
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i c = _mm_set1_epi16((short)carry);
+    for (int i = 0; i < BLOCK_SAMPLES; i += 8) {
+        __m128i z = _mm_loadu_si128((const __m128i *)(residuals + i));
+        __m128i d = _mm_xor_si128(
+            _mm_srli_epi16(z, 1),
+            _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(z, one)));
+        d = _mm_add_epi16(d, _mm_slli_si128(d, 2));
+        d = _mm_add_epi16(d, _mm_slli_si128(d, 4));
+        d = _mm_add_epi16(d, _mm_slli_si128(d, 8));
+        d = _mm_add_epi16(d, c);
+        _mm_storeu_si128((__m128i *)(values + i), d);
+        c = _mm_shufflehi_epi16(d, 0xff);
+        c = _mm_unpackhi_epi64(c, c);
+    }
+}
+
+#endif // HAVE_SSE2
+
+#ifdef OScInternal_X86
+
+OScInternal_TARGET_AVX2 static uint32_t
+Residuals16_AVX2(const uint16_t *samples, uint16_t *residuals) {
+    __m256i any = _mm256_setzero_si256();
+    for (int i = 0; i < BLOCK_SAMPLES; i += 16) {
+        __m256i cur = _mm256_loadu_si256((const __m256i *)(samples + i));
+        __m256i prev =
+            _mm256_loadu_si256((const __m256i *)(samples + i - 1));
+        __m256i d = _mm256_sub_epi16(cur, prev);
+        __m256i z = _mm256_xor_si256(_mm256_slli_epi16(d, 1),
+                                     _mm256_srai_epi16(d, 15));
+        _mm256_storeu_si256((__m256i *)(residuals + i), z);
+        any = _mm256_or_si256(any, z);
+    }
+    __m128i a = _mm_or_si128(_mm256_castsi256_si128(any),
+                             _mm256_extracti128_si256(any, 1));
+    a = _mm_or_si128(a, _mm_srli_si128(a, 8));
+    a = _mm_or_si128(a, _mm_srli_si128(a, 4));
+    a = _mm_or_si128(a, _mm_srli_si128(a, 2));
+    return (uint32_t)_mm_cvtsi128_si32(a) & 0xffff;
+}
+
+// Packing works within 128-bit lanes, so the 64-bit quarters are reordered
+OScInternal_TARGET_AVX2 static void
+Split16_AVX2(const uint16_t *values, uint8_t *low, uint8_t *high) {
+    const __m256i lowMask = _mm256_set1_epi16(0xff);
+    for (int i = 0; i < BLOCK_SAMPLES; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(values + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(values + i + 16));
+        __m256i lo = _mm256_packus_epi16(_mm256_and_si256(a, lowMask),
+                                         _mm256_and_si256(b, lowMask));
+        __m256i hi = _mm256_packus_epi16(_mm256_srli_epi16(a, 8),
+                                         _mm256_srli_epi16(b, 8));
+        _mm256_storeu_si256((__m256i *)(low + i),
+                            _mm256_permute4x64_epi64(lo, 0xd8));
+        _mm256_storeu_si256((__m256i *)(high + i),
+                            _mm256_permute4x64_epi64(hi, 0xd8));
+    }
+}
+
+OScInternal_TARGET_AVX2 static void
+ExtractPlanes_AVX2(const uint8_t *bytes, unsigned numberOfPlanes,
+                   uint8_t *planes) {
+    __m256i v[4];
+    for (int i = 0; i < 4; ++i)
+        v[i] = _mm256_loadu_si256((const __m256i *)(bytes + 32 * i));
+    for (unsigned k = 0; k < numberOfPlanes; ++k) {
+        __m128i shift = _mm_cvtsi32_si128(7 - (int)k);
+        for (int i = 0; i < 4; ++i) {
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+                _mm256_sll_epi16(v[i], shift));
+            memcpy(planes + k * PLANE_BYTES + 4 * i, &mask, 4);
+        }
+    }
+}
+
+#endif // OScInternal_X86
+
+// Bound by OScInternal_Codec_BindKernels(); decoding has no AVX2 variants
+static Residuals16Func g_residuals16 = Residuals16;
+static Split16Func g_split16 = Split16;
+static ExtractPlanesFunc g_extractPlanes = ExtractPlanes;
+static DepositPlanesFunc g_depositPlanes = DepositPlanes;
+static Merge16Func g_merge16 = Merge16;
+static PrefixSum16Func g_prefixSum16 = PrefixSum16;
+
+OSc_SIMDLevel OScInternal_Codec_BindKernels(OSc_SIMDLevel level) {
+#ifdef HAVE_SSE2
+    if (level >= OSc_SIMDLevel_SSE42) {
+        g_depositPlanes = DepositPlanes_SSE2;
+        g_merge16 = Merge16_SSE2;
+        g_prefixSum16 = PrefixSum16_SSE2;
+#ifdef OScInternal_X86
+        if (level >= OSc_SIMDLevel_AVX2) {
+            g_residuals16 = Residuals16_AVX2;
+            g_split16 = Split16_AVX2;
+            g_extractPlanes = ExtractPlanes_AVX2;
+            return OSc_SIMDLevel_AVX2;
+        }
+#endif
+        g_residuals16 = Residuals16_SSE2;
+        g_split16 = Split16_SSE2;
+        g_extractPlanes = ExtractPlanes_SSE2;
+        return OSc_SIMDLevel_SSE42;
+    }
+#endif
+    g_residuals16 = Residuals16;
+    g_split16 = Split16;
+    g_extractPlanes = ExtractPlanes;
+    g_depositPlanes = DepositPlanes;
+    g_merge16 = Merge16;
+    g_prefixSum16 = PrefixSum16;
+    return OSc_SIMDLevel_Scalar;
+}
+
+static unsigned BitLength(uint32_t x) {
+    unsigned n = 0;
+    for (; x; x >>= 1)
+        ++n;
+    return n;
+}
+
+// Write the bit planes of a block's residuals, whose bitwise OR is 'any'
+static uint8_t *PackBlock8(const uint8_t *residuals, uint32_t any,
+                           uint8_t *out) {
+    unsigned b = BitLength(any);
+    *out++ = (uint8_t)b;
+    g_extractPlanes(residuals, b, out);
+    return out + b * PLANE_BYTES;
+}
+
+static uint8_t *PackBlock16(const uint16_t *residuals, uint32_t any,
+                            uint8_t *out) {
+    unsigned b = BitLength(any);
+    *out++ = (uint8_t)b;
+    if (b == 0)
+        return out;
+    uint8_t low[BLOCK_SAMPLES];
+    uint8_t high[BLOCK_SAMPLES];
+    g_split16(residuals, low, high);
+    g_extractPlanes(low, b < 8 ? b : 8, out);
+    if (b > 8)
+        g_extractPlanes(high, b - 8, out + 8 * PLANE_BYTES);
+    return out + b * PLANE_BYTES;
+}
+
+static uint8_t *PackBlock32(const uint32_t *residuals, uint32_t any,
+                            uint8_t *out) {
+    unsigned b = BitLength(any);
+    *out++ = (uint8_t)b;
+    uint8_t bytes[BLOCK_SAMPLES];
+    for (unsigned j = 0; 8 * j < b; ++j) {
+        for (int i = 0; i < BLOCK_SAMPLES; ++i)
+            bytes[i] = (uint8_t)(residuals[i] >> (8 * j));
+        unsigned planes = b - 8 * j < 8 ? b - 8 * j : 8;
+        g_extractPlanes(bytes, planes, out + 8 * j * PLANE_BYTES);
+    }
+    return out + b * PLANE_BYTES;
+}
+
+/*
+ * The residual kernels predict every sample from the one before it; the
+ * first sample of each row is then corrected to be predicted from the row
+ * above. The first block (which has no sample before it) and the last
+ * (which may be partial) are staged in a buffer, padded by repeating the
+ * last sample so that the padding has zero residuals.
+ */
+#define DEFINE_ENCODE(name, type, bits, residualsFunc, packFunc)              \
+    static uint8_t *name(const type *samples, uint32_t width, size_t n,       \
+                         uint8_t *out) {                                      \
+        type staged[BLOCK_SAMPLES + 1];                                       \
+        type residuals[BLOCK_SAMPLES];                                        \
+        for (size_t s = 0; s < n; s += BLOCK_SAMPLES) {                       \
+            size_t count = n - s < BLOCK_SAMPLES ? n - s : BLOCK_SAMPLES;     \
+            const type *cur = samples + s;                                    \
+            if (s == 0 || count < BLOCK_SAMPLES) {                            \
+                staged[0] = s > 0 ? samples[s - 1] : 0;                       \
+                memcpy(staged + 1, cur, count * sizeof(type));               \
+                for (size_t i = count; i < BLOCK_SAMPLES; ++i)                \
+                    staged[i + 1] = staged[count];                            \
+                cur = staged + 1;                                             \
+            }                                                                 \
+            uint32_t any = residualsFunc(cur, residuals);                     \
+            size_t rowStart = (s + width - 1) / width * width;                \
+            if (rowStart < s + count) {                                       \
+                for (; rowStart < s + count; rowStart += width) {             \
+                    type above = rowStart >= width                            \
+                                     ? samples[rowStart - width]              \
+                                     : 0;                                     \
+                    type d = (type)(samples[rowStart] - above);               \
+                    residuals[rowStart - s] = ZIGZAG(type, bits, d);          \
+                }                                                             \
+                any = 0;                                                      \
+                for (int i = 0; i < BLOCK_SAMPLES; ++i)                       \
+                    any |= residuals[i];                                      \
+            }                                                                 \
+            out = packFunc(residuals, any, out);                              \
+        }                                                                     \
+        return out;                                                           \
+    }
+
+DEFINE_ENCODE(Encode8, uint8_t, 8, Residuals8, PackBlock8)
+DEFINE_ENCODE(Encode16, uint16_t, 16, g_residuals16, PackBlock16)
+DEFINE_ENCODE(Encode32, uint32_t, 32, Residuals32, PackBlock32)
+
+// Read the residuals of a block from its 'b' bit planes
+static void UnpackBlock16(const uint8_t *planes, unsigned b,
+                          uint16_t *residuals) {
+    uint8_t low[BLOCK_SAMPLES];
+    uint8_t high[BLOCK_SAMPLES];
+    g_depositPlanes(planes, b < 8 ? b : 8, low);
+    g_depositPlanes(planes + 8 * PLANE_BYTES, b > 8 ? b - 8 : 0, high);
+    g_merge16(low, high, residuals);
+}
+
+static void UnpackBlock32(const uint8_t *planes, unsigned b,
+                          uint32_t *residuals) {
+    uint8_t bytes[BLOCK_SAMPLES];
+    memset(residuals, 0, BLOCK_SAMPLES * sizeof(uint32_t));
+    for (unsigned j = 0; 8 * j < b; ++j) {
+        unsigned n = b - 8 * j < 8 ? b - 8 * j : 8;
+        g_depositPlanes(planes + 8 * j * PLANE_BYTES, n, bytes);
+        for (int i = 0; i < BLOCK_SAMPLES; ++i)
+            residuals[i] |= (uint32_t)bytes[i] << (8 * j);
+    }
+}
+
+/*
+ * Samples are reconstructed by a running sum of the residuals from the
+ * sample before the block (the prefix kernel), as if every sample were
+ * predicted from its left neighbor. Each row starting in the block is then
+ * corrected: its samples differ from the running sum by the same amount as
+ * its first sample, which is predicted from the row above.
+ */
+#define DEFINE_INTEGRATE(name, type, prefixFunc)                              \
+    static void name(const type *residuals, size_t count, type *samples,      \
+                     size_t s, uint32_t width) {                              \
+        type values[BLOCK_SAMPLES];                                           \
+        prefixFunc(residuals, s > 0 ? samples[s - 1] : 0, values);            \
+        size_t rowStart = (s + width - 1) / width * width;                    \
+        for (; rowStart < s + count; rowStart += width) {                     \
+            size_t i = rowStart - s;                                          \
+            type above = 0;                                                   \
+            if (rowStart >= s + width)                                        \
+                above = values[i - width];                                    \
+            else if (rowStart >= width)                                       \
+                above = samples[rowStart - width];                            \
+            type delta = (type)(above + UNZIGZAG(type, residuals[i]) -        \
+                                values[i]);                                   \
+            size_t end = i + width < count ? i + width : count;               \
+            for (size_t k = i; k < end; ++k)                                  \
+                values[k] = (type)(values[k] + delta);                        \
+        }                                                                     \
+        memcpy(samples + s, values, count * sizeof(type));                    \
+    }
+
+DEFINE_INTEGRATE(Integrate8, uint8_t, PrefixSum8)
+DEFINE_INTEGRATE(Integrate16, uint16_t, g_prefixSum16)
+DEFINE_INTEGRATE(Integrate32, uint32_t, PrefixSum32)
+
+/*
+ * Decoders return the end of the blocks read, or NULL if the data is
+ * truncated or malformed.
+ */
+#define DEFINE_DECODE(name, type, bits, unpackFunc)                           \
+    static const uint8_t *name(const uint8_t *in, const uint8_t *end,         \
+                               type *samples, uint32_t width, size_t n) {     \
+        type residuals[BLOCK_SAMPLES];                                        \
+        for (size_t s = 0; s < n; s += BLOCK_SAMPLES) {                       \
+            if (in == end)                                                    \
+                return NULL;                                                  \
+            unsigned b = *in++;                                               \
+            if (b > (bits) || (size_t)(end - in) < b * PLANE_BYTES)           \
+                return NULL;                                                  \
+            unpackFunc(in, b, residuals);                                     \
+            in += b * PLANE_BYTES;                                            \
+            size_t count = n - s < BLOCK_SAMPLES ? n - s : BLOCK_SAMPLES;     \
+            Integrate##bits(residuals, count, samples, s, width);             \
+        }                                                                     \
+        return in;                                                            \
+    }
+
+DEFINE_DECODE(Decode8, uint8_t, 8, g_depositPlanes)
+DEFINE_DECODE(Decode16, uint16_t, 16, UnpackBlock16)
+DEFINE_DECODE(Decode32, uint32_t, 32, UnpackBlock32)
+
+static void StoreLE32(uint8_t *p, uint32_t x) {
+    for (int i = 0; i < 4; ++i, x >>= 8)
+        p[i] = (uint8_t)x;
+}
+
+static uint32_t LoadLE32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+size_t OScInternal_Codec_GetMaxEncodedSize(uint32_t width, uint32_t height,
+                                           uint32_t bytesPerSample) {
+    size_t blocks = ((size_t)width * height + BLOCK_SAMPLES - 1) /
+                    BLOCK_SAMPLES;
+    return OScInternal_CODEC_HEADER_BYTES +
+           blocks * (1 + (size_t)bytesPerSample * BLOCK_SAMPLES);
+}
+
+size_t OScInternal_Codec_Encode(const void *samples, uint32_t width,
+                                uint32_t height, uint32_t bytesPerSample,
+                                void *dst) {
+    uint8_t *out = dst;
+    memcpy(out, "OScL", 4);
+    out[4] = FORMAT_VERSION;
+    out[5] = (uint8_t)bytesPerSample;
+    out[6] = out[7] = 0;
+    StoreLE32(out + 8, width);
+    StoreLE32(out + 12, height);
+    uint8_t *blocks = out + OScInternal_CODEC_HEADER_BYTES;
+    size_t n = (size_t)width * height;
+    switch (bytesPerSample) {
+    case 1:
+        return Encode8(samples, width, n, blocks) - out;
+    case 2:
+        return Encode16(samples, width, n, blocks) - out;
+    case 4:
+        return Encode32(samples, width, n, blocks) - out;
+    default:
+        return 0;
+    }
+}
+
+OSc_RichError *OScInternal_Codec_GetFrameInfo(const void *data, size_t size,
+                                              uint32_t *width,
+                                              uint32_t *height,
+                                              uint32_t *bytesPerSample) {
+    const uint8_t *in = data;
+    if (size < OScInternal_CODEC_HEADER_BYTES || memcmp(in, "OScL", 4) != 0)
+        return OScInternal_Error_IllegalArgument();
+    if (in[4] != FORMAT_VERSION || in[6] != 0 || in[7] != 0)
+        return OScInternal_Error_UnsupportedOperation();
+    if (in[5] != 1 && in[5] != 2 && in[5] != 4)
+        return OScInternal_Error_IllegalArgument();
+    *width = LoadLE32(in + 8);
+    *height = LoadLE32(in + 12);
+    *bytesPerSample = in[5];
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_Codec_Decode(const void *data, size_t size,
+                                        void *samples, size_t capacity) {
+    uint32_t width, height, bytesPerSample;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OScInternal_Codec_GetFrameInfo(
+                                 data, size, &width, &height,
+                                 &bytesPerSample)))
+        return err;
+    uint64_t n = (uint64_t)width * height;
+    if (n * bytesPerSample > capacity)
+        return OScInternal_Error_IllegalArgument();
+
+    const uint8_t *in = (const uint8_t *)data + OScInternal_CODEC_HEADER_BYTES;
+    const uint8_t *end = (const uint8_t *)data + size;
+    switch (bytesPerSample) {
+    case 1:
+        in = Decode8(in, end, samples, width, (size_t)n);
+        break;
+    case 2:
+        in = Decode16(in, end, samples, width, (size_t)n);
+        break;
+    default:
+        in = Decode32(in, end, samples, width, (size_t)n);
+        break;
+    }
+    if (in != end)
+        return OScInternal_Error_IllegalArgument();
+    return OSc_OK;
+}
+
+OSc_RichError *OSc_GetLosslessFrameInfo(const void *data, size_t size,
+                                        uint32_t *width, uint32_t *height,
+                                        uint32_t *bytesPerSample) {
+    if (!data || !width || !height || !bytesPerSample)
+        return OScInternal_Error_IllegalArgument();
+    return OScInternal_Codec_GetFrameInfo(data, size, width, height,
+                                          bytesPerSample);
+}
+
+OSc_RichError *OSc_DecodeLosslessFrame(const void *data, size_t size,
+                                       void *samples, size_t capacity) {
+    if (!data || !samples)
+        return OScInternal_Error_IllegalArgument();
+    return OScInternal_Codec_Decode(data, size, samples, capacity);
+}
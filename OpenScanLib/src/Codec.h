@@ -0,0 +1,50 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * Lossless compression of detector frames, used by storage sinks and
+ * available for transporting frames.
+ *
+ * Each sample is predicted from its left neighbor (the first sample of a row
+ * from the first sample of the row above), and the residuals are mapped to
+ * unsigned values with small magnitudes (zigzag encoding). The residuals of
+ * blocks of 128 samples are then stored as bit planes ("bit shuffle"): a
+ * byte holding the number of significant bits of the block's largest
+ * residual, followed by that many planes of 16 bytes. Planes above the
+ * significant bits, which dominate the size of raw detector data, are
+ * dropped, and a flat block costs a single byte. There is no entropy coder
+ * beyond this, so encoding and decoding run at memory-like speeds.
+ *
+ * An encoded frame starts with a 16-byte header: "OScL", format version
+ * (1), bytes per sample, two zero bytes, width and height (32-bit little
+ * endian). Samples of 1, 2, or 4 bytes are supported; floating-point
+ * samples are compressed (poorly) as their bit patterns.
+ */
+
+#define OScInternal_CODEC_HEADER_BYTES 16
+
+// An upper bound of the encoded size of a frame
+size_t OScInternal_Codec_GetMaxEncodedSize(uint32_t width, uint32_t height,
+                                           uint32_t bytesPerSample);
+
+// Encode a frame of (unpadded) samples in native byte order into 'dst',
+// which must hold OScInternal_Codec_GetMaxEncodedSize() bytes. Returns the
+// encoded size, or 0 if 'bytesPerSample' is not supported.
+size_t OScInternal_Codec_Encode(const void *samples, uint32_t width,
+                                uint32_t height, uint32_t bytesPerSample,
+                                void *dst);
+
+// Read the header of an encoded frame
+OSc_RichError *OScInternal_Codec_GetFrameInfo(const void *data, size_t size,
+                                              uint32_t *width,
+                                              uint32_t *height,
+                                              uint32_t *bytesPerSample);
+
+// Decode a frame into 'samples', which must hold at least 'capacity' bytes.
+// Malformed data, or a frame larger than 'capacity', is rejected.
+OSc_RichError *OScInternal_Codec_Decode(const void *data, size_t size,
+                                        void *samples, size_t capacity);
+
+// Bind the kernels for 'level' and return the level bound (see Dispatch.h)
+OSc_SIMDLevel OScInternal_Codec_BindKernels(OSc_SIMDLevel level);
@@ -0,0 +1,152 @@
+#include "InternalErrors.h"
+#include "OpenScanLibPrivate.h"
+#include "SampleFormat.h"
+
+#include <dlpack/dlpack.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// The managed tensor, with its shape and strides in the same allocation.
+// The frame buffer holding the data is the manager context.
+struct ExportedTensor {
+    DLManagedTensor managed;
+    int64_t shape[3];
+    int64_t strides[3];
+};
+
+static void DeleteTensor(DLManagedTensor *self) {
+    if (!self)
+        return;
+    OSc_FrameBuffer_Release(self->manager_ctx);
+    free(self);
+}
+
+static bool GetDataType(OSc_SampleFormat format, DLDataType *dtype) {
+    dtype->lanes = 1;
+    switch (format) {
+    case OSc_SampleFormat_UInt8:
+        dtype->code = kDLUInt;
+        dtype->bits = 8;
+        return true;
+    case OSc_SampleFormat_UInt12: // Stored in 16 bits
+    case OSc_SampleFormat_UInt16:
+        dtype->code = kDLUInt;
+        dtype->bits = 16;
+        return true;
+    case OSc_SampleFormat_UInt32:
+        dtype->code = kDLUInt;
+        dtype->bits = 32;
+        return true;
+    case OSc_SampleFormat_Int8:
+        dtype->code = kDLInt;
+        dtype->bits = 8;
+        return true;
+    case OSc_SampleFormat_Int16:
+        dtype->code = kDLInt;
+        dtype->bits = 16;
+        return true;
+    case OSc_SampleFormat_Int32:
+        dtype->code = kDLInt;
+        dtype->bits = 32;
+        return true;
+    case OSc_SampleFormat_Float32:
+        dtype->code = kDLFloat;
+        dtype->bits = 32;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Wrap 'frame' (taking over the caller's reference) as a tensor of
+// 'channels' x height x width samples, dropping the channel dimension if
+// 'channels' is 0
+static OSc_RichError *Export(OSc_FrameBuffer *frame, uint32_t channels,
+                             uint32_t width, uint32_t height,
+                             DLManagedTensor **tensor) {
+    struct ExportedTensor *t = calloc(1, sizeof(struct ExportedTensor));
+    if (!t) {
+        OSc_FrameBuffer_Release(frame);
+        return OScInternal_Error_OutOfMemory();
+    }
+    DLTensor *dl = &t->managed.dl_tensor;
+    GetDataType(OSc_FrameBuffer_GetSampleFormat(frame), &dl->dtype);
+    dl->data = OSc_FrameBuffer_GetPixels(frame);
+    dl->device.device_type = kDLCPU;
+    dl->device.device_id = 0;
+    int32_t d = 0;
+    if (channels > 0) {
+        t->shape[d] = channels;
+        t->strides[d++] = (int64_t)width * height;
+    }
+    t->shape[d] = height;
+    t->strides[d++] = width;
+    t->shape[d] = width;
+    t->strides[d++] = 1;
+    dl->ndim = d;
+    dl->shape = t->shape;
+    dl->strides = t->strides;
+    dl->byte_offset = 0;
+    t->managed.manager_ctx = frame;
+    t->managed.deleter = DeleteTensor;
+    *tensor = &t->managed;
+    return OSc_OK;
+}
+
+OSc_RichError *OSc_FrameBuffer_ExportDLPack(OSc_FrameBuffer *frame,
+                                            DLManagedTensor **tensor) {
+    if (!frame || !tensor)
+        return OScInternal_Error_IllegalArgument();
+    DLDataType dtype;
+    if (!GetDataType(OSc_FrameBuffer_GetSampleFormat(frame), &dtype))
+        return OScInternal_Error_IllegalArgument();
+    uint32_t width, height;
+    OSc_FrameBuffer_GetSize(frame, &width, &height);
+    OSc_FrameBuffer_Retain(frame);
+    return Export(frame, 0, width, height, tensor);
+}
+
+OSc_RichError *OSc_FrameBuffer_ExportDLPackSet(OSc_FrameBuffer **frames,
+                                               uint32_t count,
+                                               DLManagedTensor **tensor) {
+    if (!frames || count == 0 || !frames[0] || !tensor)
+        return OScInternal_Error_IllegalArgument();
+    uint32_t width, height;
+    OSc_FrameBuffer_GetSize(frames[0], &width, &height);
+    OSc_SampleFormat format = OSc_FrameBuffer_GetSampleFormat(frames[0]);
+    DLDataType dtype;
+    if (!GetDataType(format, &dtype))
+        return OScInternal_Error_IllegalArgument();
+    for (uint32_t i = 1; i < count; ++i) {
+        uint32_t w, h;
+        OSc_FrameBuffer_GetSize(frames[i], &w, &h); // 0 x 0 if NULL
+        if (w != width || h != height ||
+            OSc_FrameBuffer_GetSampleFormat(frames[i]) != format)
+            return OScInternal_Error_IllegalArgument();
+    }
+
+    // The channels are separate buffers, which one tensor cannot describe,
+    // so they are gathered into one frame buffer of 'count' images. A
+    // single frame is exported in place.
+    OSc_FrameBuffer *set = frames[0];
+    if (count == 1) {
+        OSc_FrameBuffer_Retain(set);
+    } else {
+        if ((uint64_t)height * count > UINT32_MAX)
+            return OScInternal_Error_IllegalArgument();
+        OSc_RichError *err;
+        if (OSc_CHECK_ERROR(err, OSc_FrameBuffer_Create(
+                                     &set, OSc_FrameBuffer_GetChannel(
+                                               frames[0]),
+                                     width, height * count, format)))
+            return err;
+        size_t bytes = OScInternal_SampleFormat_GetBufferSize(
+            format, (size_t)width * height);
+        char *dst = OSc_FrameBuffer_GetPixels(set);
+        for (uint32_t i = 0; i < count; ++i)
+            memcpy(dst + i * bytes, OSc_FrameBuffer_GetPixels(frames[i]),
+                   bytes);
+    }
+    return Export(set, count, width, height, tensor);
+}
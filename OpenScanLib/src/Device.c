@@ -1,5 +1,7 @@
+#include "DeviceManifest.h"
 #include "InternalErrors.h"
 #include "OpenScanLibPrivate.h"
+#include "SampleFormat.h"
 
 #include <math.h>
 #include <stdio.h>
@@ -11,6 +13,10 @@ struct OScInternal_Device {
     OScDev_DeviceImpl *impl;
     void *implData;
 
+    // Device module ABI minor version of the module, which determines the
+    // fields present in 'impl'
+    uint16_t implVersion;
+
     OSc_LogFunc logFunc;
     void *logData;
 
@@ -22,19 +28,57 @@ struct OScInternal_Device {
 
     char name[OSc_MAX_STR_LEN + 1];
     char displayName[OSc_MAX_STR_LEN + 1];
+
+    // A deferred device, listed from the device manifest or standing in for
+    // a device of a module unloaded after enumeration, has no 'impl' of its
+    // own. When first needed, its module is enumerated (and loaded) and it is
+    // bound to the enumerated device, to which it then forwards.
+    bool deferred;
+    OSc_Device *bound;
+    char moduleName[OSc_MAX_STR_LEN + 1];
+    char modelName[OSc_MAX_STR_LEN + 1];
+    bool hasClock;
+    bool hasScanner;
+    bool hasDetector;
+};
+
+// Minor versions of the device module ABI that appended optional fields to
+// OScDev_DeviceImpl
+enum {
+    IMPL_VERSION_GET_SAMPLE_FORMAT = 4,
 };
 
+// The device that implements 'device'
+static OSc_Device *Target(OSc_Device *device) {
+    return device->bound ? device->bound : device;
+}
+
+static OSc_RichError *Bind(OSc_Device *device, OSc_Device **target) {
+    if (device->deferred && !device->bound) {
+        OSc_RichError *err;
+        if (OSc_CHECK_ERROR(err, OScInternal_DeviceEnumeration_BindModule(
+                                     device->moduleName)))
+            return err;
+        if (!device->bound)
+            return OScInternal_Error_DeviceNoLongerAvailable();
+    }
+    *target = Target(device);
+    return OSc_OK;
+}
+
 void OSc_Device_SetLogFunc(OSc_Device *device, OSc_LogFunc func, void *data) {
     if (!device)
         return;
 
     device->logFunc = func;
     device->logData = data;
+    if (device->bound)
+        OSc_Device_SetLogFunc(device->bound, func, data);
 }
 
 OSc_RichError *OSc_Device_GetName(OSc_Device *device, const char **name) {
     OScDev_Error errCode;
-    if (!strlen(device->name)) {
+    if (!strlen(device->name) && !device->deferred) {
         errCode = device->impl->GetName(device, device->name);
         if (errCode)
             return OScInternal_Error_RetrieveFromDevice(device, errCode);
@@ -48,11 +92,10 @@ OSc_RichError *OSc_Device_GetDisplayName(OSc_Device *device,
                                          const char **name) {
     if (!strlen(device->displayName)) {
         OSc_RichError *err;
-        OScDev_Error errCode;
         const char *modelName;
-        errCode = device->impl->GetModelName(&modelName);
-        if (errCode)
-            return OScInternal_Error_RetrieveFromDevice(device, errCode);
+        if (OSc_CHECK_ERROR(
+                err, OScInternal_Device_GetModelName(device, &modelName)))
+            return err;
 
         const char *deviceName;
         if (OSc_CHECK_ERROR(err, OSc_Device_GetName(device, &deviceName)))
@@ -66,23 +109,28 @@ OSc_RichError *OSc_Device_GetDisplayName(OSc_Device *device,
 }
 
 OSc_RichError *OSc_Device_Open(OSc_Device *device, OSc_LSM *lsm) {
-    if (device->isOpen) {
-        if (device->associatedLSM == lsm)
+    OSc_RichError *err;
+    OSc_Device *target = NULL;
+    if (OSc_CHECK_ERROR(err, Bind(device, &target)))
+        return err;
+
+    if (target->isOpen) {
+        if (target->associatedLSM == lsm)
             return OSc_OK;
         return OScInternal_Error_DeviceAlreadyOpen();
     }
 
-    OSc_RichError *err;
     OScDev_Error errCode;
-    errCode = device->impl->Open(device);
+    errCode = target->impl->Open(target);
     if (errCode)
-        return OScInternal_Error_RetrieveFromDevice(device, errCode);
+        return OScInternal_Error_RetrieveFromDevice(target, errCode);
 
-    device->isOpen = true;
+    target->isOpen = true;
 
+    // The LSM refers to the device by the application's pointer
     if (OSc_CHECK_ERROR(err, OScInternal_LSM_Associate_Device(lsm, device)))
         goto Error;
-    device->associatedLSM = lsm;
+    target->associatedLSM = lsm;
 
     return OSc_OK;
 
@@ -92,49 +140,69 @@ Error:
 }
 
 OSc_RichError *OSc_Device_Close(OSc_Device *device) {
-    if (!device || !device->isOpen)
+    if (!device || !Target(device)->isOpen)
         return OSc_OK;
 
+    OSc_Device *target = Target(device);
     OSc_RichError *err;
     OScDev_Error errCode;
-    if (device->associatedLSM) {
+    if (target->associatedLSM) {
         if (OSc_CHECK_ERROR(err, OScInternal_LSM_Dissociate_Device(
-                                     device->associatedLSM, device)))
+                                     target->associatedLSM, device)))
             return err;
     }
 
-    errCode = device->impl->Close(device);
+    errCode = target->impl->Close(target);
     if (errCode)
-        return OScInternal_Error_RetrieveFromDevice(device, errCode);
+        return OScInternal_Error_RetrieveFromDevice(target, errCode);
 
-    device->isOpen = false;
+    target->isOpen = false;
 
     return OSc_OK;
 }
 
 OSc_RichError *OSc_Device_HasClock(OSc_Device *device, bool *hasClock) {
     *hasClock = false;
+    if (device->deferred && !device->bound) {
+        *hasClock = device->hasClock;
+        return OSc_OK;
+    }
 
+    device = Target(device);
     OScDev_Error errCode = device->impl->HasClock(device, hasClock);
     return OScInternal_Error_RetrieveFromDevice(device, errCode);
 }
 
 OSc_RichError *OSc_Device_HasScanner(OSc_Device *device, bool *hasScanner) {
     *hasScanner = false;
+    if (device->deferred && !device->bound) {
+        *hasScanner = device->hasScanner;
+        return OSc_OK;
+    }
 
+    device = Target(device);
     OScDev_Error errCode = device->impl->HasScanner(device, hasScanner);
     return OScInternal_Error_RetrieveFromDevice(device, errCode);
 }
 
 OSc_RichError *OSc_Device_HasDetector(OSc_Device *device, bool *hasDetector) {
     *hasDetector = false;
+    if (device->deferred && !device->bound) {
+        *hasDetector = device->hasDetector;
+        return OSc_OK;
+    }
 
+    device = Target(device);
     OScDev_Error errCode = device->impl->HasDetector(device, hasDetector);
     return OScInternal_Error_RetrieveFromDevice(device, errCode);
 }
 
 OSc_RichError *OSc_Device_GetSettings(OSc_Device *device,
                                       OSc_Setting ***settings, size_t *count) {
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, Bind(device, &device)))
+        return err;
+
     if (device->settings == NULL) {
         OScDev_Error errCode;
         errCode = device->impl->MakeSettings(device, &device->settings);
@@ -154,14 +222,61 @@ OScDev_Error OScInternal_Device_Create(OScDev_ModuleImpl *modImpl,
     (*device)->modImpl = modImpl;
     (*device)->impl = impl;
     (*device)->implData = data;
+    (*device)->implVersion = OScInternal_Module_GetABIMinorVersion(modImpl);
     return OScDev_OK;
 }
 
+OSc_Device *OScInternal_Device_CreateDeferred(
+    const char *module, const struct OScInternal_ManifestDevice *entry) {
+    OSc_Device *device = calloc(1, sizeof(OSc_Device));
+    if (!device)
+        return NULL;
+    device->deferred = true;
+    snprintf(device->moduleName, sizeof(device->moduleName), "%s", module);
+    snprintf(device->modelName, sizeof(device->modelName), "%s",
+             entry->modelName);
+    snprintf(device->name, sizeof(device->name), "%s", entry->name);
+    device->hasClock = entry->hasClock;
+    device->hasScanner = entry->hasScanner;
+    device->hasDetector = entry->hasDetector;
+    return device;
+}
+
+const char *OScInternal_Device_GetDeferredModule(OSc_Device *device) {
+    if (!device->deferred || device->bound)
+        return NULL;
+    return device->moduleName;
+}
+
+OSc_RichError *OScInternal_Device_GetModelName(OSc_Device *device,
+                                               const char **modelName) {
+    if (device->deferred) {
+        *modelName = device->modelName;
+        return OSc_OK;
+    }
+    OScDev_Error errCode = device->impl->GetModelName(modelName);
+    if (errCode)
+        return OScInternal_Error_RetrieveFromDevice(device, errCode);
+    return OSc_OK;
+}
+
+void OScInternal_Device_Bind(OSc_Device *device, OSc_Device *target) {
+    device->bound = target;
+    target->logFunc = device->logFunc;
+    target->logData = device->logData;
+}
+
 OSc_RichError *OScInternal_Device_Destroy(OSc_Device *device) {
     if (!device) {
         return OSc_OK;
     }
 
+    if (device->deferred) {
+        OSc_RichError *err = OScInternal_Device_Destroy(device->bound);
+        free(device);
+        return err;
+    }
+
     device->impl->ReleaseInstance(device);
 
     if (device->settings) {
@@ -189,12 +304,13 @@ bool OScInternal_Device_Log(OSc_Device *device, OSc_LogLevel level,
 void *OScInternal_Device_GetImplData(OSc_Device *device) {
     if (!device)
         return NULL;
-    return device->implData;
+    return Target(device)->implData;
 }
 
 OScDev_NumRange *OScInternal_Device_GetPixelRates(OSc_Device *device) {
     if (!device)
         return NULL;
+    device = Target(device);
     if (device->impl->GetPixelRates) {
         OScDev_NumRange *ret;
         OScDev_Error errCode;
@@ -210,6 +326,7 @@ OScDev_NumRange *OScInternal_Device_GetPixelRates(OSc_Device *device) {
 OScDev_NumRange *OScInternal_Device_GetResolutions(OSc_Device *device) {
     if (!device)
         return NULL;
+    device = Target(device);
     if (device->impl->GetResolutions) {
         OScDev_NumRange *ret;
         OScDev_Error errCode;
@@ -225,6 +342,7 @@ OScDev_NumRange *OScInternal_Device_GetResolutions(OSc_Device *device) {
 OScDev_NumRange *OScInternal_Device_GetZooms(OSc_Device *device) {
     if (!device)
         return NULL;
+    device = Target(device);
     if (device->impl->GetZoomFactors) {
         OScDev_NumRange *ret;
         OScDev_Error errCode;
@@ -241,6 +359,7 @@ OScDev_NumRange *OScInternal_Device_GetZooms(OSc_Device *device) {
 bool OScInternal_Device_IsROIScanSupported(OSc_Device *device) {
     if (!device)
         return false;
+    device = Target(device);
     if (!device->impl->IsROIScanSupported) {
         return false;
     }
@@ -257,6 +376,7 @@ bool OScInternal_Device_IsROIScanSupported(OSc_Device *device) {
 OScInternal_NumRange *OScInternal_Device_GetRasterWidths(OSc_Device *device) {
     if (!device)
         return NULL;
+    device = Target(device);
     if (device->impl->GetRasterWidths) {
         OScDev_NumRange *ret;
         OScDev_Error errCode = device->impl->GetRasterWidths(device, &ret);
@@ -271,6 +391,7 @@ OScInternal_NumRange *OScInternal_Device_GetRasterWidths(OSc_Device *device) {
 OScInternal_NumRange *OScInternal_Device_GetRasterHeights(OSc_Device *device) {
     if (!device)
         return NULL;
+    device = Target(device);
     if (device->impl->GetRasterHeights) {
         OScDev_NumRange *ret;
         OScDev_Error errCode;
@@ -288,6 +409,7 @@ OScInternal_Device_GetNumberOfChannels(OSc_Device *device,
                                        uint32_t *numberOfChannels) {
     if (!device || !numberOfChannels)
         return OScInternal_Error_IllegalArgument();
+    device = Target(device);
     if (device->impl->GetNumberOfChannels) {
         OScDev_Error errCode =
             device->impl->GetNumberOfChannels(device, numberOfChannels);
@@ -301,6 +423,7 @@ OSc_RichError *OScInternal_Device_GetBytesPerSample(OSc_Device *device,
                                                     uint32_t *bytesPerSample) {
     if (!device || !bytesPerSample)
         return OScInternal_Error_IllegalArgument();
+    device = Target(device);
     if (device->impl->GetBytesPerSample) {
         OScDev_Error errCode =
             device->impl->GetBytesPerSample(device, bytesPerSample);
@@ -310,20 +433,51 @@ OSc_RichError *OScInternal_Device_GetBytesPerSample(OSc_Device *device,
     return OScInternal_Error_DeviceDoesNotSupportDetector();
 }
 
+OSc_RichError *OScInternal_Device_GetSampleFormat(OSc_Device *device,
+                                                   uint32_t channel,
+                                                   OSc_SampleFormat *format) {
+    if (!device || !format)
+        return OScInternal_Error_IllegalArgument();
+    device = Target(device);
+    if (device->implVersion >= IMPL_VERSION_GET_SAMPLE_FORMAT &&
+        device->impl->GetSampleFormat) {
+        OScDev_SampleFormat devFormat;
+        OScDev_Error errCode =
+            device->impl->GetSampleFormat(device, channel, &devFormat);
+        if (errCode != OScDev_OK)
+            return OScInternal_Error_RetrieveFromDevice(device, errCode);
+        *format = devFormat;
+    } else {
+        uint32_t bytesPerSample;
+        OSc_RichError *err;
+        if (OSc_CHECK_ERROR(err, OScInternal_Device_GetBytesPerSample(
+                                     device, &bytesPerSample)))
+            return err;
+        *format =
+            OScInternal_SampleFormat_FromBytesPerSample(bytesPerSample);
+    }
+    if (!OScInternal_SampleFormat_IsValid(*format))
+        return OScInternal_Error_UnsupportedOperation();
+    return OSc_OK;
+}
+
 OSc_RichError *OScInternal_Device_Arm(OSc_Device *device,
                                       OSc_Acquisition *acq) {
     if (!device || !acq)
         return OScInternal_Error_IllegalArgument();
 
-    OScDev_Error errCode = device->impl->Arm(
-        device, OScInternal_Acquisition_GetForDevice(acq, device));
-    return OScInternal_Error_RetrieveFromDevice(device, errCode);
+    // The acquisition refers to the device by the application's pointer
+    OSc_Device *target = Target(device);
+    OScDev_Error errCode = target->impl->Arm(
+        target, OScInternal_Acquisition_GetForDevice(acq, device));
+    return OScInternal_Error_RetrieveFromDevice(target, errCode);
 }
 
 OSc_RichError *OScInternal_Device_Start(OSc_Device *device) {
     if (!device)
         return OScInternal_Error_IllegalArgument();
 
+    device = Target(device);
     OScDev_Error errCode = device->impl->Start(device);
     return OScInternal_Error_RetrieveFromDevice(device, errCode);
 }
@@ -332,6 +486,7 @@ void OScInternal_Device_Stop(OSc_Device *device) {
     if (!device)
         return;
 
+    device = Target(device);
     device->impl->Stop(device);
 }
 
@@ -339,6 +494,7 @@ void OScInternal_Device_Wait(OSc_Device *device) {
     if (!device)
         return;
 
+    device = Target(device);
     device->impl->Wait(device);
 }
 
@@ -347,10 +503,11 @@ OSc_RichError *OScInternal_Device_IsRunning(OSc_Device *device,
     if (!device || !isRunning)
         return OScInternal_Error_IllegalArgument();
 
+    device = Target(device);
     OScDev_Error errCode = device->impl->IsRunning(device, isRunning);
     return OScInternal_Error_RetrieveFromDevice(device, errCode);
 }
 
 bool OScInternal_Device_SupportsRichErrors(OSc_Device *device) {
-    return device->modImpl->supportsRichErrors;
+    return Target(device)->modImpl->supportsRichErrors;
 }
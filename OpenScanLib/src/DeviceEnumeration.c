@@ -1,18 +1,94 @@
+#include "DeviceManifest.h"
 #include "InternalErrors.h"
+#include "Module.h"
 #include "OpenScanLibPrivate.h"
+#include "Threads.h"
 
 #include <ss8str.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // Until we update the API to have proper array memory management, we fill this
 // static array once and never modify it again.
 static OScInternal_PtrArray
     *g_deviceInstances; // Elements: struct OScInternal_Device*
 
-static void EnumerateDevicesForImpl(const char *moduleName,
-                                    OScDev_DeviceImpl *impl) {
+// Seconds allowed for each module's enumeration, or 0 for no limit
+static double g_enumerationTimeout;
+
+// Device manifest cache file, if enabled, and its contents
+static char *g_manifestPath;
+static OScInternal_Manifest *g_manifest;
+
+// Unload each module after enumeration, listing deferred devices instead
+static bool g_lazyLoading;
+
+// Modules listed from the manifest, and those whose deferred devices have
+// been bound (or found to be gone)
+static OScInternal_PtrArray *g_cachedModules; // Elements: char*
+static OScInternal_PtrArray *g_boundModules; // Elements: char*
+
+// Guards the manifest and the module lists once the device list is made
+static OScInternal_Mutex g_bindMutex = OScInternal_MUTEX_INITIALIZER;
+
+/*
+ * Enumeration often probes hardware and can take seconds per module, so
+ * modules are enumerated concurrently, each on its own thread, and so are the
+ * device implementations of each module. The results are merged in module
+ * and implementation order, so that the order of the device list does not
+ * depend on timing.
+ *
+ * Modules that have not finished when the timeout expires are skipped. Their
+ * threads cannot be stopped, so they are left to finish on their own; devices
+ * they enumerate after that are destroyed.
+ */
+
+struct ImplEnumeration {
+    const char *moduleName;
+    OScDev_DeviceImpl *impl;
+    OScInternal_PtrArray *devices; // Elements: struct OScInternal_Device*
+    bool complete;
+    OScInternal_Thread thread;
+    bool threaded;
+};
+
+struct ModuleEnumeration {
+    struct Enumeration *enumeration;
+    ss8str moduleName;
+    OScInternal_PtrArray *devices; // Result, until merged
+    bool complete; // No errors during enumeration
+    bool done;
+
+    // Manifest entries of 'devices', if 'describe' and 'described'
+    bool describe;
+    bool described;
+    struct OScInternal_ManifestDevice *entries;
+
+    // Module file key, if 'hasKey'; entries from the manifest, if 'cached'
+    bool hasKey;
+    uint64_t size;
+    int64_t mtime;
+    bool cached;
+    const struct OScInternal_ManifestDevice *cachedEntries;
+    size_t cachedCount;
+};
+
+// Shared by EnumerateDevices() and the module threads; freed by whichever
+// finishes last
+struct Enumeration {
+    OScInternal_Mutex mutex;
+    OScInternal_Cond cond;
+    size_t refCount;
+    size_t remaining; // Modules not done
+    size_t count;
+    struct ModuleEnumeration *modules;
+};
+
+static bool EnumerateDevicesForImpl(const char *moduleName,
+                                    OScDev_DeviceImpl *impl,
+                                    OScInternal_PtrArray *result) {
     OScDev_Error errCode;
     OScInternal_PtrArray *devices = NULL;
     errCode = impl->EnumerateInstances(&devices);
@@ -39,11 +115,11 @@ static void EnumerateDevicesForImpl(const char *moduleName,
                  "Cannot enumerate devices: module %s, model %s", moduleName,
                  model);
         OScInternal_LogWarning(NULL, msg);
-        return;
+        return false;
     }
 
     if (!devices) {
-        return; // No devices
+        return true; // No devices
     }
 
     for (size_t i = 0; i < OScInternal_PtrArray_Size(devices); ++i) {
@@ -52,7 +128,264 @@ static void EnumerateDevicesForImpl(const char *moduleName,
         if (!device) {
             continue;
         }
-        OScInternal_PtrArray_Append(g_deviceInstances, device);
+        OScInternal_PtrArray_Append(result, device);
+    }
+    OScInternal_PtrArray_Destroy(devices);
+    return true;
+}
+
+static void EnumerateImplThread(void *data) {
+    struct ImplEnumeration *ie = data;
+    ie->complete =
+        EnumerateDevicesForImpl(ie->moduleName, ie->impl, ie->devices);
+}
+
+// Enumerate the devices of the module. If 'error' is given, it is set to the
+// error (if any) that made the enumeration incomplete; otherwise errors are
+// logged.
+static OScInternal_PtrArray *EnumerateModule(const char *moduleName,
+                                             bool *complete,
+                                             OSc_RichError **error) {
+    *complete = false;
+    OScInternal_PtrArray *result = OScInternal_PtrArray_Create();
+    if (!result)
+        return NULL;
+
+    OScInternal_PtrArray *deviceImpls = NULL;
+    OSc_RichError *err =
+        OScInternal_DeviceModule_GetDeviceImpls(moduleName, &deviceImpls);
+    if (err) {
+        ss8str msg;
+        ss8_init_copy_cstr(&msg,
+                           "Cannot get device implementations from module: ");
+        ss8_cat_cstr(&msg, moduleName);
+        if (error) {
+            *error = OScInternal_Error_Wrap(err, ss8_cstr(&msg));
+        } else {
+            char reason[OSc_MAX_STR_LEN + 1];
+            OScInternal_Error_FormatRecursive(err, reason, sizeof(reason));
+            ss8_cat_cstr(&msg, ": ");
+            ss8_cat_cstr(&msg, reason);
+            OScInternal_LogWarning(NULL, ss8_cstr(&msg));
+            OScInternal_Error_Destroy(err);
+        }
+        ss8_destroy(&msg);
+        return result;
+    }
+
+    size_t nImpls = OScInternal_PtrArray_Size(deviceImpls);
+    struct ImplEnumeration *impls =
+        calloc(nImpls, sizeof(struct ImplEnumeration));
+    if (!impls)
+        nImpls = 0;
+    for (size_t j = 0; j < nImpls; ++j) {
+        impls[j].moduleName = moduleName;
+        impls[j].impl = OScInternal_PtrArray_At(deviceImpls, j);
+        impls[j].devices = OScInternal_PtrArray_Create();
+    }
+
+    // The first implementation is enumerated on this thread, as is any that
+    // we fail to start a thread for
+    for (size_t j = 1; j < nImpls; ++j) {
+        if (impls[j].devices)
+            impls[j].threaded = OScInternal_Thread_Create(
+                &impls[j].thread, EnumerateImplThread, &impls[j]);
+    }
+    for (size_t j = 0; j < nImpls; ++j) {
+        if (impls[j].threaded)
+            OScInternal_Thread_Join(impls[j].thread);
+        else if (impls[j].devices)
+            EnumerateImplThread(&impls[j]);
+    }
+
+    *complete = nImpls == OScInternal_PtrArray_Size(deviceImpls);
+    for (size_t j = 0; j < nImpls; ++j) {
+        if (!impls[j].complete)
+            *complete = false;
+        if (!impls[j].devices)
+            continue;
+        for (size_t k = 0; k < OScInternal_PtrArray_Size(impls[j].devices);
+             ++k) {
+            OScInternal_PtrArray_Append(
+                result, OScInternal_PtrArray_At(impls[j].devices, k));
+        }
+        OScInternal_PtrArray_Destroy(impls[j].devices);
+    }
+    free(impls);
+    OScInternal_PtrArray_Destroy(deviceImpls);
+
+    // The failing implementations have logged the details
+    if (error && !*complete) {
+        ss8str msg;
+        ss8_init_copy_cstr(&msg, "Cannot enumerate devices of module: ");
+        ss8_cat_cstr(&msg, moduleName);
+        *error = OScInternal_Error_Create(ss8_cstr(&msg));
+        ss8_destroy(&msg);
+    }
+    return result;
+}
+
+// Describe 'devices' for the manifest. Returns false if any device cannot be
+// described, in which case the module is not recorded.
+static bool DescribeDevices(OScInternal_PtrArray *devices,
+                            struct OScInternal_ManifestDevice **entries) {
+    size_t count = OScInternal_PtrArray_Size(devices);
+    *entries = calloc(count ? count : 1,
+                      sizeof(struct OScInternal_ManifestDevice));
+    if (!*entries)
+        return false;
+    for (size_t k = 0; k < count; ++k) {
+        OSc_Device *device = OScInternal_PtrArray_At(devices, k);
+        struct OScInternal_ManifestDevice *entry = &(*entries)[k];
+        const char *model, *name;
+        OSc_RichError *err;
+        if (OSc_CHECK_ERROR(err,
+                            OScInternal_Device_GetModelName(device, &model)) ||
+            OSc_CHECK_ERROR(err, OSc_Device_GetName(device, &name)) ||
+            OSc_CHECK_ERROR(err, OSc_Device_HasClock(device,
+                                                     &entry->hasClock)) ||
+            OSc_CHECK_ERROR(err, OSc_Device_HasScanner(
+                                     device, &entry->hasScanner)) ||
+            OSc_CHECK_ERROR(err, OSc_Device_HasDetector(
+                                     device, &entry->hasDetector))) {
+            OScInternal_Error_Destroy(err);
+            free(*entries);
+            *entries = NULL;
+            return false;
+        }
+        snprintf(entry->modelName, sizeof(entry->modelName), "%s", model);
+        snprintf(entry->name, sizeof(entry->name), "%s", name);
+    }
+    return true;
+}
+
+// Destroy the devices and the array
+static void DestroyDevices(OScInternal_PtrArray *devices) {
+    for (size_t k = 0; k < OScInternal_PtrArray_Size(devices); ++k) {
+        OSc_RichError *err =
+            OScInternal_Device_Destroy(OScInternal_PtrArray_At(devices, k));
+        if (err)
+            OScInternal_Error_Destroy(err);
+    }
+    OScInternal_PtrArray_Destroy(devices);
+}
+
+static void FreeEnumeration(struct Enumeration *e) {
+    for (size_t i = 0; i < e->count; ++i) {
+        struct ModuleEnumeration *me = &e->modules[i];
+        if (me->devices) // Finished after timing out
+            DestroyDevices(me->devices);
+        free(me->entries);
+        ss8_destroy(&me->moduleName);
+    }
+    free(e->modules);
+    OScInternal_Cond_Destroy(&e->cond);
+    OScInternal_Mutex_Destroy(&e->mutex);
+    free(e);
+}
+
+static void EnumerateModuleThread(void *data) {
+    struct ModuleEnumeration *me = data;
+    struct Enumeration *e = me->enumeration;
+    bool complete;
+    OScInternal_PtrArray *devices =
+        EnumerateModule(ss8_cstr(&me->moduleName), &complete, NULL);
+    struct OScInternal_ManifestDevice *entries = NULL;
+    bool described =
+        devices && me->describe && DescribeDevices(devices, &entries);
+
+    OScInternal_Mutex_Lock(&e->mutex);
+    me->devices = devices;
+    me->complete = complete;
+    me->entries = entries;
+    me->described = described;
+    me->done = true;
+    --e->remaining;
+    OScInternal_Cond_Signal(&e->cond);
+    bool last = --e->refCount == 0;
+    OScInternal_Mutex_Unlock(&e->mutex);
+    if (last)
+        FreeEnumeration(e);
+}
+
+// Find the manifest entry of the module, if it is still valid
+static void LookUpManifest(struct ModuleEnumeration *me) {
+    const char *path;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OScInternal_DeviceModule_GetPath(
+                                 ss8_cstr(&me->moduleName), &path)) ||
+        OSc_CHECK_ERROR(
+            err, OScInternal_File_GetInfo(path, &me->size, &me->mtime))) {
+        OScInternal_Error_Destroy(err);
+        return;
+    }
+    me->hasKey = true;
+    // Entries without devices (written by earlier versions) are not used
+    me->cached = OScInternal_Manifest_Lookup(
+                     g_manifest, ss8_cstr(&me->moduleName), path, me->size,
+                     me->mtime, &me->cachedEntries, &me->cachedCount) &&
+                 me->cachedCount > 0;
+}
+
+// Record the module's 'count' enumerated devices in the manifest; returns
+// true if the manifest changed. Modules with errors are not recorded, so that
+// they are retried at the next start, and neither are modules without
+// devices, whose hardware may not have been connected yet.
+static bool RecordModule(struct ModuleEnumeration *me, size_t count) {
+    if (!me->complete || !me->described || !me->hasKey)
+        return false;
+    if (count == 0)
+        return OScInternal_Manifest_RemoveModule(g_manifest,
+                                                 ss8_cstr(&me->moduleName));
+    const char *path;
+    OSc_RichError *err = OScInternal_DeviceModule_GetPath(
+        ss8_cstr(&me->moduleName), &path);
+    if (err) {
+        OScInternal_Error_Destroy(err);
+        return false;
+    }
+    OScInternal_Manifest_SetModule(g_manifest, ss8_cstr(&me->moduleName),
+                                   path, me->size, me->mtime, me->entries,
+                                   count);
+    return true;
+}
+
+static void WriteManifest(void) {
+    OSc_RichError *err =
+        OScInternal_Manifest_Write(g_manifest, g_manifestPath);
+    if (err) {
+        char msg[OSc_MAX_STR_LEN + 1];
+        OScInternal_Error_FormatRecursive(err, msg, sizeof(msg));
+        OScInternal_Error_Destroy(err);
+        OScInternal_LogWarning(NULL, msg);
+    }
+}
+
+static void AddModuleName(OScInternal_PtrArray *modules, const char *module) {
+    char *name = malloc(strlen(module) + 1);
+    if (name) {
+        strcpy(name, module);
+        OScInternal_PtrArray_Append(modules, name);
+    }
+}
+
+static bool HasModuleName(OScInternal_PtrArray *modules, const char *module) {
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(modules); ++i) {
+        if (strcmp(OScInternal_PtrArray_At(modules, i), module) == 0)
+            return true;
+    }
+    return false;
+}
+
+static void
+ListDeferredDevices(const char *module,
+                    const struct OScInternal_ManifestDevice *entries,
+                    size_t count) {
+    for (size_t k = 0; k < count; ++k) {
+        OSc_Device *device =
+            OScInternal_Device_CreateDeferred(module, &entries[k]);
+        if (device)
+            OScInternal_PtrArray_Append(g_deviceInstances, device);
     }
 }
 
@@ -72,39 +405,283 @@ static OSc_RichError *EnumerateDevices(void) {
         return err;
     }
 
+    struct Enumeration *e = calloc(1, sizeof(struct Enumeration));
+    if (e)
+        e->modules = calloc(nModules, sizeof(struct ModuleEnumeration));
+    if (!e || (nModules > 0 && !e->modules)) {
+        free(e);
+        free(moduleNames);
+        return OScInternal_Error_OutOfMemory();
+    }
+    OScInternal_Mutex_Init(&e->mutex);
+    OScInternal_Cond_Init(&e->cond);
+    e->refCount = 1;
+    e->remaining = nModules;
+    e->count = nModules;
+    if (g_manifestPath && !g_manifest)
+        g_manifest = OScInternal_Manifest_Read(g_manifestPath);
+    for (size_t i = 0; i < nModules; ++i) {
+        e->modules[i].enumeration = e;
+        ss8_init_copy_cstr(&e->modules[i].moduleName, moduleNames[i]);
+        e->modules[i].describe = g_manifest || g_lazyLoading;
+        if (g_manifest) {
+            LookUpManifest(&e->modules[i]);
+            if (e->modules[i].cached) {
+                e->modules[i].done = true;
+                --e->remaining;
+            }
+        }
+    }
+    free(moduleNames);
+
     g_deviceInstances = OScInternal_PtrArray_Create();
-    if (!g_deviceInstances) {
+    g_cachedModules = OScInternal_PtrArray_Create();
+    if (!g_deviceInstances || !g_cachedModules) {
+        if (g_deviceInstances)
+            OScInternal_PtrArray_Destroy(g_deviceInstances);
+        g_deviceInstances = NULL;
+        if (g_cachedModules)
+            OScInternal_PtrArray_Destroy(g_cachedModules);
+        g_cachedModules = NULL;
+        FreeEnumeration(e);
         return OScInternal_Error_OutOfMemory();
     }
 
+    double timeout = g_enumerationTimeout;
+    double deadline = OScInternal_GetMonotonicTime() + timeout;
     for (size_t i = 0; i < nModules; ++i) {
-        const char *moduleName = moduleNames[i];
+        if (e->modules[i].cached)
+            continue;
+        OScInternal_Mutex_Lock(&e->mutex);
+        ++e->refCount;
+        OScInternal_Mutex_Unlock(&e->mutex);
+
+        OScInternal_Thread thread;
+        if (OScInternal_Thread_Create(&thread, EnumerateModuleThread,
+                                      &e->modules[i]))
+            OScInternal_Thread_Detach(thread);
+        else
+            EnumerateModuleThread(&e->modules[i]);
+    }
+
+    OScInternal_Mutex_Lock(&e->mutex);
+    while (e->remaining > 0) {
+        if (timeout > 0.0) {
+            double left = deadline - OScInternal_GetMonotonicTime();
+            if (left <= 0.0)
+                break;
+            OScInternal_Cond_TimedWait(&e->cond, &e->mutex, left);
+        } else {
+            OScInternal_Cond_Wait(&e->cond, &e->mutex);
+        }
+    }
 
-        OScInternal_PtrArray *deviceImpls = NULL;
-        err =
-            OScInternal_DeviceModule_GetDeviceImpls(moduleName, &deviceImpls);
-        if (err) {
+    bool manifestChanged = false;
+    for (size_t i = 0; i < nModules; ++i) {
+        struct ModuleEnumeration *me = &e->modules[i];
+        if (me->cached) {
+            ListDeferredDevices(ss8_cstr(&me->moduleName), me->cachedEntries,
+                                me->cachedCount);
+            AddModuleName(g_cachedModules, ss8_cstr(&me->moduleName));
+            continue;
+        }
+        if (!me->done) {
             ss8str msg;
-            ss8_init_copy_cstr(
-                &msg, "Cannot get device implementations from module: ");
-            ss8_cat_cstr(&msg, moduleName);
+            ss8_init_copy_cstr(&msg,
+                               "Device enumeration timed out; skipping "
+                               "module: ");
+            ss8_cat(&msg, &me->moduleName);
             OScInternal_LogWarning(NULL, ss8_cstr(&msg));
             ss8_destroy(&msg);
             continue;
         }
+        if (!me->devices)
+            continue;
+        size_t count = OScInternal_PtrArray_Size(me->devices);
+        if (g_lazyLoading && me->described) {
+            // No device is open yet, so the module can be unloaded, with
+            // deferred devices standing in for its devices
+            ListDeferredDevices(ss8_cstr(&me->moduleName), me->entries,
+                                count);
+            DestroyDevices(me->devices);
+            OScInternal_DeviceModule_Unload(ss8_cstr(&me->moduleName));
+        } else {
+            for (size_t k = 0; k < count; ++k) {
+                OScInternal_PtrArray_Append(
+                    g_deviceInstances,
+                    OScInternal_PtrArray_At(me->devices, k));
+            }
+            OScInternal_PtrArray_Destroy(me->devices);
+        }
+        me->devices = NULL;
+        if (g_manifest && RecordModule(me, count))
+            manifestChanged = true;
+    }
+    bool last = --e->refCount == 0;
+    OScInternal_Mutex_Unlock(&e->mutex);
+    if (last)
+        FreeEnumeration(e);
+
+    if (manifestChanged)
+        WriteManifest();
+    return OSc_OK;
+}
+
+// Find the deferred device of 'module' that 'entry' describes
+static OSc_Device *
+FindDeferredDevice(const char *module,
+                   const struct OScInternal_ManifestDevice *entry) {
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(g_deviceInstances); ++i) {
+        OSc_Device *device = OScInternal_PtrArray_At(g_deviceInstances, i);
+        const char *deferredModule =
+            OScInternal_Device_GetDeferredModule(device);
+        if (!deferredModule || strcmp(deferredModule, module) != 0)
+            continue;
+        const char *model, *name;
+        OScInternal_Device_GetModelName(device, &model);
+        OSc_Device_GetName(device, &name);
+        if (strcmp(model, entry->modelName) == 0 &&
+            strcmp(name, entry->name) == 0)
+            return device;
+    }
+    return NULL;
+}
+
+static OSc_RichError *BindModule(const char *module) {
+    if (!g_boundModules)
+        g_boundModules = OScInternal_PtrArray_Create();
+    if (!g_boundModules)
+        return OScInternal_Error_OutOfMemory();
+    if (HasModuleName(g_boundModules, module))
+        return OSc_OK;
 
-        for (size_t j = 0; j < OScInternal_PtrArray_Size(deviceImpls); ++j) {
-            EnumerateDevicesForImpl(
-                moduleName,
-                (OScDev_DeviceImpl *)OScInternal_PtrArray_At(deviceImpls, j));
+    struct ModuleEnumeration me = {0};
+    ss8_init_copy_cstr(&me.moduleName, module);
+    if (g_manifest)
+        LookUpManifest(&me);
+    OSc_RichError *err = OSc_OK;
+    OScInternal_PtrArray *devices =
+        EnumerateModule(module, &me.complete, &err);
+    if (!devices) {
+        ss8_destroy(&me.moduleName);
+        return OScInternal_Error_OutOfMemory();
+    }
+
+    // The module is not marked bound, so that opening one of its devices
+    // retries the enumeration
+    if (!me.complete) {
+        DestroyDevices(devices);
+        if (g_lazyLoading)
+            OScInternal_DeviceModule_Unload(module);
+        ss8_destroy(&me.moduleName);
+        return err;
+    }
+    me.described = DescribeDevices(devices, &me.entries);
+
+    AddModuleName(g_boundModules, module);
+
+    // Devices that were not in the manifest when the device list was made
+    // cannot be added to it; they will be listed from the next start
+    size_t count = OScInternal_PtrArray_Size(devices);
+    size_t nBound = 0;
+    for (size_t k = 0; k < count; ++k) {
+        OSc_Device *device = OScInternal_PtrArray_At(devices, k);
+        OSc_Device *deferred =
+            me.described ? FindDeferredDevice(module, &me.entries[k]) : NULL;
+        if (deferred) {
+            OScInternal_Device_Bind(deferred, device);
+            ++nBound;
+        } else {
+            err = OScInternal_Device_Destroy(device);
+            if (err)
+                OScInternal_Error_Destroy(err);
         }
-        OScInternal_PtrArray_Destroy(deviceImpls);
     }
+    OScInternal_PtrArray_Destroy(devices);
+    if (g_lazyLoading && nBound == 0)
+        OScInternal_DeviceModule_Unload(module);
 
-    free(moduleNames);
+    if (g_manifest && RecordModule(&me, count))
+        WriteManifest();
+    free(me.entries);
+    ss8_destroy(&me.moduleName);
     return OSc_OK;
 }
 
+OSc_RichError *OScInternal_DeviceEnumeration_BindModule(const char *module) {
+    OScInternal_Mutex_Lock(&g_bindMutex);
+    OSc_RichError *err = BindModule(module);
+    OScInternal_Mutex_Unlock(&g_bindMutex);
+    return err;
+}
+
+// Enumerate 'module', listed from the manifest, to update its record; returns
+// true if the manifest changed
+static bool RefreshModule(const char *module) {
+    struct ModuleEnumeration me = {0};
+    ss8_init_copy_cstr(&me.moduleName, module);
+    LookUpManifest(&me);
+    OScInternal_PtrArray *devices =
+        EnumerateModule(module, &me.complete, NULL);
+    bool changed = false;
+    if (devices) {
+        me.described = DescribeDevices(devices, &me.entries);
+        size_t count = OScInternal_PtrArray_Size(devices);
+        DestroyDevices(devices);
+        if (g_lazyLoading)
+            OScInternal_DeviceModule_Unload(module);
+        changed = RecordModule(&me, count);
+    }
+    free(me.entries);
+    ss8_destroy(&me.moduleName);
+    return changed;
+}
+
+OSc_RichError *OSc_RefreshDeviceManifest(void) {
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, EnumerateDevices()))
+        return err;
+
+    // Modules are refreshed one at a time, so that opening a device waits
+    // for at most one module
+    bool manifestChanged = false;
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(g_cachedModules); ++i) {
+        const char *module = OScInternal_PtrArray_At(g_cachedModules, i);
+        OScInternal_Mutex_Lock(&g_bindMutex);
+        // Bound modules have been enumerated and recorded already
+        if (!g_boundModules || !HasModuleName(g_boundModules, module)) {
+            if (RefreshModule(module))
+                manifestChanged = true;
+        }
+        OScInternal_Mutex_Unlock(&g_bindMutex);
+    }
+    if (manifestChanged) {
+        OScInternal_Mutex_Lock(&g_bindMutex);
+        WriteManifest();
+        OScInternal_Mutex_Unlock(&g_bindMutex);
+    }
+    return OSc_OK;
+}
+
+void OSc_SetDeviceManifestCache(const char *path) {
+    free(g_manifestPath);
+    g_manifestPath = NULL;
+    if (path) {
+        g_manifestPath = malloc(strlen(path) + 1);
+        strcpy(g_manifestPath, path);
+    }
+    OScInternal_DeviceModule_SetLoadOnDemand(g_manifestPath || g_lazyLoading);
+}
+
+void OSc_SetDeviceModuleLazyLoading(bool lazy) {
+    g_lazyLoading = lazy;
+    OScInternal_DeviceModule_SetLoadOnDemand(g_manifestPath || g_lazyLoading);
+}
+
+void OSc_SetDeviceEnumerationTimeout(double seconds) {
+    g_enumerationTimeout = seconds > 0.0 ? seconds : 0.0;
+}
+
 OSc_RichError *OSc_GetAllDevices(OSc_Device ***devices, size_t *count) {
     OSc_RichError *err;
     if (OSc_CHECK_ERROR(err, EnumerateDevices()))
@@ -1,4 +1,5 @@
 #include "DeviceInterface.h"
+#include "Interleave.h"
 #include "OpenScanLibPrivate.h"
 
 // This file contains thin wrappers around functions, to conform to the device
@@ -376,6 +377,47 @@ static bool Acquisition_CallFrameCallback(OScDev_ModuleImpl *modImpl,
                                                      pixels);
 }
 
+static uint32_t Acquisition_GetSamplesPerPixel(OScDev_ModuleImpl *modImpl,
+                                               OScDev_Acquisition *devAcq) {
+    (void)modImpl;
+    OSc_Acquisition *acq =
+        OScInternal_AcquisitionForDevice_GetAcquisition(devAcq);
+    return OSc_Acquisition_GetSamplesPerPixel(acq);
+}
+
+static bool Acquisition_CallTimeTagCallback(OScDev_ModuleImpl *modImpl,
+                                            OScDev_Acquisition *devAcq,
+                                            const uint64_t *timeTags,
+                                            size_t count) {
+    (void)modImpl;
+    size_t detIdx =
+        OScInternal_AcquisitionForDevice_GetDetectorDeviceIndex(devAcq);
+    OSc_Acquisition *acq =
+        OScInternal_AcquisitionForDevice_GetAcquisition(devAcq);
+    return OScInternal_Acquisition_CallTimeTagCallback(acq, detIdx, timeTags,
+                                                       count);
+}
+
+static OScDev_Error DeinterleaveChannels(OScDev_ModuleImpl *modImpl,
+                                         const void *src, void *const *dst,
+                                         uint32_t nChannels,
+                                         uint32_t bytesPerSample,
+                                         size_t samplesPerChannel) {
+    (void)modImpl;
+    return OScInternal_Error_ReturnAsCode(OScInternal_DeinterleaveChannels(
+        src, dst, nChannels, bytesPerSample, samplesPerChannel));
+}
+
+static OScDev_Error InterleaveChannels(OScDev_ModuleImpl *modImpl,
+                                       const void *const *src, void *dst,
+                                       uint32_t nChannels,
+                                       uint32_t bytesPerSample,
+                                       size_t samplesPerChannel) {
+    (void)modImpl;
+    return OScInternal_Error_ReturnAsCode(OScInternal_InterleaveChannels(
+        src, dst, nChannels, bytesPerSample, samplesPerChannel));
+}
+
 struct OScDevInternal_Interface DeviceInterfaceFunctionTable = {
     .Log = Log,
     .Error_RegisterCodeDomain = Error_RegisterCodeDomain,
@@ -428,4 +470,8 @@ struct OScDevInternal_Interface DeviceInterfaceFunctionTable = {
     .Acquisition_GetZoomFactor = Acquisition_GetZoomFactor,
     .Acquisition_GetROI = Acquisition_GetROI,
     .Acquisition_CallFrameCallback = Acquisition_CallFrameCallback,
+    .Acquisition_GetSamplesPerPixel = Acquisition_GetSamplesPerPixel,
+    .Acquisition_CallTimeTagCallback = Acquisition_CallTimeTagCallback,
+    .DeinterleaveChannels = DeinterleaveChannels,
+    .InterleaveChannels = InterleaveChannels,
 };
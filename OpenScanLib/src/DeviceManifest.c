@@ -0,0 +1,286 @@
+#include "DeviceManifest.h"
+
+#include "InternalErrors.h"
+
+#define OScDevInternal_BUILDING_OPENSCANLIB 1
+#include "OpenScanDeviceLibPrivate.h"
+
+#include <ss8str.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+#define MANIFEST_MAGIC "OScDevManifest"
+#define MANIFEST_VERSION 1
+#define MAX_LINE 8192
+
+struct ManifestModule {
+    ss8str name;
+    ss8str path;
+    uint64_t size;
+    int64_t mtime;
+    struct OScInternal_ManifestDevice *devices;
+    size_t deviceCount;
+};
+
+struct OScInternal_Manifest {
+    struct ManifestModule *modules;
+    size_t count;
+    size_t cap;
+};
+
+OScInternal_Manifest *OScInternal_Manifest_Create(void) {
+    return calloc(1, sizeof(OScInternal_Manifest));
+}
+
+static void ClearModule(struct ManifestModule *mod) {
+    ss8_destroy(&mod->name);
+    ss8_destroy(&mod->path);
+    free(mod->devices);
+}
+
+void OScInternal_Manifest_Destroy(OScInternal_Manifest *manifest) {
+    if (!manifest)
+        return;
+    for (size_t i = 0; i < manifest->count; ++i)
+        ClearModule(&manifest->modules[i]);
+    free(manifest->modules);
+    free(manifest);
+}
+
+static struct ManifestModule *FindModule(const OScInternal_Manifest *manifest,
+                                         const char *module) {
+    for (size_t i = 0; i < manifest->count; ++i) {
+        if (ss8_equals_cstr(&manifest->modules[i].name, module))
+            return &manifest->modules[i];
+    }
+    return NULL;
+}
+
+static struct ManifestModule *AddModule(OScInternal_Manifest *manifest) {
+    if (manifest->count == manifest->cap) {
+        manifest->cap = manifest->cap ? manifest->cap * 2 : 16;
+        manifest->modules = realloc(
+            manifest->modules, sizeof(struct ManifestModule) * manifest->cap);
+    }
+    struct ManifestModule *mod = &manifest->modules[manifest->count++];
+    ss8_init(&mod->name);
+    ss8_init(&mod->path);
+    mod->size = 0;
+    mod->mtime = 0;
+    mod->devices = NULL;
+    mod->deviceCount = 0;
+    return mod;
+}
+
+// Split "A<TAB>B" (without line break) in place
+static bool SplitPair(char *s, char **first, char **second) {
+    s[strcspn(s, "\r\n")] = '\0';
+    char *tab = strchr(s, '\t');
+    if (!tab || strchr(tab + 1, '\t'))
+        return false;
+    *tab = '\0';
+    *first = s;
+    *second = tab + 1;
+    return true;
+}
+
+static bool ParseModule(OScInternal_Manifest *manifest, char *line) {
+    uint64_t size;
+    int64_t mtime;
+    int consumed = 0;
+    if (sscanf(line, "module %" SCNu64 " %" SCNd64 " %n", &size, &mtime,
+               &consumed) != 2 ||
+        consumed == 0)
+        return false;
+    char *name, *path;
+    if (!SplitPair(line + consumed, &name, &path) || !*name || !*path ||
+        FindModule(manifest, name))
+        return false;
+
+    struct ManifestModule *mod = AddModule(manifest);
+    ss8_copy_cstr(&mod->name, name);
+    ss8_copy_cstr(&mod->path, path);
+    mod->size = size;
+    mod->mtime = mtime;
+    return true;
+}
+
+static bool ParseDevice(struct ManifestModule *mod, char *line) {
+    char flags[4];
+    int consumed = 0;
+    if (sscanf(line, "device %3[01] %n", flags, &consumed) != 1 ||
+        consumed == 0 || strlen(flags) != 3)
+        return false;
+    char *model, *name;
+    if (!SplitPair(line + consumed, &model, &name) ||
+        strlen(model) > OSc_MAX_STR_LEN || strlen(name) > OSc_MAX_STR_LEN)
+        return false;
+
+    mod->devices =
+        realloc(mod->devices, sizeof(struct OScInternal_ManifestDevice) *
+                                  (mod->deviceCount + 1));
+    struct OScInternal_ManifestDevice *dev =
+        &mod->devices[mod->deviceCount++];
+    strcpy(dev->modelName, model);
+    strcpy(dev->name, name);
+    dev->hasClock = flags[0] == '1';
+    dev->hasScanner = flags[1] == '1';
+    dev->hasDetector = flags[2] == '1';
+    return true;
+}
+
+OScInternal_Manifest *OScInternal_Manifest_Read(const char *path) {
+    OScInternal_Manifest *manifest = OScInternal_Manifest_Create();
+    if (!manifest)
+        return NULL;
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return manifest;
+
+    char *line = malloc(MAX_LINE);
+    bool ok = line && fgets(line, MAX_LINE, fp);
+    if (ok) {
+        unsigned version = 0;
+        uint32_t abiVersion = 0;
+        ok = sscanf(line, MANIFEST_MAGIC " %u %" SCNx32, &version,
+                    &abiVersion) == 2 &&
+             version == MANIFEST_VERSION &&
+             abiVersion == OScDevInternal_ABI_VERSION;
+    }
+    struct ManifestModule *mod = NULL;
+    while (ok && fgets(line, MAX_LINE, fp)) {
+        if (!strchr(line, '\n') && !feof(fp))
+            ok = false; // Line too long
+        else if (strncmp(line, "module ", 7) == 0) {
+            ok = ParseModule(manifest, line);
+            mod = &manifest->modules[manifest->count - 1];
+        } else if (strncmp(line, "device ", 7) == 0)
+            ok = mod && ParseDevice(mod, line);
+        else
+            ok = false;
+    }
+    if (ok && ferror(fp))
+        ok = false;
+    free(line);
+    fclose(fp);
+
+    // A damaged manifest is ignored as a whole; it will be rewritten
+    if (!ok) {
+        OScInternal_Manifest_Destroy(manifest);
+        manifest = OScInternal_Manifest_Create();
+    }
+    return manifest;
+}
+
+static bool ReplaceFile(const char *from, const char *to) {
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING);
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+OSc_RichError *OScInternal_Manifest_Write(const OScInternal_Manifest *manifest,
+                                          const char *path) {
+    ss8str tmpPath;
+    ss8_init_copy_cstr(&tmpPath, path);
+    ss8_cat_cstr(&tmpPath, ".tmp");
+
+    FILE *fp = fopen(ss8_cstr(&tmpPath), "w");
+    if (!fp) {
+        ss8_destroy(&tmpPath);
+        return OScInternal_Error_Create("Cannot create device manifest");
+    }
+
+    fprintf(fp, MANIFEST_MAGIC " %u %08" PRIx32 "\n", MANIFEST_VERSION,
+            (uint32_t)OScDevInternal_ABI_VERSION);
+    for (size_t i = 0; i < manifest->count; ++i) {
+        const struct ManifestModule *mod = &manifest->modules[i];
+        fprintf(fp, "module %" PRIu64 " %" PRId64 " %s\t%s\n", mod->size,
+                mod->mtime, ss8_cstr(&mod->name), ss8_cstr(&mod->path));
+        for (size_t j = 0; j < mod->deviceCount; ++j) {
+            const struct OScInternal_ManifestDevice *dev = &mod->devices[j];
+            fprintf(fp, "device %d%d%d %s\t%s\n", dev->hasClock,
+                    dev->hasScanner, dev->hasDetector, dev->modelName,
+                    dev->name);
+        }
+    }
+
+    bool ok = !ferror(fp);
+    ok = fclose(fp) == 0 && ok;
+    if (ok)
+        ok = ReplaceFile(ss8_cstr(&tmpPath), path);
+    if (!ok)
+        remove(ss8_cstr(&tmpPath));
+    ss8_destroy(&tmpPath);
+    if (!ok)
+        return OScInternal_Error_Create("Cannot write device manifest");
+    return OSc_OK;
+}
+
+bool OScInternal_Manifest_Lookup(
+    const OScInternal_Manifest *manifest, const char *module,
+    const char *path, uint64_t size, int64_t mtime,
+    const struct OScInternal_ManifestDevice **devices, size_t *count) {
+    const struct ManifestModule *mod = FindModule(manifest, module);
+    if (!mod || !ss8_equals_cstr(&mod->path, path) || mod->size != size ||
+        mod->mtime != mtime)
+        return false;
+    *devices = mod->devices;
+    *count = mod->deviceCount;
+    return true;
+}
+
+bool OScInternal_Manifest_RemoveModule(OScInternal_Manifest *manifest,
+                                       const char *module) {
+    struct ManifestModule *mod = FindModule(manifest, module);
+    if (!mod)
+        return false;
+    ClearModule(mod);
+    *mod = manifest->modules[--manifest->count];
+    return true;
+}
+
+static bool IsWritable(const char *s) { return !s[strcspn(s, "\t\r\n")]; }
+
+void OScInternal_Manifest_SetModule(
+    OScInternal_Manifest *manifest, const char *module, const char *path,
+    uint64_t size, int64_t mtime,
+    const struct OScInternal_ManifestDevice *devices, size_t count) {
+    bool writable = *module && *path && IsWritable(module) && IsWritable(path);
+    for (size_t j = 0; j < count && writable; ++j) {
+        writable = IsWritable(devices[j].modelName) &&
+                   IsWritable(devices[j].name);
+    }
+
+    if (!writable) {
+        OScInternal_Manifest_RemoveModule(manifest, module);
+        return;
+    }
+    struct ManifestModule *mod = FindModule(manifest, module);
+    if (mod) {
+        free(mod->devices);
+        mod->devices = NULL;
+        mod->deviceCount = 0;
+    } else {
+        mod = AddModule(manifest);
+        ss8_copy_cstr(&mod->name, module);
+    }
+    ss8_copy_cstr(&mod->path, path);
+    mod->size = size;
+    mod->mtime = mtime;
+    if (count > 0) {
+        mod->devices =
+            malloc(sizeof(struct OScInternal_ManifestDevice) * count);
+        memcpy(mod->devices, devices,
+               sizeof(struct OScInternal_ManifestDevice) * count);
+        mod->deviceCount = count;
+    }
+}
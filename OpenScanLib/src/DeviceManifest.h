@@ -0,0 +1,58 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * Manifest of the devices found in each device module, cached on disk so
+ * that the device list can be presented at startup without loading and
+ * enumerating the modules.
+ *
+ * Each module's entry is keyed by the module's path, size and modification
+ * time, and the whole manifest by the device module ABI version, so that an
+ * entry is only used while it describes the same module file.
+ *
+ * The file is text: a line "OScDevManifest 1 ABI" (ABI in hexadecimal),
+ * then for each module a line "module SIZE MTIME NAME<TAB>PATH", followed by
+ * a line "device FLAGS MODEL<TAB>NAME" for each of its devices, where FLAGS
+ * is three digits 0 or 1 (has clock, scanner, detector).
+ */
+
+struct OScInternal_ManifestDevice {
+    char modelName[OSc_MAX_STR_LEN + 1];
+    char name[OSc_MAX_STR_LEN + 1];
+    bool hasClock;
+    bool hasScanner;
+    bool hasDetector;
+};
+
+typedef struct OScInternal_Manifest OScInternal_Manifest;
+
+OScInternal_Manifest *OScInternal_Manifest_Create(void);
+
+void OScInternal_Manifest_Destroy(OScInternal_Manifest *manifest);
+
+// Read the manifest 'path'. A missing, unreadable, or outdated file gives an
+// empty manifest.
+OScInternal_Manifest *OScInternal_Manifest_Read(const char *path);
+
+// Write the manifest to 'path', replacing it atomically
+OSc_RichError *OScInternal_Manifest_Write(const OScInternal_Manifest *manifest,
+                                          const char *path);
+
+// Find the entry for 'module' if it matches the key, setting '*devices' to
+// its devices (valid until the entry is replaced)
+bool OScInternal_Manifest_Lookup(
+    const OScInternal_Manifest *manifest, const char *module,
+    const char *path, uint64_t size, int64_t mtime,
+    const struct OScInternal_ManifestDevice **devices, size_t *count);
+
+// Add or replace the entry for 'module'. Modules whose strings cannot be
+// written (containing tabs or line breaks) are not recorded.
+void OScInternal_Manifest_SetModule(
+    OScInternal_Manifest *manifest, const char *module, const char *path,
+    uint64_t size, int64_t mtime,
+    const struct OScInternal_ManifestDevice *devices, size_t count);
+
+// Remove the entry for 'module'; returns false if there was none
+bool OScInternal_Manifest_RemoveModule(OScInternal_Manifest *manifest,
+                                       const char *module);
@@ -1,43 +1,82 @@
 #include "DeviceInterface.h"
 #include "InternalErrors.h"
 #include "Module.h"
+#include "ModuleHost.h"
+#include "Parallel.h"
 
 #define OScDevInternal_BUILDING_OPENSCANLIB 1
 #include "OpenScanDeviceLibPrivate.h"
 
 #include <ss8str.h>
 
+#include <stdlib.h>
+#include <string.h>
+
 // Array of strings; each element _and_ the array itself must be freed when
 // replacing; last element is always empty string.
 static ss8str *g_adapterPaths;
 
-// Array of valid module handles
+// Host executable and pool size, if modules are loaded out of process
+static char *g_hostPath;
+static size_t g_hostPoolBytes;
+
+// Load each module only when its device implementations are first requested
+static bool g_loadOnDemand;
+
+// Array of modules; all are loaded, unless loading on demand
 struct Module {
     OScInternal_Module handle;
+    OScInternal_ModuleHost *host; // Instead of 'handle', in host mode
     ss8str name;
+    ss8str path;
+    bool loaded;
+    OScDev_ModuleImpl *modImpl; // Once opened, if loaded in process
 };
 static struct Module *g_loadedAdapters;
 static size_t g_loadedAdapterCount;
 static size_t g_loadedAdaptersCap;
 
-static OSc_RichError *LoadAdapter(const char *path, const char *name) {
-    if (!g_loadedAdapters) {
-        g_loadedAdaptersCap = 16;
-        g_loadedAdapters = malloc(sizeof(struct Module) * g_loadedAdaptersCap);
-    }
+// A module file found in the search paths, to be loaded
+struct PendingModule {
+    ss8str path;
+    ss8str name;
+    OScInternal_Module handle;
+    OScInternal_ModuleHost *host;
+    OSc_RichError *err;
+};
 
-    // Ensure we do not already have a module with 'name'
+static bool IsModuleNameTaken(const char *name) {
     // TODO To support a large number of modules, this should be made more
     // efficient (binary search?).
     for (size_t i = 0; i < g_loadedAdapterCount; ++i) {
         if (ss8_equals_cstr(&g_loadedAdapters[i].name, name))
-            return OScInternal_Error_DeviceModuleAlreadyExists();
+            return true;
     }
+    return false;
+}
 
-    OScInternal_Module module;
-    OSc_RichError *err;
-    if (OSc_CHECK_ERROR(err, OScInternal_Module_Load(&module, path)))
-        return err;
+static OSc_RichError *LoadAdapter(const ss8str *path,
+                                  OScInternal_Module *handle,
+                                  OScInternal_ModuleHost **host) {
+    *handle = NULL;
+    *host = NULL;
+    if (g_hostPath) {
+        return OScInternal_ModuleHost_Spawn(host, g_hostPath, ss8_cstr(path),
+                                            g_hostPoolBytes);
+    }
+    return OScInternal_Module_Load(handle, ss8_cstr(path));
+}
+
+static void LoadPendingAdapters(void *data, size_t begin, size_t end) {
+    struct PendingModule *pending = data;
+    for (size_t i = begin; i < end; ++i) {
+        if (!pending[i].err)
+            pending[i].err = LoadAdapter(&pending[i].path, &pending[i].handle,
+                                         &pending[i].host);
+    }
+}
+
+static void AddAdapter(struct PendingModule *pending, bool loaded) {
     if (g_loadedAdapterCount == g_loadedAdaptersCap) {
         g_loadedAdapters =
             realloc(g_loadedAdapters,
@@ -45,43 +84,55 @@ static OSc_RichError *LoadAdapter(const char *path, const char *name) {
     }
 
     struct Module *desc = &g_loadedAdapters[g_loadedAdapterCount++];
-    desc->handle = module;
-    ss8_init_copy_cstr(&desc->name, name);
+    desc->handle = pending->handle;
+    desc->host = pending->host;
+    ss8_init_copy(&desc->name, &pending->name);
+    ss8_init_copy(&desc->path, &pending->path);
+    desc->loaded = loaded;
+    desc->modImpl = NULL;
+}
 
-    return OSc_OK;
+static void LogAdapterError(OSc_RichError *err) {
+    ss8str msg;
+    ss8_init(&msg);
+    ss8_set_len(&msg, 1024);
+    OScInternal_Error_FormatRecursive(err, ss8_mutable_cstr(&msg),
+                                      ss8_len(&msg) + 1);
+    ss8_set_len_to_cstrlen(&msg);
+    OScInternal_Error_Destroy(err);
+    OScInternal_LogError(NULL, ss8_cstr(&msg));
+    ss8_destroy(&msg);
 }
 
-static void LoadAdaptersAtPath(const ss8str *path) {
+// Append the modules at 'path' to 'pending' (of '*count' elements, with room
+// for '*cap')
+static void FindAdaptersAtPath(const ss8str *path,
+                               struct PendingModule **pending, size_t *count,
+                               size_t *cap) {
     ss8str *files;
     OScInternal_FileList_Create(&files, ss8_cstr(path), ".osdev");
     if (!files)
         return;
     for (ss8str *pfile = files; !ss8_is_empty(pfile); ++pfile) {
-        ss8str filePath;
-        ss8_init_copy(&filePath, path);
-        ss8_cat_ch(&filePath, '/');
-        ss8_cat(&filePath, pfile);
+        if (*count == *cap) {
+            *cap = *cap ? *cap * 2 : 16;
+            *pending = realloc(*pending, sizeof(struct PendingModule) * *cap);
+        }
+        struct PendingModule *p = &(*pending)[(*count)++];
+
+        ss8_init_copy(&p->path, path);
+        ss8_cat_ch(&p->path, '/');
+        ss8_cat(&p->path, pfile);
 
-        ss8str name;
-        ss8_init_copy(&name, pfile);
+        ss8_init_copy(&p->name, pfile);
         // Remove suffix (we trust OScInternal_FileList_Create returned what it
         // should)
-        size_t dot_pos = ss8_rfind_ch(&name, ss8_len(&name), '.');
-        ss8_substr_inplace(&name, 0, dot_pos);
-
-        OSc_RichError *err = LoadAdapter(ss8_cstr(&filePath), ss8_cstr(&name));
-        ss8_destroy(&name);
-        ss8_destroy(&filePath);
-
-        ss8str msg;
-        ss8_init(&msg);
-        ss8_set_len(&msg, 1024);
-        OScInternal_Error_FormatRecursive(err, ss8_mutable_cstr(&msg),
-                                          ss8_len(&msg) + 1);
-        ss8_set_len_to_cstrlen(&msg);
-        OScInternal_Error_Destroy(err);
-        OScInternal_LogError(NULL, ss8_cstr(&msg));
-        ss8_destroy(&msg);
+        size_t dot_pos = ss8_rfind_ch(&p->name, ss8_len(&p->name), '.');
+        ss8_substr_inplace(&p->name, 0, dot_pos);
+
+        p->handle = NULL;
+        p->host = NULL;
+        p->err = OSc_OK;
     }
     OScInternal_FileList_Free(files);
 }
@@ -92,9 +143,39 @@ static void LoadAdapters() {
         g_adapterPaths = malloc(sizeof(ss8str));
         ss8_init(&g_adapterPaths[0]);
     }
+    if (!g_loadedAdapters) {
+        g_loadedAdaptersCap = 16;
+        g_loadedAdapters = malloc(sizeof(struct Module) * g_loadedAdaptersCap);
+    }
 
+    struct PendingModule *pending = NULL;
+    size_t count = 0, cap = 0;
     for (const ss8str *p = g_adapterPaths; !ss8_is_empty(p); ++p)
-        LoadAdaptersAtPath(p);
+        FindAdaptersAtPath(p, &pending, &count, &cap);
+
+    // The first module found with a given name wins, as if loaded in order
+    for (size_t i = 0; i < count; ++i) {
+        bool taken = IsModuleNameTaken(ss8_cstr(&pending[i].name));
+        for (size_t j = 0; j < i && !taken; ++j)
+            taken = ss8_equals(&pending[j].name, &pending[i].name);
+        if (taken)
+            pending[i].err = OScInternal_Error_DeviceModuleAlreadyExists();
+    }
+
+    // Loading (and relocating) a module, or starting its host, is
+    // independent of the others, so the modules are loaded in parallel
+    if (!g_loadOnDemand)
+        OScInternal_ParallelFor(count, 1, LoadPendingAdapters, pending);
+
+    for (size_t i = 0; i < count; ++i) {
+        if (pending[i].err)
+            LogAdapterError(pending[i].err);
+        else
+            AddAdapter(&pending[i], !g_loadOnDemand);
+        ss8_destroy(&pending[i].name);
+        ss8_destroy(&pending[i].path);
+    }
+    free(pending);
 }
 
 static void FreeAdapterPaths() {
@@ -109,6 +190,21 @@ static void FreeAdapterPaths() {
     }
 }
 
+void OSc_SetDeviceModuleHost(const char *hostPath, size_t poolBytes) {
+    free(g_hostPath);
+    g_hostPath = NULL;
+    if (hostPath) {
+        g_hostPath = malloc(strlen(hostPath) + 1);
+        strcpy(g_hostPath, hostPath);
+    }
+    g_hostPoolBytes =
+        poolBytes ? poolBytes : OScInternal_MODULE_HOST_DEFAULT_POOL_BYTES;
+}
+
+void OScInternal_DeviceModule_SetLoadOnDemand(bool onDemand) {
+    g_loadOnDemand = onDemand;
+}
+
 void OSc_SetDeviceModuleSearchPaths(const char **paths) {
     FreeAdapterPaths();
 
@@ -144,19 +240,44 @@ OSc_RichError *OScInternal_DeviceModule_GetNames(const char **modules,
     return OSc_OK;
 }
 
+static struct Module *FindAdapter(const char *module) {
+    for (size_t i = 0; i < g_loadedAdapterCount; ++i) {
+        if (ss8_equals_cstr(&g_loadedAdapters[i].name, module))
+            return &g_loadedAdapters[i];
+    }
+    return NULL;
+}
+
+OSc_RichError *OScInternal_DeviceModule_GetPath(const char *module,
+                                                const char **path) {
+    if (!g_loadedAdapters)
+        LoadAdapters();
+
+    struct Module *mod = FindAdapter(module);
+    if (!mod)
+        return OScInternal_Error_NoSuchDeviceModule();
+    *path = ss8_cstr(&mod->path);
+    return OSc_OK;
+}
+
 OSc_RichError *
 OScInternal_DeviceModule_GetDeviceImpls(const char *module,
                                         OScInternal_PtrArray **deviceImpls) {
-    struct Module *mod = NULL;
-    for (size_t i = 0; i < g_loadedAdapterCount; ++i) {
-        if (ss8_equals_cstr(&g_loadedAdapters[i].name, module)) {
-            mod = &g_loadedAdapters[i];
-            break;
-        }
-    }
+    struct Module *mod = FindAdapter(module);
     if (!mod)
         return OScInternal_Error_NoSuchDeviceModule();
 
+    if (!mod->loaded) {
+        OSc_RichError *err;
+        if (OSc_CHECK_ERROR(err,
+                            LoadAdapter(&mod->path, &mod->handle, &mod->host)))
+            return err;
+        mod->loaded = true;
+    }
+
+    if (mod->host)
+        return OScInternal_ModuleHost_GetDeviceImpls(mod->host, deviceImpls);
+
     OScDevInternal_EntryPointPtr entryPoint;
     OSc_RichError *err;
     OScDev_Error errCode;
@@ -168,22 +289,47 @@ OScInternal_DeviceModule_GetDeviceImpls(const char *module,
     struct OScDevInternal_Interface **funcTablePtr;
     OScDev_ModuleImpl *modImpl;
     uint32_t dpiVersion = entryPoint(&funcTablePtr, &modImpl);
-    if (dpiVersion != OScDevInternal_ABI_VERSION) {
-        // TODO We could support non-exact version matches.
+    // Modules built against an older minor version only use a prefix of our
+    // function table. Their own structs (such as OScDev_DeviceImpl) may lack
+    // fields appended since, so fields added in a later minor version are
+    // only read according to the version recorded here.
+    if ((dpiVersion >> 16) != (OScDevInternal_ABI_VERSION >> 16) ||
+        (dpiVersion & 0xffff) > (OScDevInternal_ABI_VERSION & 0xffff)) {
         return OScInternal_Error_Unknown();
     }
+    OScInternal_Module_SetABIVersion(modImpl, dpiVersion);
 
     *funcTablePtr = &DeviceInterfaceFunctionTable;
 
-    if (modImpl->Open) {
+    if (modImpl->Open && !mod->modImpl) {
         errCode = modImpl->Open();
         if (errCode)
             return OScInternal_Error_RetrieveFromModule(modImpl, errCode);
     }
-    // TODO We need to also call Close() when shutting down
+    mod->modImpl = modImpl;
+    // TODO We need to also call Close() when shutting down (we only do so
+    // when unloading)
 
     errCode = modImpl->GetDeviceImpls(deviceImpls);
     if (errCode)
         return OScInternal_Error_RetrieveFromModule(modImpl, errCode);
     return OSc_OK;
 }
+
+void OScInternal_DeviceModule_Unload(const char *module) {
+    struct Module *mod = FindAdapter(module);
+    if (!mod || !mod->loaded)
+        return;
+
+    if (mod->host) {
+        OScInternal_ModuleHost_Destroy(mod->host);
+        mod->host = NULL;
+    } else {
+        if (mod->modImpl && mod->modImpl->Close)
+            mod->modImpl->Close();
+        OScInternal_Module_Unload(mod->handle);
+        mod->handle = NULL;
+    }
+    mod->modImpl = NULL;
+    mod->loaded = false;
+}
@@ -0,0 +1,118 @@
+#include "Dispatch.h"
+#include "CPU.h"
+#include "Codec.h"
+#include "Interleave.h"
+#include "Phasor.h"
+#include "PhotonCounting.h"
+#include "Pyramid.h"
+#include "Remap.h"
+#include "SampleFormat.h"
+#include "Threads.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LEVEL_ENV_VAR "OSC_SIMD_LEVEL"
+
+struct KernelGroup {
+    const char *name;
+    OSc_SIMDLevel (*bind)(OSc_SIMDLevel level);
+};
+
+static const struct KernelGroup g_kernelGroups[] = {
+    {"Interleave", OScInternal_Interleave_BindKernels},
+    {"SampleFormat", OScInternal_SampleFormat_BindKernels},
+    {"PhotonCounting", OScInternal_PhotonCount_BindKernels},
+    {"Phasor", OScInternal_Phasor_BindKernels},
+    {"Remap", OScInternal_Remap_BindKernels},
+    {"Pyramid", OScInternal_Pyramid_BindKernels},
+    {"Codec", OScInternal_Codec_BindKernels},
+};
+
+#define NUM_KERNEL_GROUPS (sizeof(g_kernelGroups) / sizeof(g_kernelGroups[0]))
+
+static const char *const g_levelNames[] = {"scalar", "sse4.2", "avx2",
+                                           "avx512"};
+
+static OScInternal_Mutex g_mutex = OScInternal_MUTEX_INITIALIZER;
+// Guarded by g_mutex
+static bool g_initialized;
+static OSc_SIMDLevel g_level;
+static OSc_SIMDLevel g_kernelLevels[NUM_KERNEL_GROUPS];
+
+OSc_SIMDLevel OScInternal_Dispatch_GetSupportedLevel(void) {
+    unsigned features = OScInternal_CPU_GetFeatures();
+    unsigned sse42 =
+        OScInternal_CPUFeature_SSSE3 | OScInternal_CPUFeature_SSE42;
+    if ((features & sse42) != sse42)
+        return OSc_SIMDLevel_Scalar;
+    if (!(features & OScInternal_CPUFeature_AVX2))
+        return OSc_SIMDLevel_SSE42;
+    if (!(features & OScInternal_CPUFeature_AVX512))
+        return OSc_SIMDLevel_AVX2;
+    return OSc_SIMDLevel_AVX512;
+}
+
+// The level requested by the environment, or the highest level if unset or
+// unrecognized
+static OSc_SIMDLevel GetRequestedLevel(void) {
+    const char *value = getenv(LEVEL_ENV_VAR);
+    if (value) {
+        for (OSc_SIMDLevel level = OSc_SIMDLevel_Scalar;
+             level <= OSc_SIMDLevel_AVX512; ++level) {
+            if (strcmp(value, g_levelNames[level]) == 0)
+                return level;
+        }
+    }
+    return OSc_SIMDLevel_AVX512;
+}
+
+// Called with g_mutex held
+static void BindAll(OSc_SIMDLevel level) {
+    OSc_SIMDLevel supported = OScInternal_Dispatch_GetSupportedLevel();
+    if (level > supported)
+        level = supported;
+    for (size_t i = 0; i < NUM_KERNEL_GROUPS; ++i)
+        g_kernelLevels[i] = g_kernelGroups[i].bind(level);
+    g_level = level;
+    g_initialized = true;
+}
+
+void OScInternal_Dispatch_Init(void) {
+    OScInternal_Mutex_Lock(&g_mutex);
+    if (!g_initialized)
+        BindAll(GetRequestedLevel());
+    OScInternal_Mutex_Unlock(&g_mutex);
+}
+
+void OScInternal_Dispatch_Bind(OSc_SIMDLevel level) {
+    OScInternal_Mutex_Lock(&g_mutex);
+    BindAll(level);
+    OScInternal_Mutex_Unlock(&g_mutex);
+}
+
+OSc_SIMDLevel OSc_GetSIMDLevel(void) {
+    OScInternal_Dispatch_Init();
+    OScInternal_Mutex_Lock(&g_mutex);
+    OSc_SIMDLevel level = g_level;
+    OScInternal_Mutex_Unlock(&g_mutex);
+    return level;
+}
+
+size_t OSc_GetNumberOfKernels(void) { return NUM_KERNEL_GROUPS; }
+
+const char *OSc_GetKernelName(size_t index) {
+    if (index >= NUM_KERNEL_GROUPS)
+        return NULL;
+    return g_kernelGroups[index].name;
+}
+
+OSc_SIMDLevel OSc_GetKernelLevel(size_t index) {
+    if (index >= NUM_KERNEL_GROUPS)
+        return OSc_SIMDLevel_Scalar;
+    OScInternal_Dispatch_Init();
+    OScInternal_Mutex_Lock(&g_mutex);
+    OSc_SIMDLevel level = g_kernelLevels[index];
+    OScInternal_Mutex_Unlock(&g_mutex);
+    return level;
+}
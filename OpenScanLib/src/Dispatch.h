@@ -0,0 +1,24 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * Run-time dispatch of SIMD kernels. Each module with SIMD kernels has a
+ * BindKernels() function that points its kernels to the best variants for a
+ * given OSc_SIMDLevel and returns the level of the variants bound. Until it
+ * is called, the scalar variants are used.
+ *
+ * The level is determined once, from the processor features capped by the
+ * OSC_SIMD_LEVEL environment variable, when the application checks the ABI
+ * version or creates an LSM (before any acquisition can run kernels).
+ */
+
+// Determine the level and bind all kernels, unless already done
+void OScInternal_Dispatch_Init(void);
+
+// Bind all kernels for 'level', lowered to what the processor supports
+// (used by tests to cover every variant). Kernels must not be running.
+void OScInternal_Dispatch_Bind(OSc_SIMDLevel level);
+
+// The highest level supported by the processor and operating system
+OSc_SIMDLevel OScInternal_Dispatch_GetSupportedLevel(void);
@@ -0,0 +1,612 @@
+#include "FrameRing.h"
+#include "InternalErrors.h"
+#include "SampleFormat.h"
+#include "Storage.h"
+#include "Threads.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#define SLOT_ALIGNMENT 64
+#define DEFAULT_SLOTS 8
+
+// Subscribers without a futex check for new frames this often
+#define POLL_MILLISECONDS 1
+
+struct OScInternal_FrameRing {
+    char *name;
+#ifdef _WIN32
+    HANDLE mapping; // The name exists as long as a handle is open
+#endif
+    struct OScInternal_FrameRingHeader *header;
+    size_t size;
+    uint64_t published;
+};
+
+struct OScInternal_FrameRingSubscriber {
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+    const struct OScInternal_FrameRingHeader *header;
+    size_t size;
+};
+
+/*
+ * Atomic operations on the shared memory. MSVC has no __atomic builtins;
+ * there, volatile loads acquire and volatile stores release (/volatile:ms,
+ * the default on x86 and x64), and fences need only stop the compiler from
+ * reordering.
+ */
+
+#ifdef _MSC_VER
+
+static uint64_t Load64(const uint64_t *p) {
+    return *(const volatile uint64_t *)p;
+}
+
+static void Store64(uint64_t *p, uint64_t value) {
+    *(volatile uint64_t *)p = value;
+}
+
+static uint32_t Load32(const uint32_t *p) {
+    return *(const volatile uint32_t *)p;
+}
+
+static void Store32(uint32_t *p, uint32_t value) {
+    *(volatile uint32_t *)p = value;
+}
+
+static void Increment32(uint32_t *p) { InterlockedIncrement((LONG *)p); }
+
+static void AcquireFence(void) { _ReadWriteBarrier(); }
+
+static void ReleaseFence(void) { _ReadWriteBarrier(); }
+
+#else
+
+static uint64_t Load64(const uint64_t *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void Store64(uint64_t *p, uint64_t value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static uint32_t Load32(const uint32_t *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void Store32(uint32_t *p, uint32_t value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static void Increment32(uint32_t *p) {
+    __atomic_add_fetch(p, 1, __ATOMIC_RELEASE);
+}
+
+static void AcquireFence(void) { __atomic_thread_fence(__ATOMIC_ACQUIRE); }
+
+static void ReleaseFence(void) { __atomic_thread_fence(__ATOMIC_RELEASE); }
+
+#endif
+
+static OSc_RichError *IOError(const char *operation, int code) {
+    char message[256];
+#ifdef _WIN32
+    snprintf(message, sizeof(message), "%s failed (Windows error %d)",
+             operation, code);
+#else
+    snprintf(message, sizeof(message), "%s failed: %s", operation,
+             strerror(code));
+#endif
+    return OScInternal_Error_Create(message);
+}
+
+static struct OScInternal_FrameRingSlot *
+GetSlot(const struct OScInternal_FrameRingHeader *header, uint64_t frame) {
+    size_t index = (size_t)(frame % header->numberOfSlots);
+    char *base = (char *)header + header->headerBytes;
+    return (struct OScInternal_FrameRingSlot *)(base +
+                                                index * header->slotBytes);
+}
+
+/*
+ * Platform-dependent shared memory and notification. The memory functions
+ * return 0 or an error code (errno or GetLastError()).
+ */
+
+#ifdef _WIN32
+
+// Named objects are in the session namespace
+static char *GetSystemName(const char *name) {
+    const char *prefix = "Local\\";
+    char *systemName = malloc(strlen(prefix) + strlen(name) + 1);
+    if (systemName) {
+        strcpy(systemName, prefix);
+        strcat(systemName, name[0] == '/' ? name + 1 : name);
+    }
+    return systemName;
+}
+
+static int CreateSharedMemory(OScInternal_FrameRing *ring) {
+    ring->mapping = CreateFileMappingA(
+        INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+        (DWORD)((uint64_t)ring->size >> 32), (DWORD)ring->size, ring->name);
+    if (!ring->mapping)
+        return (int)GetLastError();
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(ring->mapping);
+        return ERROR_ALREADY_EXISTS;
+    }
+    ring->header = MapViewOfFile(ring->mapping, FILE_MAP_WRITE, 0, 0, 0);
+    if (!ring->header) {
+        int code = (int)GetLastError();
+        CloseHandle(ring->mapping);
+        return code;
+    }
+    return 0;
+}
+
+static void DestroySharedMemory(OScInternal_FrameRing *ring) {
+    UnmapViewOfFile(ring->header);
+    CloseHandle(ring->mapping);
+}
+
+static int OpenSharedMemory(OSc_FrameRingSubscriber *sub, const char *name,
+                            bool *notFound) {
+    sub->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    if (!sub->mapping) {
+        int code = (int)GetLastError();
+        *notFound = code == ERROR_FILE_NOT_FOUND;
+        return code;
+    }
+    sub->header = MapViewOfFile(sub->mapping, FILE_MAP_READ, 0, 0, 0);
+    MEMORY_BASIC_INFORMATION info;
+    if (!sub->header ||
+        !VirtualQuery(sub->header, &info, sizeof(info))) {
+        int code = (int)GetLastError();
+        if (sub->header)
+            UnmapViewOfFile(sub->header);
+        CloseHandle(sub->mapping);
+        return code;
+    }
+    sub->size = info.RegionSize;
+    return 0;
+}
+
+static void CloseSharedMemory(OSc_FrameRingSubscriber *sub) {
+    UnmapViewOfFile(sub->header);
+    CloseHandle(sub->mapping);
+}
+
+static void WakeSubscribers(uint32_t *notification) { (void)notification; }
+
+static void WaitForNotification(const uint32_t *notification, uint32_t value,
+                                double seconds) {
+    (void)notification;
+    (void)value;
+    DWORD ms = seconds * 1000.0 < POLL_MILLISECONDS
+                   ? (DWORD)(seconds * 1000.0)
+                   : POLL_MILLISECONDS;
+    Sleep(ms);
+}
+
+#else
+
+// POSIX shared memory names start with a slash
+static char *GetSystemName(const char *name) {
+    char *systemName = malloc(strlen(name) + 2);
+    if (systemName) {
+        strcpy(systemName, name[0] == '/' ? "" : "/");
+        strcat(systemName, name);
+    }
+    return systemName;
+}
+
+static int CreateSharedMemory(OScInternal_FrameRing *ring) {
+    // Subscribers of a previous ring keep their mapping
+    shm_unlink(ring->name);
+    int fd = shm_open(ring->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return errno;
+    if (ftruncate(fd, (off_t)ring->size) != 0) {
+        int code = errno;
+        close(fd);
+        shm_unlink(ring->name);
+        return code;
+    }
+    void *addr =
+        mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int code = addr == MAP_FAILED ? errno : 0;
+    close(fd);
+    if (code != 0) {
+        shm_unlink(ring->name);
+        return code;
+    }
+    ring->header = addr;
+    return 0;
+}
+
+static void DestroySharedMemory(OScInternal_FrameRing *ring) {
+    munmap(ring->header, ring->size);
+    shm_unlink(ring->name);
+}
+
+static int OpenSharedMemory(OSc_FrameRingSubscriber *sub, const char *name,
+                            bool *notFound) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        *notFound = errno == ENOENT;
+        return errno;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int code = errno;
+        close(fd);
+        return code;
+    }
+    sub->size = (size_t)st.st_size;
+    if (sub->size < OScInternal_FRAME_RING_HEADER_BYTES) {
+        close(fd); // Being created
+        *notFound = true;
+        return ENOENT;
+    }
+    void *addr = mmap(NULL, sub->size, PROT_READ, MAP_SHARED, fd, 0);
+    int code = addr == MAP_FAILED ? errno : 0;
+    close(fd);
+    if (code != 0)
+        return code;
+    sub->header = addr;
+    return 0;
+}
+
+static void CloseSharedMemory(OSc_FrameRingSubscriber *sub) {
+    munmap((void *)sub->header, sub->size);
+}
+
+#ifdef __linux__
+
+static void WakeSubscribers(uint32_t *notification) {
+    syscall(SYS_futex, notification, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void WaitForNotification(const uint32_t *notification, uint32_t value,
+                                double seconds) {
+    struct timespec timeout;
+    timeout.tv_sec = (time_t)seconds;
+    timeout.tv_nsec = (long)((seconds - (double)timeout.tv_sec) * 1e9);
+    syscall(SYS_futex, notification, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+#else
+
+static void WakeSubscribers(uint32_t *notification) { (void)notification; }
+
+static void WaitForNotification(const uint32_t *notification, uint32_t value,
+                                double seconds) {
+    (void)notification;
+    (void)value;
+    double poll = POLL_MILLISECONDS / 1000.0;
+    if (seconds > poll)
+        seconds = poll;
+    struct timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = (long)(seconds * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+#endif
+
+#endif
+
+OSc_RichError *OScInternal_FrameRing_Create(OScInternal_FrameRing **ring,
+                                            const char *name,
+                                            uint32_t numberOfSlots,
+                                            size_t maxFrameBytes) {
+    if (!name || !name[0] || numberOfSlots < 2)
+        return OScInternal_Error_IllegalArgument();
+    uint64_t slotBytes = ((uint64_t)sizeof(struct OScInternal_FrameRingSlot) +
+                          maxFrameBytes + SLOT_ALIGNMENT - 1) &
+                         ~(uint64_t)(SLOT_ALIGNMENT - 1);
+    if (slotBytes > UINT32_MAX ||
+        slotBytes * numberOfSlots >
+            SIZE_MAX - OScInternal_FRAME_RING_HEADER_BYTES)
+        return OScInternal_Error_IllegalArgument();
+
+    OScInternal_FrameRing *r = calloc(1, sizeof(OScInternal_FrameRing));
+    if (!r)
+        return OScInternal_Error_OutOfMemory();
+    r->name = GetSystemName(name);
+    if (!r->name) {
+        free(r);
+        return OScInternal_Error_OutOfMemory();
+    }
+    r->size = OScInternal_FRAME_RING_HEADER_BYTES +
+              (size_t)(slotBytes * numberOfSlots);
+    int code = CreateSharedMemory(r);
+    if (code != 0) {
+        free(r->name);
+        free(r);
+        return IOError("Create frame ring", code);
+    }
+
+    // The memory is zero-filled, so all slots are empty (sequence 0)
+    struct OScInternal_FrameRingHeader *h = r->header;
+    h->version = OScInternal_FRAME_RING_VERSION;
+    h->headerBytes = OScInternal_FRAME_RING_HEADER_BYTES;
+    h->numberOfSlots = numberOfSlots;
+    h->slotBytes = (uint32_t)slotBytes;
+    ReleaseFence();
+    memcpy(h->magic, OScInternal_FRAME_RING_MAGIC, sizeof(h->magic));
+    *ring = r;
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_FrameRing_Publish(OScInternal_FrameRing *ring,
+                                             uint32_t channel, uint32_t width,
+                                             uint32_t height,
+                                             OSc_SampleFormat format,
+                                             const void *pixels) {
+    struct OScInternal_FrameRingHeader *h = ring->header;
+    uint64_t bytes = (uint64_t)width * height *
+                     OScInternal_SampleFormat_GetBytesPerSample(format);
+    if (bytes > h->slotBytes - sizeof(struct OScInternal_FrameRingSlot))
+        return OScInternal_Error_Create("Frame too large for frame ring");
+
+    uint64_t n = ring->published;
+    struct OScInternal_FrameRingSlot *slot = GetSlot(h, n);
+    Store64(&slot->sequence, 2 * n + 1);
+    ReleaseFence();
+    slot->channel = channel;
+    slot->width = width;
+    slot->height = height;
+    slot->sampleFormat = format;
+    slot->pixelBytes = bytes;
+    memcpy(slot + 1, pixels, (size_t)bytes);
+    Store64(&slot->sequence, 2 * n + 2);
+
+    ring->published = n + 1;
+    Store64(&h->published, n + 1);
+    Increment32(&h->notification);
+    WakeSubscribers(&h->notification);
+    return OSc_OK;
+}
+
+void OScInternal_FrameRing_Destroy(OScInternal_FrameRing *ring) {
+    if (!ring)
+        return;
+    struct OScInternal_FrameRingHeader *h = ring->header;
+    Store32(&h->closed, 1);
+    Increment32(&h->notification);
+    WakeSubscribers(&h->notification);
+    DestroySharedMemory(ring);
+    free(ring->name);
+    free(ring);
+}
+
+OSc_RichError *
+OSc_FrameRingSubscriber_Open(OSc_FrameRingSubscriber **subscriber,
+                             const char *name) {
+    if (!subscriber || !name || !name[0])
+        return OScInternal_Error_IllegalArgument();
+    OSc_FrameRingSubscriber *sub =
+        calloc(1, sizeof(OSc_FrameRingSubscriber));
+    char *systemName = GetSystemName(name);
+    if (!sub || !systemName) {
+        free(sub);
+        free(systemName);
+        return OScInternal_Error_OutOfMemory();
+    }
+    bool notFound = false;
+    int code = OpenSharedMemory(sub, systemName, &notFound);
+    free(systemName);
+    if (code != 0) {
+        free(sub);
+        if (notFound)
+            return OScInternal_Error_Create("Frame ring not found");
+        return IOError("Open frame ring", code);
+    }
+
+    const struct OScInternal_FrameRingHeader *h = sub->header;
+    bool valid =
+        memcmp(h->magic, OScInternal_FRAME_RING_MAGIC, sizeof(h->magic)) == 0;
+    AcquireFence();
+    valid = valid && h->version == OScInternal_FRAME_RING_VERSION &&
+            h->numberOfSlots > 0 &&
+            h->headerBytes >= sizeof(struct OScInternal_FrameRingHeader) &&
+            h->slotBytes >= sizeof(struct OScInternal_FrameRingSlot) &&
+            h->headerBytes <= sub->size &&
+            h->numberOfSlots <= (sub->size - h->headerBytes) / h->slotBytes;
+    if (!valid) {
+        CloseSharedMemory(sub);
+        free(sub);
+        return OScInternal_Error_Create(
+            "Frame ring is not ready or has a wrong format");
+    }
+    *subscriber = sub;
+    return OSc_OK;
+}
+
+void OSc_FrameRingSubscriber_Close(OSc_FrameRingSubscriber *subscriber) {
+    if (!subscriber)
+        return;
+    CloseSharedMemory(subscriber);
+    free(subscriber);
+}
+
+uint64_t OSc_FrameRingSubscriber_GetNumberOfFramesPublished(
+    OSc_FrameRingSubscriber *subscriber) {
+    if (!subscriber)
+        return 0;
+    return Load64(&subscriber->header->published);
+}
+
+uint32_t
+OSc_FrameRingSubscriber_GetNumberOfSlots(OSc_FrameRingSubscriber *subscriber) {
+    return subscriber ? subscriber->header->numberOfSlots : 0;
+}
+
+bool OSc_FrameRingSubscriber_IsClosed(OSc_FrameRingSubscriber *subscriber) {
+    if (!subscriber)
+        return true;
+    return Load32(&subscriber->header->closed) != 0;
+}
+
+OSc_RichError *OSc_FrameRingSubscriber_Wait(
+    OSc_FrameRingSubscriber *subscriber, uint64_t frameNumber,
+    uint32_t timeoutMilliseconds, bool *published) {
+    if (!subscriber || !published)
+        return OScInternal_Error_IllegalArgument();
+    const struct OScInternal_FrameRingHeader *h = subscriber->header;
+    double deadline =
+        OScInternal_GetMonotonicTime() + timeoutMilliseconds / 1000.0;
+    for (;;) {
+        // Read the counter first, so that a frame published after the check
+        // below ends the wait
+        uint32_t notification = Load32(&h->notification);
+        *published = Load64(&h->published) > frameNumber;
+        if (*published || Load32(&h->closed))
+            return OSc_OK;
+        double remaining = deadline - OScInternal_GetMonotonicTime();
+        if (remaining <= 0.0)
+            return OSc_OK;
+        WaitForNotification(&h->notification, notification, remaining);
+    }
+}
+
+OSc_RichError *OSc_FrameRingSubscriber_GetFrame(
+    OSc_FrameRingSubscriber *subscriber, uint64_t frameNumber,
+    uint32_t *channel, uint32_t *width, uint32_t *height,
+    OSc_SampleFormat *format, const void **pixels, size_t *size) {
+    if (!subscriber || !channel || !width || !height || !format ||
+        !pixels || !size)
+        return OScInternal_Error_IllegalArgument();
+    const struct OScInternal_FrameRingHeader *h = subscriber->header;
+    const struct OScInternal_FrameRingSlot *slot = GetSlot(h, frameNumber);
+    uint64_t expected = 2 * frameNumber + 2;
+    if (Load64(&slot->sequence) == expected) {
+        uint64_t bytes = slot->pixelBytes;
+        *channel = slot->channel;
+        *width = slot->width;
+        *height = slot->height;
+        *format = slot->sampleFormat;
+        AcquireFence();
+        if (Load64(&slot->sequence) == expected &&
+            bytes <= h->slotBytes - sizeof(struct OScInternal_FrameRingSlot)) {
+            *pixels = slot + 1;
+            *size = (size_t)bytes;
+            return OSc_OK;
+        }
+    }
+    if (Load64(&h->published) <= frameNumber)
+        return OScInternal_Error_Create("Frame not yet published");
+    return OScInternal_Error_Create("Frame has been overwritten");
+}
+
+bool OSc_FrameRingSubscriber_IsFrameValid(OSc_FrameRingSubscriber *subscriber,
+                                          uint64_t frameNumber) {
+    if (!subscriber)
+        return false;
+    const struct OScInternal_FrameRingSlot *slot =
+        GetSlot(subscriber->header, frameNumber);
+    AcquireFence();
+    return Load64(&slot->sequence) == 2 * frameNumber + 2;
+}
+
+struct RingStage {
+    char *name;
+    uint32_t numberOfSlots;
+    OScInternal_FrameRing *ring;
+};
+
+static void DestroyRingStage(void *data) {
+    struct RingStage *rs = data;
+    OScInternal_FrameRing_Destroy(rs->ring); // Already finished normally
+    free(rs->name);
+    free(rs);
+}
+
+static OSc_RichError *StartRingStage(OSc_PipelineStage *stage, void *data) {
+    struct RingStage *rs = data;
+    struct OScInternal_RecordingInfo info;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OScInternal_RecordingInfo_FromAcquisition(
+                                 &info, OSc_PipelineStage_GetAcquisition(
+                                            stage))))
+        return err;
+    uint64_t frameBytes = OScInternal_RecordingInfo_GetFrameBytes(&info);
+    if (frameBytes == 0 || frameBytes > SIZE_MAX)
+        return OScInternal_Error_IllegalArgument();
+    return OScInternal_FrameRing_Create(&rs->ring, rs->name,
+                                        rs->numberOfSlots, (size_t)frameBytes);
+}
+
+static bool RunRingStage(OSc_PipelineStage *stage, OSc_FrameBuffer *frame,
+                         void *data) {
+    (void)stage;
+    struct RingStage *rs = data;
+    uint32_t width, height;
+    OSc_FrameBuffer_GetSize(frame, &width, &height);
+    // A frame too large for the slots is not published; viewers must not
+    // stop the acquisition
+    OSc_RichError *err = OScInternal_FrameRing_Publish(
+        rs->ring, OSc_FrameBuffer_GetChannel(frame), width, height,
+        OSc_FrameBuffer_GetSampleFormat(frame),
+        OSc_FrameBuffer_GetPixels(frame));
+    if (err)
+        OScInternal_Error_Destroy(err);
+    return true;
+}
+
+static OSc_RichError *FinishRingStage(void *data) {
+    struct RingStage *rs = data;
+    OScInternal_FrameRing_Destroy(rs->ring);
+    rs->ring = NULL;
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_FrameRing_AddStage(OScInternal_Pipeline *pipeline,
+                                              const char *name,
+                                              uint32_t numberOfSlots,
+                                              uint32_t queueDepth,
+                                              OSc_PipelineStage **stage) {
+    if (!name || !name[0] || numberOfSlots == 1)
+        return OScInternal_Error_IllegalArgument();
+    struct RingStage *rs = calloc(1, sizeof(struct RingStage));
+    if (!rs)
+        return OScInternal_Error_OutOfMemory();
+    rs->numberOfSlots = numberOfSlots ? numberOfSlots : DEFAULT_SLOTS;
+    rs->name = malloc(strlen(name) + 1);
+    if (!rs->name) {
+        free(rs);
+        return OScInternal_Error_OutOfMemory();
+    }
+    strcpy(rs->name, name);
+
+    OSc_RichError *err = OScInternal_Pipeline_AddStage(
+        pipeline, RunRingStage, rs, DestroyRingStage, queueDepth, stage);
+    if (err != OSc_OK) {
+        DestroyRingStage(rs);
+        return err;
+    }
+    OScInternal_Pipeline_SetStageLifecycle(*stage, StartRingStage,
+                                           FinishRingStage);
+    return OSc_OK;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+#include "Pipeline.h"
+
+/*
+ * Ring of frames in named shared memory (POSIX shm_open()), through which
+ * other processes on the same machine receive frames without copying or
+ * serialization, implementing the publisher stage and the public
+ * OSc_FrameRingSubscriber API.
+ *
+ * The publisher copies each frame (one channel) into the next slot of the
+ * ring, overwriting the oldest, and never waits for subscribers: any number
+ * of subscribers map the ring read-only and read frames in place. Each slot
+ * is guarded by a sequence lock: its sequence number is odd while the slot
+ * is being written, and 2n + 2 once it holds frame n (counting frames of
+ * all channels from 0). A subscriber checks the sequence number before and
+ * after reading a frame; if it has changed, the frame was overwritten and
+ * what was read must be discarded.
+ *
+ * After each frame, the publisher increments a notification counter in the
+ * ring header and wakes the subscribers waiting on it (with a futex on
+ * Linux; elsewhere, subscribers poll it). When the publisher is finished, it
+ * marks the ring closed and removes its name; subscribers that have it
+ * mapped can still read the last frames.
+ *
+ * Layout (in the byte order of the machine): a 4096-byte header (struct
+ * OScInternal_FrameRingHeader), followed by the slots, each a 64-byte
+ * struct OScInternal_FrameRingSlot followed by the pixels, padded to a
+ * multiple of 64 bytes.
+ *
+ * On Windows, a named file mapping in the session namespace ("Local\\") is
+ * used instead of POSIX shared memory.
+ */
+
+#define OScInternal_FRAME_RING_MAGIC "OScRing\n"
+#define OScInternal_FRAME_RING_VERSION 1
+#define OScInternal_FRAME_RING_HEADER_BYTES 4096
+
+struct OScInternal_FrameRingHeader {
+    char magic[8]; // OScInternal_FRAME_RING_MAGIC, written last
+    uint32_t version;
+    uint32_t headerBytes; // Offset of the first slot
+    uint32_t numberOfSlots;
+    uint32_t slotBytes;    // Stride of the slots
+    uint64_t published;    // Number of frames published
+    uint32_t notification; // Incremented after each frame (futex word)
+    uint32_t closed;       // Nonzero once the publisher is finished
+};
+
+struct OScInternal_FrameRingSlot {
+    uint64_t sequence; // Sequence lock (see above)
+    uint32_t channel;
+    uint32_t width;
+    uint32_t height;
+    int32_t sampleFormat;
+    uint64_t pixelBytes;
+    char reserved[32];
+};
+
+typedef struct OScInternal_FrameRing OScInternal_FrameRing;
+
+// Create (or replace) the ring 'name' with slots holding up to
+// 'maxFrameBytes' of pixels each
+OSc_RichError *OScInternal_FrameRing_Create(OScInternal_FrameRing **ring,
+                                            const char *name,
+                                            uint32_t numberOfSlots,
+                                            size_t maxFrameBytes);
+
+// Copy a frame into the next slot and notify subscribers. Frames larger
+// than the slots are rejected.
+OSc_RichError *OScInternal_FrameRing_Publish(OScInternal_FrameRing *ring,
+                                             uint32_t channel, uint32_t width,
+                                             uint32_t height,
+                                             OSc_SampleFormat format,
+                                             const void *pixels);
+
+// Mark the ring closed, notify subscribers, remove its name, and destroy it
+void OScInternal_FrameRing_Destroy(OScInternal_FrameRing *ring);
+
+// Add a built-in stage publishing every frame it receives to the ring
+// 'name', which is created when the acquisition is armed and closed when it
+// finishes
+OSc_RichError *OScInternal_FrameRing_AddStage(OScInternal_Pipeline *pipeline,
+                                              const char *name,
+                                              uint32_t numberOfSlots,
+                                              uint32_t queueDepth,
+                                              OSc_PipelineStage **stage);
@@ -0,0 +1,324 @@
+#include "Interleave.h"
+#include "CPU.h"
+#include "InternalErrors.h"
+
+#include <string.h>
+
+#ifdef OScInternal_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * The shuffle kernels work on blocks of nChannels 16-byte vectors of
+ * interleaved data, which correspond to one 16-byte vector per channel of
+ * planar data. Each output vector is the bitwise OR of byte shuffles of the
+ * input vectors, with shuffle masks computed per call from the channel count
+ * and sample size (0x80 zeroes a byte). With AVX2, two blocks are processed
+ * at once, one per 128-bit lane.
+ */
+
+#ifdef OScInternal_X86
+
+#define MAX_SHUFFLE_CHANNELS 8
+
+struct ShuffleMasks {
+    unsigned nChannels;
+    // mask[out][in]: bytes of input vector 'in' contributing to output
+    // vector 'out'; used[out][in] is false if there are none.
+    uint8_t mask[MAX_SHUFFLE_CHANNELS][MAX_SHUFFLE_CHANNELS][16];
+    bool used[MAX_SHUFFLE_CHANNELS][MAX_SHUFFLE_CHANNELS];
+};
+
+// Output vector k is channel k; input vector i is the i-th of the block.
+static void MakeDeinterleaveMasks(struct ShuffleMasks *m, unsigned c,
+                                  unsigned e) {
+    memset(m, 0, sizeof(*m));
+    m->nChannels = c;
+    for (unsigned k = 0; k < c; ++k) {
+        for (unsigned i = 0; i < c; ++i) {
+            for (unsigned t = 0; t < 16; ++t) {
+                unsigned g = ((t / e) * c + k) * e + t % e;
+                bool fromHere = g / 16 == i;
+                m->mask[k][i][t] = fromHere ? (uint8_t)(g % 16) : 0x80;
+                m->used[k][i] |= fromHere;
+            }
+        }
+    }
+}
+
+// Output vector i is the i-th of the block; input vector k is channel k.
+static void MakeInterleaveMasks(struct ShuffleMasks *m, unsigned c,
+                                unsigned e) {
+    memset(m, 0, sizeof(*m));
+    m->nChannels = c;
+    for (unsigned i = 0; i < c; ++i) {
+        for (unsigned k = 0; k < c; ++k) {
+            for (unsigned t = 0; t < 16; ++t) {
+                unsigned g = 16 * i + t;
+                unsigned frame = g / (c * e);
+                unsigned channel = g % (c * e) / e;
+                bool fromHere = channel == k;
+                m->mask[i][k][t] =
+                    fromHere ? (uint8_t)(frame * e + g % e) : 0x80;
+                m->used[i][k] |= fromHere;
+            }
+        }
+    }
+}
+
+OScInternal_TARGET_SSSE3 static void
+Deinterleave_SSSE3(const struct ShuffleMasks *m, const uint8_t *src,
+                   uint8_t *const *dst, size_t nBlocks) {
+    unsigned c = m->nChannels;
+    __m128i in[MAX_SHUFFLE_CHANNELS];
+    for (size_t blk = 0; blk < nBlocks; ++blk) {
+        for (unsigned i = 0; i < c; ++i)
+            in[i] = _mm_loadu_si128(
+                (const __m128i *)(src + (blk * c + i) * 16));
+        for (unsigned k = 0; k < c; ++k) {
+            __m128i out = _mm_setzero_si128();
+            for (unsigned i = 0; i < c; ++i) {
+                if (m->used[k][i])
+                    out = _mm_or_si128(
+                        out,
+                        _mm_shuffle_epi8(
+                            in[i],
+                            _mm_loadu_si128((const __m128i *)m->mask[k][i])));
+            }
+            _mm_storeu_si128((__m128i *)(dst[k] + blk * 16), out);
+        }
+    }
+}
+
+OScInternal_TARGET_SSSE3 static void
+Interleave_SSSE3(const struct ShuffleMasks *m, const uint8_t *const *src,
+                 uint8_t *dst, size_t nBlocks) {
+    unsigned c = m->nChannels;
+    __m128i in[MAX_SHUFFLE_CHANNELS];
+    for (size_t blk = 0; blk < nBlocks; ++blk) {
+        for (unsigned k = 0; k < c; ++k)
+            in[k] = _mm_loadu_si128((const __m128i *)(src[k] + blk * 16));
+        for (unsigned i = 0; i < c; ++i) {
+            __m128i out = _mm_setzero_si128();
+            for (unsigned k = 0; k < c; ++k) {
+                if (m->used[i][k])
+                    out = _mm_or_si128(
+                        out,
+                        _mm_shuffle_epi8(
+                            in[k],
+                            _mm_loadu_si128((const __m128i *)m->mask[i][k])));
+            }
+            _mm_storeu_si128((__m128i *)(dst + (blk * c + i) * 16), out);
+        }
+    }
+}
+
+OScInternal_TARGET_AVX2 static inline __m256i
+LoadMask_AVX2(const uint8_t *mask) {
+    return _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)mask));
+}
+
+// Returns the number of blocks processed (even)
+OScInternal_TARGET_AVX2 static size_t
+Deinterleave_AVX2(const struct ShuffleMasks *m, const uint8_t *src,
+                  uint8_t *const *dst, size_t nBlocks) {
+    unsigned c = m->nChannels;
+    size_t stride = (size_t)c * 16; // Bytes per block
+    __m256i in[MAX_SHUFFLE_CHANNELS];
+    size_t blk = 0;
+    for (; blk + 2 <= nBlocks; blk += 2) {
+        const uint8_t *s = src + blk * stride;
+        for (unsigned i = 0; i < c; ++i)
+            in[i] = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(
+                    _mm_loadu_si128((const __m128i *)(s + i * 16))),
+                _mm_loadu_si128((const __m128i *)(s + stride + i * 16)), 1);
+        for (unsigned k = 0; k < c; ++k) {
+            __m256i out = _mm256_setzero_si256();
+            for (unsigned i = 0; i < c; ++i) {
+                if (m->used[k][i])
+                    out = _mm256_or_si256(
+                        out, _mm256_shuffle_epi8(
+                                 in[i], LoadMask_AVX2(m->mask[k][i])));
+            }
+            _mm256_storeu_si256((__m256i *)(dst[k] + blk * 16), out);
+        }
+    }
+    return blk;
+}
+
+// Returns the number of blocks processed (even)
+OScInternal_TARGET_AVX2 static size_t
+Interleave_AVX2(const struct ShuffleMasks *m, const uint8_t *const *src,
+                uint8_t *dst, size_t nBlocks) {
+    unsigned c = m->nChannels;
+    size_t stride = (size_t)c * 16;
+    __m256i in[MAX_SHUFFLE_CHANNELS];
+    size_t blk = 0;
+    for (; blk + 2 <= nBlocks; blk += 2) {
+        for (unsigned k = 0; k < c; ++k)
+            in[k] = _mm256_loadu_si256((const __m256i *)(src[k] + blk * 16));
+        uint8_t *d = dst + blk * stride;
+        for (unsigned i = 0; i < c; ++i) {
+            __m256i out = _mm256_setzero_si256();
+            for (unsigned k = 0; k < c; ++k) {
+                if (m->used[i][k])
+                    out = _mm256_or_si256(
+                        out, _mm256_shuffle_epi8(
+                                 in[k], LoadMask_AVX2(m->mask[i][k])));
+            }
+            _mm_storeu_si128((__m128i *)(d + i * 16),
+                             _mm256_castsi256_si128(out));
+            _mm_storeu_si128((__m128i *)(d + stride + i * 16),
+                             _mm256_extracti128_si256(out, 1));
+        }
+    }
+    return blk;
+}
+
+#endif // OScInternal_X86
+
+// Bound by OScInternal_Interleave_BindKernels(); the SSE4.2 level implies
+// SSSE3
+static OSc_SIMDLevel g_level = OSc_SIMDLevel_Scalar;
+
+OSc_SIMDLevel OScInternal_Interleave_BindKernels(OSc_SIMDLevel level) {
+#ifdef OScInternal_X86
+    g_level = level < OSc_SIMDLevel_AVX2 ? level : OSc_SIMDLevel_AVX2;
+#else
+    (void)level;
+    g_level = OSc_SIMDLevel_Scalar;
+#endif
+    return g_level;
+}
+
+#ifdef OScInternal_X86
+
+static bool UseShuffleKernels(uint32_t nChannels) {
+    return (nChannels == 2 || nChannels == 3 || nChannels == 4 ||
+            nChannels == 8) &&
+           g_level >= OSc_SIMDLevel_SSE42;
+}
+
+static bool UseAVX2(void) { return g_level >= OSc_SIMDLevel_AVX2; }
+
+#endif // OScInternal_X86
+
+#define DEFINE_SCALAR_KERNELS(suffix, sampleType)                             \
+    static void Deinterleave##suffix(const sampleType *src,                  \
+                                     void *const *dst, uint32_t c,            \
+                                     size_t begin, size_t end) {              \
+        for (uint32_t k = 0; k < c; ++k) {                                    \
+            sampleType *d = dst[k];                                           \
+            for (size_t j = begin; j < end; ++j)                              \
+                d[j] = src[j * c + k];                                        \
+        }                                                                     \
+    }                                                                         \
+    static void Interleave##suffix(const void *const *src, sampleType *dst,  \
+                                   uint32_t c, size_t begin, size_t end) {    \
+        for (uint32_t k = 0; k < c; ++k) {                                    \
+            const sampleType *s = src[k];                                     \
+            for (size_t j = begin; j < end; ++j)                              \
+                dst[j * c + k] = s[j];                                        \
+        }                                                                     \
+    }
+
+DEFINE_SCALAR_KERNELS(8, uint8_t)
+DEFINE_SCALAR_KERNELS(16, uint16_t)
+DEFINE_SCALAR_KERNELS(32, uint32_t)
+
+static bool IsSupportedSampleSize(uint32_t bytesPerSample) {
+    return bytesPerSample == 1 || bytesPerSample == 2 || bytesPerSample == 4;
+}
+
+OSc_RichError *OScInternal_DeinterleaveChannels(const void *src,
+                                                void *const *dst,
+                                                uint32_t nChannels,
+                                                uint32_t bytesPerSample,
+                                                size_t samplesPerChannel) {
+    if (!src || !dst || nChannels == 0 ||
+        !IsSupportedSampleSize(bytesPerSample))
+        return OScInternal_Error_IllegalArgument();
+
+    size_t done = 0; // Samples per channel
+#ifdef OScInternal_X86
+    if (UseShuffleKernels(nChannels)) {
+        struct ShuffleMasks masks;
+        MakeDeinterleaveMasks(&masks, nChannels, bytesPerSample);
+        size_t samplesPerBlock = 16 / bytesPerSample;
+        size_t nBlocks = samplesPerChannel / samplesPerBlock;
+        size_t blk = 0;
+        if (UseAVX2())
+            blk = Deinterleave_AVX2(&masks, src, (uint8_t *const *)dst,
+                                    nBlocks);
+        if (blk < nBlocks) {
+            uint8_t *rest[MAX_SHUFFLE_CHANNELS];
+            for (uint32_t k = 0; k < nChannels; ++k)
+                rest[k] = (uint8_t *)dst[k] + blk * 16;
+            Deinterleave_SSSE3(&masks,
+                               (const uint8_t *)src + blk * 16 * nChannels,
+                               rest, nBlocks - blk);
+        }
+        done = nBlocks * samplesPerBlock;
+    }
+#endif
+
+    switch (bytesPerSample) {
+    case 1:
+        Deinterleave8(src, dst, nChannels, done, samplesPerChannel);
+        break;
+    case 2:
+        Deinterleave16(src, dst, nChannels, done, samplesPerChannel);
+        break;
+    case 4:
+        Deinterleave32(src, dst, nChannels, done, samplesPerChannel);
+        break;
+    }
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_InterleaveChannels(const void *const *src,
+                                              void *dst, uint32_t nChannels,
+                                              uint32_t bytesPerSample,
+                                              size_t samplesPerChannel) {
+    if (!src || !dst || nChannels == 0 ||
+        !IsSupportedSampleSize(bytesPerSample))
+        return OScInternal_Error_IllegalArgument();
+
+    size_t done = 0;
+#ifdef OScInternal_X86
+    if (UseShuffleKernels(nChannels)) {
+        struct ShuffleMasks masks;
+        MakeInterleaveMasks(&masks, nChannels, bytesPerSample);
+        size_t samplesPerBlock = 16 / bytesPerSample;
+        size_t nBlocks = samplesPerChannel / samplesPerBlock;
+        size_t blk = 0;
+        if (UseAVX2())
+            blk = Interleave_AVX2(&masks, (const uint8_t *const *)src, dst,
+                                  nBlocks);
+        if (blk < nBlocks) {
+            const uint8_t *rest[MAX_SHUFFLE_CHANNELS];
+            for (uint32_t k = 0; k < nChannels; ++k)
+                rest[k] = (const uint8_t *)src[k] + blk * 16;
+            Interleave_SSSE3(&masks, rest,
+                             (uint8_t *)dst + blk * 16 * nChannels,
+                             nBlocks - blk);
+        }
+        done = nBlocks * samplesPerBlock;
+    }
+#endif
+
+    switch (bytesPerSample) {
+    case 1:
+        Interleave8(src, dst, nChannels, done, samplesPerChannel);
+        break;
+    case 2:
+        Interleave16(src, dst, nChannels, done, samplesPerChannel);
+        break;
+    case 4:
+        Interleave32(src, dst, nChannels, done, samplesPerChannel);
+        break;
+    }
+    return OSc_OK;
+}
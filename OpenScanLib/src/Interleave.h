@@ -0,0 +1,27 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * Conversion between channel-interleaved sample buffers (c0 c1 c2 c0 c1 c2
+ * ...) and one planar buffer per channel. Exposed to device modules, which
+ * commonly receive interleaved data from DAQ hardware.
+ *
+ * 2, 3, 4, and 8 channels of 1-, 2-, or 4-byte samples use byte-shuffle
+ * kernels (SSSE3 or AVX2, selected at run time); other channel counts use a
+ * portable loop.
+ */
+
+OSc_RichError *OScInternal_DeinterleaveChannels(const void *src,
+                                                void *const *dst,
+                                                uint32_t nChannels,
+                                                uint32_t bytesPerSample,
+                                                size_t samplesPerChannel);
+
+OSc_RichError *OScInternal_InterleaveChannels(const void *const *src,
+                                              void *dst, uint32_t nChannels,
+                                              uint32_t bytesPerSample,
+                                              size_t samplesPerChannel);
+
+// Bind the kernels for 'level' and return the level bound (see Dispatch.h)
+OSc_SIMDLevel OScInternal_Interleave_BindKernels(OSc_SIMDLevel level);
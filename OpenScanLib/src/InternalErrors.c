@@ -54,11 +54,6 @@ OSc_RichError *OScInternal_Error_NoDetectorChannelEnabled() {
     return OScInternal_Error_Create("No channel in any detector enabled");
 }
 
-OSc_RichError *OScInternal_Error_NonUniformBytesPerSample() {
-    return OScInternal_Error_Create(
-        "Differing bytes-per-sample among enabled detector devices");
-}
-
 OSc_RichError *OScInternal_Error_DeviceModuleAlreadyExists() {
     return OScInternal_Error_Create("Device module already exists");
 }
@@ -70,3 +65,7 @@ OSc_RichError *OScInternal_Error_NoSuchDeviceModule() {
 OSc_RichError *OScInternal_Error_DeviceNotOpenedForLSM() {
     return OScInternal_Error_Create("Device not opened for LSM");
 }
+
+OSc_RichError *OScInternal_Error_DeviceNoLongerAvailable() {
+    return OScInternal_Error_Create("Device no longer available");
+}
@@ -28,10 +28,11 @@ OSc_RichError *OScInternal_Error_NoDetectorDeviceEnabled();
 
 OSc_RichError *OScInternal_Error_NoDetectorChannelEnabled();
 
-OSc_RichError *OScInternal_Error_NonUniformBytesPerSample();
 
 OSc_RichError *OScInternal_Error_DeviceModuleAlreadyExists();
 
 OSc_RichError *OScInternal_Error_NoSuchDeviceModule();
 
 OSc_RichError *OScInternal_Error_DeviceNotOpenedForLSM();
+
+OSc_RichError *OScInternal_Error_DeviceNoLongerAvailable();
@@ -0,0 +1,366 @@
+#include "Journal.h"
+#include "InternalErrors.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define JOURNAL_MAGIC "OScJrnl\n"
+#define JOURNAL_VERSION 1
+#define GROUP_MAGIC "OScG"
+
+struct FileHeader {
+    char magic[8]; // JOURNAL_MAGIC
+    uint32_t version;
+    uint32_t entrySize;
+};
+
+struct GroupHeader {
+    char magic[4]; // GROUP_MAGIC
+    uint32_t count;
+    uint64_t sequence; // 0 for the first group
+};
+
+// A group is its header, 'count' entries, and the checksum of both
+#define CHECKSUM_BYTES sizeof(uint64_t)
+
+struct OScInternal_Journal {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    int fd;
+#endif
+    char *path;
+    uint32_t entrySize;
+    uint64_t sequence;
+    char *group; // Assembled group
+    size_t groupCapacity;
+};
+
+static OSc_RichError *IOError(const char *operation, int code) {
+    char message[256];
+#ifdef _WIN32
+    snprintf(message, sizeof(message), "%s failed (Windows error %d)",
+             operation, code);
+#else
+    snprintf(message, sizeof(message), "%s failed: %s", operation,
+             strerror(code));
+#endif
+    return OScInternal_Error_Create(message);
+}
+
+// FNV-1a
+static uint64_t Checksum(const void *data, size_t size) {
+    const unsigned char *p = data;
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/*
+ * Platform-dependent file operations. Each returns 0 or an error code
+ * (errno or GetLastError()).
+ */
+
+#ifdef _WIN32
+
+static int OpenFile(OScInternal_Journal *j) {
+    j->handle = CreateFileA(j->path, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    return j->handle == INVALID_HANDLE_VALUE ? (int)GetLastError() : 0;
+}
+
+static int WriteAll(OScInternal_Journal *j, const void *data, size_t size) {
+    const char *p = data;
+    while (size > 0) {
+        DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+        DWORD written;
+        if (!WriteFile(j->handle, p, chunk, &written, NULL))
+            return (int)GetLastError();
+        p += written;
+        size -= written;
+    }
+    return 0;
+}
+
+static int SyncFile(OScInternal_Journal *j) {
+    return FlushFileBuffers(j->handle) ? 0 : (int)GetLastError();
+}
+
+// NTFS journals directory entries itself
+static int SyncDirectory(OScInternal_Journal *j) {
+    (void)j;
+    return 0;
+}
+
+static int CloseFile(OScInternal_Journal *j) {
+    return CloseHandle(j->handle) ? 0 : (int)GetLastError();
+}
+
+static int RemoveFile(OScInternal_Journal *j) {
+    return DeleteFileA(j->path) ? 0 : (int)GetLastError();
+}
+
+#else
+
+static int OpenFile(OScInternal_Journal *j) {
+    j->fd = open(j->path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+    return j->fd < 0 ? errno : 0;
+}
+
+static int WriteAll(OScInternal_Journal *j, const void *data, size_t size) {
+    const char *p = data;
+    while (size > 0) {
+        ssize_t written = write(j->fd, p, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        p += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+static int SyncFd(int fd) {
+#if defined(__APPLE__)
+    // fsync() does not flush the drive's cache on macOS
+    if (fcntl(fd, F_FULLFSYNC) == 0)
+        return 0;
+#elif defined(__linux__)
+    if (fdatasync(fd) == 0)
+        return 0;
+    if (errno != EINVAL)
+        return errno;
+#endif
+    return fsync(fd) == 0 ? 0 : errno;
+}
+
+static int SyncFile(OScInternal_Journal *j) { return SyncFd(j->fd); }
+
+static int SyncDirectory(OScInternal_Journal *j) {
+    const char *slash = strrchr(j->path, '/');
+    char *dir = slash ? malloc((size_t)(slash - j->path) + 2) : NULL;
+    if (slash && !dir)
+        return ENOMEM;
+    if (dir) {
+        size_t len = slash == j->path ? 1 : (size_t)(slash - j->path);
+        memcpy(dir, j->path, len);
+        dir[len] = '\0';
+    }
+    int fd = open(dir ? dir : ".", O_RDONLY);
+    free(dir);
+    if (fd < 0)
+        return errno;
+    // Some file systems cannot synchronize directories; nothing to be done
+    int code = SyncFd(fd);
+    close(fd);
+    return code == EINVAL || code == EBADF ? 0 : code;
+}
+
+static int CloseFile(OScInternal_Journal *j) {
+    return close(j->fd) == 0 ? 0 : errno;
+}
+
+static int RemoveFile(OScInternal_Journal *j) {
+    return unlink(j->path) == 0 ? 0 : errno;
+}
+
+#endif
+
+OSc_RichError *OScInternal_Journal_Create(OScInternal_Journal **journal,
+                                          const char *path,
+                                          uint32_t entrySize) {
+    if (entrySize == 0)
+        return OScInternal_Error_IllegalArgument();
+    OScInternal_Journal *j = calloc(1, sizeof(OScInternal_Journal));
+    if (!j)
+        return OScInternal_Error_OutOfMemory();
+    j->path = malloc(strlen(path) + 1);
+    if (!j->path) {
+        free(j);
+        return OScInternal_Error_OutOfMemory();
+    }
+    strcpy(j->path, path);
+    j->entrySize = entrySize;
+
+    int code = OpenFile(j);
+    if (code != 0) {
+        free(j->path);
+        free(j);
+        return IOError("Create journal", code);
+    }
+
+    struct FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.version = JOURNAL_VERSION;
+    header.entrySize = entrySize;
+    code = WriteAll(j, &header, sizeof(header));
+    if (code == 0)
+        code = SyncFile(j);
+    if (code == 0)
+        code = SyncDirectory(j);
+    if (code != 0) {
+        OScInternal_Journal_Close(j, true);
+        return IOError("Create journal", code);
+    }
+    *journal = j;
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_Journal_Commit(OScInternal_Journal *journal,
+                                          const void *entries, size_t count) {
+    if (count == 0)
+        return OSc_OK;
+    if (count > UINT32_MAX)
+        return OScInternal_Error_IllegalArgument();
+    size_t entryBytes = count * journal->entrySize;
+    size_t size = sizeof(struct GroupHeader) + entryBytes + CHECKSUM_BYTES;
+    if (journal->groupCapacity < size) {
+        char *group = realloc(journal->group, size);
+        if (!group)
+            return OScInternal_Error_OutOfMemory();
+        journal->group = group;
+        journal->groupCapacity = size;
+    }
+
+    // Assembled so that the group is appended with a single write
+    struct GroupHeader header;
+    memcpy(header.magic, GROUP_MAGIC, sizeof(header.magic));
+    header.count = (uint32_t)count;
+    header.sequence = journal->sequence;
+    memcpy(journal->group, &header, sizeof(header));
+    memcpy(journal->group + sizeof(header), entries, entryBytes);
+    uint64_t checksum =
+        Checksum(journal->group, sizeof(header) + entryBytes);
+    memcpy(journal->group + sizeof(header) + entryBytes, &checksum,
+           CHECKSUM_BYTES);
+
+    int code = WriteAll(journal, journal->group, size);
+    if (code == 0)
+        code = SyncFile(journal);
+    if (code != 0)
+        return IOError("Write journal", code);
+    ++journal->sequence;
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_Journal_Close(OScInternal_Journal *journal,
+                                         bool remove) {
+    if (!journal)
+        return OSc_OK;
+    int code = CloseFile(journal);
+    if (remove && code == 0)
+        code = RemoveFile(journal);
+    free(journal->group);
+    free(journal->path);
+    free(journal);
+    return code != 0 ? IOError("Close journal", code) : OSc_OK;
+}
+
+// Read a whole (small) file; '*data' is NULL if it does not exist
+static OSc_RichError *ReadFile(const char *path, char **data, size_t *size) {
+    *data = NULL;
+    *size = 0;
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return errno == ENOENT ? OSc_OK : IOError("Open journal", errno);
+    size_t capacity = 0;
+    for (;;) {
+        if (*size == capacity) {
+            capacity = capacity ? 2 * capacity : 65536;
+            char *p = realloc(*data, capacity);
+            if (!p) {
+                free(*data);
+                *data = NULL;
+                fclose(fp);
+                return OScInternal_Error_OutOfMemory();
+            }
+            *data = p;
+        }
+        size_t n = fread(*data + *size, 1, capacity - *size, fp);
+        *size += n;
+        if (n == 0)
+            break;
+    }
+    bool failed = ferror(fp) != 0;
+    fclose(fp);
+    if (failed) {
+        free(*data);
+        *data = NULL;
+        return IOError("Read journal", EIO);
+    }
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_Journal_Read(const char *path, uint32_t entrySize,
+                                        void **entries, size_t *count) {
+    *entries = NULL;
+    *count = 0;
+    char *data;
+    size_t size;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, ReadFile(path, &data, &size)))
+        return err;
+    if (!data)
+        return OScInternal_Error_Create("Recording journal not found");
+
+    struct FileHeader header;
+    if (size < sizeof(header)) {
+        free(data);
+        return OScInternal_Error_Create("Recording journal is damaged");
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != JOURNAL_VERSION || header.entrySize != entrySize) {
+        free(data);
+        return OScInternal_Error_Create(
+            "Recording journal has a wrong format");
+    }
+
+    // Entries are compacted in place, over the group headers
+    size_t pos = sizeof(header);
+    size_t entryBytes = 0;
+    for (uint64_t sequence = 0;; ++sequence) {
+        struct GroupHeader group;
+        if (size - pos < sizeof(group))
+            break;
+        memcpy(&group, data + pos, sizeof(group));
+        if (memcmp(group.magic, GROUP_MAGIC, sizeof(group.magic)) != 0 ||
+            group.sequence != sequence ||
+            group.count > (size - pos - sizeof(group)) / entrySize)
+            break;
+        size_t bytes = (size_t)group.count * entrySize;
+        if (size - pos - sizeof(group) < bytes + CHECKSUM_BYTES)
+            break;
+        uint64_t checksum;
+        memcpy(&checksum, data + pos + sizeof(group) + bytes,
+               CHECKSUM_BYTES);
+        if (checksum != Checksum(data + pos, sizeof(group) + bytes))
+            break;
+        memmove(data + entryBytes, data + pos + sizeof(group), bytes);
+        entryBytes += bytes;
+        pos += sizeof(group) + bytes + CHECKSUM_BYTES;
+    }
+
+    if (entryBytes == 0) {
+        free(data);
+        return OSc_OK;
+    }
+    *entries = data;
+    *count = entryBytes / entrySize;
+    return OSc_OK;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * Append-only journal of fixed-size entries, committed in groups, so that
+ * the index of a recording being written survives a crash.
+ *
+ * Each commit appends one group (a small header, the entries, and a
+ * checksum) and waits until it is durable with a single fdatasync()
+ * (FlushFileBuffers() on Windows), so that the cost of synchronization is
+ * shared by all the entries of the group. Reading returns the entries of
+ * every complete group in order; a group torn by a crash is detected by its
+ * checksum and ignored, together with anything after it.
+ *
+ * The file starts with "OScJrnl\n", a format version (1), and the entry
+ * size (32-bit), in the byte order of the writing machine.
+ */
+
+typedef struct OScInternal_Journal OScInternal_Journal;
+
+// Create (or truncate) the journal 'path'. Its directory is synchronized, so
+// that the journal itself is not lost in a crash.
+OSc_RichError *OScInternal_Journal_Create(OScInternal_Journal **journal,
+                                          const char *path,
+                                          uint32_t entrySize);
+
+// Append 'count' entries as one group and wait until they are durable
+OSc_RichError *OScInternal_Journal_Commit(OScInternal_Journal *journal,
+                                          const void *entries, size_t count);
+
+// Close the journal, deleting the file if 'remove' (for example, once the
+// data it protects has been completed). The journal is destroyed even if an
+// error is returned.
+OSc_RichError *OScInternal_Journal_Close(OScInternal_Journal *journal,
+                                         bool remove);
+
+// Read the committed entries of the journal 'path' (whose entries must be
+// of 'entrySize'). '*entries' receives an array to be freed with free(), or
+// NULL if there are none.
+OSc_RichError *OScInternal_Journal_Read(const char *path, uint32_t entrySize,
+                                        void **entries, size_t *count);
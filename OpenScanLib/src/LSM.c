@@ -1,3 +1,4 @@
+#include "Dispatch.h"
 #include "InternalErrors.h"
 #include "OpenScanLibPrivate.h"
 
@@ -15,6 +16,8 @@ struct OScInternal_LSM {
 };
 
 OSc_RichError *OSc_LSM_Create(OSc_LSM **lsm) {
+    OScInternal_Dispatch_Init();
+
     *lsm = calloc(1, sizeof(OSc_LSM));
     (*lsm)->detectorDevices = OScInternal_PtrArray_Create();
     (*lsm)->associatedDevices = OScInternal_PtrArray_Create();
@@ -1,11 +1,22 @@
 #include "Module.h"
 #include "InternalErrors.h"
+#include "Threads.h"
 
 #include <ss8str.h>
 
+#ifndef _WIN32
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#endif
+
 /*
  * This file contains platform-dependent utility functions for finding and
- * loading modules (DLLs).
+ * loading modules (DLLs, or shared objects on other platforms).
  */
 
 // Free a file list returned by OScInternal_FileList_Create()
@@ -17,12 +28,12 @@ void OScInternal_FileList_Free(ss8str *files) {
     free(files);
 }
 
+#ifdef _WIN32
+
 // Finds all files under 'path' that have 'suffix'.
 // Allocates array and element strings and places into 'files'.
 OSc_RichError *OScInternal_FileList_Create(ss8str **files, const char *path,
                                            const char *suffix) {
-    // Windows implementation for now
-
     DWORD err;
 
     size_t fileCount = 0;
@@ -80,6 +91,10 @@ OSc_RichError *OScInternal_Module_Load(OScInternal_Module *module,
     return OSc_OK;
 }
 
+void OScInternal_Module_Unload(OScInternal_Module module) {
+    FreeLibrary(module);
+}
+
 OSc_RichError *OScInternal_Module_GetEntryPoint(OScInternal_Module module,
                                                 const char *funcName,
                                                 void **func) {
@@ -89,6 +104,150 @@ OSc_RichError *OScInternal_Module_GetEntryPoint(OScInternal_Module module,
     return OSc_OK;
 }
 
+OSc_RichError *OScInternal_File_GetInfo(const char *path, uint64_t *size,
+                                        int64_t *mtime) {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data))
+        return OScInternal_Error_Create("Cannot get file information");
+    *size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    *mtime = (int64_t)(((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) |
+                       data.ftLastWriteTime.dwLowDateTime);
+    return OSc_OK;
+}
+
+#else
+
+static int CompareFileNames(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Finds all files under 'path' that have 'suffix', in name order (readdir()
+// order is arbitrary).
+// Allocates array and element strings and places into 'files'.
+OSc_RichError *OScInternal_FileList_Create(ss8str **files, const char *path,
+                                           const char *suffix) {
+    *files = NULL;
+    DIR *dir = opendir(path);
+    if (!dir) {
+        if (errno != ENOENT)
+            return OScInternal_Error_Create("Failed to list files");
+        *files = malloc(sizeof(ss8str));
+        ss8_init(&(*files)[0]); // Sentinel
+        return OSc_OK;
+    }
+
+    size_t fileCount = 0;
+    size_t fileCap = 16;
+    char **names = malloc(sizeof(char *) * fileCap);
+    size_t suffixLen = strlen(suffix);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len <= suffixLen ||
+            strcmp(entry->d_name + len - suffixLen, suffix) != 0)
+            continue;
+        if (fileCount == fileCap)
+            names = realloc(names, sizeof(char *) * (fileCap *= 2));
+        names[fileCount] = malloc(len + 1);
+        memcpy(names[fileCount++], entry->d_name, len + 1);
+    }
+    closedir(dir);
+
+    qsort(names, fileCount, sizeof(char *), CompareFileNames);
+    *files = malloc(sizeof(ss8str) * (fileCount + 1));
+    for (size_t i = 0; i < fileCount; ++i) {
+        ss8_init_copy_cstr(&(*files)[i], names[i]);
+        free(names[i]);
+    }
+    ss8_init(&(*files)[fileCount]); // Sentinel
+    free(names);
+    return OSc_OK;
+}
+
+// Symbols are resolved at load time, so that a module with missing
+// dependencies fails here rather than when first called
+OSc_RichError *OScInternal_Module_Load(OScInternal_Module *module,
+                                       const char *path) {
+    *module = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (*module == NULL) {
+        char msg[1024];
+        snprintf(msg, sizeof(msg), "Cannot load module: %s", dlerror());
+        return OScInternal_Error_Create(msg);
+    }
+    return OSc_OK;
+}
+
+void OScInternal_Module_Unload(OScInternal_Module module) { dlclose(module); }
+
+OSc_RichError *OScInternal_Module_GetEntryPoint(OScInternal_Module module,
+                                                const char *funcName,
+                                                void **func) {
+    *func = dlsym(module, funcName);
+    if (!*func) {
+        char msg[1024];
+        snprintf(msg, sizeof(msg), "Module has no %s function", funcName);
+        return OScInternal_Error_Create(msg);
+    }
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_File_GetInfo(const char *path, uint64_t *size,
+                                        int64_t *mtime) {
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return OScInternal_Error_Create("Cannot get file information");
+    *size = (uint64_t)st.st_size;
+    *mtime = (int64_t)st.st_mtime;
+    return OSc_OK;
+}
+
+#endif
+
 bool OScInternal_Module_SupportsRichErrors(OScDev_ModuleImpl *modImpl) {
     return modImpl->supportsRichErrors;
 }
+
+// Device module ABI version reported by the entry point of each loaded
+// module, by module implementation (a module reloaded at the same address
+// replaces its entry)
+struct ModuleVersion {
+    OScDev_ModuleImpl *modImpl;
+    uint32_t version;
+};
+static OScInternal_Mutex g_versionsMutex = OScInternal_MUTEX_INITIALIZER;
+static struct ModuleVersion *g_versions;
+static size_t g_versionCount;
+
+void OScInternal_Module_SetABIVersion(OScDev_ModuleImpl *modImpl,
+                                      uint32_t version) {
+    OScInternal_Mutex_Lock(&g_versionsMutex);
+    size_t i = 0;
+    while (i < g_versionCount && g_versions[i].modImpl != modImpl)
+        ++i;
+    if (i == g_versionCount) {
+        struct ModuleVersion *versions = realloc(
+            g_versions, sizeof(struct ModuleVersion) * (g_versionCount + 1));
+        if (versions) {
+            g_versions = versions;
+            g_versions[g_versionCount++].modImpl = modImpl;
+        }
+    }
+    if (i < g_versionCount)
+        g_versions[i].version = version;
+    OScInternal_Mutex_Unlock(&g_versionsMutex);
+}
+
+uint16_t OScInternal_Module_GetABIMinorVersion(OScDev_ModuleImpl *modImpl) {
+    // Implementations inside OpenScanLib (such as the module host's proxies)
+    // are not registered and are always current
+    uint32_t version = OScDevInternal_ABI_VERSION;
+    OScInternal_Mutex_Lock(&g_versionsMutex);
+    for (size_t i = 0; i < g_versionCount; ++i) {
+        if (g_versions[i].modImpl == modImpl) {
+            version = g_versions[i].version;
+            break;
+        }
+    }
+    OScInternal_Mutex_Unlock(&g_versionsMutex);
+    return version & 0xffff;
+}
@@ -4,13 +4,13 @@
 
 #include <ss8str.h>
 
-#ifndef _WIN32
-#error Only Windows version implemented at this time.
-#endif
-
+#ifdef _WIN32
 #include <Windows.h>
 
 typedef HMODULE OScInternal_Module;
+#else
+typedef void *OScInternal_Module; // dlopen() handle
+#endif
 
 void OScInternal_FileList_Free(ss8str *files);
 
@@ -20,6 +20,14 @@ OSc_RichError *OScInternal_FileList_Create(ss8str **files, const char *path,
 OSc_RichError *OScInternal_Module_Load(OScInternal_Module *module,
                                        const char *path);
 
+// No function or data of the module may be in use
+void OScInternal_Module_Unload(OScInternal_Module module);
+
 OSc_RichError *OScInternal_Module_GetEntryPoint(OScInternal_Module module,
                                                 const char *funcName,
                                                 void **func);
+
+// Size and modification time (in platform-dependent units) of the file at
+// 'path', to tell whether it has changed
+OSc_RichError *OScInternal_File_GetInfo(const char *path, uint64_t *size,
+                                        int64_t *mtime);
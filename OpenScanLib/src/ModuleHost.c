@@ -0,0 +1,2631 @@
+#include "ModuleHost.h"
+#include "DeviceInterface.h"
+#include "InternalErrors.h"
+#include "SampleFormat.h"
+#include "Threads.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0 // SO_NOSIGPIPE is set instead
+#endif
+#endif
+
+#define NO_HANDLE ((intptr_t)-1)
+
+// Messages larger than this are taken to be corrupt
+#define MAX_MESSAGE_BYTES (16 * 1024 * 1024)
+
+// Pool slots are at least this large, and frames larger than the slots make
+// the host reorganize the pool
+#define MIN_SLOT_BYTES (64 * 1024)
+
+// Time to wait for the host process to exit after disconnecting
+#define EXIT_TIMEOUT_SECONDS 5.0
+
+// Proxy device implementations available in the application
+#define MAX_PROXY_IMPLS 32
+
+// Requests on the control channel (application to host)
+enum {
+    OP_HELLO = 1,
+    OP_ENUMERATE_INSTANCES,
+
+    // Device requests, which start with the device
+    OP_FIRST_DEVICE_OP,
+    OP_RELEASE_INSTANCE = OP_FIRST_DEVICE_OP,
+    OP_GET_NAME,
+    OP_OPEN,
+    OP_CLOSE,
+    OP_HAS_CLOCK,
+    OP_HAS_SCANNER,
+    OP_HAS_DETECTOR,
+    OP_MAKE_SETTINGS,
+    OP_GET_PIXEL_RATES,
+    OP_GET_ACTUAL_PIXEL_RATE,
+    OP_GET_RESOLUTIONS,
+    OP_GET_ZOOM_FACTORS,
+    OP_IS_ROI_SCAN_SUPPORTED,
+    OP_GET_RASTER_WIDTHS,
+    OP_GET_RASTER_HEIGHTS,
+    OP_GET_NUMBER_OF_CHANNELS,
+    OP_GET_BYTES_PER_SAMPLE,
+    OP_GET_SAMPLE_FORMAT,
+    OP_ARM,
+    OP_START,
+    OP_STOP,
+
+    // Setting requests, which start with the setting
+    OP_FIRST_SETTING_OP,
+    OP_SETTING_IS_ENABLED = OP_FIRST_SETTING_OP,
+    OP_SETTING_IS_WRITABLE,
+    OP_SETTING_GET_NUMERIC_CONSTRAINT_TYPE,
+    OP_SETTING_GET_STRING,
+    OP_SETTING_SET_STRING,
+    OP_SETTING_GET_BOOL,
+    OP_SETTING_SET_BOOL,
+    OP_SETTING_GET_INT32,
+    OP_SETTING_SET_INT32,
+    OP_SETTING_GET_INT32_RANGE,
+    OP_SETTING_GET_INT32_DISCRETE_VALUES,
+    OP_SETTING_GET_FLOAT64,
+    OP_SETTING_SET_FLOAT64,
+    OP_SETTING_GET_FLOAT64_RANGE,
+    OP_SETTING_GET_FLOAT64_DISCRETE_VALUES,
+    OP_SETTING_GET_ENUM,
+    OP_SETTING_SET_ENUM,
+    OP_SETTING_GET_ENUM_NUM_VALUES,
+    OP_SETTING_GET_ENUM_NAME_FOR_VALUE,
+    OP_SETTING_GET_ENUM_VALUE_FOR_NAME,
+};
+
+// Messages on the event channel
+enum {
+    EVENT_FRAME = 1,  // Host: device, channel, slot, offset, bytes
+    EVENT_TIME_TAGS,  // Host: device, slot, offset, count
+    EVENT_LOG,        // Host: device, level, message
+    EVENT_IDLE,       // Host: device (whose acquisition has finished)
+    EVENT_RELEASE,    // Application: slot, device, continue
+};
+
+// Status at the start of each reply; an error is followed by its message
+enum {
+    STATUS_OK,
+    STATUS_ERROR,
+};
+
+/*
+ * Messages: a 32-bit length followed by that many bytes, starting with the
+ * request, event, or status code. Both processes are on one machine, so
+ * values are in native byte order.
+ */
+
+struct Buffer {
+    char *data;
+    size_t size;
+    size_t capacity;
+    size_t pos;   // Read position
+    bool overrun; // Read past the end
+};
+
+static void Buffer_Init(struct Buffer *b) { memset(b, 0, sizeof(*b)); }
+
+static void Buffer_Free(struct Buffer *b) {
+    free(b->data);
+    Buffer_Init(b);
+}
+
+static void Put(struct Buffer *b, const void *p, size_t n) {
+    if (b->size + n > b->capacity) {
+        size_t capacity = b->capacity ? 2 * b->capacity : 256;
+        while (capacity < b->size + n)
+            capacity *= 2;
+        b->data = realloc(b->data, capacity);
+        b->capacity = capacity;
+    }
+    memcpy(b->data + b->size, p, n);
+    b->size += n;
+}
+
+static void PutU32(struct Buffer *b, uint32_t v) { Put(b, &v, sizeof(v)); }
+
+static void PutI32(struct Buffer *b, int32_t v) { Put(b, &v, sizeof(v)); }
+
+static void PutU64(struct Buffer *b, uint64_t v) { Put(b, &v, sizeof(v)); }
+
+static void PutF64(struct Buffer *b, double v) { Put(b, &v, sizeof(v)); }
+
+static void PutString(struct Buffer *b, const char *s) {
+    uint32_t len = (uint32_t)strlen(s);
+    PutU32(b, len);
+    Put(b, s, len);
+}
+
+static void Get(struct Buffer *b, void *p, size_t n) {
+    if (b->overrun || b->size - b->pos < n) {
+        b->overrun = true;
+        memset(p, 0, n);
+        return;
+    }
+    memcpy(p, b->data + b->pos, n);
+    b->pos += n;
+}
+
+static uint32_t GetU32(struct Buffer *b) {
+    uint32_t v;
+    Get(b, &v, sizeof(v));
+    return v;
+}
+
+static int32_t GetI32(struct Buffer *b) {
+    int32_t v;
+    Get(b, &v, sizeof(v));
+    return v;
+}
+
+static uint64_t GetU64(struct Buffer *b) {
+    uint64_t v;
+    Get(b, &v, sizeof(v));
+    return v;
+}
+
+static double GetF64(struct Buffer *b) {
+    double v;
+    Get(b, &v, sizeof(v));
+    return v;
+}
+
+// Read a string into 'out' (of 'outSize' bytes), truncating if necessary
+static void GetString(struct Buffer *b, char *out, size_t outSize) {
+    uint32_t len = GetU32(b);
+    if (b->overrun || b->size - b->pos < len) {
+        b->overrun = true;
+        out[0] = '\0';
+        return;
+    }
+    size_t n = len < outSize - 1 ? len : outSize - 1;
+    memcpy(out, b->data + b->pos, n);
+    out[n] = '\0';
+    b->pos += len;
+}
+
+static void BeginMessage(struct Buffer *b, uint32_t code) {
+    Buffer_Init(b);
+    PutU32(b, 0); // Length, set when sent
+    PutU32(b, code);
+}
+
+// Ranges are sent as a flag, then the discrete values or the bounds
+static void PutRange(struct Buffer *b, const OScInternal_NumRange *range) {
+    if (OScInternal_NumRange_IsDiscrete(range)) {
+        OScInternal_NumArray *values =
+            OScInternal_NumRange_DiscreteValues(range);
+        size_t count = OScInternal_NumArray_Size(values);
+        PutU32(b, 1);
+        PutU32(b, (uint32_t)count);
+        for (size_t i = 0; i < count; ++i)
+            PutF64(b, OScInternal_NumArray_At(values, i));
+        OScInternal_NumArray_Destroy(values);
+    } else {
+        PutU32(b, 0);
+        PutF64(b, OScInternal_NumRange_Min(range));
+        PutF64(b, OScInternal_NumRange_Max(range));
+    }
+}
+
+static OScInternal_NumRange *GetRange(struct Buffer *b) {
+    if (GetU32(b)) {
+        OScInternal_NumRange *range = OScInternal_NumRange_CreateDiscrete();
+        uint32_t count = GetU32(b);
+        for (uint32_t i = 0; i < count && !b->overrun; ++i)
+            OScInternal_NumRange_AppendDiscrete(range, GetF64(b));
+        return range;
+    }
+    double min = GetF64(b);
+    double max = GetF64(b);
+    return OScInternal_NumRange_CreateContinuous(min, max);
+}
+
+static OSc_RichError *IOError(const char *operation, int code) {
+    char message[256];
+#ifdef _WIN32
+    snprintf(message, sizeof(message), "%s failed (Windows error %d)",
+             operation, code);
+#else
+    snprintf(message, sizeof(message), "%s failed: %s", operation,
+             strerror(code));
+#endif
+    return OScInternal_Error_Create(message);
+}
+
+/*
+ * Platform-dependent channels, shared memory, and processes. Functions
+ * returning int return 0 or an error code (errno or GetLastError()).
+ */
+
+#ifdef _WIN32
+
+static bool ReadAll(intptr_t handle, void *buffer, size_t size) {
+    char *p = buffer;
+    while (size > 0) {
+        DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+        DWORD read;
+        if (!ReadFile((HANDLE)handle, p, chunk, &read, NULL) || read == 0)
+            return false;
+        p += read;
+        size -= read;
+    }
+    return true;
+}
+
+static bool WriteAll(intptr_t handle, const void *buffer, size_t size) {
+    const char *p = buffer;
+    while (size > 0) {
+        DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+        DWORD written;
+        if (!WriteFile((HANDLE)handle, p, chunk, &written, NULL))
+            return false;
+        p += written;
+        size -= written;
+    }
+    return true;
+}
+
+static void CloseChannelHandle(intptr_t handle) {
+    if (handle != NO_HANDLE)
+        CloseHandle((HANDLE)handle);
+}
+
+// Stop writing to a channel, so that the other side reads end-of-file
+static void ShutdownOutput(intptr_t *out, intptr_t in) {
+    (void)in;
+    CloseChannelHandle(*out);
+    *out = NO_HANDLE;
+}
+
+// Each channel is a pair of anonymous pipes
+static int CreateChannel(intptr_t *appIn, intptr_t *appOut, intptr_t *hostIn,
+                         intptr_t *hostOut) {
+    HANDLE toHostRead, toHostWrite, toAppRead, toAppWrite;
+    if (!CreatePipe(&toHostRead, &toHostWrite, NULL, 0))
+        return (int)GetLastError();
+    if (!CreatePipe(&toAppRead, &toAppWrite, NULL, 0)) {
+        int code = (int)GetLastError();
+        CloseHandle(toHostRead);
+        CloseHandle(toHostWrite);
+        return code;
+    }
+    *appIn = (intptr_t)toAppRead;
+    *appOut = (intptr_t)toHostWrite;
+    *hostIn = (intptr_t)toHostRead;
+    *hostOut = (intptr_t)toAppWrite;
+    return 0;
+}
+
+static int CreatePool(intptr_t *appPool, intptr_t *hostPool, uint64_t size) {
+    HANDLE mapping =
+        CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                           (DWORD)(size >> 32), (DWORD)size, NULL);
+    if (!mapping)
+        return (int)GetLastError();
+    HANDLE duplicate;
+    if (!DuplicateHandle(GetCurrentProcess(), mapping, GetCurrentProcess(),
+                         &duplicate, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+        int code = (int)GetLastError();
+        CloseHandle(mapping);
+        return code;
+    }
+    *appPool = (intptr_t)mapping;
+    *hostPool = (intptr_t)duplicate;
+    return 0;
+}
+
+static int MapPool(intptr_t pool, uint64_t size, char **base) {
+    *base = MapViewOfFile((HANDLE)pool, FILE_MAP_WRITE, 0, 0, (SIZE_T)size);
+    if (!*base)
+        return (int)GetLastError();
+    return 0;
+}
+
+static void UnmapPool(char *base, uint64_t size) {
+    (void)size;
+    if (base)
+        UnmapViewOfFile(base);
+}
+
+static void AppendQuoted(char *commandLine, size_t size, const char *arg) {
+    strncat(commandLine, "\"", size - strlen(commandLine) - 1);
+    strncat(commandLine, arg, size - strlen(commandLine) - 1);
+    strncat(commandLine, "\" ", size - strlen(commandLine) - 1);
+}
+
+static int StartProcess(intptr_t *process, const char *hostPath,
+                        const char *modulePath, char args[][24],
+                        size_t numberOfArgs,
+                        const struct OScInternal_ModuleHostEndpoints *ends) {
+    char commandLine[4096] = "";
+    AppendQuoted(commandLine, sizeof(commandLine), hostPath);
+    AppendQuoted(commandLine, sizeof(commandLine), modulePath);
+    for (size_t i = 0; i < numberOfArgs; ++i) {
+        strncat(commandLine, args[i],
+                sizeof(commandLine) - strlen(commandLine) - 1);
+        strncat(commandLine, " ",
+                sizeof(commandLine) - strlen(commandLine) - 1);
+    }
+
+    // Only the host's handles are made inheritable
+    intptr_t handles[] = {ends->controlIn, ends->controlOut, ends->eventsIn,
+                          ends->eventsOut, ends->pool};
+    for (size_t i = 0; i < sizeof(handles) / sizeof(handles[0]); ++i) {
+        if (!SetHandleInformation((HANDLE)handles[i], HANDLE_FLAG_INHERIT,
+                                  HANDLE_FLAG_INHERIT))
+            return (int)GetLastError();
+    }
+
+    STARTUPINFOA startup;
+    memset(&startup, 0, sizeof(startup));
+    startup.cb = sizeof(startup);
+    PROCESS_INFORMATION info;
+    if (!CreateProcessA(hostPath, commandLine, NULL, NULL, TRUE,
+                        CREATE_NO_WINDOW, NULL, NULL, &startup, &info))
+        return (int)GetLastError();
+    CloseHandle(info.hThread);
+    *process = (intptr_t)info.hProcess;
+    return 0;
+}
+
+// Wait for the process to exit, killing it after 'timeout' seconds
+static void WaitForProcess(intptr_t process, double timeout) {
+    HANDLE h = (HANDLE)process;
+    if (WaitForSingleObject(h, (DWORD)(timeout * 1000)) != WAIT_OBJECT_0) {
+        TerminateProcess(h, 1);
+        WaitForSingleObject(h, INFINITE);
+    }
+    CloseHandle(h);
+}
+
+#else
+
+static bool ReadAll(intptr_t handle, void *buffer, size_t size) {
+    char *p = buffer;
+    while (size > 0) {
+        ssize_t n = recv((int)handle, p, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool WriteAll(intptr_t handle, const void *buffer, size_t size) {
+    const char *p = buffer;
+    while (size > 0) {
+        ssize_t n = send((int)handle, p, size, SEND_FLAGS);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static void CloseChannelHandle(intptr_t handle) {
+    if (handle != NO_HANDLE)
+        close((int)handle);
+}
+
+// Stop writing to a channel, so that the other side reads end-of-file
+static void ShutdownOutput(intptr_t *out, intptr_t in) {
+    if (*out == in) {
+        shutdown((int)*out, SHUT_WR);
+    } else {
+        CloseChannelHandle(*out);
+        *out = NO_HANDLE;
+    }
+}
+
+static int CreateChannel(intptr_t *appIn, intptr_t *appOut, intptr_t *hostIn,
+                         intptr_t *hostOut) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        return errno;
+    for (int i = 0; i < 2; ++i) {
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt(fds[i], SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    }
+    *appIn = *appOut = fds[0];
+    *hostIn = *hostOut = fds[1];
+    return 0;
+}
+
+// The pool's name is removed as soon as it is created; it is shared only by
+// inheriting the descriptor
+static int CreatePool(intptr_t *appPool, intptr_t *hostPool, uint64_t size) {
+    static volatile int32_t counter;
+    char name[64];
+    snprintf(name, sizeof(name), "/OpenScanDeviceHost-%ld-%d",
+             (long)getpid(), (int)OScInternal_Atomic_Increment(&counter));
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return errno;
+    shm_unlink(name);
+    if (ftruncate(fd, (off_t)size) != 0) {
+        int code = errno;
+        close(fd);
+        return code;
+    }
+    int duplicate = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (duplicate < 0) {
+        int code = errno;
+        close(fd);
+        return code;
+    }
+    *appPool = fd;
+    *hostPool = duplicate;
+    return 0;
+}
+
+static int MapPool(intptr_t pool, uint64_t size, char **base) {
+    void *addr = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      (int)pool, 0);
+    if (addr == MAP_FAILED) {
+        *base = NULL;
+        return errno;
+    }
+    *base = addr;
+    return 0;
+}
+
+static void UnmapPool(char *base, uint64_t size) {
+    if (base)
+        munmap(base, (size_t)size);
+}
+
+static int StartProcess(intptr_t *process, const char *hostPath,
+                        const char *modulePath, char args[][24],
+                        size_t numberOfArgs,
+                        const struct OScInternal_ModuleHostEndpoints *ends) {
+    char *argv[16];
+    size_t argc = 0;
+    argv[argc++] = (char *)hostPath;
+    argv[argc++] = (char *)modulePath;
+    for (size_t i = 0; i < numberOfArgs; ++i)
+        argv[argc++] = args[i];
+    argv[argc] = NULL;
+
+    pid_t pid = fork();
+    if (pid < 0)
+        return errno;
+    if (pid == 0) {
+        // Only the host's descriptors survive exec
+        fcntl((int)ends->controlIn, F_SETFD, 0);
+        fcntl((int)ends->eventsIn, F_SETFD, 0);
+        fcntl((int)ends->pool, F_SETFD, 0);
+        execv(hostPath, argv);
+        _exit(127);
+    }
+    *process = pid;
+    return 0;
+}
+
+// Wait for the process to exit, killing it after 'timeout' seconds
+static void WaitForProcess(intptr_t process, double timeout) {
+    double deadline = OScInternal_GetMonotonicTime() + timeout;
+    while (waitpid((pid_t)process, NULL, WNOHANG) == 0) {
+        if (OScInternal_GetMonotonicTime() >= deadline) {
+            kill((pid_t)process, SIGKILL);
+            waitpid((pid_t)process, NULL, 0);
+            return;
+        }
+        struct timespec interval = {0, 10 * 1000 * 1000};
+        nanosleep(&interval, NULL);
+    }
+}
+
+#endif
+
+static bool SendMessage(intptr_t handle, struct Buffer *message) {
+    uint32_t length = (uint32_t)(message->size - sizeof(uint32_t));
+    memcpy(message->data, &length, sizeof(length));
+    return WriteAll(handle, message->data, message->size);
+}
+
+// Receive a message into 'message' (initialized here), positioned at its
+// code; false at end-of-file or on error
+static bool ReceiveMessage(intptr_t handle, struct Buffer *message) {
+    Buffer_Init(message);
+    uint32_t length;
+    if (!ReadAll(handle, &length, sizeof(length)) || length < 4 ||
+        length > MAX_MESSAGE_BYTES)
+        return false;
+    message->data = malloc(length);
+    message->size = message->capacity = length;
+    if (!message->data || !ReadAll(handle, message->data, length)) {
+        Buffer_Free(message);
+        return false;
+    }
+    return true;
+}
+
+static void InitEndpoints(struct OScInternal_ModuleHostEndpoints *ends) {
+    ends->controlIn = ends->controlOut = NO_HANDLE;
+    ends->eventsIn = ends->eventsOut = NO_HANDLE;
+    ends->pool = NO_HANDLE;
+    ends->poolBytes = 0;
+}
+
+void OScInternal_ModuleHost_CloseEndpoints(
+    struct OScInternal_ModuleHostEndpoints *ends) {
+    if (ends->controlOut != ends->controlIn)
+        CloseChannelHandle(ends->controlOut);
+    CloseChannelHandle(ends->controlIn);
+    if (ends->eventsOut != ends->eventsIn)
+        CloseChannelHandle(ends->eventsOut);
+    CloseChannelHandle(ends->eventsIn);
+    CloseChannelHandle(ends->pool);
+    InitEndpoints(ends);
+}
+
+OSc_RichError *OScInternal_ModuleHost_CreateEndpoints(
+    struct OScInternal_ModuleHostEndpoints *application,
+    struct OScInternal_ModuleHostEndpoints *host, uint64_t poolBytes) {
+    InitEndpoints(application);
+    InitEndpoints(host);
+    if (poolBytes == 0)
+        return OScInternal_Error_IllegalArgument();
+
+    int code = CreateChannel(&application->controlIn,
+                             &application->controlOut, &host->controlIn,
+                             &host->controlOut);
+    if (code == 0)
+        code = CreateChannel(&application->eventsIn, &application->eventsOut,
+                             &host->eventsIn, &host->eventsOut);
+    if (code == 0)
+        code = CreatePool(&application->pool, &host->pool, poolBytes);
+    if (code != 0) {
+        OScInternal_ModuleHost_CloseEndpoints(application);
+        OScInternal_ModuleHost_CloseEndpoints(host);
+        return IOError("Creating device module host channels", code);
+    }
+    application->poolBytes = host->poolBytes = poolBytes;
+    return OSc_OK;
+}
+
+// The handles, then the pool size, in decimal
+#define NUMBER_OF_ARGUMENTS 6
+
+static void
+FormatArguments(char args[][24],
+                const struct OScInternal_ModuleHostEndpoints *ends) {
+    snprintf(args[0], 24, "%" PRIdPTR, ends->controlIn);
+    snprintf(args[1], 24, "%" PRIdPTR, ends->controlOut);
+    snprintf(args[2], 24, "%" PRIdPTR, ends->eventsIn);
+    snprintf(args[3], 24, "%" PRIdPTR, ends->eventsOut);
+    snprintf(args[4], 24, "%" PRIdPTR, ends->pool);
+    snprintf(args[5], 24, "%" PRIu64, ends->poolBytes);
+}
+
+static bool ParseInteger(const char *arg, long long *value) {
+    char *end;
+    errno = 0;
+    *value = strtoll(arg, &end, 10);
+    return errno == 0 && end != arg && *end == '\0';
+}
+
+bool OScInternal_ModuleHost_ParseArguments(
+    int argc, char **argv, const char **modulePath,
+    struct OScInternal_ModuleHostEndpoints *ends) {
+    if (argc != 2 + NUMBER_OF_ARGUMENTS)
+        return false;
+    long long values[NUMBER_OF_ARGUMENTS];
+    for (int i = 0; i < NUMBER_OF_ARGUMENTS; ++i) {
+        if (!ParseInteger(argv[2 + i], &values[i]))
+            return false;
+    }
+    if (values[5] <= 0)
+        return false;
+    *modulePath = argv[1];
+    ends->controlIn = (intptr_t)values[0];
+    ends->controlOut = (intptr_t)values[1];
+    ends->eventsIn = (intptr_t)values[2];
+    ends->eventsOut = (intptr_t)values[3];
+    ends->pool = (intptr_t)values[4];
+    ends->poolBytes = (uint64_t)values[5];
+    return true;
+}
+
+/*
+ * Application side: proxy device and setting implementations.
+ */
+
+struct ProxyImpl {
+    OScDev_DeviceImpl impl;
+    OScInternal_ModuleHost *host;
+    uint32_t index; // In the host
+    size_t slot;    // In g_proxyImplSlots
+    char modelName[OScDev_MAX_STR_SIZE];
+};
+
+struct ProxyDevice {
+    OScInternal_ModuleHost *host;
+    uint64_t id; // In the host
+    OSc_Device *device;
+
+    // Guarded by the host's mutex
+    OScDev_Acquisition *acq; // While armed
+    bool armed; // Until the host reports the acquisition finished
+};
+
+struct ProxySetting {
+    OScInternal_ModuleHost *host;
+    uint64_t id; // In the host
+};
+
+struct OScInternal_ModuleHost {
+    struct OScInternal_ModuleHostEndpoints ends;
+    struct OScDevInternal_Interface *devif;
+    char *pool;
+    intptr_t process;
+    bool hasProcess;
+
+    struct ProxyImpl **impls;
+    size_t numberOfImpls;
+
+    OScInternal_Mutex callMutex; // Serializes control requests
+
+    OScInternal_Thread eventThread;
+
+    OScInternal_Mutex mutex; // Guards the following
+    OScInternal_Cond idle;   // Signaled when an acquisition finishes
+    OScInternal_PtrArray *devices; // struct ProxyDevice
+    bool exited;
+    bool disconnecting;
+};
+
+static OScDev_Error ProxyGetDeviceImpls(OScDev_PtrArray **deviceImpls);
+
+// Module implementation with which proxy devices and settings are created
+// (proxies report rich errors)
+static OScDev_ModuleImpl g_proxyModuleImpl = {
+    .displayName = "Device module host",
+    .supportsRichErrors = true,
+    .GetDeviceImpls = ProxyGetDeviceImpls,
+};
+
+static OScDev_Error ProxyGetDeviceImpls(OScDev_PtrArray **deviceImpls) {
+    // Never called; see OScInternal_ModuleHost_GetDeviceImpls()
+    (void)deviceImpls;
+    return OScInternal_Error_ReturnAsCode(
+        OScInternal_Error_UnsupportedOperation());
+}
+
+static OScDev_Error ReturnAsCode(OSc_RichError *err) {
+    if (err)
+        return OScInternal_Error_ReturnAsCode(err);
+    return OScDev_OK;
+}
+
+// Send a request, freeing it, and wait for the reply. On success, 'reply' is
+// positioned at the results; it must be freed in any case.
+static OSc_RichError *Call(OScInternal_ModuleHost *host,
+                           struct Buffer *request, struct Buffer *reply) {
+    OScInternal_Mutex_Lock(&host->callMutex);
+    bool ok = SendMessage(host->ends.controlOut, request) &&
+              ReceiveMessage(host->ends.controlIn, reply);
+    OScInternal_Mutex_Unlock(&host->callMutex);
+    Buffer_Free(request);
+    if (!ok) {
+        Buffer_Free(reply);
+        return OScInternal_Error_Create("Device module host process exited");
+    }
+    if (GetU32(reply) != STATUS_OK) {
+        char message[1024];
+        GetString(reply, message, sizeof(message));
+        Buffer_Free(reply);
+        return OScInternal_Error_Create(message);
+    }
+    return OSc_OK;
+}
+
+static struct ProxyDevice *GetProxyDevice(OScDev_Device *device) {
+    return OScInternal_Device_GetImplData(device);
+}
+
+static struct ProxySetting *GetProxySetting(OScDev_Setting *setting) {
+    return OScInternal_Setting_GetImplData(setting);
+}
+
+static void BeginDeviceRequest(struct Buffer *request, uint32_t op,
+                               OScDev_Device *device) {
+    BeginMessage(request, op);
+    PutU64(request, GetProxyDevice(device)->id);
+}
+
+static OSc_RichError *CallDevice(OScDev_Device *device,
+                                 struct Buffer *request,
+                                 struct Buffer *reply) {
+    return Call(GetProxyDevice(device)->host, request, reply);
+}
+
+static OScDev_Error CallDeviceForNothing(OScDev_Device *device, uint32_t op) {
+    struct Buffer request, reply;
+    BeginDeviceRequest(&request, op, device);
+    OSc_RichError *err = CallDevice(device, &request, &reply);
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+static OScDev_Error CallDeviceForBool(OScDev_Device *device, uint32_t op,
+                                      bool *value) {
+    struct Buffer request, reply;
+    BeginDeviceRequest(&request, op, device);
+    OSc_RichError *err = CallDevice(device, &request, &reply);
+    if (!err)
+        *value = GetU32(&reply) != 0;
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+static OScDev_Error CallDeviceForU32(OScDev_Device *device, uint32_t op,
+                                     uint32_t *value) {
+    struct Buffer request, reply;
+    BeginDeviceRequest(&request, op, device);
+    OSc_RichError *err = CallDevice(device, &request, &reply);
+    if (!err)
+        *value = GetU32(&reply);
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+static OScDev_Error CallDeviceForRange(OScDev_Device *device, uint32_t op,
+                                       OScDev_NumRange **range) {
+    struct Buffer request, reply;
+    BeginDeviceRequest(&request, op, device);
+    OSc_RichError *err = CallDevice(device, &request, &reply);
+    if (!err)
+        *range = GetRange(&reply);
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+// Proxies cannot tell which implementation GetModelName() and
+// EnumerateInstances() are called for, so each implementation is given
+// functions of its own, forwarding to these
+static struct ProxyImpl *g_proxyImplSlots[MAX_PROXY_IMPLS];
+static volatile int32_t g_proxyImplSlotClaims[MAX_PROXY_IMPLS];
+
+static OScDev_Error ProxyGetModelName(size_t slot, const char **name) {
+    *name = g_proxyImplSlots[slot]->modelName;
+    return OScDev_OK;
+}
+
+static OScDev_Error ProxyEnumerateInstances(size_t slot,
+                                            OScDev_PtrArray **devices) {
+    struct ProxyImpl *proxyImpl = g_proxyImplSlots[slot];
+    OScInternal_ModuleHost *host = proxyImpl->host;
+    struct Buffer request, reply;
+    BeginMessage(&request, OP_ENUMERATE_INSTANCES);
+    PutU32(&request, proxyImpl->index);
+    OSc_RichError *err = Call(host, &request, &reply);
+    if (err)
+        return ReturnAsCode(err);
+
+    *devices = OScInternal_PtrArray_Create();
+    uint32_t count = GetU32(&reply);
+    for (uint32_t i = 0; i < count && !reply.overrun; ++i) {
+        struct ProxyDevice *pd = calloc(1, sizeof(struct ProxyDevice));
+        pd->host = host;
+        pd->id = GetU64(&reply);
+        OScInternal_Device_Create(&g_proxyModuleImpl, &pd->device,
+                                  &proxyImpl->impl, pd);
+        OScInternal_Mutex_Lock(&host->mutex);
+        OScInternal_PtrArray_Append(host->devices, pd);
+        OScInternal_Mutex_Unlock(&host->mutex);
+        OScInternal_PtrArray_Append(*devices, pd->device);
+    }
+    Buffer_Free(&reply);
+    return OScDev_OK;
+}
+
+#define PROXY_IMPL_SLOT(i)                                                    \
+    static OScDev_Error GetModelName##i(const char **name) {                 \
+        return ProxyGetModelName(i, name);                                    \
+    }                                                                         \
+    static OScDev_Error EnumerateInstances##i(OScDev_PtrArray **devices) {   \
+        return ProxyEnumerateInstances(i, devices);                           \
+    }
+
+PROXY_IMPL_SLOT(0)
+PROXY_IMPL_SLOT(1)
+PROXY_IMPL_SLOT(2)
+PROXY_IMPL_SLOT(3)
+PROXY_IMPL_SLOT(4)
+PROXY_IMPL_SLOT(5)
+PROXY_IMPL_SLOT(6)
+PROXY_IMPL_SLOT(7)
+PROXY_IMPL_SLOT(8)
+PROXY_IMPL_SLOT(9)
+PROXY_IMPL_SLOT(10)
+PROXY_IMPL_SLOT(11)
+PROXY_IMPL_SLOT(12)
+PROXY_IMPL_SLOT(13)
+PROXY_IMPL_SLOT(14)
+PROXY_IMPL_SLOT(15)
+PROXY_IMPL_SLOT(16)
+PROXY_IMPL_SLOT(17)
+PROXY_IMPL_SLOT(18)
+PROXY_IMPL_SLOT(19)
+PROXY_IMPL_SLOT(20)
+PROXY_IMPL_SLOT(21)
+PROXY_IMPL_SLOT(22)
+PROXY_IMPL_SLOT(23)
+PROXY_IMPL_SLOT(24)
+PROXY_IMPL_SLOT(25)
+PROXY_IMPL_SLOT(26)
+PROXY_IMPL_SLOT(27)
+PROXY_IMPL_SLOT(28)
+PROXY_IMPL_SLOT(29)
+PROXY_IMPL_SLOT(30)
+PROXY_IMPL_SLOT(31)
+
+#define PROXY_IMPL_SLOT_FUNCTIONS(i) {GetModelName##i, EnumerateInstances##i}
+
+static const struct {
+    OScDev_Error (*GetModelName)(const char **name);
+    OScDev_Error (*EnumerateInstances)(OScDev_PtrArray **devices);
+} g_proxyImplSlotFunctions[MAX_PROXY_IMPLS] = {
+    PROXY_IMPL_SLOT_FUNCTIONS(0),  PROXY_IMPL_SLOT_FUNCTIONS(1),
+    PROXY_IMPL_SLOT_FUNCTIONS(2),  PROXY_IMPL_SLOT_FUNCTIONS(3),
+    PROXY_IMPL_SLOT_FUNCTIONS(4),  PROXY_IMPL_SLOT_FUNCTIONS(5),
+    PROXY_IMPL_SLOT_FUNCTIONS(6),  PROXY_IMPL_SLOT_FUNCTIONS(7),
+    PROXY_IMPL_SLOT_FUNCTIONS(8),  PROXY_IMPL_SLOT_FUNCTIONS(9),
+    PROXY_IMPL_SLOT_FUNCTIONS(10), PROXY_IMPL_SLOT_FUNCTIONS(11),
+    PROXY_IMPL_SLOT_FUNCTIONS(12), PROXY_IMPL_SLOT_FUNCTIONS(13),
+    PROXY_IMPL_SLOT_FUNCTIONS(14), PROXY_IMPL_SLOT_FUNCTIONS(15),
+    PROXY_IMPL_SLOT_FUNCTIONS(16), PROXY_IMPL_SLOT_FUNCTIONS(17),
+    PROXY_IMPL_SLOT_FUNCTIONS(18), PROXY_IMPL_SLOT_FUNCTIONS(19),
+    PROXY_IMPL_SLOT_FUNCTIONS(20), PROXY_IMPL_SLOT_FUNCTIONS(21),
+    PROXY_IMPL_SLOT_FUNCTIONS(22), PROXY_IMPL_SLOT_FUNCTIONS(23),
+    PROXY_IMPL_SLOT_FUNCTIONS(24), PROXY_IMPL_SLOT_FUNCTIONS(25),
+    PROXY_IMPL_SLOT_FUNCTIONS(26), PROXY_IMPL_SLOT_FUNCTIONS(27),
+    PROXY_IMPL_SLOT_FUNCTIONS(28), PROXY_IMPL_SLOT_FUNCTIONS(29),
+    PROXY_IMPL_SLOT_FUNCTIONS(30), PROXY_IMPL_SLOT_FUNCTIONS(31),
+};
+
+// Claim a free slot for 'proxyImpl' (a slot is claimed by the caller that
+// increments its count to 1)
+static bool ClaimProxyImplSlot(struct ProxyImpl *proxyImpl) {
+    for (size_t i = 0; i < MAX_PROXY_IMPLS; ++i) {
+        if (OScInternal_Atomic_Increment(&g_proxyImplSlotClaims[i]) == 1) {
+            g_proxyImplSlots[i] = proxyImpl;
+            proxyImpl->slot = i;
+            proxyImpl->impl.GetModelName =
+                g_proxyImplSlotFunctions[i].GetModelName;
+            proxyImpl->impl.EnumerateInstances =
+                g_proxyImplSlotFunctions[i].EnumerateInstances;
+            return true;
+        }
+        OScInternal_Atomic_Decrement(&g_proxyImplSlotClaims[i]);
+    }
+    return false;
+}
+
+static void ReleaseProxyImplSlot(struct ProxyImpl *proxyImpl) {
+    g_proxyImplSlots[proxyImpl->slot] = NULL;
+    OScInternal_Atomic_Decrement(&g_proxyImplSlotClaims[proxyImpl->slot]);
+}
+
+static OScDev_Error ProxyReleaseInstance(OScDev_Device *device) {
+    struct ProxyDevice *pd = GetProxyDevice(device);
+    OScInternal_ModuleHost *host = pd->host;
+    OScDev_Error errCode = CallDeviceForNothing(device, OP_RELEASE_INSTANCE);
+
+    OScInternal_Mutex_Lock(&host->mutex);
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(host->devices); ++i) {
+        if (OScInternal_PtrArray_At(host->devices, i) == pd) {
+            OScInternal_PtrArray_Remove(host->devices, i);
+            break;
+        }
+    }
+    OScInternal_Mutex_Unlock(&host->mutex);
+    free(pd);
+    return errCode;
+}
+
+static OScDev_Error ProxyGetName(OScDev_Device *device, char *name) {
+    struct Buffer request, reply;
+    BeginDeviceRequest(&request, OP_GET_NAME, device);
+    OSc_RichError *err = CallDevice(device, &request, &reply);
+    if (!err)
+        GetString(&reply, name, OScDev_MAX_STR_SIZE);
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+static OScDev_Error ProxyOpen(OScDev_Device *device) {
+    return CallDeviceForNothing(device, OP_OPEN);
+}
+
+static OScDev_Error ProxyClose(OScDev_Device *device) {
+    return CallDeviceForNothing(device, OP_CLOSE);
+}
+
+static OScDev_Error ProxyHasClock(OScDev_Device *device, bool *hasClock) {
+    return CallDeviceForBool(device, OP_HAS_CLOCK, hasClock);
+}
+
+static OScDev_Error ProxyHasScanner(OScDev_Device *device, bool *hasScanner) {
+    return CallDeviceForBool(device, OP_HAS_SCANNER, hasScanner);
+}
+
+static OScDev_Error ProxyHasDetector(OScDev_Device *device,
+                                     bool *hasDetector) {
+    return CallDeviceForBool(device, OP_HAS_DETECTOR, hasDetector);
+}
+
+static OScDev_SettingImpl g_proxySettingImpl;
+
+static OScDev_Error ProxyMakeSettings(OScDev_Device *device,
+                                      OScDev_PtrArray **settings) {
+    struct ProxyDevice *pd = GetProxyDevice(device);
+    struct Buffer request, reply;
+    BeginDeviceRequest(&request, OP_MAKE_SETTINGS, device);
+    OSc_RichError *err = CallDevice(device, &request, &reply);
+    if (err)
+        return ReturnAsCode(err);
+
+    *settings = OScInternal_PtrArray_Create();
+    uint32_t count = GetU32(&reply);
+    for (uint32_t i = 0; i < count && !reply.overrun; ++i) {
+        struct ProxySetting *ps = calloc(1, sizeof(struct ProxySetting));
+        ps->host = pd->host;
+        ps->id = GetU64(&reply);
+        char name[OScDev_MAX_STR_SIZE];
+        GetString(&reply, name, sizeof(name));
+        OScDev_ValueType valueType = GetI32(&reply);
+        OSc_Setting *setting;
+        if (OSc_CHECK_ERROR(err, OScInternal_Setting_Create(
+                                     &g_proxyModuleImpl, &setting, name,
+                                     valueType, &g_proxySettingImpl, ps))) {
+            free(ps);
+            break;
+        }
+        OScInternal_PtrArray_Append(*settings, setting);
+    }
+    Buffer_Free(&reply);
+    if (err) {
+        for (size_t i = 0; i < OScInternal_PtrArray_Size(*settings); ++i)
+            OScInternal_Setting_Destroy(
+                OScInternal_PtrArray_At(*settings, i));
+        OScInternal_PtrArray_Destroy(*settings);
+        *settings = NULL;
+    }
+    return ReturnAsCode(err);
+}
+
+static OScDev_Error ProxyGetPixelRates(OScDev_Device *device,
+                                       OScDev_NumRange **pixelRatesHz) {
+    return CallDeviceForRange(device, OP_GET_PIXEL_RATES, pixelRatesHz);
+}
+
+static OScDev_Error ProxyGetActualPixelRate(OScDev_Device *device,
+                                            double nominalRateHz,
+                                            double *actualRateHz) {
+    struct Buffer request, reply;
+    BeginDeviceRequest(&request, OP_GET_ACTUAL_PIXEL_RATE, device);
+    PutF64(&request, nominalRateHz);
+    OSc_RichError *err = CallDevice(device, &request, &reply);
+    if (!err)
+        *actualRateHz = GetF64(&reply);
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+static OScDev_Error ProxyGetResolutions(OScDev_Device *device,
+                                        OScDev_NumRange **resolutions) {
+    return CallDeviceForRange(device, OP_GET_RESOLUTIONS, resolutions);
+}
+
+static OScDev_Error ProxyGetZoomFactors(OScDev_Device *device,
+                                        OScDev_NumRange **zooms) {
+    return CallDeviceForRange(device, OP_GET_ZOOM_FACTORS, zooms);
+}
+
+static OScDev_Error ProxyIsROIScanSupported(OScDev_Device *device,
+                                            bool *supported) {
+    return CallDeviceForBool(device, OP_IS_ROI_SCAN_SUPPORTED, supported);
+}
+
+static OScDev_Error ProxyGetRasterWidths(OScDev_Device *device,
+                                         OScDev_NumRange **widths) {
+    return CallDeviceForRange(device, OP_GET_RASTER_WIDTHS, widths);
+}
+
+static OScDev_Error ProxyGetRasterHeights(OScDev_Device *device,
+                                          OScDev_NumRange **heights) {
+    return CallDeviceForRange(device, OP_GET_RASTER_HEIGHTS, heights);
+}
+
+static OScDev_Error ProxyGetNumberOfChannels(OScDev_Device *device,
+                                             uint32_t *nChannels) {
+    return CallDeviceForU32(device, OP_GET_NUMBER_OF_CHANNELS, nChannels);
+}
+
+static OScDev_Error ProxyGetBytesPerSample(OScDev_Device *device,
+                                           uint32_t *bytesPerSample) {
+    return CallDeviceForU32(device, OP_GET_BYTES_PER_SAMPLE, bytesPerSample);
+}
+
+static OScDev_Error ProxyGetSampleFormat(OScDev_Device *device,
+                                         uint32_t channel,
+                                         OScDev_SampleFormat *format) {
+    struct Buffer request, reply;
+    BeginDeviceRequest(&request, OP_GET_SAMPLE_FORMAT, device);
+    PutU32(&request, channel);
+    OSc_RichError *err = CallDevice(device, &request, &reply);
+    if (!err)
+        *format = GetI32(&reply);
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+// The host's module gets a snapshot of the acquisition parameters
+static OScDev_Error ProxyArm(OScDev_Device *device, OScDev_Acquisition *acq) {
+    struct ProxyDevice *pd = GetProxyDevice(device);
+    OScInternal_ModuleHost *host = pd->host;
+    struct OScDevInternal_Interface *devif = host->devif;
+    OScDev_ModuleImpl *modImpl = &g_proxyModuleImpl;
+
+    struct Buffer request, reply;
+    BeginDeviceRequest(&request, OP_ARM, device);
+    bool requested;
+    devif->Acquisition_IsClockRequested(modImpl, acq, &requested);
+    PutU32(&request, requested);
+    devif->Acquisition_IsScannerRequested(modImpl, acq, &requested);
+    PutU32(&request, requested);
+    devif->Acquisition_IsDetectorRequested(modImpl, acq, &requested);
+    PutU32(&request, requested);
+    OScDev_TriggerSource startTrigger;
+    devif->Acquisition_GetClockStartTriggerSource(modImpl, acq,
+                                                  &startTrigger);
+    PutI32(&request, startTrigger);
+    OScDev_ClockSource clockSource;
+    devif->Acquisition_GetClockSource(modImpl, acq, &clockSource);
+    PutI32(&request, clockSource);
+    PutU32(&request, devif->Acquisition_GetNumberOfFrames(modImpl, acq));
+    PutF64(&request, devif->Acquisition_GetPixelRate(modImpl, acq));
+    PutU32(&request, devif->Acquisition_GetResolution(modImpl, acq));
+    PutF64(&request, devif->Acquisition_GetZoomFactor(modImpl, acq));
+    uint32_t xOffset, yOffset, width, height;
+    devif->Acquisition_GetROI(modImpl, acq, &xOffset, &yOffset, &width,
+                              &height);
+    PutU32(&request, xOffset);
+    PutU32(&request, yOffset);
+    PutU32(&request, width);
+    PutU32(&request, height);
+    PutU32(&request, devif->Acquisition_GetSamplesPerPixel(modImpl, acq));
+
+    // Frames may arrive as soon as the module is armed
+    OScInternal_Mutex_Lock(&host->mutex);
+    bool armed = pd->armed;
+    if (!armed) {
+        pd->acq = acq;
+        pd->armed = true;
+    }
+    OScInternal_Mutex_Unlock(&host->mutex);
+    if (armed) {
+        Buffer_Free(&request);
+        return ReturnAsCode(
+            OScInternal_Error_Create("Device is already armed"));
+    }
+
+    OSc_RichError *err = CallDevice(device, &request, &reply);
+    Buffer_Free(&reply);
+    if (err) {
+        OScInternal_Mutex_Lock(&host->mutex);
+        pd->acq = NULL;
+        pd->armed = false;
+        OScInternal_Cond_Broadcast(&host->idle);
+        OScInternal_Mutex_Unlock(&host->mutex);
+    }
+    return ReturnAsCode(err);
+}
+
+static OScDev_Error ProxyStart(OScDev_Device *device) {
+    return CallDeviceForNothing(device, OP_START);
+}
+
+static OScDev_Error ProxyIsRunning(OScDev_Device *device, bool *isRunning) {
+    struct ProxyDevice *pd = GetProxyDevice(device);
+    OScInternal_Mutex_Lock(&pd->host->mutex);
+    *isRunning = pd->armed;
+    OScInternal_Mutex_Unlock(&pd->host->mutex);
+    return OScDev_OK;
+}
+
+// Return once the host has reported the acquisition finished (after the
+// last frame)
+static OScDev_Error ProxyWait(OScDev_Device *device) {
+    struct ProxyDevice *pd = GetProxyDevice(device);
+    OScInternal_Mutex_Lock(&pd->host->mutex);
+    while (pd->armed)
+        OScInternal_Cond_Wait(&pd->host->idle, &pd->host->mutex);
+    OScInternal_Mutex_Unlock(&pd->host->mutex);
+    return OScDev_OK;
+}
+
+static OScDev_Error ProxyStop(OScDev_Device *device) {
+    OScDev_Error errCode = CallDeviceForNothing(device, OP_STOP);
+    if (errCode)
+        return errCode;
+    return ProxyWait(device);
+}
+
+static OScDev_DeviceImpl g_proxyDeviceImpl = {
+    .ReleaseInstance = ProxyReleaseInstance,
+    .GetName = ProxyGetName,
+    .Open = ProxyOpen,
+    .Close = ProxyClose,
+    .HasClock = ProxyHasClock,
+    .HasScanner = ProxyHasScanner,
+    .HasDetector = ProxyHasDetector,
+    .MakeSettings = ProxyMakeSettings,
+    .GetPixelRates = ProxyGetPixelRates,
+    .GetActualPixelRate = ProxyGetActualPixelRate,
+    .GetResolutions = ProxyGetResolutions,
+    .GetZoomFactors = ProxyGetZoomFactors,
+    .IsROIScanSupported = ProxyIsROIScanSupported,
+    .GetRasterWidths = ProxyGetRasterWidths,
+    .GetRasterHeights = ProxyGetRasterHeights,
+    .GetNumberOfChannels = ProxyGetNumberOfChannels,
+    .GetBytesPerSample = ProxyGetBytesPerSample,
+    .Arm = ProxyArm,
+    .Start = ProxyStart,
+    .Stop = ProxyStop,
+    .IsRunning = ProxyIsRunning,
+    .Wait = ProxyWait,
+    .GetSampleFormat = ProxyGetSampleFormat,
+};
+
+// Settings forward every function, because the host fills in defaults
+
+static void BeginSettingRequest(struct Buffer *request, uint32_t op,
+                                OScDev_Setting *setting) {
+    BeginMessage(request, op);
+    PutU64(request, GetProxySetting(setting)->id);
+}
+
+static OSc_RichError *CallSetting(OScDev_Setting *setting,
+                                  struct Buffer *request,
+                                  struct Buffer *reply) {
+    return Call(GetProxySetting(setting)->host, request, reply);
+}
+
+static OScDev_Error CallSettingForU32(OScDev_Setting *setting, uint32_t op,
+                                      uint32_t *value) {
+    struct Buffer request, reply;
+    BeginSettingRequest(&request, op, setting);
+    OSc_RichError *err = CallSetting(setting, &request, &reply);
+    if (!err)
+        *value = GetU32(&reply);
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+static OScDev_Error CallSettingForBool(OScDev_Setting *setting, uint32_t op,
+                                       bool *value) {
+    uint32_t v;
+    OScDev_Error errCode = CallSettingForU32(setting, op, &v);
+    if (!errCode)
+        *value = v != 0;
+    return errCode;
+}
+
+static OScDev_Error CallSettingForString(OScDev_Setting *setting,
+                                         uint32_t op, char *value) {
+    struct Buffer request, reply;
+    BeginSettingRequest(&request, op, setting);
+    OSc_RichError *err = CallSetting(setting, &request, &reply);
+    if (!err)
+        GetString(&reply, value, OScDev_MAX_STR_SIZE);
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+static OScDev_Error CallSettingForNumbers(OScDev_Setting *setting,
+                                          uint32_t op,
+                                          OScDev_NumArray **values) {
+    struct Buffer request, reply;
+    BeginSettingRequest(&request, op, setting);
+    OSc_RichError *err = CallSetting(setting, &request, &reply);
+    if (!err) {
+        *values = OScInternal_NumArray_Create();
+        uint32_t count = GetU32(&reply);
+        for (uint32_t i = 0; i < count && !reply.overrun; ++i)
+            OScInternal_NumArray_Append(*values, GetF64(&reply));
+    }
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+static OScDev_Error ProxySetValue(OScDev_Setting *setting,
+                                  struct Buffer *request) {
+    struct Buffer reply;
+    OSc_RichError *err = CallSetting(setting, request, &reply);
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+static OScDev_Error ProxyIsEnabled(OScDev_Setting *setting, bool *enabled) {
+    return CallSettingForBool(setting, OP_SETTING_IS_ENABLED, enabled);
+}
+
+static OScDev_Error ProxyIsWritable(OScDev_Setting *setting,
+                                    bool *writable) {
+    return CallSettingForBool(setting, OP_SETTING_IS_WRITABLE, writable);
+}
+
+static OScDev_Error
+ProxyGetNumericConstraintType(OScDev_Setting *setting,
+                              OScDev_ValueConstraint *constraintType) {
+    uint32_t v;
+    OScDev_Error errCode = CallSettingForU32(
+        setting, OP_SETTING_GET_NUMERIC_CONSTRAINT_TYPE, &v);
+    if (!errCode)
+        *constraintType = (OScDev_ValueConstraint)v;
+    return errCode;
+}
+
+static OScDev_Error ProxyGetString(OScDev_Setting *setting, char *value) {
+    return CallSettingForString(setting, OP_SETTING_GET_STRING, value);
+}
+
+static OScDev_Error ProxySetString(OScDev_Setting *setting,
+                                   const char *value) {
+    struct Buffer request;
+    BeginSettingRequest(&request, OP_SETTING_SET_STRING, setting);
+    PutString(&request, value);
+    return ProxySetValue(setting, &request);
+}
+
+static OScDev_Error ProxyGetBool(OScDev_Setting *setting, bool *value) {
+    return CallSettingForBool(setting, OP_SETTING_GET_BOOL, value);
+}
+
+static OScDev_Error ProxySetBool(OScDev_Setting *setting, bool value) {
+    struct Buffer request;
+    BeginSettingRequest(&request, OP_SETTING_SET_BOOL, setting);
+    PutU32(&request, value);
+    return ProxySetValue(setting, &request);
+}
+
+static OScDev_Error ProxyGetInt32(OScDev_Setting *setting, int32_t *value) {
+    uint32_t v;
+    OScDev_Error errCode =
+        CallSettingForU32(setting, OP_SETTING_GET_INT32, &v);
+    if (!errCode)
+        *value = (int32_t)v;
+    return errCode;
+}
+
+static OScDev_Error ProxySetInt32(OScDev_Setting *setting, int32_t value) {
+    struct Buffer request;
+    BeginSettingRequest(&request, OP_SETTING_SET_INT32, setting);
+    PutI32(&request, value);
+    return ProxySetValue(setting, &request);
+}
+
+static OScDev_Error ProxyGetInt32Range(OScDev_Setting *setting, int32_t *min,
+                                       int32_t *max) {
+    struct Buffer request, reply;
+    BeginSettingRequest(&request, OP_SETTING_GET_INT32_RANGE, setting);
+    OSc_RichError *err = CallSetting(setting, &request, &reply);
+    if (!err) {
+        *min = GetI32(&reply);
+        *max = GetI32(&reply);
+    }
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+static OScDev_Error ProxyGetInt32DiscreteValues(OScDev_Setting *setting,
+                                                OScDev_NumArray **values) {
+    return CallSettingForNumbers(
+        setting, OP_SETTING_GET_INT32_DISCRETE_VALUES, values);
+}
+
+static OScDev_Error ProxyGetFloat64(OScDev_Setting *setting, double *value) {
+    struct Buffer request, reply;
+    BeginSettingRequest(&request, OP_SETTING_GET_FLOAT64, setting);
+    OSc_RichError *err = CallSetting(setting, &request, &reply);
+    if (!err)
+        *value = GetF64(&reply);
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+static OScDev_Error ProxySetFloat64(OScDev_Setting *setting, double value) {
+    struct Buffer request;
+    BeginSettingRequest(&request, OP_SETTING_SET_FLOAT64, setting);
+    PutF64(&request, value);
+    return ProxySetValue(setting, &request);
+}
+
+static OScDev_Error ProxyGetFloat64Range(OScDev_Setting *setting,
+                                         double *min, double *max) {
+    struct Buffer request, reply;
+    BeginSettingRequest(&request, OP_SETTING_GET_FLOAT64_RANGE, setting);
+    OSc_RichError *err = CallSetting(setting, &request, &reply);
+    if (!err) {
+        *min = GetF64(&reply);
+        *max = GetF64(&reply);
+    }
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+static OScDev_Error ProxyGetFloat64DiscreteValues(OScDev_Setting *setting,
+                                                  OScDev_NumArray **values) {
+    return CallSettingForNumbers(
+        setting, OP_SETTING_GET_FLOAT64_DISCRETE_VALUES, values);
+}
+
+static OScDev_Error ProxyGetEnum(OScDev_Setting *setting, uint32_t *value) {
+    return CallSettingForU32(setting, OP_SETTING_GET_ENUM, value);
+}
+
+static OScDev_Error ProxySetEnum(OScDev_Setting *setting, uint32_t value) {
+    struct Buffer request;
+    BeginSettingRequest(&request, OP_SETTING_SET_ENUM, setting);
+    PutU32(&request, value);
+    return ProxySetValue(setting, &request);
+}
+
+static OScDev_Error ProxyGetEnumNumValues(OScDev_Setting *setting,
+                                          uint32_t *count) {
+    return CallSettingForU32(setting, OP_SETTING_GET_ENUM_NUM_VALUES, count);
+}
+
+static OScDev_Error ProxyGetEnumNameForValue(OScDev_Setting *setting,
+                                             uint32_t value, char *name) {
+    struct Buffer request, reply;
+    BeginSettingRequest(&request, OP_SETTING_GET_ENUM_NAME_FOR_VALUE,
+                        setting);
+    PutU32(&request, value);
+    OSc_RichError *err = CallSetting(setting, &request, &reply);
+    if (!err)
+        GetString(&reply, name, OScDev_MAX_STR_SIZE);
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+static OScDev_Error ProxyGetEnumValueForName(OScDev_Setting *setting,
+                                             uint32_t *value,
+                                             const char *name) {
+    struct Buffer request, reply;
+    BeginSettingRequest(&request, OP_SETTING_GET_ENUM_VALUE_FOR_NAME,
+                        setting);
+    PutString(&request, name);
+    OSc_RichError *err = CallSetting(setting, &request, &reply);
+    if (!err)
+        *value = GetU32(&reply);
+    Buffer_Free(&reply);
+    return ReturnAsCode(err);
+}
+
+// The host's settings are destroyed with its device
+static void ProxyRelease(OScDev_Setting *setting) {
+    free(GetProxySetting(setting));
+}
+
+static OScDev_SettingImpl g_proxySettingImpl = {
+    .IsEnabled = ProxyIsEnabled,
+    .IsWritable = ProxyIsWritable,
+    .GetNumericConstraintType = ProxyGetNumericConstraintType,
+    .GetString = ProxyGetString,
+    .SetString = ProxySetString,
+    .GetBool = ProxyGetBool,
+    .SetBool = ProxySetBool,
+    .GetInt32 = ProxyGetInt32,
+    .SetInt32 = ProxySetInt32,
+    .GetInt32Range = ProxyGetInt32Range,
+    .GetInt32DiscreteValues = ProxyGetInt32DiscreteValues,
+    .GetFloat64 = ProxyGetFloat64,
+    .SetFloat64 = ProxySetFloat64,
+    .GetFloat64Range = ProxyGetFloat64Range,
+    .GetFloat64DiscreteValues = ProxyGetFloat64DiscreteValues,
+    .GetEnum = ProxyGetEnum,
+    .SetEnum = ProxySetEnum,
+    .GetEnumNumValues = ProxyGetEnumNumValues,
+    .GetEnumNameForValue = ProxyGetEnumNameForValue,
+    .GetEnumValueForName = ProxyGetEnumValueForName,
+    .Release = ProxyRelease,
+};
+
+/*
+ * Application side: events.
+ */
+
+// Call with the host's mutex held
+static struct ProxyDevice *FindProxyDevice(OScInternal_ModuleHost *host,
+                                           uint64_t id) {
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(host->devices); ++i) {
+        struct ProxyDevice *pd = OScInternal_PtrArray_At(host->devices, i);
+        if (pd->id == id)
+            return pd;
+    }
+    return NULL;
+}
+
+static OScDev_Acquisition *GetArmedAcquisition(OScInternal_ModuleHost *host,
+                                               uint64_t id) {
+    OScInternal_Mutex_Lock(&host->mutex);
+    struct ProxyDevice *pd = FindProxyDevice(host, id);
+    OScDev_Acquisition *acq = pd ? pd->acq : NULL;
+    OScInternal_Mutex_Unlock(&host->mutex);
+    return acq;
+}
+
+static bool IsInPool(OScInternal_ModuleHost *host, uint64_t offset,
+                     uint64_t bytes) {
+    return offset <= host->ends.poolBytes &&
+           bytes <= host->ends.poolBytes - offset;
+}
+
+static void ReleaseSlot(OScInternal_ModuleHost *host, uint32_t slot,
+                        uint64_t id, bool shouldContinue) {
+    struct Buffer event;
+    BeginMessage(&event, EVENT_RELEASE);
+    PutU32(&event, slot);
+    PutU64(&event, id);
+    PutU32(&event, shouldContinue);
+    SendMessage(host->ends.eventsOut, &event);
+    Buffer_Free(&event);
+}
+
+static void HandleFrame(OScInternal_ModuleHost *host, struct Buffer *event) {
+    uint64_t id = GetU64(event);
+    uint32_t channel = GetU32(event);
+    uint32_t slot = GetU32(event);
+    uint64_t offset = GetU64(event);
+    uint64_t bytes = GetU64(event);
+    OScDev_Acquisition *acq = GetArmedAcquisition(host, id);
+    bool shouldContinue = false;
+    if (acq && !event->overrun && IsInPool(host, offset, bytes)) {
+        shouldContinue = host->devif->Acquisition_CallFrameCallback(
+            &g_proxyModuleImpl, acq, channel, host->pool + offset);
+    }
+    ReleaseSlot(host, slot, id, shouldContinue);
+}
+
+static void HandleTimeTags(OScInternal_ModuleHost *host,
+                           struct Buffer *event) {
+    uint64_t id = GetU64(event);
+    uint32_t slot = GetU32(event);
+    uint64_t offset = GetU64(event);
+    uint64_t count = GetU64(event);
+    OScDev_Acquisition *acq = GetArmedAcquisition(host, id);
+    bool shouldContinue = false;
+    if (acq && !event->overrun && count <= UINT64_MAX / sizeof(uint64_t) &&
+        IsInPool(host, offset, count * sizeof(uint64_t))) {
+        shouldContinue = host->devif->Acquisition_CallTimeTagCallback(
+            &g_proxyModuleImpl, acq,
+            (const uint64_t *)(host->pool + offset), (size_t)count);
+    }
+    ReleaseSlot(host, slot, id, shouldContinue);
+}
+
+static void HandleLog(OScInternal_ModuleHost *host, struct Buffer *event) {
+    uint64_t id = GetU64(event);
+    OScDev_LogLevel level = GetI32(event);
+    char message[1024];
+    GetString(event, message, sizeof(message));
+    OScInternal_Mutex_Lock(&host->mutex);
+    struct ProxyDevice *pd = FindProxyDevice(host, id);
+    OSc_Device *device = pd ? pd->device : NULL;
+    OScInternal_Mutex_Unlock(&host->mutex);
+    host->devif->Log(&g_proxyModuleImpl, device, level, message);
+}
+
+static void HandleIdle(OScInternal_ModuleHost *host, struct Buffer *event) {
+    uint64_t id = GetU64(event);
+    OScInternal_Mutex_Lock(&host->mutex);
+    struct ProxyDevice *pd = FindProxyDevice(host, id);
+    if (pd) {
+        pd->acq = NULL;
+        pd->armed = false;
+        OScInternal_Cond_Broadcast(&host->idle);
+    }
+    OScInternal_Mutex_Unlock(&host->mutex);
+}
+
+static void ReceiveEvents(void *data) {
+    OScInternal_ModuleHost *host = data;
+    struct Buffer event;
+    while (ReceiveMessage(host->ends.eventsIn, &event)) {
+        switch (GetU32(&event)) {
+        case EVENT_FRAME:
+            HandleFrame(host, &event);
+            break;
+        case EVENT_TIME_TAGS:
+            HandleTimeTags(host, &event);
+            break;
+        case EVENT_LOG:
+            HandleLog(host, &event);
+            break;
+        case EVENT_IDLE:
+            HandleIdle(host, &event);
+            break;
+        }
+        Buffer_Free(&event);
+    }
+
+    // The host has exited (or is exiting); its acquisitions are over
+    OScInternal_Mutex_Lock(&host->mutex);
+    bool expected = host->disconnecting;
+    host->exited = true;
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(host->devices); ++i) {
+        struct ProxyDevice *pd = OScInternal_PtrArray_At(host->devices, i);
+        pd->acq = NULL;
+        pd->armed = false;
+    }
+    OScInternal_Cond_Broadcast(&host->idle);
+    OScInternal_Mutex_Unlock(&host->mutex);
+    ShutdownOutput(&host->ends.eventsOut, host->ends.eventsIn);
+    if (!expected)
+        OScInternal_LogError(NULL, "Device module host process exited");
+}
+
+static void Disconnect(OScInternal_ModuleHost *host) {
+    OScInternal_Mutex_Lock(&host->mutex);
+    host->disconnecting = true;
+    OScInternal_Mutex_Unlock(&host->mutex);
+
+    OScInternal_Mutex_Lock(&host->callMutex);
+    ShutdownOutput(&host->ends.controlOut, host->ends.controlIn);
+    OScInternal_Mutex_Unlock(&host->callMutex);
+    if (host->hasProcess)
+        WaitForProcess(host->process, EXIT_TIMEOUT_SECONDS);
+    OScInternal_Thread_Join(host->eventThread);
+
+    OScInternal_ModuleHost_CloseEndpoints(&host->ends);
+}
+
+static void FreeHost(OScInternal_ModuleHost *host) {
+    for (size_t i = 0; i < host->numberOfImpls; ++i) {
+        ReleaseProxyImplSlot(host->impls[i]);
+        free(host->impls[i]);
+    }
+    free(host->impls);
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(host->devices); ++i)
+        free(OScInternal_PtrArray_At(host->devices, i));
+    OScInternal_PtrArray_Destroy(host->devices);
+    OScInternal_Cond_Destroy(&host->idle);
+    OScInternal_Mutex_Destroy(&host->mutex);
+    OScInternal_Mutex_Destroy(&host->callMutex);
+    UnmapPool(host->pool, host->ends.poolBytes);
+    free(host);
+}
+
+static OSc_RichError *Hello(OScInternal_ModuleHost *host) {
+    struct Buffer request, reply;
+    BeginMessage(&request, OP_HELLO);
+    OSc_RichError *err = Call(host, &request, &reply);
+    if (err)
+        return err;
+
+    uint32_t count = GetU32(&reply);
+    host->impls = calloc(count, sizeof(struct ProxyImpl *));
+    for (uint32_t i = 0; i < count && !reply.overrun; ++i) {
+        struct ProxyImpl *proxyImpl = calloc(1, sizeof(struct ProxyImpl));
+        proxyImpl->impl = g_proxyDeviceImpl;
+        proxyImpl->host = host;
+        proxyImpl->index = i;
+        GetString(&reply, proxyImpl->modelName,
+                  sizeof(proxyImpl->modelName));
+        if (!ClaimProxyImplSlot(proxyImpl)) {
+            free(proxyImpl);
+            err = OScInternal_Error_Create(
+                "Too many device implementations in hosted device modules");
+            break;
+        }
+        host->impls[host->numberOfImpls++] = proxyImpl;
+    }
+    Buffer_Free(&reply);
+    return err;
+}
+
+OSc_RichError *
+OScInternal_ModuleHost_Connect(OScInternal_ModuleHost **host,
+                               struct OScInternal_ModuleHostEndpoints *ends,
+                               struct OScDevInternal_Interface *devif) {
+    *host = NULL;
+    OScInternal_ModuleHost *h = calloc(1, sizeof(OScInternal_ModuleHost));
+    h->ends = *ends;
+    InitEndpoints(ends);
+    h->devif = devif;
+    OScInternal_Mutex_Init(&h->callMutex);
+    OScInternal_Mutex_Init(&h->mutex);
+    OScInternal_Cond_Init(&h->idle);
+    h->devices = OScInternal_PtrArray_Create();
+
+    int code = MapPool(h->ends.pool, h->ends.poolBytes, &h->pool);
+    if (code != 0) {
+        OScInternal_ModuleHost_CloseEndpoints(&h->ends);
+        FreeHost(h);
+        return IOError("Mapping the device module host buffer pool", code);
+    }
+    if (!OScInternal_Thread_Create(&h->eventThread, ReceiveEvents, h)) {
+        OScInternal_ModuleHost_CloseEndpoints(&h->ends);
+        FreeHost(h);
+        return OScInternal_Error_OutOfMemory();
+    }
+
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, Hello(h))) {
+        Disconnect(h);
+        FreeHost(h);
+        return err;
+    }
+    *host = h;
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_ModuleHost_Spawn(OScInternal_ModuleHost **host,
+                                            const char *hostPath,
+                                            const char *modulePath,
+                                            uint64_t poolBytes) {
+    struct OScInternal_ModuleHostEndpoints application, child;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OScInternal_ModuleHost_CreateEndpoints(
+                                 &application, &child, poolBytes)))
+        return err;
+
+    char args[NUMBER_OF_ARGUMENTS][24];
+    FormatArguments(args, &child);
+    intptr_t process = 0;
+    int code = StartProcess(&process, hostPath, modulePath, args,
+                            NUMBER_OF_ARGUMENTS, &child);
+    OScInternal_ModuleHost_CloseEndpoints(&child);
+    if (code != 0) {
+        OScInternal_ModuleHost_CloseEndpoints(&application);
+        return IOError("Starting the device module host", code);
+    }
+
+    err = OScInternal_ModuleHost_Connect(host, &application,
+                                         &DeviceInterfaceFunctionTable);
+    if (err) {
+        WaitForProcess(process, EXIT_TIMEOUT_SECONDS);
+        char message[1024];
+        snprintf(message, sizeof(message),
+                 "Cannot host device module %s in %s", modulePath,
+                 hostPath);
+        return OScInternal_Error_Wrap(err, message);
+    }
+    (*host)->process = process;
+    (*host)->hasProcess = true;
+    return OSc_OK;
+}
+
+OSc_RichError *
+OScInternal_ModuleHost_GetDeviceImpls(OScInternal_ModuleHost *host,
+                                      OScInternal_PtrArray **deviceImpls) {
+    *deviceImpls = OScInternal_PtrArray_Create();
+    for (size_t i = 0; i < host->numberOfImpls; ++i)
+        OScInternal_PtrArray_Append(*deviceImpls, &host->impls[i]->impl);
+    return OSc_OK;
+}
+
+void OScInternal_ModuleHost_Destroy(OScInternal_ModuleHost *host) {
+    if (!host)
+        return;
+    Disconnect(host);
+    FreeHost(host);
+}
+
+/*
+ * Host side.
+ */
+
+struct HostDevice;
+
+// What the application's acquisition looked like when the device was armed
+struct HostAcquisition {
+    struct HostDevice *device;
+    bool clockRequested;
+    bool scannerRequested;
+    bool detectorRequested;
+    OScDev_TriggerSource startTrigger;
+    OScDev_ClockSource clockSource;
+    uint32_t numberOfFrames;
+    double pixelRate;
+    uint32_t resolution;
+    double zoomFactor;
+    uint32_t xOffset;
+    uint32_t yOffset;
+    uint32_t width;
+    uint32_t height;
+    uint32_t samplesPerPixel;
+
+    uint32_t numberOfChannels;
+    size_t *channelBytes;
+    volatile bool cancelled; // A frame callback returned false
+};
+
+struct HostDevice {
+    OSc_Device *device;
+    OScDev_DeviceImpl *impl;
+    struct HostAcquisition acq;
+
+    // Waits for the module's acquisition to finish, then reports it
+    OScInternal_Thread waiter;
+    bool hasWaiter;
+
+    bool armed; // Guarded by the server's mutex
+};
+
+struct Server {
+    struct OScInternal_ModuleHostEndpoints ends;
+    struct OScDevInternal_Interface devif; // As seen by the module
+    OScDevInternal_EntryPointPtr entryPoint;
+    const char *loadError;
+    OScDev_ModuleImpl *modImpl;
+    OScInternal_PtrArray *impls;
+    bool opened;
+
+    char *pool;
+    uint32_t maxSlots;
+
+    OScInternal_Mutex eventMutex; // Serializes posting events
+
+    OScInternal_Thread releaseThread;
+
+    OScInternal_Mutex mutex; // Guards the following
+    OScInternal_Cond slotFreed;
+    OScInternal_PtrArray *devices; // struct HostDevice
+    uint64_t slotBytes;
+    uint32_t numberOfSlots;
+    uint32_t *freeSlots;
+    uint32_t numberOfFreeSlots;
+    uint32_t numberArmed;
+    bool applicationGone; // No more slots will be returned
+};
+
+// The device interface functions called by the module carry no context of
+// ours; there is one module per host process
+static struct Server *g_server;
+
+static uint64_t GetDeviceId(OSc_Device *device) {
+    return (uint64_t)(uintptr_t)device;
+}
+
+// Call with the server's mutex held
+static struct HostDevice *FindHostDevice(struct Server *s, uint64_t id) {
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(s->devices); ++i) {
+        struct HostDevice *hd = OScInternal_PtrArray_At(s->devices, i);
+        if (GetDeviceId(hd->device) == id)
+            return hd;
+    }
+    return NULL;
+}
+
+static bool PostEvent(struct Server *s, struct Buffer *event) {
+    OScInternal_Mutex_Lock(&s->eventMutex);
+    bool ok = SendMessage(s->ends.eventsOut, event);
+    OScInternal_Mutex_Unlock(&s->eventMutex);
+    Buffer_Free(event);
+    return ok;
+}
+
+// Call with the server's mutex held
+static void LayOutPool(struct Server *s, uint64_t slotBytes) {
+    uint64_t numberOfSlots = s->ends.poolBytes / slotBytes;
+    if (numberOfSlots > s->maxSlots)
+        numberOfSlots = s->maxSlots;
+    s->slotBytes = slotBytes;
+    s->numberOfSlots = (uint32_t)numberOfSlots;
+    // Hand out the lowest slots first
+    for (uint32_t i = 0; i < s->numberOfSlots; ++i)
+        s->freeSlots[i] = s->numberOfSlots - 1 - i;
+    s->numberOfFreeSlots = s->numberOfSlots;
+}
+
+// Make the slots large enough for frames of 'frameBytes'
+static OSc_RichError *ReserveSlots(struct Server *s, size_t frameBytes) {
+    uint64_t slotBytes = ((uint64_t)frameBytes + 63) / 64 * 64;
+    if (slotBytes < MIN_SLOT_BYTES)
+        slotBytes = MIN_SLOT_BYTES;
+
+    OScInternal_Mutex_Lock(&s->mutex);
+    if (slotBytes <= s->slotBytes) {
+        OScInternal_Mutex_Unlock(&s->mutex);
+        return OSc_OK;
+    }
+    if (s->ends.poolBytes / slotBytes < 2 || s->numberArmed > 0) {
+        OScInternal_Mutex_Unlock(&s->mutex);
+        char message[256];
+        snprintf(message, sizeof(message),
+                 "Frames of %zu bytes do not fit in the device module host "
+                 "buffer pool of %" PRIu64 " bytes%s",
+                 frameBytes, s->ends.poolBytes,
+                 s->numberArmed > 0 ? " while another device is armed" : "");
+        return OScInternal_Error_Create(message);
+    }
+    // Slots still out belong to the current layout
+    while (s->numberOfFreeSlots < s->numberOfSlots && !s->applicationGone)
+        OScInternal_Cond_Wait(&s->slotFreed, &s->mutex);
+    LayOutPool(s, slotBytes);
+    OScInternal_Mutex_Unlock(&s->mutex);
+    return OSc_OK;
+}
+
+static bool AcquireSlot(struct Server *s, uint32_t *slot, uint64_t *offset,
+                        uint64_t *slotBytes) {
+    OScInternal_Mutex_Lock(&s->mutex);
+    while (s->numberOfFreeSlots == 0 && s->numberOfSlots > 0 &&
+           !s->applicationGone)
+        OScInternal_Cond_Wait(&s->slotFreed, &s->mutex);
+    bool ok = s->numberOfFreeSlots > 0 && !s->applicationGone;
+    if (ok) {
+        *slot = s->freeSlots[--s->numberOfFreeSlots];
+        *offset = *slot * s->slotBytes;
+        *slotBytes = s->slotBytes;
+    }
+    OScInternal_Mutex_Unlock(&s->mutex);
+    return ok;
+}
+
+static void ReturnSlot(struct Server *s, uint32_t slot) {
+    OScInternal_Mutex_Lock(&s->mutex);
+    if (slot < s->numberOfSlots && s->numberOfFreeSlots < s->numberOfSlots)
+        s->freeSlots[s->numberOfFreeSlots++] = slot;
+    OScInternal_Cond_Broadcast(&s->slotFreed);
+    OScInternal_Mutex_Unlock(&s->mutex);
+}
+
+// Receive returned slots until the application closes the event channel
+static void ReceiveReleases(void *data) {
+    struct Server *s = data;
+    struct Buffer event;
+    while (ReceiveMessage(s->ends.eventsIn, &event)) {
+        if (GetU32(&event) == EVENT_RELEASE) {
+            uint32_t slot = GetU32(&event);
+            uint64_t id = GetU64(&event);
+            bool shouldContinue = GetU32(&event) != 0;
+            if (!event.overrun) {
+                if (!shouldContinue) {
+                    OScInternal_Mutex_Lock(&s->mutex);
+                    struct HostDevice *hd = FindHostDevice(s, id);
+                    if (hd)
+                        hd->acq.cancelled = true;
+                    OScInternal_Mutex_Unlock(&s->mutex);
+                }
+                ReturnSlot(s, slot);
+            }
+        }
+        Buffer_Free(&event);
+    }
+
+    OScInternal_Mutex_Lock(&s->mutex);
+    s->applicationGone = true;
+    OScInternal_Cond_Broadcast(&s->slotFreed);
+    OScInternal_Mutex_Unlock(&s->mutex);
+}
+
+static struct HostAcquisition *GetHostAcquisition(OScDev_Acquisition *acq) {
+    return (struct HostAcquisition *)acq;
+}
+
+static void HostLog(OScDev_ModuleImpl *modImpl, OScDev_Device *device,
+                    OScDev_LogLevel level, const char *message) {
+    (void)modImpl;
+    struct Buffer event;
+    BeginMessage(&event, EVENT_LOG);
+    PutU64(&event, GetDeviceId(device));
+    PutI32(&event, level);
+    PutString(&event, message);
+    PostEvent(g_server, &event);
+}
+
+static OScDev_Error HostIsClockRequested(OScDev_ModuleImpl *modImpl,
+                                         OScDev_Acquisition *acq,
+                                         bool *isRequested) {
+    (void)modImpl;
+    *isRequested = GetHostAcquisition(acq)->clockRequested;
+    return OScDev_OK;
+}
+
+static OScDev_Error HostIsScannerRequested(OScDev_ModuleImpl *modImpl,
+                                           OScDev_Acquisition *acq,
+                                           bool *isRequested) {
+    (void)modImpl;
+    *isRequested = GetHostAcquisition(acq)->scannerRequested;
+    return OScDev_OK;
+}
+
+static OScDev_Error HostIsDetectorRequested(OScDev_ModuleImpl *modImpl,
+                                            OScDev_Acquisition *acq,
+                                            bool *isRequested) {
+    (void)modImpl;
+    *isRequested = GetHostAcquisition(acq)->detectorRequested;
+    return OScDev_OK;
+}
+
+static OScDev_Error
+HostGetClockStartTriggerSource(OScDev_ModuleImpl *modImpl,
+                               OScDev_Acquisition *acq,
+                               OScDev_TriggerSource *startTrigger) {
+    (void)modImpl;
+    *startTrigger = GetHostAcquisition(acq)->startTrigger;
+    return OScDev_OK;
+}
+
+static OScDev_Error HostGetClockSource(OScDev_ModuleImpl *modImpl,
+                                       OScDev_Acquisition *acq,
+                                       OScDev_ClockSource *clock) {
+    (void)modImpl;
+    *clock = GetHostAcquisition(acq)->clockSource;
+    return OScDev_OK;
+}
+
+static uint32_t HostGetNumberOfFrames(OScDev_ModuleImpl *modImpl,
+                                      OScDev_Acquisition *acq) {
+    (void)modImpl;
+    return GetHostAcquisition(acq)->numberOfFrames;
+}
+
+static double HostGetPixelRate(OScDev_ModuleImpl *modImpl,
+                               OScDev_Acquisition *acq) {
+    (void)modImpl;
+    return GetHostAcquisition(acq)->pixelRate;
+}
+
+static uint32_t HostGetResolution(OScDev_ModuleImpl *modImpl,
+                                  OScDev_Acquisition *acq) {
+    (void)modImpl;
+    return GetHostAcquisition(acq)->resolution;
+}
+
+static double HostGetZoomFactor(OScDev_ModuleImpl *modImpl,
+                                OScDev_Acquisition *acq) {
+    (void)modImpl;
+    return GetHostAcquisition(acq)->zoomFactor;
+}
+
+static void HostGetROI(OScDev_ModuleImpl *modImpl, OScDev_Acquisition *acq,
+                       uint32_t *xOffset, uint32_t *yOffset, uint32_t *width,
+                       uint32_t *height) {
+    (void)modImpl;
+    struct HostAcquisition *a = GetHostAcquisition(acq);
+    *xOffset = a->xOffset;
+    *yOffset = a->yOffset;
+    *width = a->width;
+    *height = a->height;
+}
+
+static uint32_t HostGetSamplesPerPixel(OScDev_ModuleImpl *modImpl,
+                                       OScDev_Acquisition *acq) {
+    (void)modImpl;
+    return GetHostAcquisition(acq)->samplesPerPixel;
+}
+
+// Copy the frame into the pool; the application's result arrives
+// asynchronously, and stops the acquisition at a later frame
+static bool HostCallFrameCallback(OScDev_ModuleImpl *modImpl,
+                                  OScDev_Acquisition *acq, uint32_t channel,
+                                  void *pixels) {
+    (void)modImpl;
+    struct HostAcquisition *a = GetHostAcquisition(acq);
+    if (channel >= a->numberOfChannels || a->cancelled)
+        return false;
+    uint32_t slot;
+    uint64_t offset, slotBytes;
+    if (!AcquireSlot(g_server, &slot, &offset, &slotBytes))
+        return false;
+    if (a->channelBytes[channel] > slotBytes) {
+        ReturnSlot(g_server, slot);
+        return false;
+    }
+    memcpy(g_server->pool + offset, pixels, a->channelBytes[channel]);
+
+    struct Buffer event;
+    BeginMessage(&event, EVENT_FRAME);
+    PutU64(&event, GetDeviceId(a->device->device));
+    PutU32(&event, channel);
+    PutU32(&event, slot);
+    PutU64(&event, offset);
+    PutU64(&event, a->channelBytes[channel]);
+    if (!PostEvent(g_server, &event)) {
+        ReturnSlot(g_server, slot);
+        return false;
+    }
+    return !a->cancelled;
+}
+
+static bool HostCallTimeTagCallback(OScDev_ModuleImpl *modImpl,
+                                    OScDev_Acquisition *acq,
+                                    const uint64_t *timeTags, size_t count) {
+    (void)modImpl;
+    struct HostAcquisition *a = GetHostAcquisition(acq);
+    while (count > 0 && !a->cancelled) {
+        uint32_t slot;
+        uint64_t offset, slotBytes;
+        if (!AcquireSlot(g_server, &slot, &offset, &slotBytes))
+            return false;
+        size_t n = (size_t)(slotBytes / sizeof(uint64_t));
+        if (n > count)
+            n = count;
+        memcpy(g_server->pool + offset, timeTags, n * sizeof(uint64_t));
+
+        struct Buffer event;
+        BeginMessage(&event, EVENT_TIME_TAGS);
+        PutU64(&event, GetDeviceId(a->device->device));
+        PutU32(&event, slot);
+        PutU64(&event, offset);
+        PutU64(&event, n);
+        if (!PostEvent(g_server, &event)) {
+            ReturnSlot(g_server, slot);
+            return false;
+        }
+        timeTags += n;
+        count -= n;
+    }
+    return !a->cancelled;
+}
+
+static void WaitForAcquisition(void *data) {
+    struct HostDevice *hd = data;
+    struct Server *s = g_server;
+    hd->impl->Wait(hd->device);
+
+    OScInternal_Mutex_Lock(&s->mutex);
+    hd->armed = false;
+    --s->numberArmed;
+    OScInternal_Mutex_Unlock(&s->mutex);
+
+    struct Buffer event;
+    BeginMessage(&event, EVENT_IDLE);
+    PutU64(&event, GetDeviceId(hd->device));
+    PostEvent(s, &event);
+}
+
+static OSc_RichError *Arm(struct Server *s, struct HostDevice *hd,
+                          struct Buffer *request) {
+    OScInternal_Mutex_Lock(&s->mutex);
+    bool armed = hd->armed;
+    OScInternal_Mutex_Unlock(&s->mutex);
+    if (armed)
+        return OScInternal_Error_Create("Device is already armed");
+    if (hd->hasWaiter) {
+        OScInternal_Thread_Join(hd->waiter);
+        hd->hasWaiter = false;
+    }
+
+    struct HostAcquisition *a = &hd->acq;
+    free(a->channelBytes);
+    memset(a, 0, sizeof(*a));
+    a->device = hd;
+    a->clockRequested = GetU32(request) != 0;
+    a->scannerRequested = GetU32(request) != 0;
+    a->detectorRequested = GetU32(request) != 0;
+    a->startTrigger = GetI32(request);
+    a->clockSource = GetI32(request);
+    a->numberOfFrames = GetU32(request);
+    a->pixelRate = GetF64(request);
+    a->resolution = GetU32(request);
+    a->zoomFactor = GetF64(request);
+    a->xOffset = GetU32(request);
+    a->yOffset = GetU32(request);
+    a->width = GetU32(request);
+    a->height = GetU32(request);
+    a->samplesPerPixel = GetU32(request);
+    if (request->overrun)
+        return OScInternal_Error_IllegalArgument();
+
+    OSc_RichError *err;
+    if (a->detectorRequested) {
+        if (OSc_CHECK_ERROR(err, OScInternal_Device_GetNumberOfChannels(
+                                     hd->device, &a->numberOfChannels)))
+            return err;
+        a->channelBytes = calloc(a->numberOfChannels, sizeof(size_t));
+        size_t numberOfSamples =
+            (size_t)a->width * a->height * a->samplesPerPixel;
+        size_t maxBytes = 0;
+        for (uint32_t ch = 0; ch < a->numberOfChannels; ++ch) {
+            OSc_SampleFormat format;
+            if (OSc_CHECK_ERROR(err, OScInternal_Device_GetSampleFormat(
+                                         hd->device, ch, &format)))
+                return err;
+            a->channelBytes[ch] =
+                OScInternal_SampleFormat_GetBufferSize(format,
+                                                       numberOfSamples);
+            if (a->channelBytes[ch] > maxBytes)
+                maxBytes = a->channelBytes[ch];
+        }
+        if (OSc_CHECK_ERROR(err, ReserveSlots(s, maxBytes)))
+            return err;
+    }
+
+    OScDev_Error errCode =
+        hd->impl->Arm(hd->device, (OScDev_Acquisition *)a);
+    if (errCode)
+        return OScInternal_Error_RetrieveFromDevice(hd->device, errCode);
+
+    OScInternal_Mutex_Lock(&s->mutex);
+    hd->armed = true;
+    ++s->numberArmed;
+    OScInternal_Mutex_Unlock(&s->mutex);
+    hd->hasWaiter =
+        OScInternal_Thread_Create(&hd->waiter, WaitForAcquisition, hd);
+    if (!hd->hasWaiter) {
+        hd->impl->Stop(hd->device);
+        hd->impl->Wait(hd->device);
+        OScInternal_Mutex_Lock(&s->mutex);
+        hd->armed = false;
+        --s->numberArmed;
+        OScInternal_Mutex_Unlock(&s->mutex);
+        return OScInternal_Error_OutOfMemory();
+    }
+    return OSc_OK;
+}
+
+static void ReleaseDevice(struct Server *s, struct HostDevice *hd) {
+    if (hd->hasWaiter) {
+        OScInternal_Mutex_Lock(&s->mutex);
+        bool armed = hd->armed;
+        OScInternal_Mutex_Unlock(&s->mutex);
+        if (armed)
+            hd->impl->Stop(hd->device);
+        OScInternal_Thread_Join(hd->waiter);
+    }
+
+    OScInternal_Mutex_Lock(&s->mutex);
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(s->devices); ++i) {
+        if (OScInternal_PtrArray_At(s->devices, i) == hd) {
+            OScInternal_PtrArray_Remove(s->devices, i);
+            break;
+        }
+    }
+    OScInternal_Mutex_Unlock(&s->mutex);
+
+    OScInternal_Device_Destroy(hd->device);
+    free(hd->acq.channelBytes);
+    free(hd);
+}
+
+static OSc_RichError *EnumerateInstances(struct Server *s,
+                                         struct Buffer *request,
+                                         struct Buffer *reply) {
+    uint32_t index = GetU32(request);
+    if (request->overrun || !s->impls ||
+        index >= OScInternal_PtrArray_Size(s->impls))
+        return OScInternal_Error_IllegalArgument();
+    OScDev_DeviceImpl *impl = OScInternal_PtrArray_At(s->impls, index);
+
+    OScInternal_PtrArray *devices = NULL;
+    OScDev_Error errCode = impl->EnumerateInstances(&devices);
+    if (errCode)
+        return OScInternal_Error_RetrieveFromModule(s->modImpl, errCode);
+
+    size_t count = OScInternal_PtrArray_Size(devices);
+    PutU32(reply, (uint32_t)count);
+    for (size_t i = 0; i < count; ++i) {
+        struct HostDevice *hd = calloc(1, sizeof(struct HostDevice));
+        hd->device = OScInternal_PtrArray_At(devices, i);
+        hd->impl = impl;
+        OScInternal_Mutex_Lock(&s->mutex);
+        OScInternal_PtrArray_Append(s->devices, hd);
+        OScInternal_Mutex_Unlock(&s->mutex);
+        PutU64(reply, GetDeviceId(hd->device));
+    }
+    OScInternal_PtrArray_Destroy(devices);
+    return OSc_OK;
+}
+
+static OSc_RichError *HandleHello(struct Server *s, struct Buffer *reply) {
+    if (!s->entryPoint)
+        return OScInternal_Error_Create(s->loadError);
+
+    if (!s->modImpl) {
+        struct OScDevInternal_Interface **funcTablePtr;
+        OScDev_ModuleImpl *modImpl;
+        uint32_t dpiVersion = s->entryPoint(&funcTablePtr, &modImpl);
+        // Older minor versions are accepted as when loading in process
+        // (OScInternal_DeviceModule_GetDeviceImpls())
+        if ((dpiVersion >> 16) != (OScDevInternal_ABI_VERSION >> 16) ||
+            (dpiVersion & 0xffff) > (OScDevInternal_ABI_VERSION & 0xffff)) {
+            return OScInternal_Error_Create(
+                "Device module was built for an incompatible version of "
+                "OpenScanDeviceLib");
+        }
+        OScInternal_Module_SetABIVersion(modImpl, dpiVersion);
+        *funcTablePtr = &s->devif;
+        s->modImpl = modImpl;
+
+        OScDev_Error errCode;
+        if (modImpl->Open) {
+            errCode = modImpl->Open();
+            if (errCode)
+                return OScInternal_Error_RetrieveFromModule(modImpl,
+                                                            errCode);
+        }
+        s->opened = true;
+
+        errCode = modImpl->GetDeviceImpls(&s->impls);
+        if (errCode)
+            return OScInternal_Error_RetrieveFromModule(modImpl, errCode);
+    }
+
+    size_t count = OScInternal_PtrArray_Size(s->impls);
+    PutU32(reply, (uint32_t)count);
+    for (size_t i = 0; i < count; ++i) {
+        OScDev_DeviceImpl *impl = OScInternal_PtrArray_At(s->impls, i);
+        const char *name = NULL;
+        impl->GetModelName(&name);
+        PutString(reply, name ? name : "");
+    }
+    return OSc_OK;
+}
+
+static OSc_RichError *ReplyRange(struct Buffer *reply,
+                                 OScInternal_NumRange *range) {
+    PutRange(reply, range);
+    OScInternal_NumRange_Destroy(range);
+    return OSc_OK;
+}
+
+static OSc_RichError *HandleDeviceRequest(struct Server *s, uint32_t op,
+                                          struct Buffer *request,
+                                          struct Buffer *reply) {
+    uint64_t id = GetU64(request);
+    OScInternal_Mutex_Lock(&s->mutex);
+    struct HostDevice *hd = FindHostDevice(s, id);
+    OScInternal_Mutex_Unlock(&s->mutex);
+    if (!hd || request->overrun)
+        return OScInternal_Error_IllegalArgument();
+    OSc_Device *device = hd->device;
+
+    OSc_RichError *err;
+    OScDev_Error errCode;
+    bool b;
+    uint32_t u;
+    switch (op) {
+    case OP_RELEASE_INSTANCE:
+        ReleaseDevice(s, hd);
+        return OSc_OK;
+    case OP_GET_NAME: {
+        char name[OScDev_MAX_STR_SIZE] = "";
+        errCode = hd->impl->GetName(device, name);
+        PutString(reply, name);
+        return OScInternal_Error_RetrieveFromDevice(device, errCode);
+    }
+    case OP_OPEN:
+        errCode = hd->impl->Open(device);
+        return OScInternal_Error_RetrieveFromDevice(device, errCode);
+    case OP_CLOSE:
+        errCode = hd->impl->Close(device);
+        return OScInternal_Error_RetrieveFromDevice(device, errCode);
+    case OP_HAS_CLOCK:
+        err = OSc_Device_HasClock(device, &b);
+        PutU32(reply, b);
+        return err;
+    case OP_HAS_SCANNER:
+        err = OSc_Device_HasScanner(device, &b);
+        PutU32(reply, b);
+        return err;
+    case OP_HAS_DETECTOR:
+        err = OSc_Device_HasDetector(device, &b);
+        PutU32(reply, b);
+        return err;
+    case OP_MAKE_SETTINGS: {
+        OSc_Setting **settings;
+        size_t count;
+        if (OSc_CHECK_ERROR(err,
+                            OSc_Device_GetSettings(device, &settings, &count)))
+            return err;
+        PutU32(reply, (uint32_t)count);
+        for (size_t i = 0; i < count; ++i) {
+            char name[OScDev_MAX_STR_SIZE] = "";
+            OSc_ValueType valueType;
+            OSc_Setting_GetName(settings[i], name);
+            OSc_Setting_GetValueType(settings[i], &valueType);
+            PutU64(reply, (uint64_t)(uintptr_t)settings[i]);
+            PutString(reply, name);
+            PutI32(reply, valueType);
+        }
+        return OSc_OK;
+    }
+    case OP_GET_PIXEL_RATES:
+        return ReplyRange(reply, OScInternal_Device_GetPixelRates(device));
+    case OP_GET_ACTUAL_PIXEL_RATE: {
+        double nominal = GetF64(request);
+        double actual = nominal;
+        errCode = OScDev_OK;
+        if (hd->impl->GetActualPixelRate)
+            errCode = hd->impl->GetActualPixelRate(device, nominal, &actual);
+        PutF64(reply, actual);
+        return OScInternal_Error_RetrieveFromDevice(device, errCode);
+    }
+    case OP_GET_RESOLUTIONS:
+        return ReplyRange(reply, OScInternal_Device_GetResolutions(device));
+    case OP_GET_ZOOM_FACTORS:
+        return ReplyRange(reply, OScInternal_Device_GetZooms(device));
+    case OP_IS_ROI_SCAN_SUPPORTED:
+        PutU32(reply, OScInternal_Device_IsROIScanSupported(device));
+        return OSc_OK;
+    case OP_GET_RASTER_WIDTHS:
+        return ReplyRange(reply, OScInternal_Device_GetRasterWidths(device));
+    case OP_GET_RASTER_HEIGHTS:
+        return ReplyRange(reply,
+                          OScInternal_Device_GetRasterHeights(device));
+    case OP_GET_NUMBER_OF_CHANNELS:
+        err = OScInternal_Device_GetNumberOfChannels(device, &u);
+        PutU32(reply, u);
+        return err;
+    case OP_GET_BYTES_PER_SAMPLE:
+        err = OScInternal_Device_GetBytesPerSample(device, &u);
+        PutU32(reply, u);
+        return err;
+    case OP_GET_SAMPLE_FORMAT: {
+        OSc_SampleFormat format = 0;
+        err = OScInternal_Device_GetSampleFormat(device, GetU32(request),
+                                                 &format);
+        PutI32(reply, format);
+        return err;
+    }
+    case OP_ARM:
+        return Arm(s, hd, request);
+    case OP_START:
+        errCode = hd->impl->Start(device);
+        return OScInternal_Error_RetrieveFromDevice(device, errCode);
+    case OP_STOP:
+        errCode = hd->impl->Stop(device);
+        return OScInternal_Error_RetrieveFromDevice(device, errCode);
+    }
+    return OScInternal_Error_UnsupportedOperation();
+}
+
+static OSc_RichError *HandleSettingRequest(uint32_t op,
+                                           struct Buffer *request,
+                                           struct Buffer *reply) {
+    // Settings are identified by their address in this process
+    OSc_Setting *setting = (OSc_Setting *)(uintptr_t)GetU64(request);
+    if (!setting || request->overrun)
+        return OScInternal_Error_IllegalArgument();
+
+    OSc_RichError *err;
+    char str[OScDev_MAX_STR_SIZE] = "";
+    bool b;
+    int32_t i32, i32Max;
+    uint32_t u32;
+    double f64, f64Max;
+    switch (op) {
+    case OP_SETTING_IS_ENABLED:
+        err = OSc_Setting_IsEnabled(setting, &b);
+        PutU32(reply, b);
+        return err;
+    case OP_SETTING_IS_WRITABLE:
+        err = OSc_Setting_IsWritable(setting, &b);
+        PutU32(reply, b);
+        return err;
+    case OP_SETTING_GET_NUMERIC_CONSTRAINT_TYPE: {
+        OSc_ValueConstraint constraintType;
+        err = OSc_Setting_GetNumericConstraintType(setting, &constraintType);
+        PutU32(reply, (uint32_t)constraintType);
+        return err;
+    }
+    case OP_SETTING_GET_STRING:
+        err = OSc_Setting_GetStringValue(setting, str);
+        PutString(reply, str);
+        return err;
+    case OP_SETTING_SET_STRING:
+        GetString(request, str, sizeof(str));
+        return OSc_Setting_SetStringValue(setting, str);
+    case OP_SETTING_GET_BOOL:
+        err = OSc_Setting_GetBoolValue(setting, &b);
+        PutU32(reply, b);
+        return err;
+    case OP_SETTING_SET_BOOL:
+        return OSc_Setting_SetBoolValue(setting, GetU32(request) != 0);
+    case OP_SETTING_GET_INT32:
+        err = OSc_Setting_GetInt32Value(setting, &i32);
+        PutI32(reply, i32);
+        return err;
+    case OP_SETTING_SET_INT32:
+        return OSc_Setting_SetInt32Value(setting, GetI32(request));
+    case OP_SETTING_GET_INT32_RANGE:
+        err = OSc_Setting_GetInt32ContinuousRange(setting, &i32, &i32Max);
+        PutI32(reply, i32);
+        PutI32(reply, i32Max);
+        return err;
+    case OP_SETTING_GET_INT32_DISCRETE_VALUES: {
+        int32_t *values;
+        size_t count;
+        if (OSc_CHECK_ERROR(err, OSc_Setting_GetInt32DiscreteValues(
+                                     setting, &values, &count)))
+            return err;
+        PutU32(reply, (uint32_t)count);
+        for (size_t i = 0; i < count; ++i)
+            PutF64(reply, values[i]);
+        return OSc_OK;
+    }
+    case OP_SETTING_GET_FLOAT64:
+        err = OSc_Setting_GetFloat64Value(setting, &f64);
+        PutF64(reply, f64);
+        return err;
+    case OP_SETTING_SET_FLOAT64:
+        return OSc_Setting_SetFloat64Value(setting, GetF64(request));
+    case OP_SETTING_GET_FLOAT64_RANGE:
+        err = OSc_Setting_GetFloat64ContinuousRange(setting, &f64, &f64Max);
+        PutF64(reply, f64);
+        PutF64(reply, f64Max);
+        return err;
+    case OP_SETTING_GET_FLOAT64_DISCRETE_VALUES: {
+        double *values;
+        size_t count;
+        if (OSc_CHECK_ERROR(err, OSc_Setting_GetFloat64DiscreteValues(
+                                     setting, &values, &count)))
+            return err;
+        PutU32(reply, (uint32_t)count);
+        for (size_t i = 0; i < count; ++i)
+            PutF64(reply, values[i]);
+        return OSc_OK;
+    }
+    case OP_SETTING_GET_ENUM:
+        err = OSc_Setting_GetEnumValue(setting, &u32);
+        PutU32(reply, u32);
+        return err;
+    case OP_SETTING_SET_ENUM:
+        return OSc_Setting_SetEnumValue(setting, GetU32(request));
+    case OP_SETTING_GET_ENUM_NUM_VALUES:
+        err = OSc_Setting_GetEnumNumValues(setting, &u32);
+        PutU32(reply, u32);
+        return err;
+    case OP_SETTING_GET_ENUM_NAME_FOR_VALUE:
+        err = OSc_Setting_GetEnumNameForValue(setting, GetU32(request), str);
+        PutString(reply, str);
+        return err;
+    case OP_SETTING_GET_ENUM_VALUE_FOR_NAME:
+        GetString(request, str, sizeof(str));
+        u32 = 0;
+        err = OSc_Setting_GetEnumValueForName(setting, &u32, str);
+        PutU32(reply, u32);
+        return err;
+    }
+    return OScInternal_Error_UnsupportedOperation();
+}
+
+static OSc_RichError *HandleRequest(struct Server *s, uint32_t op,
+                                    struct Buffer *request,
+                                    struct Buffer *reply) {
+    if (op == OP_HELLO)
+        return HandleHello(s, reply);
+    if (!s->modImpl)
+        return OScInternal_Error_IllegalArgument();
+    if (op == OP_ENUMERATE_INSTANCES)
+        return EnumerateInstances(s, request, reply);
+    if (op >= OP_FIRST_SETTING_OP)
+        return HandleSettingRequest(op, request, reply);
+    if (op >= OP_FIRST_DEVICE_OP)
+        return HandleDeviceRequest(s, op, request, reply);
+    return OScInternal_Error_UnsupportedOperation();
+}
+
+static void Shutdown(struct Server *s) {
+    while (!OScInternal_PtrArray_Empty(s->devices))
+        ReleaseDevice(s, OScInternal_PtrArray_At(s->devices, 0));
+    if (s->opened && s->modImpl->Close)
+        s->modImpl->Close();
+    if (s->impls)
+        OScInternal_PtrArray_Destroy(s->impls);
+}
+
+int OScInternal_ModuleHost_Serve(struct OScInternal_ModuleHostEndpoints *ends,
+                                 OScDevInternal_EntryPointPtr entryPoint,
+                                 const char *loadError) {
+    struct Server *s = calloc(1, sizeof(struct Server));
+    s->ends = *ends;
+    InitEndpoints(ends);
+    s->entryPoint = entryPoint;
+    s->loadError = loadError ? loadError : "Cannot load device module";
+
+    s->devif = DeviceInterfaceFunctionTable;
+    s->devif.Log = HostLog;
+    s->devif.Acquisition_IsClockRequested = HostIsClockRequested;
+    s->devif.Acquisition_IsScannerRequested = HostIsScannerRequested;
+    s->devif.Acquisition_IsDetectorRequested = HostIsDetectorRequested;
+    s->devif.Acquisition_GetClockStartTriggerSource =
+        HostGetClockStartTriggerSource;
+    s->devif.Acquisition_GetClockSource = HostGetClockSource;
+    s->devif.Acquisition_GetNumberOfFrames = HostGetNumberOfFrames;
+    s->devif.Acquisition_GetPixelRate = HostGetPixelRate;
+    s->devif.Acquisition_GetResolution = HostGetResolution;
+    s->devif.Acquisition_GetZoomFactor = HostGetZoomFactor;
+    s->devif.Acquisition_GetROI = HostGetROI;
+    s->devif.Acquisition_CallFrameCallback = HostCallFrameCallback;
+    s->devif.Acquisition_GetSamplesPerPixel = HostGetSamplesPerPixel;
+    s->devif.Acquisition_CallTimeTagCallback = HostCallTimeTagCallback;
+
+    int status = 1;
+    if (MapPool(s->ends.pool, s->ends.poolBytes, &s->pool) != 0)
+        goto Cleanup;
+    uint64_t maxSlots = s->ends.poolBytes / MIN_SLOT_BYTES;
+    s->maxSlots = maxSlots > UINT32_MAX ? UINT32_MAX : (uint32_t)maxSlots;
+    s->freeSlots = malloc(sizeof(uint32_t) * (s->maxSlots + 1));
+    LayOutPool(s, MIN_SLOT_BYTES);
+
+    OScInternal_Mutex_Init(&s->eventMutex);
+    OScInternal_Mutex_Init(&s->mutex);
+    OScInternal_Cond_Init(&s->slotFreed);
+    s->devices = OScInternal_PtrArray_Create();
+    g_server = s;
+    if (!OScInternal_Thread_Create(&s->releaseThread, ReceiveReleases, s))
+        goto Cleanup;
+
+    struct Buffer request;
+    while (ReceiveMessage(s->ends.controlIn, &request)) {
+        uint32_t op = GetU32(&request);
+        struct Buffer reply;
+        BeginMessage(&reply, STATUS_OK);
+        OSc_RichError *err = HandleRequest(s, op, &request, &reply);
+        Buffer_Free(&request);
+        if (err) {
+            char message[1024];
+            OScInternal_Error_FormatRecursive(err, message, sizeof(message));
+            OScInternal_Error_Destroy(err);
+            Buffer_Free(&reply);
+            BeginMessage(&reply, STATUS_ERROR);
+            PutString(&reply, message);
+        }
+        bool sent = SendMessage(s->ends.controlOut, &reply);
+        Buffer_Free(&reply);
+        if (!sent)
+            break;
+    }
+    status = 0;
+
+    // The application has disconnected
+    Shutdown(s);
+    ShutdownOutput(&s->ends.eventsOut, s->ends.eventsIn);
+    OScInternal_Thread_Join(s->releaseThread);
+
+Cleanup:
+    g_server = NULL;
+    if (s->devices) {
+        OScInternal_PtrArray_Destroy(s->devices);
+        OScInternal_Cond_Destroy(&s->slotFreed);
+        OScInternal_Mutex_Destroy(&s->mutex);
+        OScInternal_Mutex_Destroy(&s->eventMutex);
+    }
+    OScInternal_ModuleHost_CloseEndpoints(&s->ends);
+    UnmapPool(s->pool, s->ends.poolBytes);
+    free(s->freeSlots);
+    free(s);
+    return status;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+#define OScDevInternal_BUILDING_OPENSCANLIB 1
+#include "OpenScanDeviceLibPrivate.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Out-of-process device module host.
+ *
+ * In host mode (OSc_SetDeviceModuleHost()), each device module is loaded in
+ * its own child process (the OpenScanDeviceHost executable) rather than in
+ * the application, so that a crash in a device module or a vendor library
+ * does not take the application down with it. The application sees proxy
+ * device implementations whose functions are forwarded to the host, one
+ * synchronous request and reply per call, over a local stream channel (a
+ * socket pair, or a pair of anonymous pipes on Windows).
+ *
+ * Frames do not travel over the channel. The application creates a buffer
+ * pool in shared memory, which the host inherits. When the module delivers a
+ * frame, the host copies it into a free slot of the pool and posts the
+ * slot's location on a second (event) channel; the application passes the
+ * frame to the acquisition directly from the pool, then returns the slot,
+ * along with the frame callback's result. Time tags and log messages travel
+ * on the event channel, as does the end of each acquisition (when the
+ * module's Wait() returns in the host), so that IsRunning() and Wait() are
+ * answered without a round trip.
+ *
+ * If the host process exits, calls to its devices fail and acquisitions it
+ * was running finish.
+ */
+
+#define OScInternal_MODULE_HOST_DEFAULT_POOL_BYTES (64 * 1024 * 1024)
+
+// Handles (file descriptors on POSIX) of one side of the channels. On
+// POSIX, each channel is one socket, so that the 'In' and 'Out' handles are
+// equal.
+struct OScInternal_ModuleHostEndpoints {
+    intptr_t controlIn;  // Requests (host) or replies (application)
+    intptr_t controlOut; // Replies (host) or requests (application)
+    intptr_t eventsIn;
+    intptr_t eventsOut;
+    intptr_t pool; // Shared memory of the buffer pool
+    uint64_t poolBytes;
+};
+
+typedef struct OScInternal_ModuleHost OScInternal_ModuleHost;
+
+// Create connected endpoints for the application and the host, and a buffer
+// pool of 'poolBytes'
+OSc_RichError *OScInternal_ModuleHost_CreateEndpoints(
+    struct OScInternal_ModuleHostEndpoints *application,
+    struct OScInternal_ModuleHostEndpoints *host, uint64_t poolBytes);
+
+void OScInternal_ModuleHost_CloseEndpoints(
+    struct OScInternal_ModuleHostEndpoints *ends);
+
+// Start the host executable at 'hostPath' to load the module at
+// 'modulePath', and connect to it
+OSc_RichError *OScInternal_ModuleHost_Spawn(OScInternal_ModuleHost **host,
+                                            const char *hostPath,
+                                            const char *modulePath,
+                                            uint64_t poolBytes);
+
+// Connect to a host serving at the other side of 'ends' (which are taken
+// over, even on error). The host's devices reach their acquisitions through
+// 'devif' (normally &DeviceInterfaceFunctionTable).
+OSc_RichError *
+OScInternal_ModuleHost_Connect(OScInternal_ModuleHost **host,
+                               struct OScInternal_ModuleHostEndpoints *ends,
+                               struct OScDevInternal_Interface *devif);
+
+// Get the proxy device implementations, in a new array
+OSc_RichError *
+OScInternal_ModuleHost_GetDeviceImpls(OScInternal_ModuleHost *host,
+                                      OScInternal_PtrArray **deviceImpls);
+
+// Disconnect, which makes the host exit, and wait for the host process. All
+// devices of the host must have been destroyed.
+void OScInternal_ModuleHost_Destroy(OScInternal_ModuleHost *host);
+
+// In the host process: parse the command line given by
+// OScInternal_ModuleHost_Spawn()
+bool OScInternal_ModuleHost_ParseArguments(
+    int argc, char **argv, const char **modulePath,
+    struct OScInternal_ModuleHostEndpoints *ends);
+
+// In the host process: serve the module with 'entryPoint' until the
+// application disconnects, and return the exit status. If 'entryPoint' is
+// NULL, the application's requests fail with 'loadError'.
+int OScInternal_ModuleHost_Serve(struct OScInternal_ModuleHostEndpoints *ends,
+                                 OScDevInternal_EntryPointPtr entryPoint,
+                                 const char *loadError);
@@ -0,0 +1,38 @@
+#include "InternalErrors.h"
+#include "Module.h"
+#include "ModuleHost.h"
+
+#include <stdio.h>
+
+/*
+ * The OpenScanDeviceHost executable, which loads one device module on behalf
+ * of an application (see ModuleHost.h). It is started by OpenScanLib, not by
+ * users.
+ */
+
+int main(int argc, char **argv) {
+    const char *modulePath;
+    struct OScInternal_ModuleHostEndpoints ends;
+    if (!OScInternal_ModuleHost_ParseArguments(argc, argv, &modulePath,
+                                               &ends)) {
+        fprintf(stderr, "OpenScanDeviceHost is started by OpenScanLib\n");
+        return 2;
+    }
+
+    // A module that fails to load is reported to the application, through
+    // the channel, when it first calls
+    OScDevInternal_EntryPointPtr entryPoint = NULL;
+    char loadError[1024] = "";
+    OScInternal_Module module;
+    OSc_RichError *err = OScInternal_Module_Load(&module, modulePath);
+    if (!err)
+        err = OScInternal_Module_GetEntryPoint(
+            module, OScDevInternal_ENTRY_POINT_NAME, (void *)&entryPoint);
+    if (err) {
+        OScInternal_Error_FormatRecursive(err, loadError, sizeof(loadError));
+        OScInternal_Error_Destroy(err);
+        entryPoint = NULL;
+    }
+
+    return OScInternal_ModuleHost_Serve(&ends, entryPoint, loadError);
+}
@@ -0,0 +1,514 @@
+#include "OMETiffWriter.h"
+#include "InternalErrors.h"
+#include "SampleFormat.h"
+
+#include <ss8str.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Memory for write buffers, which bounds the data queued for writing
+#define BUFFER_POOL_BYTES (64 * 1024 * 1024)
+#define MIN_BUFFERS 4
+#define MAX_BUFFERS 32
+
+#define INITIAL_PAGE_CAPACITY 1024
+
+// BigTIFF structure
+#define TIFF_VERSION_BIG 43
+#define TIFF_HEADER_BYTES 16
+#define TIFF_ENTRY_BYTES 20
+
+enum {
+    TAG_IMAGE_WIDTH = 256,
+    TAG_IMAGE_LENGTH = 257,
+    TAG_BITS_PER_SAMPLE = 258,
+    TAG_COMPRESSION = 259,
+    TAG_PHOTOMETRIC = 262,
+    TAG_IMAGE_DESCRIPTION = 270,
+    TAG_STRIP_OFFSETS = 273,
+    TAG_SAMPLES_PER_PIXEL = 277,
+    TAG_ROWS_PER_STRIP = 278,
+    TAG_STRIP_BYTE_COUNTS = 279,
+    TAG_PLANAR_CONFIGURATION = 284,
+    TAG_SAMPLE_FORMAT = 339,
+};
+
+enum {
+    TYPE_ASCII = 2,
+    TYPE_SHORT = 3,
+    TYPE_LONG = 4,
+    TYPE_LONG8 = 16,
+};
+
+// Only the first IFD has the ImageDescription
+#define MAX_ENTRIES 12
+// Every IFD takes this many bytes (entry count, entries, next IFD offset) at
+// the start of its record, followed by the pixels
+#define IFD_BYTES (8 + MAX_ENTRIES * TIFF_ENTRY_BYTES + 8)
+
+// A page's channel and (per-channel) frame number
+struct Page {
+    uint32_t channel;
+    uint32_t frame;
+};
+
+// A rewritable record start: the IFD and the pixels sharing its block
+struct Block {
+    uint64_t offset;
+    size_t size;
+    char data[OScInternal_STORAGE_ALIGNMENT];
+};
+
+struct OScInternal_OMETiffWriter {
+    OScInternal_StorageFile *file;
+    struct OScInternal_RecordingInfo info;
+
+    struct Page *pages;
+    size_t numberOfPages;
+    size_t pagesCapacity;
+
+    uint32_t *framesPerChannel; // Next frame number of each channel
+    uint32_t numberOfChannels;
+
+    // Of the first page
+    uint32_t width;
+    uint32_t height;
+    OSc_SampleFormat format;
+
+    struct Block first;
+    struct Block last;
+};
+
+static bool IsLittleEndian(void) {
+    const uint16_t one = 1;
+    return *(const uint8_t *)&one == 1;
+}
+
+static void PutU16(char *p, uint16_t value) {
+    memcpy(p, &value, sizeof(value));
+}
+
+static void PutU64(char *p, uint64_t value) {
+    memcpy(p, &value, sizeof(value));
+}
+
+static char *PutEntry(char *p, uint16_t tag, uint16_t type, uint64_t count,
+                      uint64_t value) {
+    PutU16(p, tag);
+    PutU16(p + 2, type);
+    PutU64(p + 4, count);
+    // Inline values are left-justified in the value field
+    memset(p + 12, 0, 8);
+    if (type == TYPE_SHORT)
+        PutU16(p + 12, (uint16_t)value);
+    else if (type == TYPE_LONG) {
+        uint32_t v = (uint32_t)value;
+        memcpy(p + 12, &v, sizeof(v));
+    } else
+        PutU64(p + 12, value);
+    return p + TIFF_ENTRY_BYTES;
+}
+
+static uint16_t GetTiffSampleFormat(OSc_SampleFormat format) {
+    switch (format) {
+    case OSc_SampleFormat_Int8:
+    case OSc_SampleFormat_Int16:
+    case OSc_SampleFormat_Int32:
+        return 2;
+    case OSc_SampleFormat_Float32:
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+static const char *GetOMEPixelType(OSc_SampleFormat format) {
+    switch (format) {
+    case OSc_SampleFormat_UInt8:
+        return "uint8";
+    case OSc_SampleFormat_UInt12:
+    case OSc_SampleFormat_UInt12Packed: // Unpacked in frames
+    case OSc_SampleFormat_UInt16:
+        return "uint16";
+    case OSc_SampleFormat_UInt32:
+        return "uint32";
+    case OSc_SampleFormat_Int8:
+        return "int8";
+    case OSc_SampleFormat_Int16:
+        return "int16";
+    case OSc_SampleFormat_Int32:
+        return "int32";
+    case OSc_SampleFormat_Float32:
+        return "float";
+    default:
+        return NULL;
+    }
+}
+
+// Fill the IFD of a page whose record starts at 'offset'. The first page
+// gets a placeholder (empty) ImageDescription.
+static void FillIFD(char *ifd, bool isFirst, uint32_t width, uint32_t height,
+                    OSc_SampleFormat format, uint64_t offset,
+                    uint64_t pixelBytes, uint64_t nextOffset) {
+    memset(ifd, 0, IFD_BYTES);
+    uint16_t bits =
+        (uint16_t)(8 * OScInternal_SampleFormat_GetBytesPerSample(format));
+    uint64_t numberOfEntries = isFirst ? MAX_ENTRIES : MAX_ENTRIES - 1;
+    PutU64(ifd, numberOfEntries);
+    char *p = ifd + 8;
+    p = PutEntry(p, TAG_IMAGE_WIDTH, TYPE_LONG, 1, width);
+    p = PutEntry(p, TAG_IMAGE_LENGTH, TYPE_LONG, 1, height);
+    p = PutEntry(p, TAG_BITS_PER_SAMPLE, TYPE_SHORT, 1, bits);
+    p = PutEntry(p, TAG_COMPRESSION, TYPE_SHORT, 1, 1);
+    p = PutEntry(p, TAG_PHOTOMETRIC, TYPE_SHORT, 1, 1); // Black is zero
+    if (isFirst)
+        p = PutEntry(p, TAG_IMAGE_DESCRIPTION, TYPE_ASCII, 1, 0);
+    p = PutEntry(p, TAG_STRIP_OFFSETS, TYPE_LONG8, 1, offset + IFD_BYTES);
+    p = PutEntry(p, TAG_SAMPLES_PER_PIXEL, TYPE_SHORT, 1, 1);
+    p = PutEntry(p, TAG_ROWS_PER_STRIP, TYPE_LONG, 1, height);
+    p = PutEntry(p, TAG_STRIP_BYTE_COUNTS, TYPE_LONG8, 1, pixelBytes);
+    p = PutEntry(p, TAG_PLANAR_CONFIGURATION, TYPE_SHORT, 1, 1);
+    p = PutEntry(p, TAG_SAMPLE_FORMAT, TYPE_SHORT, 1,
+                 GetTiffSampleFormat(format));
+    PutU64(p, nextOffset);
+}
+
+static void SetNextIFD(char *ifd, uint64_t nextOffset) {
+    uint64_t numberOfEntries;
+    memcpy(&numberOfEntries, ifd, sizeof(numberOfEntries));
+    PutU64(ifd + 8 + numberOfEntries * TIFF_ENTRY_BYTES, nextOffset);
+}
+
+// The ImageDescription entry is the sixth, after Photometric
+static void SetDescription(char *ifd, uint64_t count, uint64_t offset) {
+    PutEntry(ifd + 8 + 5 * TIFF_ENTRY_BYTES, TAG_IMAGE_DESCRIPTION,
+             TYPE_ASCII, count, offset);
+}
+
+static void FillHeader(char *header, uint64_t firstIFDOffset) {
+    memcpy(header, IsLittleEndian() ? "II" : "MM", 2);
+    PutU16(header + 2, TIFF_VERSION_BIG);
+    PutU16(header + 4, 8); // Offset size
+    PutU16(header + 6, 0);
+    PutU64(header + 8, firstIFDOffset);
+}
+
+OSc_RichError *OScInternal_OMETiffWriter_Create(
+    OScInternal_OMETiffWriter **writer, const char *path,
+    const struct OScInternal_RecordingInfo *info) {
+    OScInternal_OMETiffWriter *w =
+        calloc(1, sizeof(OScInternal_OMETiffWriter));
+    if (!w)
+        return OScInternal_Error_OutOfMemory();
+    w->info = *info;
+
+    // Buffers hold a whole record when possible, so that each page is
+    // written with a single request
+    uint64_t recordBytes = OScInternal_Storage_Align(
+        IFD_BYTES + OScInternal_RecordingInfo_GetFrameBytes(info));
+    size_t bufferSize = recordBytes < BUFFER_POOL_BYTES / MIN_BUFFERS
+                            ? (size_t)recordBytes
+                            : BUFFER_POOL_BYTES / MIN_BUFFERS;
+    uint32_t numberOfBuffers = (uint32_t)(BUFFER_POOL_BYTES / bufferSize);
+    if (numberOfBuffers > MAX_BUFFERS)
+        numberOfBuffers = MAX_BUFFERS;
+
+    uint64_t expectedSize = 0;
+    if (info->numberOfFrames != UINT32_MAX) {
+        expectedSize = OScInternal_STORAGE_ALIGNMENT +
+                       (uint64_t)info->numberOfFrames *
+                           info->numberOfChannels * recordBytes;
+    }
+
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OScInternal_StorageFile_Create(
+                                 &w->file, path, expectedSize, bufferSize,
+                                 numberOfBuffers))) {
+        free(w);
+        return err;
+    }
+
+    // The first record follows the header block
+    void *buffer;
+    err = OScInternal_StorageFile_GetBuffer(w->file, &buffer);
+    if (!err) {
+        FillHeader(buffer, OScInternal_STORAGE_ALIGNMENT);
+        err = OScInternal_StorageFile_Append(w->file, buffer,
+                                             TIFF_HEADER_BYTES, NULL);
+    }
+    if (err) {
+        OSc_RichError *closeErr = OScInternal_StorageFile_Close(w->file, 0);
+        if (closeErr)
+            OScInternal_Error_Destroy(closeErr);
+        free(w);
+        return err;
+    }
+
+    *writer = w;
+    return OSc_OK;
+}
+
+static bool AddPage(OScInternal_OMETiffWriter *w, uint32_t channel) {
+    if (w->numberOfPages == w->pagesCapacity) {
+        size_t capacity =
+            w->pagesCapacity ? 2 * w->pagesCapacity : INITIAL_PAGE_CAPACITY;
+        struct Page *pages = realloc(w->pages, capacity * sizeof(*pages));
+        if (!pages)
+            return false;
+        w->pages = pages;
+        w->pagesCapacity = capacity;
+    }
+    if (channel >= w->numberOfChannels) {
+        uint32_t *counts =
+            realloc(w->framesPerChannel, (channel + 1) * sizeof(uint32_t));
+        if (!counts)
+            return false;
+        memset(counts + w->numberOfChannels, 0,
+               (channel + 1 - w->numberOfChannels) * sizeof(uint32_t));
+        w->framesPerChannel = counts;
+        w->numberOfChannels = channel + 1;
+    }
+    struct Page *page = &w->pages[w->numberOfPages++];
+    page->channel = channel;
+    page->frame = w->framesPerChannel[channel]++;
+    return true;
+}
+
+OSc_RichError *
+OScInternal_OMETiffWriter_WriteFrame(OScInternal_OMETiffWriter *writer,
+                                     uint32_t channel, uint32_t width,
+                                     uint32_t height, OSc_SampleFormat format,
+                                     const void *pixels) {
+    size_t bytes = (size_t)width * height *
+                   OScInternal_SampleFormat_GetBytesPerSample(format);
+    if (bytes == 0 || !GetOMEPixelType(format))
+        return OScInternal_Error_IllegalArgument();
+    bool isFirst = writer->numberOfPages == 0;
+    if (!isFirst && (width != writer->width || height != writer->height ||
+                     format != writer->format))
+        return OScInternal_Error_IllegalArgument();
+    if (!AddPage(writer, channel))
+        return OScInternal_Error_OutOfMemory();
+
+    OScInternal_StorageFile *file = writer->file;
+    uint64_t offset = OScInternal_StorageFile_GetAppendOffset(file);
+    uint64_t nextOffset =
+        offset + OScInternal_Storage_Align(IFD_BYTES + bytes);
+
+    // The IFD and as many pixels as fit go in one buffer (normally all)
+    void *block;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OScInternal_StorageFile_GetBuffer(file, &block)))
+        return err;
+    char *buffer = block;
+    size_t bufferSize = OScInternal_StorageFile_GetBufferSize(file);
+    FillIFD(buffer, isFirst, width, height, format, offset, bytes,
+            nextOffset);
+    size_t n = bytes < bufferSize - IFD_BYTES ? bytes : bufferSize - IFD_BYTES;
+    memcpy(buffer + IFD_BYTES, pixels, n);
+
+    struct Block *last = &writer->last;
+    last->offset = offset;
+    last->size = IFD_BYTES + n < sizeof(last->data) ? IFD_BYTES + n
+                                                    : sizeof(last->data);
+    memcpy(last->data, buffer, last->size);
+    if (isFirst) {
+        writer->first = *last;
+        writer->width = width;
+        writer->height = height;
+        writer->format = format;
+    }
+
+    if (OSc_CHECK_ERROR(err, OScInternal_StorageFile_Append(
+                                 file, buffer, IFD_BYTES + n, NULL)))
+        return err;
+    if (n < bytes)
+        return OScInternal_StorageFile_AppendCopy(
+            file, (const char *)pixels + n, bytes - n, NULL);
+    return OSc_OK;
+}
+
+static void CatFormat(ss8str *s, const char *format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    ss8_cat_cstr(s, buf);
+}
+
+// Pages are mapped to planes with a single TiffData element if they are in
+// the default (XYCZT) order, and otherwise individually
+static void CatTiffData(ss8str *xml, const OScInternal_OMETiffWriter *w,
+                        uint32_t sizeC, uint32_t sizeT) {
+    bool ordered = w->numberOfPages == (size_t)sizeC * sizeT;
+    for (size_t i = 0; ordered && i < w->numberOfPages; ++i) {
+        ordered = w->pages[i].channel == i % sizeC &&
+                  w->pages[i].frame == i / sizeC;
+    }
+    if (ordered) {
+        CatFormat(xml, "<TiffData IFD=\"0\" PlaneCount=\"%zu\"/>",
+                  w->numberOfPages);
+        return;
+    }
+    for (size_t i = 0; i < w->numberOfPages; ++i) {
+        CatFormat(xml,
+                  "<TiffData IFD=\"%zu\" FirstC=\"%u\" FirstT=\"%u\" "
+                  "PlaneCount=\"1\"/>",
+                  i, (unsigned)w->pages[i].channel,
+                  (unsigned)w->pages[i].frame);
+    }
+}
+
+static void BuildOMEXML(ss8str *xml, const OScInternal_OMETiffWriter *w) {
+    const struct OScInternal_RecordingInfo *info = &w->info;
+    uint32_t sizeC = info->numberOfChannels > w->numberOfChannels
+                         ? info->numberOfChannels
+                         : w->numberOfChannels;
+    uint32_t sizeT = 0;
+    for (uint32_t c = 0; c < w->numberOfChannels; ++c) {
+        if (w->framesPerChannel[c] > sizeT)
+            sizeT = w->framesPerChannel[c];
+    }
+
+    ss8_cat_cstr(
+        xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+             "<OME xmlns=\"http://www.openmicroscopy.org/Schemas/OME/2016-06\""
+             " xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\""
+             " xsi:schemaLocation=\""
+             "http://www.openmicroscopy.org/Schemas/OME/2016-06 "
+             "http://www.openmicroscopy.org/Schemas/OME/2016-06/ome.xsd\""
+             " Creator=\"OpenScanLib\">"
+             "<Image ID=\"Image:0\">");
+    CatFormat(xml,
+              "<Pixels ID=\"Pixels:0\" DimensionOrder=\"XYCZT\" "
+              "Type=\"%s\" BigEndian=\"%s\" SizeX=\"%u\" SizeY=\"%u\" "
+              "SizeC=\"%u\" SizeZ=\"1\" SizeT=\"%u\"",
+              GetOMEPixelType(w->format),
+              IsLittleEndian() ? "false" : "true", (unsigned)w->width,
+              (unsigned)w->height, (unsigned)sizeC, (unsigned)sizeT);
+    if (w->format == OSc_SampleFormat_UInt12 ||
+        w->format == OSc_SampleFormat_UInt12Packed)
+        ss8_cat_cstr(xml, " SignificantBits=\"12\"");
+    ss8_cat_cstr(xml, ">");
+    for (uint32_t c = 0; c < sizeC; ++c)
+        CatFormat(xml, "<Channel ID=\"Channel:0:%u\" SamplesPerPixel=\"1\"/>",
+                  (unsigned)c);
+    CatTiffData(xml, w, sizeC, sizeT);
+    ss8_cat_cstr(xml, "</Pixels>"
+                      "<AnnotationRef ID=\"Annotation:0\"/>"
+                      "</Image>");
+
+    // Scan parameters, which have no place in the OME model
+    ss8_cat_cstr(xml, "<StructuredAnnotations>"
+                      "<MapAnnotation ID=\"Annotation:0\" "
+                      "Namespace=\"OpenScanLib\"><Value>");
+    CatFormat(xml, "<M K=\"PixelRateHz\">%.15g</M>", info->pixelRateHz);
+    CatFormat(xml, "<M K=\"Resolution\">%u</M>", (unsigned)info->resolution);
+    CatFormat(xml, "<M K=\"ZoomFactor\">%.15g</M>", info->zoomFactor);
+    CatFormat(xml,
+              "<M K=\"ROI\">%u,%u,%u,%u</M>", (unsigned)info->xOffset,
+              (unsigned)info->yOffset, (unsigned)info->width,
+              (unsigned)info->height);
+    CatFormat(xml, "<M K=\"NumberOfChannels\">%u</M>",
+              (unsigned)info->numberOfChannels);
+    ss8_cat_cstr(xml, "</Value></MapAnnotation>"
+                      "</StructuredAnnotations>"
+                      "</OME>");
+}
+
+OSc_RichError *
+OScInternal_OMETiffWriter_Close(OScInternal_OMETiffWriter *writer) {
+    if (!writer)
+        return OSc_OK;
+
+    OScInternal_StorageFile *file = writer->file;
+    OSc_RichError *err = OSc_OK;
+    uint64_t size = OScInternal_StorageFile_GetAppendOffset(file);
+    if (writer->numberOfPages == 0) {
+        // Nothing to describe; a file without IFDs is not a valid TIFF
+        char header[TIFF_HEADER_BYTES];
+        FillHeader(header, 0);
+        err = OScInternal_StorageFile_WriteAt(file, header, sizeof(header),
+                                              0);
+        size = TIFF_HEADER_BYTES;
+    } else {
+        ss8str xml;
+        ss8_init(&xml);
+        BuildOMEXML(&xml, writer);
+        size_t xmlBytes = ss8_len(&xml) + 1;
+        uint64_t xmlOffset;
+        err = OScInternal_StorageFile_AppendCopy(file, ss8_cstr(&xml),
+                                                 xmlBytes, &xmlOffset);
+        ss8_destroy(&xml);
+
+        // Patch the IFDs only once the records they share blocks with are
+        // written; the first and last pages may be the same
+        if (err == OSc_OK)
+            err = OScInternal_StorageFile_Flush(file);
+        if (err == OSc_OK) {
+            struct Block *first = &writer->first;
+            struct Block *last = &writer->last;
+            if (writer->numberOfPages == 1)
+                last = first;
+            SetNextIFD(last->data, 0);
+            SetDescription(first->data, xmlBytes, xmlOffset);
+            if (last != first)
+                err = OScInternal_StorageFile_WriteAt(file, last->data,
+                                                      last->size,
+                                                      last->offset);
+            if (err == OSc_OK)
+                err = OScInternal_StorageFile_WriteAt(file, first->data,
+                                                      first->size,
+                                                      first->offset);
+            size = xmlOffset + xmlBytes;
+        }
+    }
+
+    OSc_RichError *closeErr = OScInternal_StorageFile_Close(file, size);
+    if (closeErr && err)
+        OScInternal_Error_Destroy(closeErr);
+    else if (closeErr)
+        err = closeErr;
+
+    free(writer->pages);
+    free(writer->framesPerChannel);
+    free(writer);
+    return err;
+}
+
+static OSc_RichError *
+CreateSinkWriter(void **writer, const char *path,
+                 const struct OScInternal_RecordingInfo *info) {
+    return OScInternal_OMETiffWriter_Create(
+        (OScInternal_OMETiffWriter **)writer, path, info);
+}
+
+static OSc_RichError *WriteSinkFrame(void *writer, uint32_t channel,
+                                     uint32_t width, uint32_t height,
+                                     OSc_SampleFormat format,
+                                     const void *pixels) {
+    return OScInternal_OMETiffWriter_WriteFrame(writer, channel, width,
+                                                height, format, pixels);
+}
+
+static OSc_RichError *CloseSinkWriter(void *writer) {
+    return OScInternal_OMETiffWriter_Close(writer);
+}
+
+static const struct OScInternal_StorageSink g_omeTiffSink = {
+    CreateSinkWriter,
+    WriteSinkFrame,
+    CloseSinkWriter,
+    false,
+};
+
+OSc_RichError *
+OScInternal_OMETiffWriter_AddStage(OScInternal_Pipeline *pipeline,
+                                   const char *path, uint32_t queueDepth,
+                                   OSc_PipelineStage **stage) {
+    return OScInternal_StorageSink_AddStage(pipeline, &g_omeTiffSink, path,
+                                            queueDepth, stage);
+}
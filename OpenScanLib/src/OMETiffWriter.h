@@ -0,0 +1,48 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+#include "Pipeline.h"
+#include "Storage.h"
+
+/*
+ * Streaming OME-TIFF writer.
+ *
+ * Files are BigTIFF (so that recordings may exceed 4 GiB), with one
+ * uncompressed single-strip page per channel per frame. Each page is written
+ * as one record, holding its IFD followed by its pixels, as soon as the
+ * frame arrives; the IFD already points to the offset where the next record
+ * will start. When the file is closed, the OME-XML metadata is appended, and
+ * only the first and last IFDs are rewritten: the first to point to the
+ * metadata (its ImageDescription), the last to terminate the chain of IFDs.
+ *
+ * The number of frames need not be known in advance; the OME-XML describes
+ * the frames actually written. Values are in the byte order of the writing
+ * machine, as indicated in the TIFF header.
+ */
+
+typedef struct OScInternal_OMETiffWriter OScInternal_OMETiffWriter;
+
+OSc_RichError *
+OScInternal_OMETiffWriter_Create(OScInternal_OMETiffWriter **writer,
+                                 const char *path,
+                                 const struct OScInternal_RecordingInfo *info);
+
+// Write one channel of one frame as a page; returns once the data is queued
+// for writing.
+OSc_RichError *
+OScInternal_OMETiffWriter_WriteFrame(OScInternal_OMETiffWriter *writer,
+                                     uint32_t channel, uint32_t width,
+                                     uint32_t height, OSc_SampleFormat format,
+                                     const void *pixels);
+
+// Write the metadata and close the file. The writer is destroyed even if an
+// error is returned.
+OSc_RichError *
+OScInternal_OMETiffWriter_Close(OScInternal_OMETiffWriter *writer);
+
+// Add a built-in stage writing every frame it receives to an OME-TIFF file,
+// which is created when the acquisition is armed and closed when it finishes
+OSc_RichError *
+OScInternal_OMETiffWriter_AddStage(OScInternal_Pipeline *pipeline,
+                                   const char *path, uint32_t queueDepth,
+                                   OSc_PipelineStage **stage);
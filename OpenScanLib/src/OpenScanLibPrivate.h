@@ -154,9 +154,21 @@ OScInternal_NumRange *OScInternal_NumRange_Intersection6(
 OSc_RichError *OScInternal_DeviceModule_GetCount(size_t *count);
 OSc_RichError *OScInternal_DeviceModule_GetNames(const char **modules,
                                                  size_t *count);
+// Modules are listed without loading them and loaded by
+// OScInternal_DeviceModule_GetDeviceImpls(); must be set before modules are
+// first listed
+void OScInternal_DeviceModule_SetLoadOnDemand(bool onDemand);
+OSc_RichError *OScInternal_DeviceModule_GetPath(const char *module,
+                                                const char **path);
 OSc_RichError *
 OScInternal_DeviceModule_GetDeviceImpls(const char *module,
                                         OScInternal_PtrArray **deviceImpls);
+// Unload the module (or stop its host) until its device implementations are
+// requested again; all of its devices must have been destroyed
+void OScInternal_DeviceModule_Unload(const char *module);
+
+// Enumerate 'module' and bind its deferred devices
+OSc_RichError *OScInternal_DeviceEnumeration_BindModule(const char *module);
 
 OSc_RichError *OScInternal_LSM_Associate_Device(OSc_LSM *lsm,
                                                 OSc_Device *device);
@@ -170,6 +182,17 @@ OScDev_Error OScInternal_Device_Create(OScDev_ModuleImpl *modImpl,
                                        OSc_Device **device,
                                        OScDev_DeviceImpl *impl, void *data);
 OSc_RichError *OScInternal_Device_Destroy(OSc_Device *device);
+// Deferred devices are listed from the device manifest (or after unloading
+// their module) and stand in for a device of 'module' until bound to the
+// enumerated device
+struct OScInternal_ManifestDevice;
+OSc_Device *OScInternal_Device_CreateDeferred(
+    const char *module, const struct OScInternal_ManifestDevice *entry);
+// The module of a deferred device not yet bound, or NULL
+const char *OScInternal_Device_GetDeferredModule(OSc_Device *device);
+void OScInternal_Device_Bind(OSc_Device *device, OSc_Device *target);
+OSc_RichError *OScInternal_Device_GetModelName(OSc_Device *device,
+                                               const char **modelName);
 bool OScInternal_Device_Log(OSc_Device *device, OSc_LogLevel level,
                             const char *message);
 void *OScInternal_Device_GetImplData(OSc_Device *device);
@@ -184,6 +207,9 @@ OScInternal_Device_GetNumberOfChannels(OSc_Device *device,
                                        uint32_t *numberOfChannels);
 OSc_RichError *OScInternal_Device_GetBytesPerSample(OSc_Device *device,
                                                     uint32_t *bytesPerSample);
+OSc_RichError *OScInternal_Device_GetSampleFormat(OSc_Device *device,
+                                                   uint32_t channel,
+                                                   OSc_SampleFormat *format);
 OSc_RichError *OScInternal_Device_Arm(OSc_Device *device,
                                       OSc_Acquisition *acq);
 OSc_RichError *OScInternal_Device_Start(OSc_Device *device);
@@ -204,6 +230,13 @@ bool OScInternal_Setting_SupportsRichErrors(OSc_Setting *setting);
 
 bool OScInternal_Module_SupportsRichErrors(OScDev_ModuleImpl *modImpl);
 
+// Record the device module ABI version returned by a module's entry point.
+// Fields appended to module-owned structs (OScDev_DeviceImpl) in a later
+// minor version must not be read from modules built for an earlier one.
+void OScInternal_Module_SetABIVersion(OScDev_ModuleImpl *modImpl,
+                                      uint32_t version);
+uint16_t OScInternal_Module_GetABIMinorVersion(OScDev_ModuleImpl *modImpl);
+
 OSc_Device *
 OScInternal_AcquisitionForDevice_GetDevice(OScDev_Acquisition *devAcq);
 size_t OScInternal_AcquisitionForDevice_GetDetectorDeviceIndex(
@@ -223,3 +256,7 @@ OScDev_Acquisition *OScInternal_Acquisition_GetForDevice(OSc_Acquisition *acq,
 bool OScInternal_Acquisition_CallFrameCallback(OSc_Acquisition *acq,
                                                size_t detectorIndex,
                                                uint32_t channel, void *pixels);
+bool OScInternal_Acquisition_CallTimeTagCallback(OSc_Acquisition *acq,
+                                                 size_t detectorIndex,
+                                                 const uint64_t *timeTags,
+                                                 size_t count);
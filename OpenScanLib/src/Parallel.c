@@ -0,0 +1,124 @@
+#include "Parallel.h"
+#include "Threads.h"
+
+#include <stdlib.h>
+
+// Upper limit on worker threads, regardless of processor count
+#define MAX_WORKERS 63
+
+// The worker pool is created on first use and lives until process exit. Only
+// one loop runs on it at a time; chunks are claimed under the mutex, which is
+// acceptable because chunks are expected to be large (bands of image rows).
+struct WorkerPool {
+    OScInternal_Mutex mutex;
+    OScInternal_Cond workAvailable;
+    OScInternal_Cond workDone;
+    OScInternal_Thread threads[MAX_WORKERS];
+    unsigned nThreads;
+
+    // The current loop, valid while 'busy' is true
+    bool busy;
+    OScInternal_ParallelFunc func;
+    void *data;
+    size_t count;
+    size_t grain;
+    size_t nextBegin;
+    size_t chunksRemaining;
+};
+
+static OScInternal_Mutex g_poolInitMutex = OScInternal_MUTEX_INITIALIZER;
+static struct WorkerPool *g_pool;
+
+// Called with the pool mutex held; returns with it held.
+static bool RunOneChunk(struct WorkerPool *pool) {
+    if (!pool->busy || pool->nextBegin >= pool->count)
+        return false;
+
+    size_t begin = pool->nextBegin;
+    size_t end = begin + pool->grain < pool->count ? begin + pool->grain
+                                                   : pool->count;
+    pool->nextBegin = end;
+    OScInternal_ParallelFunc func = pool->func;
+    void *data = pool->data;
+
+    OScInternal_Mutex_Unlock(&pool->mutex);
+    func(data, begin, end);
+    OScInternal_Mutex_Lock(&pool->mutex);
+
+    if (--pool->chunksRemaining == 0)
+        OScInternal_Cond_Broadcast(&pool->workDone);
+    return true;
+}
+
+static void WorkerMain(void *data) {
+    struct WorkerPool *pool = data;
+    OScInternal_Mutex_Lock(&pool->mutex);
+    for (;;) {
+        if (!RunOneChunk(pool))
+            OScInternal_Cond_Wait(&pool->workAvailable, &pool->mutex);
+    }
+}
+
+static struct WorkerPool *GetPool(void) {
+    OScInternal_Mutex_Lock(&g_poolInitMutex);
+    if (!g_pool) {
+        struct WorkerPool *pool = calloc(1, sizeof(struct WorkerPool));
+        if (pool) {
+            OScInternal_Mutex_Init(&pool->mutex);
+            OScInternal_Cond_Init(&pool->workAvailable);
+            OScInternal_Cond_Init(&pool->workDone);
+
+            // The calling thread participates, so one fewer worker suffices
+            unsigned n = OScInternal_GetNumberOfProcessors() - 1;
+            if (n > MAX_WORKERS)
+                n = MAX_WORKERS;
+            for (unsigned i = 0; i < n; ++i) {
+                if (!OScInternal_Thread_Create(&pool->threads[i], WorkerMain,
+                                               pool))
+                    break;
+                ++pool->nThreads;
+            }
+            g_pool = pool;
+        }
+    }
+    OScInternal_Mutex_Unlock(&g_poolInitMutex);
+    return g_pool;
+}
+
+void OScInternal_ParallelFor(size_t count, size_t grain,
+                             OScInternal_ParallelFunc func, void *data) {
+    if (count == 0)
+        return;
+    if (grain == 0)
+        grain = 1;
+
+    struct WorkerPool *pool = count > grain ? GetPool() : NULL;
+    if (!pool || pool->nThreads == 0) {
+        func(data, 0, count);
+        return;
+    }
+
+    OScInternal_Mutex_Lock(&pool->mutex);
+    if (pool->busy) {
+        OScInternal_Mutex_Unlock(&pool->mutex);
+        func(data, 0, count);
+        return;
+    }
+
+    pool->busy = true;
+    pool->func = func;
+    pool->data = data;
+    pool->count = count;
+    pool->grain = grain;
+    pool->nextBegin = 0;
+    pool->chunksRemaining = (count + grain - 1) / grain;
+    OScInternal_Cond_Broadcast(&pool->workAvailable);
+
+    while (RunOneChunk(pool))
+        ;
+    while (pool->chunksRemaining > 0)
+        OScInternal_Cond_Wait(&pool->workDone, &pool->mutex);
+
+    pool->busy = false;
+    OScInternal_Mutex_Unlock(&pool->mutex);
+}
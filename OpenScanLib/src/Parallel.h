@@ -0,0 +1,19 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * Data-parallel loops for pixel processing, run on a set of worker threads
+ * owned by OpenScanLib.
+ */
+
+typedef void (*OScInternal_ParallelFunc)(void *data, size_t begin,
+                                         size_t end);
+
+// Call 'func' on disjoint subranges covering [0, count), each (except
+// possibly the last) 'grain' long, using the worker threads and the calling
+// thread. Returns after all subranges have been processed. If the workers
+// are busy with another loop, the whole range is processed on the calling
+// thread instead of waiting.
+void OScInternal_ParallelFor(size_t count, size_t grain,
+                             OScInternal_ParallelFunc func, void *data);
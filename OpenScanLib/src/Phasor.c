@@ -0,0 +1,300 @@
+#include "Phasor.h"
+#include "InternalErrors.h"
+#include "Parallel.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Work is split into chunks of this many pixels, a multiple of the SIMD
+// width
+#define CHUNK_PIXELS 16384
+
+struct OScInternal_Phasor {
+    size_t nPixels;
+    uint32_t nBins;
+    float *cosTable; // Indexed by bin
+    float *sinTable;
+
+    // Accumulators for the current frame
+    float *sumCos;
+    float *sumSin;
+    float *sumIntensity;
+    uint32_t binsAdded;
+};
+
+OSc_RichError *OScInternal_Phasor_Create(OScInternal_Phasor **phasor,
+                                         size_t nPixels, uint32_t nBins,
+                                         uint32_t harmonic) {
+    if (nPixels == 0 || nBins == 0 || harmonic == 0)
+        return OScInternal_Error_IllegalArgument();
+
+    OScInternal_Phasor *p = calloc(1, sizeof(OScInternal_Phasor));
+    if (!p)
+        return OScInternal_Error_OutOfMemory();
+    p->nPixels = nPixels;
+    p->nBins = nBins;
+    p->cosTable = malloc(nBins * sizeof(float));
+    p->sinTable = malloc(nBins * sizeof(float));
+    p->sumCos = calloc(nPixels, sizeof(float));
+    p->sumSin = calloc(nPixels, sizeof(float));
+    p->sumIntensity = calloc(nPixels, sizeof(float));
+    if (!p->cosTable || !p->sinTable || !p->sumCos || !p->sumSin ||
+        !p->sumIntensity) {
+        OScInternal_Phasor_Destroy(p);
+        return OScInternal_Error_OutOfMemory();
+    }
+
+    // Each bin is represented by the phase at its center
+    for (uint32_t k = 0; k < nBins; ++k) {
+        double phase = 2.0 * M_PI * harmonic * (k + 0.5) / nBins;
+        p->cosTable[k] = (float)cos(phase);
+        p->sinTable[k] = (float)sin(phase);
+    }
+
+    *phasor = p;
+    return OSc_OK;
+}
+
+void OScInternal_Phasor_Destroy(OScInternal_Phasor *phasor) {
+    if (!phasor)
+        return;
+    free(phasor->cosTable);
+    free(phasor->sinTable);
+    free(phasor->sumCos);
+    free(phasor->sumSin);
+    free(phasor->sumIntensity);
+    free(phasor);
+}
+
+struct AccumulateJob {
+    OScInternal_Phasor *phasor;
+    const void *samples;
+    uint32_t bytesPerSample;
+    float cosK;
+    float sinK;
+};
+
+struct ComputeJob {
+    OScInternal_Phasor *phasor;
+    float rotCos; // modulationScale * cos(phaseShift)
+    float rotSin; // modulationScale * sin(phaseShift)
+    float *g;
+    float *s;
+    float *intensity;
+};
+
+// Kernels process pixels [begin, end)
+typedef void (*AccumulateFunc)(const struct AccumulateJob *job, size_t begin,
+                               size_t end);
+typedef void (*ComputeFunc)(const struct ComputeJob *job, size_t begin,
+                            size_t end);
+
+static void Accumulate(const struct AccumulateJob *job, size_t begin,
+                       size_t end) {
+    OScInternal_Phasor *p = job->phasor;
+    for (size_t i = begin; i < end; ++i) {
+        float v;
+        switch (job->bytesPerSample) {
+        case 1:
+            v = ((const uint8_t *)job->samples)[i];
+            break;
+        case 2:
+            v = ((const uint16_t *)job->samples)[i];
+            break;
+        default:
+            v = (float)((const uint32_t *)job->samples)[i];
+            break;
+        }
+        p->sumCos[i] += v * job->cosK;
+        p->sumSin[i] += v * job->sinK;
+        p->sumIntensity[i] += v;
+    }
+}
+
+static void Compute(const struct ComputeJob *job, size_t begin, size_t end) {
+    OScInternal_Phasor *p = job->phasor;
+    for (size_t i = begin; i < end; ++i) {
+        float intensity = p->sumIntensity[i];
+        float g = 0.0f, s = 0.0f;
+        if (intensity > 0.0f) {
+            float gRaw = p->sumCos[i] / intensity;
+            float sRaw = p->sumSin[i] / intensity;
+            g = gRaw * job->rotCos - sRaw * job->rotSin;
+            s = gRaw * job->rotSin + sRaw * job->rotCos;
+        }
+        job->g[i] = g;
+        job->s[i] = s;
+        job->intensity[i] = intensity;
+    }
+}
+
+#ifdef HAVE_SSE2
+
+static inline void Accumulate4_SSE2(__m128i counts, __m128 vc, __m128 vs,
+                                    float *sumCos, float *sumSin,
+                                    float *sumIntensity) {
+    __m128 v = _mm_cvtepi32_ps(counts);
+    _mm_storeu_ps(sumCos, _mm_add_ps(_mm_loadu_ps(sumCos), _mm_mul_ps(v, vc)));
+    _mm_storeu_ps(sumSin, _mm_add_ps(_mm_loadu_ps(sumSin), _mm_mul_ps(v, vs)));
+    _mm_storeu_ps(sumIntensity, _mm_add_ps(_mm_loadu_ps(sumIntensity), v));
+}
+
+static void Accumulate_SSE2(const struct AccumulateJob *job, size_t begin,
+                            size_t end) {
+    OScInternal_Phasor *p = job->phasor;
+    __m128 vc = _mm_set1_ps(job->cosK);
+    __m128 vs = _mm_set1_ps(job->sinK);
+    __m128i zero = _mm_setzero_si128();
+    size_t i = begin;
+    if (job->bytesPerSample == 1) {
+        const uint8_t *src = job->samples;
+        for (; i + 16 <= end; i += 16) {
+            __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i lo = _mm_unpacklo_epi8(b, zero);
+            __m128i hi = _mm_unpackhi_epi8(b, zero);
+            __m128i w[4] = {
+                _mm_unpacklo_epi16(lo, zero),
+                _mm_unpackhi_epi16(lo, zero),
+                _mm_unpacklo_epi16(hi, zero),
+                _mm_unpackhi_epi16(hi, zero),
+            };
+            for (int j = 0; j < 4; ++j)
+                Accumulate4_SSE2(w[j], vc, vs, p->sumCos + i + 4 * j,
+                                 p->sumSin + i + 4 * j,
+                                 p->sumIntensity + i + 4 * j);
+        }
+    } else if (job->bytesPerSample == 2) {
+        const uint16_t *src = job->samples;
+        for (; i + 16 <= end; i += 16) {
+            for (int j = 0; j < 2; ++j) {
+                __m128i h =
+                    _mm_loadu_si128((const __m128i *)(src + i + 8 * j));
+                size_t k = i + 8 * j;
+                Accumulate4_SSE2(_mm_unpacklo_epi16(h, zero), vc, vs,
+                                 p->sumCos + k, p->sumSin + k,
+                                 p->sumIntensity + k);
+                Accumulate4_SSE2(_mm_unpackhi_epi16(h, zero), vc, vs,
+                                 p->sumCos + k + 4, p->sumSin + k + 4,
+                                 p->sumIntensity + k + 4);
+            }
+        }
+    }
+    Accumulate(job, i, end);
+}
+
+static void Compute_SSE2(const struct ComputeJob *job, size_t begin,
+                         size_t end) {
+    OScInternal_Phasor *p = job->phasor;
+    __m128 rc = _mm_set1_ps(job->rotCos);
+    __m128 rs = _mm_set1_ps(job->rotSin);
+    __m128 zero = _mm_setzero_ps();
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 sc = _mm_loadu_ps(p->sumCos + i);
+        __m128 ss = _mm_loadu_ps(p->sumSin + i);
+        __m128 si = _mm_loadu_ps(p->sumIntensity + i);
+        // Lanes with zero intensity divide by 1 and are then masked to 0
+        __m128 nonzero = _mm_cmpgt_ps(si, zero);
+        __m128 inv = _mm_div_ps(
+            _mm_set1_ps(1.0f),
+            _mm_or_ps(_mm_and_ps(nonzero, si),
+                      _mm_andnot_ps(nonzero, _mm_set1_ps(1.0f))));
+        __m128 g = _mm_mul_ps(sc, inv);
+        __m128 s = _mm_mul_ps(ss, inv);
+        __m128 gc = _mm_sub_ps(_mm_mul_ps(g, rc), _mm_mul_ps(s, rs));
+        __m128 sc2 = _mm_add_ps(_mm_mul_ps(g, rs), _mm_mul_ps(s, rc));
+        _mm_storeu_ps(job->g + i, _mm_and_ps(nonzero, gc));
+        _mm_storeu_ps(job->s + i, _mm_and_ps(nonzero, sc2));
+        _mm_storeu_ps(job->intensity + i, si);
+    }
+    Compute(job, i, end);
+}
+
+#endif // HAVE_SSE2
+
+// Bound by OScInternal_Phasor_BindKernels()
+static AccumulateFunc g_accumulate = Accumulate;
+static ComputeFunc g_compute = Compute;
+
+OSc_SIMDLevel OScInternal_Phasor_BindKernels(OSc_SIMDLevel level) {
+#ifdef HAVE_SSE2
+    if (level >= OSc_SIMDLevel_SSE42) {
+        g_accumulate = Accumulate_SSE2;
+        g_compute = Compute_SSE2;
+        return OSc_SIMDLevel_SSE42;
+    }
+#endif
+    g_accumulate = Accumulate;
+    g_compute = Compute;
+    return OSc_SIMDLevel_Scalar;
+}
+
+static void AccumulateChunks(void *data, size_t beginChunk, size_t endChunk) {
+    const struct AccumulateJob *job = data;
+    OScInternal_Phasor *p = job->phasor;
+    size_t begin = beginChunk * CHUNK_PIXELS;
+    size_t end = endChunk * CHUNK_PIXELS;
+    if (end > p->nPixels)
+        end = p->nPixels;
+    g_accumulate(job, begin, end);
+}
+
+bool OScInternal_Phasor_AddBin(OScInternal_Phasor *phasor, uint32_t bin,
+                               const void *samples, uint32_t bytesPerSample) {
+    if (bin >= phasor->nBins)
+        return false;
+
+    struct AccumulateJob job = {
+        .phasor = phasor,
+        .samples = samples,
+        .bytesPerSample = bytesPerSample,
+        .cosK = phasor->cosTable[bin],
+        .sinK = phasor->sinTable[bin],
+    };
+    size_t nChunks = (phasor->nPixels + CHUNK_PIXELS - 1) / CHUNK_PIXELS;
+    OScInternal_ParallelFor(nChunks, 4, AccumulateChunks, &job);
+
+    return ++phasor->binsAdded == phasor->nBins;
+}
+
+static void ComputeChunks(void *data, size_t beginChunk, size_t endChunk) {
+    const struct ComputeJob *job = data;
+    OScInternal_Phasor *p = job->phasor;
+    size_t begin = beginChunk * CHUNK_PIXELS;
+    size_t end = endChunk * CHUNK_PIXELS;
+    if (end > p->nPixels)
+        end = p->nPixels;
+
+    g_compute(job, begin, end);
+
+    size_t n = end - begin;
+    memset(p->sumCos + begin, 0, n * sizeof(float));
+    memset(p->sumSin + begin, 0, n * sizeof(float));
+    memset(p->sumIntensity + begin, 0, n * sizeof(float));
+}
+
+void OScInternal_Phasor_Compute(OScInternal_Phasor *phasor, double phaseShift,
+                                double modulationScale, float *g, float *s,
+                                float *intensity) {
+    struct ComputeJob job = {
+        .phasor = phasor,
+        .rotCos = (float)(modulationScale * cos(phaseShift)),
+        .rotSin = (float)(modulationScale * sin(phaseShift)),
+        .g = g,
+        .s = s,
+        .intensity = intensity,
+    };
+    size_t nChunks = (phasor->nPixels + CHUNK_PIXELS - 1) / CHUNK_PIXELS;
+    OScInternal_ParallelFor(nChunks, 4, ComputeChunks, &job);
+    phasor->binsAdded = 0;
+}
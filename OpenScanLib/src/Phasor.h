@@ -0,0 +1,37 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * Phasor analysis of fluorescence lifetime data delivered as per-pixel time
+ * bin histograms, one time bin per channel.
+ *
+ * Time bins of a frame are accumulated, as they arrive, into per-pixel
+ * sums weighted by precomputed cosine and sine tables for the harmonic.
+ * When all bins have been added, the normalized and calibrated phasor
+ * coordinates G and S, and the total intensity, are computed.
+ */
+
+typedef struct OScInternal_Phasor OScInternal_Phasor;
+
+// The histogram is assumed to span one laser period in 'nBins' bins.
+OSc_RichError *OScInternal_Phasor_Create(OScInternal_Phasor **phasor,
+                                         size_t nPixels, uint32_t nBins,
+                                         uint32_t harmonic);
+void OScInternal_Phasor_Destroy(OScInternal_Phasor *phasor);
+
+// Add one time bin of the current frame. Returns true if this completes the
+// frame, in which case OScInternal_Phasor_Compute() should be called.
+bool OScInternal_Phasor_AddBin(OScInternal_Phasor *phasor, uint32_t bin,
+                               const void *samples, uint32_t bytesPerSample);
+
+// Compute the output images (each nPixels floats) for the completed frame
+// and reset for the next frame. The calibration rotates the phasors by
+// 'phaseShift' radians and scales them by 'modulationScale'. Pixels with no
+// intensity have G = S = 0.
+void OScInternal_Phasor_Compute(OScInternal_Phasor *phasor, double phaseShift,
+                                double modulationScale, float *g, float *s,
+                                float *intensity);
+
+// Bind the kernels for 'level' and return the level bound (see Dispatch.h)
+OSc_SIMDLevel OScInternal_Phasor_BindKernels(OSc_SIMDLevel level);
@@ -0,0 +1,242 @@
+#include "PhotonCounting.h"
+#include "Parallel.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+// Samples are discriminated in blocks of 64, each block yielding 64-bit
+// masks of samples above the upper threshold ('high') and below the lower
+// threshold ('low').
+#define BLOCK 64
+
+static inline unsigned PopCount64(uint64_t x) {
+#if defined(__GNUC__)
+    return (unsigned)__builtin_popcountll(x);
+#else
+    // Not using __popcnt64(), which requires the POPCNT instruction
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (unsigned)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+static inline uint32_t LoadSample(const void *src, size_t i,
+                                  uint32_t bytesPerSample) {
+    switch (bytesPerSample) {
+    case 1:
+        return ((const uint8_t *)src)[i];
+    case 2:
+        return ((const uint16_t *)src)[i];
+    default:
+        return ((const uint32_t *)src)[i];
+    }
+}
+
+static void DiscriminateScalar(const void *src, size_t n,
+                               uint32_t bytesPerSample, uint32_t lower,
+                               uint32_t upper, uint64_t *high,
+                               uint64_t *low) {
+    uint64_t h = 0, l = 0;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t s = LoadSample(src, i, bytesPerSample);
+        h |= (uint64_t)(s >= upper) << i;
+        l |= (uint64_t)(s < lower) << i;
+    }
+    *high = h;
+    *low = l;
+}
+
+/*
+ * Block kernels discriminate a full block of BLOCK samples, with thresholds
+ * representable in the sample type.
+ */
+typedef void (*DiscriminateBlockFunc)(const void *src, uint32_t lower,
+                                      uint32_t upper, uint64_t *high,
+                                      uint64_t *low);
+
+static void Discriminate8(const void *src, uint32_t lower, uint32_t upper,
+                          uint64_t *high, uint64_t *low) {
+    DiscriminateScalar(src, BLOCK, 1, lower, upper, high, low);
+}
+
+static void Discriminate16(const void *src, uint32_t lower, uint32_t upper,
+                           uint64_t *high, uint64_t *low) {
+    DiscriminateScalar(src, BLOCK, 2, lower, upper, high, low);
+}
+
+#ifdef HAVE_SSE2
+
+// SSE2 has only signed compares, so samples and thresholds are biased by
+// half the range. Thresholds must be representable in the sample type.
+
+static void Discriminate8_SSE2(const void *samples, uint32_t lower,
+                               uint32_t upper, uint64_t *high,
+                               uint64_t *low) {
+    const uint8_t *src = samples;
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i lo = _mm_xor_si128(_mm_set1_epi8((char)lower), bias);
+    const __m128i up = _mm_xor_si128(_mm_set1_epi8((char)upper), bias);
+    uint64_t belowUpper = 0, l = 0;
+    for (int k = 0; k < BLOCK / 16; ++k) {
+        __m128i s = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i *)(src + 16 * k)), bias);
+        belowUpper |= (uint64_t)_mm_movemask_epi8(_mm_cmpgt_epi8(up, s))
+                      << (16 * k);
+        l |= (uint64_t)_mm_movemask_epi8(_mm_cmpgt_epi8(lo, s)) << (16 * k);
+    }
+    *high = ~belowUpper;
+    *low = l;
+}
+
+static void Discriminate16_SSE2(const void *samples, uint32_t lower,
+                                uint32_t upper, uint64_t *high,
+                                uint64_t *low) {
+    const uint16_t *src = samples;
+    const __m128i bias = _mm_set1_epi16((short)0x8000);
+    const __m128i lo = _mm_xor_si128(_mm_set1_epi16((short)lower), bias);
+    const __m128i up = _mm_xor_si128(_mm_set1_epi16((short)upper), bias);
+    uint64_t belowUpper = 0, l = 0;
+    for (int k = 0; k < BLOCK / 16; ++k) {
+        __m128i s0 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i *)(src + 16 * k)), bias);
+        __m128i s1 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i *)(src + 16 * k + 8)), bias);
+        // Packing the 16-bit compare results gives one byte per sample
+        __m128i bu = _mm_packs_epi16(_mm_cmpgt_epi16(up, s0),
+                                     _mm_cmpgt_epi16(up, s1));
+        __m128i bl = _mm_packs_epi16(_mm_cmpgt_epi16(lo, s0),
+                                     _mm_cmpgt_epi16(lo, s1));
+        belowUpper |= (uint64_t)_mm_movemask_epi8(bu) << (16 * k);
+        l |= (uint64_t)_mm_movemask_epi8(bl) << (16 * k);
+    }
+    *high = ~belowUpper;
+    *low = l;
+}
+
+#endif // HAVE_SSE2
+
+// Bound by OScInternal_PhotonCount_BindKernels()
+static DiscriminateBlockFunc g_discriminate8 = Discriminate8;
+static DiscriminateBlockFunc g_discriminate16 = Discriminate16;
+
+OSc_SIMDLevel OScInternal_PhotonCount_BindKernels(OSc_SIMDLevel level) {
+#ifdef HAVE_SSE2
+    if (level >= OSc_SIMDLevel_SSE42) {
+        g_discriminate8 = Discriminate8_SSE2;
+        g_discriminate16 = Discriminate16_SSE2;
+        return OSc_SIMDLevel_SSE42;
+    }
+#endif
+    g_discriminate8 = Discriminate8;
+    g_discriminate16 = Discriminate16;
+    return OSc_SIMDLevel_Scalar;
+}
+
+// Given the 'high' and 'low' masks of a block and the discriminator state
+// before the block, return the mask of samples at which the discriminator
+// goes high, and update the state. Within a block, the discriminator is high
+// from any 'high' sample up to (excluding) the next 'low' sample; adding the
+// 'high' bits to the complement of 'low' propagates a carry across exactly
+// those spans, so no per-sample loop is needed.
+static inline uint64_t RisingEdges(uint64_t high, uint64_t low,
+                                   unsigned *state) {
+    uint64_t notLow = ~low;
+    uint64_t sum = notLow + high + *state;
+    uint64_t isHigh = ((sum ^ notLow) | high) & notLow;
+    uint64_t wasHigh = (isHigh << 1) | *state;
+    *state = (unsigned)(isHigh >> 63);
+    return isHigh & ~wasHigh;
+}
+
+static inline void StoreCount(void *dst, size_t i, uint32_t count,
+                              uint32_t bytesPerCount) {
+    if (bytesPerCount == 1)
+        ((uint8_t *)dst)[i] = (uint8_t)(count < UINT8_MAX ? count : UINT8_MAX);
+    else
+        ((uint16_t *)dst)[i] =
+            (uint16_t)(count < UINT16_MAX ? count : UINT16_MAX);
+}
+
+static void CountLine(const struct OScInternal_PhotonCountParams *p,
+                      const void *src, void *dst, bool useBlockKernels) {
+    size_t nSamples = (size_t)p->width * p->samplesPerPixel;
+    unsigned state = 0;
+    size_t pixel = 0;
+    size_t pixelEnd = p->samplesPerPixel; // Sample index
+    uint32_t count = 0;                  // Edges so far in current pixel
+
+    for (size_t base = 0; base < nSamples; base += BLOCK) {
+        size_t n = nSamples - base < BLOCK ? nSamples - base : BLOCK;
+        const char *blockSrc = (const char *)src + base * p->bytesPerSample;
+        uint64_t high, low;
+        if (useBlockKernels && n == BLOCK && p->bytesPerSample == 1)
+            g_discriminate8(blockSrc, p->lowerThreshold, p->upperThreshold,
+                            &high, &low);
+        else if (useBlockKernels && n == BLOCK && p->bytesPerSample == 2)
+            g_discriminate16(blockSrc, p->lowerThreshold, p->upperThreshold,
+                             &high, &low);
+        else
+            DiscriminateScalar(blockSrc, n, p->bytesPerSample,
+                               p->lowerThreshold, p->upperThreshold, &high,
+                               &low);
+
+        uint64_t edges = RisingEdges(high, low, &state);
+
+        // Distribute the edges among the pixels ending in this block; the
+        // remainder belongs to the next pixel
+        while (pixel < p->width && pixelEnd <= base + n) {
+            unsigned nBits = (unsigned)(pixelEnd - base);
+            uint64_t mask = nBits == 64 ? ~0ULL : (1ULL << nBits) - 1;
+            count += PopCount64(edges & mask);
+            edges &= ~mask;
+            StoreCount(dst, pixel, count, p->bytesPerCount);
+            count = 0;
+            ++pixel;
+            pixelEnd += p->samplesPerPixel;
+        }
+        count += PopCount64(edges);
+    }
+}
+
+struct CountJob {
+    const struct OScInternal_PhotonCountParams *params;
+    const void *src;
+    void *dst;
+    bool useBlockKernels;
+};
+
+static void CountLines(void *data, size_t begin, size_t end) {
+    const struct CountJob *job = data;
+    const struct OScInternal_PhotonCountParams *p = job->params;
+    size_t srcStride = (size_t)p->width * p->samplesPerPixel *
+                       p->bytesPerSample;
+    size_t dstStride = (size_t)p->width * p->bytesPerCount;
+    for (size_t row = begin; row < end; ++row) {
+        CountLine(p, (const char *)job->src + row * srcStride,
+                  (char *)job->dst + row * dstStride, job->useBlockKernels);
+    }
+}
+
+void OScInternal_PhotonCount(
+    const struct OScInternal_PhotonCountParams *params, const void *src,
+    void *dst) {
+    if (params->samplesPerPixel == 0 || params->width == 0)
+        return;
+
+    uint32_t maxSample = params->bytesPerSample == 1   ? UINT8_MAX
+                         : params->bytesPerSample == 2 ? UINT16_MAX
+                                                       : UINT32_MAX;
+    struct CountJob job = {
+        .params = params,
+        .src = src,
+        .dst = dst,
+        .useBlockKernels = params->upperThreshold <= maxSample,
+    };
+    size_t lineSamples = (size_t)params->width * params->samplesPerPixel;
+    // Aim for at least 64K samples per task
+    size_t grain = 1 + 65536 / lineSamples;
+    OScInternal_ParallelFor(params->height, grain, CountLines, &job);
+}
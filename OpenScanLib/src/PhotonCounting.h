@@ -0,0 +1,34 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * Photon discrimination: converts an oversampled analog detector signal
+ * (several raw samples per pixel) into per-pixel photon counts.
+ *
+ * The discriminator has hysteresis: it goes high when a sample is at or
+ * above the upper threshold and low when a sample is below the lower
+ * threshold, and a photon is counted for each low-to-high transition. The
+ * discriminator is reset (low) at the start of every line, so that lines can
+ * be processed independently.
+ */
+
+struct OScInternal_PhotonCountParams {
+    uint32_t width;
+    uint32_t height;
+    uint32_t samplesPerPixel;
+    uint32_t bytesPerSample; // Raw samples: 1, 2, or 4 (unsigned)
+    uint32_t bytesPerCount;  // Output counts: 1 or 2 (saturating)
+    uint32_t lowerThreshold;
+    uint32_t upperThreshold; // Must be >= lowerThreshold
+};
+
+// Count photons in one channel of one frame. 'src' holds width x height x
+// samplesPerPixel raw samples, with the samples of each pixel contiguous;
+// 'dst' receives width x height counts.
+void OScInternal_PhotonCount(
+    const struct OScInternal_PhotonCountParams *params, const void *src,
+    void *dst);
+
+// Bind the kernels for 'level' and return the level bound (see Dispatch.h)
+OSc_SIMDLevel OScInternal_PhotonCount_BindKernels(OSc_SIMDLevel level);
@@ -0,0 +1,691 @@
+#include "Pipeline.h"
+#include "InternalErrors.h"
+#include "Pyramid.h"
+#include "SampleFormat.h"
+#include "TaskPool.h"
+#include "Threads.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#define INITIAL_QUEUE_CAPACITY 8
+
+// Frame buffers are allocated with this alignment, and their pixels start
+// at this offset, so that the pixels are as aligned as the SIMD kernels
+// prefer.
+#define FRAME_ALIGNMENT 64
+#define PIXELS_OFFSET FRAME_ALIGNMENT
+
+struct OScInternal_FrameBuffer {
+    volatile int32_t refCount;
+    uint32_t channel;
+    uint32_t width;
+    uint32_t height;
+    OSc_SampleFormat format;
+};
+
+struct QueuedFrame {
+    OSc_FrameBuffer *frame;
+    double enqueueTime;
+};
+
+struct OScInternal_PipelineStage {
+    OScInternal_Pipeline *pipeline;
+    OSc_PipelineStageFunc func;
+    void *data;
+    OScInternal_StageDestroyFunc destroy;
+    OScInternal_StageStartFunc start;
+    OScInternal_StageFinishFunc finish;
+    bool started; // Only accessed while no frames are in flight
+
+    // Edges; only modified while the acquisition is not armed
+    OScInternal_PtrArray *downstream;
+    size_t numberOfUpstream;
+
+    OScInternal_Mutex mutex; // Guards the fields below
+    uint32_t queueDepth;     // 0 for unbounded
+    struct QueuedFrame *queue; // Growable ring buffer
+    size_t capacity;           // Power of 2
+    size_t front;
+    size_t size;
+    bool active; // A task is submitted or running for this stage
+
+    uint64_t framesProcessed;
+    uint64_t framesDropped;
+    size_t maxQueuedFrames;
+    double totalLatency; // From enqueueing to completion of processing
+    double maxLatency;
+    double totalProcessingTime;
+};
+
+struct OScInternal_Pipeline {
+    OSc_Acquisition *acq;
+    OScInternal_PtrArray *stages;
+
+    OScInternal_Mutex mutex; // Guards the fields below
+    OScInternal_Cond idle;
+    size_t activeStages;
+    bool cancelled;
+};
+
+static void *AllocateFrame(size_t size) {
+#ifdef _WIN32
+    return _aligned_malloc(size, FRAME_ALIGNMENT);
+#else
+    void *p;
+    if (posix_memalign(&p, FRAME_ALIGNMENT, size) != 0)
+        return NULL;
+    return p;
+#endif
+}
+
+static void FreeFrame(void *p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+static void *GetPixels(OSc_FrameBuffer *frame) {
+    return (char *)frame + PIXELS_OFFSET;
+}
+
+static size_t GetPixelBytes(const OSc_FrameBuffer *frame) {
+    return (size_t)frame->width * frame->height *
+           OScInternal_SampleFormat_GetBytesPerSample(frame->format);
+}
+
+OSc_RichError *OSc_FrameBuffer_Create(OSc_FrameBuffer **frame,
+                                      uint32_t channel, uint32_t width,
+                                      uint32_t height,
+                                      OSc_SampleFormat format) {
+    if (!frame || width == 0 || height == 0 ||
+        !OScInternal_SampleFormat_IsValid(format) ||
+        format == OSc_SampleFormat_UInt12Packed)
+        return OScInternal_Error_IllegalArgument();
+
+    size_t bytes = (size_t)width * height *
+                   OScInternal_SampleFormat_GetBytesPerSample(format);
+    OSc_FrameBuffer *f = AllocateFrame(PIXELS_OFFSET + bytes);
+    if (!f)
+        return OScInternal_Error_OutOfMemory();
+    f->refCount = 1;
+    f->channel = channel;
+    f->width = width;
+    f->height = height;
+    f->format = format;
+    *frame = f;
+    return OSc_OK;
+}
+
+void OSc_FrameBuffer_Retain(OSc_FrameBuffer *frame) {
+    if (frame)
+        OScInternal_Atomic_Increment(&frame->refCount);
+}
+
+void OSc_FrameBuffer_Release(OSc_FrameBuffer *frame) {
+    if (frame && OScInternal_Atomic_Decrement(&frame->refCount) == 0)
+        FreeFrame(frame);
+}
+
+void *OSc_FrameBuffer_GetPixels(OSc_FrameBuffer *frame) {
+    if (!frame)
+        return NULL;
+    return GetPixels(frame);
+}
+
+uint32_t OSc_FrameBuffer_GetChannel(OSc_FrameBuffer *frame) {
+    if (!frame)
+        return 0;
+    return frame->channel;
+}
+
+void OSc_FrameBuffer_GetSize(OSc_FrameBuffer *frame, uint32_t *width,
+                             uint32_t *height) {
+    if (width)
+        *width = frame ? frame->width : 0;
+    if (height)
+        *height = frame ? frame->height : 0;
+}
+
+OSc_SampleFormat OSc_FrameBuffer_GetSampleFormat(OSc_FrameBuffer *frame) {
+    if (!frame)
+        return OSc_SampleFormat_Auto;
+    return frame->format;
+}
+
+// Called with the stage mutex held
+static bool Queue_Push(OSc_PipelineStage *stage, struct QueuedFrame qf) {
+    if (stage->size == stage->capacity) {
+        size_t capacity =
+            stage->capacity ? 2 * stage->capacity : INITIAL_QUEUE_CAPACITY;
+        struct QueuedFrame *queue =
+            malloc(capacity * sizeof(struct QueuedFrame));
+        if (!queue)
+            return false;
+        for (size_t i = 0; i < stage->size; ++i)
+            queue[i] =
+                stage->queue[(stage->front + i) & (stage->capacity - 1)];
+        free(stage->queue);
+        stage->queue = queue;
+        stage->capacity = capacity;
+        stage->front = 0;
+    }
+    stage->queue[(stage->front + stage->size) & (stage->capacity - 1)] = qf;
+    ++stage->size;
+    return true;
+}
+
+// Called with the stage mutex held
+static bool Queue_Pop(OSc_PipelineStage *stage, struct QueuedFrame *qf) {
+    if (stage->size == 0)
+        return false;
+    *qf = stage->queue[stage->front];
+    stage->front = (stage->front + 1) & (stage->capacity - 1);
+    --stage->size;
+    return true;
+}
+
+static bool IsCancelled(OScInternal_Pipeline *pipeline) {
+    OScInternal_Mutex_Lock(&pipeline->mutex);
+    bool cancelled = pipeline->cancelled;
+    OScInternal_Mutex_Unlock(&pipeline->mutex);
+    return cancelled;
+}
+
+static void Cancel(OScInternal_Pipeline *pipeline) {
+    OScInternal_Mutex_Lock(&pipeline->mutex);
+    pipeline->cancelled = true;
+    OScInternal_Mutex_Unlock(&pipeline->mutex);
+}
+
+// Process the frame at the front of the queue. Returns false (and marks the
+// stage inactive) if the queue was empty.
+static bool ProcessNext(OSc_PipelineStage *stage) {
+    OScInternal_Pipeline *pipeline = stage->pipeline;
+
+    struct QueuedFrame qf;
+    OScInternal_Mutex_Lock(&stage->mutex);
+    bool found = Queue_Pop(stage, &qf);
+    if (!found)
+        stage->active = false;
+    OScInternal_Mutex_Unlock(&stage->mutex);
+
+    if (!found) {
+        OScInternal_Mutex_Lock(&pipeline->mutex);
+        if (--pipeline->activeStages == 0)
+            OScInternal_Cond_Broadcast(&pipeline->idle);
+        OScInternal_Mutex_Unlock(&pipeline->mutex);
+        return false;
+    }
+
+    // Frames still queued after cancellation are discarded unprocessed
+    bool processed = false;
+    double startTime = OScInternal_GetMonotonicTime();
+    if (!IsCancelled(pipeline)) {
+        if (!stage->func(stage, qf.frame, stage->data))
+            Cancel(pipeline);
+        processed = true;
+    }
+    double endTime = OScInternal_GetMonotonicTime();
+    OSc_FrameBuffer_Release(qf.frame);
+
+    if (processed) {
+        double latency = endTime - qf.enqueueTime;
+        OScInternal_Mutex_Lock(&stage->mutex);
+        ++stage->framesProcessed;
+        stage->totalLatency += latency;
+        if (latency > stage->maxLatency)
+            stage->maxLatency = latency;
+        stage->totalProcessingTime += endTime - startTime;
+        OScInternal_Mutex_Unlock(&stage->mutex);
+    }
+    return true;
+}
+
+static void RunStage(void *data) {
+    OSc_PipelineStage *stage = data;
+    while (ProcessNext(stage)) {
+        // Continue with the next frame as a new task, so that other stages
+        // get a turn. If the pool is unavailable, continue on this thread.
+        if (OScInternal_TaskPool_Submit(RunStage, stage))
+            return;
+    }
+}
+
+static void Enqueue(OSc_PipelineStage *stage, OSc_FrameBuffer *frame) {
+    struct QueuedFrame qf = {frame, OScInternal_GetMonotonicTime()};
+    bool activate = false;
+
+    OScInternal_Mutex_Lock(&stage->mutex);
+    if ((stage->queueDepth > 0 && stage->size >= stage->queueDepth) ||
+        !Queue_Push(stage, qf)) {
+        ++stage->framesDropped;
+    } else {
+        OSc_FrameBuffer_Retain(frame);
+        if (stage->size > stage->maxQueuedFrames)
+            stage->maxQueuedFrames = stage->size;
+        activate = !stage->active;
+        stage->active = true;
+    }
+    OScInternal_Mutex_Unlock(&stage->mutex);
+
+    if (activate) {
+        // Counted before the upstream stage (if any) can become inactive, so
+        // that the pipeline is never seen as idle while frames are in flight
+        OScInternal_Pipeline *pipeline = stage->pipeline;
+        OScInternal_Mutex_Lock(&pipeline->mutex);
+        ++pipeline->activeStages;
+        OScInternal_Mutex_Unlock(&pipeline->mutex);
+        if (!OScInternal_TaskPool_Submit(RunStage, stage))
+            RunStage(stage);
+    }
+}
+
+static void DropFrame(OSc_PipelineStage *stage) {
+    OScInternal_Mutex_Lock(&stage->mutex);
+    ++stage->framesDropped;
+    OScInternal_Mutex_Unlock(&stage->mutex);
+}
+
+OSc_RichError *OSc_PipelineStage_Emit(OSc_PipelineStage *stage,
+                                      OSc_FrameBuffer *frame) {
+    if (!stage || !frame)
+        return OScInternal_Error_IllegalArgument();
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(stage->downstream); ++i)
+        Enqueue(OScInternal_PtrArray_At(stage->downstream, i), frame);
+    return OSc_OK;
+}
+
+// Whether 'target' can be reached from 'stage' along the edges
+static bool IsReachable(OSc_PipelineStage *stage, OSc_PipelineStage *target) {
+    if (stage == target)
+        return true;
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(stage->downstream); ++i) {
+        if (IsReachable(OScInternal_PtrArray_At(stage->downstream, i),
+                        target))
+            return true;
+    }
+    return false;
+}
+
+OSc_RichError *OSc_PipelineStage_Connect(OSc_PipelineStage *upstream,
+                                         OSc_PipelineStage *downstream) {
+    if (!upstream || !downstream ||
+        upstream->pipeline != downstream->pipeline)
+        return OScInternal_Error_IllegalArgument();
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(upstream->downstream);
+         ++i) {
+        if (OScInternal_PtrArray_At(upstream->downstream, i) == downstream)
+            return OScInternal_Error_IllegalArgument();
+    }
+    // The graph must remain acyclic
+    if (IsReachable(downstream, upstream))
+        return OScInternal_Error_IllegalArgument();
+
+    OScInternal_PtrArray_Append(upstream->downstream, downstream);
+    ++downstream->numberOfUpstream;
+    return OSc_OK;
+}
+
+OSc_Acquisition *OSc_PipelineStage_GetAcquisition(OSc_PipelineStage *stage) {
+    if (!stage)
+        return NULL;
+    return stage->pipeline->acq;
+}
+
+OSc_RichError *OSc_PipelineStage_GetStatistics(
+    OSc_PipelineStage *stage, uint64_t *framesProcessed,
+    uint64_t *framesDropped, uint32_t *maxQueuedFrames, double *meanLatency,
+    double *maxLatency, double *meanProcessingTime) {
+    if (!stage)
+        return OScInternal_Error_IllegalArgument();
+    OScInternal_Mutex_Lock(&stage->mutex);
+    uint64_t n = stage->framesProcessed;
+    if (framesProcessed)
+        *framesProcessed = n;
+    if (framesDropped)
+        *framesDropped = stage->framesDropped;
+    if (maxQueuedFrames)
+        *maxQueuedFrames = (uint32_t)stage->maxQueuedFrames;
+    if (meanLatency)
+        *meanLatency = n ? stage->totalLatency / n : 0.0;
+    if (maxLatency)
+        *maxLatency = stage->maxLatency;
+    if (meanProcessingTime)
+        *meanProcessingTime = n ? stage->totalProcessingTime / n : 0.0;
+    OScInternal_Mutex_Unlock(&stage->mutex);
+    return OSc_OK;
+}
+
+static void DestroyStage(OSc_PipelineStage *stage) {
+    struct QueuedFrame qf;
+    while (Queue_Pop(stage, &qf))
+        OSc_FrameBuffer_Release(qf.frame);
+    free(stage->queue);
+    if (stage->destroy)
+        stage->destroy(stage->data);
+    OScInternal_PtrArray_Destroy(stage->downstream);
+    OScInternal_Mutex_Destroy(&stage->mutex);
+    free(stage);
+}
+
+OSc_RichError *OScInternal_Pipeline_Create(OScInternal_Pipeline **pipeline,
+                                           OSc_Acquisition *acq) {
+    OScInternal_Pipeline *p = calloc(1, sizeof(OScInternal_Pipeline));
+    if (!p)
+        return OScInternal_Error_OutOfMemory();
+    p->acq = acq;
+    p->stages = OScInternal_PtrArray_Create();
+    OScInternal_Mutex_Init(&p->mutex);
+    OScInternal_Cond_Init(&p->idle);
+    *pipeline = p;
+    return OSc_OK;
+}
+
+void OScInternal_Pipeline_Destroy(OScInternal_Pipeline *pipeline) {
+    if (!pipeline)
+        return;
+    OSc_RichError *err = OScInternal_Pipeline_Finish(pipeline);
+    if (err)
+        OScInternal_Error_Destroy(err);
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(pipeline->stages); ++i)
+        DestroyStage(OScInternal_PtrArray_At(pipeline->stages, i));
+    OScInternal_PtrArray_Destroy(pipeline->stages);
+    OScInternal_Cond_Destroy(&pipeline->idle);
+    OScInternal_Mutex_Destroy(&pipeline->mutex);
+    free(pipeline);
+}
+
+OSc_RichError *OScInternal_Pipeline_AddStage(
+    OScInternal_Pipeline *pipeline, OSc_PipelineStageFunc func, void *data,
+    OScInternal_StageDestroyFunc destroy, uint32_t queueDepth,
+    OSc_PipelineStage **stage) {
+    OSc_PipelineStage *s = calloc(1, sizeof(OSc_PipelineStage));
+    if (!s)
+        return OScInternal_Error_OutOfMemory();
+    s->pipeline = pipeline;
+    s->func = func;
+    s->data = data;
+    s->destroy = destroy;
+    s->downstream = OScInternal_PtrArray_Create();
+    OScInternal_Mutex_Init(&s->mutex);
+    s->queueDepth = queueDepth;
+    OScInternal_PtrArray_Append(pipeline->stages, s);
+    *stage = s;
+    return OSc_OK;
+}
+
+void OScInternal_Pipeline_SetStageLifecycle(
+    OSc_PipelineStage *stage, OScInternal_StageStartFunc start,
+    OScInternal_StageFinishFunc finish) {
+    stage->start = start;
+    stage->finish = finish;
+}
+
+size_t
+OScInternal_Pipeline_GetNumberOfStages(OScInternal_Pipeline *pipeline) {
+    return OScInternal_PtrArray_Size(pipeline->stages);
+}
+
+OSc_PipelineStage *
+OScInternal_Pipeline_GetStage(OScInternal_Pipeline *pipeline, size_t index) {
+    return OScInternal_PtrArray_At(pipeline->stages, index);
+}
+
+OSc_PipelineStageFunc OScInternal_PipelineStage_GetFunc(
+    OSc_PipelineStage *stage) {
+    return stage->func;
+}
+
+void *OScInternal_PipelineStage_GetData(OSc_PipelineStage *stage) {
+    return stage->data;
+}
+
+void OScInternal_Pipeline_Reset(OScInternal_Pipeline *pipeline) {
+    OScInternal_Pipeline_Drain(pipeline);
+    OScInternal_Mutex_Lock(&pipeline->mutex);
+    pipeline->cancelled = false;
+    OScInternal_Mutex_Unlock(&pipeline->mutex);
+
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(pipeline->stages); ++i) {
+        OSc_PipelineStage *stage =
+            OScInternal_PtrArray_At(pipeline->stages, i);
+        OScInternal_Mutex_Lock(&stage->mutex);
+        stage->framesProcessed = 0;
+        stage->framesDropped = 0;
+        stage->maxQueuedFrames = 0;
+        stage->totalLatency = 0.0;
+        stage->maxLatency = 0.0;
+        stage->totalProcessingTime = 0.0;
+        OScInternal_Mutex_Unlock(&stage->mutex);
+    }
+}
+
+OSc_RichError *OScInternal_Pipeline_Start(OScInternal_Pipeline *pipeline) {
+    OSc_RichError *err = OScInternal_Pipeline_Finish(pipeline);
+    if (err)
+        OScInternal_Error_Destroy(err);
+
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(pipeline->stages); ++i) {
+        OSc_PipelineStage *stage =
+            OScInternal_PtrArray_At(pipeline->stages, i);
+        if (stage->start) {
+            if (OSc_CHECK_ERROR(err, stage->start(stage, stage->data))) {
+                OSc_RichError *finishErr =
+                    OScInternal_Pipeline_Finish(pipeline);
+                if (finishErr)
+                    OScInternal_Error_Destroy(finishErr);
+                return err;
+            }
+        }
+        stage->started = true;
+    }
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_Pipeline_Finish(OScInternal_Pipeline *pipeline) {
+    OScInternal_Pipeline_Drain(pipeline);
+    OSc_RichError *firstErr = OSc_OK;
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(pipeline->stages); ++i) {
+        OSc_PipelineStage *stage =
+            OScInternal_PtrArray_At(pipeline->stages, i);
+        if (!stage->started)
+            continue;
+        stage->started = false;
+        if (stage->finish) {
+            OSc_RichError *err = stage->finish(stage->data);
+            if (err && firstErr)
+                OScInternal_Error_Destroy(err);
+            else if (err)
+                firstErr = err;
+        }
+    }
+    return firstErr;
+}
+
+// Copy pushed pixels into a new frame buffer. Frame buffers are never
+// packed, so packed samples are unpacked.
+static OSc_RichError *CreatePushedFrame(OSc_FrameBuffer **frame,
+                                        uint32_t channel, uint32_t width,
+                                        uint32_t height,
+                                        OSc_SampleFormat format,
+                                        const void *pixels) {
+    OSc_SampleFormat frameFormat = format == OSc_SampleFormat_UInt12Packed
+                                       ? OSc_SampleFormat_UInt12
+                                       : format;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OSc_FrameBuffer_Create(frame, channel, width,
+                                                    height, frameFormat)))
+        return err;
+    if (frameFormat == format) {
+        memcpy(GetPixels(*frame), pixels, GetPixelBytes(*frame));
+        return OSc_OK;
+    }
+    if (OSc_CHECK_ERROR(err, OScInternal_ConvertSamples(
+                                 pixels, format, GetPixels(*frame),
+                                 frameFormat, (size_t)width * height))) {
+        OSc_FrameBuffer_Release(*frame);
+        *frame = NULL;
+    }
+    return err;
+}
+
+bool OScInternal_Pipeline_Push(OScInternal_Pipeline *pipeline,
+                               uint32_t channel, uint32_t width,
+                               uint32_t height, OSc_SampleFormat format,
+                               const void *pixels) {
+    if (IsCancelled(pipeline))
+        return false;
+
+    OSc_FrameBuffer *frame = NULL;
+    for (size_t i = 0; i < OScInternal_PtrArray_Size(pipeline->stages); ++i) {
+        OSc_PipelineStage *stage =
+            OScInternal_PtrArray_At(pipeline->stages, i);
+        if (stage->numberOfUpstream > 0)
+            continue;
+        if (!frame) {
+            OSc_RichError *err = CreatePushedFrame(&frame, channel, width,
+                                                   height, format, pixels);
+            if (err != OSc_OK) {
+                // Not fatal to the acquisition; recorded as a dropped frame
+                OScInternal_Error_Destroy(err);
+                DropFrame(stage);
+                continue;
+            }
+        }
+        Enqueue(stage, frame);
+    }
+    OSc_FrameBuffer_Release(frame);
+    return true;
+}
+
+void OScInternal_Pipeline_Drain(OScInternal_Pipeline *pipeline) {
+    OScInternal_Mutex_Lock(&pipeline->mutex);
+    while (pipeline->activeStages > 0)
+        OScInternal_Cond_Wait(&pipeline->idle, &pipeline->mutex);
+    OScInternal_Mutex_Unlock(&pipeline->mutex);
+}
+
+// Built-in downsampling stage, with a pyramid per channel (created on the
+// first frame of the channel, and recreated if the frame size changes)
+struct DownsampleStage {
+    uint32_t level;
+    OScInternal_Pyramid **pyramids;
+    uint32_t *widths; // Of the frames of each pyramid
+    uint32_t *heights;
+    OSc_SampleFormat *formats;
+    uint32_t numberOfChannels;
+};
+
+static void DestroyDownsampleStage(void *data) {
+    struct DownsampleStage *ds = data;
+    for (uint32_t ch = 0; ch < ds->numberOfChannels; ++ch)
+        OScInternal_Pyramid_Destroy(ds->pyramids[ch]);
+    free(ds->pyramids);
+    free(ds->widths);
+    free(ds->heights);
+    free(ds->formats);
+    free(ds);
+}
+
+static bool GrowDownsampleStage(struct DownsampleStage *ds,
+                                uint32_t numberOfChannels) {
+    OScInternal_Pyramid **pyramids =
+        realloc(ds->pyramids, numberOfChannels * sizeof(void *));
+    if (!pyramids)
+        return false;
+    ds->pyramids = pyramids;
+    uint32_t *widths =
+        realloc(ds->widths, numberOfChannels * sizeof(uint32_t));
+    if (!widths)
+        return false;
+    ds->widths = widths;
+    uint32_t *heights =
+        realloc(ds->heights, numberOfChannels * sizeof(uint32_t));
+    if (!heights)
+        return false;
+    ds->heights = heights;
+    OSc_SampleFormat *formats =
+        realloc(ds->formats, numberOfChannels * sizeof(OSc_SampleFormat));
+    if (!formats)
+        return false;
+    ds->formats = formats;
+    for (uint32_t ch = ds->numberOfChannels; ch < numberOfChannels; ++ch)
+        ds->pyramids[ch] = NULL;
+    ds->numberOfChannels = numberOfChannels;
+    return true;
+}
+
+static bool RunDownsampleStage(OSc_PipelineStage *stage,
+                               OSc_FrameBuffer *frame, void *data) {
+    struct DownsampleStage *ds = data;
+    uint32_t ch = frame->channel;
+    if (ch >= ds->numberOfChannels && !GrowDownsampleStage(ds, ch + 1))
+        return true; // Frame not emitted
+
+    OScInternal_Pyramid *pyramid = ds->pyramids[ch];
+    if (pyramid && (ds->widths[ch] != frame->width ||
+                    ds->heights[ch] != frame->height ||
+                    ds->formats[ch] != frame->format)) {
+        OScInternal_Pyramid_Destroy(pyramid);
+        pyramid = ds->pyramids[ch] = NULL;
+    }
+    if (!pyramid) {
+        uint32_t maxLevels =
+            OScInternal_Pyramid_GetMaxLevels(frame->width, frame->height);
+        uint32_t levels = ds->level < maxLevels ? ds->level : maxLevels;
+        if (levels == 0) // 1 x 1 frame
+            return OSc_PipelineStage_Emit(stage, frame) == OSc_OK;
+        OSc_RichError *err = OScInternal_Pyramid_Create(
+            &pyramid, frame->width, frame->height, levels, frame->format);
+        if (err != OSc_OK) {
+            OScInternal_Error_Destroy(err);
+            return true;
+        }
+        ds->pyramids[ch] = pyramid;
+        ds->widths[ch] = frame->width;
+        ds->heights[ch] = frame->height;
+        ds->formats[ch] = frame->format;
+    }
+
+    OScInternal_Pyramid_Build(pyramid, GetPixels(frame));
+    uint32_t level = OScInternal_Pyramid_GetNumberOfLevels(pyramid);
+    uint32_t width, height;
+    OScInternal_Pyramid_GetLevelSize(frame->width, frame->height, level,
+                                     &width, &height);
+    OSc_FrameBuffer *output;
+    OSc_RichError *err =
+        OSc_FrameBuffer_Create(&output, ch, width, height, frame->format);
+    if (err != OSc_OK) {
+        OScInternal_Error_Destroy(err);
+        return true;
+    }
+    memcpy(GetPixels(output), OScInternal_Pyramid_GetLevel(pyramid, level),
+           GetPixelBytes(output));
+    OSc_PipelineStage_Emit(stage, output);
+    OSc_FrameBuffer_Release(output);
+    return true;
+}
+
+OSc_RichError *OScInternal_Pipeline_AddDownsampleStage(
+    OScInternal_Pipeline *pipeline, uint32_t level, uint32_t queueDepth,
+    OSc_PipelineStage **stage) {
+    if (level == 0)
+        return OScInternal_Error_IllegalArgument();
+    struct DownsampleStage *ds = calloc(1, sizeof(struct DownsampleStage));
+    if (!ds)
+        return OScInternal_Error_OutOfMemory();
+    ds->level = level;
+    OSc_RichError *err = OScInternal_Pipeline_AddStage(
+        pipeline, RunDownsampleStage, ds, DestroyDownsampleStage, queueDepth,
+        stage);
+    if (err != OSc_OK)
+        DestroyDownsampleStage(ds);
+    return err;
+}
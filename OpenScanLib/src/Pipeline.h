@@ -0,0 +1,83 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * Processing pipeline of an acquisition: a DAG of stages, run on the shared
+ * task pool (TaskPool.h), that pass reference-counted frame buffers along
+ * their edges. Output frames are copied into a frame buffer and queued to
+ * every stage without an upstream stage.
+ *
+ * Each stage processes its queued frames one at a time, in order, so stage
+ * functions need not be reentrant; different stages (and different frames
+ * in different stages) run concurrently. A stage whose queue is full drops
+ * the arriving frame rather than blocking, so that neither device threads
+ * nor pool workers ever wait on a downstream stage.
+ */
+
+typedef struct OScInternal_Pipeline OScInternal_Pipeline;
+
+typedef void (*OScInternal_StageDestroyFunc)(void *data);
+
+// Optional lifecycle functions of a stage (used by built-in stages that hold
+// resources, such as files, for the duration of an acquisition)
+typedef OSc_RichError *(*OScInternal_StageStartFunc)(OSc_PipelineStage *stage,
+                                                     void *data);
+typedef OSc_RichError *(*OScInternal_StageFinishFunc)(void *data);
+
+OSc_RichError *OScInternal_Pipeline_Create(OScInternal_Pipeline **pipeline,
+                                           OSc_Acquisition *acq);
+
+// Finishes the stages (discarding errors), then destroys them
+void OScInternal_Pipeline_Destroy(OScInternal_Pipeline *pipeline);
+
+// Add a stage, owned by the pipeline. 'destroy' (if not NULL) is called with
+// 'data' when the stage is destroyed. A 'queueDepth' of 0 means unbounded.
+OSc_RichError *OScInternal_Pipeline_AddStage(
+    OScInternal_Pipeline *pipeline, OSc_PipelineStageFunc func, void *data,
+    OScInternal_StageDestroyFunc destroy, uint32_t queueDepth,
+    OSc_PipelineStage **stage);
+
+// Add a built-in stage emitting each frame downsampled by 2^level
+OSc_RichError *OScInternal_Pipeline_AddDownsampleStage(
+    OScInternal_Pipeline *pipeline, uint32_t level, uint32_t queueDepth,
+    OSc_PipelineStage **stage);
+
+// Set the lifecycle functions of a stage. 'start' is called when the
+// acquisition is armed; 'finish' is called, only if 'start' succeeded, after
+// all frames have been processed. Either may be NULL.
+void OScInternal_Pipeline_SetStageLifecycle(
+    OSc_PipelineStage *stage, OScInternal_StageStartFunc start,
+    OScInternal_StageFinishFunc finish);
+
+// Enumerate the stages, in the order in which they were added
+size_t
+OScInternal_Pipeline_GetNumberOfStages(OScInternal_Pipeline *pipeline);
+OSc_PipelineStage *
+OScInternal_Pipeline_GetStage(OScInternal_Pipeline *pipeline, size_t index);
+
+// The function and data with which a stage was added
+OSc_PipelineStageFunc OScInternal_PipelineStage_GetFunc(
+    OSc_PipelineStage *stage);
+void *OScInternal_PipelineStage_GetData(OSc_PipelineStage *stage);
+
+// Clear the cancellation flag and statistics before an acquisition is armed
+void OScInternal_Pipeline_Reset(OScInternal_Pipeline *pipeline);
+
+// Call the start functions of the stages, after OScInternal_Pipeline_Reset().
+// Stages still started from an earlier acquisition are finished first.
+OSc_RichError *OScInternal_Pipeline_Start(OScInternal_Pipeline *pipeline);
+
+// Wait for queued frames to be processed, then call the finish functions of
+// the started stages. Returns the first error.
+OSc_RichError *OScInternal_Pipeline_Finish(OScInternal_Pipeline *pipeline);
+
+// Copy a frame into a new frame buffer and queue it to the source stages.
+// Returns false if a stage has requested cancellation.
+bool OScInternal_Pipeline_Push(OScInternal_Pipeline *pipeline,
+                               uint32_t channel, uint32_t width,
+                               uint32_t height, OSc_SampleFormat format,
+                               const void *pixels);
+
+// Block until all queued frames have been processed by all stages
+void OScInternal_Pipeline_Drain(OScInternal_Pipeline *pipeline);
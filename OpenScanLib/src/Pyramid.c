@@ -0,0 +1,320 @@
+#include "Pyramid.h"
+#include "InternalErrors.h"
+#include "Parallel.h"
+#include "SampleFormat.h"
+
+#include <stdlib.h>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#define MAX_LEVELS 32
+
+// Approximate source samples per unit of parallel work
+#define GRAIN_SAMPLES 65536
+
+/*
+ * Each kernel reduces two source rows ('row1' may equal 'row0' at the bottom
+ * edge) of 'srcWidth' samples into one row of (srcWidth + 1) / 2 samples.
+ * Integer results are rounded to nearest (half up).
+ */
+typedef void (*ReduceRowFunc)(const void *row0, const void *row1, void *dst,
+                              uint32_t srcWidth);
+
+#define DEFINE_SCALAR_REDUCE(name, type, sumType)                             \
+    static void name(const void *row0, const void *row1, void *dst,           \
+                     uint32_t srcWidth) {                                     \
+        const type *a = row0;                                                 \
+        const type *b = row1;                                                 \
+        type *d = dst;                                                        \
+        uint32_t dstWidth = (srcWidth + 1) / 2;                               \
+        for (uint32_t x = 0; x < dstWidth; ++x) {                             \
+            uint32_t x0 = 2 * x;                                              \
+            uint32_t x1 = x0 + 1 < srcWidth ? x0 + 1 : x0;                    \
+            sumType s = (sumType)a[x0] + a[x1] + b[x0] + b[x1];               \
+            d[x] = (type)((s + 2) >> 2);                                      \
+        }                                                                     \
+    }
+
+DEFINE_SCALAR_REDUCE(ReduceUInt8, uint8_t, uint32_t)
+DEFINE_SCALAR_REDUCE(ReduceUInt16, uint16_t, uint32_t)
+DEFINE_SCALAR_REDUCE(ReduceUInt32, uint32_t, uint64_t)
+DEFINE_SCALAR_REDUCE(ReduceInt8, int8_t, int32_t)
+DEFINE_SCALAR_REDUCE(ReduceInt16, int16_t, int32_t)
+DEFINE_SCALAR_REDUCE(ReduceInt32, int32_t, int64_t)
+
+static void ReduceFloat(const void *row0, const void *row1, void *dst,
+                        uint32_t srcWidth) {
+    const float *a = row0;
+    const float *b = row1;
+    float *d = dst;
+    uint32_t dstWidth = (srcWidth + 1) / 2;
+    // Same order of operations as the vector kernel
+    for (uint32_t x = 0; x < dstWidth; ++x) {
+        uint32_t x0 = 2 * x;
+        uint32_t x1 = x0 + 1 < srcWidth ? x0 + 1 : x0;
+        d[x] = ((a[x0] + a[x1]) + (b[x0] + b[x1])) * 0.25f;
+    }
+}
+
+#ifdef HAVE_SSE2
+
+// Vectorized kernels handle the leading full pairs, then finish with the
+// scalar kernel from output sample 'x' (2x in the source rows).
+#define FINISH_SCALAR(scalarFunc, type)                                       \
+    scalarFunc((const type *)row0 + 2 * x, (const type *)row1 + 2 * x,        \
+               (type *)dst + x, srcWidth - 2 * x)
+
+static void ReduceUInt8_SSE2(const void *row0, const void *row1, void *dst,
+                             uint32_t srcWidth) {
+    const uint8_t *a = row0;
+    const uint8_t *b = row1;
+    uint8_t *d = dst;
+    uint32_t x = 0;
+    const __m128i lowMask = _mm_set1_epi16(0xff);
+    const __m128i two = _mm_set1_epi16(2);
+    for (; x + 8 <= srcWidth / 2; x += 8) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + 2 * x));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + 2 * x));
+        __m128i s = _mm_add_epi16(
+            _mm_add_epi16(_mm_and_si128(va, lowMask), _mm_srli_epi16(va, 8)),
+            _mm_add_epi16(_mm_and_si128(vb, lowMask), _mm_srli_epi16(vb, 8)));
+        s = _mm_srli_epi16(_mm_add_epi16(s, two), 2);
+        _mm_storel_epi64((__m128i *)(d + x), _mm_packus_epi16(s, s));
+    }
+    FINISH_SCALAR(ReduceUInt8, uint8_t);
+}
+
+static void ReduceUInt16_SSE2(const void *row0, const void *row1, void *dst,
+                              uint32_t srcWidth) {
+    const uint16_t *a = row0;
+    const uint16_t *b = row1;
+    uint16_t *d = dst;
+    uint32_t x = 0;
+    // Pairs are summed in 32-bit lanes; the results are packed back to 16
+    // bits with signed saturation, so they are offset by 0x8000 around it.
+    const __m128i lowMask = _mm_set1_epi32(0xffff);
+    const __m128i two = _mm_set1_epi32(2);
+    const __m128i offset32 = _mm_set1_epi32(0x8000);
+    const __m128i offset16 = _mm_set1_epi16((short)0x8000);
+    for (; x + 4 <= srcWidth / 2; x += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + 2 * x));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + 2 * x));
+        __m128i s = _mm_add_epi32(
+            _mm_add_epi32(_mm_and_si128(va, lowMask), _mm_srli_epi32(va, 16)),
+            _mm_add_epi32(_mm_and_si128(vb, lowMask),
+                          _mm_srli_epi32(vb, 16)));
+        s = _mm_sub_epi32(_mm_srli_epi32(_mm_add_epi32(s, two), 2), offset32);
+        __m128i p = _mm_xor_si128(_mm_packs_epi32(s, s), offset16);
+        _mm_storel_epi64((__m128i *)(d + x), p);
+    }
+    FINISH_SCALAR(ReduceUInt16, uint16_t);
+}
+
+// Sums of adjacent pairs of the 8 samples in v0 and v1
+static inline __m128 AddPairs(__m128 v0, __m128 v1) {
+    return _mm_add_ps(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0)),
+                      _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+
+static void ReduceFloat_SSE2(const void *row0, const void *row1, void *dst,
+                             uint32_t srcWidth) {
+    const float *a = row0;
+    const float *b = row1;
+    float *d = dst;
+    uint32_t x = 0;
+    const __m128 quarter = _mm_set1_ps(0.25f);
+    for (; x + 4 <= srcWidth / 2; x += 4) {
+        __m128 sa =
+            AddPairs(_mm_loadu_ps(a + 2 * x), _mm_loadu_ps(a + 2 * x + 4));
+        __m128 sb =
+            AddPairs(_mm_loadu_ps(b + 2 * x), _mm_loadu_ps(b + 2 * x + 4));
+        _mm_storeu_ps(d + x, _mm_mul_ps(_mm_add_ps(sa, sb), quarter));
+    }
+    FINISH_SCALAR(ReduceFloat, float);
+}
+
+#endif // HAVE_SSE2
+
+// Kernels with SIMD variants, bound by OScInternal_Pyramid_BindKernels()
+static ReduceRowFunc g_reduceUInt8 = ReduceUInt8;
+static ReduceRowFunc g_reduceUInt16 = ReduceUInt16;
+static ReduceRowFunc g_reduceFloat = ReduceFloat;
+
+OSc_SIMDLevel OScInternal_Pyramid_BindKernels(OSc_SIMDLevel level) {
+#ifdef HAVE_SSE2
+    if (level >= OSc_SIMDLevel_SSE42) {
+        g_reduceUInt8 = ReduceUInt8_SSE2;
+        g_reduceUInt16 = ReduceUInt16_SSE2;
+        g_reduceFloat = ReduceFloat_SSE2;
+        return OSc_SIMDLevel_SSE42;
+    }
+#endif
+    g_reduceUInt8 = ReduceUInt8;
+    g_reduceUInt16 = ReduceUInt16;
+    g_reduceFloat = ReduceFloat;
+    return OSc_SIMDLevel_Scalar;
+}
+
+static ReduceRowFunc GetReduceFunc(OSc_SampleFormat format) {
+    switch (format) {
+    case OSc_SampleFormat_UInt8:
+        return g_reduceUInt8;
+    case OSc_SampleFormat_UInt12:
+    case OSc_SampleFormat_UInt16:
+        return g_reduceUInt16;
+    case OSc_SampleFormat_UInt32:
+        return ReduceUInt32;
+    case OSc_SampleFormat_Int8:
+        return ReduceInt8;
+    case OSc_SampleFormat_Int16:
+        return ReduceInt16;
+    case OSc_SampleFormat_Int32:
+        return ReduceInt32;
+    case OSc_SampleFormat_Float32:
+        return g_reduceFloat;
+    default:
+        return NULL;
+    }
+}
+
+struct OScInternal_Pyramid {
+    uint32_t width;
+    uint32_t height;
+    uint32_t numberOfLevels;
+    uint32_t bytesPerSample;
+    ReduceRowFunc reduce;
+    uint8_t *buffer;
+    uint8_t *levels[MAX_LEVELS + 1]; // Index 0 unused
+};
+
+void OScInternal_Pyramid_GetLevelSize(uint32_t width, uint32_t height,
+                                      uint32_t level, uint32_t *levelWidth,
+                                      uint32_t *levelHeight) {
+    for (uint32_t k = 0; k < level; ++k) {
+        width = width / 2 + width % 2;
+        height = height / 2 + height % 2;
+    }
+    *levelWidth = width;
+    *levelHeight = height;
+}
+
+uint32_t OScInternal_Pyramid_GetMaxLevels(uint32_t width, uint32_t height) {
+    uint32_t levels = 0;
+    while (width > 1 || height > 1) {
+        width = width / 2 + width % 2;
+        height = height / 2 + height % 2;
+        ++levels;
+    }
+    return levels;
+}
+
+OSc_RichError *OScInternal_Pyramid_Create(OScInternal_Pyramid **pyramid,
+                                          uint32_t width, uint32_t height,
+                                          uint32_t numberOfLevels,
+                                          OSc_SampleFormat format) {
+    ReduceRowFunc reduce = GetReduceFunc(format);
+    if (width == 0 || height == 0 || numberOfLevels == 0 ||
+        numberOfLevels > OScInternal_Pyramid_GetMaxLevels(width, height) ||
+        !reduce)
+        return OScInternal_Error_IllegalArgument();
+
+    OScInternal_Pyramid *p = calloc(1, sizeof(OScInternal_Pyramid));
+    if (!p)
+        return OScInternal_Error_OutOfMemory();
+    p->width = width;
+    p->height = height;
+    p->numberOfLevels = numberOfLevels;
+    p->bytesPerSample = OScInternal_SampleFormat_GetBytesPerSample(format);
+    p->reduce = reduce;
+
+    size_t offsets[MAX_LEVELS + 1];
+    size_t total = 0;
+    for (uint32_t level = 1; level <= numberOfLevels; ++level) {
+        uint32_t w, h;
+        OScInternal_Pyramid_GetLevelSize(width, height, level, &w, &h);
+        offsets[level] = total;
+        total += (size_t)w * h * p->bytesPerSample;
+    }
+    p->buffer = malloc(total);
+    if (!p->buffer) {
+        OScInternal_Pyramid_Destroy(p);
+        return OScInternal_Error_OutOfMemory();
+    }
+    for (uint32_t level = 1; level <= numberOfLevels; ++level)
+        p->levels[level] = p->buffer + offsets[level];
+
+    *pyramid = p;
+    return OSc_OK;
+}
+
+void OScInternal_Pyramid_Destroy(OScInternal_Pyramid *pyramid) {
+    if (!pyramid)
+        return;
+    free(pyramid->buffer);
+    free(pyramid);
+}
+
+uint32_t
+OScInternal_Pyramid_GetNumberOfLevels(const OScInternal_Pyramid *pyramid) {
+    return pyramid->numberOfLevels;
+}
+
+struct ReduceJob {
+    ReduceRowFunc reduce;
+    size_t bytesPerSample;
+    const uint8_t *src;
+    uint32_t srcWidth;
+    uint32_t srcHeight;
+    uint8_t *dst;
+    uint32_t dstWidth;
+};
+
+static void ReduceRows(void *data, size_t begin, size_t end) {
+    const struct ReduceJob *job = data;
+    size_t srcStride = (size_t)job->srcWidth * job->bytesPerSample;
+    size_t dstStride = (size_t)job->dstWidth * job->bytesPerSample;
+    for (size_t y = begin; y < end; ++y) {
+        size_t y0 = 2 * y;
+        size_t y1 = y0 + 1 < job->srcHeight ? y0 + 1 : y0;
+        job->reduce(job->src + y0 * srcStride, job->src + y1 * srcStride,
+                    job->dst + y * dstStride, job->srcWidth);
+    }
+}
+
+void OScInternal_Pyramid_Build(OScInternal_Pyramid *pyramid,
+                               const void *pixels) {
+    OScInternal_Pyramid *p = pyramid;
+    const uint8_t *src = pixels;
+    uint32_t srcWidth = p->width;
+    uint32_t srcHeight = p->height;
+    for (uint32_t level = 1; level <= p->numberOfLevels; ++level) {
+        uint32_t dstWidth, dstHeight;
+        OScInternal_Pyramid_GetLevelSize(srcWidth, srcHeight, 1, &dstWidth,
+                                         &dstHeight);
+        struct ReduceJob job = {
+            .reduce = p->reduce,
+            .bytesPerSample = p->bytesPerSample,
+            .src = src,
+            .srcWidth = srcWidth,
+            .srcHeight = srcHeight,
+            .dst = p->levels[level],
+            .dstWidth = dstWidth,
+        };
+        size_t grain = GRAIN_SAMPLES / srcWidth + 1;
+        OScInternal_ParallelFor(dstHeight, grain, ReduceRows, &job);
+
+        src = p->levels[level];
+        srcWidth = dstWidth;
+        srcHeight = dstHeight;
+    }
+}
+
+const void *OScInternal_Pyramid_GetLevel(const OScInternal_Pyramid *pyramid,
+                                         uint32_t level) {
+    if (level == 0 || level > pyramid->numberOfLevels)
+        return NULL;
+    return pyramid->levels[level];
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * Multi-resolution preview pyramid. Level k (k >= 1) of a frame is the frame
+ * downsampled by 2^k with a 2x2 box filter applied repeatedly, so that
+ * viewers can pan and zoom large images without touching full-resolution
+ * data. A level with an odd width or height produces the last column or row
+ * of the next level from the single remaining column or row.
+ */
+
+typedef struct OScInternal_Pyramid OScInternal_Pyramid;
+
+// Size of level 'level' of a width x height frame
+void OScInternal_Pyramid_GetLevelSize(uint32_t width, uint32_t height,
+                                      uint32_t level, uint32_t *levelWidth,
+                                      uint32_t *levelHeight);
+
+// The number of levels until (and including) the first 1 x 1 level
+uint32_t OScInternal_Pyramid_GetMaxLevels(uint32_t width, uint32_t height);
+
+// Create a pyramid of levels 1 to numberOfLevels (which must not exceed
+// OScInternal_Pyramid_GetMaxLevels()) for frames of the given size and
+// (non-packed) sample format.
+OSc_RichError *OScInternal_Pyramid_Create(OScInternal_Pyramid **pyramid,
+                                          uint32_t width, uint32_t height,
+                                          uint32_t numberOfLevels,
+                                          OSc_SampleFormat format);
+
+void OScInternal_Pyramid_Destroy(OScInternal_Pyramid *pyramid);
+
+uint32_t
+OScInternal_Pyramid_GetNumberOfLevels(const OScInternal_Pyramid *pyramid);
+
+// Compute all levels from a full-resolution frame
+void OScInternal_Pyramid_Build(OScInternal_Pyramid *pyramid,
+                               const void *pixels);
+
+// The samples of a level (1 to numberOfLevels), valid until the next build
+const void *OScInternal_Pyramid_GetLevel(const OScInternal_Pyramid *pyramid,
+                                         uint32_t level);
+
+// Bind the kernels for 'level' and return the level bound (see Dispatch.h)
+OSc_SIMDLevel OScInternal_Pyramid_BindKernels(OSc_SIMDLevel level);
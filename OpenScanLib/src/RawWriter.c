@@ -0,0 +1,372 @@
+#include "RawWriter.h"
+#include "Codec.h"
+#include "InternalErrors.h"
+#include "Journal.h"
+#include "SampleFormat.h"
+#include "Threads.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Memory for write buffers, which bounds the data queued for writing
+#define BUFFER_POOL_BYTES (64 * 1024 * 1024)
+#define MIN_BUFFERS 4
+#define MAX_BUFFERS 32
+
+#define INITIAL_INDEX_CAPACITY 1024
+
+struct OScInternal_RawWriter {
+    OScInternal_StorageFile *file;
+    struct OScInternal_RawHeader header;
+
+    struct OScInternal_RawIndexEntry *index;
+    size_t indexSize;
+    size_t indexCapacity;
+
+    uint32_t *framesPerChannel; // Next frame number of each channel
+    uint32_t numberOfChannels;
+
+    // Compressed frames that do not fit in a write buffer are encoded here
+    void *encodeBuffer;
+    size_t encodeBufferSize;
+
+    // Journal of the index; NULL if not kept
+    OScInternal_Journal *journal;
+    size_t committedRecords;
+    size_t commitRecords; // 0 to commit by time only
+    double commitSeconds; // 0 to commit by count only
+    double lastCommitTime;
+};
+
+static void FillHeader(struct OScInternal_RawHeader *header,
+                       const struct OScInternal_RecordingInfo *info) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, OScInternal_RAW_MAGIC, sizeof(header->magic));
+    header->version = OScInternal_RAW_VERSION;
+    header->headerBytes = OScInternal_STORAGE_ALIGNMENT;
+    header->pixelRateHz = info->pixelRateHz;
+    header->zoomFactor = info->zoomFactor;
+    header->resolution = info->resolution;
+    header->xOffset = info->xOffset;
+    header->yOffset = info->yOffset;
+    header->width = info->width;
+    header->height = info->height;
+    header->numberOfChannels = info->numberOfChannels;
+    header->sampleFormat = info->sampleFormat;
+    header->numberOfFrames = info->numberOfFrames;
+    header->compression = info->compression;
+}
+
+static OSc_RichError *
+CreateJournal(OScInternal_RawWriter *w, const char *path,
+              const struct OScInternal_RecordingInfo *info) {
+    if (info->commitFrames == 0 && info->commitMilliseconds == 0)
+        return OSc_OK;
+    size_t len = strlen(path);
+    char *journalPath = malloc(len + sizeof(OScInternal_RAW_JOURNAL_SUFFIX));
+    if (!journalPath)
+        return OScInternal_Error_OutOfMemory();
+    memcpy(journalPath, path, len);
+    memcpy(journalPath + len, OScInternal_RAW_JOURNAL_SUFFIX,
+           sizeof(OScInternal_RAW_JOURNAL_SUFFIX));
+    OSc_RichError *err = OScInternal_Journal_Create(
+        &w->journal, journalPath, sizeof(struct OScInternal_RawIndexEntry));
+    free(journalPath);
+    if (err)
+        return err;
+
+    uint32_t channels = info->numberOfChannels ? info->numberOfChannels : 1;
+    w->commitRecords = (size_t)info->commitFrames * channels;
+    w->commitSeconds = info->commitMilliseconds / 1000.0;
+    w->lastCommitTime = OScInternal_GetMonotonicTime();
+    return OSc_OK;
+}
+
+static void DestroyJournal(OScInternal_RawWriter *w, bool remove) {
+    OSc_RichError *err = OScInternal_Journal_Close(w->journal, remove);
+    if (err)
+        OScInternal_Error_Destroy(err);
+    w->journal = NULL;
+}
+
+// Make the records written so far durable, and then their index entries
+static OSc_RichError *Commit(OScInternal_RawWriter *w) {
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OScInternal_StorageFile_Sync(w->file)))
+        return err;
+    if (OSc_CHECK_ERROR(err, OScInternal_Journal_Commit(
+                                 w->journal, w->index + w->committedRecords,
+                                 w->indexSize - w->committedRecords)))
+        return err;
+    w->committedRecords = w->indexSize;
+    w->lastCommitTime = OScInternal_GetMonotonicTime();
+    return OSc_OK;
+}
+
+// Commit if enough records, or time, have accumulated. Time is checked only
+// as frames arrive; there is nothing new to commit in between.
+static OSc_RichError *MaybeCommit(OScInternal_RawWriter *w) {
+    if (!w->journal)
+        return OSc_OK;
+    size_t pending = w->indexSize - w->committedRecords;
+    if ((w->commitRecords > 0 && pending >= w->commitRecords) ||
+        (w->commitSeconds > 0.0 &&
+         OScInternal_GetMonotonicTime() - w->lastCommitTime >=
+             w->commitSeconds))
+        return Commit(w);
+    return OSc_OK;
+}
+
+OSc_RichError *
+OScInternal_RawWriter_Create(OScInternal_RawWriter **writer, const char *path,
+                             const struct OScInternal_RecordingInfo *info) {
+    OScInternal_RawWriter *w = calloc(1, sizeof(OScInternal_RawWriter));
+    if (!w)
+        return OScInternal_Error_OutOfMemory();
+    FillHeader(&w->header, info);
+
+    // Buffers hold a whole frame when possible, so that each record is
+    // written with a single request (and compressed frames are encoded in
+    // place). Compressed records are sized for the worst case.
+    uint64_t recordBytes = OScInternal_RecordingInfo_GetFrameBytes(info);
+    if (info->compression == OSc_StorageCompression_Lossless &&
+        recordBytes > 0)
+        recordBytes = OScInternal_Codec_GetMaxEncodedSize(
+            info->width, info->height,
+            OScInternal_SampleFormat_GetBytesPerSample(info->sampleFormat));
+    recordBytes = OScInternal_Storage_Align(recordBytes);
+    if (recordBytes == 0)
+        recordBytes = OScInternal_STORAGE_ALIGNMENT;
+    size_t bufferSize = recordBytes < BUFFER_POOL_BYTES / MIN_BUFFERS
+                            ? (size_t)recordBytes
+                            : BUFFER_POOL_BYTES / MIN_BUFFERS;
+    uint32_t numberOfBuffers = (uint32_t)(BUFFER_POOL_BYTES / bufferSize);
+    if (numberOfBuffers > MAX_BUFFERS)
+        numberOfBuffers = MAX_BUFFERS;
+
+    uint64_t expectedSize = 0;
+    if (info->numberOfFrames != UINT32_MAX) {
+        uint64_t records =
+            (uint64_t)info->numberOfFrames * info->numberOfChannels;
+        expectedSize =
+            OScInternal_STORAGE_ALIGNMENT + records * recordBytes +
+            records * sizeof(struct OScInternal_RawIndexEntry);
+    }
+
+    // The journal is created (truncating any stale one) before the file, so
+    // that it can never describe a different recording
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, CreateJournal(w, path, info))) {
+        free(w);
+        return err;
+    }
+
+    if (OSc_CHECK_ERROR(err, OScInternal_StorageFile_Create(
+                                 &w->file, path, expectedSize, bufferSize,
+                                 numberOfBuffers))) {
+        DestroyJournal(w, true);
+        free(w);
+        return err;
+    }
+
+    // Write the header block now, so that an unclosed file is recognizable
+    void *buffer;
+    err = OScInternal_StorageFile_GetBuffer(w->file, &buffer);
+    if (!err) {
+        memcpy(buffer, &w->header, sizeof(w->header));
+        err = OScInternal_StorageFile_Append(w->file, buffer,
+                                             sizeof(w->header), NULL);
+    }
+    if (err) {
+        OSc_RichError *closeErr = OScInternal_StorageFile_Close(w->file, 0);
+        if (closeErr)
+            OScInternal_Error_Destroy(closeErr);
+        DestroyJournal(w, true);
+        free(w);
+        return err;
+    }
+
+    *writer = w;
+    return OSc_OK;
+}
+
+static bool AddIndexEntry(OScInternal_RawWriter *w,
+                          const struct OScInternal_RawIndexEntry *entry) {
+    if (w->indexSize == w->indexCapacity) {
+        size_t capacity = w->indexCapacity ? 2 * w->indexCapacity
+                                           : INITIAL_INDEX_CAPACITY;
+        struct OScInternal_RawIndexEntry *index =
+            realloc(w->index, capacity * sizeof(*index));
+        if (!index)
+            return false;
+        w->index = index;
+        w->indexCapacity = capacity;
+    }
+    w->index[w->indexSize++] = *entry;
+    return true;
+}
+
+static bool GetFrameNumber(OScInternal_RawWriter *w, uint32_t channel,
+                           uint32_t *frame) {
+    if (channel >= w->numberOfChannels) {
+        uint32_t *counts =
+            realloc(w->framesPerChannel, (channel + 1) * sizeof(uint32_t));
+        if (!counts)
+            return false;
+        memset(counts + w->numberOfChannels, 0,
+               (channel + 1 - w->numberOfChannels) * sizeof(uint32_t));
+        w->framesPerChannel = counts;
+        w->numberOfChannels = channel + 1;
+    }
+    *frame = w->framesPerChannel[channel]++;
+    return true;
+}
+
+// Encode a frame directly into a write buffer if it is sure to fit, or else
+// into the writer's encode buffer
+static OSc_RichError *
+AppendEncoded(OScInternal_RawWriter *w, uint32_t width, uint32_t height,
+              OSc_SampleFormat format, const void *pixels,
+              struct OScInternal_RawIndexEntry *entry) {
+    uint32_t bytesPerSample =
+        OScInternal_SampleFormat_GetBytesPerSample(format);
+    size_t maxSize =
+        OScInternal_Codec_GetMaxEncodedSize(width, height, bytesPerSample);
+    if (maxSize <= OScInternal_StorageFile_GetBufferSize(w->file)) {
+        void *buffer;
+        OSc_RichError *err;
+        if (OSc_CHECK_ERROR(
+                err, OScInternal_StorageFile_GetBuffer(w->file, &buffer)))
+            return err;
+        size_t size = OScInternal_Codec_Encode(pixels, width, height,
+                                               bytesPerSample, buffer);
+        entry->storedBytes = (uint32_t)size;
+        return OScInternal_StorageFile_Append(w->file, buffer, size,
+                                              &entry->offset);
+    }
+    if (w->encodeBufferSize < maxSize) {
+        void *buffer = realloc(w->encodeBuffer, maxSize);
+        if (!buffer)
+            return OScInternal_Error_OutOfMemory();
+        w->encodeBuffer = buffer;
+        w->encodeBufferSize = maxSize;
+    }
+    size_t size = OScInternal_Codec_Encode(pixels, width, height,
+                                           bytesPerSample, w->encodeBuffer);
+    entry->storedBytes = (uint32_t)size;
+    return OScInternal_StorageFile_AppendCopy(w->file, w->encodeBuffer, size,
+                                              &entry->offset);
+}
+
+OSc_RichError *OScInternal_RawWriter_WriteFrame(OScInternal_RawWriter *writer,
+                                                uint32_t channel,
+                                                uint32_t width,
+                                                uint32_t height,
+                                                OSc_SampleFormat format,
+                                                const void *pixels) {
+    size_t bytes = (size_t)width * height *
+                   OScInternal_SampleFormat_GetBytesPerSample(format);
+    if (bytes == 0)
+        return OScInternal_Error_IllegalArgument();
+
+    struct OScInternal_RawIndexEntry entry = {
+        .channel = channel,
+        .width = width,
+        .height = height,
+        .sampleFormat = format,
+    };
+    if (!GetFrameNumber(writer, channel, &entry.frame))
+        return OScInternal_Error_OutOfMemory();
+
+    OSc_RichError *err;
+    if (writer->header.compression == OSc_StorageCompression_Lossless) {
+        err = AppendEncoded(writer, width, height, format, pixels, &entry);
+    } else {
+        entry.storedBytes = (uint32_t)bytes;
+        err = OScInternal_StorageFile_AppendCopy(writer->file, pixels, bytes,
+                                                 &entry.offset);
+    }
+    if (err)
+        return err;
+    if (!AddIndexEntry(writer, &entry))
+        return OScInternal_Error_OutOfMemory();
+    return MaybeCommit(writer);
+}
+
+OSc_RichError *OScInternal_RawWriter_Close(OScInternal_RawWriter *writer) {
+    if (!writer)
+        return OSc_OK;
+
+    OScInternal_StorageFile *file = writer->file;
+    uint64_t indexOffset = OScInternal_StorageFile_GetAppendOffset(file);
+    size_t indexBytes =
+        writer->indexSize * sizeof(struct OScInternal_RawIndexEntry);
+    OSc_RichError *err = OSc_OK;
+    if (indexBytes > 0)
+        err = OScInternal_StorageFile_AppendCopy(file, writer->index,
+                                                 indexBytes, NULL);
+
+    // The header is updated only after everything else is written, so that
+    // it never points to an incomplete index
+    if (err == OSc_OK)
+        err = OScInternal_StorageFile_Flush(file);
+    if (err == OSc_OK) {
+        writer->header.indexOffset = indexOffset;
+        writer->header.numberOfRecords = writer->indexSize;
+        err = OScInternal_StorageFile_WriteAt(file, &writer->header,
+                                              sizeof(writer->header), 0);
+    }
+
+    uint64_t size = err == OSc_OK
+                        ? indexOffset + indexBytes
+                        : OScInternal_StorageFile_GetAppendOffset(file);
+    OSc_RichError *closeErr = OScInternal_StorageFile_Close(file, size);
+    if (closeErr && err)
+        OScInternal_Error_Destroy(closeErr);
+    else if (closeErr)
+        err = closeErr;
+
+    // Once the file is complete, its index supersedes the journal; if not,
+    // the journal is kept for recovery
+    DestroyJournal(writer, err == OSc_OK);
+
+    free(writer->index);
+    free(writer->framesPerChannel);
+    free(writer->encodeBuffer);
+    free(writer);
+    return err;
+}
+
+static OSc_RichError *
+CreateSinkWriter(void **writer, const char *path,
+                 const struct OScInternal_RecordingInfo *info) {
+    return OScInternal_RawWriter_Create((OScInternal_RawWriter **)writer,
+                                        path, info);
+}
+
+static OSc_RichError *WriteSinkFrame(void *writer, uint32_t channel,
+                                     uint32_t width, uint32_t height,
+                                     OSc_SampleFormat format,
+                                     const void *pixels) {
+    return OScInternal_RawWriter_WriteFrame(writer, channel, width, height,
+                                            format, pixels);
+}
+
+static OSc_RichError *CloseSinkWriter(void *writer) {
+    return OScInternal_RawWriter_Close(writer);
+}
+
+static const struct OScInternal_StorageSink g_rawSink = {
+    CreateSinkWriter,
+    WriteSinkFrame,
+    CloseSinkWriter,
+    true,
+};
+
+OSc_RichError *OScInternal_RawWriter_AddStage(OScInternal_Pipeline *pipeline,
+                                              const char *path,
+                                              uint32_t queueDepth,
+                                              OSc_PipelineStage **stage) {
+    return OScInternal_StorageSink_AddStage(pipeline, &g_rawSink, path,
+                                            queueDepth, stage);
+}
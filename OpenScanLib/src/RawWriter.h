@@ -0,0 +1,83 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+#include "Pipeline.h"
+#include "Storage.h"
+
+/*
+ * Raw recording files and their streaming writer.
+ *
+ * A raw file holds one record per channel per frame, each starting at a
+ * multiple of OScInternal_STORAGE_ALIGNMENT (so that records can be written
+ * with direct I/O and mapped for reading). Records hold the samples, or, if
+ * the file is compressed, a frame encoded with the lossless codec (see
+ * Codec.h). The file starts with a header block and ends with an index of
+ * the records, located by the header. All values are in the byte order of
+ * the writing machine. The replay device module (ReplayDeviceModule) has its
+ * own copy of these definitions, which must be kept in sync.
+ *
+ * A file whose header has a zero index offset was not closed (for example,
+ * because the process crashed). Its index can then be recovered, up to the
+ * last commit, from the journal (see Journal.h) kept while recording, named
+ * after the file with OScInternal_RAW_JOURNAL_SUFFIX appended.
+ */
+
+#define OScInternal_RAW_MAGIC "OScRaw\r\n"
+#define OScInternal_RAW_VERSION 2
+#define OScInternal_RAW_JOURNAL_SUFFIX ".journal"
+
+struct OScInternal_RawHeader {
+    char magic[8]; // OScInternal_RAW_MAGIC
+    uint32_t version;
+    uint32_t headerBytes; // Offset of the first record
+    uint64_t indexOffset; // 0 if the file was not closed
+    uint64_t numberOfRecords;
+    double pixelRateHz;
+    double zoomFactor;
+    uint32_t resolution;
+    uint32_t xOffset;
+    uint32_t yOffset;
+    uint32_t width;
+    uint32_t height;
+    uint32_t numberOfChannels;
+    int32_t sampleFormat;
+    uint32_t numberOfFrames; // As requested; UINT32_MAX if unknown
+    int32_t compression;     // OSc_StorageCompression (since version 2)
+    uint32_t reserved;
+};
+
+struct OScInternal_RawIndexEntry {
+    uint64_t offset;
+    uint32_t frame; // Counted per channel
+    uint32_t channel;
+    uint32_t width;
+    uint32_t height;
+    int32_t sampleFormat;
+    uint32_t storedBytes; // Size of the record (before padding)
+};
+
+typedef struct OScInternal_RawWriter OScInternal_RawWriter;
+
+OSc_RichError *
+OScInternal_RawWriter_Create(OScInternal_RawWriter **writer, const char *path,
+                             const struct OScInternal_RecordingInfo *info);
+
+// Copy one channel of one frame into the write buffers; returns once the
+// data is queued for writing.
+OSc_RichError *OScInternal_RawWriter_WriteFrame(OScInternal_RawWriter *writer,
+                                                uint32_t channel,
+                                                uint32_t width,
+                                                uint32_t height,
+                                                OSc_SampleFormat format,
+                                                const void *pixels);
+
+// Write the index and the final header, and close the file. The writer is
+// destroyed even if an error is returned.
+OSc_RichError *OScInternal_RawWriter_Close(OScInternal_RawWriter *writer);
+
+// Add a built-in stage writing every frame it receives to a raw file, which
+// is created when the acquisition is armed and closed when it finishes
+OSc_RichError *OScInternal_RawWriter_AddStage(OScInternal_Pipeline *pipeline,
+                                              const char *path,
+                                              uint32_t queueDepth,
+                                              OSc_PipelineStage **stage);
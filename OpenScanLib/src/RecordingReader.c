@@ -0,0 +1,453 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // madvise()
+#endif
+
+#include "RecordingReader.h"
+#include "Codec.h"
+#include "InternalErrors.h"
+#include "Journal.h"
+#include "SampleFormat.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define NO_RECORD UINT32_MAX
+
+struct OScInternal_RecordingReader {
+    const char *data; // The mapped file
+    uint64_t size;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+
+    const struct OScInternal_RawHeader *header;
+    const struct OScInternal_RawIndexEntry *index;
+    uint64_t numberOfRecords;
+    uint64_t dataEnd; // Records lie before this offset
+    void *recoveredIndex; // Index read from the journal, if not closed
+    uint32_t numberOfFrames;
+    uint32_t numberOfChannels;
+    uint32_t *records; // [frame][channel] -> index entry, or NO_RECORD
+};
+
+static OSc_RichError *FileError(const char *operation, const char *path,
+                                int code) {
+    char message[512];
+#ifdef _WIN32
+    snprintf(message, sizeof(message), "%s %s failed (Windows error %d)",
+             operation, path, code);
+#else
+    snprintf(message, sizeof(message), "%s %s failed: %s", operation, path,
+             strerror(code));
+#endif
+    return OScInternal_Error_Create(message);
+}
+
+static OSc_RichError *FormatError(const char *problem) {
+    char message[256];
+    snprintf(message, sizeof(message), "Not a valid recording: %s", problem);
+    return OScInternal_Error_Create(message);
+}
+
+/*
+ * Platform-dependent mapping
+ */
+
+#ifdef _WIN32
+
+static OSc_RichError *MapFile(OSc_RecordingReader *r, const char *path) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return FileError("Opening", path, (int)GetLastError());
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        OSc_RichError *err = FileError("Reading", path, (int)GetLastError());
+        CloseHandle(file);
+        return err;
+    }
+    r->size = (uint64_t)size.QuadPart;
+    if (r->size < sizeof(struct OScInternal_RawHeader) ||
+        r->size > SIZE_MAX) {
+        CloseHandle(file);
+        return FormatError("file too small or too large to map");
+    }
+    r->mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    DWORD code = GetLastError();
+    CloseHandle(file); // The mapping keeps the file open
+    if (!r->mapping)
+        return FileError("Mapping", path, (int)code);
+    r->data = MapViewOfFile(r->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!r->data) {
+        code = GetLastError();
+        CloseHandle(r->mapping);
+        return FileError("Mapping", path, (int)code);
+    }
+    return OSc_OK;
+}
+
+static void UnmapFile(OSc_RecordingReader *r) {
+    UnmapViewOfFile(r->data);
+    CloseHandle(r->mapping);
+}
+
+enum Advice { ADVICE_NORMAL, ADVICE_SEQUENTIAL, ADVICE_RANDOM };
+
+// Windows has no per-mapping access hints; its read-ahead adapts on its own
+static void AdviseAccess(OSc_RecordingReader *r, enum Advice advice) {
+    (void)r;
+    (void)advice;
+}
+
+static void AdviseWillNeed(OSc_RecordingReader *r, uint64_t offset,
+                           uint64_t size) {
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = (PVOID)(r->data + offset);
+    range.NumberOfBytes = (SIZE_T)size;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+#else
+
+static OSc_RichError *MapFile(OSc_RecordingReader *r, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return FileError("Opening", path, errno);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        OSc_RichError *err = FileError("Reading", path, errno);
+        close(fd);
+        return err;
+    }
+    r->size = (uint64_t)st.st_size;
+    if (r->size < sizeof(struct OScInternal_RawHeader) ||
+        r->size > SIZE_MAX) {
+        close(fd);
+        return FormatError("file too small or too large to map");
+    }
+    void *data = mmap(NULL, (size_t)r->size, PROT_READ, MAP_SHARED, fd, 0);
+    int code = errno;
+    close(fd); // The mapping keeps the file open
+    if (data == MAP_FAILED)
+        return FileError("Mapping", path, code);
+    r->data = data;
+    return OSc_OK;
+}
+
+static void UnmapFile(OSc_RecordingReader *r) {
+    munmap((void *)r->data, (size_t)r->size);
+}
+
+enum Advice { ADVICE_NORMAL, ADVICE_SEQUENTIAL, ADVICE_RANDOM };
+
+static void AdviseAccess(OSc_RecordingReader *r, enum Advice advice) {
+    int a = advice == ADVICE_SEQUENTIAL ? MADV_SEQUENTIAL
+            : advice == ADVICE_RANDOM   ? MADV_RANDOM
+                                        : MADV_NORMAL;
+    // Hints only; failure is harmless
+    madvise((void *)r->data, (size_t)r->size, a);
+}
+
+static void AdviseWillNeed(OSc_RecordingReader *r, uint64_t offset,
+                           uint64_t size) {
+    // The range must start on a page boundary; records are aligned to
+    // OScInternal_STORAGE_ALIGNMENT, a multiple of the usual page size
+    long pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t start = pageSize > 0 ? offset / pageSize * pageSize : offset;
+    madvise((void *)(r->data + start), (size_t)(offset + size - start),
+            MADV_WILLNEED);
+}
+
+#endif
+
+static size_t GetStoredBytes(const struct OScInternal_RawHeader *header,
+                             const struct OScInternal_RawIndexEntry *e) {
+    // Version 1 files (uncompressed) did not record the size
+    if (header->version >= 2)
+        return e->storedBytes;
+    return (size_t)e->width * e->height *
+           OScInternal_SampleFormat_GetBytesPerSample(e->sampleFormat);
+}
+
+static OSc_RichError *BuildTable(OSc_RecordingReader *r) {
+    const struct OScInternal_RawHeader *h = r->header;
+    for (uint64_t i = 0; i < r->numberOfRecords; ++i) {
+        const struct OScInternal_RawIndexEntry *e = &r->index[i];
+        size_t bytes = GetStoredBytes(h, e);
+        if (e->offset < h->headerBytes || e->offset > r->dataEnd ||
+            bytes > r->dataEnd - e->offset)
+            return FormatError("record outside of data");
+        if (e->frame == UINT32_MAX || e->channel == UINT32_MAX)
+            return FormatError("bad record number");
+        if (e->frame >= r->numberOfFrames)
+            r->numberOfFrames = e->frame + 1;
+        if (e->channel >= r->numberOfChannels)
+            r->numberOfChannels = e->channel + 1;
+    }
+
+    size_t count = (size_t)r->numberOfFrames * r->numberOfChannels;
+    if (r->numberOfChannels > 0 && count / r->numberOfChannels !=
+                                       r->numberOfFrames)
+        return OScInternal_Error_OutOfMemory();
+    r->records = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    if (!r->records)
+        return OScInternal_Error_OutOfMemory();
+    for (size_t i = 0; i < count; ++i)
+        r->records[i] = NO_RECORD;
+    for (uint32_t i = 0; i < (uint32_t)r->numberOfRecords; ++i) {
+        const struct OScInternal_RawIndexEntry *e = &r->index[i];
+        r->records[(size_t)e->frame * r->numberOfChannels + e->channel] = i;
+    }
+    return OSc_OK;
+}
+
+// Read the index of a file that was not closed from its journal
+static OSc_RichError *RecoverIndex(OSc_RecordingReader *r, const char *path) {
+    size_t len = strlen(path);
+    char *journalPath = malloc(len + sizeof(OScInternal_RAW_JOURNAL_SUFFIX));
+    if (!journalPath)
+        return OScInternal_Error_OutOfMemory();
+    memcpy(journalPath, path, len);
+    memcpy(journalPath + len, OScInternal_RAW_JOURNAL_SUFFIX,
+           sizeof(OScInternal_RAW_JOURNAL_SUFFIX));
+    size_t count;
+    OSc_RichError *err = OScInternal_Journal_Read(
+        journalPath, sizeof(struct OScInternal_RawIndexEntry),
+        &r->recoveredIndex, &count);
+    free(journalPath);
+    if (err)
+        return OScInternal_Error_Wrap(
+            err, "Recording was not closed and its index cannot be "
+                 "recovered");
+    if (count >= UINT32_MAX)
+        return FormatError("index too large");
+    r->index = r->recoveredIndex;
+    r->numberOfRecords = count;
+    r->dataEnd = r->size;
+    return OSc_OK;
+}
+
+static OSc_RichError *ParseFile(OSc_RecordingReader *r, const char *path) {
+    const struct OScInternal_RawHeader *h =
+        (const struct OScInternal_RawHeader *)r->data;
+    if (memcmp(h->magic, OScInternal_RAW_MAGIC, sizeof(h->magic)) != 0)
+        return FormatError("wrong signature");
+    if (h->version < 1 || h->version > OScInternal_RAW_VERSION)
+        return OScInternal_Error_Create(
+            "Recording format version not supported");
+    r->header = h;
+
+    OSc_RichError *err;
+    if (h->indexOffset == 0) {
+        if (OSc_CHECK_ERROR(err, RecoverIndex(r, path)))
+            return err;
+        return BuildTable(r);
+    }
+    if (h->numberOfRecords >= UINT32_MAX ||
+        h->indexOffset % OScInternal_STORAGE_ALIGNMENT != 0 ||
+        h->indexOffset > r->size ||
+        h->numberOfRecords >
+            (r->size - h->indexOffset) /
+                sizeof(struct OScInternal_RawIndexEntry))
+        return FormatError("index outside of file");
+    r->index = (const struct OScInternal_RawIndexEntry *)(r->data +
+                                                          h->indexOffset);
+    r->numberOfRecords = h->numberOfRecords;
+    r->dataEnd = h->indexOffset;
+    return BuildTable(r);
+}
+
+OSc_RichError *OSc_RecordingReader_Open(OSc_RecordingReader **reader,
+                                        const char *path) {
+    if (!reader || !path)
+        return OScInternal_Error_IllegalArgument();
+    OSc_RecordingReader *r = calloc(1, sizeof(OSc_RecordingReader));
+    if (!r)
+        return OScInternal_Error_OutOfMemory();
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, MapFile(r, path))) {
+        free(r);
+        return err;
+    }
+    if (OSc_CHECK_ERROR(err, ParseFile(r, path))) {
+        free(r->records);
+        free(r->recoveredIndex);
+        UnmapFile(r);
+        free(r);
+        return err;
+    }
+    *reader = r;
+    return OSc_OK;
+}
+
+void OSc_RecordingReader_Close(OSc_RecordingReader *reader) {
+    if (!reader)
+        return;
+    UnmapFile(reader);
+    free(reader->records);
+    free(reader->recoveredIndex);
+    free(reader);
+}
+
+const struct OScInternal_RawIndexEntry *
+OScInternal_RecordingReader_GetRecord(OSc_RecordingReader *reader,
+                                      uint32_t frame, uint32_t channel) {
+    if (frame >= reader->numberOfFrames ||
+        channel >= reader->numberOfChannels)
+        return NULL;
+    uint32_t i = reader->records[(size_t)frame * reader->numberOfChannels +
+                                 channel];
+    return i == NO_RECORD ? NULL : &reader->index[i];
+}
+
+uint32_t OSc_RecordingReader_GetNumberOfFrames(OSc_RecordingReader *reader) {
+    return reader ? reader->numberOfFrames : 0;
+}
+
+uint32_t
+OSc_RecordingReader_GetNumberOfChannels(OSc_RecordingReader *reader) {
+    return reader ? reader->numberOfChannels : 0;
+}
+
+OSc_StorageCompression
+OSc_RecordingReader_GetCompression(OSc_RecordingReader *reader) {
+    if (!reader || reader->header->version < 2)
+        return OSc_StorageCompression_None;
+    return reader->header->compression;
+}
+
+double OSc_RecordingReader_GetPixelRate(OSc_RecordingReader *reader) {
+    return reader ? reader->header->pixelRateHz : 0.0;
+}
+
+uint32_t OSc_RecordingReader_GetResolution(OSc_RecordingReader *reader) {
+    return reader ? reader->header->resolution : 0;
+}
+
+double OSc_RecordingReader_GetZoomFactor(OSc_RecordingReader *reader) {
+    return reader ? reader->header->zoomFactor : 0.0;
+}
+
+void OSc_RecordingReader_GetROI(OSc_RecordingReader *reader,
+                                uint32_t *xOffset, uint32_t *yOffset,
+                                uint32_t *width, uint32_t *height) {
+    const struct OScInternal_RawHeader *h = reader ? reader->header : NULL;
+    if (xOffset)
+        *xOffset = h ? h->xOffset : 0;
+    if (yOffset)
+        *yOffset = h ? h->yOffset : 0;
+    if (width)
+        *width = h ? h->width : 0;
+    if (height)
+        *height = h ? h->height : 0;
+}
+
+OSc_RichError *OSc_RecordingReader_GetFrameInfo(OSc_RecordingReader *reader,
+                                                uint32_t frame,
+                                                uint32_t channel,
+                                                uint32_t *width,
+                                                uint32_t *height,
+                                                OSc_SampleFormat *format) {
+    if (!reader)
+        return OScInternal_Error_IllegalArgument();
+    const struct OScInternal_RawIndexEntry *e =
+        OScInternal_RecordingReader_GetRecord(reader, frame, channel);
+    if (!e)
+        return OScInternal_Error_OutOfRange();
+    if (width)
+        *width = e->width;
+    if (height)
+        *height = e->height;
+    if (format)
+        *format = e->sampleFormat;
+    return OSc_OK;
+}
+
+OSc_RichError *OSc_RecordingReader_GetFrame(OSc_RecordingReader *reader,
+                                            uint32_t frame, uint32_t channel,
+                                            const void **data, size_t *size) {
+    if (!reader || !data)
+        return OScInternal_Error_IllegalArgument();
+    const struct OScInternal_RawIndexEntry *e =
+        OScInternal_RecordingReader_GetRecord(reader, frame, channel);
+    if (!e)
+        return OScInternal_Error_OutOfRange();
+    *data = reader->data + e->offset;
+    if (size)
+        *size = GetStoredBytes(reader->header, e);
+    return OSc_OK;
+}
+
+OSc_RichError *OSc_RecordingReader_ReadFrame(OSc_RecordingReader *reader,
+                                             uint32_t frame, uint32_t channel,
+                                             void *samples, size_t capacity) {
+    const void *data;
+    size_t size;
+    OSc_RichError *err;
+    if (!samples)
+        return OScInternal_Error_IllegalArgument();
+    if (OSc_CHECK_ERROR(err, OSc_RecordingReader_GetFrame(
+                                 reader, frame, channel, &data, &size)))
+        return err;
+    if (OSc_RecordingReader_GetCompression(reader) ==
+        OSc_StorageCompression_Lossless)
+        return OScInternal_Codec_Decode(data, size, samples, capacity);
+    if (size > capacity)
+        return OScInternal_Error_IllegalArgument();
+    memcpy(samples, data, size);
+    return OSc_OK;
+}
+
+OSc_RichError *
+OSc_RecordingReader_SetSequentialAccess(OSc_RecordingReader *reader,
+                                        bool sequential) {
+    if (!reader)
+        return OScInternal_Error_IllegalArgument();
+    AdviseAccess(reader, sequential ? ADVICE_SEQUENTIAL : ADVICE_RANDOM);
+    return OSc_OK;
+}
+
+OSc_RichError *OSc_RecordingReader_Prefetch(OSc_RecordingReader *reader,
+                                            uint32_t firstFrame,
+                                            uint32_t numberOfFrames) {
+    if (!reader)
+        return OScInternal_Error_IllegalArgument();
+    if (firstFrame >= reader->numberOfFrames)
+        return OSc_OK;
+    uint32_t endFrame = reader->numberOfFrames - firstFrame < numberOfFrames
+                            ? reader->numberOfFrames
+                            : firstFrame + numberOfFrames;
+
+    // Records are stored roughly in frame order, so the span of the
+    // requested records is read (including any records of other frames
+    // interleaved with them)
+    uint64_t begin = UINT64_MAX;
+    uint64_t end = 0;
+    for (uint32_t f = firstFrame; f < endFrame; ++f) {
+        for (uint32_t c = 0; c < reader->numberOfChannels; ++c) {
+            const struct OScInternal_RawIndexEntry *e =
+                OScInternal_RecordingReader_GetRecord(reader, f, c);
+            if (!e)
+                continue;
+            uint64_t recordEnd = e->offset + GetStoredBytes(reader->header, e);
+            if (e->offset < begin)
+                begin = e->offset;
+            if (recordEnd > end)
+                end = recordEnd;
+        }
+    }
+    if (begin < end)
+        AdviseWillNeed(reader, begin, end - begin);
+    return OSc_OK;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+#include "RawWriter.h"
+
+/*
+ * Reader of raw recording files (see RawWriter.h), implementing the public
+ * OSc_RecordingReader API.
+ *
+ * The whole file is mapped read-only, and the index at its end is turned
+ * into a table of records by (frame, channel), so that any frame is found
+ * in constant time and returned as a pointer into the mapping, without
+ * copying. The operating system's read-ahead is steered with madvise() (or
+ * PrefetchVirtualMemory() on Windows): sequential playback, random access,
+ * or prefetching of a range of frames ahead of display.
+ *
+ * A file that was not closed has no index; its committed records are then
+ * read from the journal next to it, without scanning the data.
+ *
+ * A reader is not modified after it is opened, so it may be used from any
+ * number of threads.
+ */
+
+// Look up a record; returns NULL if there is no such record
+const struct OScInternal_RawIndexEntry *
+OScInternal_RecordingReader_GetRecord(OSc_RecordingReader *reader,
+                                      uint32_t frame, uint32_t channel);
@@ -0,0 +1,422 @@
+#include "Remap.h"
+#include "InternalErrors.h"
+#include "Parallel.h"
+#include "Threads.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define INVALID_OFFSET UINT32_MAX
+
+// Output is processed in tiles so that the source footprint of a tile stays
+// in cache even when the map walks the source diagonally. A band of
+// TILE_ROWS rows is the unit of work distributed to threads.
+#define TILE_ROWS 16
+#define TILE_COLS 64
+
+// Number of maps kept in the cache after all users release them
+#define CACHE_SIZE 4
+
+struct RemapEntry {
+    uint32_t offset; // Top-left source sample, or INVALID_OFFSET
+    uint16_t fx;     // Weight of right-hand samples, 0-256
+    uint16_t fy;     // Weight of bottom samples, 0-256
+};
+
+struct OScInternal_RemapMap {
+    struct OScInternal_RemapGeometry geometry;
+    unsigned refCount; // Guarded by g_cacheMutex
+
+    // Offsets from the top-left sample to its right and bottom neighbors;
+    // zero in a dimension of size 1.
+    size_t dx;
+    size_t dy;
+
+    struct RemapEntry *entries; // width * height
+};
+
+static OScInternal_Mutex g_cacheMutex = OScInternal_MUTEX_INITIALIZER;
+// Most recently used first; entries hold one reference each
+static OScInternal_RemapMap *g_cache[CACHE_SIZE];
+
+bool OScInternal_RemapGeometry_IsIdentity(
+    const struct OScInternal_RemapGeometry *geometry) {
+    return fmod(geometry->rotationDegrees, 360.0) == 0.0 &&
+           geometry->distortionFunc == NULL;
+}
+
+static bool GeometryEquals(const struct OScInternal_RemapGeometry *g1,
+                           const struct OScInternal_RemapGeometry *g2) {
+    return g1->resolution == g2->resolution &&
+           g1->zoomFactor == g2->zoomFactor && g1->xOffset == g2->xOffset &&
+           g1->yOffset == g2->yOffset && g1->width == g2->width &&
+           g1->height == g2->height &&
+           g1->rotationDegrees == g2->rotationDegrees &&
+           g1->distortionFunc == g2->distortionFunc &&
+           g1->distortionData == g2->distortionData;
+}
+
+// Convert a source coordinate (in pixels, relative to the first pixel center)
+// to the 2x2 neighborhood start and 8-bit weight. Returns false if outside.
+static bool ToFixedPoint(double s, uint32_t size, uint32_t *start,
+                         uint16_t *frac) {
+    if (!(s >= -0.5 && s <= size - 0.5))
+        return false; // Also rejects NaN
+    if (s < 0.0)
+        s = 0.0;
+    if (s > size - 1.0)
+        s = size - 1.0;
+    long q = lround(s * 256.0);
+    long i = q >> 8;
+    long f = q & 0xff;
+    // Keep the 2x2 neighborhood inside the raster
+    long maxStart = size >= 2 ? (long)size - 2 : 0;
+    if (i > maxStart) {
+        f += (i - maxStart) * 256;
+        i = maxStart;
+    }
+    *start = (uint32_t)i;
+    *frac = (uint16_t)f;
+    return true;
+}
+
+static OSc_RichError *
+BuildMap(const struct OScInternal_RemapGeometry *geom,
+         OScInternal_RemapMap **map) {
+    uint64_t nPixels = (uint64_t)geom->width * geom->height;
+    if (nPixels == 0)
+        return OScInternal_Error_EmptyRaster();
+    if (nPixels >= INVALID_OFFSET || nPixels > SIZE_MAX / 8)
+        return OScInternal_Error_OutOfRange();
+
+    *map = calloc(1, sizeof(OScInternal_RemapMap));
+    if (!*map)
+        return OScInternal_Error_OutOfMemory();
+    (*map)->entries = malloc(sizeof(struct RemapEntry) * (size_t)nPixels);
+    if (!(*map)->entries) {
+        free(*map);
+        *map = NULL;
+        return OScInternal_Error_OutOfMemory();
+    }
+    (*map)->geometry = *geom;
+    (*map)->refCount = 1;
+    (*map)->dx = geom->width > 1 ? 1 : 0;
+    (*map)->dy = geom->height > 1 ? geom->width : 0;
+
+    // Coordinates are in full-frame pixels relative to the field center.
+    // The image is rotated about the field center; the raster was scanned
+    // rotated by 'rotationDegrees' (counterclockwise), so an output
+    // (sample-frame) position p is found in the raster at R(-theta) p. The
+    // distortion function works in zoom-independent normalized coordinates.
+    double c = geom->resolution / 2.0;
+    double theta = geom->rotationDegrees * M_PI / 180.0;
+    double cosT = cos(theta);
+    double sinT = sin(theta);
+    double toNormalized = 1.0 / (c * geom->zoomFactor);
+
+    struct RemapEntry *e = (*map)->entries;
+    for (uint32_t j = 0; j < geom->height; ++j) {
+        double y = geom->yOffset + j + 0.5 - c;
+        for (uint32_t i = 0; i < geom->width; ++i, ++e) {
+            double x = geom->xOffset + i + 0.5 - c;
+            double rx = cosT * x + sinT * y;
+            double ry = -sinT * x + cosT * y;
+            if (geom->distortionFunc) {
+                double dx, dy;
+                geom->distortionFunc(rx * toNormalized, ry * toNormalized,
+                                     &dx, &dy, geom->distortionData);
+                rx = dx / toNormalized;
+                ry = dy / toNormalized;
+            }
+            double sx = rx + c - geom->xOffset - 0.5;
+            double sy = ry + c - geom->yOffset - 0.5;
+
+            uint32_t x0, y0;
+            if (ToFixedPoint(sx, geom->width, &x0, &e->fx) &&
+                ToFixedPoint(sy, geom->height, &y0, &e->fy)) {
+                e->offset = y0 * geom->width + x0;
+            } else {
+                e->offset = INVALID_OFFSET;
+                e->fx = e->fy = 0;
+            }
+        }
+    }
+    return OSc_OK;
+}
+
+static void DestroyMap(OScInternal_RemapMap *map) {
+    if (map) {
+        free(map->entries);
+        free(map);
+    }
+}
+
+OSc_RichError *
+OScInternal_RemapMap_Get(const struct OScInternal_RemapGeometry *geometry,
+                         OScInternal_RemapMap **map) {
+    if (!geometry || !map)
+        return OScInternal_Error_IllegalArgument();
+
+    OScInternal_Mutex_Lock(&g_cacheMutex);
+    for (size_t i = 0; i < CACHE_SIZE && g_cache[i]; ++i) {
+        if (GeometryEquals(&g_cache[i]->geometry, geometry)) {
+            *map = g_cache[i];
+            ++(*map)->refCount;
+            memmove(&g_cache[1], &g_cache[0], sizeof(g_cache[0]) * i);
+            g_cache[0] = *map;
+            OScInternal_Mutex_Unlock(&g_cacheMutex);
+            return OSc_OK;
+        }
+    }
+    OScInternal_Mutex_Unlock(&g_cacheMutex);
+
+    // Build without holding the lock (it may take a while, and calls the
+    // client's distortion function). Another thread may concurrently build
+    // an identical map; that is harmless.
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, BuildMap(geometry, map)))
+        return err;
+
+    OScInternal_Mutex_Lock(&g_cacheMutex);
+    OScInternal_RemapMap *evicted = g_cache[CACHE_SIZE - 1];
+    memmove(&g_cache[1], &g_cache[0], sizeof(g_cache[0]) * (CACHE_SIZE - 1));
+    g_cache[0] = *map;
+    ++(*map)->refCount;
+    if (evicted && --evicted->refCount > 0)
+        evicted = NULL;
+    OScInternal_Mutex_Unlock(&g_cacheMutex);
+
+    DestroyMap(evicted);
+    return OSc_OK;
+}
+
+void OScInternal_RemapMap_Release(OScInternal_RemapMap *map) {
+    if (!map)
+        return;
+    OScInternal_Mutex_Lock(&g_cacheMutex);
+    bool last = --map->refCount == 0;
+    OScInternal_Mutex_Unlock(&g_cacheMutex);
+    if (last)
+        DestroyMap(map);
+}
+
+/*
+ * Kernels. Interpolation is separable and rounds after each pass:
+ *     top = (s00 * (256 - fx) + s01 * fx + 128) >> 8
+ *     bot = (s10 * (256 - fx) + s11 * fx + 128) >> 8
+ *     out = (top * (256 - fy) + bot * fy + 128) >> 8
+ * so that all intermediates of the 16-bit kernel fit in 32 bits and the SIMD
+ * and scalar versions produce identical results.
+ */
+
+#define DEFINE_SCALAR_KERNEL(name, sampleType, accumType)                    \
+    static void name(const struct RemapEntry *e, size_t n,                   \
+                     const sampleType *src, sampleType *dst, size_t dx,       \
+                     size_t dy) {                                             \
+        for (size_t k = 0; k < n; ++k) {                                      \
+            if (e[k].offset == INVALID_OFFSET) {                              \
+                dst[k] = 0;                                                   \
+                continue;                                                     \
+            }                                                                 \
+            const sampleType *s = src + e[k].offset;                          \
+            accumType fx = e[k].fx, fy = e[k].fy;                             \
+            accumType top = (s[0] * (256 - fx) + s[dx] * fx + 128) >> 8;      \
+            accumType bot =                                                   \
+                (s[dy] * (256 - fx) + s[dy + dx] * fx + 128) >> 8;            \
+            dst[k] = (sampleType)((top * (256 - fy) + bot * fy + 128) >> 8);  \
+        }                                                                     \
+    }
+
+DEFINE_SCALAR_KERNEL(Remap8, uint8_t, uint32_t)
+DEFINE_SCALAR_KERNEL(Remap16, uint16_t, uint32_t)
+DEFINE_SCALAR_KERNEL(Remap32, uint32_t, uint64_t)
+
+static void RemapFloat(const struct RemapEntry *e, size_t n, const float *src,
+                       float *dst, size_t dx, size_t dy) {
+    for (size_t k = 0; k < n; ++k) {
+        if (e[k].offset == INVALID_OFFSET) {
+            dst[k] = 0.0f;
+            continue;
+        }
+        const float *s = src + e[k].offset;
+        float fx = e[k].fx * (1.0f / 256.0f);
+        float fy = e[k].fy * (1.0f / 256.0f);
+        float top = s[0] + (s[dx] - s[0]) * fx;
+        float bot = s[dy] + (s[dy + dx] - s[dy]) * fx;
+        dst[k] = top + (bot - top) * fy;
+    }
+}
+
+#ifdef HAVE_SSE2
+
+// (a * wa + b * wb + 128) >> 8 for 8 lanes of uint16, where the result is
+// known to fit in 16 bits.
+static inline __m128i Lerp16x8(__m128i a, __m128i wa, __m128i b,
+                               __m128i wb) {
+    __m128i aLo = _mm_mullo_epi16(a, wa);
+    __m128i aHi = _mm_mulhi_epu16(a, wa);
+    __m128i bLo = _mm_mullo_epi16(b, wb);
+    __m128i bHi = _mm_mulhi_epu16(b, wb);
+    __m128i round = _mm_set1_epi32(128);
+    __m128i sum0 = _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(aLo, aHi),
+                                               _mm_unpacklo_epi16(bLo, bHi)),
+                                 round);
+    __m128i sum1 = _mm_add_epi32(_mm_add_epi32(_mm_unpackhi_epi16(aLo, aHi),
+                                               _mm_unpackhi_epi16(bLo, bHi)),
+                                 round);
+    // Unsigned 32-to-16 pack via signed saturation of biased values
+    __m128i bias = _mm_set1_epi32(32768);
+    sum0 = _mm_sub_epi32(_mm_srli_epi32(sum0, 8), bias);
+    sum1 = _mm_sub_epi32(_mm_srli_epi32(sum1, 8), bias);
+    return _mm_xor_si128(_mm_packs_epi32(sum0, sum1),
+                         _mm_set1_epi16((short)0x8000));
+}
+
+static void Remap16_SSE2(const struct RemapEntry *e, size_t n,
+                         const uint16_t *src, uint16_t *dst, size_t dx,
+                         size_t dy) {
+    const __m128i w256 = _mm_set1_epi16(256);
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        // There is no gather in SSE2; load neighborhoods into lanes.
+        uint16_t s00[8], s01[8], s10[8], s11[8], fx[8], fy[8];
+        for (size_t l = 0; l < 8; ++l) {
+            const struct RemapEntry *el = &e[k + l];
+            if (el->offset == INVALID_OFFSET) {
+                s00[l] = s01[l] = s10[l] = s11[l] = 0;
+                fx[l] = fy[l] = 0;
+                continue;
+            }
+            const uint16_t *s = src + el->offset;
+            s00[l] = s[0];
+            s01[l] = s[dx];
+            s10[l] = s[dy];
+            s11[l] = s[dy + dx];
+            fx[l] = el->fx;
+            fy[l] = el->fy;
+        }
+        __m128i vfx = _mm_loadu_si128((const __m128i *)fx);
+        __m128i vfy = _mm_loadu_si128((const __m128i *)fy);
+        __m128i vgx = _mm_sub_epi16(w256, vfx);
+        __m128i vgy = _mm_sub_epi16(w256, vfy);
+        __m128i top = Lerp16x8(_mm_loadu_si128((const __m128i *)s00), vgx,
+                               _mm_loadu_si128((const __m128i *)s01), vfx);
+        __m128i bot = Lerp16x8(_mm_loadu_si128((const __m128i *)s10), vgx,
+                               _mm_loadu_si128((const __m128i *)s11), vfx);
+        _mm_storeu_si128((__m128i *)(dst + k), Lerp16x8(top, vgy, bot, vfy));
+    }
+    Remap16(e + k, n - k, src, dst + k, dx, dy);
+}
+
+#endif // HAVE_SSE2
+
+typedef void (*Remap16Func)(const struct RemapEntry *e, size_t n,
+                            const uint16_t *src, uint16_t *dst, size_t dx,
+                            size_t dy);
+
+// Bound by OScInternal_Remap_BindKernels()
+static Remap16Func g_remap16 = Remap16;
+
+OSc_SIMDLevel OScInternal_Remap_BindKernels(OSc_SIMDLevel level) {
+#ifdef HAVE_SSE2
+    if (level >= OSc_SIMDLevel_SSE42) {
+        g_remap16 = Remap16_SSE2;
+        return OSc_SIMDLevel_SSE42;
+    }
+#endif
+    g_remap16 = Remap16;
+    return OSc_SIMDLevel_Scalar;
+}
+
+struct ApplyJob {
+    const OScInternal_RemapMap *map;
+    const void *src;
+    void *dst;
+    uint32_t bytesPerSample;
+    bool isFloat;
+};
+
+static void ApplyBands(void *data, size_t beginBand, size_t endBand) {
+    const struct ApplyJob *job = data;
+    const OScInternal_RemapMap *map = job->map;
+    size_t width = map->geometry.width;
+    size_t height = map->geometry.height;
+    size_t rowEnd =
+        endBand * TILE_ROWS < height ? endBand * TILE_ROWS : height;
+
+    for (size_t tileRow = beginBand * TILE_ROWS; tileRow < rowEnd;
+         tileRow += TILE_ROWS) {
+        size_t tileRowEnd =
+            tileRow + TILE_ROWS < rowEnd ? tileRow + TILE_ROWS : rowEnd;
+        for (size_t tileCol = 0; tileCol < width; tileCol += TILE_COLS) {
+            size_t n = tileCol + TILE_COLS < width ? TILE_COLS
+                                                   : width - tileCol;
+            for (size_t row = tileRow; row < tileRowEnd; ++row) {
+                size_t i = row * width + tileCol;
+                const struct RemapEntry *e = map->entries + i;
+                switch (job->bytesPerSample) {
+                case 1:
+                    Remap8(e, n, job->src, (uint8_t *)job->dst + i, map->dx,
+                           map->dy);
+                    break;
+                case 2:
+                    g_remap16(e, n, job->src, (uint16_t *)job->dst + i,
+                              map->dx, map->dy);
+                    break;
+                case 4:
+                    if (job->isFloat)
+                        RemapFloat(e, n, job->src, (float *)job->dst + i,
+                                   map->dx, map->dy);
+                    else
+                        Remap32(e, n, job->src, (uint32_t *)job->dst + i,
+                                map->dx, map->dy);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void Apply(const struct ApplyJob *job) {
+    const OScInternal_RemapMap *map = job->map;
+    size_t nBands = (map->geometry.height + TILE_ROWS - 1) / TILE_ROWS;
+    // Aim for bands of at least 64K pixels per task
+    size_t grain = 1 + 65536 / ((size_t)map->geometry.width * TILE_ROWS);
+    OScInternal_ParallelFor(nBands, grain, ApplyBands, (void *)job);
+}
+
+void OScInternal_RemapMap_Apply(const OScInternal_RemapMap *map,
+                                const void *src, void *dst,
+                                uint32_t bytesPerSample) {
+    if (bytesPerSample != 1 && bytesPerSample != 2 && bytesPerSample != 4)
+        return;
+    struct ApplyJob job = {
+        .map = map,
+        .src = src,
+        .dst = dst,
+        .bytesPerSample = bytesPerSample,
+    };
+    Apply(&job);
+}
+
+void OScInternal_RemapMap_ApplyFloat(const OScInternal_RemapMap *map,
+                                     const float *src, float *dst) {
+    struct ApplyJob job = {
+        .map = map,
+        .src = src,
+        .dst = dst,
+        .bytesPerSample = 4,
+        .isFloat = true,
+    };
+    Apply(&job);
+}
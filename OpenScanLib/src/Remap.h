@@ -0,0 +1,54 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * 2D remap engine, used to correct scan rotation and scanner field
+ * distortion by resampling each frame through a precomputed coordinate map.
+ *
+ * A map stores, for each output pixel, the index of the top-left source
+ * sample of the 2x2 neighborhood and the bilinear weights in 8-bit fixed
+ * point. Maps are cached by geometry, so that repeated acquisitions with the
+ * same settings do not recompute them.
+ */
+
+struct OScInternal_RemapGeometry {
+    uint32_t resolution;
+    double zoomFactor;
+    uint32_t xOffset;
+    uint32_t yOffset;
+    uint32_t width;
+    uint32_t height;
+
+    double rotationDegrees;
+    OSc_FieldDistortionFunc distortionFunc; // May be NULL
+    void *distortionData;
+};
+
+typedef struct OScInternal_RemapMap OScInternal_RemapMap;
+
+// True if the geometry requires no resampling at all
+bool OScInternal_RemapGeometry_IsIdentity(
+    const struct OScInternal_RemapGeometry *geometry);
+
+// Get a (possibly cached) map for the geometry. The map must be released
+// with OScInternal_RemapMap_Release().
+OSc_RichError *
+OScInternal_RemapMap_Get(const struct OScInternal_RemapGeometry *geometry,
+                         OScInternal_RemapMap **map);
+
+void OScInternal_RemapMap_Release(OScInternal_RemapMap *map);
+
+// Resample one channel of one frame. 'src' and 'dst' are width x height
+// samples; samples outside of the source raster are set to zero. Safe to call
+// concurrently on the same map with different buffers.
+void OScInternal_RemapMap_Apply(const OScInternal_RemapMap *map,
+                                const void *src, void *dst,
+                                uint32_t bytesPerSample);
+
+// Like OScInternal_RemapMap_Apply(), for 32-bit floating-point samples.
+void OScInternal_RemapMap_ApplyFloat(const OScInternal_RemapMap *map,
+                                     const float *src, float *dst);
+
+// Bind the kernels for 'level' and return the level bound (see Dispatch.h)
+OSc_SIMDLevel OScInternal_Remap_BindKernels(OSc_SIMDLevel level);
@@ -0,0 +1,536 @@
+#include "SampleFormat.h"
+#include "CPU.h"
+#include "InternalErrors.h"
+#include "Parallel.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#ifdef OScInternal_X86
+#include <immintrin.h>
+#endif
+
+// Samples per unit of parallel work; even, so that chunks of packed samples
+// start on a byte boundary
+#define CHUNK 32768
+
+// Samples per step of the generic conversion
+#define GENERIC_BLOCK 256
+
+enum Kind {
+    KIND_UNSIGNED,
+    KIND_SIGNED,
+    KIND_FLOAT,
+};
+
+struct FormatInfo {
+    uint8_t kind;
+    uint8_t bits; // Significant bits
+    uint8_t bytes;
+};
+
+static const struct FormatInfo FORMATS[] = {
+    [OSc_SampleFormat_UInt8] = {KIND_UNSIGNED, 8, 1},
+    [OSc_SampleFormat_UInt12] = {KIND_UNSIGNED, 12, 2},
+    [OSc_SampleFormat_UInt12Packed] = {KIND_UNSIGNED, 12, 2},
+    [OSc_SampleFormat_UInt16] = {KIND_UNSIGNED, 16, 2},
+    [OSc_SampleFormat_UInt32] = {KIND_UNSIGNED, 32, 4},
+    [OSc_SampleFormat_Int8] = {KIND_SIGNED, 8, 1},
+    [OSc_SampleFormat_Int16] = {KIND_SIGNED, 16, 2},
+    [OSc_SampleFormat_Int32] = {KIND_SIGNED, 32, 4},
+    [OSc_SampleFormat_Float32] = {KIND_FLOAT, 32, 4},
+};
+
+bool OScInternal_SampleFormat_IsValid(OSc_SampleFormat format) {
+    return format >= 0 &&
+           format < (OSc_SampleFormat)(sizeof(FORMATS) / sizeof(FORMATS[0]));
+}
+
+bool OScInternal_SampleFormat_IsUnsignedInteger(OSc_SampleFormat format) {
+    return OScInternal_SampleFormat_IsValid(format) &&
+           FORMATS[format].kind == KIND_UNSIGNED;
+}
+
+uint32_t OScInternal_SampleFormat_GetBytesPerSample(OSc_SampleFormat format) {
+    if (!OScInternal_SampleFormat_IsValid(format))
+        return 0;
+    return FORMATS[format].bytes;
+}
+
+size_t OScInternal_SampleFormat_GetBufferSize(OSc_SampleFormat format,
+                                              size_t count) {
+    if (format == OSc_SampleFormat_UInt12Packed)
+        return (3 * count + 1) / 2;
+    return count * OScInternal_SampleFormat_GetBytesPerSample(format);
+}
+
+uint32_t OScInternal_SampleFormat_GetMaxValue(OSc_SampleFormat format) {
+    if (!OScInternal_SampleFormat_IsUnsignedInteger(format))
+        return 0;
+    uint32_t bits = FORMATS[format].bits;
+    return bits < 32 ? (1u << bits) - 1 : UINT32_MAX;
+}
+
+OSc_SampleFormat OScInternal_SampleFormat_FromBytesPerSample(uint32_t bytes) {
+    switch (bytes) {
+    case 1:
+        return OSc_SampleFormat_UInt8;
+    case 2:
+        return OSc_SampleFormat_UInt16;
+    case 4:
+        return OSc_SampleFormat_UInt32;
+    default:
+        return -1;
+    }
+}
+
+static OSc_SampleFormat UnsignedFormat(uint32_t bits) {
+    if (bits <= 8)
+        return OSc_SampleFormat_UInt8;
+    if (bits <= 12)
+        return OSc_SampleFormat_UInt12;
+    if (bits <= 16)
+        return OSc_SampleFormat_UInt16;
+    return OSc_SampleFormat_UInt32;
+}
+
+static OSc_SampleFormat SignedFormat(uint32_t bits) {
+    if (bits <= 8)
+        return OSc_SampleFormat_Int8;
+    if (bits <= 16)
+        return OSc_SampleFormat_Int16;
+    return OSc_SampleFormat_Int32;
+}
+
+OSc_SampleFormat OScInternal_SampleFormat_Promote(OSc_SampleFormat a,
+                                                  OSc_SampleFormat b) {
+    struct FormatInfo fa = FORMATS[a], fb = FORMATS[b];
+    if (fa.kind == KIND_FLOAT || fb.kind == KIND_FLOAT)
+        return OSc_SampleFormat_Float32;
+    if (fa.kind == fb.kind) {
+        uint32_t bits = fa.bits > fb.bits ? fa.bits : fb.bits;
+        return fa.kind == KIND_SIGNED ? SignedFormat(bits)
+                                      : UnsignedFormat(bits);
+    }
+    // Mixed signedness: the unsigned values need one more bit when signed
+    uint32_t sbits = fa.kind == KIND_SIGNED ? fa.bits : fb.bits;
+    uint32_t ubits = fa.kind == KIND_SIGNED ? fb.bits : fa.bits;
+    return SignedFormat(ubits + 1 > sbits ? ubits + 1 : sbits);
+}
+
+/*
+ * Generic conversion, used for any pair of formats without a dedicated
+ * kernel: samples are loaded into doubles (which represent all values of
+ * every format exactly), then rounded, clamped, and stored.
+ */
+
+static inline uint16_t LoadPacked12(const uint8_t *src, size_t i) {
+    const uint8_t *b = src + i / 2 * 3;
+    if (i % 2)
+        return (uint16_t)((b[1] >> 4) | (b[2] << 4));
+    return (uint16_t)(b[0] | ((b[1] & 0xf) << 8));
+}
+
+static void LoadGeneric(const void *src, OSc_SampleFormat format,
+                        size_t begin, size_t n, double *values) {
+    switch (format) {
+#define LOAD_CASE(fmt, type)                                                  \
+    case fmt:                                                                 \
+        for (size_t i = 0; i < n; ++i)                                        \
+            values[i] = ((const type *)src)[begin + i];                       \
+        break;
+        LOAD_CASE(OSc_SampleFormat_UInt8, uint8_t)
+        LOAD_CASE(OSc_SampleFormat_UInt12, uint16_t)
+        LOAD_CASE(OSc_SampleFormat_UInt16, uint16_t)
+        LOAD_CASE(OSc_SampleFormat_UInt32, uint32_t)
+        LOAD_CASE(OSc_SampleFormat_Int8, int8_t)
+        LOAD_CASE(OSc_SampleFormat_Int16, int16_t)
+        LOAD_CASE(OSc_SampleFormat_Int32, int32_t)
+        LOAD_CASE(OSc_SampleFormat_Float32, float)
+#undef LOAD_CASE
+    case OSc_SampleFormat_UInt12Packed:
+        for (size_t i = 0; i < n; ++i)
+            values[i] = LoadPacked12(src, begin + i);
+        break;
+    }
+}
+
+static inline double RoundAndClamp(double v, double min, double max) {
+    if (!(v >= min)) // Also NaN
+        return v != v ? 0.0 : min;
+    if (v > max)
+        return max;
+    return floor(v + 0.5);
+}
+
+static void StoreGeneric(const double *values, OSc_SampleFormat format,
+                         void *dst, size_t begin, size_t n) {
+    switch (format) {
+#define STORE_CASE(fmt, type, min, max)                                       \
+    case fmt:                                                                 \
+        for (size_t i = 0; i < n; ++i)                                        \
+            ((type *)dst)[begin + i] =                                        \
+                (type)RoundAndClamp(values[i], min, max);                     \
+        break;
+        STORE_CASE(OSc_SampleFormat_UInt8, uint8_t, 0, UINT8_MAX)
+        STORE_CASE(OSc_SampleFormat_UInt12, uint16_t, 0, 4095)
+        STORE_CASE(OSc_SampleFormat_UInt16, uint16_t, 0, UINT16_MAX)
+        STORE_CASE(OSc_SampleFormat_UInt32, uint32_t, 0, UINT32_MAX)
+        STORE_CASE(OSc_SampleFormat_Int8, int8_t, INT8_MIN, INT8_MAX)
+        STORE_CASE(OSc_SampleFormat_Int16, int16_t, INT16_MIN, INT16_MAX)
+        STORE_CASE(OSc_SampleFormat_Int32, int32_t, INT32_MIN, INT32_MAX)
+#undef STORE_CASE
+    case OSc_SampleFormat_Float32:
+        for (size_t i = 0; i < n; ++i)
+            ((float *)dst)[begin + i] = (float)values[i];
+        break;
+    }
+}
+
+typedef void (*ConvertKernel)(const void *src, void *dst, size_t begin,
+                              size_t end);
+
+struct ConvertJob {
+    const void *src;
+    OSc_SampleFormat srcFormat;
+    void *dst;
+    OSc_SampleFormat dstFormat;
+    size_t count;
+    ConvertKernel kernel; // NULL for generic conversion
+};
+
+static void ConvertGeneric(const struct ConvertJob *job, size_t begin,
+                           size_t end) {
+    double values[GENERIC_BLOCK];
+    for (size_t i = begin; i < end; i += GENERIC_BLOCK) {
+        size_t n = end - i < GENERIC_BLOCK ? end - i : GENERIC_BLOCK;
+        LoadGeneric(job->src, job->srcFormat, i, n, values);
+        StoreGeneric(values, job->dstFormat, job->dst, i, n);
+    }
+}
+
+/*
+ * Dedicated kernels for common conversions. Each converts samples [begin,
+ * end). The SIMD variants finish the remainder with the scalar variant.
+ */
+
+#define DEFINE_SCALAR_KERNEL(name, srcType, dstType, expr)                    \
+    static void name(const void *src, void *dst, size_t begin, size_t end) {  \
+        const srcType *s = src;                                               \
+        dstType *d = dst;                                                     \
+        for (size_t i = begin; i < end; ++i)                                  \
+            d[i] = (expr);                                                    \
+    }
+
+DEFINE_SCALAR_KERNEL(Widen8To16, uint8_t, uint16_t, s[i])
+DEFINE_SCALAR_KERNEL(Widen16To32, uint16_t, uint32_t, s[i])
+DEFINE_SCALAR_KERNEL(WidenSigned16To32, int16_t, int32_t, s[i])
+DEFINE_SCALAR_KERNEL(Unsigned8ToFloat, uint8_t, float, s[i])
+DEFINE_SCALAR_KERNEL(Unsigned16ToFloat, uint16_t, float, s[i])
+DEFINE_SCALAR_KERNEL(Signed16ToFloat, int16_t, float, s[i])
+// Unsigned 16-bit (or 12-bit) to unsigned 8-bit, saturating
+DEFINE_SCALAR_KERNEL(Narrow16To8, uint16_t, uint8_t,
+                     s[i] > UINT8_MAX ? UINT8_MAX : (uint8_t)s[i])
+DEFINE_SCALAR_KERNEL(Saturate16To12, uint16_t, uint16_t,
+                     s[i] > 4095 ? 4095 : s[i])
+DEFINE_SCALAR_KERNEL(UnpackPacked12, uint8_t, uint16_t, LoadPacked12(s, i))
+
+#undef DEFINE_SCALAR_KERNEL
+
+#ifdef HAVE_SSE2
+
+static void Widen8To16_SSE2(const void *src, void *dst, size_t begin,
+                            size_t end) {
+    const uint8_t *s = src;
+    uint16_t *d = dst;
+    size_t i = begin;
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= end; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        _mm_storeu_si128((__m128i *)(d + i), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128((__m128i *)(d + i + 8), _mm_unpackhi_epi8(v, zero));
+    }
+    Widen8To16(src, dst, i, end);
+}
+
+static void Widen16To32_SSE2(const void *src, void *dst, size_t begin,
+                             size_t end) {
+    const uint16_t *s = src;
+    uint32_t *d = dst;
+    size_t i = begin;
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= end; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        _mm_storeu_si128((__m128i *)(d + i), _mm_unpacklo_epi16(v, zero));
+        _mm_storeu_si128((__m128i *)(d + i + 4),
+                         _mm_unpackhi_epi16(v, zero));
+    }
+    Widen16To32(src, dst, i, end);
+}
+
+static void WidenSigned16To32_SSE2(const void *src, void *dst, size_t begin,
+                                   size_t end) {
+    const int16_t *s = src;
+    int32_t *d = dst;
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i sign = _mm_srai_epi16(v, 15);
+        _mm_storeu_si128((__m128i *)(d + i), _mm_unpacklo_epi16(v, sign));
+        _mm_storeu_si128((__m128i *)(d + i + 4),
+                         _mm_unpackhi_epi16(v, sign));
+    }
+    WidenSigned16To32(src, dst, i, end);
+}
+
+static void Unsigned8ToFloat_SSE2(const void *src, void *dst, size_t begin,
+                                  size_t end) {
+    const uint8_t *s = src;
+    float *d = dst;
+    size_t i = begin;
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= end; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_ps(d + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_ps(d + i + 4,
+                      _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_ps(d + i + 8,
+                      _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_ps(d + i + 12,
+                      _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+    }
+    Unsigned8ToFloat(src, dst, i, end);
+}
+
+static void Unsigned16ToFloat_SSE2(const void *src, void *dst, size_t begin,
+                                   size_t end) {
+    const uint16_t *s = src;
+    float *d = dst;
+    size_t i = begin;
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= end; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        _mm_storeu_ps(d + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)));
+        _mm_storeu_ps(d + i + 4,
+                      _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)));
+    }
+    Unsigned16ToFloat(src, dst, i, end);
+}
+
+static void Signed16ToFloat_SSE2(const void *src, void *dst, size_t begin,
+                                 size_t end) {
+    const int16_t *s = src;
+    float *d = dst;
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i sign = _mm_srai_epi16(v, 15);
+        _mm_storeu_ps(d + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, sign)));
+        _mm_storeu_ps(d + i + 4,
+                      _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, sign)));
+    }
+    Signed16ToFloat(src, dst, i, end);
+}
+
+static void Narrow16To8_SSE2(const void *src, void *dst, size_t begin,
+                             size_t end) {
+    const uint16_t *s = src;
+    uint8_t *d = dst;
+    size_t i = begin;
+    // min(x, m) == x - max(x - m, 0), using unsigned saturating subtraction
+    const __m128i max = _mm_set1_epi16(UINT8_MAX);
+    for (; i + 16 <= end; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + 8));
+        a = _mm_sub_epi16(a, _mm_subs_epu16(a, max));
+        b = _mm_sub_epi16(b, _mm_subs_epu16(b, max));
+        _mm_storeu_si128((__m128i *)(d + i), _mm_packus_epi16(a, b));
+    }
+    Narrow16To8(src, dst, i, end);
+}
+
+static void Saturate16To12_SSE2(const void *src, void *dst, size_t begin,
+                                size_t end) {
+    const uint16_t *s = src;
+    uint16_t *d = dst;
+    size_t i = begin;
+    const __m128i max = _mm_set1_epi16(4095);
+    for (; i + 8 <= end; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        v = _mm_sub_epi16(v, _mm_subs_epu16(v, max));
+        _mm_storeu_si128((__m128i *)(d + i), v);
+    }
+    Saturate16To12(src, dst, i, end);
+}
+
+#endif // HAVE_SSE2
+
+#ifdef OScInternal_X86
+
+// 8 samples (12 bytes) per step; each step loads 16 bytes, so stop while at
+// least 11 samples remain, which guarantees the extra 4 bytes exist.
+OScInternal_TARGET_SSSE3 static void UnpackPacked12_SSSE3(const void *src,
+                                                          void *dst,
+                                                          size_t begin,
+                                                          size_t end) {
+    const uint8_t *s = src;
+    uint16_t *d = dst;
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8,
+                                          9, 10, 10, 11);
+    const __m128i evenMask = _mm_set1_epi32(0x00000fff);
+    const __m128i oddMask = _mm_set1_epi32((int)0xffff0000);
+    size_t i = begin;
+    for (; i + 11 <= end; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i / 2 * 3));
+        v = _mm_shuffle_epi8(v, shuffle);
+        __m128i even = _mm_and_si128(v, evenMask);
+        __m128i odd = _mm_and_si128(_mm_srli_epi16(v, 4), oddMask);
+        _mm_storeu_si128((__m128i *)(d + i), _mm_or_si128(even, odd));
+    }
+    UnpackPacked12(src, dst, i, end);
+}
+
+#endif
+
+enum KernelIndex {
+    KERNEL_WIDEN_8_TO_16,
+    KERNEL_WIDEN_16_TO_32,
+    KERNEL_WIDEN_SIGNED_16_TO_32,
+    KERNEL_UNSIGNED_8_TO_FLOAT,
+    KERNEL_UNSIGNED_16_TO_FLOAT,
+    KERNEL_SIGNED_16_TO_FLOAT,
+    KERNEL_NARROW_16_TO_8,
+    KERNEL_SATURATE_16_TO_12,
+    KERNEL_UNPACK_PACKED_12,
+    NUM_KERNELS,
+};
+
+static const ConvertKernel SCALAR_KERNELS[NUM_KERNELS] = {
+    [KERNEL_WIDEN_8_TO_16] = Widen8To16,
+    [KERNEL_WIDEN_16_TO_32] = Widen16To32,
+    [KERNEL_WIDEN_SIGNED_16_TO_32] = WidenSigned16To32,
+    [KERNEL_UNSIGNED_8_TO_FLOAT] = Unsigned8ToFloat,
+    [KERNEL_UNSIGNED_16_TO_FLOAT] = Unsigned16ToFloat,
+    [KERNEL_SIGNED_16_TO_FLOAT] = Signed16ToFloat,
+    [KERNEL_NARROW_16_TO_8] = Narrow16To8,
+    [KERNEL_SATURATE_16_TO_12] = Saturate16To12,
+    [KERNEL_UNPACK_PACKED_12] = UnpackPacked12,
+};
+
+#if defined(HAVE_SSE2) && defined(OScInternal_X86)
+// The SSE4.2 level implies SSSE3
+static const ConvertKernel SSE_KERNELS[NUM_KERNELS] = {
+    [KERNEL_WIDEN_8_TO_16] = Widen8To16_SSE2,
+    [KERNEL_WIDEN_16_TO_32] = Widen16To32_SSE2,
+    [KERNEL_WIDEN_SIGNED_16_TO_32] = WidenSigned16To32_SSE2,
+    [KERNEL_UNSIGNED_8_TO_FLOAT] = Unsigned8ToFloat_SSE2,
+    [KERNEL_UNSIGNED_16_TO_FLOAT] = Unsigned16ToFloat_SSE2,
+    [KERNEL_SIGNED_16_TO_FLOAT] = Signed16ToFloat_SSE2,
+    [KERNEL_NARROW_16_TO_8] = Narrow16To8_SSE2,
+    [KERNEL_SATURATE_16_TO_12] = Saturate16To12_SSE2,
+    [KERNEL_UNPACK_PACKED_12] = UnpackPacked12_SSSE3,
+};
+#endif
+
+// Bound by OScInternal_SampleFormat_BindKernels()
+static const ConvertKernel *g_kernels = SCALAR_KERNELS;
+
+OSc_SIMDLevel OScInternal_SampleFormat_BindKernels(OSc_SIMDLevel level) {
+#if defined(HAVE_SSE2) && defined(OScInternal_X86)
+    if (level >= OSc_SIMDLevel_SSE42) {
+        g_kernels = SSE_KERNELS;
+        return OSc_SIMDLevel_SSE42;
+    }
+#endif
+    g_kernels = SCALAR_KERNELS;
+    return OSc_SIMDLevel_Scalar;
+}
+
+static ConvertKernel FindKernel(OSc_SampleFormat srcFormat,
+                                OSc_SampleFormat dstFormat) {
+    switch (srcFormat) {
+    case OSc_SampleFormat_UInt8:
+        if (dstFormat == OSc_SampleFormat_UInt12 ||
+            dstFormat == OSc_SampleFormat_UInt16 ||
+            dstFormat == OSc_SampleFormat_Int16)
+            return g_kernels[KERNEL_WIDEN_8_TO_16];
+        if (dstFormat == OSc_SampleFormat_Float32)
+            return g_kernels[KERNEL_UNSIGNED_8_TO_FLOAT];
+        break;
+    case OSc_SampleFormat_UInt12Packed:
+        if (dstFormat == OSc_SampleFormat_UInt12 ||
+            dstFormat == OSc_SampleFormat_UInt16 ||
+            dstFormat == OSc_SampleFormat_Int16)
+            return g_kernels[KERNEL_UNPACK_PACKED_12];
+        break;
+    case OSc_SampleFormat_UInt12:
+    case OSc_SampleFormat_UInt16:
+        if (dstFormat == OSc_SampleFormat_UInt8)
+            return g_kernels[KERNEL_NARROW_16_TO_8];
+        if (dstFormat == OSc_SampleFormat_UInt12)
+            return g_kernels[KERNEL_SATURATE_16_TO_12];
+        if (dstFormat == OSc_SampleFormat_UInt32 ||
+            dstFormat == OSc_SampleFormat_Int32)
+            return g_kernels[KERNEL_WIDEN_16_TO_32];
+        if (dstFormat == OSc_SampleFormat_Float32)
+            return g_kernels[KERNEL_UNSIGNED_16_TO_FLOAT];
+        break;
+    case OSc_SampleFormat_Int16:
+        if (dstFormat == OSc_SampleFormat_Int32)
+            return g_kernels[KERNEL_WIDEN_SIGNED_16_TO_32];
+        if (dstFormat == OSc_SampleFormat_Float32)
+            return g_kernels[KERNEL_SIGNED_16_TO_FLOAT];
+        break;
+    }
+    return NULL;
+}
+
+static void ConvertChunks(void *data, size_t beginChunk, size_t endChunk) {
+    const struct ConvertJob *job = data;
+    size_t begin = beginChunk * CHUNK;
+    size_t end = endChunk * CHUNK;
+    if (end > job->count)
+        end = job->count;
+    if (job->kernel)
+        job->kernel(job->src, job->dst, begin, end);
+    else
+        ConvertGeneric(job, begin, end);
+}
+
+OSc_RichError *OScInternal_ConvertSamples(const void *src,
+                                          OSc_SampleFormat srcFormat,
+                                          void *dst,
+                                          OSc_SampleFormat dstFormat,
+                                          size_t count) {
+    if (!OScInternal_SampleFormat_IsValid(srcFormat) ||
+        !OScInternal_SampleFormat_IsValid(dstFormat) ||
+        dstFormat == OSc_SampleFormat_UInt12Packed)
+        return OScInternal_Error_IllegalArgument();
+
+    // UInt12 samples are valid UInt16 samples
+    if (srcFormat == dstFormat || (srcFormat == OSc_SampleFormat_UInt12 &&
+                                   dstFormat == OSc_SampleFormat_UInt16)) {
+        memcpy(dst, src, OScInternal_SampleFormat_GetBufferSize(dstFormat,
+                                                                 count));
+        return OSc_OK;
+    }
+
+    struct ConvertJob job = {
+        .src = src,
+        .srcFormat = srcFormat,
+        .dst = dst,
+        .dstFormat = dstFormat,
+        .count = count,
+        .kernel = FindKernel(srcFormat, dstFormat),
+    };
+    OScInternal_ParallelFor((count + CHUNK - 1) / CHUNK, 1, ConvertChunks,
+                            &job);
+    return OSc_OK;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * Sample formats of detector data, and conversion between them. Channels
+ * whose native format differs from the common format of an acquisition are
+ * converted as their frames arrive, so that later processing stages and the
+ * frame callback only ever see a single format.
+ */
+
+bool OScInternal_SampleFormat_IsValid(OSc_SampleFormat format);
+
+bool OScInternal_SampleFormat_IsUnsignedInteger(OSc_SampleFormat format);
+
+// Size of one sample; 2 for the packed format, which is stored unpacked
+// everywhere but in device frames
+uint32_t OScInternal_SampleFormat_GetBytesPerSample(OSc_SampleFormat format);
+
+// Size of a buffer holding 'count' samples
+size_t OScInternal_SampleFormat_GetBufferSize(OSc_SampleFormat format,
+                                              size_t count);
+
+// Largest value of an unsigned integer format
+uint32_t OScInternal_SampleFormat_GetMaxValue(OSc_SampleFormat format);
+
+// The unsigned integer format of the given size, or -1 if there is none
+OSc_SampleFormat OScInternal_SampleFormat_FromBytesPerSample(uint32_t bytes);
+
+// The narrowest non-packed format that can hold all values of both formats
+// (saturating at Int32 for UInt32 combined with a signed format)
+OSc_SampleFormat OScInternal_SampleFormat_Promote(OSc_SampleFormat a,
+                                                  OSc_SampleFormat b);
+
+// Convert 'count' samples. Integer results saturate; floating-point inputs
+// are rounded to nearest (NaN becomes 0). The packed format is only
+// supported as the source.
+OSc_RichError *OScInternal_ConvertSamples(const void *src,
+                                          OSc_SampleFormat srcFormat,
+                                          void *dst,
+                                          OSc_SampleFormat dstFormat,
+                                          size_t count);
+
+// Bind the kernels for 'level' and return the level bound (see Dispatch.h)
+OSc_SIMDLevel OScInternal_SampleFormat_BindKernels(OSc_SIMDLevel level);
@@ -0,0 +1,882 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // O_DIRECT, fallocate()
+#endif
+
+#include "Storage.h"
+#include "InternalErrors.h"
+#include "SampleFormat.h"
+#include "Threads.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+// Writer threads used when io_uring is not available
+#define MAX_WRITER_THREADS 4
+
+OSc_RichError *OScInternal_RecordingInfo_FromAcquisition(
+    struct OScInternal_RecordingInfo *info, OSc_Acquisition *acq) {
+    memset(info, 0, sizeof(*info));
+    info->numberOfFrames = UINT32_MAX;
+    if (!acq)
+        return OSc_OK;
+
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OSc_Acquisition_GetNumberOfChannels(
+                                 acq, &info->numberOfChannels)))
+        return err;
+    if (OSc_CHECK_ERROR(err, OSc_Acquisition_GetSampleFormat(
+                                 acq, &info->sampleFormat)))
+        return err;
+    info->pixelRateHz = OSc_Acquisition_GetPixelRate(acq);
+    info->resolution = OSc_Acquisition_GetResolution(acq);
+    info->zoomFactor = OSc_Acquisition_GetZoomFactor(acq);
+    OSc_Acquisition_GetROI(acq, &info->xOffset, &info->yOffset,
+                           &info->width, &info->height);
+    info->numberOfFrames = OSc_Acquisition_GetNumberOfFrames(acq);
+    info->compression = OSc_Acquisition_GetStorageCompression(acq);
+    OSc_Acquisition_GetRecordingCommitInterval(acq, &info->commitFrames,
+                                               &info->commitMilliseconds);
+    return OSc_OK;
+}
+
+uint64_t OScInternal_RecordingInfo_GetFrameBytes(
+    const struct OScInternal_RecordingInfo *info) {
+    return (uint64_t)info->width * info->height *
+           OScInternal_SampleFormat_GetBytesPerSample(info->sampleFormat);
+}
+
+#ifdef HAVE_IO_URING
+
+struct Ring {
+    int fd;
+    void *sqMap;
+    size_t sqMapSize;
+    void *cqMap;
+    size_t cqMapSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqTail;
+    unsigned *sqArray;
+    unsigned sqMask;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+};
+
+static void Ring_Destroy(struct Ring *r) {
+    if (r->sqes)
+        munmap(r->sqes, r->sqesSize);
+    if (r->cqMap)
+        munmap(r->cqMap, r->cqMapSize);
+    if (r->sqMap)
+        munmap(r->sqMap, r->sqMapSize);
+    close(r->fd);
+}
+
+static void *MapRing(int fd, size_t size, off_t offset) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, offset);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+// Returns false if io_uring is not available (old kernel, or disabled)
+static bool Ring_Init(struct Ring *r, unsigned entries) {
+    memset(r, 0, sizeof(*r));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (r->fd < 0)
+        return false;
+
+    // The rings are mapped separately, which every kernel version supports
+    r->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cqMapSize = params.cq_off.cqes +
+                   params.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqMap = MapRing(r->fd, r->sqMapSize, IORING_OFF_SQ_RING);
+    r->cqMap = MapRing(r->fd, r->cqMapSize, IORING_OFF_CQ_RING);
+    r->sqes = MapRing(r->fd, r->sqesSize, IORING_OFF_SQES);
+    if (!r->sqMap || !r->cqMap || !r->sqes) {
+        Ring_Destroy(r);
+        return false;
+    }
+
+    char *sq = r->sqMap;
+    r->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    r->sqArray = (unsigned *)(sq + params.sq_off.array);
+    r->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    char *cq = r->cqMap;
+    r->cqHead = (unsigned *)(cq + params.cq_off.head);
+    r->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    r->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+// The caller ensures that no more writes are in flight than ring entries.
+// Returns 0 or an errno value; on failure the write is withdrawn, so that
+// its buffer may be reused.
+static int Ring_SubmitWrite(struct Ring *r, int fd, const struct iovec *iov,
+                            uint64_t offset, uint64_t userData) {
+    unsigned tail = *r->sqTail; // Only written by us
+    unsigned index = tail & r->sqMask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITEV; // Supported since io_uring was added
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = 1;
+    sqe->off = offset;
+    sqe->user_data = userData;
+    r->sqArray[index] = index;
+    __atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    for (;;) {
+        if (syscall(__NR_io_uring_enter, r->fd, 1, 0, 0, NULL, 0) >= 0)
+            return 0;
+        if (errno != EINTR) {
+            // Without SQPOLL the kernel only reads the tail during
+            // io_uring_enter(), which has not consumed the entry
+            int code = errno;
+            __atomic_store_n(r->sqTail, tail, __ATOMIC_RELEASE);
+            return code;
+        }
+    }
+}
+
+// Get the next completion, waiting for one if 'wait' is true. Returns 0,
+// EAGAIN if there is none and 'wait' is false, or an errno value if waiting
+// failed.
+static int Ring_Reap(struct Ring *r, bool wait, uint64_t *userData,
+                     int32_t *result) {
+    for (;;) {
+        unsigned head = *r->cqHead; // Only written by us
+        unsigned tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+        if (head != tail) {
+            struct io_uring_cqe *cqe = &r->cqes[head & r->cqMask];
+            *userData = cqe->user_data;
+            *result = cqe->res;
+            __atomic_store_n(r->cqHead, head + 1, __ATOMIC_RELEASE);
+            return 0;
+        }
+        if (!wait)
+            return EAGAIN;
+        if (syscall(__NR_io_uring_enter, r->fd, 0, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+            errno != EINTR)
+            return errno;
+    }
+}
+
+#endif // HAVE_IO_URING
+
+struct PendingWrite {
+    uint32_t buffer;
+    size_t size; // Aligned
+    uint64_t offset;
+};
+
+struct OScInternal_StorageFile {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    int fd;
+#endif
+    size_t bufferSize;
+    uint32_t numberOfBuffers;
+    char *bufferMemory; // Aligned; numberOfBuffers * bufferSize
+    void *bufferAllocation;
+    uint64_t appendOffset;
+
+#ifdef HAVE_IO_URING
+    bool useRing;
+    struct Ring ring;
+    struct iovec *iovecs; // Indexed by buffer
+#endif
+
+    // Writer threads, when not using io_uring
+    OScInternal_Thread threads[MAX_WRITER_THREADS];
+    unsigned numberOfThreads;
+
+    OScInternal_Mutex mutex; // Guards the fields below
+    OScInternal_Cond bufferFreed;
+    OScInternal_Cond writeQueued;
+    uint32_t *freeBuffers; // Stack of buffer indices
+    uint32_t numberOfFreeBuffers;
+    struct PendingWrite *pending; // Ring buffer of numberOfBuffers
+    uint32_t pendingFront;
+    uint32_t numberOfPending;
+    bool closing;
+    OSc_RichError *error; // First write error not yet returned
+};
+
+static OSc_RichError *IOError(const char *operation, int code) {
+    char message[256];
+#ifdef _WIN32
+    snprintf(message, sizeof(message), "%s failed (Windows error %d)",
+             operation, code);
+#else
+    snprintf(message, sizeof(message), "%s failed: %s", operation,
+             strerror(code));
+#endif
+    return OScInternal_Error_Create(message);
+}
+
+// Record the error of an asynchronous write; called with the mutex held
+static void SetError(OScInternal_StorageFile *file, OSc_RichError *error) {
+    if (file->error)
+        OScInternal_Error_Destroy(error);
+    else
+        file->error = error;
+}
+
+static OSc_RichError *TakeError(OScInternal_StorageFile *file) {
+    OScInternal_Mutex_Lock(&file->mutex);
+    OSc_RichError *err = file->error;
+    file->error = NULL;
+    OScInternal_Mutex_Unlock(&file->mutex);
+    return err;
+}
+
+static char *GetBufferAt(OScInternal_StorageFile *file, uint32_t index) {
+    return file->bufferMemory + (size_t)index * file->bufferSize;
+}
+
+/*
+ * Platform-dependent file operations. Each returns 0 or an error code
+ * (errno or GetLastError()).
+ */
+
+#ifdef _WIN32
+
+static int OpenFile(OScInternal_StorageFile *file, const char *path) {
+    file->handle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE,
+                               FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL |
+                                   FILE_FLAG_NO_BUFFERING,
+                               NULL);
+    return file->handle == INVALID_HANDLE_VALUE ? (int)GetLastError() : 0;
+}
+
+static void Preallocate(OScInternal_StorageFile *file, uint64_t size) {
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = (LONGLONG)size;
+    // Failure is harmless
+    SetFileInformationByHandle(file->handle, FileAllocationInfo, &info,
+                               sizeof(info));
+}
+
+static int WriteAt(OScInternal_StorageFile *file, const void *data,
+                   size_t size, uint64_t offset) {
+    const char *p = data;
+    while (size > 0) {
+        OVERLAPPED ov;
+        memset(&ov, 0, sizeof(ov));
+        ov.Offset = (DWORD)offset;
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+        DWORD written;
+        if (!WriteFile(file->handle, p, chunk, &written, &ov))
+            return (int)GetLastError();
+        if (written == 0)
+            return ERROR_HANDLE_DISK_FULL;
+        p += written;
+        offset += written;
+        size -= written;
+    }
+    return 0;
+}
+
+static int SyncFile(OScInternal_StorageFile *file) {
+    return FlushFileBuffers(file->handle) ? 0 : (int)GetLastError();
+}
+
+static int TruncateAndClose(OScInternal_StorageFile *file, uint64_t size) {
+    int ret = 0;
+    FILE_END_OF_FILE_INFO info;
+    info.EndOfFile.QuadPart = (LONGLONG)size;
+    if (!SetFileInformationByHandle(file->handle, FileEndOfFileInfo, &info,
+                                    sizeof(info)))
+        ret = (int)GetLastError();
+    if (!CloseHandle(file->handle) && ret == 0)
+        ret = (int)GetLastError();
+    return ret;
+}
+
+static void *AllocateAligned(size_t size) {
+    return _aligned_malloc(size, OScInternal_STORAGE_ALIGNMENT);
+}
+
+static void FreeAligned(void *p) { _aligned_free(p); }
+
+static int MakeDirectory(const char *path) {
+    if (CreateDirectoryA(path, NULL))
+        return 0;
+    DWORD code = GetLastError();
+    return code == ERROR_ALREADY_EXISTS ? 0 : (int)code;
+}
+
+#else
+
+static int OpenFile(OScInternal_StorageFile *file, const char *path) {
+    int flags = O_RDWR | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    // Not all file systems (for example, tmpfs) support direct I/O
+    file->fd = open(path, flags | O_DIRECT, 0666);
+    if (file->fd >= 0 || errno != EINVAL)
+        return file->fd < 0 ? errno : 0;
+#endif
+    file->fd = open(path, flags, 0666);
+    return file->fd < 0 ? errno : 0;
+}
+
+static void Preallocate(OScInternal_StorageFile *file, uint64_t size) {
+#ifdef __linux__
+    // Unlike posix_fallocate(), never falls back to writing zeros. Failure
+    // (such as lack of file system support) is harmless.
+    (void)fallocate(file->fd, 0, 0, (off_t)size);
+#else
+    (void)file;
+    (void)size;
+#endif
+}
+
+static int WriteAt(OScInternal_StorageFile *file, const void *data,
+                   size_t size, uint64_t offset) {
+    const char *p = data;
+    while (size > 0) {
+        ssize_t written = pwrite(file->fd, p, size, (off_t)offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        if (written == 0)
+            return ENOSPC;
+        p += written;
+        offset += (uint64_t)written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+static int SyncFile(OScInternal_StorageFile *file) {
+#ifdef __linux__
+    // Also persists the allocation of preallocated extents now written
+    return fdatasync(file->fd) == 0 ? 0 : errno;
+#else
+    return fsync(file->fd) == 0 ? 0 : errno;
+#endif
+}
+
+static int TruncateAndClose(OScInternal_StorageFile *file, uint64_t size) {
+    int ret = 0;
+    if (ftruncate(file->fd, (off_t)size) != 0)
+        ret = errno;
+    if (close(file->fd) != 0 && ret == 0)
+        ret = errno;
+    return ret;
+}
+
+static void *AllocateAligned(size_t size) {
+    void *p;
+    if (posix_memalign(&p, OScInternal_STORAGE_ALIGNMENT, size) != 0)
+        return NULL;
+    return p;
+}
+
+static void FreeAligned(void *p) { free(p); }
+
+static int MakeDirectory(const char *path) {
+    if (mkdir(path, 0777) == 0 || errno == EEXIST)
+        return 0;
+    return errno;
+}
+
+#endif
+
+static void ReleaseBuffer(OScInternal_StorageFile *file, uint32_t index) {
+    OScInternal_Mutex_Lock(&file->mutex);
+    file->freeBuffers[file->numberOfFreeBuffers++] = index;
+    OScInternal_Cond_Signal(&file->bufferFreed);
+    OScInternal_Mutex_Unlock(&file->mutex);
+}
+
+static void WriterThread(void *data) {
+    OScInternal_StorageFile *file = data;
+    OScInternal_Mutex_Lock(&file->mutex);
+    for (;;) {
+        while (file->numberOfPending == 0 && !file->closing)
+            OScInternal_Cond_Wait(&file->writeQueued, &file->mutex);
+        if (file->numberOfPending == 0)
+            break; // Closing
+        struct PendingWrite w = file->pending[file->pendingFront];
+        file->pendingFront = (file->pendingFront + 1) % file->numberOfBuffers;
+        --file->numberOfPending;
+        OScInternal_Mutex_Unlock(&file->mutex);
+
+        int code = WriteAt(file, GetBufferAt(file, w.buffer), w.size,
+                           w.offset);
+
+        OScInternal_Mutex_Lock(&file->mutex);
+        if (code != 0)
+            SetError(file, IOError("Write", code));
+        file->freeBuffers[file->numberOfFreeBuffers++] = w.buffer;
+        OScInternal_Cond_Signal(&file->bufferFreed);
+    }
+    OScInternal_Mutex_Unlock(&file->mutex);
+}
+
+#ifdef HAVE_IO_URING
+
+// Handle one completion; returns false if none is available or waiting
+// failed (recording the error)
+static bool ReapOne(OScInternal_StorageFile *file, bool wait) {
+    uint64_t index = 0;
+    int32_t result = 0;
+    int code = Ring_Reap(&file->ring, wait, &index, &result);
+    if (code != 0) {
+        if (code != EAGAIN) {
+            OScInternal_Mutex_Lock(&file->mutex);
+            SetError(file, IOError("Wait for write", code));
+            OScInternal_Mutex_Unlock(&file->mutex);
+        }
+        return false;
+    }
+    if (result < 0 || (size_t)result != file->iovecs[index].iov_len) {
+        OScInternal_Mutex_Lock(&file->mutex);
+        SetError(file, IOError("Write", result < 0 ? -result : ENOSPC));
+        OScInternal_Mutex_Unlock(&file->mutex);
+    }
+    ReleaseBuffer(file, (uint32_t)index);
+    return true;
+}
+
+#endif
+
+static void DestroyFile(OScInternal_StorageFile *file) {
+#ifdef HAVE_IO_URING
+    if (file->useRing)
+        Ring_Destroy(&file->ring);
+    free(file->iovecs);
+#endif
+    if (file->error)
+        OScInternal_Error_Destroy(file->error);
+    FreeAligned(file->bufferAllocation);
+    free(file->freeBuffers);
+    free(file->pending);
+    OScInternal_Cond_Destroy(&file->writeQueued);
+    OScInternal_Cond_Destroy(&file->bufferFreed);
+    OScInternal_Mutex_Destroy(&file->mutex);
+    free(file);
+}
+
+OSc_RichError *OScInternal_StorageFile_Create(OScInternal_StorageFile **file,
+                                              const char *path,
+                                              uint64_t expectedSize,
+                                              size_t bufferSize,
+                                              uint32_t numberOfBuffers) {
+    if (!path || bufferSize == 0 || numberOfBuffers == 0)
+        return OScInternal_Error_IllegalArgument();
+
+    OScInternal_StorageFile *f = calloc(1, sizeof(OScInternal_StorageFile));
+    if (!f)
+        return OScInternal_Error_OutOfMemory();
+    OScInternal_Mutex_Init(&f->mutex);
+    OScInternal_Cond_Init(&f->bufferFreed);
+    OScInternal_Cond_Init(&f->writeQueued);
+    f->bufferSize = (size_t)OScInternal_Storage_Align(bufferSize);
+    f->numberOfBuffers = numberOfBuffers;
+    f->bufferAllocation = f->bufferMemory =
+        AllocateAligned(f->bufferSize * numberOfBuffers);
+    f->freeBuffers = malloc(numberOfBuffers * sizeof(uint32_t));
+    f->pending = malloc(numberOfBuffers * sizeof(struct PendingWrite));
+#ifdef HAVE_IO_URING
+    f->iovecs = calloc(numberOfBuffers, sizeof(struct iovec));
+    if (!f->iovecs) {
+        DestroyFile(f);
+        return OScInternal_Error_OutOfMemory();
+    }
+#endif
+    if (!f->bufferMemory || !f->freeBuffers || !f->pending) {
+        DestroyFile(f);
+        return OScInternal_Error_OutOfMemory();
+    }
+    for (uint32_t i = 0; i < numberOfBuffers; ++i)
+        f->freeBuffers[i] = numberOfBuffers - 1 - i;
+    f->numberOfFreeBuffers = numberOfBuffers;
+
+    int code = OpenFile(f, path);
+    if (code != 0) {
+        DestroyFile(f);
+        return IOError("Create file", code);
+    }
+    if (expectedSize > 0)
+        Preallocate(f, expectedSize);
+
+#ifdef HAVE_IO_URING
+    f->useRing = Ring_Init(&f->ring, numberOfBuffers);
+    if (!f->useRing)
+#endif
+    {
+        unsigned n = numberOfBuffers < MAX_WRITER_THREADS ? numberOfBuffers
+                                                          : MAX_WRITER_THREADS;
+        for (; f->numberOfThreads < n; ++f->numberOfThreads) {
+            if (!OScInternal_Thread_Create(&f->threads[f->numberOfThreads],
+                                           WriterThread, f))
+                break;
+        }
+        if (f->numberOfThreads == 0) {
+            TruncateAndClose(f, 0);
+            DestroyFile(f);
+            return OScInternal_Error_Create("Cannot start file writer");
+        }
+    }
+
+    *file = f;
+    return OSc_OK;
+}
+
+size_t OScInternal_StorageFile_GetBufferSize(OScInternal_StorageFile *file) {
+    return file->bufferSize;
+}
+
+OSc_RichError *OScInternal_StorageFile_GetBuffer(OScInternal_StorageFile *file,
+                                                 void **buffer) {
+#ifdef HAVE_IO_URING
+    if (file->useRing) {
+        // Handle whatever has completed, and wait if nothing is free
+        while (ReapOne(file, false))
+            ;
+        OScInternal_Mutex_Lock(&file->mutex);
+        bool none = file->numberOfFreeBuffers == 0;
+        OScInternal_Mutex_Unlock(&file->mutex);
+        // No buffer would ever be freed if we cannot wait for completions
+        if (none && !ReapOne(file, true))
+            return TakeError(file);
+    }
+#endif
+    OScInternal_Mutex_Lock(&file->mutex);
+    while (file->numberOfFreeBuffers == 0)
+        OScInternal_Cond_Wait(&file->bufferFreed, &file->mutex);
+    uint32_t index = file->freeBuffers[--file->numberOfFreeBuffers];
+    OScInternal_Mutex_Unlock(&file->mutex);
+    *buffer = GetBufferAt(file, index);
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_StorageFile_Append(OScInternal_StorageFile *file,
+                                              void *buffer, size_t size,
+                                              uint64_t *offset) {
+    uint32_t index =
+        (uint32_t)(((char *)buffer - file->bufferMemory) / file->bufferSize);
+    size_t alignedSize = (size_t)OScInternal_Storage_Align(size);
+    if (size == 0 || alignedSize > file->bufferSize) {
+        ReleaseBuffer(file, index);
+        return OScInternal_Error_IllegalArgument();
+    }
+    memset((char *)buffer + size, 0, alignedSize - size);
+    uint64_t off = file->appendOffset;
+    file->appendOffset += alignedSize;
+    if (offset)
+        *offset = off;
+
+#ifdef HAVE_IO_URING
+    if (file->useRing) {
+        file->iovecs[index].iov_base = buffer;
+        file->iovecs[index].iov_len = alignedSize;
+        int code = Ring_SubmitWrite(&file->ring, file->fd,
+                                    &file->iovecs[index], off, index);
+        if (code != 0) {
+            ReleaseBuffer(file, index);
+            OScInternal_Mutex_Lock(&file->mutex);
+            SetError(file, IOError("Write", code));
+            OScInternal_Mutex_Unlock(&file->mutex);
+        }
+        return TakeError(file);
+    }
+#endif
+
+    OScInternal_Mutex_Lock(&file->mutex);
+    uint32_t back =
+        (file->pendingFront + file->numberOfPending) % file->numberOfBuffers;
+    file->pending[back] = (struct PendingWrite){index, alignedSize, off};
+    ++file->numberOfPending;
+    OScInternal_Cond_Signal(&file->writeQueued);
+    OSc_RichError *err = file->error;
+    file->error = NULL;
+    OScInternal_Mutex_Unlock(&file->mutex);
+    return err;
+}
+
+uint64_t
+OScInternal_StorageFile_GetAppendOffset(OScInternal_StorageFile *file) {
+    return file->appendOffset;
+}
+
+OSc_RichError *
+OScInternal_StorageFile_AppendCopy(OScInternal_StorageFile *file,
+                                   const void *data, size_t size,
+                                   uint64_t *offset) {
+    if (offset)
+        *offset = file->appendOffset;
+    // Every piece but the last fills a buffer, so the data stays contiguous
+    const char *src = data;
+    while (size > 0) {
+        size_t n = size < file->bufferSize ? size : file->bufferSize;
+        void *buffer;
+        OSc_RichError *err = OScInternal_StorageFile_GetBuffer(file, &buffer);
+        if (err)
+            return err;
+        memcpy(buffer, src, n);
+        err = OScInternal_StorageFile_Append(file, buffer, n, NULL);
+        if (err)
+            return err;
+        src += n;
+        size -= n;
+    }
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_StorageFile_WriteAt(OScInternal_StorageFile *file,
+                                               const void *data, size_t size,
+                                               uint64_t offset) {
+    size_t alignedSize = (size_t)OScInternal_Storage_Align(size);
+    if (alignedSize > file->bufferSize ||
+        offset % OScInternal_STORAGE_ALIGNMENT != 0)
+        return OScInternal_Error_IllegalArgument();
+
+    // Direct I/O requires an aligned source
+    void *block;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OScInternal_StorageFile_GetBuffer(file, &block)))
+        return err;
+    char *buffer = block;
+    memcpy(buffer, data, size);
+    memset(buffer + size, 0, alignedSize - size);
+    int code = WriteAt(file, buffer, alignedSize, offset);
+    uint32_t index =
+        (uint32_t)((buffer - file->bufferMemory) / file->bufferSize);
+    ReleaseBuffer(file, index);
+    return code != 0 ? IOError("Write", code) : OSc_OK;
+}
+
+OSc_RichError *OScInternal_StorageFile_Flush(OScInternal_StorageFile *file) {
+#ifdef HAVE_IO_URING
+    if (file->useRing) {
+        for (;;) {
+            OScInternal_Mutex_Lock(&file->mutex);
+            bool done = file->numberOfFreeBuffers == file->numberOfBuffers;
+            OScInternal_Mutex_Unlock(&file->mutex);
+            if (done || !ReapOne(file, true))
+                break;
+        }
+        return TakeError(file);
+    }
+#endif
+    OScInternal_Mutex_Lock(&file->mutex);
+    while (file->numberOfFreeBuffers < file->numberOfBuffers)
+        OScInternal_Cond_Wait(&file->bufferFreed, &file->mutex);
+    OScInternal_Mutex_Unlock(&file->mutex);
+    return TakeError(file);
+}
+
+OSc_RichError *OScInternal_StorageFile_Sync(OScInternal_StorageFile *file) {
+    OSc_RichError *err = OScInternal_StorageFile_Flush(file);
+    if (err)
+        return err;
+    int code = SyncFile(file);
+    return code != 0 ? IOError("Synchronize file", code) : OSc_OK;
+}
+
+OSc_RichError *OScInternal_StorageFile_Close(OScInternal_StorageFile *file,
+                                             uint64_t size) {
+    if (!file)
+        return OSc_OK;
+    OSc_RichError *err = OScInternal_StorageFile_Flush(file);
+
+    OScInternal_Mutex_Lock(&file->mutex);
+    file->closing = true;
+    OScInternal_Cond_Broadcast(&file->writeQueued);
+    OScInternal_Mutex_Unlock(&file->mutex);
+    for (unsigned i = 0; i < file->numberOfThreads; ++i)
+        OScInternal_Thread_Join(file->threads[i]);
+
+    int code = TruncateAndClose(file, size);
+    if (code != 0 && err == OSc_OK)
+        err = IOError("Close file", code);
+    DestroyFile(file);
+    return err;
+}
+
+void *OScInternal_Storage_AllocateAligned(size_t size) {
+    return AllocateAligned((size_t)OScInternal_Storage_Align(size));
+}
+
+void OScInternal_Storage_FreeAligned(void *p) { FreeAligned(p); }
+
+OSc_RichError *OScInternal_Storage_WriteFile(const char *path,
+                                             const void *data, size_t size) {
+    OScInternal_StorageFile file;
+    memset(&file, 0, sizeof(file));
+    int code = OpenFile(&file, path);
+    if (code != 0)
+        return IOError("Create file", code);
+    code = WriteAt(&file, data, (size_t)OScInternal_Storage_Align(size), 0);
+    int closeCode = TruncateAndClose(&file, size);
+    if (code != 0)
+        return IOError("Write", code);
+    if (closeCode != 0)
+        return IOError("Close file", closeCode);
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_Storage_CreateDirectories(const char *path) {
+    size_t len = strlen(path);
+    char *p = malloc(len + 1);
+    if (!p)
+        return OScInternal_Error_OutOfMemory();
+    strcpy(p, path);
+    for (size_t i = 1; i <= len; ++i) {
+        char c = p[i];
+        if (c != '/' && c != '\\' && c != '\0')
+            continue;
+        // Skip drive letters ("C:") and repeated separators
+        if (p[i - 1] == ':' || p[i - 1] == '/' || p[i - 1] == '\\')
+            continue;
+        p[i] = '\0';
+        int code = MakeDirectory(p);
+        p[i] = c;
+        if (code != 0) {
+            free(p);
+            return IOError("Create directory", code);
+        }
+    }
+    free(p);
+    return OSc_OK;
+}
+
+// The sink stage keeps the first error, to be returned by
+// OSc_Acquisition_Wait()
+struct SinkStage {
+    const struct OScInternal_StorageSink *sink;
+    char *path;
+    void *writer;
+    OSc_RichError *error;
+};
+
+static void DestroySinkStage(void *data) {
+    struct SinkStage *ss = data;
+    // Already finished by the pipeline
+    if (ss->error)
+        OScInternal_Error_Destroy(ss->error);
+    free(ss->path);
+    free(ss);
+}
+
+static OSc_RichError *StartSinkStage(OSc_PipelineStage *stage, void *data) {
+    struct SinkStage *ss = data;
+    struct OScInternal_RecordingInfo info;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OScInternal_RecordingInfo_FromAcquisition(
+                                 &info, OSc_PipelineStage_GetAcquisition(
+                                            stage))))
+        return err;
+    return ss->sink->create(&ss->writer, ss->path, &info);
+}
+
+static bool RunSinkStage(OSc_PipelineStage *stage, OSc_FrameBuffer *frame,
+                         void *data) {
+    (void)stage;
+    struct SinkStage *ss = data;
+    uint32_t width, height;
+    OSc_FrameBuffer_GetSize(frame, &width, &height);
+    OSc_RichError *err = ss->sink->writeFrame(
+        ss->writer, OSc_FrameBuffer_GetChannel(frame), width, height,
+        OSc_FrameBuffer_GetSampleFormat(frame),
+        OSc_FrameBuffer_GetPixels(frame));
+    if (err == OSc_OK)
+        return true;
+    // Cancel the acquisition rather than record an incomplete file
+    if (ss->error)
+        OScInternal_Error_Destroy(err);
+    else
+        ss->error = err;
+    return false;
+}
+
+static OSc_RichError *FinishSinkStage(void *data) {
+    struct SinkStage *ss = data;
+    OSc_RichError *err = OSc_OK;
+    if (ss->writer)
+        err = ss->sink->close(ss->writer);
+    ss->writer = NULL;
+    if (ss->error) {
+        if (err)
+            OScInternal_Error_Destroy(err);
+        err = ss->error;
+        ss->error = NULL;
+    }
+    return err;
+}
+
+OSc_RichError *
+OScInternal_StorageSink_AddStage(OScInternal_Pipeline *pipeline,
+                                 const struct OScInternal_StorageSink *sink,
+                                 const char *path, uint32_t queueDepth,
+                                 OSc_PipelineStage **stage) {
+    if (!path || !path[0])
+        return OScInternal_Error_IllegalArgument();
+    struct SinkStage *ss = calloc(1, sizeof(struct SinkStage));
+    if (!ss)
+        return OScInternal_Error_OutOfMemory();
+    ss->sink = sink;
+    ss->path = malloc(strlen(path) + 1);
+    if (!ss->path) {
+        free(ss);
+        return OScInternal_Error_OutOfMemory();
+    }
+    strcpy(ss->path, path);
+
+    OSc_RichError *err = OScInternal_Pipeline_AddStage(
+        pipeline, RunSinkStage, ss, DestroySinkStage, queueDepth, stage);
+    if (err != OSc_OK) {
+        DestroySinkStage(ss);
+        return err;
+    }
+    OScInternal_Pipeline_SetStageLifecycle(*stage, StartSinkStage,
+                                           FinishSinkStage);
+    return OSc_OK;
+}
+
+bool OScInternal_StorageSink_GetStage(
+    OSc_PipelineStage *stage, const struct OScInternal_StorageSink **sink,
+    const char **path) {
+    if (OScInternal_PipelineStage_GetFunc(stage) != RunSinkStage)
+        return false;
+    struct SinkStage *ss = OScInternal_PipelineStage_GetData(stage);
+    *sink = ss->sink;
+    *path = ss->path;
+    return true;
+}
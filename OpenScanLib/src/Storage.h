@@ -0,0 +1,160 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+#include "Pipeline.h"
+
+/*
+ * Infrastructure shared by the storage sinks (the built-in pipeline stages
+ * that record frames to disk).
+ *
+ * OScInternal_StorageFile appends data to a file from a fixed pool of
+ * aligned buffers, without blocking the caller on the disk. On Linux the
+ * file is opened with O_DIRECT (bypassing the page cache, which otherwise
+ * thrashes during long recordings) and preallocated with fallocate(), and
+ * buffers are written asynchronously through io_uring, or by writer threads
+ * if io_uring is unavailable. On Windows, unbuffered I/O and writer threads
+ * are used. The pool bounds both memory use and the number of writes in
+ * flight; acquiring a buffer blocks only when all buffers are being written.
+ *
+ * A storage file is not thread-safe: calls must be serialized (as they are
+ * when made from a pipeline stage function).
+ *
+ * Each file format provides an OScInternal_StorageSink, from which a
+ * pipeline stage is made that creates the file when the acquisition is armed
+ * and closes it when the acquisition finishes.
+ */
+
+// File offsets and sizes of writes are multiples of this
+#define OScInternal_STORAGE_ALIGNMENT 4096
+
+// Parameters of an acquisition recorded by storage sinks
+struct OScInternal_RecordingInfo {
+    double pixelRateHz;
+    uint32_t resolution;
+    double zoomFactor;
+    uint32_t xOffset;
+    uint32_t yOffset;
+    uint32_t width;
+    uint32_t height;
+    uint32_t numberOfChannels;
+    OSc_SampleFormat sampleFormat;
+    uint32_t numberOfFrames; // UINT32_MAX if unknown
+    OSc_StorageCompression compression;
+    uint32_t commitFrames; // Index commit interval; 0 for none
+    uint32_t commitMilliseconds;
+};
+
+// Describe the output frames of an acquisition. If 'acq' is NULL, the info
+// is zeroed, with an unknown number of frames.
+OSc_RichError *OScInternal_RecordingInfo_FromAcquisition(
+    struct OScInternal_RecordingInfo *info, OSc_Acquisition *acq);
+
+// Bytes of the output frames of one channel, excluding any padding
+uint64_t OScInternal_RecordingInfo_GetFrameBytes(
+    const struct OScInternal_RecordingInfo *info);
+
+// Round up to OScInternal_STORAGE_ALIGNMENT
+static inline uint64_t OScInternal_Storage_Align(uint64_t size) {
+    return (size + OScInternal_STORAGE_ALIGNMENT - 1) &
+           ~(uint64_t)(OScInternal_STORAGE_ALIGNMENT - 1);
+}
+
+typedef struct OScInternal_StorageFile OScInternal_StorageFile;
+
+// Create (or truncate) a file. 'expectedSize' (0 if unknown) is preallocated.
+// 'bufferSize' is rounded up to the alignment.
+OSc_RichError *OScInternal_StorageFile_Create(OScInternal_StorageFile **file,
+                                              const char *path,
+                                              uint64_t expectedSize,
+                                              size_t bufferSize,
+                                              uint32_t numberOfBuffers);
+
+size_t OScInternal_StorageFile_GetBufferSize(OScInternal_StorageFile *file);
+
+// Get a free buffer, blocking while all buffers are being written. The
+// buffer must be passed to OScInternal_StorageFile_Append(). Fails if
+// waiting for a write to complete fails.
+OSc_RichError *OScInternal_StorageFile_GetBuffer(OScInternal_StorageFile *file,
+                                                 void **buffer);
+
+// Append the first 'size' bytes of a buffer, zero-padded to the alignment,
+// and return the buffer to the pool once written. '*offset' receives the
+// offset at which the data is written. An error from an earlier
+// asynchronous write may be returned instead.
+OSc_RichError *OScInternal_StorageFile_Append(OScInternal_StorageFile *file,
+                                              void *buffer, size_t size,
+                                              uint64_t *offset);
+
+// Copy data into as many buffers as needed and append it contiguously.
+// '*offset' (if not NULL) receives the offset of the first byte.
+OSc_RichError *
+OScInternal_StorageFile_AppendCopy(OScInternal_StorageFile *file,
+                                   const void *data, size_t size,
+                                   uint64_t *offset);
+
+// The offset at which the next append will write
+uint64_t
+OScInternal_StorageFile_GetAppendOffset(OScInternal_StorageFile *file);
+
+// Synchronously write 'size' (at most the buffer size) bytes at an aligned
+// offset, zero-padded to the alignment, overwriting earlier appended data
+// (for example, a header rewritten when the file is closed).
+OSc_RichError *OScInternal_StorageFile_WriteAt(OScInternal_StorageFile *file,
+                                               const void *data, size_t size,
+                                               uint64_t offset);
+
+// Wait until all appended data has been written
+OSc_RichError *OScInternal_StorageFile_Flush(OScInternal_StorageFile *file);
+
+// Flush, and wait until the data written is durable (fdatasync())
+OSc_RichError *OScInternal_StorageFile_Sync(OScInternal_StorageFile *file);
+
+// Flush, trim the file to the end of the data written (discarding the
+// preallocated remainder and the padding of the last write), and close it.
+// The file is destroyed even if an error is returned.
+OSc_RichError *OScInternal_StorageFile_Close(OScInternal_StorageFile *file,
+                                             uint64_t size);
+
+// Memory suitable for OScInternal_Storage_WriteFile(); 'size' is rounded up
+// to the alignment
+void *OScInternal_Storage_AllocateAligned(size_t size);
+void OScInternal_Storage_FreeAligned(void *p);
+
+// Synchronously write a whole file (created or truncated) with direct I/O
+// where supported. 'data' must come from OScInternal_Storage_AllocateAligned()
+// and be readable up to 'size' rounded up to the alignment.
+OSc_RichError *OScInternal_Storage_WriteFile(const char *path,
+                                             const void *data, size_t size);
+
+// Create a directory and any missing parents
+OSc_RichError *OScInternal_Storage_CreateDirectories(const char *path);
+
+// Functions of a file format writer, which receives the channels of each
+// frame as they arrive
+struct OScInternal_StorageSink {
+    OSc_RichError *(*create)(void **writer, const char *path,
+                             const struct OScInternal_RecordingInfo *info);
+    OSc_RichError *(*writeFrame)(void *writer, uint32_t channel,
+                                 uint32_t width, uint32_t height,
+                                 OSc_SampleFormat format,
+                                 const void *pixels);
+    // Complete the file; the writer is destroyed even on error
+    OSc_RichError *(*close)(void *writer);
+    // Whether frames are compressed as set by the acquisition
+    bool compressible;
+};
+
+// Add a stage writing every frame it receives with 'sink' (which must
+// outlive the stage). Write errors cancel the acquisition and are returned
+// when the pipeline is finished.
+OSc_RichError *
+OScInternal_StorageSink_AddStage(OScInternal_Pipeline *pipeline,
+                                 const struct OScInternal_StorageSink *sink,
+                                 const char *path, uint32_t queueDepth,
+                                 OSc_PipelineStage **stage);
+
+// If 'stage' was added by OScInternal_StorageSink_AddStage(), get its sink
+// and path and return true
+bool OScInternal_StorageSink_GetStage(
+    OSc_PipelineStage *stage, const struct OScInternal_StorageSink **sink,
+    const char **path);
@@ -0,0 +1,320 @@
+#include "StorageThroughput.h"
+#include "Codec.h"
+#include "InternalErrors.h"
+#include "SampleFormat.h"
+#include "Storage.h"
+#include "Threads.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCRATCH_FILE_NAME ".OpenScanThroughput.tmp"
+#define TEST_BUFFER_BYTES (4 * 1024 * 1024)
+#define TEST_BUFFERS 16
+#define MIN_TEST_BYTES (32 * 1024 * 1024)
+#define MAX_TEST_BYTES (256 * 1024 * 1024)
+#define MIN_TEST_SECONDS 0.25
+#define ENCODE_TEST_SIZE 512
+#define MIN_ENCODE_SECONDS 0.1
+
+struct WriteRate {
+    char *directory;
+    double bytesPerSecond;
+};
+
+// Guards the measurements, which are also serialized by it so that they do
+// not compete with each other
+static OScInternal_Mutex g_mutex = OScInternal_MUTEX_INITIALIZER;
+static struct WriteRate *g_writeRates;
+static size_t g_numberOfWriteRates;
+static double g_encodeRates[5]; // By bytes per sample; 0 if not measured
+
+static char *CopyString(const char *s) {
+    char *copy = malloc(strlen(s) + 1);
+    if (copy)
+        strcpy(copy, s);
+    return copy;
+}
+
+// Directory in which 'path' (a file or a directory) would be created
+static char *GetParentDirectory(const char *path) {
+    const char *slash = strrchr(path, '/');
+    const char *backslash = strrchr(path, '\\');
+    if (!slash || (backslash && backslash > slash))
+        slash = backslash;
+    if (!slash)
+        return CopyString(".");
+    size_t len = slash == path ? 1 : (size_t)(slash - path);
+    char *dir = malloc(len + 1);
+    if (dir) {
+        memcpy(dir, path, len);
+        dir[len] = '\0';
+    }
+    return dir;
+}
+
+// Noise that does not compress, so that the file system stores it all
+static void FillNoise(void *data, size_t size) {
+    uint32_t state = 2463534242u;
+    uint32_t *words = data;
+    for (size_t i = 0; i < size / sizeof(uint32_t); ++i) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        words[i] = state;
+    }
+}
+
+static OSc_RichError *WriteScratchFile(const char *path,
+                                       double *bytesPerSecond) {
+    void *data = malloc(TEST_BUFFER_BYTES);
+    if (!data)
+        return OScInternal_Error_OutOfMemory();
+    FillNoise(data, TEST_BUFFER_BYTES);
+
+    OScInternal_StorageFile *file;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OScInternal_StorageFile_Create(
+                                 &file, path, MAX_TEST_BYTES,
+                                 TEST_BUFFER_BYTES, TEST_BUFFERS))) {
+        free(data);
+        return err;
+    }
+
+    double start = OScInternal_GetMonotonicTime();
+    double elapsed = 0.0;
+    uint64_t written = 0;
+    while (written < MAX_TEST_BYTES &&
+           (written < MIN_TEST_BYTES || elapsed < MIN_TEST_SECONDS)) {
+        if (OSc_CHECK_ERROR(err, OScInternal_StorageFile_AppendCopy(
+                                     file, data, TEST_BUFFER_BYTES, NULL)))
+            break;
+        written += TEST_BUFFER_BYTES;
+        elapsed = OScInternal_GetMonotonicTime() - start;
+    }
+    if (!err)
+        err = OScInternal_StorageFile_Sync(file);
+    elapsed = OScInternal_GetMonotonicTime() - start;
+    free(data);
+
+    OSc_RichError *closeErr = OScInternal_StorageFile_Close(file, written);
+    remove(path);
+    if (err) {
+        if (closeErr)
+            OScInternal_Error_Destroy(closeErr);
+        return err;
+    }
+    if (closeErr)
+        return closeErr;
+    *bytesPerSecond = elapsed > 0.0 ? (double)written / elapsed : HUGE_VAL;
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_StorageThroughput_MeasureWrite(
+    const char *directory, double *bytesPerSecond) {
+    OScInternal_Mutex_Lock(&g_mutex);
+    for (size_t i = 0; i < g_numberOfWriteRates; ++i) {
+        if (strcmp(g_writeRates[i].directory, directory) == 0) {
+            *bytesPerSecond = g_writeRates[i].bytesPerSecond;
+            OScInternal_Mutex_Unlock(&g_mutex);
+            return OSc_OK;
+        }
+    }
+
+    OSc_RichError *err = OSc_OK;
+    size_t len = strlen(directory);
+    char *path = malloc(len + sizeof(SCRATCH_FILE_NAME) + 1);
+    struct WriteRate *rates =
+        realloc(g_writeRates,
+                (g_numberOfWriteRates + 1) * sizeof(struct WriteRate));
+    if (rates)
+        g_writeRates = rates;
+    char *dir = CopyString(directory);
+    if (!path || !rates || !dir)
+        err = OScInternal_Error_OutOfMemory();
+
+    if (!err) {
+        memcpy(path, directory, len);
+        path[len] = '/';
+        memcpy(path + len + 1, SCRATCH_FILE_NAME, sizeof(SCRATCH_FILE_NAME));
+        err = WriteScratchFile(path, bytesPerSecond);
+    }
+    if (!err) {
+        g_writeRates[g_numberOfWriteRates].directory = dir;
+        g_writeRates[g_numberOfWriteRates].bytesPerSecond = *bytesPerSecond;
+        ++g_numberOfWriteRates;
+        dir = NULL;
+    }
+    OScInternal_Mutex_Unlock(&g_mutex);
+    free(dir);
+    free(path);
+    return err;
+}
+
+double OScInternal_StorageThroughput_MeasureEncode(uint32_t bytesPerSample) {
+    if (bytesPerSample != 1 && bytesPerSample != 2 && bytesPerSample != 4)
+        return HUGE_VAL; // Not encoded
+    OScInternal_Mutex_Lock(&g_mutex);
+    double rate = g_encodeRates[bytesPerSample];
+    OScInternal_Mutex_Unlock(&g_mutex);
+    if (rate > 0.0)
+        return rate;
+
+    size_t frameBytes =
+        (size_t)ENCODE_TEST_SIZE * ENCODE_TEST_SIZE * bytesPerSample;
+    void *frame = malloc(frameBytes);
+    void *encoded = malloc(OScInternal_Codec_GetMaxEncodedSize(
+        ENCODE_TEST_SIZE, ENCODE_TEST_SIZE, bytesPerSample));
+    if (!frame || !encoded) {
+        free(frame);
+        free(encoded);
+        return HUGE_VAL; // Unknown; do not report a bottleneck
+    }
+
+    // Detector-like frame: an offset plus noise in the low 6 bits
+    FillNoise(frame, frameBytes);
+    for (size_t i = 0; i < frameBytes / bytesPerSample; ++i) {
+        if (bytesPerSample == 1)
+            ((uint8_t *)frame)[i] &= 0x3f;
+        else if (bytesPerSample == 2)
+            ((uint16_t *)frame)[i] = 100 + (((uint16_t *)frame)[i] & 0x3f);
+        else
+            ((uint32_t *)frame)[i] = 100 + (((uint32_t *)frame)[i] & 0x3f);
+    }
+
+    double start = OScInternal_GetMonotonicTime();
+    double elapsed;
+    uint64_t encodedBytes = 0;
+    do {
+        OScInternal_Codec_Encode(frame, ENCODE_TEST_SIZE, ENCODE_TEST_SIZE,
+                                 bytesPerSample, encoded);
+        encodedBytes += frameBytes;
+        elapsed = OScInternal_GetMonotonicTime() - start;
+    } while (elapsed < MIN_ENCODE_SECONDS);
+    free(frame);
+    free(encoded);
+
+    rate = (double)encodedBytes / elapsed;
+    OScInternal_Mutex_Lock(&g_mutex);
+    g_encodeRates[bytesPerSample] = rate;
+    OScInternal_Mutex_Unlock(&g_mutex);
+    return rate;
+}
+
+// Data rate to be written to one directory
+struct DirectoryLoad {
+    char *directory;
+    double bytesPerSecond;
+};
+
+static void DestroyLoads(struct DirectoryLoad *loads, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        free(loads[i].directory);
+    free(loads);
+}
+
+static OSc_RichError *AddLoad(struct DirectoryLoad **loads, size_t *count,
+                              const char *path, double bytesPerSecond) {
+    char *dir = GetParentDirectory(path);
+    if (!dir)
+        return OScInternal_Error_OutOfMemory();
+    for (size_t i = 0; i < *count; ++i) {
+        if (strcmp((*loads)[i].directory, dir) == 0) {
+            (*loads)[i].bytesPerSecond += bytesPerSecond;
+            free(dir);
+            return OSc_OK;
+        }
+    }
+    struct DirectoryLoad *l =
+        realloc(*loads, (*count + 1) * sizeof(struct DirectoryLoad));
+    if (!l) {
+        free(dir);
+        return OScInternal_Error_OutOfMemory();
+    }
+    *loads = l;
+    l[*count].directory = dir;
+    l[*count].bytesPerSecond = bytesPerSecond;
+    ++*count;
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_StorageThroughput_Check(
+    OScInternal_Pipeline *pipeline, OSc_Acquisition *acq,
+    double *requiredBytesPerSecond, double *availableBytesPerSecond) {
+    *requiredBytesPerSecond = 0.0;
+    *availableBytesPerSecond = HUGE_VAL;
+    if (!pipeline)
+        return OSc_OK;
+
+    struct OScInternal_RecordingInfo info;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OScInternal_RecordingInfo_FromAcquisition(
+                                 &info, acq)))
+        return err;
+    // Frames can be acquired no faster than the pixel rate allows (line
+    // and frame flyback only slow them down)
+    double pixels = (double)info.width * info.height;
+    double frameRate = pixels > 0.0 ? info.pixelRateHz / pixels : 0.0;
+    double stageBytesPerSecond =
+        (double)OScInternal_RecordingInfo_GetFrameBytes(&info) *
+        info.numberOfChannels * frameRate;
+    uint32_t bytesPerSample =
+        OScInternal_SampleFormat_GetBytesPerSample(info.sampleFormat);
+
+    // The fraction of the required rate that can be sustained, limited by
+    // each directory written to and each stage's encoding
+    double headroom = HUGE_VAL;
+    struct DirectoryLoad *loads = NULL;
+    size_t numberOfLoads = 0;
+    size_t numberOfStages = OScInternal_Pipeline_GetNumberOfStages(pipeline);
+    for (size_t i = 0; i < numberOfStages; ++i) {
+        const struct OScInternal_StorageSink *sink;
+        const char *path;
+        if (!OScInternal_StorageSink_GetStage(
+                OScInternal_Pipeline_GetStage(pipeline, i), &sink, &path))
+            continue;
+        // Assume no reduction in size from compression, which depends on
+        // the sample
+        if (OSc_CHECK_ERROR(err, AddLoad(&loads, &numberOfLoads, path,
+                                         stageBytesPerSecond))) {
+            DestroyLoads(loads, numberOfLoads);
+            return err;
+        }
+        if (sink->compressible &&
+            info.compression != OSc_StorageCompression_None) {
+            double encode =
+                OScInternal_StorageThroughput_MeasureEncode(bytesPerSample);
+            if (encode / stageBytesPerSecond < headroom)
+                headroom = encode / stageBytesPerSecond;
+        }
+        *requiredBytesPerSecond += stageBytesPerSecond;
+    }
+
+    for (size_t i = 0; i < numberOfLoads; ++i) {
+        double rate;
+        if (OSc_CHECK_ERROR(err, OScInternal_StorageThroughput_MeasureWrite(
+                                     loads[i].directory, &rate))) {
+            DestroyLoads(loads, numberOfLoads);
+            return err;
+        }
+        if (rate / loads[i].bytesPerSecond < headroom)
+            headroom = rate / loads[i].bytesPerSecond;
+    }
+    DestroyLoads(loads, numberOfLoads);
+
+    if (*requiredBytesPerSecond > 0.0)
+        *availableBytesPerSecond = *requiredBytesPerSecond * headroom;
+    if (*availableBytesPerSecond < *requiredBytesPerSecond) {
+        char msg[256];
+        snprintf(msg, sizeof(msg),
+                 "Storage can sustain about %.0f MB/s, but the acquisition "
+                 "will produce up to %.0f MB/s; recording is likely to "
+                 "fall behind the acquisition",
+                 *availableBytesPerSecond / 1e6,
+                 *requiredBytesPerSecond / 1e6);
+        OScInternal_LogWarning(NULL, msg);
+    }
+    return OSc_OK;
+}
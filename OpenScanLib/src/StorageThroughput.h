@@ -0,0 +1,34 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+#include "Pipeline.h"
+
+/*
+ * Pre-flight estimate of whether the storage stages of an acquisition can
+ * keep up with the data rate it will produce, implementing
+ * OSc_Acquisition_CheckStorageThroughput().
+ *
+ * The rate at which a directory absorbs data is measured by writing a
+ * scratch file there in the same way as the storage sinks do (aligned
+ * buffers, direct I/O where supported, written asynchronously) and
+ * synchronizing it, so that the result reflects the device rather than the
+ * operating system's cache. The encoding rate of the lossless codec is
+ * measured on a synthetic noisy frame. Both are measured at most once per
+ * process (per directory, and per sample size), since a measurement takes a
+ * noticeable fraction of a second.
+ */
+
+// Measure (or look up) the sustained write rate of 'directory'
+OSc_RichError *OScInternal_StorageThroughput_MeasureWrite(
+    const char *directory, double *bytesPerSecond);
+
+// Measure (or look up) the single-thread lossless encoding rate, in bytes
+// of samples per second
+double OScInternal_StorageThroughput_MeasureEncode(uint32_t bytesPerSample);
+
+// Estimate the data rate the storage stages of 'pipeline' (which may be
+// NULL) must sustain, and the rate they can sustain; the latter is HUGE_VAL
+// if there are no storage stages
+OSc_RichError *OScInternal_StorageThroughput_Check(
+    OScInternal_Pipeline *pipeline, OSc_Acquisition *acq,
+    double *requiredBytesPerSecond, double *availableBytesPerSecond);
@@ -0,0 +1,844 @@
+#include "StreamServer.h"
+#include "Codec.h"
+#include "InternalErrors.h"
+#include "SampleFormat.h"
+#include "Threads.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/errqueue.h>
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) &&                         \
+    defined(SO_EE_ORIGIN_ZEROCOPY)
+#define HAVE_ZEROCOPY 1
+#endif
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS (MSG_NOSIGNAL | MSG_DONTWAIT)
+#else
+#define SEND_FLAGS MSG_DONTWAIT // SO_NOSIGPIPE is set instead
+#endif
+#endif
+
+#define DEFAULT_CLIENT_QUEUE_DEPTH 4
+#define LISTEN_BACKLOG 16
+
+// Smaller payloads are cheaper to copy than to pin for MSG_ZEROCOPY
+#define ZEROCOPY_MIN_BYTES (64 * 1024)
+
+struct Message {
+    volatile int32_t refCount;
+    struct OScInternal_StreamFrameHeader header;
+    const char *payload;
+    OSc_FrameBuffer *frame; // Holds the payload, if not encoded
+    void *encoded;
+};
+
+static void ReleaseMessage(struct Message *message) {
+    if (message && OScInternal_Atomic_Decrement(&message->refCount) == 0) {
+        OSc_FrameBuffer_Release(message->frame);
+        free(message->encoded);
+        free(message);
+    }
+}
+
+static OSc_RichError *CreateMessage(struct Message **message,
+                                    OSc_FrameBuffer *frame,
+                                    OSc_StorageCompression compression,
+                                    uint64_t sequence) {
+    struct Message *m = calloc(1, sizeof(struct Message));
+    if (!m)
+        return OScInternal_Error_OutOfMemory();
+    m->refCount = 1;
+    uint32_t width, height;
+    OSc_FrameBuffer_GetSize(frame, &width, &height);
+    OSc_SampleFormat format = OSc_FrameBuffer_GetSampleFormat(frame);
+    uint32_t bytesPerSample =
+        OScInternal_SampleFormat_GetBytesPerSample(format);
+    memcpy(m->header.magic, OScInternal_STREAM_FRAME_MAGIC,
+           sizeof(m->header.magic));
+    m->header.channel = OSc_FrameBuffer_GetChannel(frame);
+    m->header.sequence = sequence;
+    m->header.width = width;
+    m->header.height = height;
+    m->header.sampleFormat = format;
+
+    if (compression == OSc_StorageCompression_Lossless) {
+        size_t maxSize =
+            OScInternal_Codec_GetMaxEncodedSize(width, height, bytesPerSample);
+        m->encoded = malloc(maxSize);
+        if (!m->encoded) {
+            free(m);
+            return OScInternal_Error_OutOfMemory();
+        }
+        size_t size =
+            OScInternal_Codec_Encode(OSc_FrameBuffer_GetPixels(frame), width,
+                                     height, bytesPerSample, m->encoded);
+        if (size > 0) {
+            m->header.compression = OSc_StorageCompression_Lossless;
+            m->header.payloadBytes = size;
+            m->payload = m->encoded;
+            *message = m;
+            return OSc_OK;
+        }
+        // Sample size not supported by the codec; send as is
+        free(m->encoded);
+        m->encoded = NULL;
+    }
+    OSc_FrameBuffer_Retain(frame);
+    m->frame = frame;
+    m->header.compression = OSc_StorageCompression_None;
+    m->header.payloadBytes = (uint64_t)width * height * bytesPerSample;
+    m->payload = OSc_FrameBuffer_GetPixels(frame);
+    *message = m;
+    return OSc_OK;
+}
+
+#ifndef _WIN32
+
+// A message sent with MSG_ZEROCOPY, held until the kernel is done with it
+struct ZeroCopySend {
+    uint32_t id;
+    struct Message *message;
+};
+
+struct Client {
+    int fd;
+
+    // Guarded by the server's mutex
+    struct Message **queue; // Ring buffer of 'capacity' messages
+    size_t capacity;
+    size_t front;
+    size_t size;
+    size_t sent;  // Bytes of the front message already sent
+    bool sending; // The front message is being sent by the I/O thread
+
+    // Only accessed by the I/O thread
+    bool zeroCopy;
+    uint32_t nextZeroCopyId;
+    struct ZeroCopySend *zeroCopySends; // In order of id
+    size_t numberOfZeroCopySends;
+    size_t zeroCopyCapacity;
+};
+
+struct OScInternal_StreamServer {
+    int listenFd;
+    bool tcp;
+    uint16_t port;
+    char *unixPath; // Removed when destroyed; NULL for TCP
+    int wakeFds[2]; // Pipe waking the I/O thread
+    OScInternal_Thread thread;
+
+    struct OScInternal_StreamHeader streamHeader;
+    OSc_StorageCompression compression;
+    uint32_t clientQueueDepth;
+    uint64_t sequence; // Only accessed by the sending thread
+
+    // Guards the fields below. The clients array is only modified by the
+    // I/O thread, which may therefore read it without the mutex.
+    OScInternal_Mutex mutex;
+    struct Client **clients;
+    size_t numberOfClients;
+    uint64_t framesDropped;
+    bool stopping;
+};
+
+static OSc_RichError *IOError(const char *operation, int code) {
+    char message[256];
+    snprintf(message, sizeof(message), "%s failed: %s", operation,
+             strerror(code));
+    return OScInternal_Error_Create(message);
+}
+
+static bool SetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0 &&
+           fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+}
+
+static void Wake(OScInternal_StreamServer *server) {
+    char c = 0;
+    // A full pipe already wakes the thread
+    ssize_t n = write(server->wakeFds[1], &c, 1);
+    (void)n;
+}
+
+static void DestroyClient(struct Client *client) {
+    close(client->fd);
+    for (size_t i = 0; i < client->size; ++i)
+        ReleaseMessage(client->queue[(client->front + i) % client->capacity]);
+    for (size_t i = 0; i < client->numberOfZeroCopySends; ++i)
+        ReleaseMessage(client->zeroCopySends[i].message);
+    free(client->zeroCopySends);
+    free(client->queue);
+    free(client);
+}
+
+// Queue a message (with the mutex held), dropping the oldest message not
+// being sent if the queue is full
+static void Enqueue(OScInternal_StreamServer *server, struct Client *client,
+                    struct Message *message) {
+    size_t capacity = client->capacity;
+    if (client->size == capacity) {
+        bool frontBusy = client->sending || client->sent > 0;
+        if (frontBusy && capacity == 1) {
+            ++server->framesDropped; // Drop the new message instead
+            return;
+        }
+        size_t drop = (client->front + (frontBusy ? 1 : 0)) % capacity;
+        ReleaseMessage(client->queue[drop]);
+        if (frontBusy) // Keep the front message, moving it up
+            client->queue[drop] = client->queue[client->front];
+        client->front = (client->front + 1) % capacity;
+        --client->size;
+        ++server->framesDropped;
+    }
+    OScInternal_Atomic_Increment(&message->refCount);
+    client->queue[(client->front + client->size) % capacity] = message;
+    ++client->size;
+}
+
+#ifdef HAVE_ZEROCOPY
+
+static bool AddZeroCopySend(struct Client *client, struct Message *message) {
+    if (client->numberOfZeroCopySends == client->zeroCopyCapacity) {
+        size_t capacity =
+            client->zeroCopyCapacity ? 2 * client->zeroCopyCapacity : 16;
+        struct ZeroCopySend *sends = realloc(
+            client->zeroCopySends, capacity * sizeof(struct ZeroCopySend));
+        if (!sends)
+            return false;
+        client->zeroCopySends = sends;
+        client->zeroCopyCapacity = capacity;
+    }
+    OScInternal_Atomic_Increment(&message->refCount);
+    struct ZeroCopySend *s =
+        &client->zeroCopySends[client->numberOfZeroCopySends++];
+    s->id = client->nextZeroCopyId++;
+    s->message = message;
+    return true;
+}
+
+// Release the messages whose MSG_ZEROCOPY sends have completed. Completions
+// are reported as ranges of ids, in order for a TCP socket.
+static bool ReapZeroCopy(struct Client *client) {
+    for (;;) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(client->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm;
+             cm = CMSG_NXTHDR(&msg, cm)) {
+            const struct sock_extended_err *err =
+                (const struct sock_extended_err *)CMSG_DATA(cm);
+            if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0)
+                continue;
+            size_t done = 0;
+            while (done < client->numberOfZeroCopySends &&
+                   (int32_t)(client->zeroCopySends[done].id - err->ee_data) <=
+                       0)
+                ReleaseMessage(client->zeroCopySends[done++].message);
+            client->numberOfZeroCopySends -= done;
+            memmove(client->zeroCopySends, client->zeroCopySends + done,
+                    client->numberOfZeroCopySends *
+                        sizeof(struct ZeroCopySend));
+        }
+    }
+}
+
+#endif
+
+// Send queued messages until the socket is full; false if disconnected
+static bool SendQueued(OScInternal_StreamServer *server,
+                       struct Client *client) {
+    size_t capacity = client->capacity;
+    for (;;) {
+        OScInternal_Mutex_Lock(&server->mutex);
+        if (client->size == 0) {
+            OScInternal_Mutex_Unlock(&server->mutex);
+            return true;
+        }
+        struct Message *m = client->queue[client->front];
+        OScInternal_Atomic_Increment(&m->refCount);
+        client->sending = true;
+        size_t offset = client->sent;
+        OScInternal_Mutex_Unlock(&server->mutex);
+
+        size_t headerBytes = sizeof(m->header);
+        size_t total = headerBytes + (size_t)m->header.payloadBytes;
+        struct iovec iov[2];
+        int iovcnt = 0;
+        if (offset < headerBytes) {
+            iov[iovcnt].iov_base = (char *)&m->header + offset;
+            iov[iovcnt++].iov_len = headerBytes - offset;
+        }
+        size_t payloadOffset = offset > headerBytes ? offset - headerBytes : 0;
+        if (m->header.payloadBytes > payloadOffset) {
+            iov[iovcnt].iov_base = (char *)m->payload + payloadOffset;
+            iov[iovcnt++].iov_len =
+                (size_t)m->header.payloadBytes - payloadOffset;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        ssize_t n = -1;
+        int code = 0;
+#ifdef HAVE_ZEROCOPY
+        bool zeroCopy = client->zeroCopy &&
+                        m->header.payloadBytes - payloadOffset >=
+                            ZEROCOPY_MIN_BYTES;
+        if (zeroCopy) {
+            n = sendmsg(client->fd, &msg, SEND_FLAGS | MSG_ZEROCOPY);
+            code = n < 0 ? errno : 0;
+            // Out of memory for pinning pages; copy instead
+            if (n < 0 && code == ENOBUFS)
+                zeroCopy = false;
+            else if (n >= 0 && !AddZeroCopySend(client, m))
+                code = ENOMEM;
+        }
+        if (!zeroCopy)
+#endif
+        {
+            n = sendmsg(client->fd, &msg, SEND_FLAGS);
+            code = n < 0 ? errno : 0;
+        }
+
+        struct Message *done = NULL;
+        OScInternal_Mutex_Lock(&server->mutex);
+        client->sending = false;
+        if (n > 0) {
+            client->sent += (size_t)n;
+            if (client->sent == total) {
+                done = m;
+                client->front = (client->front + 1) % capacity;
+                --client->size;
+                client->sent = 0;
+            }
+        }
+        OScInternal_Mutex_Unlock(&server->mutex);
+        ReleaseMessage(done); // The queue's reference
+        ReleaseMessage(m);
+
+        if (n < 0 || code != 0)
+            return code == EAGAIN || code == EWOULDBLOCK || code == EINTR;
+        if (!done)
+            return true; // Socket buffer full; wait for POLLOUT
+    }
+}
+
+// Read and discard anything the client sends; false if disconnected
+static bool DiscardInput(struct Client *client) {
+    char buffer[256];
+    for (;;) {
+        ssize_t n = recv(client->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n > 0)
+            continue;
+        if (n == 0)
+            return false;
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+}
+
+static void RemoveClient(OScInternal_StreamServer *server, size_t index) {
+    OScInternal_Mutex_Lock(&server->mutex);
+    struct Client *client = server->clients[index];
+    memmove(server->clients + index, server->clients + index + 1,
+            (server->numberOfClients - index - 1) * sizeof(struct Client *));
+    --server->numberOfClients;
+    OScInternal_Mutex_Unlock(&server->mutex);
+    DestroyClient(client);
+}
+
+static void AcceptClients(OScInternal_StreamServer *server) {
+    for (;;) {
+        int fd = accept(server->listenFd, NULL, NULL);
+        if (fd < 0)
+            return; // EAGAIN, or an aborted connection
+        bool ok = SetNonBlocking(fd);
+#ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        bool zeroCopy = false;
+        if (server->tcp) {
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+#ifdef HAVE_ZEROCOPY
+            zeroCopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on,
+                                  sizeof(on)) == 0;
+#endif
+        }
+
+        // The socket buffer is empty, so this small write completes
+        ok = ok && send(fd, &server->streamHeader,
+                        sizeof(server->streamHeader), SEND_FLAGS) ==
+                       (ssize_t)sizeof(server->streamHeader);
+        struct Client *client = ok ? calloc(1, sizeof(struct Client)) : NULL;
+        if (client)
+            client->queue =
+                calloc(server->clientQueueDepth, sizeof(struct Message *));
+        struct Client **clients = NULL;
+        if (client && client->queue) {
+            OScInternal_Mutex_Lock(&server->mutex);
+            clients = realloc(server->clients, (server->numberOfClients + 1) *
+                                                   sizeof(struct Client *));
+            if (clients) {
+                server->clients = clients;
+                client->fd = fd;
+                client->capacity = server->clientQueueDepth;
+                client->zeroCopy = zeroCopy;
+                clients[server->numberOfClients++] = client;
+            }
+            OScInternal_Mutex_Unlock(&server->mutex);
+        }
+        if (!clients) {
+            if (client)
+                free(client->queue);
+            free(client);
+            close(fd);
+        }
+    }
+}
+
+static void ServeThread(void *data) {
+    OScInternal_StreamServer *server = data;
+    struct pollfd *fds = NULL;
+    size_t capacity = 0;
+    for (;;) {
+        OScInternal_Mutex_Lock(&server->mutex);
+        if (server->stopping) {
+            OScInternal_Mutex_Unlock(&server->mutex);
+            break;
+        }
+        size_t n = server->numberOfClients;
+        if (capacity < n + 2) {
+            struct pollfd *p = realloc(fds, (n + 2) * sizeof(struct pollfd));
+            if (!p) {
+                OScInternal_Mutex_Unlock(&server->mutex);
+                break;
+            }
+            fds = p;
+            capacity = n + 2;
+        }
+        fds[0].fd = server->wakeFds[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = server->listenFd;
+        fds[1].events = POLLIN;
+        for (size_t i = 0; i < n; ++i) {
+            struct Client *client = server->clients[i];
+            fds[2 + i].fd = client->fd;
+            fds[2 + i].events =
+                (short)(POLLIN | (client->size > 0 ? POLLOUT : 0));
+        }
+        OScInternal_Mutex_Unlock(&server->mutex);
+
+        if (poll(fds, (nfds_t)(n + 2), -1) < 0)
+            continue; // EINTR
+        if (fds[0].revents & POLLIN) {
+            char buffer[64];
+            while (read(server->wakeFds[0], buffer, sizeof(buffer)) > 0)
+                ;
+        }
+        // In reverse, so that removing a client does not move the others
+        for (size_t i = n; i-- > 0;) {
+            struct Client *client = server->clients[i];
+            short revents = fds[2 + i].revents;
+            bool ok = true;
+            if (revents & POLLERR) {
+#ifdef HAVE_ZEROCOPY
+                // Zero-copy completions are also reported as POLLERR
+                if (client->zeroCopy)
+                    ok = ReapZeroCopy(client);
+#endif
+                int error = 0;
+                socklen_t len = sizeof(error);
+                if (getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &error,
+                               &len) != 0 ||
+                    error != 0)
+                    ok = false;
+            }
+            if (ok && (revents & (POLLIN | POLLHUP)))
+                ok = DiscardInput(client);
+            if (ok && (revents & POLLOUT))
+                ok = SendQueued(server, client);
+            if (!ok || (revents & POLLNVAL))
+                RemoveClient(server, i);
+        }
+        if (fds[1].revents & POLLIN)
+            AcceptClients(server);
+    }
+    free(fds);
+}
+
+// Create the listening socket; returns 0 or an errno value
+static int ListenUnix(OScInternal_StreamServer *server, const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return ENAMETOOLONG;
+    strcpy(addr.sun_path, path);
+    server->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->listenFd < 0)
+        return errno;
+    // A socket left by an earlier server is replaced, but any other file at
+    // the path is left alone (and bind() then fails)
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+    if (bind(server->listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        return errno;
+    server->unixPath = malloc(strlen(path) + 1);
+    if (!server->unixPath)
+        return ENOMEM;
+    strcpy(server->unixPath, path);
+    return listen(server->listenFd, LISTEN_BACKLOG) == 0 ? 0 : errno;
+}
+
+static OSc_RichError *ListenTCP(OScInternal_StreamServer *server,
+                                const char *hostAndPort) {
+    const char *colon = strrchr(hostAndPort, ':');
+    if (!colon || colon == hostAndPort || !colon[1])
+        return OScInternal_Error_IllegalArgument();
+    size_t hostLen = (size_t)(colon - hostAndPort);
+    const char *host = hostAndPort;
+    if (host[0] == '[' && host[hostLen - 1] == ']') { // IPv6 literal
+        ++host;
+        hostLen -= 2;
+    }
+    char *hostCopy = malloc(hostLen + 1);
+    if (!hostCopy)
+        return OScInternal_Error_OutOfMemory();
+    memcpy(hostCopy, host, hostLen);
+    hostCopy[hostLen] = '\0';
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo *addrs;
+    int gai = getaddrinfo(hostCopy, colon + 1, &hints, &addrs);
+    free(hostCopy);
+    if (gai != 0) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Cannot resolve stream address: %s",
+                 gai_strerror(gai));
+        return OScInternal_Error_Create(msg);
+    }
+
+    int code = EADDRNOTAVAIL;
+    for (struct addrinfo *a = addrs; a; a = a->ai_next) {
+        int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) {
+            code = errno;
+            continue;
+        }
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, a->ai_addr, a->ai_addrlen) == 0 &&
+            listen(fd, LISTEN_BACKLOG) == 0) {
+            server->listenFd = fd;
+            code = 0;
+            break;
+        }
+        code = errno;
+        close(fd);
+    }
+    freeaddrinfo(addrs);
+    if (code != 0)
+        return IOError("Listen for stream clients", code);
+
+    struct sockaddr_storage bound;
+    socklen_t len = sizeof(bound);
+    if (getsockname(server->listenFd, (struct sockaddr *)&bound, &len) == 0) {
+        if (bound.ss_family == AF_INET)
+            server->port =
+                ntohs(((struct sockaddr_in *)&bound)->sin_port);
+        else if (bound.ss_family == AF_INET6)
+            server->port =
+                ntohs(((struct sockaddr_in6 *)&bound)->sin6_port);
+    }
+    server->tcp = true;
+    return OSc_OK;
+}
+
+static void CloseServerSockets(OScInternal_StreamServer *server) {
+    if (server->listenFd >= 0)
+        close(server->listenFd);
+    if (server->unixPath)
+        unlink(server->unixPath);
+    free(server->unixPath);
+    if (server->wakeFds[0] >= 0)
+        close(server->wakeFds[0]);
+    if (server->wakeFds[1] >= 0)
+        close(server->wakeFds[1]);
+}
+
+OSc_RichError *
+OScInternal_StreamServer_Create(OScInternal_StreamServer **server,
+                                const char *address,
+                                const struct OScInternal_RecordingInfo *info,
+                                OSc_StorageCompression compression,
+                                uint32_t clientQueueDepth) {
+    if (!address || (compression != OSc_StorageCompression_None &&
+                     compression != OSc_StorageCompression_Lossless))
+        return OScInternal_Error_IllegalArgument();
+    OScInternal_StreamServer *s = calloc(1, sizeof(OScInternal_StreamServer));
+    if (!s)
+        return OScInternal_Error_OutOfMemory();
+    s->listenFd = -1;
+    s->wakeFds[0] = s->wakeFds[1] = -1;
+    s->compression = compression;
+    s->clientQueueDepth =
+        clientQueueDepth ? clientQueueDepth : DEFAULT_CLIENT_QUEUE_DEPTH;
+
+    struct OScInternal_StreamHeader *h = &s->streamHeader;
+    memcpy(h->magic, OScInternal_STREAM_MAGIC, sizeof(h->magic));
+    h->version = OScInternal_STREAM_VERSION;
+    h->frameHeaderBytes = sizeof(struct OScInternal_StreamFrameHeader);
+    h->pixelRateHz = info->pixelRateHz;
+    h->zoomFactor = info->zoomFactor;
+    h->resolution = info->resolution;
+    h->xOffset = info->xOffset;
+    h->yOffset = info->yOffset;
+    h->width = info->width;
+    h->height = info->height;
+    h->numberOfChannels = info->numberOfChannels;
+    h->sampleFormat = info->sampleFormat;
+    h->compression = compression;
+
+    OSc_RichError *err = OSc_OK;
+    if (strncmp(address, "unix:", 5) == 0) {
+        int code = ListenUnix(s, address + 5);
+        if (code != 0)
+            err = IOError("Listen for stream clients", code);
+    } else if (strncmp(address, "tcp:", 4) == 0) {
+        err = ListenTCP(s, address + 4);
+    } else {
+        err = OScInternal_Error_IllegalArgument();
+    }
+    if (!err && (pipe(s->wakeFds) != 0 || !SetNonBlocking(s->wakeFds[0]) ||
+                 !SetNonBlocking(s->wakeFds[1]) ||
+                 !SetNonBlocking(s->listenFd)))
+        err = IOError("Set up stream server", errno);
+    if (err) {
+        CloseServerSockets(s);
+        free(s);
+        return err;
+    }
+
+    OScInternal_Mutex_Init(&s->mutex);
+    if (!OScInternal_Thread_Create(&s->thread, ServeThread, s)) {
+        OScInternal_Mutex_Destroy(&s->mutex);
+        CloseServerSockets(s);
+        free(s);
+        return OScInternal_Error_Create("Cannot start stream server thread");
+    }
+    *server = s;
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_StreamServer_Send(OScInternal_StreamServer *server,
+                                             OSc_FrameBuffer *frame) {
+    uint64_t sequence = server->sequence++;
+    OScInternal_Mutex_Lock(&server->mutex);
+    bool anyClients = server->numberOfClients > 0;
+    OScInternal_Mutex_Unlock(&server->mutex);
+    if (!anyClients)
+        return OSc_OK; // Do not encode for nobody
+
+    struct Message *message = NULL;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, CreateMessage(&message, frame,
+                                           server->compression, sequence)))
+        return err;
+    OScInternal_Mutex_Lock(&server->mutex);
+    for (size_t i = 0; i < server->numberOfClients; ++i)
+        Enqueue(server, server->clients[i], message);
+    OScInternal_Mutex_Unlock(&server->mutex);
+    ReleaseMessage(message);
+    Wake(server);
+    return OSc_OK;
+}
+
+uint16_t OScInternal_StreamServer_GetPort(OScInternal_StreamServer *server) {
+    return server->port;
+}
+
+uint32_t
+OScInternal_StreamServer_GetNumberOfClients(OScInternal_StreamServer *server) {
+    OScInternal_Mutex_Lock(&server->mutex);
+    uint32_t n = (uint32_t)server->numberOfClients;
+    OScInternal_Mutex_Unlock(&server->mutex);
+    return n;
+}
+
+uint64_t
+OScInternal_StreamServer_GetFramesDropped(OScInternal_StreamServer *server) {
+    OScInternal_Mutex_Lock(&server->mutex);
+    uint64_t n = server->framesDropped;
+    OScInternal_Mutex_Unlock(&server->mutex);
+    return n;
+}
+
+void OScInternal_StreamServer_Destroy(OScInternal_StreamServer *server) {
+    if (!server)
+        return;
+    OScInternal_Mutex_Lock(&server->mutex);
+    server->stopping = true;
+    OScInternal_Mutex_Unlock(&server->mutex);
+    Wake(server);
+    OScInternal_Thread_Join(server->thread);
+
+    for (size_t i = 0; i < server->numberOfClients; ++i)
+        DestroyClient(server->clients[i]);
+    free(server->clients);
+    CloseServerSockets(server);
+    OScInternal_Mutex_Destroy(&server->mutex);
+    free(server);
+}
+
+#else // _WIN32
+
+OSc_RichError *
+OScInternal_StreamServer_Create(OScInternal_StreamServer **server,
+                                const char *address,
+                                const struct OScInternal_RecordingInfo *info,
+                                OSc_StorageCompression compression,
+                                uint32_t clientQueueDepth) {
+    (void)server;
+    (void)address;
+    (void)info;
+    (void)compression;
+    (void)clientQueueDepth;
+    return OScInternal_Error_UnsupportedOperation();
+}
+
+OSc_RichError *OScInternal_StreamServer_Send(OScInternal_StreamServer *server,
+                                             OSc_FrameBuffer *frame) {
+    (void)server;
+    (void)frame;
+    return OScInternal_Error_UnsupportedOperation();
+}
+
+uint16_t OScInternal_StreamServer_GetPort(OScInternal_StreamServer *server) {
+    (void)server;
+    return 0;
+}
+
+uint32_t
+OScInternal_StreamServer_GetNumberOfClients(OScInternal_StreamServer *server) {
+    (void)server;
+    return 0;
+}
+
+uint64_t
+OScInternal_StreamServer_GetFramesDropped(OScInternal_StreamServer *server) {
+    (void)server;
+    return 0;
+}
+
+void OScInternal_StreamServer_Destroy(OScInternal_StreamServer *server) {
+    (void)server;
+}
+
+#endif
+
+struct ServerStage {
+    char *address;
+    OSc_StorageCompression compression;
+    uint32_t clientQueueDepth;
+    OScInternal_StreamServer *server;
+};
+
+static void DestroyServerStage(void *data) {
+    struct ServerStage *ss = data;
+    OScInternal_StreamServer_Destroy(ss->server); // Already finished normally
+    free(ss->address);
+    free(ss);
+}
+
+static OSc_RichError *StartServerStage(OSc_PipelineStage *stage,
+                                       void *data) {
+    struct ServerStage *ss = data;
+    struct OScInternal_RecordingInfo info;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OScInternal_RecordingInfo_FromAcquisition(
+                                 &info, OSc_PipelineStage_GetAcquisition(
+                                            stage))))
+        return err;
+    return OScInternal_StreamServer_Create(&ss->server, ss->address, &info,
+                                           ss->compression,
+                                           ss->clientQueueDepth);
+}
+
+static bool RunServerStage(OSc_PipelineStage *stage, OSc_FrameBuffer *frame,
+                           void *data) {
+    (void)stage;
+    struct ServerStage *ss = data;
+    // Monitoring clients must not stop the acquisition; a frame that cannot
+    // be queued (out of memory) is skipped
+    OSc_RichError *err = OScInternal_StreamServer_Send(ss->server, frame);
+    if (err)
+        OScInternal_Error_Destroy(err);
+    return true;
+}
+
+static OSc_RichError *FinishServerStage(void *data) {
+    struct ServerStage *ss = data;
+    OScInternal_StreamServer_Destroy(ss->server);
+    ss->server = NULL;
+    return OSc_OK;
+}
+
+OSc_RichError *OScInternal_StreamServer_AddStage(
+    OScInternal_Pipeline *pipeline, const char *address,
+    OSc_StorageCompression compression, uint32_t clientQueueDepth,
+    uint32_t queueDepth, OSc_PipelineStage **stage) {
+    if (!address || !address[0] ||
+        (compression != OSc_StorageCompression_None &&
+         compression != OSc_StorageCompression_Lossless))
+        return OScInternal_Error_IllegalArgument();
+    struct ServerStage *ss = calloc(1, sizeof(struct ServerStage));
+    if (!ss)
+        return OScInternal_Error_OutOfMemory();
+    ss->compression = compression;
+    ss->clientQueueDepth = clientQueueDepth;
+    ss->address = malloc(strlen(address) + 1);
+    if (!ss->address) {
+        free(ss);
+        return OScInternal_Error_OutOfMemory();
+    }
+    strcpy(ss->address, address);
+
+    OSc_RichError *err = OScInternal_Pipeline_AddStage(
+        pipeline, RunServerStage, ss, DestroyServerStage, queueDepth, stage);
+    if (err != OSc_OK) {
+        DestroyServerStage(ss);
+        return err;
+    }
+    OScInternal_Pipeline_SetStageLifecycle(*stage, StartServerStage,
+                                           FinishServerStage);
+    return OSc_OK;
+}
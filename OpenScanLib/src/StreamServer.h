@@ -0,0 +1,99 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+#include "Pipeline.h"
+#include "Storage.h"
+
+/*
+ * Server streaming frames to any number of clients over a Unix-domain or
+ * TCP socket, implementing the stream server stage.
+ *
+ * Each frame is turned once into a reference-counted message (a header and
+ * the payload, which is the frame buffer itself, retained, or the frame
+ * encoded with the lossless codec) that is queued to every client, so that
+ * a client costs no copy in the process. An I/O thread sends the messages
+ * with nonblocking sendmsg(), gathering header and payload. On Linux, large
+ * payloads are sent to TCP clients with MSG_ZEROCOPY where the socket
+ * supports it, and the message is held until the kernel reports completion.
+ *
+ * Each client has a bounded queue. When a slow client's queue is full, its
+ * oldest message not yet being sent is dropped, so that the client always
+ * receives the latest frames; other clients are not affected.
+ *
+ * Protocol (little-endian): on connecting, the client receives a struct
+ * OScInternal_StreamHeader describing the acquisition, then, for each
+ * frame, a struct OScInternal_StreamFrameHeader followed by
+ * 'payloadBytes' bytes of samples (or an encoded frame, if 'compression'
+ * is OSc_StorageCompression_Lossless). Sequence numbers count all frames
+ * sent to any client, so gaps show dropped frames. Anything the client
+ * sends is ignored.
+ *
+ * Not available on Windows.
+ */
+
+#define OScInternal_STREAM_MAGIC "OScStrm\n"
+#define OScInternal_STREAM_VERSION 1
+#define OScInternal_STREAM_FRAME_MAGIC "OScF"
+
+struct OScInternal_StreamHeader {
+    char magic[8]; // OScInternal_STREAM_MAGIC
+    uint32_t version;
+    uint32_t frameHeaderBytes; // Size of OScInternal_StreamFrameHeader
+    double pixelRateHz;
+    double zoomFactor;
+    uint32_t resolution;
+    uint32_t xOffset;
+    uint32_t yOffset;
+    uint32_t width;
+    uint32_t height;
+    uint32_t numberOfChannels;
+    int32_t sampleFormat;
+    int32_t compression;
+};
+
+struct OScInternal_StreamFrameHeader {
+    char magic[4]; // OScInternal_STREAM_FRAME_MAGIC
+    uint32_t channel;
+    uint64_t sequence;
+    uint32_t width;
+    uint32_t height;
+    int32_t sampleFormat;
+    int32_t compression;
+    uint64_t payloadBytes;
+};
+
+typedef struct OScInternal_StreamServer OScInternal_StreamServer;
+
+// Listen on 'address' ("unix:PATH" or "tcp:HOST:PORT") and start serving.
+// A Unix socket file already at PATH is replaced.
+OSc_RichError *
+OScInternal_StreamServer_Create(OScInternal_StreamServer **server,
+                                const char *address,
+                                const struct OScInternal_RecordingInfo *info,
+                                OSc_StorageCompression compression,
+                                uint32_t clientQueueDepth);
+
+// Queue a frame to all connected clients. The frame buffer is retained
+// until it has been sent (unless it is encoded).
+OSc_RichError *OScInternal_StreamServer_Send(OScInternal_StreamServer *server,
+                                             OSc_FrameBuffer *frame);
+
+// The TCP port listened on (useful if 0 was requested), or 0
+uint16_t OScInternal_StreamServer_GetPort(OScInternal_StreamServer *server);
+
+uint32_t
+OScInternal_StreamServer_GetNumberOfClients(OScInternal_StreamServer *server);
+
+// Frames dropped for slow clients (counted once per client)
+uint64_t
+OScInternal_StreamServer_GetFramesDropped(OScInternal_StreamServer *server);
+
+// Disconnect all clients, discarding queued frames, and stop listening
+void OScInternal_StreamServer_Destroy(OScInternal_StreamServer *server);
+
+// Add a built-in stage streaming every frame it receives, serving on
+// 'address' from when the acquisition is armed until it finishes
+OSc_RichError *OScInternal_StreamServer_AddStage(
+    OScInternal_Pipeline *pipeline, const char *address,
+    OSc_StorageCompression compression, uint32_t clientQueueDepth,
+    uint32_t queueDepth, OSc_PipelineStage **stage);
@@ -0,0 +1,201 @@
+#include "TaskPool.h"
+#include "Threads.h"
+
+#include <stdlib.h>
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+// Upper limit on worker threads, regardless of processor count
+#define MAX_WORKERS 64
+
+#define INITIAL_DEQUE_CAPACITY 64
+
+struct Task {
+    OScInternal_TaskFunc func;
+    void *data;
+};
+
+// Growable ring buffer of tasks
+struct Deque {
+    OScInternal_Mutex mutex;
+    struct Task *tasks;
+    size_t capacity; // Power of 2
+    size_t front;
+    size_t size;
+};
+
+struct Worker {
+    struct TaskPool *pool;
+    unsigned index;
+    struct Deque deque;
+    OScInternal_Thread thread;
+};
+
+struct TaskPool {
+    struct Worker workers[MAX_WORKERS];
+    unsigned nWorkers;
+
+    // Counts tasks in all deques. It is incremented before a task is pushed,
+    // so a worker woken by it may briefly find the deques empty and retry.
+    OScInternal_Mutex mutex;
+    OScInternal_Cond tasksAvailable;
+    size_t pending;
+
+    volatile int32_t nextWorker; // For round-robin distribution
+};
+
+static OScInternal_Mutex g_poolInitMutex = OScInternal_MUTEX_INITIALIZER;
+static struct TaskPool *g_pool;
+
+static THREAD_LOCAL struct Worker *t_currentWorker;
+
+static bool Deque_PushBack(struct Deque *d, struct Task task) {
+    bool ok = true;
+    OScInternal_Mutex_Lock(&d->mutex);
+    if (d->size == d->capacity) {
+        size_t capacity = d->capacity ? 2 * d->capacity
+                                      : INITIAL_DEQUE_CAPACITY;
+        struct Task *tasks = malloc(capacity * sizeof(struct Task));
+        if (tasks) {
+            for (size_t i = 0; i < d->size; ++i)
+                tasks[i] = d->tasks[(d->front + i) & (d->capacity - 1)];
+            free(d->tasks);
+            d->tasks = tasks;
+            d->capacity = capacity;
+            d->front = 0;
+        } else {
+            ok = false;
+        }
+    }
+    if (ok) {
+        d->tasks[(d->front + d->size) & (d->capacity - 1)] = task;
+        ++d->size;
+    }
+    OScInternal_Mutex_Unlock(&d->mutex);
+    return ok;
+}
+
+static bool Deque_PopBack(struct Deque *d, struct Task *task) {
+    bool ok = false;
+    OScInternal_Mutex_Lock(&d->mutex);
+    if (d->size > 0) {
+        --d->size;
+        *task = d->tasks[(d->front + d->size) & (d->capacity - 1)];
+        ok = true;
+    }
+    OScInternal_Mutex_Unlock(&d->mutex);
+    return ok;
+}
+
+static bool Deque_PopFront(struct Deque *d, struct Task *task) {
+    bool ok = false;
+    OScInternal_Mutex_Lock(&d->mutex);
+    if (d->size > 0) {
+        *task = d->tasks[d->front];
+        d->front = (d->front + 1) & (d->capacity - 1);
+        --d->size;
+        ok = true;
+    }
+    OScInternal_Mutex_Unlock(&d->mutex);
+    return ok;
+}
+
+static bool FindTask(struct Worker *self, struct Task *task) {
+    if (Deque_PopBack(&self->deque, task))
+        return true;
+    struct TaskPool *pool = self->pool;
+    for (unsigned i = 1; i < pool->nWorkers; ++i) {
+        struct Worker *victim =
+            &pool->workers[(self->index + i) % pool->nWorkers];
+        if (Deque_PopFront(&victim->deque, task))
+            return true;
+    }
+    return false;
+}
+
+static void WorkerMain(void *data) {
+    struct Worker *self = data;
+    struct TaskPool *pool = self->pool;
+    t_currentWorker = self;
+    for (;;) {
+        OScInternal_Mutex_Lock(&pool->mutex);
+        while (pool->pending == 0)
+            OScInternal_Cond_Wait(&pool->tasksAvailable, &pool->mutex);
+        OScInternal_Mutex_Unlock(&pool->mutex);
+
+        struct Task task;
+        if (!FindTask(self, &task))
+            continue;
+
+        OScInternal_Mutex_Lock(&pool->mutex);
+        --pool->pending;
+        OScInternal_Mutex_Unlock(&pool->mutex);
+        task.func(task.data);
+    }
+}
+
+static struct TaskPool *GetPool(void) {
+    OScInternal_Mutex_Lock(&g_poolInitMutex);
+    if (!g_pool) {
+        struct TaskPool *pool = calloc(1, sizeof(struct TaskPool));
+        if (pool) {
+            OScInternal_Mutex_Init(&pool->mutex);
+            OScInternal_Cond_Init(&pool->tasksAvailable);
+
+            // Unlike ParallelFor(), the submitting thread does not take part
+            unsigned n = OScInternal_GetNumberOfProcessors();
+            if (n > MAX_WORKERS)
+                n = MAX_WORKERS;
+            for (unsigned i = 0; i < n; ++i) {
+                struct Worker *w = &pool->workers[i];
+                w->pool = pool;
+                w->index = i;
+                OScInternal_Mutex_Init(&w->deque.mutex);
+            }
+            // Workers do not look at nWorkers before the first task is
+            // submitted, which happens after this function returns.
+            unsigned started = 0;
+            while (started < n &&
+                   OScInternal_Thread_Create(&pool->workers[started].thread,
+                                             WorkerMain,
+                                             &pool->workers[started]))
+                ++started;
+            pool->nWorkers = started;
+            g_pool = pool;
+        }
+    }
+    OScInternal_Mutex_Unlock(&g_poolInitMutex);
+    return g_pool;
+}
+
+bool OScInternal_TaskPool_Submit(OScInternal_TaskFunc func, void *data) {
+    struct TaskPool *pool = GetPool();
+    if (!pool || pool->nWorkers == 0)
+        return false;
+
+    struct Worker *target = t_currentWorker;
+    if (!target) {
+        uint32_t i =
+            (uint32_t)OScInternal_Atomic_Increment(&pool->nextWorker);
+        target = &pool->workers[i % pool->nWorkers];
+    }
+
+    OScInternal_Mutex_Lock(&pool->mutex);
+    ++pool->pending;
+    OScInternal_Mutex_Unlock(&pool->mutex);
+
+    struct Task task = {func, data};
+    bool ok = Deque_PushBack(&target->deque, task);
+
+    OScInternal_Mutex_Lock(&pool->mutex);
+    if (ok)
+        OScInternal_Cond_Signal(&pool->tasksAvailable);
+    else
+        --pool->pending;
+    OScInternal_Mutex_Unlock(&pool->mutex);
+    return ok;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * Shared pool of worker threads running independent tasks, used for
+ * pipeline stages. Unlike the data-parallel loops of Parallel.h, tasks are
+ * fire-and-forget and may themselves submit further tasks.
+ *
+ * Each worker has its own deque: tasks submitted from a worker go to the
+ * back of its deque and are run from the back (most recent first, while the
+ * data is still in cache); idle workers steal from the front of the others'
+ * deques. Tasks submitted from other threads are distributed round-robin.
+ */
+
+typedef void (*OScInternal_TaskFunc)(void *data);
+
+// Queue 'func' to be called with 'data' on a worker thread. The pool is
+// created on first use and lives until process exit. Returns false if no
+// worker thread could be started (or memory was exhausted), in which case
+// the task was not queued.
+bool OScInternal_TaskPool_Submit(OScInternal_TaskFunc func, void *data);
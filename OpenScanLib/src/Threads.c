@@ -0,0 +1,225 @@
+#include "Threads.h"
+
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+/*
+ * This file contains platform-dependent implementations of the threading
+ * primitives declared in Threads.h.
+ */
+
+struct ThreadStart {
+    OScInternal_ThreadFunc func;
+    void *data;
+};
+
+#ifdef _WIN32
+
+static DWORD WINAPI ThreadMain(LPVOID param) {
+    struct ThreadStart start = *(struct ThreadStart *)param;
+    free(param);
+    start.func(start.data);
+    return 0;
+}
+
+bool OScInternal_Thread_Create(OScInternal_Thread *thread,
+                               OScInternal_ThreadFunc func, void *data) {
+    struct ThreadStart *start = malloc(sizeof(struct ThreadStart));
+    if (!start)
+        return false;
+    start->func = func;
+    start->data = data;
+    *thread = CreateThread(NULL, 0, ThreadMain, start, 0, NULL);
+    if (*thread == NULL) {
+        free(start);
+        return false;
+    }
+    return true;
+}
+
+void OScInternal_Thread_Join(OScInternal_Thread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+void OScInternal_Thread_Detach(OScInternal_Thread thread) {
+    CloseHandle(thread);
+}
+
+void OScInternal_Mutex_Init(OScInternal_Mutex *mutex) {
+    InitializeSRWLock(mutex);
+}
+
+void OScInternal_Mutex_Destroy(OScInternal_Mutex *mutex) {
+    (void)mutex; // SRW locks need no cleanup
+}
+
+void OScInternal_Mutex_Lock(OScInternal_Mutex *mutex) {
+    AcquireSRWLockExclusive(mutex);
+}
+
+void OScInternal_Mutex_Unlock(OScInternal_Mutex *mutex) {
+    ReleaseSRWLockExclusive(mutex);
+}
+
+void OScInternal_Cond_Init(OScInternal_Cond *cond) {
+    InitializeConditionVariable(cond);
+}
+
+void OScInternal_Cond_Destroy(OScInternal_Cond *cond) {
+    (void)cond; // Condition variables need no cleanup
+}
+
+void OScInternal_Cond_Wait(OScInternal_Cond *cond, OScInternal_Mutex *mutex) {
+    SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+}
+
+bool OScInternal_Cond_TimedWait(OScInternal_Cond *cond,
+                                OScInternal_Mutex *mutex, double seconds) {
+    DWORD ms = seconds > 0.0 ? (DWORD)(seconds * 1000.0 + 0.5) : 0;
+    if (ms == INFINITE)
+        --ms;
+    return SleepConditionVariableSRW(cond, mutex, ms, 0) ||
+           GetLastError() != ERROR_TIMEOUT;
+}
+
+void OScInternal_Cond_Signal(OScInternal_Cond *cond) {
+    WakeConditionVariable(cond);
+}
+
+void OScInternal_Cond_Broadcast(OScInternal_Cond *cond) {
+    WakeAllConditionVariable(cond);
+}
+
+int32_t OScInternal_Atomic_Increment(volatile int32_t *value) {
+    return InterlockedIncrement((volatile LONG *)value);
+}
+
+int32_t OScInternal_Atomic_Decrement(volatile int32_t *value) {
+    return InterlockedDecrement((volatile LONG *)value);
+}
+
+unsigned OScInternal_GetNumberOfProcessors(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+double OScInternal_GetMonotonicTime(void) {
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+#else // POSIX
+
+static void *ThreadMain(void *param) {
+    struct ThreadStart start = *(struct ThreadStart *)param;
+    free(param);
+    start.func(start.data);
+    return NULL;
+}
+
+bool OScInternal_Thread_Create(OScInternal_Thread *thread,
+                               OScInternal_ThreadFunc func, void *data) {
+    struct ThreadStart *start = malloc(sizeof(struct ThreadStart));
+    if (!start)
+        return false;
+    start->func = func;
+    start->data = data;
+    if (pthread_create(thread, NULL, ThreadMain, start) != 0) {
+        free(start);
+        return false;
+    }
+    return true;
+}
+
+void OScInternal_Thread_Join(OScInternal_Thread thread) {
+    pthread_join(thread, NULL);
+}
+
+void OScInternal_Thread_Detach(OScInternal_Thread thread) {
+    pthread_detach(thread);
+}
+
+void OScInternal_Mutex_Init(OScInternal_Mutex *mutex) {
+    pthread_mutex_init(mutex, NULL);
+}
+
+void OScInternal_Mutex_Destroy(OScInternal_Mutex *mutex) {
+    pthread_mutex_destroy(mutex);
+}
+
+void OScInternal_Mutex_Lock(OScInternal_Mutex *mutex) {
+    pthread_mutex_lock(mutex);
+}
+
+void OScInternal_Mutex_Unlock(OScInternal_Mutex *mutex) {
+    pthread_mutex_unlock(mutex);
+}
+
+void OScInternal_Cond_Init(OScInternal_Cond *cond) {
+    pthread_cond_init(cond, NULL);
+}
+
+void OScInternal_Cond_Destroy(OScInternal_Cond *cond) {
+    pthread_cond_destroy(cond);
+}
+
+void OScInternal_Cond_Wait(OScInternal_Cond *cond, OScInternal_Mutex *mutex) {
+    pthread_cond_wait(cond, mutex);
+}
+
+bool OScInternal_Cond_TimedWait(OScInternal_Cond *cond,
+                                OScInternal_Mutex *mutex, double seconds) {
+    // Condition variables use the realtime clock by default
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    if (seconds > 0.0) {
+        if (seconds > 1e9)
+            seconds = 1e9;
+        time_t whole = (time_t)seconds;
+        deadline.tv_sec += whole;
+        deadline.tv_nsec += (long)((seconds - (double)whole) * 1e9);
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_nsec -= 1000000000L;
+            ++deadline.tv_sec;
+        }
+    }
+    return pthread_cond_timedwait(cond, mutex, &deadline) != ETIMEDOUT;
+}
+
+void OScInternal_Cond_Signal(OScInternal_Cond *cond) {
+    pthread_cond_signal(cond);
+}
+
+void OScInternal_Cond_Broadcast(OScInternal_Cond *cond) {
+    pthread_cond_broadcast(cond);
+}
+
+int32_t OScInternal_Atomic_Increment(volatile int32_t *value) {
+    return __atomic_add_fetch(value, 1, __ATOMIC_ACQ_REL);
+}
+
+int32_t OScInternal_Atomic_Decrement(volatile int32_t *value) {
+    return __atomic_sub_fetch(value, 1, __ATOMIC_ACQ_REL);
+}
+
+unsigned OScInternal_GetNumberOfProcessors(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
+}
+
+double OScInternal_GetMonotonicTime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * Minimal platform-dependent threading primitives used by OpenScanLib's
+ * internal processing code. Only what is needed is wrapped here; this is not
+ * meant to be a general-purpose threading library.
+ */
+
+#ifdef _WIN32
+
+#include <Windows.h>
+
+typedef HANDLE OScInternal_Thread;
+typedef SRWLOCK OScInternal_Mutex;
+typedef CONDITION_VARIABLE OScInternal_Cond;
+
+#define OScInternal_MUTEX_INITIALIZER SRWLOCK_INIT
+
+#else
+
+#include <pthread.h>
+
+typedef pthread_t OScInternal_Thread;
+typedef pthread_mutex_t OScInternal_Mutex;
+typedef pthread_cond_t OScInternal_Cond;
+
+#define OScInternal_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+
+#endif
+
+typedef void (*OScInternal_ThreadFunc)(void *data);
+
+// Returns false if the thread could not be started.
+bool OScInternal_Thread_Create(OScInternal_Thread *thread,
+                               OScInternal_ThreadFunc func, void *data);
+void OScInternal_Thread_Join(OScInternal_Thread thread);
+// Let the thread run to completion on its own; it can no longer be joined.
+void OScInternal_Thread_Detach(OScInternal_Thread thread);
+
+// Mutexes with static storage duration may instead be initialized with
+// OScInternal_MUTEX_INITIALIZER (and are then never destroyed).
+void OScInternal_Mutex_Init(OScInternal_Mutex *mutex);
+void OScInternal_Mutex_Destroy(OScInternal_Mutex *mutex);
+void OScInternal_Mutex_Lock(OScInternal_Mutex *mutex);
+void OScInternal_Mutex_Unlock(OScInternal_Mutex *mutex);
+
+void OScInternal_Cond_Init(OScInternal_Cond *cond);
+void OScInternal_Cond_Destroy(OScInternal_Cond *cond);
+void OScInternal_Cond_Wait(OScInternal_Cond *cond, OScInternal_Mutex *mutex);
+// Like OScInternal_Cond_Wait(), but give up after 'seconds'. Returns false on
+// timeout (spurious wakeups may still return true).
+bool OScInternal_Cond_TimedWait(OScInternal_Cond *cond,
+                                OScInternal_Mutex *mutex, double seconds);
+void OScInternal_Cond_Signal(OScInternal_Cond *cond);
+void OScInternal_Cond_Broadcast(OScInternal_Cond *cond);
+
+// Atomically add 1 to or subtract 1 from a counter (such as a reference
+// count), returning the new value.
+int32_t OScInternal_Atomic_Increment(volatile int32_t *value);
+int32_t OScInternal_Atomic_Decrement(volatile int32_t *value);
+
+// Number of logical processors available to this process (at least 1).
+unsigned OScInternal_GetNumberOfProcessors(void);
+
+// Seconds from an arbitrary origin, unaffected by changes to the wall clock.
+double OScInternal_GetMonotonicTime(void);
@@ -0,0 +1,155 @@
+#include "TimeTag.h"
+#include "InternalErrors.h"
+#include "Parallel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MACROTIME_MASK 0xffffffffffULL
+
+// Pixels per block when transposing counters into images
+#define TRANSPOSE_BLOCK 64
+
+struct OScInternal_LifetimeHistogram {
+    struct OScInternal_LifetimeHistogramParams params;
+    OScInternal_LifetimeHistogramFrameFunc func;
+    void *data;
+
+    uint64_t lineTicks;  // Macrotime span of the pixels of a line
+    uint64_t pixelScale; // 2^32 / ticksPerPixel
+    size_t pixelStride;  // Counters per pixel (channels x bins)
+    size_t nPixels;
+
+    uint16_t *counts; // Pixel-major
+    uint16_t *images; // Image-major, for delivery
+
+    // Scan position; line is -1 before the first line of a frame
+    int64_t line;
+    uint64_t lineStartTime;
+    uint16_t *lineCounts;
+};
+
+OSc_RichError *OScInternal_LifetimeHistogram_Create(
+    OScInternal_LifetimeHistogram **histogram,
+    const struct OScInternal_LifetimeHistogramParams *params,
+    OScInternal_LifetimeHistogramFrameFunc func, void *data) {
+    if (params->width == 0 || params->height == 0 ||
+        params->numberOfChannels == 0 || params->microtimeBins == 0 ||
+        params->microtimeShift >= 16 || !(params->ticksPerPixel >= 1.0))
+        return OScInternal_Error_IllegalArgument();
+
+    OScInternal_LifetimeHistogram *h =
+        calloc(1, sizeof(OScInternal_LifetimeHistogram));
+    if (!h)
+        return OScInternal_Error_OutOfMemory();
+    h->params = *params;
+    h->func = func;
+    h->data = data;
+    h->lineTicks = (uint64_t)(params->width * params->ticksPerPixel + 0.5);
+    h->pixelScale = (uint64_t)(4294967296.0 / params->ticksPerPixel);
+    h->pixelStride = (size_t)params->numberOfChannels * params->microtimeBins;
+    h->nPixels = (size_t)params->width * params->height;
+    h->counts = calloc(h->nPixels * h->pixelStride, sizeof(uint16_t));
+    h->images = malloc(h->nPixels * h->pixelStride * sizeof(uint16_t));
+    if (!h->counts || !h->images) {
+        OScInternal_LifetimeHistogram_Destroy(h);
+        return OScInternal_Error_OutOfMemory();
+    }
+    h->line = -1;
+
+    *histogram = h;
+    return OSc_OK;
+}
+
+void OScInternal_LifetimeHistogram_Destroy(
+    OScInternal_LifetimeHistogram *histogram) {
+    if (!histogram)
+        return;
+    free(histogram->counts);
+    free(histogram->images);
+    free(histogram);
+}
+
+static void TransposeBlocks(void *data, size_t beginBlock, size_t endBlock) {
+    OScInternal_LifetimeHistogram *h = data;
+    size_t stride = h->pixelStride;
+    size_t end = endBlock * TRANSPOSE_BLOCK;
+    if (end > h->nPixels)
+        end = h->nPixels;
+
+    for (size_t p0 = beginBlock * TRANSPOSE_BLOCK; p0 < end;
+         p0 += TRANSPOSE_BLOCK) {
+        size_t n = end - p0 < TRANSPOSE_BLOCK ? end - p0 : TRANSPOSE_BLOCK;
+        const uint16_t *src = h->counts + p0 * stride;
+        for (size_t k = 0; k < stride; ++k) {
+            uint16_t *dst = h->images + k * h->nPixels + p0;
+            for (size_t i = 0; i < n; ++i)
+                dst[i] = src[i * stride + k];
+        }
+        memset(h->counts + p0 * stride, 0, n * stride * sizeof(uint16_t));
+    }
+}
+
+static bool CompleteFrame(OScInternal_LifetimeHistogram *h) {
+    h->line = -1;
+    size_t nBlocks = (h->nPixels + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK;
+    OScInternal_ParallelFor(nBlocks, 64, TransposeBlocks, h);
+
+    for (size_t k = 0; k < h->pixelStride; ++k) {
+        if (!h->func(h->data, (uint32_t)k, h->images + k * h->nPixels))
+            return false;
+    }
+    return true;
+}
+
+bool OScInternal_LifetimeHistogram_Add(
+    OScInternal_LifetimeHistogram *histogram, const uint64_t *timeTags,
+    size_t count) {
+    OScInternal_LifetimeHistogram *h = histogram;
+    const uint32_t width = h->params.width;
+    const uint32_t nChannels = h->params.numberOfChannels;
+    const uint32_t nBins = h->params.microtimeBins;
+    const uint32_t shift = h->params.microtimeShift;
+    const uint64_t lineTicks = h->lineTicks;
+    const uint64_t pixelScale = h->pixelScale;
+
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t tag = timeTags[i];
+        uint64_t time = tag & MACROTIME_MASK;
+        switch (tag >> 62) {
+        case OScDev_TimeTagKind_Photon: {
+            if (h->line < 0)
+                break;
+            uint64_t offset = (time - h->lineStartTime) & MACROTIME_MASK;
+            if (offset >= lineTicks)
+                break;
+            uint32_t pixel = (uint32_t)((offset * pixelScale) >> 32);
+            uint32_t channel = (uint32_t)(tag >> 56) & 0x3f;
+            uint32_t bin = ((uint32_t)(tag >> 40) & 0xffff) >> shift;
+            if (pixel >= width || channel >= nChannels || bin >= nBins)
+                break;
+            uint16_t *c = h->lineCounts + pixel * h->pixelStride +
+                          channel * nBins + bin;
+            *c += *c != UINT16_MAX;
+            break;
+        }
+        case OScDev_TimeTagKind_LineStart:
+            if (h->line + 1 == (int64_t)h->params.height) {
+                if (!CompleteFrame(h))
+                    return false;
+            }
+            ++h->line;
+            h->lineStartTime = time;
+            h->lineCounts =
+                h->counts + (size_t)h->line * width * h->pixelStride;
+            break;
+        case OScDev_TimeTagKind_FrameEnd:
+            if (h->line >= 0 && !CompleteFrame(h))
+                return false;
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+
+/*
+ * Lifetime histogram building from time-tagged photon records (see
+ * OScDev_TimeTag_Make() for the record format).
+ *
+ * Photons are assigned to a line by the preceding line start marker, to a
+ * pixel by their macrotime offset from that marker, and to a time bin by
+ * their microtime. Counters are stored pixel-major (all channels and time
+ * bins of a pixel are adjacent), so that the photons of a pixel, which
+ * arrive together, touch only a few cache lines. On frame completion the
+ * counters are transposed into one image per channel and time bin.
+ */
+
+struct OScInternal_LifetimeHistogramParams {
+    uint32_t width;
+    uint32_t height;
+    uint32_t numberOfChannels;
+    uint32_t microtimeBins;
+    uint32_t microtimeShift;
+    double ticksPerPixel; // Macrotime units per pixel; at least 1
+};
+
+// Receives an image of width x height counts for (local) channel index
+// 'channel' = detectorChannel * microtimeBins + bin. Return false to cancel.
+typedef bool (*OScInternal_LifetimeHistogramFrameFunc)(void *data,
+                                                       uint32_t channel,
+                                                       const uint16_t *counts);
+
+typedef struct OScInternal_LifetimeHistogram OScInternal_LifetimeHistogram;
+
+OSc_RichError *OScInternal_LifetimeHistogram_Create(
+    OScInternal_LifetimeHistogram **histogram,
+    const struct OScInternal_LifetimeHistogramParams *params,
+    OScInternal_LifetimeHistogramFrameFunc func, void *data);
+void OScInternal_LifetimeHistogram_Destroy(
+    OScInternal_LifetimeHistogram *histogram);
+
+// Process a batch of records, calling the frame function for each frame
+// completed. Returns false if the frame function requested cancellation.
+bool OScInternal_LifetimeHistogram_Add(
+    OScInternal_LifetimeHistogram *histogram, const uint64_t *timeTags,
+    size_t count);
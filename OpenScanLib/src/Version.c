@@ -1,6 +1,9 @@
+#include "Dispatch.h"
 #include "OpenScanLibPrivate.h"
 
 bool OScInternal_CheckVersion(uint32_t version) {
+    OScInternal_Dispatch_Init();
+
     uint16_t dllMajor = OScInternal_ABI_VERSION >> 16;
     uint16_t dllMinor = OScInternal_ABI_VERSION & 0xffff;
     uint16_t appMajor = version >> 16;
@@ -0,0 +1,618 @@
+#include "ZarrWriter.h"
+#include "Codec.h"
+#include "InternalErrors.h"
+#include "Parallel.h"
+#include "SampleFormat.h"
+#include "TaskPool.h"
+#include "Threads.h"
+
+#include <ss8str.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TARGET_CHUNK_BYTES (1024 * 1024)
+#define TARGET_SHARD_BYTES (16 * 1024 * 1024)
+#define MAX_TILE_SIZE 256 // Height and width of chunks
+#define MAX_CHUNK_FRAMES 64
+
+// Shards being filled or encoded at the same time
+#define NUMBER_OF_SHARDS 3
+
+// Per chunk: offset and size, or all ones if the chunk is empty
+#define INDEX_ENTRY_BYTES 16
+
+enum ShardState {
+    SHARD_FREE,
+    SHARD_FILLING,
+    SHARD_ENCODING,
+};
+
+struct Shard {
+    OScInternal_ZarrWriter *writer;
+    enum ShardState state;
+    uint64_t block;            // Index along t, in shards
+    uint32_t numberOfReceived; // Frames (of any channel) copied in
+    uint32_t numberOfFrames;   // Frames (along t) to store when encoding
+    char *frames;              // [shardFrames][channels][height][width]
+    char *output;              // Aligned; chunks followed by the index
+    size_t *chunkSizes;        // Encoded size of each chunk, if compressed
+    bool encodingFailed;       // Out of memory while compressing
+};
+
+// Shape of the array and its shards and chunks, fixed by the first frame
+struct Layout {
+    uint32_t width;
+    uint32_t height;
+    OSc_SampleFormat format;
+    uint32_t bytesPerSample;
+    uint32_t channels;
+    uint32_t chunkFrames;
+    uint32_t chunkHeight;
+    uint32_t chunkWidth;
+    uint32_t shardFrames;
+    uint32_t tilesY; // Chunks per shard along y
+    uint32_t tilesX; // Chunks per shard along x
+    size_t frameBytes;
+    size_t chunkBytes;
+    bool compressed;
+    size_t slotBytes; // Space for each chunk (encoded) in shard output
+    size_t chunksPerFrameBlock; // Chunks per chunkFrames frames
+    size_t chunksPerShard;
+};
+
+struct OScInternal_ZarrWriter {
+    char *path;
+    struct OScInternal_RecordingInfo info;
+    uint32_t *framesPerChannel; // info.numberOfChannels (at least 1)
+    bool laidOut;
+    struct Layout layout;
+    struct Shard shards[NUMBER_OF_SHARDS];
+
+    OScInternal_Mutex mutex; // Guards shard states and the error
+    OScInternal_Cond shardEncoded;
+    OSc_RichError *error; // First error from encoding, not yet returned
+};
+
+static const char *GetZarrDataType(OSc_SampleFormat format) {
+    switch (format) {
+    case OSc_SampleFormat_UInt8:
+        return "uint8";
+    case OSc_SampleFormat_UInt12:
+    case OSc_SampleFormat_UInt12Packed: // Unpacked in frames
+    case OSc_SampleFormat_UInt16:
+        return "uint16";
+    case OSc_SampleFormat_UInt32:
+        return "uint32";
+    case OSc_SampleFormat_Int8:
+        return "int8";
+    case OSc_SampleFormat_Int16:
+        return "int16";
+    case OSc_SampleFormat_Int32:
+        return "int32";
+    case OSc_SampleFormat_Float32:
+        return "float32";
+    default:
+        return NULL;
+    }
+}
+
+static bool IsLittleEndian(void) {
+    const uint16_t one = 1;
+    return *(const uint8_t *)&one == 1;
+}
+
+static void ComputeLayout(struct Layout *l, uint32_t width, uint32_t height,
+                          OSc_SampleFormat format, uint32_t channels,
+                          uint32_t numberOfFrames, bool compressed) {
+    memset(l, 0, sizeof(*l));
+    l->width = width;
+    l->height = height;
+    l->format = format;
+    l->bytesPerSample = OScInternal_SampleFormat_GetBytesPerSample(format);
+    l->channels = channels;
+    l->chunkWidth = width < MAX_TILE_SIZE ? width : MAX_TILE_SIZE;
+    l->chunkHeight = height < MAX_TILE_SIZE ? height : MAX_TILE_SIZE;
+    l->tilesX = (width + l->chunkWidth - 1) / l->chunkWidth;
+    l->tilesY = (height + l->chunkHeight - 1) / l->chunkHeight;
+
+    // Chunks span frames up to the target size, but not far beyond the
+    // number of frames
+    size_t tileBytes =
+        (size_t)l->chunkWidth * l->chunkHeight * l->bytesPerSample;
+    l->chunkFrames = 1;
+    while (l->chunkFrames < MAX_CHUNK_FRAMES &&
+           2 * l->chunkFrames * tileBytes <= TARGET_CHUNK_BYTES &&
+           l->chunkFrames < numberOfFrames)
+        l->chunkFrames *= 2;
+    l->chunkBytes = l->chunkFrames * tileBytes;
+    l->compressed = compressed;
+    l->slotBytes = compressed ? OScInternal_Codec_GetMaxEncodedSize(
+                                    l->chunkWidth,
+                                    l->chunkFrames * l->chunkHeight,
+                                    l->bytesPerSample)
+                              : l->chunkBytes;
+    l->chunksPerFrameBlock = (size_t)channels * l->tilesY * l->tilesX;
+
+    size_t frameBlockBytes = l->chunksPerFrameBlock * l->chunkBytes;
+    uint64_t frameBlocks = TARGET_SHARD_BYTES / frameBlockBytes;
+    if (frameBlocks == 0)
+        frameBlocks = 1;
+    uint64_t neededBlocks =
+        ((uint64_t)numberOfFrames + l->chunkFrames - 1) / l->chunkFrames;
+    if (frameBlocks > neededBlocks)
+        frameBlocks = neededBlocks;
+    l->shardFrames = l->chunkFrames * (uint32_t)frameBlocks;
+    l->chunksPerShard = frameBlocks * l->chunksPerFrameBlock;
+    l->frameBytes = (size_t)width * height * l->bytesPerSample;
+}
+
+static bool AllocateShard(struct Shard *shard, const struct Layout *l) {
+    if (!shard->frames) {
+        shard->frames = malloc((size_t)l->shardFrames * l->channels *
+                               l->frameBytes);
+        if (!shard->frames)
+            return false;
+    }
+    if (!shard->output) {
+        shard->output = OScInternal_Storage_AllocateAligned(
+            l->chunksPerShard * (l->slotBytes + INDEX_ENTRY_BYTES));
+        if (!shard->output)
+            return false;
+    }
+    if (l->compressed && !shard->chunkSizes) {
+        shard->chunkSizes = malloc(l->chunksPerShard * sizeof(size_t));
+        if (!shard->chunkSizes)
+            return false;
+    }
+    return true;
+}
+
+static OSc_RichError *TakeError(OScInternal_ZarrWriter *w) {
+    OScInternal_Mutex_Lock(&w->mutex);
+    OSc_RichError *err = w->error;
+    w->error = NULL;
+    OScInternal_Mutex_Unlock(&w->mutex);
+    return err;
+}
+
+// Gather chunks [begin, end) of a shard from its frames, in C order of the
+// chunk grid (frame block, channel, tile y, tile x), padding edge tiles with
+// the fill value (zero). Compressed chunks are gathered into a staging
+// buffer and encoded into their slot, each tile row as an image row.
+static void EncodeChunks(void *data, size_t begin, size_t end) {
+    struct Shard *shard = data;
+    OScInternal_ZarrWriter *w = shard->writer;
+    const struct Layout *l = &w->layout;
+    size_t rowBytes = (size_t)l->chunkWidth * l->bytesPerSample;
+    char *staging = NULL;
+    if (l->compressed) {
+        staging = malloc(l->chunkBytes);
+        if (!staging) {
+            OScInternal_Mutex_Lock(&w->mutex);
+            shard->encodingFailed = true;
+            OScInternal_Mutex_Unlock(&w->mutex);
+            return;
+        }
+    }
+    for (size_t i = begin; i < end; ++i) {
+        size_t tx = i % l->tilesX;
+        size_t ty = (i / l->tilesX) % l->tilesY;
+        size_t c = (i / ((size_t)l->tilesX * l->tilesY)) % l->channels;
+        size_t frameBlock = i / l->chunksPerFrameBlock;
+        size_t x0 = tx * l->chunkWidth;
+        size_t xn = l->width - x0 < l->chunkWidth ? l->width - x0
+                                                  : l->chunkWidth;
+        size_t srcBytes = xn * l->bytesPerSample;
+
+        char *slot = shard->output + i * l->slotBytes;
+        char *dst = staging ? staging : slot;
+        for (size_t f = 0; f < l->chunkFrames; ++f) {
+            size_t t = frameBlock * l->chunkFrames + f;
+            const char *frame =
+                shard->frames + (t * l->channels + c) * l->frameBytes;
+            for (size_t y = 0; y < l->chunkHeight; ++y, dst += rowBytes) {
+                size_t yy = ty * l->chunkHeight + y;
+                if (yy >= l->height) {
+                    memset(dst, 0, rowBytes);
+                    continue;
+                }
+                memcpy(dst,
+                       frame + (yy * l->width + x0) * l->bytesPerSample,
+                       srcBytes);
+                memset(dst + srcBytes, 0, rowBytes - srcBytes);
+            }
+        }
+        if (staging)
+            shard->chunkSizes[i] = OScInternal_Codec_Encode(
+                staging, l->chunkWidth, l->chunkFrames * l->chunkHeight,
+                l->bytesPerSample, slot);
+    }
+    free(staging);
+}
+
+// Pack the encoded chunks of a shard, append the index, and write the file
+static OSc_RichError *WriteShard(struct Shard *shard, size_t usedChunks) {
+    OScInternal_ZarrWriter *w = shard->writer;
+    const struct Layout *l = &w->layout;
+
+    // Compressed chunks are packed together, in order
+    size_t dataBytes = usedChunks * l->chunkBytes;
+    if (l->compressed) {
+        dataBytes = 0;
+        for (size_t i = 0; i < usedChunks; ++i) {
+            memmove(shard->output + dataBytes,
+                    shard->output + i * l->slotBytes, shard->chunkSizes[i]);
+            dataBytes += shard->chunkSizes[i];
+        }
+    }
+
+    char *index = shard->output + dataBytes;
+    uint64_t offset = 0;
+    for (size_t i = 0; i < l->chunksPerShard; ++i) {
+        uint64_t entry[2] = {UINT64_MAX, UINT64_MAX};
+        if (i < usedChunks) {
+            entry[0] = offset;
+            entry[1] = l->compressed ? shard->chunkSizes[i] : l->chunkBytes;
+            offset += entry[1];
+        }
+        memcpy(index + i * INDEX_ENTRY_BYTES, entry, INDEX_ENTRY_BYTES);
+    }
+    size_t size = dataBytes + l->chunksPerShard * INDEX_ENTRY_BYTES;
+
+    // Default chunk key encoding; a shard spans all of c, y, and x
+    size_t pathSize = strlen(w->path) + 64;
+    char *path = malloc(pathSize);
+    if (!path)
+        return OScInternal_Error_OutOfMemory();
+    snprintf(path, pathSize, "%s/c/%llu/0/0", w->path,
+             (unsigned long long)shard->block);
+    OSc_RichError *err = OScInternal_Storage_CreateDirectories(path);
+    if (err == OSc_OK) {
+        strcat(path, "/0");
+        err = OScInternal_Storage_WriteFile(path, shard->output, size);
+    }
+    free(path);
+    return err;
+}
+
+static void EncodeShard(void *data) {
+    struct Shard *shard = data;
+    OScInternal_ZarrWriter *w = shard->writer;
+    const struct Layout *l = &w->layout;
+
+    // Chunks entirely past the last frame are left empty
+    size_t usedChunks =
+        (shard->numberOfFrames + l->chunkFrames - 1) / l->chunkFrames *
+        l->chunksPerFrameBlock;
+    shard->encodingFailed = false;
+    OScInternal_ParallelFor(usedChunks, 1, EncodeChunks, shard);
+    OScInternal_Mutex_Lock(&w->mutex);
+    bool failed = shard->encodingFailed;
+    OScInternal_Mutex_Unlock(&w->mutex);
+
+    // The chunk sizes of a failed encoding are not valid, so neither the
+    // data nor the index can be assembled
+    OSc_RichError *err;
+    if (failed)
+        err = OScInternal_Error_OutOfMemory();
+    else
+        err = WriteShard(shard, usedChunks);
+
+    OScInternal_Mutex_Lock(&w->mutex);
+    if (err && w->error)
+        OScInternal_Error_Destroy(err);
+    else if (err)
+        w->error = err;
+    shard->state = SHARD_FREE;
+    OScInternal_Cond_Broadcast(&w->shardEncoded);
+    OScInternal_Mutex_Unlock(&w->mutex);
+}
+
+// Called without the mutex held (the shard may be encoded immediately)
+static void SubmitShard(struct Shard *shard, uint32_t numberOfFrames) {
+    OScInternal_ZarrWriter *w = shard->writer;
+    OScInternal_Mutex_Lock(&w->mutex);
+    shard->state = SHARD_ENCODING;
+    shard->numberOfFrames = numberOfFrames;
+    OScInternal_Mutex_Unlock(&w->mutex);
+    if (!OScInternal_TaskPool_Submit(EncodeShard, shard))
+        EncodeShard(shard);
+}
+
+// Get the shard filling for 'block', waiting for one to become free if
+// necessary
+static OSc_RichError *GetShard(OScInternal_ZarrWriter *w, uint64_t block,
+                               struct Shard **shard) {
+    OScInternal_Mutex_Lock(&w->mutex);
+    for (;;) {
+        struct Shard *available = NULL;
+        bool anyEncoding = false;
+        for (int i = 0; i < NUMBER_OF_SHARDS; ++i) {
+            struct Shard *s = &w->shards[i];
+            if (s->state == SHARD_FILLING && s->block == block) {
+                OScInternal_Mutex_Unlock(&w->mutex);
+                *shard = s;
+                return OSc_OK;
+            }
+            if (s->state == SHARD_FREE && !available)
+                available = s;
+            anyEncoding = anyEncoding || s->state == SHARD_ENCODING;
+        }
+        if (available) {
+            available->state = SHARD_FILLING;
+            available->block = block;
+            available->numberOfReceived = 0;
+            OScInternal_Mutex_Unlock(&w->mutex);
+            if (!AllocateShard(available, &w->layout)) {
+                OScInternal_Mutex_Lock(&w->mutex);
+                available->state = SHARD_FREE;
+                OScInternal_Mutex_Unlock(&w->mutex);
+                return OScInternal_Error_OutOfMemory();
+            }
+            *shard = available;
+            return OSc_OK;
+        }
+        if (!anyEncoding) {
+            // Every shard is waiting for frames of a lagging channel
+            OScInternal_Mutex_Unlock(&w->mutex);
+            return OScInternal_Error_Create(
+                "Channels too far out of step to buffer Zarr shards");
+        }
+        OScInternal_Cond_Wait(&w->shardEncoded, &w->mutex);
+    }
+}
+
+OSc_RichError *
+OScInternal_ZarrWriter_Create(OScInternal_ZarrWriter **writer,
+                              const char *path,
+                              const struct OScInternal_RecordingInfo *info) {
+    OScInternal_ZarrWriter *w = calloc(1, sizeof(OScInternal_ZarrWriter));
+    if (!w)
+        return OScInternal_Error_OutOfMemory();
+    w->info = *info;
+    if (w->info.numberOfChannels == 0)
+        w->info.numberOfChannels = 1;
+    w->path = malloc(strlen(path) + 1);
+    w->framesPerChannel = calloc(w->info.numberOfChannels, sizeof(uint32_t));
+    if (!w->path || !w->framesPerChannel) {
+        free(w->path);
+        free(w->framesPerChannel);
+        free(w);
+        return OScInternal_Error_OutOfMemory();
+    }
+    strcpy(w->path, path);
+    for (int i = 0; i < NUMBER_OF_SHARDS; ++i)
+        w->shards[i].writer = w;
+
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, OScInternal_Storage_CreateDirectories(path))) {
+        free(w->path);
+        free(w->framesPerChannel);
+        free(w);
+        return err;
+    }
+    OScInternal_Mutex_Init(&w->mutex);
+    OScInternal_Cond_Init(&w->shardEncoded);
+    *writer = w;
+    return OSc_OK;
+}
+
+OSc_RichError *
+OScInternal_ZarrWriter_WriteFrame(OScInternal_ZarrWriter *writer,
+                                  uint32_t channel, uint32_t width,
+                                  uint32_t height, OSc_SampleFormat format,
+                                  const void *pixels) {
+    struct Layout *l = &writer->layout;
+    if (channel >= writer->info.numberOfChannels || width == 0 ||
+        height == 0 || !GetZarrDataType(format))
+        return OScInternal_Error_IllegalArgument();
+    if (!writer->laidOut) {
+        ComputeLayout(l, width, height, format, writer->info.numberOfChannels,
+                      writer->info.numberOfFrames,
+                      writer->info.compression ==
+                          OSc_StorageCompression_Lossless);
+        writer->laidOut = true;
+    } else if (width != l->width || height != l->height ||
+               format != l->format) {
+        return OScInternal_Error_IllegalArgument();
+    }
+
+    uint32_t t = writer->framesPerChannel[channel];
+    struct Shard *shard = NULL;
+    OSc_RichError *err;
+    if (OSc_CHECK_ERROR(err, GetShard(writer, t / l->shardFrames, &shard)))
+        return err;
+    ++writer->framesPerChannel[channel];
+    size_t slot = (size_t)(t % l->shardFrames) * l->channels + channel;
+    memcpy(shard->frames + slot * l->frameBytes, pixels, l->frameBytes);
+    if (++shard->numberOfReceived == l->shardFrames * l->channels)
+        SubmitShard(shard, l->shardFrames);
+    return TakeError(writer);
+}
+
+static void CatFormat(ss8str *s, const char *format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    ss8_cat_cstr(s, buf);
+}
+
+static void BuildMetadata(ss8str *json, const OScInternal_ZarrWriter *w,
+                          uint32_t numberOfFrames) {
+    const struct Layout *l = &w->layout;
+    const struct OScInternal_RecordingInfo *info = &w->info;
+    const char *endian = IsLittleEndian() ? "little" : "big";
+    ss8_cat_cstr(json, "{\n"
+                       "  \"zarr_format\": 3,\n"
+                       "  \"node_type\": \"array\",\n");
+    CatFormat(json, "  \"shape\": [%u, %u, %u, %u],\n",
+              (unsigned)numberOfFrames, (unsigned)l->channels,
+              (unsigned)l->height, (unsigned)l->width);
+    CatFormat(json, "  \"data_type\": \"%s\",\n", GetZarrDataType(l->format));
+    CatFormat(json,
+              "  \"chunk_grid\": {\"name\": \"regular\", \"configuration\": "
+              "{\"chunk_shape\": [%u, %u, %u, %u]}},\n",
+              (unsigned)l->shardFrames, (unsigned)l->channels,
+              (unsigned)(l->tilesY * l->chunkHeight),
+              (unsigned)(l->tilesX * l->chunkWidth));
+    ss8_cat_cstr(json, "  \"chunk_key_encoding\": {\"name\": \"default\", "
+                       "\"configuration\": {\"separator\": \"/\"}},\n"
+                       "  \"fill_value\": 0,\n"
+                       "  \"codecs\": [{\"name\": \"sharding_indexed\", "
+                       "\"configuration\": {\n");
+    CatFormat(json, "    \"chunk_shape\": [%u, 1, %u, %u],\n",
+              (unsigned)l->chunkFrames, (unsigned)l->chunkHeight,
+              (unsigned)l->chunkWidth);
+    if (l->compressed)
+        ss8_cat_cstr(json, "    \"codecs\": [{\"name\": "
+                           "\"openscan_lossless\"}],\n");
+    else
+        CatFormat(json,
+                  "    \"codecs\": [{\"name\": \"bytes\", "
+                  "\"configuration\": {\"endian\": \"%s\"}}],\n",
+                  endian);
+    CatFormat(json,
+              "    \"index_codecs\": [{\"name\": \"bytes\", "
+              "\"configuration\": {\"endian\": \"%s\"}}],\n",
+              endian);
+    ss8_cat_cstr(json, "    \"index_location\": \"end\"}}],\n"
+                       "  \"dimension_names\": [\"t\", \"c\", \"y\", "
+                       "\"x\"],\n"
+                       "  \"attributes\": {\"openscan\": {\n");
+    CatFormat(json, "    \"pixelRateHz\": %.15g,\n", info->pixelRateHz);
+    CatFormat(json, "    \"resolution\": %u,\n", (unsigned)info->resolution);
+    CatFormat(json, "    \"zoomFactor\": %.15g,\n", info->zoomFactor);
+    CatFormat(json, "    \"roi\": [%u, %u, %u, %u]}}\n",
+              (unsigned)info->xOffset, (unsigned)info->yOffset,
+              (unsigned)info->width, (unsigned)info->height);
+    ss8_cat_cstr(json, "}\n");
+}
+
+static OSc_RichError *WriteMetadata(const OScInternal_ZarrWriter *w,
+                                    uint32_t numberOfFrames) {
+    ss8str path;
+    ss8_init_copy_cstr(&path, w->path);
+    ss8_cat_cstr(&path, "/zarr.json");
+    ss8str json;
+    ss8_init(&json);
+    BuildMetadata(&json, w, numberOfFrames);
+
+    OSc_RichError *err = OSc_OK;
+    FILE *fp = fopen(ss8_cstr(&path), "wb");
+    if (!fp ||
+        fwrite(ss8_cstr(&json), 1, ss8_len(&json), fp) != ss8_len(&json))
+        err = OScInternal_Error_Create("Cannot write Zarr metadata");
+    if (fp && fclose(fp) != 0 && err == OSc_OK)
+        err = OScInternal_Error_Create("Cannot write Zarr metadata");
+    ss8_destroy(&json);
+    ss8_destroy(&path);
+    return err;
+}
+
+OSc_RichError *OScInternal_ZarrWriter_Close(OScInternal_ZarrWriter *writer) {
+    if (!writer)
+        return OSc_OK;
+    struct Layout *l = &writer->layout;
+    if (!writer->laidOut) {
+        // No frames; describe an empty array
+        const struct OScInternal_RecordingInfo *info = &writer->info;
+        OSc_SampleFormat format = GetZarrDataType(info->sampleFormat)
+                                      ? info->sampleFormat
+                                      : OSc_SampleFormat_UInt16;
+        ComputeLayout(l, info->width ? info->width : 1,
+                      info->height ? info->height : 1, format,
+                      info->numberOfChannels, 1,
+                      info->compression == OSc_StorageCompression_Lossless);
+    }
+
+    uint32_t numberOfFrames = 0;
+    for (uint32_t c = 0; c < l->channels; ++c) {
+        if (writer->framesPerChannel[c] > numberOfFrames)
+            numberOfFrames = writer->framesPerChannel[c];
+    }
+
+    // Complete the shards still filling, zeroing the frames never received
+    for (int i = 0; i < NUMBER_OF_SHARDS; ++i) {
+        struct Shard *shard = &writer->shards[i];
+        if (shard->state != SHARD_FILLING)
+            continue;
+        uint64_t start = shard->block * l->shardFrames;
+        for (uint32_t t = 0; t < l->shardFrames; ++t) {
+            for (uint32_t c = 0; c < l->channels; ++c) {
+                if (start + t >= writer->framesPerChannel[c]) {
+                    size_t slot = (size_t)t * l->channels + c;
+                    memset(shard->frames + slot * l->frameBytes, 0,
+                           l->frameBytes);
+                }
+            }
+        }
+        uint64_t frames = numberOfFrames - start;
+        SubmitShard(shard, (uint32_t)(frames < l->shardFrames
+                                          ? frames
+                                          : l->shardFrames));
+    }
+
+    OScInternal_Mutex_Lock(&writer->mutex);
+    for (int i = 0; i < NUMBER_OF_SHARDS; ++i) {
+        while (writer->shards[i].state != SHARD_FREE)
+            OScInternal_Cond_Wait(&writer->shardEncoded, &writer->mutex);
+    }
+    OScInternal_Mutex_Unlock(&writer->mutex);
+
+    OSc_RichError *err = TakeError(writer);
+    OSc_RichError *metadataErr = WriteMetadata(writer, numberOfFrames);
+    if (metadataErr && err)
+        OScInternal_Error_Destroy(metadataErr);
+    else if (metadataErr)
+        err = metadataErr;
+
+    for (int i = 0; i < NUMBER_OF_SHARDS; ++i) {
+        free(writer->shards[i].frames);
+        OScInternal_Storage_FreeAligned(writer->shards[i].output);
+        free(writer->shards[i].chunkSizes);
+    }
+    OScInternal_Cond_Destroy(&writer->shardEncoded);
+    OScInternal_Mutex_Destroy(&writer->mutex);
+    free(writer->framesPerChannel);
+    free(writer->path);
+    free(writer);
+    return err;
+}
+
+static OSc_RichError *
+CreateSinkWriter(void **writer, const char *path,
+                 const struct OScInternal_RecordingInfo *info) {
+    return OScInternal_ZarrWriter_Create((OScInternal_ZarrWriter **)writer,
+                                         path, info);
+}
+
+static OSc_RichError *WriteSinkFrame(void *writer, uint32_t channel,
+                                     uint32_t width, uint32_t height,
+                                     OSc_SampleFormat format,
+                                     const void *pixels) {
+    return OScInternal_ZarrWriter_WriteFrame(writer, channel, width, height,
+                                             format, pixels);
+}
+
+static OSc_RichError *CloseSinkWriter(void *writer) {
+    return OScInternal_ZarrWriter_Close(writer);
+}
+
+static const struct OScInternal_StorageSink g_zarrSink = {
+    CreateSinkWriter,
+    WriteSinkFrame,
+    CloseSinkWriter,
+    true,
+};
+
+OSc_RichError *OScInternal_ZarrWriter_AddStage(OScInternal_Pipeline *pipeline,
+                                               const char *path,
+                                               uint32_t queueDepth,
+                                               OSc_PipelineStage **stage) {
+    return OScInternal_StorageSink_AddStage(pipeline, &g_zarrSink, path,
+                                            queueDepth, stage);
+}
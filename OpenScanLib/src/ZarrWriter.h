@@ -0,0 +1,56 @@
+#pragma once
+
+#include "OpenScanLibPrivate.h"
+#include "Pipeline.h"
+#include "Storage.h"
+
+/*
+ * Chunked array writer producing a Zarr (version 3) array.
+ *
+ * The array has dimensions (t, c, y, x). It is divided into shards of a
+ * block of frames with all channels and the whole (padded) frame, each
+ * stored as one file ("c/<block>/0/0/0") holding the shard's chunks and,
+ * at its end, an index of them (the "sharding_indexed" codec). Chunks of
+ * several frames of a tile of one channel are sized for efficient reading;
+ * shards are sized to keep the number of files small.
+ *
+ * Frames are copied into a shard buffer as they arrive. When a shard is
+ * complete, its chunks are encoded (in parallel) and the shard file is
+ * written by a task on the shared task pool, while the next shard fills.
+ * If the recording is compressed, each chunk is encoded with the lossless
+ * codec (Codec.h) as a frame of the chunk's width, and the encoded chunks
+ * are packed together in the shard file.
+ * The array metadata ("zarr.json"), including the acquisition parameters
+ * as attributes, is written when the writer is closed, when the number of
+ * frames is known.
+ */
+
+typedef struct OScInternal_ZarrWriter OScInternal_ZarrWriter;
+
+// Create the array directory 'path'. Frames of channels beyond
+// 'info->numberOfChannels' (or 1, if 0) are rejected.
+OSc_RichError *
+OScInternal_ZarrWriter_Create(OScInternal_ZarrWriter **writer,
+                              const char *path,
+                              const struct OScInternal_RecordingInfo *info);
+
+// Copy one channel of one frame into its shard; may block while all shard
+// buffers are being encoded. An error from encoding or writing an earlier
+// shard may be returned.
+OSc_RichError *
+OScInternal_ZarrWriter_WriteFrame(OScInternal_ZarrWriter *writer,
+                                  uint32_t channel, uint32_t width,
+                                  uint32_t height, OSc_SampleFormat format,
+                                  const void *pixels);
+
+// Write any incomplete last shard and the metadata. The writer is destroyed
+// even if an error is returned.
+OSc_RichError *OScInternal_ZarrWriter_Close(OScInternal_ZarrWriter *writer);
+
+// Add a built-in stage writing every frame it receives to a Zarr array,
+// which is created when the acquisition is armed and completed when it
+// finishes
+OSc_RichError *OScInternal_ZarrWriter_AddStage(OScInternal_Pipeline *pipeline,
+                                               const char *path,
+                                               uint32_t queueDepth,
+                                               OSc_PipelineStage **stage);
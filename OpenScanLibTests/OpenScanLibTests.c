@@ -29,9 +29,42 @@
 extern int tests_run;
 /* End of MinUnit */
 
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include <dlpack/dlpack.h>
+
+#include "Codec.h"
+#include "DeviceInterface.h"
+#include "DeviceManifest.h"
+#include "Dispatch.h"
+#include "FrameRing.h"
+#include "Interleave.h"
+#include "Journal.h"
+#include "ModuleHost.h"
+#include "OMETiffWriter.h"
 #include "OpenScanLibPrivate.h"
+#include "Phasor.h"
+#include "PhotonCounting.h"
+#include "Pipeline.h"
+#include "Pyramid.h"
+#include "RawWriter.h"
+#include "RecordingReader.h"
+#include "Remap.h"
+#include "SampleFormat.h"
+#include "StorageThroughput.h"
+#include "StreamServer.h"
+#include "Threads.h"
+#include "TimeTag.h"
+#include "ZarrWriter.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 static char *test_NumRange_Intersection(void) {
     OScInternal_NumRange *bigRange =
@@ -51,15 +84,1934 @@ static char *test_NumRange_Intersection(void) {
     return NULL;
 }
 
+static void ShiftRight(double x, double y, double *distortedX,
+                       double *distortedY, void *data) {
+    (void)data;
+    *distortedX = x + 0.25; // 1 pixel at resolution 8
+    *distortedY = y;
+}
+
+static char *test_Remap(void) {
+    enum { W = 8, H = 6 };
+    uint16_t src[W * H], dst[W * H];
+    for (int i = 0; i < W * H; ++i)
+        src[i] = (uint16_t)(1000 * i);
+
+    // 180-degree rotation of a centered ROI is an exact point reflection
+    struct OScInternal_RemapGeometry geom = {
+        .resolution = 8,
+        .zoomFactor = 1.0,
+        .yOffset = 1,
+        .width = W,
+        .height = H,
+        .rotationDegrees = 180.0,
+    };
+    OScInternal_RemapMap *map;
+    mu_assert("remap map expected",
+              OScInternal_RemapMap_Get(&geom, &map) == OSc_OK);
+    OScInternal_RemapMap_Apply(map, src, dst, 2);
+    OScInternal_RemapMap_Release(map);
+    for (int i = 0; i < W * H; ++i)
+        mu_assert("rotated pixel expected", dst[i] == src[W * H - 1 - i]);
+
+    // Distortion by a whole pixel shifts the image, leaving zeros
+    geom.rotationDegrees = 0.0;
+    geom.distortionFunc = ShiftRight;
+    mu_assert("remap map expected",
+              OScInternal_RemapMap_Get(&geom, &map) == OSc_OK);
+    OScInternal_RemapMap_Apply(map, src, dst, 2);
+    OScInternal_RemapMap_Release(map);
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            uint16_t expected = x < W - 1 ? src[y * W + x + 1] : 0;
+            mu_assert("shifted pixel expected", dst[y * W + x] == expected);
+        }
+    }
+
+    return NULL;
+}
+
+static char *test_PhotonCount(void) {
+    // Two lines of 3 pixels with 4 samples each. A pulse that dips only
+    // below the upper threshold (but not the lower) is counted once.
+    const uint8_t src[] = {
+        200, 0, 200, 0,     // 2 photons
+        200, 80, 200, 0,    // 1 photon (hysteresis)
+        0, 0, 0, 200,       // 1 photon, still high at end of pixel
+        200, 200, 200, 200, // 1 photon: discriminator reset at line start
+        0, 0, 0, 0,         // 0 photons
+        100, 0, 60, 10,     // 1 photon
+    };
+    const uint8_t expected[] = {2, 1, 1, 1, 0, 1};
+    uint8_t dst[6];
+    struct OScInternal_PhotonCountParams params = {
+        .width = 3,
+        .height = 2,
+        .samplesPerPixel = 4,
+        .bytesPerSample = 1,
+        .bytesPerCount = 1,
+        .lowerThreshold = 50,
+        .upperThreshold = 100,
+    };
+    OScInternal_PhotonCount(&params, src, dst);
+    for (int i = 0; i < 6; ++i)
+        mu_assert("photon count expected", dst[i] == expected[i]);
+
+    return NULL;
+}
+
+static char *test_Phasor(void) {
+    // Pixel i has all of its photons in time bin i % 4, except the last,
+    // which is empty
+    enum { N = 21, BINS = 4 };
+    uint16_t bins[BINS][N] = {{0}};
+    for (int i = 0; i < N - 1; ++i)
+        bins[i % BINS][i] = (uint16_t)(i + 1);
+
+    OScInternal_Phasor *phasor;
+    mu_assert("phasor expected",
+              OScInternal_Phasor_Create(&phasor, N, BINS, 1) == OSc_OK);
+    for (uint32_t k = 0; k < BINS; ++k) {
+        bool complete = OScInternal_Phasor_AddBin(phasor, k, bins[k], 2);
+        mu_assert("frame completion expected", complete == (k == BINS - 1));
+    }
+    float g[N], s[N], intensity[N];
+    // Rotate by a quarter turn and halve
+    OScInternal_Phasor_Compute(phasor, 1.5707963267948966, 0.5, g, s,
+                               intensity);
+    OScInternal_Phasor_Destroy(phasor);
+
+    for (int i = 0; i < N - 1; ++i) {
+        double phase = 6.283185307179586 * (i % BINS + 0.5) / BINS;
+        mu_assert("intensity expected", intensity[i] == i + 1);
+        mu_assert("G expected", fabs(g[i] + 0.5 * sin(phase)) < 1e-6);
+        mu_assert("S expected", fabs(s[i] - 0.5 * cos(phase)) < 1e-6);
+    }
+    mu_assert("empty pixel expected",
+              g[N - 1] == 0.0f && s[N - 1] == 0.0f && intensity[N - 1] == 0);
+
+    return NULL;
+}
+
+static uint16_t histogramImages[4][8];
+static int histogramFrames;
+
+static bool StoreHistogramImage(void *data, uint32_t channel,
+                                const uint16_t *counts) {
+    (void)data;
+    memcpy(histogramImages[channel], counts, sizeof(histogramImages[0]));
+    if (channel == 3)
+        ++histogramFrames;
+    return true;
+}
+
+static char *test_LifetimeHistogram(void) {
+    // 4 x 2 pixels of 10 macrotime units each, 4 time bins
+    struct OScInternal_LifetimeHistogramParams params = {
+        .width = 4,
+        .height = 2,
+        .numberOfChannels = 1,
+        .microtimeBins = 4,
+        .ticksPerPixel = 10.0,
+    };
+    const uint64_t P = OScDev_TimeTagKind_Photon;
+    const uint64_t tags[] = {
+        (P << 62) | (2ULL << 40) | 50, // Before first line: dropped
+        ((uint64_t)OScDev_TimeTagKind_LineStart << 62) | 100,
+        (P << 62) | (1ULL << 40) | 105,  // Pixel 0, bin 1
+        (P << 62) | (3ULL << 40) | 115,  // Pixel 1, bin 3
+        (P << 62) | (3ULL << 40) | 119,  // Pixel 1, bin 3
+        (P << 62) | (9ULL << 40) | 125,  // Bin out of range: dropped
+        (P << 62) | (1ULL << 56) | 126,  // Channel out of range: dropped
+        (P << 62) | 139,                 // Pixel 3, bin 0
+        (P << 62) | 140,                 // After end of line: dropped
+        ((uint64_t)OScDev_TimeTagKind_LineStart << 62) | 200,
+        (P << 62) | (2ULL << 40) | 225, // Pixel 6, bin 2
+        ((uint64_t)OScDev_TimeTagKind_FrameEnd << 62) | 300,
+    };
+    OScInternal_LifetimeHistogram *histogram;
+    mu_assert("histogram expected",
+              OScInternal_LifetimeHistogram_Create(&histogram, &params,
+                                                   StoreHistogramImage,
+                                                   NULL) == OSc_OK);
+    // Splitting the batch must not matter
+    mu_assert("no cancellation expected",
+              OScInternal_LifetimeHistogram_Add(histogram, tags, 5));
+    mu_assert("no cancellation expected",
+              OScInternal_LifetimeHistogram_Add(histogram, tags + 5,
+                                                sizeof(tags) / 8 - 5));
+    OScInternal_LifetimeHistogram_Destroy(histogram);
+
+    static const uint16_t expected[4][8] = {
+        {0, 0, 0, 1, 0, 0, 0, 0},
+        {1, 0, 0, 0, 0, 0, 0, 0},
+        {0, 0, 0, 0, 0, 0, 1, 0},
+        {0, 2, 0, 0, 0, 0, 0, 0},
+    };
+    mu_assert("one frame expected", histogramFrames == 1);
+    mu_assert("histogram images expected",
+              memcmp(histogramImages, expected, sizeof(expected)) == 0);
+
+    return NULL;
+}
+
+static char *test_Interleave(void) {
+    // Enough samples for the vector kernels plus a remainder
+    enum { C = 3, N = 37 };
+    uint16_t interleaved[C * N], planar[C][N], reinterleaved[C * N];
+    for (int i = 0; i < C * N; ++i)
+        interleaved[i] = (uint16_t)(i * 7919);
+    void *planes[C] = {planar[0], planar[1], planar[2]};
+
+    mu_assert("deinterleave expected",
+              OScInternal_DeinterleaveChannels(interleaved, planes, C, 2,
+                                               N) == OSc_OK);
+    for (int k = 0; k < C; ++k)
+        for (int j = 0; j < N; ++j)
+            mu_assert("planar sample expected",
+                      planar[k][j] == interleaved[j * C + k]);
+
+    mu_assert("interleave expected",
+              OScInternal_InterleaveChannels((const void *const *)planes,
+                                             reinterleaved, C, 2,
+                                             N) == OSc_OK);
+    mu_assert("round trip expected",
+              memcmp(interleaved, reinterleaved, sizeof(interleaved)) == 0);
+
+    return NULL;
+}
+
+static char *test_SampleFormat(void) {
+    mu_assert("promote expected",
+              OScInternal_SampleFormat_Promote(
+                  OSc_SampleFormat_UInt8, OSc_SampleFormat_UInt12Packed) ==
+                  OSc_SampleFormat_UInt12);
+    mu_assert("promote expected",
+              OScInternal_SampleFormat_Promote(OSc_SampleFormat_UInt8,
+                                               OSc_SampleFormat_Int8) ==
+                  OSc_SampleFormat_Int16);
+    mu_assert("promote expected",
+              OScInternal_SampleFormat_Promote(OSc_SampleFormat_Int16,
+                                               OSc_SampleFormat_Float32) ==
+                  OSc_SampleFormat_Float32);
+
+    // 0x123, 0xabc, 0xfff, 0x001, 0x800
+    const uint8_t packed[] = {0x23, 0xc1, 0xab, 0xff, 0x1f, 0x00, 0x00, 0x08};
+    uint16_t unpacked[5];
+    mu_assert("unpack expected",
+              OScInternal_ConvertSamples(
+                  packed, OSc_SampleFormat_UInt12Packed, unpacked,
+                  OSc_SampleFormat_UInt16, 5) == OSc_OK);
+    const uint16_t expected[] = {0x123, 0xabc, 0xfff, 0x001, 0x800};
+    mu_assert("unpacked samples expected",
+              memcmp(unpacked, expected, sizeof(expected)) == 0);
+
+    const float floats[] = {-1.0f, 0.4f, 0.6f, 254.5f, 1e6f};
+    uint8_t bytes[5];
+    mu_assert("convert expected",
+              OScInternal_ConvertSamples(floats, OSc_SampleFormat_Float32,
+                                         bytes, OSc_SampleFormat_UInt8,
+                                         5) == OSc_OK);
+    mu_assert("saturated samples expected",
+              bytes[0] == 0 && bytes[1] == 0 && bytes[2] == 1 &&
+                  bytes[3] == 255 && bytes[4] == 255);
+
+    return NULL;
+}
+
+static OScDev_Error VersionTestReleaseInstance(OScDev_Device *device) {
+    (void)device;
+    return OScDev_OK;
+}
+
+static OScDev_Error VersionTestGetBytesPerSample(OScDev_Device *device,
+                                                 uint32_t *bytesPerSample) {
+    (void)device;
+    *bytesPerSample = 1;
+    return OScDev_OK;
+}
+
+static OScDev_Error VersionTestGetSampleFormat(OScDev_Device *device,
+                                               uint32_t channel,
+                                               OScDev_SampleFormat *format) {
+    (void)device;
+    (void)channel;
+    *format = OScDev_SampleFormat_Int16;
+    return OScDev_OK;
+}
+
+static char *test_DeviceImplVersion(void) {
+    static OScDev_ModuleImpl modImpl = {.displayName = "VersionTest"};
+    static OScDev_DeviceImpl impl = {
+        .ReleaseInstance = VersionTestReleaseInstance,
+        .GetBytesPerSample = VersionTestGetBytesPerSample,
+        .GetSampleFormat = VersionTestGetSampleFormat,
+    };
+
+    // A module built for 13.3 has no GetSampleFormat field to read
+    OScInternal_Module_SetABIVersion(&modImpl,
+                                     OScDevInternal_MAKE_VERSION(13, 3));
+    OSc_Device *device;
+    OScInternal_Device_Create(&modImpl, &device, &impl, NULL);
+    OSc_SampleFormat format;
+    mu_assert("format from bytes per sample expected",
+              OScInternal_Device_GetSampleFormat(device, 0, &format) ==
+                      OSc_OK &&
+                  format == OSc_SampleFormat_UInt8);
+    OScInternal_Device_Destroy(device);
+
+    OScInternal_Module_SetABIVersion(&modImpl,
+                                     OScDevInternal_MAKE_VERSION(13, 4));
+    OScInternal_Device_Create(&modImpl, &device, &impl, NULL);
+    mu_assert("format from module expected",
+              OScInternal_Device_GetSampleFormat(device, 0, &format) ==
+                      OSc_OK &&
+                  format == OSc_SampleFormat_Int16);
+    OScInternal_Device_Destroy(device);
+    return NULL;
+}
+
+// A device that is clock, scanner and 8-channel detector, and whose
+// acquisitions finish as soon as they are armed
+static OScDev_Error PyramidTestNoOp(OScDev_Device *device) {
+    (void)device;
+    return OScDev_OK;
+}
+
+static OScDev_Error PyramidTestHasRole(OScDev_Device *device, bool *has) {
+    (void)device;
+    *has = true;
+    return OScDev_OK;
+}
+
+static OScDev_Error PyramidTestGetNumberOfChannels(OScDev_Device *device,
+                                                   uint32_t *nChannels) {
+    (void)device;
+    *nChannels = 8;
+    return OScDev_OK;
+}
+
+static OScDev_Error PyramidTestGetBytesPerSample(OScDev_Device *device,
+                                                 uint32_t *bytesPerSample) {
+    (void)device;
+    *bytesPerSample = 2;
+    return OScDev_OK;
+}
+
+static OScDev_Error PyramidTestArm(OScDev_Device *device,
+                                   OScDev_Acquisition *acq) {
+    (void)device;
+    (void)acq;
+    return OScDev_OK;
+}
+
+static OScDev_Error PyramidTestIsRunning(OScDev_Device *device,
+                                         bool *isRunning) {
+    (void)device;
+    *isRunning = false;
+    return OScDev_OK;
+}
+
+static bool PyramidTestPreview(OSc_Acquisition *acq, uint32_t channel,
+                               uint32_t level, uint32_t width,
+                               uint32_t height, void *pixels, void *data) {
+    (void)acq;
+    (void)channel;
+    (void)level;
+    (void)width;
+    (void)height;
+    (void)pixels;
+    (void)data;
+    return true;
+}
+
+static char *test_Pyramid(void) {
+    // Odd sizes replicate the last column and row
+    const uint16_t frame[] = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+    mu_assert("max levels expected",
+              OScInternal_Pyramid_GetMaxLevels(3, 3) == 2);
+
+    OScInternal_Pyramid *pyramid;
+    mu_assert("create expected",
+              OScInternal_Pyramid_Create(&pyramid, 3, 3, 2,
+                                         OSc_SampleFormat_UInt16) == OSc_OK);
+    OScInternal_Pyramid_Build(pyramid, frame);
+
+    const uint16_t *level1 = OScInternal_Pyramid_GetLevel(pyramid, 1);
+    mu_assert("level 1 expected", level1[0] == 3 && level1[1] == 5 &&
+                                      level1[2] == 8 && level1[3] == 9);
+    const uint16_t *level2 = OScInternal_Pyramid_GetLevel(pyramid, 2);
+    mu_assert("level 2 expected", level2[0] == 6);
+
+    OScInternal_Pyramid_Destroy(pyramid);
+
+    // The pyramids of an acquisition are released by the number allocated,
+    // even if the number of output channels has changed since it was armed
+    static OScDev_ModuleImpl modImpl = {.displayName = "PyramidTest"};
+    static OScDev_DeviceImpl impl = {
+        .ReleaseInstance = PyramidTestNoOp,
+        .Open = PyramidTestNoOp,
+        .Close = PyramidTestNoOp,
+        .HasClock = PyramidTestHasRole,
+        .HasScanner = PyramidTestHasRole,
+        .HasDetector = PyramidTestHasRole,
+        .GetNumberOfChannels = PyramidTestGetNumberOfChannels,
+        .GetBytesPerSample = PyramidTestGetBytesPerSample,
+        .Arm = PyramidTestArm,
+        .Start = PyramidTestNoOp,
+        .Stop = PyramidTestNoOp,
+        .IsRunning = PyramidTestIsRunning,
+        .Wait = PyramidTestNoOp,
+    };
+    OSc_Device *device;
+    OScInternal_Device_Create(&modImpl, &device, &impl, NULL);
+    OSc_LSM *lsm;
+    OSc_LSM_Create(&lsm);
+    bool ok = OSc_Device_Open(device, lsm) == OSc_OK &&
+              OSc_LSM_SetClockDevice(lsm, device) == OSc_OK &&
+              OSc_LSM_SetScannerDevice(lsm, device) == OSc_OK &&
+              OSc_LSM_AddDetectorDevice(lsm, device) == OSc_OK;
+    OSc_AcqTemplate *tmpl = NULL;
+    OSc_Acquisition *acq;
+    ok = ok && OSc_AcqTemplate_Create(&tmpl, lsm) == OSc_OK &&
+         OSc_Acquisition_Create(&acq, tmpl) == OSc_OK;
+    if (ok) {
+        // 3 phasor channels, then 8 channels, then 3 again
+        ok = OSc_Acquisition_SetPreviewPyramid(acq, 2, PyramidTestPreview) ==
+                 OSc_OK &&
+             OSc_Acquisition_SetPhasorAnalysis(acq, 1) == OSc_OK &&
+             OSc_Acquisition_Arm(acq) == OSc_OK &&
+             OSc_Acquisition_Wait(acq) == OSc_OK &&
+             OSc_Acquisition_SetPhasorAnalysis(acq, 0) == OSc_OK &&
+             OSc_Acquisition_Arm(acq) == OSc_OK &&
+             OSc_Acquisition_Wait(acq) == OSc_OK &&
+             OSc_Acquisition_SetPhasorAnalysis(acq, 1) == OSc_OK &&
+             OSc_Acquisition_Arm(acq) == OSc_OK &&
+             OSc_Acquisition_Wait(acq) == OSc_OK &&
+             OSc_Acquisition_SetPhasorAnalysis(acq, 0) == OSc_OK;
+        OSc_Acquisition_Destroy(acq);
+    }
+    OSc_AcqTemplate_Destroy(tmpl);
+    OSc_LSM_Destroy(lsm);
+    OScInternal_Device_Destroy(device);
+    mu_assert("re-armed acquisition expected", ok);
+    return NULL;
+}
+
+// Run the kernels covered by test_Dispatch at the currently bound level
+static void RunDispatchedKernels(const uint8_t *input, size_t n,
+                                 uint8_t *output) {
+    enum { W = 32, H = 32 };
+    uint8_t *out = output;
+
+    OScInternal_Pyramid *pyramid;
+    OScInternal_Pyramid_Create(&pyramid, W, H, 2, OSc_SampleFormat_UInt16);
+    OScInternal_Pyramid_Build(pyramid, input);
+    memcpy(out, OScInternal_Pyramid_GetLevel(pyramid, 1),
+           W / 2 * H / 2 * sizeof(uint16_t));
+    out += W / 2 * H / 2 * sizeof(uint16_t);
+    OScInternal_Pyramid_Destroy(pyramid);
+
+    OScInternal_ConvertSamples(input, OSc_SampleFormat_UInt16, out,
+                               OSc_SampleFormat_UInt8, n / 2);
+    out += n / 2;
+    OScInternal_ConvertSamples(input, OSc_SampleFormat_UInt12Packed, out,
+                               OSc_SampleFormat_UInt16, n / 2);
+    out += n;
+
+    struct OScInternal_PhotonCountParams params = {
+        .width = (uint32_t)(n / 64),
+        .height = 1,
+        .samplesPerPixel = 64,
+        .bytesPerSample = 1,
+        .bytesPerCount = 1,
+        .lowerThreshold = 64,
+        .upperThreshold = 192,
+    };
+    OScInternal_PhotonCount(&params, input, out);
+    out += n / 64;
+
+    uint8_t planar[4][512];
+    void *planes[4] = {planar[0], planar[1], planar[2], planar[3]};
+    OScInternal_DeinterleaveChannels(input, planes, 4, 1, n / 4);
+    memcpy(out, planar, n);
+}
+
+static char *test_Dispatch(void) {
+    mu_assert("kernel names expected",
+              OSc_GetNumberOfKernels() > 0 && OSc_GetKernelName(0) &&
+                  !OSc_GetKernelName(OSc_GetNumberOfKernels()));
+
+    // Every level must give the same results as the scalar kernels
+    enum { N = 2048, OUT = 512 + N / 2 + N + N / 64 + N };
+    static uint8_t input[N], expected[OUT], actual[OUT];
+    uint32_t x = 12345;
+    for (int i = 0; i < N; ++i) {
+        x = x * 1103515245 + 12345;
+        input[i] = (uint8_t)(x >> 16);
+    }
+
+    OSc_SIMDLevel initial = OSc_GetSIMDLevel();
+    OScInternal_Dispatch_Bind(OSc_SIMDLevel_Scalar);
+    mu_assert("scalar level expected",
+              OSc_GetSIMDLevel() == OSc_SIMDLevel_Scalar);
+    RunDispatchedKernels(input, N, expected);
+
+    OSc_SIMDLevel supported = OScInternal_Dispatch_GetSupportedLevel();
+    for (OSc_SIMDLevel level = OSc_SIMDLevel_SSE42; level <= supported;
+         ++level) {
+        OScInternal_Dispatch_Bind(level);
+        memset(actual, 0, sizeof(actual));
+        RunDispatchedKernels(input, N, actual);
+        mu_assert("results independent of level expected",
+                  memcmp(expected, actual, sizeof(actual)) == 0);
+    }
+
+    OScInternal_Dispatch_Bind(initial);
+    return NULL;
+}
+
+static char *test_Codec(void) {
+    // Rows that do not fill whole blocks, with a gradient and some noise
+    enum { W = 200, H = 37, N = W * H };
+    static uint16_t frame[N], decoded[N];
+    static uint8_t expected[N * 3], encoded[N * 5];
+    uint32_t x = 12345;
+    for (int i = 0; i < N; ++i) {
+        x = x * 1103515245 + 12345;
+        frame[i] = (uint16_t)(1000 + 20 * (i / W) + (i % W) +
+                              ((x >> 16) & 31) - (i == N / 2 ? 999 : 0));
+    }
+    mu_assert("bound expected",
+              OScInternal_Codec_GetMaxEncodedSize(W, H, 2) <=
+                      sizeof(expected) &&
+                  OScInternal_Codec_GetMaxEncodedSize(7, N / 7, 4) <=
+                      sizeof(encoded));
+
+    OSc_SIMDLevel initial = OSc_GetSIMDLevel();
+    OScInternal_Dispatch_Bind(OSc_SIMDLevel_Scalar);
+    size_t size = OScInternal_Codec_Encode(frame, W, H, 2, expected);
+    mu_assert("compression expected", size > 0 && size < sizeof(frame) / 2);
+
+    OSc_SIMDLevel supported = OScInternal_Dispatch_GetSupportedLevel();
+    for (OSc_SIMDLevel level = OSc_SIMDLevel_Scalar; level <= supported;
+         ++level) {
+        OScInternal_Dispatch_Bind(level);
+        mu_assert("encoding independent of level expected",
+                  OScInternal_Codec_Encode(frame, W, H, 2, encoded) ==
+                          size &&
+                      memcmp(encoded, expected, size) == 0);
+        memset(decoded, 0, sizeof(decoded));
+        mu_assert("decode expected",
+                  OScInternal_Codec_Decode(encoded, size, decoded,
+                                           sizeof(decoded)) == OSc_OK &&
+                      memcmp(decoded, frame, sizeof(frame)) == 0);
+    }
+    OScInternal_Dispatch_Bind(initial);
+
+    uint32_t width, height, bytesPerSample;
+    mu_assert("info expected",
+              OScInternal_Codec_GetFrameInfo(encoded, size, &width, &height,
+                                             &bytesPerSample) == OSc_OK &&
+                  width == W && height == H && bytesPerSample == 2);
+    OSc_RichError *err =
+        OScInternal_Codec_Decode(encoded, size - 1, decoded, sizeof(decoded));
+    mu_assert("truncated data rejected", err != OSc_OK);
+    OScInternal_Error_Destroy(err);
+
+    // Other sample sizes, with a frame narrower than a block
+    static uint32_t wide[N], wideDecoded[N];
+    for (int i = 0; i < N; ++i)
+        wide[i] = (uint32_t)frame[i] * 65599u;
+    size = OScInternal_Codec_Encode(wide, 7, N / 7, 4, encoded);
+    mu_assert("32-bit round trip expected",
+              size > 0 &&
+                  OScInternal_Codec_Decode(encoded, size, wideDecoded,
+                                           sizeof(wideDecoded)) == OSc_OK &&
+                  memcmp(wide, wideDecoded, (N / 7) * 7 * 4) == 0);
+    size = OScInternal_Codec_Encode(frame, N * 2, 1, 1, encoded);
+    mu_assert("8-bit round trip expected",
+              size > 0 &&
+                  OScInternal_Codec_Decode(encoded, size, decoded,
+                                           sizeof(decoded)) == OSc_OK &&
+                  memcmp(frame, decoded, sizeof(frame)) == 0);
+    return NULL;
+}
+
+static bool SumPipelineFrame(OSc_PipelineStage *stage, OSc_FrameBuffer *frame,
+                             void *data) {
+    (void)stage;
+    uint32_t width, height;
+    OSc_FrameBuffer_GetSize(frame, &width, &height);
+    const uint16_t *pixels = OSc_FrameBuffer_GetPixels(frame);
+    uint32_t *sum = data;
+    for (uint32_t i = 0; i < width * height; ++i)
+        *sum += pixels[i];
+    return true;
+}
+
+static char *test_Pipeline(void) {
+    OScInternal_Pipeline *pipeline;
+    mu_assert("create expected",
+              OScInternal_Pipeline_Create(&pipeline, NULL) == OSc_OK);
+
+    // Source -> downsample -> sum, and source -> sum
+    uint32_t fullSum = 0, downsampledSum = 0;
+    OSc_PipelineStage *full, *downsample, *downsampled;
+    OScInternal_Pipeline_AddStage(pipeline, SumPipelineFrame, &fullSum, NULL,
+                                  0, &full);
+    OScInternal_Pipeline_AddDownsampleStage(pipeline, 1, 0, &downsample);
+    OScInternal_Pipeline_AddStage(pipeline, SumPipelineFrame,
+                                  &downsampledSum, NULL, 0, &downsampled);
+    mu_assert("connect expected",
+              OSc_PipelineStage_Connect(downsample, downsampled) == OSc_OK);
+    OSc_RichError *err = OSc_PipelineStage_Connect(downsampled, downsample);
+    mu_assert("cycle rejected", err != OSc_OK);
+    OScInternal_Error_Destroy(err);
+
+    const uint16_t frame[] = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+    for (int i = 0; i < 3; ++i)
+        mu_assert("push expected",
+                  OScInternal_Pipeline_Push(pipeline, 0, 3, 3,
+                                            OSc_SampleFormat_UInt16, frame));
+    OScInternal_Pipeline_Drain(pipeline);
+
+    mu_assert("full frames expected", fullSum == 3 * 45);
+    mu_assert("downsampled frames expected", downsampledSum == 3 * 25);
+    uint64_t processed, dropped;
+    OSc_PipelineStage_GetStatistics(downsampled, &processed, &dropped, NULL,
+                                    NULL, NULL, NULL);
+    mu_assert("statistics expected", processed == 3 && dropped == 0);
+
+    // Packed samples (0x123, 0xabc) reach the stages unpacked
+    const uint8_t packed[] = {0x23, 0xc1, 0xab};
+    fullSum = 0;
+    mu_assert("push expected",
+              OScInternal_Pipeline_Push(pipeline, 0, 2, 1,
+                                        OSc_SampleFormat_UInt12Packed,
+                                        packed));
+    OScInternal_Pipeline_Drain(pipeline);
+    mu_assert("unpacked frame expected", fullSum == 0x123 + 0xabc);
+    OScInternal_Pipeline_Destroy(pipeline);
+
+    OSc_FrameBuffer *buffer;
+    mu_assert("frame buffer expected",
+              OSc_FrameBuffer_Create(&buffer, 0, 3, 3,
+                                     OSc_SampleFormat_UInt8) == OSc_OK);
+    bool aligned = (uintptr_t)OSc_FrameBuffer_GetPixels(buffer) % 64 == 0;
+    OSc_FrameBuffer_Release(buffer);
+    mu_assert("aligned pixels expected", aligned);
+    return NULL;
+}
+
+static char *test_DLPack(void) {
+    enum { W = 5, H = 3 };
+    OSc_FrameBuffer *frames[2];
+    for (uint32_t c = 0; c < 2; ++c) {
+        OSc_FrameBuffer_Create(&frames[c], c, W, H, OSc_SampleFormat_Int16);
+        int16_t *pixels = OSc_FrameBuffer_GetPixels(frames[c]);
+        for (int i = 0; i < W * H; ++i)
+            pixels[i] = (int16_t)(c * 100 - i);
+    }
+
+    // In place, holding a reference to the frame buffer
+    DLManagedTensor *t;
+    mu_assert("export expected",
+              OSc_FrameBuffer_ExportDLPack(frames[1], &t) == OSc_OK);
+    OSc_FrameBuffer_Release(frames[1]);
+    const DLTensor *dl = &t->dl_tensor;
+    mu_assert("tensor expected",
+              dl->ndim == 2 && dl->shape[0] == H && dl->shape[1] == W &&
+                  dl->strides[0] == W && dl->strides[1] == 1 &&
+                  dl->dtype.code == kDLInt && dl->dtype.bits == 16 &&
+                  dl->dtype.lanes == 1 && dl->device.device_type == kDLCPU &&
+                  ((int16_t *)dl->data)[W * H - 1] == 100 - (W * H - 1));
+
+    OSc_FrameBuffer *set[2] = {frames[0], t->manager_ctx};
+    DLManagedTensor *s;
+    mu_assert("set export expected",
+              OSc_FrameBuffer_ExportDLPackSet(set, 2, &s) == OSc_OK);
+    t->deleter(t); // Frees frames[1]
+    dl = &s->dl_tensor;
+    const int16_t *data = dl->data;
+    mu_assert("set tensor expected",
+              dl->ndim == 3 && dl->shape[0] == 2 && dl->shape[1] == H &&
+                  dl->shape[2] == W && dl->strides[0] == W * H &&
+                  dl->strides[1] == W && dl->strides[2] == 1 &&
+                  data[1] == -1 && data[W * H + 1] == 99);
+    s->deleter(s);
+
+    OSc_FrameBuffer *other;
+    OSc_FrameBuffer_Create(&other, 1, W, H, OSc_SampleFormat_UInt16);
+    set[1] = other;
+    OSc_RichError *err = OSc_FrameBuffer_ExportDLPackSet(set, 2, &s);
+    mu_assert("mismatched formats rejected", err != OSc_OK);
+    OScInternal_Error_Destroy(err);
+    OSc_FrameBuffer_Release(other);
+    OSc_FrameBuffer_Release(frames[0]);
+    return NULL;
+}
+
+static char *test_RawWriter(void) {
+    const char *path = "OpenScanLibTests_raw.tmp";
+    OScInternal_Pipeline *pipeline;
+    mu_assert("create expected",
+              OScInternal_Pipeline_Create(&pipeline, NULL) == OSc_OK);
+    OSc_PipelineStage *stage;
+    mu_assert("add expected", OScInternal_RawWriter_AddStage(
+                                  pipeline, path, 0, &stage) == OSc_OK);
+    mu_assert("start expected",
+              OScInternal_Pipeline_Start(pipeline) == OSc_OK);
+
+    // Small frames, and frames larger than the write buffers
+    enum { W = 80, H = 40 };
+    static uint16_t small[9], large[W * H];
+    for (int i = 0; i < 9; ++i)
+        small[i] = (uint16_t)(i + 1);
+    for (int i = 0; i < W * H; ++i)
+        large[i] = (uint16_t)(3 * i);
+    for (int i = 0; i < 2; ++i) {
+        OScInternal_Pipeline_Push(pipeline, 0, 3, 3, OSc_SampleFormat_UInt16,
+                                  small);
+        OScInternal_Pipeline_Push(pipeline, 1, W, H, OSc_SampleFormat_UInt16,
+                                  large);
+    }
+    mu_assert("finish expected",
+              OScInternal_Pipeline_Finish(pipeline) == OSc_OK);
+    OScInternal_Pipeline_Destroy(pipeline);
+
+    FILE *fp = fopen(path, "rb");
+    mu_assert("file expected", fp != NULL);
+    struct OScInternal_RawHeader header;
+    bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+              memcmp(header.magic, OScInternal_RAW_MAGIC, 8) == 0 &&
+              header.indexOffset % OScInternal_STORAGE_ALIGNMENT == 0 &&
+              header.numberOfRecords == 4;
+    struct OScInternal_RawIndexEntry index[4];
+    ok = ok && fseek(fp, (long)header.indexOffset, SEEK_SET) == 0 &&
+         fread(index, sizeof(index), 1, fp) == 1;
+    for (int i = 0; ok && i < 4; ++i) {
+        uint32_t channel = i % 2;
+        size_t bytes = channel ? sizeof(large) : sizeof(small);
+        static uint16_t pixels[W * H];
+        ok = index[i].channel == channel &&
+             index[i].frame == (uint32_t)i / 2 &&
+             index[i].width == (channel ? W : 3) &&
+             index[i].offset % OScInternal_STORAGE_ALIGNMENT == 0 &&
+             fseek(fp, (long)index[i].offset, SEEK_SET) == 0 &&
+             fread(pixels, bytes, 1, fp) == 1 &&
+             memcmp(pixels, channel ? large : small, bytes) == 0;
+    }
+    fclose(fp);
+    remove(path);
+    mu_assert("records expected", ok);
+    return NULL;
+}
+
+static char *test_Journal(void) {
+    const char *path = "OpenScanLibTests_journal.tmp";
+    uint64_t entries[5] = {1, 2, 3, 4, 5};
+    OScInternal_Journal *journal;
+    mu_assert("create expected",
+              OScInternal_Journal_Create(&journal, path, sizeof(uint64_t)) ==
+                  OSc_OK);
+    mu_assert("commit expected",
+              OScInternal_Journal_Commit(journal, entries, 3) == OSc_OK &&
+                  OScInternal_Journal_Commit(journal, entries + 3, 2) ==
+                      OSc_OK);
+    mu_assert("close expected",
+              OScInternal_Journal_Close(journal, false) == OSc_OK);
+
+    // A group torn by a crash
+    FILE *fp = fopen(path, "ab");
+    mu_assert("append expected", fp != NULL);
+    fwrite("OScG\1\0\0\0\2\0\0\0\0\0\0\0\xff", 1, 17, fp);
+    fclose(fp);
+
+    void *read;
+    size_t count;
+    OSc_RichError *err =
+        OScInternal_Journal_Read(path, sizeof(uint64_t), &read, &count);
+    remove(path);
+    mu_assert("read expected", err == OSc_OK);
+    bool ok = count == 5 && memcmp(read, entries, sizeof(entries)) == 0;
+    free(read);
+    mu_assert("entries expected", ok);
+    return NULL;
+}
+
+static uint16_t RecordingTestPixel(uint32_t f, uint32_t c, uint32_t i) {
+    return (uint16_t)(1000 * f + 100 * c + i % 97);
+}
+
+static char *test_RecordingReader(void) {
+    const char *path = "OpenScanLibTests_reader.tmp";
+    enum { W = 40, H = 20 };
+    static uint16_t pixels[W * H];
+    bool ok = true;
+    for (int compressed = 0; ok && compressed < 2; ++compressed) {
+        struct OScInternal_RecordingInfo info = {0};
+        info.numberOfChannels = 2;
+        info.sampleFormat = OSc_SampleFormat_UInt16;
+        info.numberOfFrames = UINT32_MAX;
+        info.compression = compressed ? OSc_StorageCompression_Lossless
+                                      : OSc_StorageCompression_None;
+        info.commitFrames = 1;
+        OScInternal_RawWriter *writer;
+        mu_assert("create expected", OScInternal_RawWriter_Create(
+                                         &writer, path, &info) == OSc_OK);
+        // 3 frames, the last without channel 1
+        for (uint32_t f = 0; f < 3; ++f) {
+            for (uint32_t c = 0; c < (f < 2 ? 2u : 1u); ++c) {
+                for (uint32_t i = 0; i < W * H; ++i)
+                    pixels[i] = RecordingTestPixel(f, c, i);
+                OScInternal_RawWriter_WriteFrame(writer, c, W, H,
+                                                 OSc_SampleFormat_UInt16,
+                                                 pixels);
+            }
+        }
+        // Before closing, the committed frames are recovered from the journal
+        OSc_RecordingReader *reader;
+        mu_assert("recovery expected",
+                  OSc_RecordingReader_Open(&reader, path) == OSc_OK);
+        ok = OSc_RecordingReader_GetNumberOfFrames(reader) == 2 &&
+             OSc_RecordingReader_ReadFrame(reader, 1, 1, pixels,
+                                           sizeof(pixels)) == OSc_OK &&
+             pixels[W * H - 1] == RecordingTestPixel(1, 1, W * H - 1);
+        OSc_RecordingReader_Close(reader);
+        mu_assert("close expected",
+                  OScInternal_RawWriter_Close(writer) == OSc_OK);
+        mu_assert("recovered frames expected", ok);
+
+        mu_assert("open expected",
+                  OSc_RecordingReader_Open(&reader, path) == OSc_OK);
+        ok = OSc_RecordingReader_GetNumberOfFrames(reader) == 3 &&
+             OSc_RecordingReader_GetNumberOfChannels(reader) == 2 &&
+             OSc_RecordingReader_GetCompression(reader) == info.compression;
+        OSc_RecordingReader_SetSequentialAccess(reader, true);
+        OSc_RecordingReader_Prefetch(reader, 1, 10);
+        for (uint32_t f = 2; ok && f-- > 0;) { // Out of order
+            for (uint32_t c = 0; ok && c < 2; ++c) {
+                uint32_t width, height;
+                OSc_SampleFormat format;
+                const void *data;
+                size_t size;
+                ok = OSc_RecordingReader_GetFrameInfo(reader, f, c, &width,
+                                                      &height,
+                                                      &format) == OSc_OK &&
+                     width == W && height == H &&
+                     format == OSc_SampleFormat_UInt16 &&
+                     OSc_RecordingReader_GetFrame(reader, f, c, &data,
+                                                  &size) == OSc_OK &&
+                     OSc_RecordingReader_ReadFrame(reader, f, c, pixels,
+                                                   sizeof(pixels)) == OSc_OK;
+                if (ok && !compressed)
+                    ok = size == sizeof(pixels) &&
+                         memcmp(data, pixels, size) == 0;
+                if (ok && compressed)
+                    ok = size < sizeof(pixels);
+                for (uint32_t i = 0; ok && i < W * H; ++i)
+                    ok = pixels[i] == RecordingTestPixel(f, c, i);
+            }
+        }
+        OSc_RichError *err = OSc_RecordingReader_ReadFrame(
+            reader, 2, 1, pixels, sizeof(pixels));
+        ok = ok && err != OSc_OK;
+        OScInternal_Error_Destroy(err);
+        OSc_RecordingReader_Close(reader);
+        remove(path);
+    }
+    mu_assert("frames expected", ok);
+    return NULL;
+}
+
+// Directory containing the replay device module; NULL to skip its test
+static const char *g_replayModuleDir;
+
+struct ReplayTestFrames {
+    uint32_t delivered[2]; // Per channel
+    bool ok;
+};
+
+static bool ReplayTestFrameCallback(OSc_Acquisition *acq, uint32_t channel,
+                                    void *pixels, void *data) {
+    (void)acq;
+    struct ReplayTestFrames *frames = data;
+    enum { W = 40, H = 20 };
+    if (channel >= 2) {
+        frames->ok = false;
+        return false;
+    }
+    uint32_t f = frames->delivered[channel]++;
+    const uint16_t *p = pixels;
+    for (uint32_t i = 0; frames->ok && i < W * H; ++i)
+        frames->ok = p[i] == RecordingTestPixel(f, channel, i);
+    return true;
+}
+
+static char *test_ReplayDevice(void) {
+    if (!g_replayModuleDir) {
+        printf("Skipping replay device test (no module directory given)\n");
+        return NULL;
+    }
+
+    // A recording of 2 frames with 2 channels
+    const char *path = "OpenScanLibTests_replay.tmp";
+    enum { W = 40, H = 20 };
+    static uint16_t pixels[W * H];
+    struct OScInternal_RecordingInfo info = {0};
+    info.numberOfChannels = 2;
+    info.sampleFormat = OSc_SampleFormat_UInt16;
+    info.numberOfFrames = 2;
+    OScInternal_RawWriter *writer;
+    mu_assert("create expected",
+              OScInternal_RawWriter_Create(&writer, path, &info) == OSc_OK);
+    for (uint32_t f = 0; f < 2; ++f) {
+        for (uint32_t c = 0; c < 2; ++c) {
+            for (uint32_t i = 0; i < W * H; ++i)
+                pixels[i] = RecordingTestPixel(f, c, i);
+            OScInternal_RawWriter_WriteFrame(
+                writer, c, W, H, OSc_SampleFormat_UInt16, pixels);
+        }
+    }
+    mu_assert("close expected",
+              OScInternal_RawWriter_Close(writer) == OSc_OK);
+
+    const char *paths[] = {g_replayModuleDir, NULL};
+    OSc_SetDeviceModuleSearchPaths(paths);
+    OSc_Device **devices;
+    size_t count = 0;
+    const char *name = "";
+    mu_assert("replay device expected",
+              OSc_GetAllDevices(&devices, &count) == OSc_OK && count == 1 &&
+                  OSc_Device_GetName(devices[0], &name) == OSc_OK &&
+                  strcmp(name, "Replay Device") == 0);
+    OSc_Device *device = devices[0];
+
+    OSc_LSM *lsm;
+    OSc_LSM_Create(&lsm);
+    bool ok = OSc_Device_Open(device, lsm) == OSc_OK &&
+              OSc_LSM_SetClockDevice(lsm, device) == OSc_OK &&
+              OSc_LSM_SetScannerDevice(lsm, device) == OSc_OK &&
+              OSc_LSM_AddDetectorDevice(lsm, device) == OSc_OK;
+    OSc_Setting **settings;
+    ok = ok && OSc_Device_GetSettings(device, &settings, &count) == OSc_OK;
+    OSc_Setting *file = NULL;
+    for (size_t i = 0; ok && i < count; ++i) {
+        char settingName[OSc_MAX_STR_SIZE];
+        OSc_Setting_GetName(settings[i], settingName);
+        if (strcmp(settingName, "Recording file") == 0)
+            file = settings[i];
+    }
+    ok = ok && file && OSc_Setting_SetStringValue(file, path) == OSc_OK;
+    OSc_AcqTemplate *tmpl = NULL;
+    ok = ok && OSc_AcqTemplate_Create(&tmpl, lsm) == OSc_OK &&
+         OSc_AcqTemplate_SetNumberOfFrames(tmpl, 2) == OSc_OK;
+
+    // The default ROI is the full (square) resolution, not the recorded size
+    OSc_Acquisition *acq;
+    char msg[1024] = "";
+    if (ok && OSc_Acquisition_Create(&acq, tmpl) == OSc_OK) {
+        OSc_RichError *err = OSc_Acquisition_Arm(acq);
+        if (err) {
+            OSc_Error_FormatRecursive(err, msg, sizeof(msg));
+            OSc_Error_Destroy(err);
+        } else {
+            OSc_Acquisition_Stop(acq);
+            OSc_Acquisition_Wait(acq);
+        }
+        OSc_Acquisition_Destroy(acq);
+    }
+    ok = ok && strstr(msg, "differs from the recording");
+
+    struct ReplayTestFrames frames = {{0, 0}, true};
+    ok = ok && OSc_AcqTemplate_SetROI(tmpl, 0, 0, W, H) == OSc_OK &&
+         OSc_Acquisition_Create(&acq, tmpl) == OSc_OK;
+    if (ok) {
+        OSc_Acquisition_SetFrameCallback(acq, ReplayTestFrameCallback);
+        OSc_Acquisition_SetData(acq, &frames);
+        ok = OSc_Acquisition_Arm(acq) == OSc_OK &&
+             OSc_Acquisition_Start(acq) == OSc_OK &&
+             OSc_Acquisition_Wait(acq) == OSc_OK;
+        OSc_Acquisition_Destroy(acq);
+    }
+    ok = ok && frames.ok && frames.delivered[0] == 2 &&
+         frames.delivered[1] == 2;
+
+    OSc_AcqTemplate_Destroy(tmpl);
+    OSc_LSM_Destroy(lsm);
+    remove(path);
+    mu_assert("replayed frames expected", ok);
+    return NULL;
+}
+
+static char *test_FrameRing(void) {
+    const char *name = "OpenScanLibTests_ring";
+    enum { W = 16, H = 8, SLOTS = 4 };
+    static uint16_t pixels[W * H];
+    OScInternal_FrameRing *ring;
+    mu_assert("create expected",
+              OScInternal_FrameRing_Create(&ring, name, SLOTS,
+                                           sizeof(pixels)) == OSc_OK);
+    OSc_FrameRingSubscriber *sub;
+    mu_assert("open expected",
+              OSc_FrameRingSubscriber_Open(&sub, name) == OSc_OK);
+
+    bool published;
+    OSc_FrameRingSubscriber_Wait(sub, 0, 1, &published);
+    bool ok = !published;
+    for (uint32_t f = 0; f < SLOTS + 2; ++f) {
+        for (uint32_t i = 0; i < W * H; ++i)
+            pixels[i] = (uint16_t)(f * 1000 + i);
+        OScInternal_FrameRing_Publish(ring, f % 2, W, H,
+                                      OSc_SampleFormat_UInt16, pixels);
+    }
+    OSc_FrameRingSubscriber_Wait(sub, SLOTS + 1, 1000, &published);
+    ok = ok && published &&
+         OSc_FrameRingSubscriber_GetNumberOfFramesPublished(sub) == SLOTS + 2;
+
+    // The oldest frames have been overwritten
+    uint32_t channel, width, height;
+    OSc_SampleFormat format;
+    const void *data;
+    size_t size;
+    OSc_RichError *err = OSc_FrameRingSubscriber_GetFrame(
+        sub, 1, &channel, &width, &height, &format, &data, &size);
+    ok = ok && err != OSc_OK && !OSc_FrameRingSubscriber_IsFrameValid(sub, 1);
+    OScInternal_Error_Destroy(err);
+    for (uint32_t f = 2; ok && f < SLOTS + 2; ++f) {
+        ok = OSc_FrameRingSubscriber_GetFrame(sub, f, &channel, &width,
+                                              &height, &format, &data,
+                                              &size) == OSc_OK &&
+             channel == f % 2 && width == W && height == H &&
+             format == OSc_SampleFormat_UInt16 && size == sizeof(pixels) &&
+             ((const uint16_t *)data)[W * H - 1] == f * 1000 + W * H - 1 &&
+             OSc_FrameRingSubscriber_IsFrameValid(sub, f);
+    }
+    err = OSc_FrameRingSubscriber_GetFrame(sub, SLOTS + 2, &channel, &width,
+                                           &height, &format, &data, &size);
+    ok = ok && err != OSc_OK;
+    OScInternal_Error_Destroy(err);
+
+    // Too large for the slots
+    err = OScInternal_FrameRing_Publish(ring, 0, W, H,
+                                        OSc_SampleFormat_Float32, pixels);
+    ok = ok && err != OSc_OK;
+    OScInternal_Error_Destroy(err);
+
+    OScInternal_FrameRing_Destroy(ring);
+    ok = ok && OSc_FrameRingSubscriber_IsClosed(sub);
+    OSc_FrameRingSubscriber_Close(sub);
+    mu_assert("frames expected", ok);
+    return NULL;
+}
+
+#ifndef _WIN32
+
+static bool ReceiveAll(int fd, void *buffer, size_t size) {
+    char *p = buffer;
+    while (size > 0) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+// Start a server and connect a client to it; returns the client socket
+static int ConnectStreamClient(OScInternal_StreamServer **server,
+                               const char *path,
+                               OSc_StorageCompression compression,
+                               uint32_t width, uint32_t height) {
+    struct OScInternal_RecordingInfo info;
+    memset(&info, 0, sizeof(info));
+    info.width = width;
+    info.height = height;
+    info.numberOfChannels = 2;
+    info.sampleFormat = OSc_SampleFormat_UInt16;
+    char address[64];
+    snprintf(address, sizeof(address), "unix:%s", path);
+    if (OScInternal_StreamServer_Create(server, address, &info, compression,
+                                        2) != OSc_OK)
+        return -1;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        OScInternal_StreamServer_Destroy(*server);
+        return -1;
+    }
+    double deadline = OScInternal_GetMonotonicTime() + 5.0;
+    while (OScInternal_StreamServer_GetNumberOfClients(*server) == 0 &&
+           OScInternal_GetMonotonicTime() < deadline)
+        usleep(1000);
+    return fd;
+}
+
+static char *test_StreamServer(void) {
+    const char *path = "OpenScanLibTests_stream.sock";
+    enum { W = 512, H = 512, FRAMES = 10 };
+    OScInternal_StreamServer *server;
+    int fd = ConnectStreamClient(&server, path, OSc_StorageCompression_None,
+                                 W, H);
+    mu_assert("client expected",
+              fd >= 0 &&
+                  OScInternal_StreamServer_GetNumberOfClients(server) == 1);
+
+    struct OScInternal_StreamHeader header;
+    bool ok = ReceiveAll(fd, &header, sizeof(header)) &&
+              memcmp(header.magic, OScInternal_STREAM_MAGIC, 8) == 0 &&
+              header.frameHeaderBytes ==
+                  sizeof(struct OScInternal_StreamFrameHeader) &&
+              header.width == W && header.numberOfChannels == 2 &&
+              header.sampleFormat == OSc_SampleFormat_UInt16;
+
+    // The client does not read until all frames are sent: the frames that
+    // do not fit in its queue (or the socket) are dropped, but the latest
+    // frame is always received
+    OSc_FrameBuffer *frames[FRAMES];
+    for (uint32_t f = 0; f < FRAMES; ++f) {
+        OSc_FrameBuffer_Create(&frames[f], f % 2, W, H,
+                               OSc_SampleFormat_UInt16);
+        uint16_t *pixels = OSc_FrameBuffer_GetPixels(frames[f]);
+        for (uint32_t i = 0; i < W * H; ++i)
+            pixels[i] = (uint16_t)(f * 7 + i);
+        OScInternal_StreamServer_Send(server, frames[f]);
+        OSc_FrameBuffer_Release(frames[f]); // Retained while queued
+    }
+    ok = ok && OScInternal_StreamServer_GetFramesDropped(server) > 0;
+    static uint16_t received[W * H];
+    struct OScInternal_StreamFrameHeader fh;
+    uint64_t last = 0;
+    bool first = true;
+    do {
+        ok = ok && ReceiveAll(fd, &fh, sizeof(fh)) &&
+             memcmp(fh.magic, OScInternal_STREAM_FRAME_MAGIC, 4) == 0 &&
+             (first || fh.sequence > last) &&
+             fh.payloadBytes == sizeof(received) &&
+             ReceiveAll(fd, received, sizeof(received)) &&
+             fh.channel == fh.sequence % 2 &&
+             received[W * H - 1] ==
+                 (uint16_t)(fh.sequence * 7 + W * H - 1);
+        last = fh.sequence;
+        first = false;
+    } while (ok && last < FRAMES - 1);
+    close(fd);
+    OScInternal_StreamServer_Destroy(server);
+    mu_assert("latest frames expected", ok);
+
+    // Lossless: encoded once, decoded by the client
+    enum { SW = 32, SH = 8 };
+    fd = ConnectStreamClient(&server, path, OSc_StorageCompression_Lossless,
+                             SW, SH);
+    mu_assert("second client expected", fd >= 0);
+    OSc_FrameBuffer *frame;
+    OSc_FrameBuffer_Create(&frame, 1, SW, SH, OSc_SampleFormat_UInt16);
+    uint16_t *pixels = OSc_FrameBuffer_GetPixels(frame);
+    for (uint32_t i = 0; i < SW * SH; ++i)
+        pixels[i] = (uint16_t)(i % 37);
+    OScInternal_StreamServer_Send(server, frame);
+    static char encoded[4096];
+    ok = ReceiveAll(fd, &header, sizeof(header)) &&
+         header.compression == OSc_StorageCompression_Lossless &&
+         ReceiveAll(fd, &fh, sizeof(fh)) && fh.sequence == 0 &&
+         fh.compression == OSc_StorageCompression_Lossless &&
+         fh.payloadBytes <= sizeof(encoded) &&
+         ReceiveAll(fd, encoded, (size_t)fh.payloadBytes) &&
+         OScInternal_Codec_Decode(encoded, (size_t)fh.payloadBytes, received,
+                                  sizeof(received)) == OSc_OK &&
+         memcmp(received, pixels, SW * SH * 2) == 0;
+    OSc_FrameBuffer_Release(frame);
+    close(fd);
+    OScInternal_StreamServer_Destroy(server);
+    mu_assert("encoded frame expected", ok);
+    mu_assert("socket removed expected", access(path, F_OK) != 0);
+
+    // A file that is not a socket is not replaced
+    FILE *fp = fopen(path, "w");
+    mu_assert("file expected", fp != NULL);
+    fclose(fp);
+    ok = ConnectStreamClient(&server, path, OSc_StorageCompression_None, W,
+                             H) < 0 &&
+         access(path, F_OK) == 0;
+    remove(path);
+    mu_assert("file kept expected", ok);
+    return NULL;
+}
+
+#endif
+
+// A device module served by the module host within the test process
+static struct OScDevInternal_Interface *g_hostTestDevif;
+static OScDev_ModuleImpl g_hostTestModuleImpl;
+
+enum { HOST_W = 64, HOST_H = 32, HOST_FRAMES = 20 };
+
+struct HostTestDevice {
+    int32_t gain;
+    OScDev_Acquisition *acq;
+    OScInternal_Mutex mutex;
+    OScInternal_Cond cond;
+    bool running;
+};
+
+static struct HostTestDevice *GetHostTestDevice(OScDev_Device *device) {
+    return g_hostTestDevif->Device_GetImplData(&g_hostTestModuleImpl, device);
+}
+
+static OScDev_Error HostTestGetModelName(const char **name) {
+    *name = "HostTestModel";
+    return OScDev_OK;
+}
+
+static OScDev_DeviceImpl g_hostTestDeviceImpl;
+
+static OScDev_Error HostTestEnumerateInstances(OScDev_PtrArray **devices) {
+    struct HostTestDevice *d = calloc(1, sizeof(struct HostTestDevice));
+    d->gain = 7;
+    OScInternal_Mutex_Init(&d->mutex);
+    OScInternal_Cond_Init(&d->cond);
+    OScDev_Device *device;
+    g_hostTestDevif->Device_Create(&g_hostTestModuleImpl, &device,
+                                   &g_hostTestDeviceImpl, d);
+    *devices = g_hostTestDevif->PtrArray_Create(&g_hostTestModuleImpl);
+    g_hostTestDevif->PtrArray_Append(&g_hostTestModuleImpl, *devices,
+                                     device);
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestReleaseInstance(OScDev_Device *device) {
+    struct HostTestDevice *d = GetHostTestDevice(device);
+    OScInternal_Cond_Destroy(&d->cond);
+    OScInternal_Mutex_Destroy(&d->mutex);
+    free(d);
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestGetName(OScDev_Device *device, char *name) {
+    (void)device;
+    strcpy(name, "HostTestDevice");
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestNoOp(OScDev_Device *device) {
+    (void)device;
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestTrue(OScDev_Device *device, bool *value) {
+    (void)device;
+    *value = true;
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestFalse(OScDev_Device *device, bool *value) {
+    (void)device;
+    *value = false;
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestGetGain(OScDev_Setting *setting, int32_t *value) {
+    struct HostTestDevice *d =
+        g_hostTestDevif->Setting_GetImplData(&g_hostTestModuleImpl, setting);
+    *value = d->gain;
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestSetGain(OScDev_Setting *setting, int32_t value) {
+    struct HostTestDevice *d =
+        g_hostTestDevif->Setting_GetImplData(&g_hostTestModuleImpl, setting);
+    if (value > 100)
+        return OScDev_Error_Unknown;
+    d->gain = value;
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestGetGainConstraint(OScDev_Setting *setting,
+                                              OScDev_ValueConstraint *type) {
+    (void)setting;
+    *type = OScDev_ValueConstraint_Range;
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestGetGainRange(OScDev_Setting *setting,
+                                         int32_t *min, int32_t *max) {
+    (void)setting;
+    *min = 0;
+    *max = 100;
+    return OScDev_OK;
+}
+
+static OScDev_SettingImpl g_hostTestGainImpl = {
+    .GetInt32 = HostTestGetGain,
+    .SetInt32 = HostTestSetGain,
+    .GetNumericConstraintType = HostTestGetGainConstraint,
+    .GetInt32Range = HostTestGetGainRange,
+};
+
+static OScDev_Error HostTestMakeSettings(OScDev_Device *device,
+                                         OScDev_PtrArray **settings) {
+    OScDev_Setting *gain;
+    g_hostTestDevif->Setting_Create(&g_hostTestModuleImpl, &gain, "Gain",
+                                    OScDev_ValueType_Int32,
+                                    &g_hostTestGainImpl,
+                                    GetHostTestDevice(device));
+    *settings = g_hostTestDevif->PtrArray_Create(&g_hostTestModuleImpl);
+    g_hostTestDevif->PtrArray_Append(&g_hostTestModuleImpl, *settings, gain);
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestGetPixelRates(OScDev_Device *device,
+                                          OScDev_NumRange **rates) {
+    (void)device;
+    *rates = g_hostTestDevif->NumRange_CreateDiscrete(&g_hostTestModuleImpl);
+    g_hostTestDevif->NumRange_AppendDiscrete(&g_hostTestModuleImpl, *rates,
+                                             1e6);
+    g_hostTestDevif->NumRange_AppendDiscrete(&g_hostTestModuleImpl, *rates,
+                                             2e6);
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestGetNumberOfChannels(OScDev_Device *device,
+                                                uint32_t *n) {
+    (void)device;
+    *n = 2;
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestGetBytesPerSample(OScDev_Device *device,
+                                              uint32_t *n) {
+    (void)device;
+    *n = 2;
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestArm(OScDev_Device *device,
+                                OScDev_Acquisition *acq) {
+    struct HostTestDevice *d = GetHostTestDevice(device);
+    uint32_t x, y, w, h;
+    g_hostTestDevif->Acquisition_GetROI(&g_hostTestModuleImpl, acq, &x, &y,
+                                        &w, &h);
+    if (w != HOST_W || h != HOST_H)
+        return OScDev_Error_Unknown;
+    d->acq = acq;
+    OScInternal_Mutex_Lock(&d->mutex);
+    d->running = true;
+    OScInternal_Mutex_Unlock(&d->mutex);
+    return OScDev_OK;
+}
+
+// Deliver all frames (more than fit in the pool at once) synchronously
+static OScDev_Error HostTestStart(OScDev_Device *device) {
+    struct HostTestDevice *d = GetHostTestDevice(device);
+    static uint16_t pixels[HOST_W * HOST_H];
+    uint32_t frames = g_hostTestDevif->Acquisition_GetNumberOfFrames(
+        &g_hostTestModuleImpl, d->acq);
+    g_hostTestDevif->Log(&g_hostTestModuleImpl, device,
+                         OScDev_LogLevel_Info, "started");
+    for (uint32_t f = 0; f < frames; ++f) {
+        for (uint32_t ch = 0; ch < 2; ++ch) {
+            for (uint32_t i = 0; i < HOST_W * HOST_H; ++i)
+                pixels[i] = (uint16_t)(f * 100 + ch * 10 + i);
+            g_hostTestDevif->Acquisition_CallFrameCallback(
+                &g_hostTestModuleImpl, d->acq, ch, pixels);
+        }
+    }
+    uint64_t timeTags[3] = {1, 2, 3};
+    g_hostTestDevif->Acquisition_CallTimeTagCallback(
+        &g_hostTestModuleImpl, d->acq, timeTags, 3);
+    OScInternal_Mutex_Lock(&d->mutex);
+    d->running = false;
+    OScInternal_Cond_Broadcast(&d->cond);
+    OScInternal_Mutex_Unlock(&d->mutex);
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestWait(OScDev_Device *device) {
+    struct HostTestDevice *d = GetHostTestDevice(device);
+    OScInternal_Mutex_Lock(&d->mutex);
+    while (d->running)
+        OScInternal_Cond_Wait(&d->cond, &d->mutex);
+    OScInternal_Mutex_Unlock(&d->mutex);
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestIsRunning(OScDev_Device *device,
+                                      bool *isRunning) {
+    struct HostTestDevice *d = GetHostTestDevice(device);
+    OScInternal_Mutex_Lock(&d->mutex);
+    *isRunning = d->running;
+    OScInternal_Mutex_Unlock(&d->mutex);
+    return OScDev_OK;
+}
+
+static OScDev_DeviceImpl g_hostTestDeviceImpl = {
+    .GetModelName = HostTestGetModelName,
+    .EnumerateInstances = HostTestEnumerateInstances,
+    .ReleaseInstance = HostTestReleaseInstance,
+    .GetName = HostTestGetName,
+    .Open = HostTestNoOp,
+    .Close = HostTestNoOp,
+    .HasClock = HostTestFalse,
+    .HasScanner = HostTestFalse,
+    .HasDetector = HostTestTrue,
+    .MakeSettings = HostTestMakeSettings,
+    .GetPixelRates = HostTestGetPixelRates,
+    .GetNumberOfChannels = HostTestGetNumberOfChannels,
+    .GetBytesPerSample = HostTestGetBytesPerSample,
+    .Arm = HostTestArm,
+    .Start = HostTestStart,
+    .Stop = HostTestNoOp,
+    .IsRunning = HostTestIsRunning,
+    .Wait = HostTestWait,
+};
+
+static OScDev_Error HostTestGetDeviceImpls(OScDev_PtrArray **impls) {
+    *impls = g_hostTestDevif->PtrArray_Create(&g_hostTestModuleImpl);
+    g_hostTestDevif->PtrArray_Append(&g_hostTestModuleImpl, *impls,
+                                     &g_hostTestDeviceImpl);
+    return OScDev_OK;
+}
+
+static OScDev_ModuleImpl g_hostTestModuleImpl = {
+    .displayName = "Host test module",
+    .GetDeviceImpls = HostTestGetDeviceImpls,
+};
+
+static uint32_t HostTestEntryPoint(struct OScDevInternal_Interface ***devif,
+                                   OScDev_ModuleImpl **impl) {
+    *devif = &g_hostTestDevif;
+    *impl = &g_hostTestModuleImpl;
+    return OScDevInternal_ABI_VERSION;
+}
+
+// The application's acquisition, as seen by the proxy device
+static struct {
+    uint32_t frames;
+    bool pixelsOK;
+    size_t timeTags;
+    uint32_t logs;
+} g_hostTestAcq;
+
+static OScDev_Error HostTestAcqTrue(OScDev_ModuleImpl *modImpl,
+                                    OScDev_Acquisition *acq, bool *value) {
+    (void)modImpl;
+    (void)acq;
+    *value = true;
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestAcqFalse(OScDev_ModuleImpl *modImpl,
+                                     OScDev_Acquisition *acq, bool *value) {
+    (void)modImpl;
+    (void)acq;
+    *value = false;
+    return OScDev_OK;
+}
+
+static OScDev_Error
+HostTestAcqGetStartTrigger(OScDev_ModuleImpl *modImpl,
+                           OScDev_Acquisition *acq,
+                           OScDev_TriggerSource *startTrigger) {
+    (void)modImpl;
+    (void)acq;
+    *startTrigger = OScDev_TriggerSource_Software;
+    return OScDev_OK;
+}
+
+static OScDev_Error HostTestAcqGetClockSource(OScDev_ModuleImpl *modImpl,
+                                              OScDev_Acquisition *acq,
+                                              OScDev_ClockSource *clock) {
+    (void)modImpl;
+    (void)acq;
+    *clock = OScDev_ClockSource_Internal;
+    return OScDev_OK;
+}
+
+static double HostTestAcqGetPixelRate(OScDev_ModuleImpl *modImpl,
+                                      OScDev_Acquisition *acq) {
+    (void)modImpl;
+    (void)acq;
+    return 2e6;
+}
+
+static uint32_t HostTestAcqGetResolution(OScDev_ModuleImpl *modImpl,
+                                         OScDev_Acquisition *acq) {
+    (void)modImpl;
+    (void)acq;
+    return HOST_W;
+}
+
+static double HostTestAcqGetZoomFactor(OScDev_ModuleImpl *modImpl,
+                                       OScDev_Acquisition *acq) {
+    (void)modImpl;
+    (void)acq;
+    return 1.0;
+}
+
+static uint32_t HostTestAcqGetNumberOfFrames(OScDev_ModuleImpl *modImpl,
+                                             OScDev_Acquisition *acq) {
+    (void)modImpl;
+    (void)acq;
+    return HOST_FRAMES;
+}
+
+static uint32_t HostTestAcqGetSamplesPerPixel(OScDev_ModuleImpl *modImpl,
+                                              OScDev_Acquisition *acq) {
+    (void)modImpl;
+    (void)acq;
+    return 1;
+}
+
+static void HostTestAcqGetROI(OScDev_ModuleImpl *modImpl,
+                              OScDev_Acquisition *acq, uint32_t *xOffset,
+                              uint32_t *yOffset, uint32_t *width,
+                              uint32_t *height) {
+    (void)modImpl;
+    (void)acq;
+    *xOffset = *yOffset = 0;
+    *width = HOST_W;
+    *height = HOST_H;
+}
+
+static bool HostTestAcqCallFrameCallback(OScDev_ModuleImpl *modImpl,
+                                         OScDev_Acquisition *acq,
+                                         uint32_t channel, void *pixels) {
+    (void)modImpl;
+    (void)acq;
+    // Frames of a channel arrive in order
+    uint32_t f = g_hostTestAcq.frames++ / 2;
+    const uint16_t *p = pixels;
+    if (p[HOST_W * HOST_H - 1] !=
+        (uint16_t)(f * 100 + channel * 10 + HOST_W * HOST_H - 1))
+        g_hostTestAcq.pixelsOK = false;
+    return true;
+}
+
+static bool HostTestAcqCallTimeTagCallback(OScDev_ModuleImpl *modImpl,
+                                           OScDev_Acquisition *acq,
+                                           const uint64_t *timeTags,
+                                           size_t count) {
+    (void)modImpl;
+    (void)acq;
+    if (timeTags[count - 1] == 3)
+        g_hostTestAcq.timeTags += count;
+    return true;
+}
+
+static void HostTestLog(OScDev_ModuleImpl *modImpl, OScDev_Device *device,
+                        OScDev_LogLevel level, const char *message) {
+    (void)modImpl;
+    if (device && level == OScDev_LogLevel_Info &&
+        strcmp(message, "started") == 0)
+        ++g_hostTestAcq.logs;
+}
+
+struct HostTestServer {
+    struct OScInternal_ModuleHostEndpoints ends;
+    int status;
+};
+
+static void HostTestServe(void *data) {
+    struct HostTestServer *server = data;
+    server->status = OScInternal_ModuleHost_Serve(
+        &server->ends, HostTestEntryPoint, NULL);
+}
+
+static char *test_ModuleHost(void) {
+    struct OScInternal_ModuleHostEndpoints ends;
+    struct HostTestServer server;
+    server.status = -1;
+    mu_assert("endpoints expected",
+              OScInternal_ModuleHost_CreateEndpoints(
+                  &ends, &server.ends, 1024 * 1024) == OSc_OK);
+    OScInternal_Thread serverThread;
+    mu_assert("server expected", OScInternal_Thread_Create(
+                                     &serverThread, HostTestServe, &server));
+
+    // The proxies call the application's acquisition through 'devif'; every
+    // acquisition entry read by the proxy's Arm() is replaced, as 'acq' is
+    // not a real OSc_Acquisition
+    static struct OScDevInternal_Interface devif;
+    devif = DeviceInterfaceFunctionTable;
+    devif.Log = HostTestLog;
+    devif.Acquisition_IsClockRequested = HostTestAcqTrue;
+    devif.Acquisition_IsScannerRequested = HostTestAcqFalse;
+    devif.Acquisition_IsDetectorRequested = HostTestAcqTrue;
+    devif.Acquisition_GetClockStartTriggerSource = HostTestAcqGetStartTrigger;
+    devif.Acquisition_GetClockSource = HostTestAcqGetClockSource;
+    devif.Acquisition_GetPixelRate = HostTestAcqGetPixelRate;
+    devif.Acquisition_GetResolution = HostTestAcqGetResolution;
+    devif.Acquisition_GetZoomFactor = HostTestAcqGetZoomFactor;
+    devif.Acquisition_GetNumberOfFrames = HostTestAcqGetNumberOfFrames;
+    devif.Acquisition_GetSamplesPerPixel = HostTestAcqGetSamplesPerPixel;
+    devif.Acquisition_GetROI = HostTestAcqGetROI;
+    devif.Acquisition_CallFrameCallback = HostTestAcqCallFrameCallback;
+    devif.Acquisition_CallTimeTagCallback = HostTestAcqCallTimeTagCallback;
+
+    OScInternal_ModuleHost *host;
+    mu_assert("connection expected", OScInternal_ModuleHost_Connect(
+                                         &host, &ends, &devif) == OSc_OK);
+    OScInternal_PtrArray *impls;
+    OScInternal_ModuleHost_GetDeviceImpls(host, &impls);
+    mu_assert("one implementation expected",
+              OScInternal_PtrArray_Size(impls) == 1);
+    OScDev_DeviceImpl *impl = OScInternal_PtrArray_At(impls, 0);
+    OScInternal_PtrArray_Destroy(impls);
+    const char *model;
+    impl->GetModelName(&model);
+    OScInternal_PtrArray *devices;
+    mu_assert("instances expected",
+              strcmp(model, "HostTestModel") == 0 &&
+                  impl->EnumerateInstances(&devices) == OScDev_OK &&
+                  OScInternal_PtrArray_Size(devices) == 1);
+    OSc_Device *device = OScInternal_PtrArray_At(devices, 0);
+    OScInternal_PtrArray_Destroy(devices);
+
+    // Control calls are forwarded to the module
+    const char *deviceName;
+    bool hasDetector = false, hasClock = true;
+    bool ok = impl->Open(device) == OScDev_OK &&
+              OSc_Device_GetName(device, &deviceName) == OSc_OK &&
+              strcmp(deviceName, "HostTestDevice") == 0 &&
+              OSc_Device_HasDetector(device, &hasDetector) == OSc_OK &&
+              hasDetector &&
+              OSc_Device_HasClock(device, &hasClock) == OSc_OK && !hasClock;
+    OSc_Setting **settings;
+    size_t count = 0;
+    char name[OSc_MAX_STR_SIZE];
+    int32_t gain = 0, min = -1, max = -1;
+    OSc_ValueConstraint constraint;
+    ok = ok && OSc_Device_GetSettings(device, &settings, &count) == OSc_OK &&
+         count == 1 && OSc_Setting_GetName(settings[0], name) == OSc_OK &&
+         strcmp(name, "Gain") == 0 &&
+         OSc_Setting_GetInt32Value(settings[0], &gain) == OSc_OK &&
+         gain == 7 &&
+         OSc_Setting_SetInt32Value(settings[0], 42) == OSc_OK &&
+         OSc_Setting_GetInt32Value(settings[0], &gain) == OSc_OK &&
+         gain == 42 &&
+         OSc_Setting_GetNumericConstraintType(settings[0], &constraint) ==
+             OSc_OK &&
+         constraint == OSc_ValueConstraint_Continuous &&
+         OSc_Setting_GetInt32ContinuousRange(settings[0], &min, &max) ==
+             OSc_OK &&
+         min == 0 && max == 100;
+    mu_assert("control calls expected", ok);
+
+    // Errors in the host are returned
+    OSc_RichError *err = OSc_Setting_SetInt32Value(settings[0], 101);
+    mu_assert("error expected", err != OSc_OK);
+    OScInternal_Error_Destroy(err);
+
+    OScInternal_NumRange *rates = OScInternal_Device_GetPixelRates(device);
+    uint32_t channels = 0;
+    OSc_SampleFormat format;
+    ok = OScInternal_NumRange_IsDiscrete(rates) &&
+         OScInternal_NumRange_ClosestValue(rates, 3e6) == 2e6 &&
+         OScInternal_Device_GetNumberOfChannels(device, &channels) ==
+             OSc_OK &&
+         channels == 2 &&
+         OScInternal_Device_GetSampleFormat(device, 1, &format) == OSc_OK &&
+         format == OSc_SampleFormat_UInt16;
+    OScInternal_NumRange_Destroy(rates);
+    mu_assert("ranges and formats expected", ok);
+
+    // Frames arrive through the pool; Wait() returns after the last one
+    memset(&g_hostTestAcq, 0, sizeof(g_hostTestAcq));
+    g_hostTestAcq.pixelsOK = true;
+    OScDev_Acquisition *acq = (OScDev_Acquisition *)&g_hostTestAcq;
+    bool running = true;
+    ok = impl->Arm(device, acq) == OScDev_OK &&
+         impl->Start(device) == OScDev_OK && impl->Wait(device) == OScDev_OK &&
+         impl->IsRunning(device, &running) == OScDev_OK && !running;
+    mu_assert("acquisition expected", ok);
+    mu_assert("frames expected", g_hostTestAcq.frames == 2 * HOST_FRAMES &&
+                                     g_hostTestAcq.pixelsOK);
+    mu_assert("time tags and log expected",
+              g_hostTestAcq.timeTags == 3 && g_hostTestAcq.logs == 1);
+
+    impl->Close(device);
+    OScInternal_Device_Destroy(device);
+    OScInternal_ModuleHost_Destroy(host);
+    OScInternal_Thread_Join(serverThread);
+    mu_assert("server exit expected", server.status == 0);
+    return NULL;
+}
+
+static char *test_DeviceManifest(void) {
+    const char *path = "OpenScanLibTests_manifest.tmp";
+    struct OScInternal_ManifestDevice devs[2] = {
+        {"ModelA", "dev0", true, true, false},
+        {"ModelB", "dev 1", false, false, true},
+    };
+    OScInternal_Manifest *manifest = OScInternal_Manifest_Create();
+    OScInternal_Manifest_SetModule(manifest, "ModA", "/mods/ModA.osdev", 100,
+                                   12345, devs, 2);
+    OScInternal_Manifest_SetModule(manifest, "Empty", "/mods/Empty.osdev", 7,
+                                   -1, NULL, 0);
+    struct OScInternal_ManifestDevice tabbed = {"Bad\tModel", "x", false,
+                                                 false, false};
+    OScInternal_Manifest_SetModule(manifest, "Tabbed", "/mods/Tabbed.osdev",
+                                   1, 1, &tabbed, 1);
+    OSc_RichError *err = OScInternal_Manifest_Write(manifest, path);
+    OScInternal_Manifest_Destroy(manifest);
+    mu_assert("write expected", err == OSc_OK);
+
+    manifest = OScInternal_Manifest_Read(path);
+    const struct OScInternal_ManifestDevice *read;
+    size_t count;
+    bool ok = OScInternal_Manifest_Lookup(manifest, "ModA", "/mods/ModA.osdev",
+                                          100, 12345, &read, &count) &&
+              count == 2 && strcmp(read[1].name, "dev 1") == 0 &&
+              strcmp(read[0].modelName, "ModelA") == 0 && read[0].hasClock &&
+              read[0].hasScanner && !read[0].hasDetector &&
+              read[1].hasDetector;
+    ok = ok && OScInternal_Manifest_Lookup(manifest, "Empty",
+                                           "/mods/Empty.osdev", 7, -1, &read,
+                                           &count) &&
+         count == 0;
+    bool stale = OScInternal_Manifest_Lookup(manifest, "ModA",
+                                             "/mods/ModA.osdev", 100, 12346,
+                                             &read, &count) ||
+                 OScInternal_Manifest_Lookup(manifest, "Tabbed",
+                                             "/mods/Tabbed.osdev", 1, 1,
+                                             &read, &count);
+    bool removed =
+        OScInternal_Manifest_RemoveModule(manifest, "Empty") &&
+        !OScInternal_Manifest_RemoveModule(manifest, "Empty") &&
+        !OScInternal_Manifest_Lookup(manifest, "Empty", "/mods/Empty.osdev", 7,
+                                     -1, &read, &count) &&
+        OScInternal_Manifest_Lookup(manifest, "ModA", "/mods/ModA.osdev", 100,
+                                    12345, &read, &count);
+    OScInternal_Manifest_Destroy(manifest);
+    mu_assert("entries expected", ok);
+    mu_assert("stale entries unexpected", !stale);
+    mu_assert("removal expected", removed);
+
+    // A damaged manifest is ignored
+    FILE *fp = fopen(path, "a");
+    mu_assert("append expected", fp != NULL);
+    fputs("garbage\n", fp);
+    fclose(fp);
+    manifest = OScInternal_Manifest_Read(path);
+    remove(path);
+    ok = !OScInternal_Manifest_Lookup(manifest, "ModA", "/mods/ModA.osdev",
+                                      100, 12345, &read, &count);
+    OScInternal_Manifest_Destroy(manifest);
+    mu_assert("damaged manifest ignored", ok);
+    return NULL;
+}
+
+static char *test_StorageThroughput(void) {
+    double rate, cached;
+    mu_assert("measurement expected",
+              OScInternal_StorageThroughput_MeasureWrite(".", &rate) ==
+                  OSc_OK);
+    mu_assert("cached measurement expected",
+              OScInternal_StorageThroughput_MeasureWrite(".", &cached) ==
+                      OSc_OK &&
+                  cached == rate && rate > 0.0);
+    double encode = OScInternal_StorageThroughput_MeasureEncode(2);
+    mu_assert("encoding rate expected", encode > 0.0 && encode < HUGE_VAL);
+
+    double required, available;
+    mu_assert("check expected",
+              OScInternal_StorageThroughput_Check(NULL, NULL, &required,
+                                                  &available) == OSc_OK);
+    mu_assert("no storage expected", required == 0.0 && available > 1e300);
+    return NULL;
+}
+
+static char *test_OMETiffWriter(void) {
+    const char *path = "OpenScanLibTests_ome.tmp";
+    OScInternal_OMETiffWriter *writer;
+    struct OScInternal_RecordingInfo info = {.numberOfChannels = 2,
+                                             .numberOfFrames = UINT32_MAX};
+    mu_assert("create expected", OScInternal_OMETiffWriter_Create(
+                                     &writer, path, &info) == OSc_OK);
+
+    // Frames larger than the write buffers, for 2 channels
+    enum { W = 80, H = 40, PAGES = 6 };
+    static uint16_t frame[W * H];
+    for (int p = 0; p < PAGES; ++p) {
+        for (int i = 0; i < W * H; ++i)
+            frame[i] = (uint16_t)(p * 1000 + i);
+        mu_assert("write expected",
+                  OScInternal_OMETiffWriter_WriteFrame(
+                      writer, p % 2, W, H, OSc_SampleFormat_UInt16, frame) ==
+                      OSc_OK);
+    }
+    mu_assert("close expected",
+              OScInternal_OMETiffWriter_Close(writer) == OSc_OK);
+
+    // Follow the chain of IFDs
+    FILE *fp = fopen(path, "rb");
+    mu_assert("file expected", fp != NULL);
+    char header[8];
+    uint64_t ifd;
+    bool ok = fread(header, sizeof(header), 1, fp) == 1 &&
+              fread(&ifd, sizeof(ifd), 1, fp) == 1 &&
+              header[2] == 43 && header[4] == 8;
+    int pages = 0;
+    uint64_t descriptionCount = 0, descriptionOffset = 0;
+    while (ok && ifd != 0) {
+        uint64_t n;
+        ok = fseek(fp, (long)ifd, SEEK_SET) == 0 &&
+             fread(&n, sizeof(n), 1, fp) == 1 && n <= 12;
+        uint64_t stripOffset = 0, stripBytes = 0;
+        for (uint64_t e = 0; ok && e < n; ++e) {
+            uint16_t tag, type;
+            uint64_t count, value;
+            ok = fread(&tag, 2, 1, fp) == 1 && fread(&type, 2, 1, fp) == 1 &&
+                 fread(&count, 8, 1, fp) == 1 && fread(&value, 8, 1, fp) == 1;
+            if (tag == 273)
+                stripOffset = value;
+            else if (tag == 279)
+                stripBytes = value;
+            else if (tag == 270) {
+                descriptionCount = count;
+                descriptionOffset = value;
+            }
+        }
+        ok = ok && fread(&ifd, sizeof(ifd), 1, fp) == 1 &&
+             stripBytes == sizeof(frame) &&
+             fseek(fp, (long)stripOffset, SEEK_SET) == 0 &&
+             fread(frame, sizeof(frame), 1, fp) == 1 &&
+             frame[0] == pages * 1000 && frame[W * H - 1] == pages * 1000 +
+                                                               W * H - 1;
+        ++pages;
+    }
+    mu_assert("pages expected", ok && pages == PAGES);
+
+    static char xml[4096];
+    ok = descriptionCount > 0 && descriptionCount <= sizeof(xml) &&
+         fseek(fp, (long)descriptionOffset, SEEK_SET) == 0 &&
+         fread(xml, descriptionCount, 1, fp) == 1 &&
+         xml[descriptionCount - 1] == '\0';
+    fclose(fp);
+    remove(path);
+    mu_assert("OME-XML expected",
+              ok && strstr(xml, "SizeC=\"2\" SizeZ=\"1\" SizeT=\"3\"") &&
+                  strstr(xml, "<TiffData IFD=\"0\" PlaneCount=\"6\"/>"));
+    return NULL;
+}
+
+static uint16_t ZarrTestPixel(uint32_t t, uint32_t y, uint32_t x) {
+    return (uint16_t)(t * 7 + y * 3 + x);
+}
+
+static char *test_ZarrWriter(void) {
+    const char *path = "OpenScanLibTests_zarr.tmp";
+    OScInternal_ZarrWriter *writer;
+    struct OScInternal_RecordingInfo info = {.numberOfChannels = 1,
+                                             .numberOfFrames = UINT32_MAX};
+    mu_assert("create expected",
+              OScInternal_ZarrWriter_Create(&writer, path, &info) == OSc_OK);
+
+    // 512 x 512 frames give 256 x 256 x 8 chunks, and shards of 32 frames:
+    // two full shards and one partial
+    enum { N = 512, FRAMES = 70 };
+    static uint16_t frame[N * N];
+    for (uint32_t t = 0; t < FRAMES; ++t) {
+        for (uint32_t y = 0; y < N; ++y)
+            for (uint32_t x = 0; x < N; ++x)
+                frame[y * N + x] = ZarrTestPixel(t, y, x);
+        mu_assert("write expected",
+                  OScInternal_ZarrWriter_WriteFrame(
+                      writer, 0, N, N, OSc_SampleFormat_UInt16, frame) ==
+                      OSc_OK);
+    }
+    mu_assert("frame of unknown channel rejected",
+              OScInternal_ZarrWriter_WriteFrame(
+                  writer, 1, N, N, OSc_SampleFormat_UInt16, frame) != OSc_OK);
+    mu_assert("close expected",
+              OScInternal_ZarrWriter_Close(writer) == OSc_OK);
+
+    static char json[4096];
+    FILE *fp = fopen("OpenScanLibTests_zarr.tmp/zarr.json", "rb");
+    mu_assert("metadata expected", fp != NULL);
+    size_t n = fread(json, 1, sizeof(json) - 1, fp);
+    json[n] = '\0';
+    fclose(fp);
+    mu_assert("shape expected", strstr(json, "\"shape\": [70, 1, 512, 512]"));
+
+    // The last shard holds frames 64-69 in its first 4 chunks (tiles of one
+    // chunk of frames); the index marks the others empty
+    fp = fopen("OpenScanLibTests_zarr.tmp/c/2/0/0/0", "rb");
+    mu_assert("shard expected", fp != NULL);
+    uint64_t index[16][2];
+    uint16_t samples[2];
+    bool ok = fseek(fp, -(long)sizeof(index), SEEK_END) == 0 &&
+              fread(index, sizeof(index), 1, fp) == 1 &&
+              index[3][1] == 256 * 256 * 8 * 2 && index[4][0] == UINT64_MAX;
+    // Tile (y 0, x 1): the first sample of frames 64 and 65
+    ok = ok && fseek(fp, (long)index[1][0], SEEK_SET) == 0 &&
+         fread(&samples[0], 2, 1, fp) == 1 &&
+         fseek(fp, (long)index[1][0] + 256 * 256 * 2, SEEK_SET) == 0 &&
+         fread(&samples[1], 2, 1, fp) == 1 &&
+         samples[0] == ZarrTestPixel(64, 0, 256) &&
+         samples[1] == ZarrTestPixel(65, 0, 256);
+    fclose(fp);
+    mu_assert("chunks expected", ok);
+
+    char file[64];
+    for (int shard = 0; shard < 3; ++shard) {
+        snprintf(file, sizeof(file), "%s/c/%d/0/0/0", path, shard);
+        for (int i = 0; i < 4; ++i) {
+            remove(file);
+            *strrchr(file, '/') = '\0';
+        }
+    }
+    snprintf(file, sizeof(file), "%s/zarr.json", path);
+    remove(file);
+    snprintf(file, sizeof(file), "%s/c", path);
+    remove(file);
+    remove(path);
+    return NULL;
+}
+
 static char *all_tests(void) {
     mu_run_test(test_NumRange_Intersection);
+    mu_run_test(test_Remap);
+    mu_run_test(test_PhotonCount);
+    mu_run_test(test_Phasor);
+    mu_run_test(test_LifetimeHistogram);
+    mu_run_test(test_Interleave);
+    mu_run_test(test_SampleFormat);
+    mu_run_test(test_DeviceImplVersion);
+    mu_run_test(test_Pyramid);
+    mu_run_test(test_Dispatch);
+    mu_run_test(test_Codec);
+    mu_run_test(test_Pipeline);
+    mu_run_test(test_DLPack);
+    mu_run_test(test_RawWriter);
+    mu_run_test(test_Journal);
+    mu_run_test(test_RecordingReader);
+    mu_run_test(test_ReplayDevice);
+    mu_run_test(test_FrameRing);
+#ifndef _WIN32
+    mu_run_test(test_StreamServer);
+#endif
+    mu_run_test(test_ModuleHost);
+    mu_run_test(test_DeviceManifest);
+    mu_run_test(test_StorageThroughput);
+    mu_run_test(test_OMETiffWriter);
+    mu_run_test(test_ZarrWriter);
 
     return NULL;
 }
 
 int tests_run;
 
-int main() {
+int main(int argc, char *argv[]) {
+    if (argc > 1)
+        g_replayModuleDir = argv[1];
+
     char *result = all_tests();
 
     if (result != NULL)
@@ -0,0 +1,920 @@
+/*
+ * Replay device: a clock, scanner, and detector that replays a raw recording
+ * (written by OpenScanLib's raw writer stage), so that the whole pipeline
+ * can be exercised with real data and realistic load without hardware.
+ *
+ * The recording is mapped into memory when it is selected, and frames are
+ * passed to OScDev_Acquisition_CallFrameCallback() directly from the
+ * mapping, with the operating system reading ahead of the replay. Frames are
+ * delivered at the rate at which they were scanned (the recorded pixel rate
+ * and raster size), or as fast as the application accepts them.
+ *
+ * The mapping is copy-on-write, because the frame callback receives
+ * writable pointers: an application modifying a frame gets a private copy of
+ * the page instead of a fault, and the file is never changed.
+ *
+ * The format definitions below must match OpenScanLib's RawWriter.h.
+ * Compressed recordings are not supported.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // madvise()
+#endif
+
+#include "OpenScanDeviceLib.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define DEVICE_NAME "Replay Device"
+
+// Frames ahead of the replay to request from the file
+#define PREFETCH_FRAMES 4
+
+/*
+ * Raw recording format
+ */
+
+#define RAW_MAGIC "OScRaw\r\n"
+#define RAW_VERSION 2
+
+struct RawHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerBytes;
+    uint64_t indexOffset; // 0 if the file was not closed
+    uint64_t numberOfRecords;
+    double pixelRateHz;
+    double zoomFactor;
+    uint32_t resolution;
+    uint32_t xOffset;
+    uint32_t yOffset;
+    uint32_t width;
+    uint32_t height;
+    uint32_t numberOfChannels;
+    int32_t sampleFormat;
+    uint32_t numberOfFrames;
+    int32_t compression; // Since version 2
+    uint32_t reserved;
+};
+
+struct RawIndexEntry {
+    uint64_t offset;
+    uint32_t frame;
+    uint32_t channel;
+    uint32_t width;
+    uint32_t height;
+    int32_t sampleFormat;
+    uint32_t storedBytes; // Since version 2
+};
+
+/*
+ * Platform-dependent threads, timing and mapping
+ */
+
+#ifdef _WIN32
+
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Cond;
+typedef HANDLE Thread;
+
+static void Mutex_Init(Mutex *m) { InitializeCriticalSection(m); }
+static void Mutex_Destroy(Mutex *m) { DeleteCriticalSection(m); }
+static void Mutex_Lock(Mutex *m) { EnterCriticalSection(m); }
+static void Mutex_Unlock(Mutex *m) { LeaveCriticalSection(m); }
+static void Cond_Init(Cond *c) { InitializeConditionVariable(c); }
+static void Cond_Destroy(Cond *c) { (void)c; }
+static void Cond_Broadcast(Cond *c) { WakeAllConditionVariable(c); }
+static void Cond_Wait(Cond *c, Mutex *m) {
+    SleepConditionVariableCS(c, m, INFINITE);
+}
+
+// Seconds on a monotonic clock
+static double Now(void) {
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double)count.QuadPart / (double)frequency.QuadPart;
+}
+
+// Wait until 'deadline' (see Now()) or until signaled
+static void Cond_WaitUntil(Cond *c, Mutex *m, double deadline) {
+    double remaining = deadline - Now();
+    if (remaining > 0.0)
+        SleepConditionVariableCS(c, m, (DWORD)(remaining * 1000.0) + 1);
+}
+
+static DWORD WINAPI ThreadMain(void *param);
+
+static bool Thread_Start(Thread *thread, void *param) {
+    *thread = CreateThread(NULL, 0, ThreadMain, param, 0, NULL);
+    return *thread != NULL;
+}
+
+static void Thread_Join(Thread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+#else
+
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Cond;
+typedef pthread_t Thread;
+
+static void Mutex_Init(Mutex *m) { pthread_mutex_init(m, NULL); }
+static void Mutex_Destroy(Mutex *m) { pthread_mutex_destroy(m); }
+static void Mutex_Lock(Mutex *m) { pthread_mutex_lock(m); }
+static void Mutex_Unlock(Mutex *m) { pthread_mutex_unlock(m); }
+
+static void Cond_Init(Cond *c) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(c, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static void Cond_Destroy(Cond *c) { pthread_cond_destroy(c); }
+static void Cond_Broadcast(Cond *c) { pthread_cond_broadcast(c); }
+static void Cond_Wait(Cond *c, Mutex *m) { pthread_cond_wait(c, m); }
+
+// Seconds on a monotonic clock
+static double Now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+// Wait until 'deadline' (see Now()) or until signaled
+static void Cond_WaitUntil(Cond *c, Mutex *m, double deadline) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)deadline;
+    ts.tv_nsec = (long)((deadline - (double)ts.tv_sec) * 1e9);
+    if (ts.tv_nsec >= 1000000000L)
+        ts.tv_nsec = 999999999L;
+    pthread_cond_timedwait(c, m, &ts);
+}
+
+static void *ThreadMain(void *param);
+
+static bool Thread_Start(Thread *thread, void *param) {
+    return pthread_create(thread, NULL, ThreadMain, param) == 0;
+}
+
+static void Thread_Join(Thread thread) { pthread_join(thread, NULL); }
+
+#endif
+
+struct Recording {
+    const char *data; // The mapped file
+    uint64_t size;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+    double pixelRateHz;
+    uint32_t width;
+    uint32_t height;
+    uint32_t numberOfChannels;
+    OScDev_SampleFormat format;
+    uint32_t numberOfFrames; // Frames with all channels recorded
+    uint64_t *offsets;       // [frame][channel]; 0 if not recorded
+};
+
+static OScDev_Error Fail(const char *message) {
+    return OScDev_Error_ReturnAsCode(OScDev_Error_Create(message));
+}
+
+#ifdef _WIN32
+
+static OScDev_Error MapFile(struct Recording *rec, const char *path) {
+    char msg[OScDev_MAX_STR_SIZE + 64];
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER size;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size)) {
+        snprintf(msg, sizeof(msg), "Cannot open %s (Windows error %d)", path,
+                 (int)GetLastError());
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        return Fail(msg);
+    }
+    rec->size = (uint64_t)size.QuadPart;
+    if (rec->size < sizeof(struct RawHeader) || rec->size > SIZE_MAX) {
+        CloseHandle(file);
+        return Fail("Not a raw recording (wrong size)");
+    }
+    rec->mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    CloseHandle(file); // The mapping keeps the file open
+    rec->data = rec->mapping
+                    ? MapViewOfFile(rec->mapping, FILE_MAP_COPY, 0, 0, 0)
+                    : NULL;
+    if (!rec->data) {
+        snprintf(msg, sizeof(msg), "Cannot map %s (Windows error %d)", path,
+                 (int)GetLastError());
+        if (rec->mapping)
+            CloseHandle(rec->mapping);
+        return Fail(msg);
+    }
+    return OScDev_OK;
+}
+
+static void UnmapFile(struct Recording *rec) {
+    UnmapViewOfFile(rec->data);
+    CloseHandle(rec->mapping);
+}
+
+// Windows has no per-mapping access hint; its read-ahead adapts on its own
+static void AdviseSequential(struct Recording *rec) { (void)rec; }
+
+static void AdviseWillNeed(struct Recording *rec, uint64_t offset,
+                           uint64_t size) {
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = (PVOID)(rec->data + offset);
+    range.NumberOfBytes = (SIZE_T)size;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+#else
+
+static OScDev_Error MapFile(struct Recording *rec, const char *path) {
+    char msg[OScDev_MAX_STR_SIZE + 64];
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        snprintf(msg, sizeof(msg), "Cannot open %s: %s", path,
+                 strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return Fail(msg);
+    }
+    rec->size = (uint64_t)st.st_size;
+    if (rec->size < sizeof(struct RawHeader) || rec->size > SIZE_MAX) {
+        close(fd);
+        return Fail("Not a raw recording (wrong size)");
+    }
+    void *data = mmap(NULL, (size_t)rec->size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE, fd, 0);
+    int code = errno;
+    close(fd); // The mapping keeps the file open
+    if (data == MAP_FAILED) {
+        snprintf(msg, sizeof(msg), "Cannot map %s: %s", path, strerror(code));
+        return Fail(msg);
+    }
+    rec->data = data;
+    return OScDev_OK;
+}
+
+static void UnmapFile(struct Recording *rec) {
+    munmap((void *)rec->data, (size_t)rec->size);
+}
+
+static void AdviseSequential(struct Recording *rec) {
+    madvise((void *)rec->data, (size_t)rec->size, MADV_SEQUENTIAL);
+}
+
+static void AdviseWillNeed(struct Recording *rec, uint64_t offset,
+                           uint64_t size) {
+    long pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t start = pageSize > 0 ? offset / pageSize * pageSize : offset;
+    madvise((void *)(rec->data + start), (size_t)(offset + size - start),
+            MADV_WILLNEED);
+}
+
+#endif
+
+/*
+ * Recordings
+ */
+
+static size_t GetFrameBytes(OScDev_SampleFormat format, size_t samples) {
+    switch (format) {
+    case OScDev_SampleFormat_UInt8:
+    case OScDev_SampleFormat_Int8:
+        return samples;
+    case OScDev_SampleFormat_UInt12:
+    case OScDev_SampleFormat_UInt16:
+    case OScDev_SampleFormat_Int16:
+        return 2 * samples;
+    case OScDev_SampleFormat_UInt12Packed:
+        return (3 * samples + 1) / 2;
+    case OScDev_SampleFormat_UInt32:
+    case OScDev_SampleFormat_Int32:
+    case OScDev_SampleFormat_Float32:
+        return 4 * samples;
+    default:
+        return 0;
+    }
+}
+
+static OScDev_Error ParseIndex(struct Recording *rec) {
+    const struct RawHeader *h = (const struct RawHeader *)rec->data;
+    if (memcmp(h->magic, RAW_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version < 1 || h->version > RAW_VERSION)
+        return Fail("Not a raw recording of a supported version");
+    if (h->indexOffset == 0)
+        return Fail("Recording was not closed and has no index");
+    if (h->version >= 2 && h->compression != 0)
+        return Fail("Compressed recordings cannot be replayed");
+    if (h->indexOffset > rec->size ||
+        h->numberOfRecords > (rec->size - h->indexOffset) /
+                                 sizeof(struct RawIndexEntry) ||
+        h->numberOfRecords == 0)
+        return Fail("Recording has no frames or a damaged index");
+    const struct RawIndexEntry *index =
+        (const struct RawIndexEntry *)(rec->data + h->indexOffset);
+
+    // All records must share the size and format of the first
+    rec->pixelRateHz = h->pixelRateHz;
+    rec->width = index[0].width;
+    rec->height = index[0].height;
+    rec->format = index[0].sampleFormat;
+    size_t frameBytes =
+        GetFrameBytes(rec->format, (size_t)rec->width * rec->height);
+    uint32_t maxFrame = 0;
+    for (uint64_t i = 0; i < h->numberOfRecords; ++i) {
+        const struct RawIndexEntry *e = &index[i];
+        if (e->width != rec->width || e->height != rec->height ||
+            e->sampleFormat != rec->format || frameBytes == 0)
+            return Fail("Recording frames differ in size or format");
+        if (e->offset == 0 || e->offset > h->indexOffset ||
+            frameBytes > h->indexOffset - e->offset ||
+            e->channel >= 64 || e->frame == UINT32_MAX)
+            return Fail("Recording has a damaged index");
+        if (e->channel >= rec->numberOfChannels)
+            rec->numberOfChannels = e->channel + 1;
+        if (e->frame > maxFrame)
+            maxFrame = e->frame;
+    }
+
+    size_t count = ((size_t)maxFrame + 1) * rec->numberOfChannels;
+    rec->offsets = calloc(count, sizeof(uint64_t));
+    if (!rec->offsets)
+        return Fail("Out of memory");
+    for (uint64_t i = 0; i < h->numberOfRecords; ++i)
+        rec->offsets[(size_t)index[i].frame * rec->numberOfChannels +
+                     index[i].channel] = index[i].offset;
+
+    // Replay up to the first incomplete frame
+    for (rec->numberOfFrames = 0; rec->numberOfFrames <= maxFrame;
+         ++rec->numberOfFrames) {
+        const uint64_t *offsets =
+            &rec->offsets[(size_t)rec->numberOfFrames *
+                          rec->numberOfChannels];
+        uint32_t c = 0;
+        while (c < rec->numberOfChannels && offsets[c] != 0)
+            ++c;
+        if (c < rec->numberOfChannels)
+            break;
+    }
+    if (rec->numberOfFrames == 0)
+        return Fail("Recording has no complete frames");
+    return OScDev_OK;
+}
+
+static void Recording_Destroy(struct Recording *rec) {
+    if (!rec)
+        return;
+    UnmapFile(rec);
+    free(rec->offsets);
+    free(rec);
+}
+
+static OScDev_Error Recording_Open(struct Recording **rec, const char *path) {
+    struct Recording *r = calloc(1, sizeof(struct Recording));
+    if (!r)
+        return Fail("Out of memory");
+    OScDev_Error err;
+    if (OScDev_CHECK(err, MapFile(r, path))) {
+        free(r);
+        return err;
+    }
+    if (OScDev_CHECK(err, ParseIndex(r))) {
+        Recording_Destroy(r);
+        return err;
+    }
+    *rec = r;
+    return OScDev_OK;
+}
+
+static const char *GetFrameData(struct Recording *rec, uint32_t frame,
+                                uint32_t channel) {
+    return rec->data +
+           rec->offsets[(size_t)frame * rec->numberOfChannels + channel];
+}
+
+// Ask for a frame to be read ahead of its replay
+static void Prefetch(struct Recording *rec, uint32_t frame) {
+    const uint64_t *offsets =
+        &rec->offsets[(size_t)frame * rec->numberOfChannels];
+    uint64_t begin = UINT64_MAX, end = 0;
+    size_t bytes =
+        GetFrameBytes(rec->format, (size_t)rec->width * rec->height);
+    for (uint32_t c = 0; c < rec->numberOfChannels; ++c) {
+        if (offsets[c] < begin)
+            begin = offsets[c];
+        if (offsets[c] + bytes > end)
+            end = offsets[c] + bytes;
+    }
+    AdviseWillNeed(rec, begin, end - begin);
+}
+
+/*
+ * Device
+ */
+
+static OScDev_DeviceImpl g_ReplayDeviceImpl;
+
+enum Speed {
+    SPEED_RECORDED,
+    SPEED_MAXIMUM,
+    NUM_SPEEDS,
+};
+
+static const char *const SPEED_NAMES[NUM_SPEEDS] = {
+    "Recorded pixel rate",
+    "Maximum",
+};
+
+struct ReplayData {
+    char path[OScDev_MAX_STR_SIZE];
+    struct Recording *recording; // NULL if none selected
+    enum Speed speed;
+    bool loop;
+
+    Mutex mutex;
+    Cond cond;
+    Thread thread;
+    bool threadJoinable;
+    bool running; // Armed or replaying
+    bool started;
+    bool stopRequested;
+    bool useDetector;
+    OScDev_Acquisition *acquisition;
+};
+
+static inline struct ReplayData *GetData(OScDev_Device *device) {
+    return (struct ReplayData *)OScDev_Device_GetImplData(device);
+}
+
+static inline struct ReplayData *GetSettingData(OScDev_Setting *setting) {
+    return GetData((OScDev_Device *)OScDev_Setting_GetImplData(setting));
+}
+
+// Wait until due, returning false if a stop is requested
+static bool WaitForFrame(struct ReplayData *data, double due) {
+    Mutex_Lock(&data->mutex);
+    while (!data->stopRequested && due > 0.0 && Now() < due)
+        Cond_WaitUntil(&data->cond, &data->mutex, due);
+    bool stop = data->stopRequested;
+    Mutex_Unlock(&data->mutex);
+    return !stop;
+}
+
+static void Replay(struct ReplayData *data) {
+    struct Recording *rec = data->recording;
+    OScDev_Acquisition *acq = data->acquisition;
+
+    Mutex_Lock(&data->mutex);
+    while (!data->started && !data->stopRequested)
+        Cond_Wait(&data->cond, &data->mutex);
+    Mutex_Unlock(&data->mutex);
+
+    // Frames are due when they would have been scanned
+    double interval = 0.0;
+    if (data->speed == SPEED_RECORDED && rec->pixelRateHz > 0.0)
+        interval = (double)rec->width * rec->height / rec->pixelRateHz;
+    uint32_t totalFrames = OScDev_Acquisition_GetNumberOfFrames(acq);
+    if (!data->loop && totalFrames > rec->numberOfFrames)
+        totalFrames = rec->numberOfFrames;
+
+    AdviseSequential(rec);
+    for (uint32_t f = 0; f < PREFETCH_FRAMES && f < totalFrames; ++f)
+        Prefetch(rec, f % rec->numberOfFrames);
+    double start = Now();
+    for (uint32_t n = 0; n < totalFrames; ++n) {
+        if (n + PREFETCH_FRAMES < totalFrames)
+            Prefetch(rec, (n + PREFETCH_FRAMES) % rec->numberOfFrames);
+        if (!WaitForFrame(data, interval > 0.0 ? start + (n + 1) * interval
+                                               : 0.0))
+            break;
+        if (!data->useDetector)
+            continue;
+        uint32_t frame = n % rec->numberOfFrames;
+        bool proceed = true;
+        for (uint32_t c = 0; proceed && c < rec->numberOfChannels; ++c)
+            proceed = OScDev_Acquisition_CallFrameCallback(
+                acq, c, (void *)GetFrameData(rec, frame, c));
+        if (!proceed)
+            break;
+    }
+
+    Mutex_Lock(&data->mutex);
+    data->running = false;
+    Cond_Broadcast(&data->cond);
+    Mutex_Unlock(&data->mutex);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI ThreadMain(void *param) {
+    Replay(param);
+    return 0;
+}
+#else
+static void *ThreadMain(void *param) {
+    Replay(param);
+    return NULL;
+}
+#endif
+
+// Wait for the replay to finish (after a stop request, if 'stop')
+static OScDev_Error Finish(OScDev_Device *device, bool stop) {
+    struct ReplayData *data = GetData(device);
+    Mutex_Lock(&data->mutex);
+    if (stop && data->running) {
+        data->stopRequested = true;
+        Cond_Broadcast(&data->cond);
+    }
+    while (data->running)
+        Cond_Wait(&data->cond, &data->mutex);
+    bool join = data->threadJoinable;
+    data->threadJoinable = false;
+    Mutex_Unlock(&data->mutex);
+    if (join)
+        Thread_Join(data->thread);
+    return OScDev_OK;
+}
+
+/*
+ * Settings
+ */
+
+static OScDev_Error GetRecordingFile(OScDev_Setting *setting, char *value) {
+    strncpy(value, GetSettingData(setting)->path, OScDev_MAX_STR_LEN);
+    value[OScDev_MAX_STR_LEN] = '\0';
+    return OScDev_OK;
+}
+
+static OScDev_Error SetRecordingFile(OScDev_Setting *setting,
+                                     const char *value) {
+    struct ReplayData *data = GetSettingData(setting);
+    Mutex_Lock(&data->mutex);
+    bool running = data->running;
+    Mutex_Unlock(&data->mutex);
+    if (running)
+        return Fail("Cannot change the recording during an acquisition");
+
+    struct Recording *rec = NULL;
+    OScDev_Error err;
+    if (value[0] != '\0' && OScDev_CHECK(err, Recording_Open(&rec, value)))
+        return err;
+    Recording_Destroy(data->recording);
+    data->recording = rec;
+    strncpy(data->path, value, OScDev_MAX_STR_LEN);
+    data->path[OScDev_MAX_STR_LEN] = '\0';
+    return OScDev_OK;
+}
+
+static OScDev_SettingImpl SettingImpl_RecordingFile = {
+    .GetString = GetRecordingFile,
+    .SetString = SetRecordingFile,
+};
+
+static OScDev_Error GetSpeed(OScDev_Setting *setting, uint32_t *value) {
+    *value = GetSettingData(setting)->speed;
+    return OScDev_OK;
+}
+
+static OScDev_Error SetSpeed(OScDev_Setting *setting, uint32_t value) {
+    GetSettingData(setting)->speed = (enum Speed)value;
+    return OScDev_OK;
+}
+
+static OScDev_Error GetSpeedNumValues(OScDev_Setting *setting,
+                                      uint32_t *count) {
+    (void)setting;
+    *count = NUM_SPEEDS;
+    return OScDev_OK;
+}
+
+static OScDev_Error GetSpeedNameForValue(OScDev_Setting *setting,
+                                         uint32_t value, char *name) {
+    (void)setting;
+    if (value >= NUM_SPEEDS)
+        return OScDev_Error_Illegal_Argument;
+    strncpy(name, SPEED_NAMES[value], OScDev_MAX_STR_LEN);
+    return OScDev_OK;
+}
+
+static OScDev_Error GetSpeedValueForName(OScDev_Setting *setting,
+                                         uint32_t *value, const char *name) {
+    (void)setting;
+    for (uint32_t i = 0; i < NUM_SPEEDS; ++i) {
+        if (strcmp(name, SPEED_NAMES[i]) == 0) {
+            *value = i;
+            return OScDev_OK;
+        }
+    }
+    return OScDev_Error_Unknown_Enum_Value_Name;
+}
+
+static OScDev_SettingImpl SettingImpl_Speed = {
+    .GetEnum = GetSpeed,
+    .SetEnum = SetSpeed,
+    .GetEnumNumValues = GetSpeedNumValues,
+    .GetEnumNameForValue = GetSpeedNameForValue,
+    .GetEnumValueForName = GetSpeedValueForName,
+};
+
+static OScDev_Error GetLoop(OScDev_Setting *setting, bool *value) {
+    *value = GetSettingData(setting)->loop;
+    return OScDev_OK;
+}
+
+static OScDev_Error SetLoop(OScDev_Setting *setting, bool value) {
+    GetSettingData(setting)->loop = value;
+    return OScDev_OK;
+}
+
+static OScDev_SettingImpl SettingImpl_Loop = {
+    .GetBool = GetLoop,
+    .SetBool = SetLoop,
+};
+
+/*
+ * Device implementation
+ */
+
+static OScDev_Error GetModelName(const char **name) {
+    *name = DEVICE_NAME;
+    return OScDev_OK;
+}
+
+static OScDev_Error EnumerateInstances(OScDev_PtrArray **devices) {
+    struct ReplayData *data = calloc(1, sizeof(struct ReplayData));
+    if (!data)
+        return Fail("Out of memory");
+    Mutex_Init(&data->mutex);
+    Cond_Init(&data->cond);
+
+    OScDev_Device *device;
+    OScDev_Error err;
+    if (OScDev_CHECK(err, OScDev_Device_Create(&device, &g_ReplayDeviceImpl,
+                                               data))) {
+        Cond_Destroy(&data->cond);
+        Mutex_Destroy(&data->mutex);
+        free(data);
+        return err;
+    }
+    *devices = OScDev_PtrArray_Create();
+    OScDev_PtrArray_Append(*devices, device);
+    return OScDev_OK;
+}
+
+static OScDev_Error ReleaseInstance(OScDev_Device *device) {
+    struct ReplayData *data = GetData(device);
+    Recording_Destroy(data->recording);
+    Cond_Destroy(&data->cond);
+    Mutex_Destroy(&data->mutex);
+    free(data);
+    return OScDev_OK;
+}
+
+static OScDev_Error GetName(OScDev_Device *device, char *name) {
+    (void)device;
+    strncpy(name, DEVICE_NAME, OScDev_MAX_STR_LEN);
+    return OScDev_OK;
+}
+
+static OScDev_Error Open(OScDev_Device *device) {
+    (void)device;
+    return OScDev_OK;
+}
+
+static OScDev_Error Close(OScDev_Device *device) {
+    return Finish(device, true);
+}
+
+static OScDev_Error HasRole(OScDev_Device *device, bool *has) {
+    (void)device;
+    *has = true;
+    return OScDev_OK;
+}
+
+static OScDev_Error GetPixelRates(OScDev_Device *device,
+                                  OScDev_NumRange **pixelRatesHz) {
+    (void)device;
+    // Replay follows the recorded pixel rate, whatever is requested
+    *pixelRatesHz = OScDev_NumRange_CreateContinuous(1.0, 1e10);
+    return OScDev_OK;
+}
+
+static OScDev_Error GetResolutions(OScDev_Device *device,
+                                   OScDev_NumRange **resolutions) {
+    (void)device;
+    *resolutions = OScDev_NumRange_CreateContinuous(1.0, 65536.0);
+    return OScDev_OK;
+}
+
+static OScDev_Error IsROIScanSupported(OScDev_Device *device,
+                                       bool *supported) {
+    (void)device;
+    *supported = true;
+    return OScDev_OK;
+}
+
+static OScDev_Error GetNumberOfChannels(OScDev_Device *device,
+                                        uint32_t *nChannels) {
+    struct Recording *rec = GetData(device)->recording;
+    *nChannels = rec ? rec->numberOfChannels : 1;
+    return OScDev_OK;
+}
+
+static OScDev_Error GetSampleFormat(OScDev_Device *device, uint32_t channel,
+                                    OScDev_SampleFormat *format) {
+    (void)channel;
+    struct Recording *rec = GetData(device)->recording;
+    *format = rec ? rec->format : OScDev_SampleFormat_UInt16;
+    return OScDev_OK;
+}
+
+static OScDev_Error GetBytesPerSample(OScDev_Device *device,
+                                      uint32_t *bytesPerSample) {
+    OScDev_SampleFormat format;
+    GetSampleFormat(device, 0, &format);
+    *bytesPerSample = (uint32_t)GetFrameBytes(format, 2) / 2;
+    if (*bytesPerSample == 0)
+        *bytesPerSample = 2;
+    return OScDev_OK;
+}
+
+static OScDev_Error MakeSettings(OScDev_Device *device,
+                                 OScDev_PtrArray **settings) {
+    OScDev_Error err = OScDev_OK;
+    *settings = OScDev_PtrArray_Create();
+
+    OScDev_Setting *file;
+    if (OScDev_CHECK(err, OScDev_Setting_Create(&file, "Recording file",
+                                                OScDev_ValueType_String,
+                                                &SettingImpl_RecordingFile,
+                                                device)))
+        goto error;
+    OScDev_PtrArray_Append(*settings, file);
+
+    OScDev_Setting *speed;
+    if (OScDev_CHECK(err, OScDev_Setting_Create(&speed, "Replay speed",
+                                                OScDev_ValueType_Enum,
+                                                &SettingImpl_Speed, device)))
+        goto error;
+    OScDev_PtrArray_Append(*settings, speed);
+
+    OScDev_Setting *loop;
+    if (OScDev_CHECK(err, OScDev_Setting_Create(&loop, "Loop",
+                                                OScDev_ValueType_Bool,
+                                                &SettingImpl_Loop, device)))
+        goto error;
+    OScDev_PtrArray_Append(*settings, loop);
+
+    return OScDev_OK;
+
+error:
+    for (size_t i = 0; i < OScDev_PtrArray_Size(*settings); ++i) {
+        OScDev_Setting_Destroy(OScDev_PtrArray_At(*settings, i));
+    }
+    OScDev_PtrArray_Destroy(*settings);
+    *settings = NULL;
+    return err;
+}
+
+static OScDev_Error Arm(OScDev_Device *device, OScDev_Acquisition *acq) {
+    struct ReplayData *data = GetData(device);
+    struct Recording *rec = data->recording;
+    if (!rec)
+        return Fail("No recording selected for replay");
+
+    bool useClock, useScanner, useDetector;
+    OScDev_Acquisition_IsClockRequested(acq, &useClock);
+    OScDev_Acquisition_IsScannerRequested(acq, &useScanner);
+    OScDev_Acquisition_IsDetectorRequested(acq, &useDetector);
+    OScDev_TriggerSource startTrigger = OScDev_TriggerSource_Software;
+    if (useClock)
+        OScDev_Acquisition_GetClockStartTriggerSource(acq, &startTrigger);
+
+    if (useDetector) {
+        uint32_t xOffset, yOffset, width, height;
+        OScDev_Acquisition_GetROI(acq, &xOffset, &yOffset, &width, &height);
+        if (width != rec->width || height != rec->height) {
+            char msg[OScDev_MAX_STR_SIZE];
+            snprintf(msg, sizeof(msg),
+                     "Raster size (%ux%u) differs from the recording "
+                     "(%ux%u)",
+                     (unsigned)width, (unsigned)height, (unsigned)rec->width,
+                     (unsigned)rec->height);
+            return Fail(msg);
+        }
+        if (OScDev_Acquisition_GetSamplesPerPixel(acq) != 1)
+            return Fail("Replay cannot oversample pixels");
+    }
+
+    Mutex_Lock(&data->mutex);
+    if (data->running) {
+        Mutex_Unlock(&data->mutex);
+        return Fail("Acquisition already armed or running");
+    }
+    bool join = data->threadJoinable;
+    data->threadJoinable = false;
+    Mutex_Unlock(&data->mutex);
+    if (join) // Finished on its own, but not yet waited for
+        Thread_Join(data->thread);
+
+    data->acquisition = acq;
+    data->useDetector = useDetector;
+    data->stopRequested = false;
+    // Without a software start by us, replay starts when armed
+    data->started = !useClock || startTrigger != OScDev_TriggerSource_Software;
+    data->running = true;
+    if (!Thread_Start(&data->thread, data)) {
+        data->running = false;
+        return Fail("Cannot start replay thread");
+    }
+    data->threadJoinable = true;
+    return OScDev_OK;
+}
+
+static OScDev_Error Start(OScDev_Device *device) {
+    struct ReplayData *data = GetData(device);
+    Mutex_Lock(&data->mutex);
+    if (!data->running || data->started) {
+        Mutex_Unlock(&data->mutex);
+        return Fail(data->running ? "Acquisition running" : "Not armed");
+    }
+    data->started = true;
+    Cond_Broadcast(&data->cond);
+    Mutex_Unlock(&data->mutex);
+    return OScDev_OK;
+}
+
+static OScDev_Error Stop(OScDev_Device *device) {
+    return Finish(device, true);
+}
+
+static OScDev_Error IsRunning(OScDev_Device *device, bool *isRunning) {
+    struct ReplayData *data = GetData(device);
+    Mutex_Lock(&data->mutex);
+    *isRunning = data->running;
+    Mutex_Unlock(&data->mutex);
+    return OScDev_OK;
+}
+
+static OScDev_Error Wait(OScDev_Device *device) {
+    return Finish(device, false);
+}
+
+static OScDev_DeviceImpl g_ReplayDeviceImpl = {
+    .GetModelName = GetModelName,
+    .EnumerateInstances = EnumerateInstances,
+    .ReleaseInstance = ReleaseInstance,
+    .GetName = GetName,
+    .Open = Open,
+    .Close = Close,
+    .HasClock = HasRole,
+    .HasScanner = HasRole,
+    .HasDetector = HasRole,
+    .MakeSettings = MakeSettings,
+    .GetPixelRates = GetPixelRates,
+    .GetResolutions = GetResolutions,
+    .IsROIScanSupported = IsROIScanSupported,
+    .GetNumberOfChannels = GetNumberOfChannels,
+    .GetBytesPerSample = GetBytesPerSample,
+    .Arm = Arm,
+    .Start = Start,
+    .Stop = Stop,
+    .IsRunning = IsRunning,
+    .Wait = Wait,
+    .GetSampleFormat = GetSampleFormat,
+};
+
+static OScDev_Error GetDeviceImpls(OScDev_PtrArray **deviceImpls) {
+    *deviceImpls = OScDev_PtrArray_CreateFromNullTerminated(
+        (OScDev_DeviceImpl *[]){&g_ReplayDeviceImpl, NULL});
+    return OScDev_OK;
+}
+
+OScDev_MODULE_IMPL = {
+    .supportsRichErrors = true,
+    .displayName = "Replay Device Module for OpenScan",
+    .GetDeviceImpls = GetDeviceImpls,
+};